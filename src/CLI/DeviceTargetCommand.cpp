@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "DeviceTargetCommand.hpp"
+
+#include <IPCClient.hpp>
+#include <iostream>
+#include <set>
+#include <vector>
+
+namespace usbguard
+{
+  static const char *options_short = "hpq:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "permanent", no_argument, nullptr, 'p' },
+    { "query", required_argument, nullptr, 'q' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream, const char *command, Rule::Target target)
+  {
+    const String target_string = Rule::targetToString(target);
+
+    stream << " Usage: " << usbguard_arg0 << " " << command << " [OPTIONS] <device-id> [<device-id> ...]" << std::endl;
+    stream << std::endl;
+    stream << " A device-id of - reads whitespace separated device ids from stdin." << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -p, --permanent      Make the decision permanent. A device specific " << target_string << std::endl;
+    stream << "                       rule will be appended to or updated in the current policy." << std::endl;
+    stream << "  -q, --query <query>  Apply the decision to all devices matching the query," << std::endl;
+    stream << "                       e.g. 'match with-interface 03:*:*' or 'id 1234:*'." << std::endl;
+    stream << "  -h, --help           Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  /*
+   * Queries may leave out the rule target, e.g. just `id 1234:*'.
+   */
+  static String normalizeQuery(const String& query)
+  {
+    try {
+      Rule::fromString(query);
+      return query;
+    }
+    catch(...) {
+      return "match " + query;
+    }
+  }
+
+  int usbguard_apply_device_target(int argc, char **argv, const char *command, Rule::Target target)
+  {
+    bool permanent = false;
+    std::vector<String> queries;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout, command, target);
+          return EXIT_SUCCESS;
+        case 'p':
+          permanent = true;
+          break;
+        case 'q':
+          queries.push_back(normalizeQuery(optarg));
+          break;
+        case '?':
+          showHelp(std::cerr, command, target);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1 && queries.empty()) {
+      showHelp(std::cerr, command, target);
+      return EXIT_FAILURE;
+    }
+
+    std::vector<uint32_t> ids;
+
+    for (int i = 0; i < argc; ++i) {
+      const String arg(argv[i]);
+      if (arg == "-") {
+        String id_string;
+        while (std::cin >> id_string) {
+          ids.push_back(std::stoul(id_string));
+        }
+      }
+      else {
+        ids.push_back(std::stoul(arg));
+      }
+    }
+
+    usbguard::IPCClient ipc(/*connected=*/true);
+
+    for (auto const& query : queries) {
+      for (auto const& device_rule : ipc.listDevices(query)) {
+        ids.push_back(device_rule.getRuleID());
+      }
+    }
+
+    /* Each device once, in the order given */
+    std::vector<Interface::DeviceTarget> targets;
+    std::set<uint32_t> seen_ids;
+
+    for (const uint32_t id : ids) {
+      if (seen_ids.insert(id).second) {
+        targets.push_back({ id, target });
+      }
+    }
+
+    if (!targets.empty()) {
+      ipc.applyDevicePolicy(targets, permanent, 0);
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
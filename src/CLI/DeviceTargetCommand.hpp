@@ -0,0 +1,32 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include <Rule.hpp>
+
+namespace usbguard
+{
+  /*
+   * Shared implementation of the allow-device, block-device and
+   * reject-device commands: apply `target' to the devices given
+   * by id, read from stdin or matched by a query, using a single
+   * IPC connection and request.
+   */
+  int usbguard_apply_device_target(int argc, char **argv, const char *command, Rule::Target target);
+} /* namespace usbguard */
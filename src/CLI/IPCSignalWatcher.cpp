@@ -18,16 +18,114 @@
 //
 #include <iostream>
 #include "IPCSignalWatcher.hpp"
+#include "IPCPrivate.hpp"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
 
 namespace usbguard
 {
+  /*
+   * With FlushPolicy::Size, the output is written once the
+   * buffered events reach this size.
+   */
+  static const size_t G_output_buffer_size = 64 * 1024;
+
+  static json interfacesToJSON(const std::vector<USBInterfaceType>& interfaces)
+  {
+    json interfaces_json = json::array();
+    for (auto const& interface : interfaces) {
+      interfaces_json.push_back(interface.typeString());
+    }
+    return interfaces_json;
+  }
+
+  IPCSignalWatcher::IPCSignalWatcher(Format format, FlushPolicy flush_policy)
+    : _format(format),
+      _flush_policy(flush_policy)
+  {
+    if (_format != Format::Text) {
+      _buffer.reserve(G_output_buffer_size);
+    }
+  }
+
+  IPCSignalWatcher::~IPCSignalWatcher()
+  {
+    flush();
+  }
+
+  void IPCSignalWatcher::writeEvent(const json& event)
+  {
+    switch(_format) {
+      case Format::JSONLines:
+        IPCPrivate::encodeMessage(event, IPCPrivate::WireFormat::JSON, _encoded);
+        _buffer.append(_encoded);
+        _buffer.push_back('\n');
+        break;
+      case Format::Binary:
+        {
+          IPCPrivate::encodeMessage(event, IPCPrivate::WireFormat::MessagePack, _encoded);
+          const uint32_t size = _encoded.size();
+          for (unsigned int i = 0; i < 4; ++i) {
+            _buffer.push_back(static_cast<char>((size >> (8 * i)) & 0xff));
+          }
+          _buffer.append(_encoded);
+        }
+        break;
+      case Format::Text:
+        throw std::runtime_error("BUG: writeEvent called in the text format");
+    }
+
+    if (_flush_policy == FlushPolicy::Event || _buffer.size() >= G_output_buffer_size) {
+      flush();
+    }
+    return;
+  }
+
+  void IPCSignalWatcher::flush()
+  {
+    size_t offset = 0;
+
+    while (offset < _buffer.size()) {
+      const ssize_t written = ::write(STDOUT_FILENO, _buffer.data() + offset, _buffer.size() - offset);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cerr << "Cannot write the output: " << strerror(errno) << std::endl;
+        break;
+      }
+      offset += written;
+    }
+
+    _buffer.clear();
+    return;
+  }
+
   void IPCSignalWatcher::IPCConnected()
   {
+    if (_format != Format::Text) {
+      writeEvent({ { "event", "IPCConnected" } });
+      return;
+    }
     std::cout << "[IPC] Connected" << std::endl;
   }
 
   void IPCSignalWatcher::IPCDisconnected(bool exception_initiated, const IPCException& exception)
   {
+    if (_format != Format::Text) {
+      json event = {
+        {               "event", "IPCDisconnected" },
+        { "exception_initiated", exception_initiated }
+      };
+      if (exception_initiated) {
+        event["reason"] = exception.codeAsString();
+        event["message"] = exception.message();
+      }
+      writeEvent(event);
+      return;
+    }
     std::cout << "[IPC] Disconnected: exception_initiated=" << exception_initiated;
     if (exception_initiated) {
       std::cout << " reason=" << exception.codeAsString();
@@ -38,6 +136,17 @@ namespace usbguard
 
   void IPCSignalWatcher::DeviceInserted(uint32_t id, const std::map< std::string, std::string >& attributes, const std::vector< USBInterfaceType >& interfaces, bool rule_match, uint32_t rule_id)
   {
+    if (_format != Format::Text) {
+      writeEvent({
+        {      "event", "DeviceInserted" },
+        {         "id", id },
+        { "attributes", attributes },
+        { "interfaces", interfacesToJSON(interfaces) },
+        { "rule_match", rule_match },
+        {    "rule_id", rule_id }
+      });
+      return;
+    }
     std::cout << "[device] Inserted: id=" << id;
     for (auto attribute : attributes) {
       std::cout << " " << attribute.first << "=" << attribute.second;
@@ -54,6 +163,16 @@ namespace usbguard
 
   void IPCSignalWatcher::DevicePresent(uint32_t id, const std::map< std::string, std::string >& attributes, const std::vector< USBInterfaceType >& interfaces, Rule::Target target)
   {
+    if (_format != Format::Text) {
+      writeEvent({
+        {      "event", "DevicePresent" },
+        {         "id", id },
+        { "attributes", attributes },
+        { "interfaces", interfacesToJSON(interfaces) },
+        {     "target", Rule::targetToString(target) }
+      });
+      return;
+    }
     std::cout << "[device] Present: id=" << id;
     for (auto attribute : attributes) {
       std::cout << " " << attribute.first << "=" << attribute.second;
@@ -69,6 +188,14 @@ namespace usbguard
 
   void IPCSignalWatcher::DeviceRemoved(uint32_t id, const std::map< std::string, std::string >& attributes)
   {
+    if (_format != Format::Text) {
+      writeEvent({
+        {      "event", "DeviceRemoved" },
+        {         "id", id },
+        { "attributes", attributes }
+      });
+      return;
+    }
     std::cout << "[device] Removed: id=" << id;
     for (auto attribute : attributes) {
       std::cout << " " << attribute.first << "=" << attribute.second;
@@ -78,6 +205,16 @@ namespace usbguard
 
   void IPCSignalWatcher::DeviceAllowed(uint32_t id, const std::map< std::string, std::string >& attributes, bool rule_match, uint32_t rule_id)
   {
+    if (_format != Format::Text) {
+      writeEvent({
+        {      "event", "DeviceAllowed" },
+        {         "id", id },
+        { "attributes", attributes },
+        { "rule_match", rule_match },
+        {    "rule_id", rule_id }
+      });
+      return;
+    }
     std::cout << "[device] Allowed: id=" << id;
     for (auto attribute : attributes) {
       std::cout << " " << attribute.first << "=" << attribute.second;
@@ -89,6 +226,16 @@ namespace usbguard
 
   void IPCSignalWatcher::DeviceBlocked(uint32_t id, const std::map< std::string, std::string >& attributes, bool rule_match, uint32_t rule_id)
   {
+    if (_format != Format::Text) {
+      writeEvent({
+        {      "event", "DeviceBlocked" },
+        {         "id", id },
+        { "attributes", attributes },
+        { "rule_match", rule_match },
+        {    "rule_id", rule_id }
+      });
+      return;
+    }
     std::cout << "[device] Blocked: id=" << id;
     for (auto attribute : attributes) {
       std::cout << " " << attribute.first << "=" << attribute.second;
@@ -100,6 +247,16 @@ namespace usbguard
 
   void IPCSignalWatcher::DeviceRejected(uint32_t id, const std::map< std::string, std::string >& attributes, bool rule_match, uint32_t rule_id)
   {
+    if (_format != Format::Text) {
+      writeEvent({
+        {      "event", "DeviceRejected" },
+        {         "id", id },
+        { "attributes", attributes },
+        { "rule_match", rule_match },
+        {    "rule_id", rule_id }
+      });
+      return;
+    }
     std::cout << "[device] Rejected: id=" << id;
     for (auto attribute : attributes) {
       std::cout << " " << attribute.first << "=" << attribute.second;
@@ -108,4 +265,24 @@ namespace usbguard
     std::cout << " rule_match=" << rule_match;
     std::cout << " rule_id=" << rule_id << std::endl;
   }
+
+  void IPCSignalWatcher::RuleChanged(uint32_t id, bool removed, const std::string& rule_spec, uint64_t generation)
+  {
+    if (_format != Format::Text) {
+      writeEvent({
+        {      "event", "RuleChanged" },
+        {         "id", id },
+        {    "removed", removed },
+        {       "rule", rule_spec },
+        { "generation", generation }
+      });
+      return;
+    }
+
+    std::cout << "[rule] " << (removed ? "Removed" : "Changed") << ": id=" << id;
+    if (!removed) {
+      std::cout << " rule=" << rule_spec;
+    }
+    std::cout << " generation=" << generation << std::endl;
+  }
 } /* namespace usbguard */
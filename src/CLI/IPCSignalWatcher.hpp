@@ -18,12 +18,38 @@
 //
 #pragma once
 #include <IPCClient.hpp>
+#include "Common/JSON.hpp"
+
+#include <string>
 
 namespace usbguard
 {
   class IPCSignalWatcher : public IPCClient
   {
   public:
+    /*
+     * Output formats. JSONLines writes one JSON object per line.
+     * Binary writes each event as a MessagePack map prefixed with
+     * its size as a 32-bit little-endian integer.
+     */
+    enum class Format {
+      Text,
+      JSONLines,
+      Binary
+    };
+
+    /*
+     * When to write the buffered output: after each event, or
+     * only once the buffer is full (and on destruction).
+     */
+    enum class FlushPolicy {
+      Event,
+      Size
+    };
+
+    IPCSignalWatcher(Format format = Format::Text, FlushPolicy flush_policy = FlushPolicy::Event);
+    ~IPCSignalWatcher();
+
     void IPCConnected() override;
     void IPCDisconnected(bool exception_initiated, const IPCException& exception) override;
 
@@ -55,5 +81,19 @@ namespace usbguard
                         const std::map<std::string,std::string>& attributes,
                         bool rule_match,
                         uint32_t rule_id) override;
+
+    void RuleChanged(uint32_t id,
+                     bool removed,
+                     const std::string& rule_spec,
+                     uint64_t generation) override;
+
+  private:
+    void writeEvent(const json& event);
+    void flush();
+
+    const Format _format;
+    const FlushPolicy _flush_policy;
+    std::string _buffer;
+    std::string _encoded;
   };
 } /* namespace usbguard */
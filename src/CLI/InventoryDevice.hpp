@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include <Typedefs.hpp>
+#include <Device.hpp>
+#include <DeviceManager.hpp>
+#include <DeviceManagerHooks.hpp>
+#include <stdexcept>
+
+namespace usbguard
+{
+  /*
+   * A device loaded from an inventory snapshot. All the values are
+   * taken from the snapshot, nothing is read from the system.
+   */
+  class InventoryDevice : public Device
+  {
+  public:
+    InventoryDevice(DeviceManager& manager)
+      : Device(manager),
+        _is_controller(false)
+    {
+    }
+
+    bool isController() const
+    {
+      return _is_controller;
+    }
+
+    void setController(bool state)
+    {
+      _is_controller = state;
+    }
+
+  private:
+    bool _is_controller;
+  };
+
+  /*
+   * Owner of the inventory devices. It only satisfies the Device
+   * constructor, the devices are never inserted or authorized.
+   */
+  class InventoryDeviceManager : public DeviceManager
+  {
+  public:
+    InventoryDeviceManager(DeviceManagerHooks& hooks)
+      : DeviceManager(hooks)
+    {
+    }
+
+    void setDefaultBlockedState(bool state) { (void)state; }
+    void start() {}
+    void stop() {}
+    void scan() {}
+
+    Pointer<Device> allowDevice(uint32_t id)
+    {
+      (void)id;
+      throw std::runtime_error("BUG: Inventory devices cannot be authorized");
+    }
+
+    Pointer<Device> blockDevice(uint32_t id)
+    {
+      (void)id;
+      throw std::runtime_error("BUG: Inventory devices cannot be authorized");
+    }
+
+    Pointer<Device> rejectDevice(uint32_t id)
+    {
+      (void)id;
+      throw std::runtime_error("BUG: Inventory devices cannot be authorized");
+    }
+  };
+} /* namespace usbguard */
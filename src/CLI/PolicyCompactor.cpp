@@ -0,0 +1,149 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "PolicyCompactor.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+
+namespace usbguard
+{
+  namespace
+  {
+    /*
+     * Rules with conditions aren't merged: the state of a condition
+     * may be specific to the rule, e.g. for rule-applied.
+     */
+    bool isCompactable(const Rule& rule)
+    {
+      return rule.attributeConditions().empty() &&
+        rule.getTarget() != Rule::Target::Invalid;
+    }
+
+    template<typename T>
+    bool isMergeable(const Rule::Attribute<T>& attribute)
+    {
+      switch(attribute.setOperator()) {
+        case Rule::SetOperator::Equals:
+          return attribute.count() == 1;
+        case Rule::SetOperator::OneOf:
+          return attribute.count() > 0;
+        default:
+          return false;
+      }
+    }
+
+    /*
+     * Merge the rules which are equal except for the attribute. The
+     * merged rule takes the place of the first one. Returns true if
+     * any rules were merged.
+     */
+    template<typename T>
+    bool compactAttribute(std::vector<Rule>& rules, Rule::Attribute<T>& (Rule::*attribute)())
+    {
+      struct Group
+      {
+        size_t index;
+        std::unordered_set<String> values;
+      };
+
+      std::unordered_map<String, Group> groups;
+      std::vector<Rule> result;
+
+      for (Rule& rule : rules) {
+        if (!isCompactable(rule) || !isMergeable((rule.*attribute)())) {
+          result.push_back(rule);
+          continue;
+        }
+
+        Rule key_rule(rule);
+        (key_rule.*attribute)().clear();
+        const auto group = groups.emplace(key_rule.toString(), Group { result.size(), { } });
+
+        if (group.second) {
+          result.push_back(rule);
+        }
+
+        auto& values = group.first->second.values;
+        auto& merged_attribute = (result[group.first->second.index].*attribute)();
+
+        if (!group.second) {
+          merged_attribute.setSetOperator(Rule::SetOperator::OneOf);
+        }
+
+        for (auto const& value : (rule.*attribute)().values()) {
+          String value_string;
+          appendRuleString(value_string, value);
+
+          if (values.insert(value_string).second && !group.second) {
+            merged_attribute.values().push_back(value);
+          }
+        }
+      }
+
+      if (result.size() == rules.size()) {
+        return false;
+      }
+
+      rules.swap(result);
+      return true;
+    }
+
+    void compactRun(std::vector<Rule>& rules)
+    {
+      bool changed = true;
+
+      /*
+       * A merge can make other rules equal except for another
+       * attribute, e.g. the same serial numbers used with two
+       * device ids.
+       */
+      while (changed) {
+        changed = false;
+        changed |= compactAttribute(rules, &Rule::attributeSerial);
+        changed |= compactAttribute(rules, &Rule::attributeHash);
+        changed |= compactAttribute(rules, &Rule::attributeParentHash);
+        changed |= compactAttribute(rules, &Rule::attributeViaPort);
+        changed |= compactAttribute(rules, &Rule::attributeName);
+        changed |= compactAttribute(rules, &Rule::attributeDeviceID);
+      }
+      return;
+    }
+  } /* namespace */
+
+  std::vector<Rule> PolicyCompactor::compact(const std::vector<Rule>& rules)
+  {
+    std::vector<Rule> result;
+    size_t begin = 0;
+
+    while (begin < rules.size()) {
+      size_t end = begin + 1;
+
+      while (end < rules.size() && rules[end].getTarget() == rules[begin].getTarget()) {
+        ++end;
+      }
+
+      std::vector<Rule> run(rules.begin() + begin, rules.begin() + end);
+      compactRun(run);
+      result.insert(result.end(), run.begin(), run.end());
+      begin = end;
+    }
+
+    return result;
+  }
+} /* namespace usbguard */
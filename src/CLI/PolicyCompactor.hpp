@@ -0,0 +1,47 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <Rule.hpp>
+#include <vector>
+
+namespace usbguard
+{
+  /*
+   * Merges rules which differ only in the value of one single valued
+   * attribute (id, serial, name, hash, parent-hash or via-port) into
+   * one rule with a one-of set of the values, e.g.
+   *
+   *   allow id 1234:5678 serial "A"
+   *   allow id 1234:5678 serial "B"
+   *
+   * into
+   *
+   *   allow id 1234:5678 serial one-of { "A" "B" }
+   *
+   * A device has exactly one value of these attributes, so the
+   * merged rule matches exactly the devices matched by any of the
+   * original rules. Only rules with the same target which follow
+   * each other are merged, so the first matching target for any
+   * device stays the same.
+   */
+  class PolicyCompactor
+  {
+  public:
+    static std::vector<Rule> compact(const std::vector<Rule>& rules);
+  };
+} /* namespace usbguard */
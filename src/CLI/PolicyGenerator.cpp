@@ -17,9 +17,195 @@
 // Authors: Daniel Kopecek <dkopecek@redhat.com>
 //
 #include "PolicyGenerator.hpp"
+#include "PolicyCompactor.hpp"
+#include "InventoryDevice.hpp"
+#include "Base64.hpp"
+#include "DeviceSnapshot.hpp"
+#include "Common/JSON.hpp"
+#include "Common/ThreadPool.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace usbguard
 {
+  namespace
+  {
+    /*
+     * A device of an inventory snapshot. The parent device is the
+     * device of the same snapshot whose key equals parent_key. If
+     * there's no such device, the device is connected to a controller
+     * and parent_hash is used, or, if empty, the hash of parent_key.
+     */
+    struct InventoryEntry
+    {
+      String source; /* <path>:<machine>:<index> for error messages */
+      String key;
+      String parent_key;
+      String parent_hash;
+      String port;
+      String name;
+      String vendor_id;
+      String product_id;
+      String serial;
+      String descriptors; /* Raw descriptor data */
+      Pointer<InventoryDevice> device;
+      Pointer<Rule> rule;
+    };
+
+    typedef std::vector<InventoryEntry> InventorySnapshot;
+
+    String jsonString(const json& object, const char *key)
+    {
+      const auto it = object.find(key);
+      if (it == object.end() || it->is_null()) {
+        return String();
+      }
+      return it->get<String>();
+    }
+
+    void loadInventorySnapshot(const String& path, const json& snapshot_json, size_t snapshot_index,
+                               std::vector<InventorySnapshot>& snapshots)
+    {
+      if (!snapshot_json.is_object()) {
+        throw std::runtime_error(path + ": inventory snapshot is not an object");
+      }
+      if (snapshot_json.value("version", 1) != 1) {
+        throw std::runtime_error(path + ": unsupported inventory snapshot version");
+      }
+
+      const String machine = snapshot_json.value("machine", std::to_string(snapshot_index));
+      const auto& devices_json = snapshot_json.at("devices");
+      InventorySnapshot snapshot;
+
+      for (size_t i = 0; i < devices_json.size(); ++i) {
+        const json& device_json = devices_json.at(i);
+        InventoryEntry entry;
+
+        entry.source = path + ":" + machine + ":" + std::to_string(i);
+        entry.key = jsonString(device_json, "syspath");
+        entry.parent_key = jsonString(device_json, "parent_syspath");
+        entry.port = entry.key.substr(entry.key.find_last_of('/') + 1);
+        entry.name = jsonString(device_json, "name");
+        entry.vendor_id = jsonString(device_json, "vendor_id");
+        entry.product_id = jsonString(device_json, "product_id");
+        entry.serial = jsonString(device_json, "serial");
+        entry.descriptors = base64Decode(jsonString(device_json, "descriptors"));
+
+        if (entry.key.empty() || entry.parent_key.empty()) {
+          throw std::runtime_error(entry.source + ": syspath and parent_syspath values are required");
+        }
+
+        snapshot.push_back(std::move(entry));
+      }
+
+      snapshots.push_back(std::move(snapshot));
+      return;
+    }
+
+    /*
+     * An inventory file contains one snapshot object or an array of
+     * snapshot objects, one per machine:
+     *
+     *   { "version": 1, "machine": "<name>",
+     *     "devices": [ { "syspath": "...", "parent_syspath": "...",
+     *                    "name": "...", "vendor_id": "...", "product_id": "...",
+     *                    "serial": "...", "descriptors": "<base64>" }, ... ] }
+     *
+     * The values are the udev device attributes and the content of
+     * the descriptors sysfs file of each USB device.
+     */
+    /*
+     * A device snapshot written by the dump-devices command. The
+     * devices are linked by their ids and the devices connected to
+     * a controller carry the parent hash computed by the daemon.
+     */
+    void loadDeviceSnapshot(const String& path, std::vector<InventorySnapshot>& snapshots)
+    {
+      const DeviceSnapshot device_snapshot(path);
+      InventorySnapshot snapshot;
+
+      for (size_t i = 0; i < device_snapshot.count(); ++i) {
+        const DeviceSnapshot::Entry device_entry = device_snapshot.entry(i);
+        InventoryEntry entry;
+
+        entry.source = path + ":" + std::to_string(device_entry.id);
+        entry.key = std::to_string(device_entry.id);
+        entry.parent_key = std::to_string(device_entry.parent_id);
+        entry.parent_hash = device_entry.parent_hash;
+        entry.port = device_entry.port;
+        entry.name = device_entry.name;
+        entry.vendor_id = device_entry.vendor_id;
+        entry.product_id = device_entry.product_id;
+        entry.serial = device_entry.serial;
+        entry.descriptors = device_entry.descriptors;
+
+        if (device_entry.parent_id == Rule::RootID && entry.parent_hash.empty()) {
+          throw std::runtime_error(entry.source + ": parent hash value is required");
+        }
+
+        snapshot.push_back(std::move(entry));
+      }
+
+      snapshots.push_back(std::move(snapshot));
+      return;
+    }
+
+    std::vector<InventorySnapshot> loadInventoryFile(const String& path)
+    {
+      std::ifstream stream(path, std::ifstream::binary);
+
+      if (!stream.is_open()) {
+        throw std::runtime_error(path + ": cannot open the inventory file");
+      }
+
+      char magic[8] = { };
+      stream.read(magic, sizeof magic);
+      std::vector<InventorySnapshot> snapshots;
+
+      if (DeviceSnapshot::isSnapshot(magic, stream.gcount())) {
+        loadDeviceSnapshot(path, snapshots);
+        return snapshots;
+      }
+
+      stream.clear();
+      stream.seekg(0);
+
+      const json inventory_json = json::parse(stream);
+
+      if (inventory_json.is_array()) {
+        for (size_t i = 0; i < inventory_json.size(); ++i) {
+          loadInventorySnapshot(path, inventory_json.at(i), i, snapshots);
+        }
+      }
+      else {
+        loadInventorySnapshot(path, inventory_json, 0, snapshots);
+      }
+
+      return snapshots;
+    }
+
+    /*
+     * Call item_fn for every index in [0, count) using up to
+     * thread_count threads of the shared pool. The exception thrown
+     * for the lowest index is rethrown after the work is finished.
+     */
+    void forEachConcurrently(size_t count, size_t thread_count, const std::function<void(size_t)>& item_fn)
+    {
+      if (thread_count <= 1 || count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+          item_fn(i);
+        }
+        return;
+      }
+      ThreadPool::shared().parallelFor(count, item_fn, thread_count);
+      return;
+    }
+  } /* namespace */
 
   PolicyGenerator::PolicyGenerator()
    : _ruleset(nullptr)
@@ -30,7 +216,9 @@ namespace usbguard
     _port_specific_noserial = true;
     _with_catchall = false;
     _catchall_target = Rule::Target::Block;
-    _dm = DeviceManager::create(*this);
+    _compact = false;
+    _generated_count = 0;
+    _compact_count = 0;
     return;
   }
 
@@ -60,14 +248,157 @@ namespace usbguard
 
   void PolicyGenerator::generate()
   {
+    _dm = DeviceManager::create(*this);
     _dm->scan();
+    finishRuleSet();
+    return;
+  }
+
+  void PolicyGenerator::generateFromInventory(const std::vector<std::string>& paths, const size_t thread_count)
+  {
+    std::vector<std::vector<InventorySnapshot>> file_snapshots(paths.size());
+
+    forEachConcurrently(paths.size(), thread_count, [&](size_t i) {
+      file_snapshots[i] = loadInventoryFile(paths[i]);
+    });
+
+    std::vector<InventoryEntry*> entries;
+
+    for (auto& snapshots : file_snapshots) {
+      for (auto& snapshot : snapshots) {
+        for (auto& entry : snapshot) {
+          entries.push_back(&entry);
+        }
+      }
+    }
+
+    InventoryDeviceManager device_manager(*this);
 
+    /*
+     * Parse the descriptors and compute the hash of every device.
+     * The devices don't depend on each other at this point.
+     */
+    forEachConcurrently(entries.size(), thread_count, [&](size_t i) {
+      InventoryEntry& entry = *entries[i];
+      auto device = makePointer<InventoryDevice>(device_manager);
+
+      device->setID(static_cast<uint32_t>(i + 1));
+      device->setName(entry.name);
+      device->setDeviceID(USBDeviceID(entry.vendor_id, entry.product_id));
+      device->setSerial(entry.serial);
+      device->setPort(entry.port);
+      device->setTarget(Rule::Target::Allow);
+
+      try {
+        const uint8_t * const descriptor_data = reinterpret_cast<const uint8_t *>(entry.descriptors.data());
+        const size_t descriptor_expected_size = device->loadDescriptors(descriptor_data, entry.descriptors.size());
+
+        if (descriptor_expected_size < sizeof(USBDeviceDescriptor)) {
+          throw std::runtime_error("parser processed less data than the size of a USB device descriptor");
+        }
+
+        device->updateHash(descriptor_data, descriptor_expected_size);
+      }
+      catch(const std::exception& ex) {
+        throw std::runtime_error(entry.source + ": " + ex.what());
+      }
+
+      entry.device = device;
+    });
+
+    /*
+     * Link the devices within every snapshot. A device whose parent
+     * isn't a USB device of the same snapshot is connected to a
+     * controller. Its parent hash is computed from the parent
+     * syspath, the same way as for the devices on a live system,
+     * unless the snapshot provides it.
+     */
+    for (auto& snapshots : file_snapshots) {
+      for (auto& snapshot : snapshots) {
+        std::unordered_map<String, const InventoryEntry*> key_map;
+
+        for (const auto& entry : snapshot) {
+          key_map.emplace(entry.key, &entry);
+        }
+        for (auto& entry : snapshot) {
+          const auto parent = key_map.find(entry.parent_key);
+          if (parent != key_map.end()) {
+            entry.device->setParentID(parent->second->device->getID());
+            entry.device->setParentHash(parent->second->device->getHash());
+          }
+          else {
+            entry.device->setParentID(Rule::RootID);
+            entry.device->setParentHash(entry.parent_hash.empty() ?
+                                        entry.device->hashString(entry.parent_key) : entry.parent_hash);
+            entry.device->setController(true);
+          }
+        }
+      }
+    }
+
+    forEachConcurrently(entries.size(), thread_count, [&](size_t i) {
+      entries[i]->rule = generateDeviceRule(*entries[i]->device);
+    });
+
+    /*
+     * Append the unique rules in one batch, so that the ruleset
+     * isn't copied for every appended rule.
+     */
+    std::unordered_set<String> rule_strings;
+    std::vector<RuleSet::Operation> operations;
+
+    for (const InventoryEntry* entry : entries) {
+      if (rule_strings.insert(entry->rule->toString()).second) {
+        operations.push_back(RuleSet::Operation::append(*entry->rule));
+      }
+    }
+
+    _ruleset.applyBatch(operations);
+
+    finishRuleSet();
+    return;
+  }
+
+  void PolicyGenerator::finishRuleSet()
+  {
+    _generated_count = _ruleset.getRules().size();
+    _compact_count = _generated_count;
+
+    if (_compact) {
+      compactRuleSet();
+    }
+
+    appendCatchAllRule();
+    return;
+  }
+
+  void PolicyGenerator::compactRuleSet()
+  {
+    std::vector<Rule> rules;
+
+    for (auto const& rule : _ruleset.getRules()) {
+      rules.push_back(*rule);
+    }
+
+    std::vector<RuleSet::Operation> operations;
+
+    for (auto const& rule : PolicyCompactor::compact(rules)) {
+      operations.push_back(RuleSet::Operation::append(rule));
+    }
+
+    _ruleset = RuleSet(nullptr);
+    _ruleset.applyBatch(operations);
+    _compact_count = operations.size();
+    return;
+  }
+
+  void PolicyGenerator::appendCatchAllRule()
+  {
     if (_with_catchall) {
       Rule catchall_rule;
       catchall_rule.setTarget(_catchall_target);
       _ruleset.appendRule(catchall_rule);
     }
-
     return;
   }
 
@@ -83,7 +414,29 @@ namespace usbguard
     return;
   }
 
+  void PolicyGenerator::setCompactRules(bool state)
+  {
+    _compact = state;
+    return;
+  }
+
+  size_t PolicyGenerator::getGeneratedRuleCount() const
+  {
+    return _generated_count;
+  }
+
+  size_t PolicyGenerator::getCompactRuleCount() const
+  {
+    return _compact_count;
+  }
+
   void PolicyGenerator::dmHookDevicePresent(Pointer<Device> device)
+  {
+    _ruleset.appendRule(*generateDeviceRule(*device));
+    return;
+  }
+
+  Pointer<Rule> PolicyGenerator::generateDeviceRule(Device& device) const
   {
     bool port_specific = _port_specific;
     /*
@@ -92,10 +445,10 @@ namespace usbguard
      * applicability.
      */
     if (!port_specific && _port_specific_noserial) {
-      port_specific = device->getSerial().empty();
+      port_specific = device.getSerial().empty();
     }
 
-    Pointer<Rule> rule = device->getDeviceRule(/*include_port=*/port_specific);
+    Pointer<Rule> rule = device.getDeviceRule(/*include_port=*/port_specific);
 
     /* Remove everything but the hash value for hash-only rules */
     if (_hash_only) {
@@ -117,8 +470,7 @@ namespace usbguard
     }
 
     rule->setTarget(Rule::Target::Allow);
-    _ruleset.appendRule(*rule);
-    return;
+    return rule;
   }
 
   void PolicyGenerator::dmHookDeviceInserted(Pointer<Device> device)
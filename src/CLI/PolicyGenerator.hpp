@@ -20,6 +20,8 @@
 #include <RuleSet.hpp>
 #include <DeviceManager.hpp>
 #include <DeviceManagerHooks.hpp>
+#include <string>
+#include <vector>
 
 namespace usbguard
 {
@@ -33,10 +35,32 @@ namespace usbguard
     void setPortSpecificRules(bool state);
     void setPortSpecificNoSerialRules(bool state);
     void setExplicitCatchAllRule(bool state, Rule::Target target = Rule::Target::Block);
+    /*
+     * Merge the generated rules which differ only in one single
+     * valued attribute, see PolicyCompactor.
+     */
+    void setCompactRules(bool state);
 
+    /*
+     * Generate rules for the devices connected to this system.
+     */
     void generate();
+    /*
+     * Generate rules for the devices of captured device inventory
+     * snapshots, without accessing udev or sysfs. Rules which are
+     * the same for several devices, e.g. for the same device model
+     * found on many machines, are generated only once.
+     */
+    void generateFromInventory(const std::vector<std::string>& paths, size_t thread_count);
     const RuleSet& refRuleSet() const;
 
+    /*
+     * The number of the generated device rules, before and after
+     * the compaction. Both are the same if the rules aren't compacted.
+     */
+    size_t getGeneratedRuleCount() const;
+    size_t getCompactRuleCount() const;
+
     void dmHookDeviceInserted(Pointer<Device> device);
     void dmHookDevicePresent(Pointer<Device> device);
     void dmHookDeviceRemoved(Pointer<Device> device);
@@ -46,6 +70,11 @@ namespace usbguard
     uint32_t dmHookAssignID();
 
   private:
+    Pointer<Rule> generateDeviceRule(Device& device) const;
+    void finishRuleSet();
+    void compactRuleSet();
+    void appendCatchAllRule();
+
     RuleSet _ruleset;
     Pointer<DeviceManager> _dm;
 
@@ -55,5 +84,8 @@ namespace usbguard
     bool _port_specific_noserial;
     bool _with_catchall;
     Rule::Target _catchall_target;
+    bool _compact;
+    size_t _generated_count;
+    size_t _compact_count;
   };
 } /* namespace usbguard */
@@ -0,0 +1,285 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "PolicyOptimizer.hpp"
+
+#include <algorithm>
+#include <queue>
+
+namespace usbguard
+{
+  PolicyOptimizer::PolicyOptimizer(const std::vector<Rule>& rules)
+    : _rules(rules),
+      _hit_counts(rules.size(), 0)
+  {
+    return;
+  }
+
+  void PolicyOptimizer::setHitCount(size_t index, uint64_t count)
+  {
+    _hit_counts.at(index) = count;
+    return;
+  }
+
+  uint64_t PolicyOptimizer::getHitCount(size_t index) const
+  {
+    return _hit_counts.at(index);
+  }
+
+  const std::vector<Rule>& PolicyOptimizer::refRules() const
+  {
+    return _rules;
+  }
+
+  std::vector<size_t> PolicyOptimizer::optimize() const
+  {
+    const size_t rule_count = _rules.size();
+    /*
+     * A rule may be moved in front of an earlier rule only if the
+     * two rules are disjoint. For every rule, count the earlier
+     * rules which have to stay in front of it and remember which
+     * later rules depend on it.
+     */
+    std::vector<size_t> pending(rule_count, 0);
+    std::vector<std::vector<size_t>> dependents(rule_count);
+
+    for (size_t j = 0; j < rule_count; ++j) {
+      for (size_t i = 0; i < j; ++i) {
+        if (!areDisjoint(_rules[i], _rules[j])) {
+          dependents[i].push_back(j);
+          ++pending[j];
+        }
+      }
+    }
+
+    /*
+     * Out of the rules which can be placed next, pick the one with
+     * the highest hit count. Ties keep the original order.
+     */
+    auto less_preferred = [this](size_t a, size_t b) {
+      if (_hit_counts[a] != _hit_counts[b]) {
+        return _hit_counts[a] < _hit_counts[b];
+      }
+      return a > b;
+    };
+
+    std::priority_queue<size_t, std::vector<size_t>, decltype(less_preferred)> available(less_preferred);
+    std::vector<size_t> order;
+
+    for (size_t i = 0; i < rule_count; ++i) {
+      if (pending[i] == 0) {
+        available.push(i);
+      }
+    }
+
+    while (!available.empty()) {
+      const size_t index = available.top();
+      available.pop();
+      order.push_back(index);
+      for (const size_t dependent : dependents[index]) {
+        if (--pending[dependent] == 0) {
+          available.push(dependent);
+        }
+      }
+    }
+
+    return order;
+  }
+
+  std::vector<std::pair<size_t, size_t>> PolicyOptimizer::findShadowedRules() const
+  {
+    std::vector<std::pair<size_t, size_t>> shadowed;
+
+    for (size_t j = 0; j < _rules.size(); ++j) {
+      for (size_t i = 0; i < j; ++i) {
+        if (covers(_rules[i], _rules[j])) {
+          shadowed.emplace_back(j, i);
+          break;
+        }
+      }
+    }
+
+    return shadowed;
+  }
+
+  /*
+   * Values with wildcards may match more than one device value, so
+   * two different values don't imply two disjoint match sets.
+   */
+  template<typename T>
+  static bool isConcreteValue(const T&)
+  {
+    return true;
+  }
+
+  static bool isConcreteValue(const USBDeviceID& device_id)
+  {
+    const String& vendor_id = device_id.getVendorID();
+    const String& product_id = device_id.getProductID();
+
+    return !vendor_id.empty() && vendor_id != "*" &&
+      !product_id.empty() && product_id != "*";
+  }
+
+  template<typename T>
+  static StringVector valueStrings(const Rule::Attribute<T>& attribute)
+  {
+    StringVector strings;
+    for (const auto& value : attribute.values()) {
+      strings.push_back(toRuleString(value));
+    }
+    return strings;
+  }
+
+  /*
+   * Computes the values a device attribute may have for a single
+   * valued attribute to match. Returns false if the set of values
+   * isn't finite or isn't known.
+   */
+  template<typename T>
+  static bool finiteMatchSet(const Rule::Attribute<T>& attribute, StringVector& match_set, bool concrete_only)
+  {
+    if (attribute.empty()) {
+      return false;
+    }
+
+    switch(attribute.setOperator()) {
+      case Rule::SetOperator::AllOf:
+      case Rule::SetOperator::OneOf:
+      case Rule::SetOperator::Equals:
+        break;
+      default:
+        return false;
+    }
+
+    if (concrete_only) {
+      for (const auto& value : attribute.values()) {
+        if (!isConcreteValue(value)) {
+          return false;
+        }
+      }
+    }
+
+    match_set = valueStrings(attribute);
+    return true;
+  }
+
+  static bool isSubset(const StringVector& subset, const StringVector& set)
+  {
+    for (const auto& item : subset) {
+      if (std::find(set.begin(), set.end(), item) == set.end()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool haveCommonItem(const StringVector& a, const StringVector& b)
+  {
+    for (const auto& item : a) {
+      if (std::find(b.begin(), b.end(), item) != b.end()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template<typename T>
+  static bool excludes(const Rule::Attribute<T>& a, const Rule::Attribute<T>& b)
+  {
+    StringVector a_set;
+
+    if (!finiteMatchSet(a, a_set, /*concrete_only=*/true)) {
+      return false;
+    }
+
+    StringVector b_set;
+
+    if (finiteMatchSet(b, b_set, /*concrete_only=*/true)) {
+      return !haveCommonItem(a_set, b_set);
+    }
+
+    if (b.setOperator() == Rule::SetOperator::NoneOf) {
+      return isSubset(a_set, valueStrings(b));
+    }
+
+    return false;
+  }
+
+  template<typename T>
+  static bool disjointAttributes(const Rule::Attribute<T>& a, const Rule::Attribute<T>& b)
+  {
+    return excludes(a, b) || excludes(b, a);
+  }
+
+  bool PolicyOptimizer::areDisjoint(const Rule& a, const Rule& b)
+  {
+    return disjointAttributes(a.attributeDeviceID(), b.attributeDeviceID()) ||
+      disjointAttributes(a.attributeSerial(), b.attributeSerial()) ||
+      disjointAttributes(a.attributeName(), b.attributeName()) ||
+      disjointAttributes(a.attributeHash(), b.attributeHash()) ||
+      disjointAttributes(a.attributeParentHash(), b.attributeParentHash()) ||
+      disjointAttributes(a.attributeViaPort(), b.attributeViaPort());
+  }
+
+  /*
+   * Returns true if every device value matching the attribute b
+   * also matches the attribute a.
+   */
+  template<typename T>
+  static bool coversAttribute(const Rule::Attribute<T>& a, const Rule::Attribute<T>& b, bool single_valued)
+  {
+    if (a.empty()) {
+      return true;
+    }
+
+    const StringVector a_values = valueStrings(a);
+
+    if (a.setOperator() == b.setOperator() && a_values == valueStrings(b)) {
+      return true;
+    }
+
+    const bool a_matches_any = a.setOperator() == Rule::SetOperator::OneOf ||
+      (single_valued && a.count() == 1 &&
+       (a.setOperator() == Rule::SetOperator::Equals ||
+        a.setOperator() == Rule::SetOperator::AllOf));
+
+    StringVector b_set;
+
+    if (a_matches_any && finiteMatchSet(b, b_set, /*concrete_only=*/false)) {
+      return isSubset(b_set, a_values);
+    }
+
+    return false;
+  }
+
+  bool PolicyOptimizer::covers(const Rule& a, const Rule& b)
+  {
+    if (!a.attributeConditions().empty()) {
+      return false;
+    }
+
+    return coversAttribute(a.attributeDeviceID(), b.attributeDeviceID(), true) &&
+      coversAttribute(a.attributeSerial(), b.attributeSerial(), true) &&
+      coversAttribute(a.attributeName(), b.attributeName(), true) &&
+      coversAttribute(a.attributeHash(), b.attributeHash(), true) &&
+      coversAttribute(a.attributeParentHash(), b.attributeParentHash(), true) &&
+      coversAttribute(a.attributeViaPort(), b.attributeViaPort(), true) &&
+      coversAttribute(a.attributeWithInterface(), b.attributeWithInterface(), false);
+  }
+} /* namespace usbguard */
@@ -0,0 +1,60 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <Rule.hpp>
+#include <RuleSet.hpp>
+#include <vector>
+#include <utility>
+
+namespace usbguard
+{
+  /*
+   * Proposes a rule order where frequently matched rules are
+   * evaluated earlier. Two rules are swapped only if no device can
+   * match both of them, so the first matching rule for any device
+   * stays the same.
+   */
+  class PolicyOptimizer
+  {
+  public:
+    PolicyOptimizer(const std::vector<Rule>& rules);
+
+    void setHitCount(size_t index, uint64_t count);
+    uint64_t getHitCount(size_t index) const;
+    const std::vector<Rule>& refRules() const;
+
+    /*
+     * Returns the rule indexes in the proposed order.
+     */
+    std::vector<size_t> optimize() const;
+
+    /*
+     * Returns (shadowed, shadowing) rule index pairs for rules
+     * which can never be reached because an earlier rule matches
+     * every device they would match.
+     */
+    std::vector<std::pair<size_t, size_t>> findShadowedRules() const;
+
+    static bool areDisjoint(const Rule& a, const Rule& b);
+    static bool covers(const Rule& a, const Rule& b);
+
+  private:
+    std::vector<Rule> _rules;
+    std::vector<uint64_t> _hit_counts;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,144 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-apply-policy.hpp"
+
+#include <IPCClient.hpp>
+#include <RuleParser.hpp>
+#include <RuleSetDiff.hpp>
+#include <iostream>
+
+namespace usbguard
+{
+  static const char *options_short = "hn";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "dry-run", no_argument, nullptr, 'n' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " apply-policy [OPTIONS] <file>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -n, --dry-run  Print the rule changes without applying them." << std::endl;
+    stream << "  -h, --help     Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  static void printOperations(const std::vector<RuleSet::Operation>& operations, const PointerVector<const Rule>& rules)
+  {
+    for (auto const& operation : operations) {
+      if (operation.type != RuleSet::Operation::Type::Remove) {
+        continue;
+      }
+      for (auto const& rule : rules) {
+        if (rule->getRuleID() == operation.id) {
+          std::cout << "- " << operation.id << ": " << rule->toString() << std::endl;
+          break;
+        }
+      }
+    }
+
+    /* The new rules are inserted in reverse order */
+    for (auto it = operations.crbegin(); it != operations.crend(); ++it) {
+      if (it->type != RuleSet::Operation::Type::Append) {
+        continue;
+      }
+      std::cout << "+ ";
+      if (it->parent_id == Rule::RootID) {
+        std::cout << "first: ";
+      }
+      else {
+        std::cout << "after " << it->parent_id << ": ";
+      }
+      std::cout << it->rule.toString() << std::endl;
+    }
+    return;
+  }
+
+  int usbguard_apply_policy(int argc, char *argv[])
+  {
+    bool dry_run = false;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'n':
+          dry_run = true;
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    RuleSet file_ruleset(nullptr);
+
+    try {
+      file_ruleset.load(argv[0]);
+    }
+    catch(const RuleParserError& ex) {
+      std::cerr << "Syntax error in " << argv[0] << " on line " << ex.line() << ": " << ex.hint() << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    std::vector<Rule> file_rules;
+
+    for (auto const& rule : file_ruleset.getRules()) {
+      file_rules.push_back(*rule);
+    }
+
+    usbguard::IPCClient ipc(/*connected=*/true);
+    RuleSet current_ruleset = ipc.listRules();
+    const PointerVector<const Rule> current_rules = current_ruleset.getRules();
+    const RuleSetDiff diff(current_rules, file_rules);
+
+    if (dry_run) {
+      printOperations(diff.operations(), current_rules);
+    }
+    else if (!diff.operations().empty()) {
+      /*
+       * The batch fails as a whole if a removed rule is gone, e.g.
+       * because the rule set was modified in the meantime.
+       */
+      ipc.applyRuleBatch(diff.operations());
+    }
+
+    std::cout << diff.keptCount() << " rules kept, "
+              << diff.removedCount() << " removed, "
+              << diff.insertedCount() << " inserted" << std::endl;
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-audit.hpp"
+
+#include <AuditLog.hpp>
+#include <Base64.hpp>
+#include <iostream>
+#include <iomanip>
+#include <time.h>
+
+namespace usbguard
+{
+  static const char *options_short = "hn:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "last", required_argument, nullptr, 'n' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " audit [OPTIONS] <file> [<file> ...]" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -n, --last <count>  Print only the last <count> records." << std::endl;
+    stream << "  -h, --help          Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  static void printRecord(std::ostream& stream, const AuditLog::Record& record)
+  {
+    const time_t seconds = record.timestamp_us / 1000000;
+    struct tm tm;
+    char timestamp[32];
+
+    ::gmtime_r(&seconds, &tm);
+    ::strftime(timestamp, sizeof timestamp, "%Y-%m-%dT%H:%M:%S", &tm);
+
+    stream << timestamp << '.' << std::setw(6) << std::setfill('0') << (record.timestamp_us % 1000000) << 'Z'
+           << ' ' << AuditLog::eventToString(record.event)
+           << " id=" << record.device_id
+           << " rule=" << record.rule_id
+           << " target=" << Rule::targetToString(record.target)
+           << " latency=" << (record.latency_ns / 1000) << "us"
+           << " port=" << (record.port.empty() ? String("-") : record.port)
+           << " hash=" << (record.hash.empty() ? String("-") : base64Encode(record.hash))
+           << std::endl;
+  }
+
+  int usbguard_audit(int argc, char *argv[])
+  {
+    size_t last = 0;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'n':
+          last = std::stoul(optarg);
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    /*
+     * The files are printed in the given order, so the rotated
+     * files have to be listed oldest first.
+     */
+    std::vector<Pointer<AuditLog::Reader>> readers;
+    size_t total = 0;
+
+    for (int i = 0; i < argc; ++i) {
+      readers.push_back(makePointer<AuditLog::Reader>(argv[i]));
+      total += readers.back()->count();
+    }
+
+    size_t skip = (last > 0 && last < total) ? total - last : 0;
+
+    for (const auto& reader : readers) {
+      const size_t count = reader->count();
+
+      if (skip >= count) {
+        skip -= count;
+        continue;
+      }
+      for (size_t index = skip; index < count; ++index) {
+        printRecord(std::cout, reader->record(index));
+      }
+      skip = 0;
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
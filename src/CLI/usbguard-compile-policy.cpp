@@ -0,0 +1,128 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-compile-policy.hpp"
+
+#include <PolicyBundle.hpp>
+#include <RuleParser.hpp>
+#include <RuleSet.hpp>
+#include <Hash.hpp>
+#include <iostream>
+
+namespace usbguard
+{
+  static const char *options_short = "hb:k:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "base", required_argument, nullptr, 'b' },
+    { "key-file", required_argument, nullptr, 'k' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " compile-policy [OPTIONS] <version> <rule-file> <bundle-file>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -b, --base <bundle>   Create a delta bundle against a full bundle." << std::endl;
+    stream << "  -k, --key-file <path> Sign the bundle with the key from a file." << std::endl;
+    stream << "  -h, --help            Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  int usbguard_compile_policy(int argc, char *argv[])
+  {
+    String base_path;
+    String key_path;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'b':
+          base_path = String(optarg);
+          break;
+        case 'k':
+          key_path = String(optarg);
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 3) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    const String version_string(argv[0]);
+
+    if (version_string.empty() || version_string.find_first_not_of("0123456789") != String::npos) {
+      std::cerr << "Invalid policy version: " << version_string << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    const uint64_t version = std::stoull(version_string);
+    RuleSet file_ruleset(nullptr);
+
+    try {
+      file_ruleset.load(argv[1]);
+    }
+    catch(const RuleParserError& ex) {
+      std::cerr << "Syntax error in " << argv[1] << " on line " << ex.line() << ": " << ex.hint() << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    std::vector<Rule> rules;
+
+    for (auto const& rule : file_ruleset.getRules()) {
+      rules.push_back(*rule);
+    }
+
+    const String key = key_path.empty() ? String() : Hash::readKeyFile(key_path);
+
+    if (base_path.empty()) {
+      PolicyBundle(version, rules).save(argv[2], key);
+      std::cout << "Version " << version << ": " << rules.size() << " rules" << std::endl;
+    }
+    else {
+      const PolicyBundle base = PolicyBundle::load(base_path, key);
+
+      if (version <= base.getVersion()) {
+        std::cerr << "The version has to be newer than the base version " << base.getVersion() << std::endl;
+        return EXIT_FAILURE;
+      }
+
+      const PolicyBundle delta(version, base, rules);
+      delta.save(argv[2], key);
+      std::cout << "Version " << version << " based on version " << base.getVersion() << ": "
+                << delta.getRules().size() << " rules inserted" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,92 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-dump-devices.hpp"
+
+#include <IPCClient.hpp>
+#include <iostream>
+#include <fstream>
+#include <unistd.h>
+
+namespace usbguard
+{
+  static const char *options_short = "ho:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "output", required_argument, nullptr, 'o' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " dump-devices [OPTIONS]" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -o, --output <file>  Write the snapshot to a file instead of stdout." << std::endl;
+    stream << "  -h, --help           Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  int usbguard_dump_devices(int argc, char *argv[])
+  {
+    std::string output_path;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'o':
+          output_path = optarg;
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    if (output_path.empty() && ::isatty(STDOUT_FILENO)) {
+      std::cerr << "The snapshot is binary data, redirect stdout or use the --output option." << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    usbguard::IPCClient ipc(/*connected=*/true);
+    const std::string snapshot = ipc.dumpDevices();
+
+    if (output_path.empty()) {
+      std::cout.write(snapshot.data(), snapshot.size());
+      std::cout.flush();
+      return std::cout.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::ofstream stream(output_path, std::ofstream::binary|std::ofstream::trunc);
+    stream.write(snapshot.data(), snapshot.size());
+    stream.close();
+
+    if (!stream) {
+      std::cerr << "Cannot write the snapshot to " << output_path << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
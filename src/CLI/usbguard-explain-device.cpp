@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-explain-device.hpp"
+
+#include <IPCClient.hpp>
+#include <iostream>
+
+namespace usbguard
+{
+  static const char *options_short = "h";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " explain-device [OPTIONS] <id>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -h, --help  Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  int usbguard_explain_device(int argc, char *argv[])
+  {
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    const uint32_t id = std::stoul(argv[0]);
+
+    usbguard::IPCClient ipc(/*connected=*/true);
+    const auto steps = ipc.explainDevice(id);
+    uint64_t total_ns = 0;
+
+    for (auto const& step : steps) {
+      std::cout << step.rule_id << ": " << Rule::targetToString(step.target) << ": ";
+      if (!step.rejected_by.empty()) {
+        std::cout << "rejected by " << step.rejected_by;
+      }
+      else if (step.matched) {
+        std::cout << "matched";
+      }
+      else {
+        std::cout << "conditions not met";
+      }
+      std::cout << " (" << step.time_ns << " ns)" << std::endl;
+
+      for (auto const& condition : step.conditions) {
+        std::cout << "    " << condition.first << ": " << (condition.second ? "true" : "false") << std::endl;
+      }
+      total_ns += step.time_ns;
+    }
+
+    std::cout << steps.size() << " rules visited in " << total_ns << " ns, ";
+    if (!steps.empty() && steps.back().matched) {
+      std::cout << "decided by rule " << steps.back().rule_id << std::endl;
+    }
+    else {
+      std::cout << "decided by the implicit policy target" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -16,18 +16,21 @@
 //
 // Authors: Daniel Kopecek <dkopecek@redhat.com>
 //
+#include <iomanip>
 #include <iostream>
+#include <thread>
 #include <DeviceManager.hpp>
 #include <unistd.h>
 
 #include "usbguard.hpp"
 #include "usbguard-generate-policy.hpp"
 #include "PolicyGenerator.hpp"
+#include "Hash.hpp"
 #include "Common/Utility.hpp"
 
 namespace usbguard
 {
-  static const char *options_short = "hpPt:HX";
+  static const char *options_short = "hpPt:HXa:k:I:j:C";
 
   static const struct ::option options_long[] = {
     { "help", no_argument, nullptr, 'h' },
@@ -36,6 +39,11 @@ namespace usbguard
     { "target", required_argument, nullptr, 't' },
     { "hash-only", no_argument, nullptr, 'H' },
     { "no-hashes", no_argument, nullptr, 'X' },
+    { "hash-algorithm", required_argument, nullptr, 'a' },
+    { "hash-key-file", required_argument, nullptr, 'k' },
+    { "from-inventory", required_argument, nullptr, 'I' },
+    { "jobs", required_argument, nullptr, 'j' },
+    { "compact", no_argument, nullptr, 'C' },
     { nullptr, 0, nullptr, 0 }
   };
 
@@ -51,6 +59,24 @@ namespace usbguard
     stream << "                     specified target. Possible targets: allow, block, reject." << std::endl;
     stream << "  -X, --no-hashes    Don't generate a hash attribute for each device." << std::endl;
     stream << "  -H, --hash-only    Generate a hash-only policy." << std::endl;
+    stream << "  -a, --hash-algorithm <A>" << std::endl;
+    stream << "                     Compute device hashes using the specified algorithm." << std::endl;
+    stream << "                     Possible algorithms: sha256 (default), sha512, blake2b." << std::endl;
+    stream << "  -k, --hash-key-file <path>" << std::endl;
+    stream << "                     Compute keyed device hashes using the content of the" << std::endl;
+    stream << "                     file as the key." << std::endl;
+    stream << "                     Both hash options have to match the DeviceHashAlgorithm" << std::endl;
+    stream << "                     and DeviceHashKeyFile daemon settings." << std::endl;
+    stream << "  -I, --from-inventory <path>" << std::endl;
+    stream << "                     Generate the policy for the devices of a captured" << std::endl;
+    stream << "                     device inventory instead of the connected devices." << std::endl;
+    stream << "                     Can be used multiple times. Duplicate rules are" << std::endl;
+    stream << "                     generated only once." << std::endl;
+    stream << "  -j, --jobs <n>     Number of threads used to process the inventory" << std::endl;
+    stream << "                     (default: number of CPUs)." << std::endl;
+    stream << "  -C, --compact      Merge rules which differ only in one attribute value" << std::endl;
+    stream << "                     into rules with one-of sets and report the" << std::endl;
+    stream << "                     compaction ratio on stderr." << std::endl;
     stream << "  -h, --help         Show this help." << std::endl;
     stream << std::endl;
   }
@@ -63,6 +89,9 @@ namespace usbguard
     std::string catchall_target = "block";
     bool with_hashes = true;
     bool only_hashes = false;
+    bool compact = false;
+    std::vector<std::string> inventory_paths;
+    size_t thread_count = std::thread::hardware_concurrency();
     int opt = 0;
 
     while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
@@ -86,6 +115,21 @@ namespace usbguard
         case 'X':
           with_hashes = false;
           break;
+        case 'a':
+          Hash::setDefaultAlgorithm(Hash::algorithmFromString(optarg));
+          break;
+        case 'k':
+          Hash::setDefaultKeyFromFile(optarg);
+          break;
+        case 'I':
+          inventory_paths.push_back(optarg);
+          break;
+        case 'j':
+          thread_count = stringToNumber<size_t>(optarg);
+          break;
+        case 'C':
+          compact = true;
+          break;
         case '?':
           showHelp(std::cerr);
         default:
@@ -101,10 +145,28 @@ namespace usbguard
     generator.setPortSpecificNoSerialRules(port_specific_noserial);
     generator.setExplicitCatchAllRule(with_catchall,
                                       Rule::targetFromString(catchall_target));
-    generator.generate();
+    generator.setCompactRules(compact);
+    if (inventory_paths.empty()) {
+      generator.generate();
+    }
+    else {
+      generator.generateFromInventory(inventory_paths, thread_count);
+    }
     const RuleSet& ruleset = generator.refRuleSet();
     ruleset.save(std::cout);
 
+    if (compact) {
+      const size_t generated_count = generator.getGeneratedRuleCount();
+      const size_t compact_count = generator.getCompactRuleCount();
+
+      std::cerr << "Compacted " << generated_count << " rules into " << compact_count;
+      if (compact_count > 0) {
+        std::cerr << " (ratio " << std::fixed << std::setprecision(2)
+                  << double(generated_count) / double(compact_count) << ")";
+      }
+      std::cerr << std::endl;
+    }
+
     return EXIT_SUCCESS;
   }
 } /* namespace usbguard */
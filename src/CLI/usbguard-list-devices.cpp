@@ -21,15 +21,21 @@
 
 #include <IPCClient.hpp>
 #include <iostream>
+#include <map>
+#include <sstream>
 
 namespace usbguard
 {
-  static const char *options_short = "hab";
+  static const char *options_short = "habs:q:tf:";
 
   static const struct ::option options_long[] = {
     { "help", no_argument, nullptr, 'h' },
     { "blocked", no_argument, nullptr, 'b' },
     { "allowed", no_argument, nullptr, 'a' },
+    { "subtree", required_argument, nullptr, 's' },
+    { "query", required_argument, nullptr, 'q' },
+    { "tree", no_argument, nullptr, 't' },
+    { "fields", required_argument, nullptr, 'f' },
     { nullptr, 0, nullptr, 0 }
   };
 
@@ -38,16 +44,72 @@ namespace usbguard
     stream << " Usage: " << usbguard_arg0 << " list-devices [OPTIONS]" << std::endl;
     stream << std::endl;
     stream << " Options:" << std::endl;
-    stream << "  -a, --allowed  List allowed devices." << std::endl;
-    stream << "  -b, --blocked  List blocked devices." << std::endl;
-    stream << "  -h, --help     Show this help." << std::endl;
+    stream << "  -a, --allowed       List allowed devices." << std::endl;
+    stream << "  -b, --blocked       List blocked devices." << std::endl;
+    stream << "  -s, --subtree <id>  List only the device <id> and the devices" << std::endl;
+    stream << "                      connected behind it, in topology order." << std::endl;
+    stream << "  -q, --query <rule>  List only the devices matching the rule" << std::endl;
+    stream << "                      attributes, e.g. 'with-interface 08:*:*'." << std::endl;
+    stream << "  -t, --tree          Show the devices as a tree, each device" << std::endl;
+    stream << "                      indented below its parent." << std::endl;
+    stream << "  -f, --fields <list> Show only the listed fields, separated by" << std::endl;
+    stream << "                      commas: target, id, name, serial, hash," << std::endl;
+    stream << "                      parent-hash, via-port, with-interface, rule." << std::endl;
+    stream << "  -h, --help          Show this help." << std::endl;
     stream << std::endl;
   }
 
+  static std::vector<std::string> splitFields(const std::string& list)
+  {
+    std::vector<std::string> fields;
+    std::istringstream stream(list);
+    std::string field;
+
+    while (std::getline(stream, field, ',')) {
+      if (!field.empty()) {
+        fields.push_back(field);
+      }
+    }
+
+    return fields;
+  }
+
+  /*
+   * The devices are listed in topology order. In a tree, a device
+   * is indented one level below its parent; devices whose parent
+   * isn't listed start at the top level.
+   */
+  static void showDeviceFields(const std::vector<IPCClient::DeviceFields>& devices, bool show_tree)
+  {
+    std::map<uint32_t, size_t> depths;
+
+    for (auto const& device : devices) {
+      if (show_tree) {
+        auto parent = depths.find(device.parent_id);
+        const size_t depth = (parent != depths.end() ? parent->second + 1 : 0);
+        depths[device.id] = depth;
+        std::cout << std::string(depth * 2, ' ');
+      }
+
+      std::cout << device.id << ":";
+      for (auto const& value : device.values) {
+        if (!value.empty()) {
+          std::cout << " " << value;
+        }
+      }
+      std::cout << std::endl;
+    }
+  }
+
   int usbguard_list_devices(int argc, char *argv[])
   {
     bool list_blocked = false;
     bool list_allowed = false;
+    bool list_subtree = false;
+    uint32_t subtree_id = Rule::RootID;
+    std::string query_attributes;
+    bool show_tree = false;
+    std::vector<std::string> fields;
     int opt = 0;
 
     while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
@@ -61,6 +123,19 @@ namespace usbguard
         case 'b':
           list_blocked = true;
           break;
+        case 's':
+          list_subtree = true;
+          subtree_id = std::stoul(optarg);
+          break;
+        case 'q':
+          query_attributes = optarg;
+          break;
+        case 't':
+          show_tree = true;
+          break;
+        case 'f':
+          fields = splitFields(optarg);
+          break;
         case '?':
           showHelp(std::cerr);
         default:
@@ -80,9 +155,28 @@ namespace usbguard
       }
     }
 
+    if (!query_attributes.empty()) {
+      query.append(" ").append(query_attributes);
+    }
+
     usbguard::IPCClient ipc(/*connected=*/true);
 
-    for (auto device_rule : ipc.listDevices(query)) {
+    /*
+     * The daemon filters the devices and renders only the requested
+     * fields, so a tree or a field selection costs a single call.
+     */
+    if (show_tree || !fields.empty()) {
+      if (fields.empty()) {
+        fields.push_back("rule");
+      }
+      showDeviceFields(ipc.listDeviceFields(subtree_id, query, fields), show_tree);
+      return EXIT_SUCCESS;
+    }
+
+    const std::vector<Rule> device_rules = \
+      list_subtree ? ipc.listDeviceSubtree(subtree_id, query) : ipc.listDevices(query);
+
+    for (auto device_rule : device_rules) {
       std::cout << device_rule.getRuleID() << ": " << device_rule.toString() << std::endl;
     }
 
@@ -21,13 +21,21 @@
 
 #include <IPCClient.hpp>
 #include <iostream>
+#include <map>
+#include <ctime>
 
 namespace usbguard
 {
-  static const char *options_short = "h";
+  static const char *options_short = "hst:m:r:l:o:";
 
   static const struct ::option options_long[] = {
     { "help", no_argument, nullptr, 'h' },
+    { "stats", no_argument, nullptr, 's' },
+    { "target", required_argument, nullptr, 't' },
+    { "match", required_argument, nullptr, 'm' },
+    { "range", required_argument, nullptr, 'r' },
+    { "limit", required_argument, nullptr, 'l' },
+    { "offset", required_argument, nullptr, 'o' },
     { nullptr, 0, nullptr, 0 }
   };
 
@@ -36,12 +44,95 @@ namespace usbguard
     stream << " Usage: " << usbguard_arg0 << " list-rules [OPTIONS]" << std::endl;
     stream << std::endl;
     stream << " Options:" << std::endl;
-    stream << "  -h, --help  Show this help." << std::endl;
+    stream << "  -s, --stats               Show rule usage statistics." << std::endl;
+    stream << "  -t, --target <target>     List only the rules with the target." << std::endl;
+    stream << "  -m, --match <device-rule> List only the rules which apply to the" << std::endl;
+    stream << "                            device rule, ignoring the rule conditions." << std::endl;
+    stream << "  -r, --range <first>[-<last>]" << std::endl;
+    stream << "                            List only the rules with ids in the range." << std::endl;
+    stream << "  -o, --offset <n>          Skip the first <n> of the listed rules." << std::endl;
+    stream << "  -l, --limit <n>           List at most <n> rules." << std::endl;
+    stream << "  -h, --help                Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  /*
+   * The device rule may be given without the target,
+   * e.g. just as `id 1234:5678 serial "0001"'.
+   */
+  static std::string deviceRuleString(const std::string& spec)
+  {
+    try {
+      return Rule::fromString(spec).toString();
+    }
+    catch(...) {
+      return Rule::fromString("match " + spec).toString();
+    }
+  }
+
+  static void parseRange(const std::string& range, IPCClient::RuleFilter& filter)
+  {
+    const size_t dash = range.find('-');
+
+    filter.first_id = std::stoul(range.substr(0, dash));
+    filter.last_id = (dash == std::string::npos ? filter.first_id : std::stoul(range.substr(dash + 1)));
+
+    if (filter.first_id > filter.last_id) {
+      throw std::runtime_error("Invalid rule id range: " + range);
+    }
+  }
+
+  static std::string timeToString(uint64_t unix_time)
+  {
+    if (unix_time == 0) {
+      return "never";
+    }
+
+    const time_t time_value = unix_time;
+    struct ::tm tm = { };
+    char buffer[32];
+
+    ::localtime_r(&time_value, &tm);
+    ::strftime(buffer, sizeof buffer, "%Y-%m-%d %H:%M:%S", &tm);
+
+    return buffer;
+  }
+
+  static void showStatistics(std::ostream& stream, const Rule::Statistics& statistics)
+  {
+    stream << "    evaluated: " << statistics.evaluated
+           << " (last: " << timeToString(statistics.last_evaluated) << ")" << std::endl;
+    stream << "    applied: " << statistics.applied
+           << " (last: " << timeToString(statistics.last_applied) << ")" << std::endl;
+    stream << "    match time:";
+
+    const auto& histogram = statistics.match_time_histogram;
+    bool empty = true;
+
+    for (size_t i = 0; i < histogram.size(); ++i) {
+      if (histogram[i] == 0) {
+        continue;
+      }
+      if (i + 1 < histogram.size()) {
+        stream << " <" << (uint64_t(1) << i) << "us: " << histogram[i];
+      }
+      else {
+        stream << " >=" << (uint64_t(1) << (i - 1)) << "us: " << histogram[i];
+      }
+      empty = false;
+    }
+
+    if (empty) {
+      stream << " -";
+    }
+
     stream << std::endl;
   }
 
   int usbguard_list_rules(int argc, char *argv[])
   {
+    bool show_statistics = false;
+    IPCClient::RuleFilter filter;
     int opt = 0;
 
     while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
@@ -49,6 +140,24 @@ namespace usbguard
         case 'h':
           showHelp(std::cout);
           return EXIT_SUCCESS;
+        case 's':
+          show_statistics = true;
+          break;
+        case 't':
+          filter.target = optarg;
+          break;
+        case 'm':
+          filter.device = deviceRuleString(optarg);
+          break;
+        case 'r':
+          parseRange(optarg, filter);
+          break;
+        case 'l':
+          filter.limit = std::stoul(optarg);
+          break;
+        case 'o':
+          filter.offset = std::stoul(optarg);
+          break;
         case '?':
           showHelp(std::cerr);
         default:
@@ -57,10 +166,21 @@ namespace usbguard
     }
 
     usbguard::IPCClient ipc(/*connected=*/true);
-    RuleSet ruleset = ipc.listRules();
+    /* The rules are selected by the daemon, only they are sent */
+    const std::vector<Rule> rules = ipc.listRules(filter);
+    std::map<uint32_t, Rule::Statistics> statistics;
 
-    for (auto rule : ruleset.getRules()) {
-      std::cout << rule->getRuleID() << ": " << rule->toString() << std::endl;
+    if (show_statistics) {
+      for (auto const& rule_statistics : ipc.getRuleStatistics()) {
+        statistics[rule_statistics.rule_id] = rule_statistics;
+      }
+    }
+
+    for (auto const& rule : rules) {
+      std::cout << rule.getRuleID() << ": " << rule.toString() << std::endl;
+      if (show_statistics) {
+        showStatistics(std::cout, statistics[rule.getRuleID()]);
+      }
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,175 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-optimize-policy.hpp"
+#include "PolicyOptimizer.hpp"
+
+#include <IPCClient.hpp>
+#include <iostream>
+#include <fstream>
+#include <map>
+
+namespace usbguard
+{
+  static const char *options_short = "hs:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "stats", required_argument, nullptr, 's' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " optimize-policy [OPTIONS] <file>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -s, --stats <file>  Read the rule hit counts from a file instead of" << std::endl;
+    stream << "                      asking the USBGuard daemon. Each line of the file" << std::endl;
+    stream << "                      contains a hit count followed by a rule." << std::endl;
+    stream << "  -h, --help          Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  /*
+   * Rules are matched to their statistics by their normalized
+   * string form, so the rule ids of the running daemon don't have
+   * to correspond to the rule order in the file.
+   */
+  typedef std::map<std::string, uint64_t> HitCountMap;
+
+  static void loadHitCounts(const std::string& path, HitCountMap& hit_counts)
+  {
+    std::ifstream stream(path);
+
+    if (!stream.is_open()) {
+      throw std::runtime_error("Cannot open the statistics file");
+    }
+
+    std::string line;
+    size_t line_number = 0;
+
+    while (std::getline(stream, line)) {
+      ++line_number;
+
+      const size_t count_begin = line.find_first_not_of(" \t");
+      if (count_begin == std::string::npos || line[count_begin] == '#') {
+        continue;
+      }
+
+      const size_t count_end = line.find_first_of(" \t", count_begin);
+      if (count_end == std::string::npos) {
+        throw std::runtime_error("Invalid statistics on line " + std::to_string(line_number));
+      }
+
+      const uint64_t count = std::stoull(line.substr(count_begin, count_end - count_begin));
+      const Rule rule = Rule::fromString(line.substr(count_end));
+
+      hit_counts[rule.toString()] += count;
+    }
+
+    return;
+  }
+
+  static void fetchHitCounts(HitCountMap& hit_counts)
+  {
+    usbguard::IPCClient ipc(/*connected=*/true);
+    RuleSet ruleset = ipc.listRules();
+    std::map<uint32_t, uint64_t> applied;
+
+    for (auto const& statistics : ipc.getRuleStatistics()) {
+      applied[statistics.rule_id] = statistics.applied;
+    }
+
+    for (auto const& rule : ruleset.getRules()) {
+      hit_counts[rule->toString()] += applied[rule->getRuleID()];
+    }
+
+    return;
+  }
+
+  int usbguard_optimize_policy(int argc, char *argv[])
+  {
+    std::string stats_path;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 's':
+          stats_path = optarg;
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    RuleSet ruleset(nullptr);
+    ruleset.load(argv[0]);
+
+    std::vector<Rule> rules;
+    for (auto const& rule : ruleset.getRules()) {
+      rules.push_back(*rule);
+    }
+
+    HitCountMap hit_counts;
+
+    if (stats_path.empty()) {
+      fetchHitCounts(hit_counts);
+    }
+    else {
+      loadHitCounts(stats_path, hit_counts);
+    }
+
+    PolicyOptimizer optimizer(rules);
+
+    for (size_t i = 0; i < rules.size(); ++i) {
+      auto it = hit_counts.find(rules[i].toString());
+      if (it != hit_counts.end()) {
+        optimizer.setHitCount(i, it->second);
+      }
+    }
+
+    for (auto const& shadowed : optimizer.findShadowedRules()) {
+      std::cerr << "Rule " << shadowed.first + 1
+                << " is shadowed by rule " << shadowed.second + 1
+                << ": " << rules[shadowed.first].toString() << std::endl;
+    }
+
+    RuleSet optimized_ruleset(nullptr);
+    for (const size_t index : optimizer.optimize()) {
+      optimized_ruleset.appendRule(rules[index]);
+    }
+    optimized_ruleset.save(std::cout);
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-policy.hpp"
+
+#include <IPCClient.hpp>
+#include <iostream>
+#include <iomanip>
+#include <ctime>
+
+namespace usbguard
+{
+  static const char *options_short = "h";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " policy [OPTIONS] <command>" << std::endl;
+    stream << std::endl;
+    stream << " Commands:" << std::endl;
+    stream << "  snapshot [<name>]   Save the current rule set of the daemon." << std::endl;
+    stream << "  list-snapshots      List the saved rule sets." << std::endl;
+    stream << "  rollback <version>  Restore a saved rule set." << std::endl;
+    stream << "  enable-group <group>   Enable the rules of a group." << std::endl;
+    stream << "  disable-group <group>  Disable the rules of a group." << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -h, --help  Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  static String formatTime(uint64_t time)
+  {
+    const time_t time_value = static_cast<time_t>(time);
+    struct tm time_tm;
+    char buffer[32];
+
+    if (::localtime_r(&time_value, &time_tm) == nullptr ||
+        ::strftime(buffer, sizeof buffer, "%Y-%m-%d %H:%M:%S", &time_tm) == 0) {
+      return std::to_string(time);
+    }
+
+    return buffer;
+  }
+
+  int usbguard_policy(int argc, char *argv[])
+  {
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    const String command = argv[0];
+
+    if (command == "snapshot" && argc <= 2) {
+      usbguard::IPCClient ipc(/*connected=*/true);
+      const uint32_t version = ipc.saveRuleSetSnapshot(argc == 2 ? argv[1] : "manual");
+      std::cout << version << std::endl;
+    }
+    else if (command == "list-snapshots" && argc == 1) {
+      usbguard::IPCClient ipc(/*connected=*/true);
+
+      for (auto const& snapshot : ipc.listRuleSetSnapshots()) {
+        std::cout << std::setw(6) << snapshot.version << ": "
+                  << formatTime(snapshot.time) << " "
+                  << std::setw(6) << snapshot.rule_count << " rules  "
+                  << snapshot.name << std::endl;
+      }
+    }
+    else if (command == "rollback" && argc == 2) {
+      const uint32_t version = std::stoul(argv[1]);
+      usbguard::IPCClient ipc(/*connected=*/true);
+      ipc.rollbackRuleSet(version);
+    }
+    else if ((command == "enable-group" || command == "disable-group") && argc == 2) {
+      usbguard::IPCClient ipc(/*connected=*/true);
+      ipc.setRuleGroupEnabled(argv[1], command == "enable-group");
+    }
+    else {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -18,27 +18,70 @@
 //
 #include "usbguard.hpp"
 #include "usbguard-read-descriptor.hpp"
+#include "DeviceSnapshot.hpp"
+#include "InventoryDevice.hpp"
+#include "Common/JSON.hpp"
+#include "Common/ThreadPool.hpp"
+#include "Common/Utility.hpp"
 #include <USB.hpp>
+#include <Hash.hpp>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <cinttypes>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace usbguard
 {
-  static const char *options_short = "h";
+  static const char *options_short = "hd:s:j:a:k:";
 
   static const struct ::option options_long[] = {
     { "help", no_argument, nullptr, 'h' },
+    { "device", required_argument, nullptr, 'd' },
+    { "summary", required_argument, nullptr, 's' },
+    { "jobs", required_argument, nullptr, 'j' },
+    { "hash-algorithm", required_argument, nullptr, 'a' },
+    { "hash-key-file", required_argument, nullptr, 'k' },
     { nullptr, 0, nullptr, 0 }
   };
 
   static void showHelp(std::ostream& stream)
   {
     stream << " Usage: " << usbguard_arg0 << " read-descriptor [OPTIONS] <file>" << std::endl;
+    stream << "        " << usbguard_arg0 << " read-descriptor --summary <format> [OPTIONS] <path> ..." << std::endl;
+    stream << std::endl;
+    stream << " The file contains raw descriptor data or a device snapshot written" << std::endl;
+    stream << " by the dump-devices command." << std::endl;
     stream << std::endl;
     stream << " Options:" << std::endl;
-    stream << "  -h, --help       Show this help." << std::endl;
+    stream << "  -d, --device <id>  Print only the descriptors of the device with the" << std::endl;
+    stream << "                     specified id from a device snapshot." << std::endl;
+    stream << "  -s, --summary <format>" << std::endl;
+    stream << "                     Parse all the files, the files in the directories and" << std::endl;
+    stream << "                     the files matching the glob patterns given as <path>" << std::endl;
+    stream << "                     and write a summary of each device and the interface" << std::endl;
+    stream << "                     type histogram. Formats: jsonl, csv." << std::endl;
+    stream << "  -j, --jobs <n>     Number of threads used for the summary (default:" << std::endl;
+    stream << "                     number of CPUs)." << std::endl;
+    stream << "  -a, --hash-algorithm <A>" << std::endl;
+    stream << "                     Compute the summary device hashes using the specified" << std::endl;
+    stream << "                     algorithm: sha256 (default), sha512, blake2b." << std::endl;
+    stream << "  -k, --hash-key-file <path>" << std::endl;
+    stream << "                     Compute keyed summary device hashes using the content" << std::endl;
+    stream << "                     of the file as the key." << std::endl;
+    stream << "  -h, --help         Show this help." << std::endl;
     stream << std::endl;
   }
 
@@ -51,8 +94,450 @@ namespace usbguard
   static void parseUnknownDescriptor(USBDescriptorParser*, const USBDescriptor*, USBDescriptor*);
   static void printUnknownDescriptor(USBDescriptorParser*, const USBDescriptor*);
 
+  static void printDescriptors(const uint8_t *data, size_t size)
+  {
+    USBDescriptorParser parser;
+
+    parser.setHandler(USB_DESCRIPTOR_TYPE_DEVICE, sizeof(USBDeviceDescriptor),
+                      USBParseDeviceDescriptor, printDeviceDescriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_CONFIGURATION, sizeof(USBConfigurationDescriptor),
+                      USBParseConfigurationDescriptor, printConfigurationDescriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_INTERFACE, sizeof(USBInterfaceDescriptor),
+                      USBParseInterfaceDescriptor, printInterfaceDescriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof(USBEndpointDescriptor),
+                      USBParseEndpointDescriptor, printEndpointDescriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof(USBAudioEndpointDescriptor),
+                      USBParseAudioEndpointDescriptor, printAudioEndpointDescriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_UNKNOWN, 0,
+                      parseUnknownDescriptor, printUnknownDescriptor);
+
+    const size_t size_parsed = parser.parse(data, size);
+
+    printf("Bytes parsed: %zu\n", size_parsed);
+
+    for (auto const& count : parser.getDescriptorCounts()) {
+      printf("Descriptor type 0x%02" PRIx8 " count: %zu\n", count.first, count.second);
+    }
+    return;
+  }
+
+  namespace
+  {
+    /*
+     * Read-only memory mapping of a whole file.
+     */
+    class MappedFile
+    {
+    public:
+      explicit MappedFile(const std::string& path)
+        : _data(nullptr),
+          _size(0)
+      {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+          throw std::runtime_error(std::string("cannot open the file: ") + strerror(errno));
+        }
+
+        struct ::stat st;
+
+        if (::fstat(fd, &st) != 0) {
+          const int saved_errno = errno;
+          ::close(fd);
+          throw std::runtime_error(std::string("cannot stat the file: ") + strerror(saved_errno));
+        }
+        if (st.st_size == 0) {
+          ::close(fd);
+          throw std::runtime_error("the file is empty");
+        }
+
+        void * const mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        const int saved_errno = errno;
+        ::close(fd);
+
+        if (mapping == MAP_FAILED) {
+          throw std::runtime_error(std::string("cannot map the file: ") + strerror(saved_errno));
+        }
+
+        _data = static_cast<const uint8_t *>(mapping);
+        _size = st.st_size;
+      }
+
+      ~MappedFile()
+      {
+        ::munmap(const_cast<uint8_t *>(_data), _size);
+      }
+
+      MappedFile(const MappedFile&) = delete;
+      const MappedFile& operator=(const MappedFile&) = delete;
+
+      const uint8_t *data() const
+      {
+        return _data;
+      }
+
+      size_t size() const
+      {
+        return _size;
+      }
+
+    private:
+      const uint8_t *_data;
+      size_t _size;
+    };
+
+    /*
+     * The summary of one device: a raw descriptor file or one
+     * device of a device snapshot. The error is empty if the
+     * descriptors were parsed.
+     */
+    struct DeviceSummary
+    {
+      std::string source;
+      std::string error;
+      size_t size;
+      size_t parsed;
+      std::string vendor_id;
+      std::string product_id;
+      std::string hash;
+      std::vector<std::string> interfaces;
+    };
+
+    /*
+     * The devices are never inserted into the device manager,
+     * so no ids are assigned.
+     */
+    class SummaryHooks : public DeviceManagerHooks
+    {
+    public:
+      uint32_t dmHookAssignID()
+      {
+        return Rule::DefaultID;
+      }
+    };
+
+    /*
+     * Parse the descriptors the same way as the daemon does and
+     * compute the device hash from the name, the device id, the
+     * serial number and the descriptor data, like the daemon.
+     */
+    DeviceSummary summarizeDevice(DeviceManager& manager, const std::string& source,
+                                  const std::string& name, const std::string& serial,
+                                  const uint8_t *data, size_t size)
+    {
+      DeviceSummary summary;
+
+      summary.source = source;
+      summary.size = size;
+      summary.parsed = 0;
+
+      try {
+        InventoryDevice device(manager);
+
+        device.setName(name);
+        device.setSerial(serial);
+
+        const size_t descriptor_expected_size = device.loadDescriptors(data, size);
+
+        if (descriptor_expected_size < sizeof(USBDeviceDescriptor)) {
+          throw std::runtime_error("parser processed less data than the size of a USB device descriptor");
+        }
+
+        device.updateHash(data, descriptor_expected_size);
+
+        summary.parsed = descriptor_expected_size;
+        summary.vendor_id = device.getDeviceID().getVendorID();
+        summary.product_id = device.getDeviceID().getProductID();
+        summary.hash = device.getHash();
+
+        for (auto const& interface_type : device.getInterfaceTypes()) {
+          summary.interfaces.push_back(interface_type.typeString());
+        }
+      }
+      catch(const std::exception& ex) {
+        summary.error = ex.what();
+      }
+
+      return summary;
+    }
+
+    /*
+     * Raw descriptor files are hashed with an empty name and serial
+     * number, which the descriptor data doesn't contain. The devices
+     * of a snapshot are hashed with their recorded values.
+     */
+    std::vector<DeviceSummary> summarizeFile(DeviceManager& manager, const std::string& path)
+    {
+      std::vector<DeviceSummary> summaries;
+
+      try {
+        const MappedFile file(path);
+
+        if (!DeviceSnapshot::isSnapshot(file.data(), file.size())) {
+          summaries.push_back(summarizeDevice(manager, path, std::string(), std::string(),
+                                              file.data(), file.size()));
+          return summaries;
+        }
+
+        const DeviceSnapshot snapshot(file.data(), file.size());
+
+        for (size_t i = 0; i < snapshot.count(); ++i) {
+          const DeviceSnapshot::Entry entry = snapshot.entry(i);
+          size_t size = 0;
+          const uint8_t * const descriptor_data = snapshot.descriptorData(i, size);
+
+          summaries.push_back(summarizeDevice(manager, path + ":" + std::to_string(entry.id),
+                                              entry.name, entry.serial, descriptor_data, size));
+        }
+      }
+      catch(const std::exception& ex) {
+        DeviceSummary summary;
+        summary.source = path;
+        summary.error = ex.what();
+        summary.size = 0;
+        summary.parsed = 0;
+        summaries.push_back(std::move(summary));
+      }
+
+      return summaries;
+    }
+
+    /*
+     * Regular files in the directory and its subdirectories,
+     * sorted by their path.
+     */
+    void listDirectoryFiles(const std::string& directory, std::vector<std::string>& paths)
+    {
+      DIR * const dir = ::opendir(directory.c_str());
+
+      if (dir == nullptr) {
+        throw std::runtime_error(directory + ": cannot open the directory: " + strerror(errno));
+      }
+
+      std::vector<std::string> entries;
+
+      for (const struct ::dirent *entry = ::readdir(dir); entry != nullptr; entry = ::readdir(dir)) {
+        const std::string name(entry->d_name);
+        if (name != "." && name != "..") {
+          entries.push_back(directory + "/" + name);
+        }
+      }
+
+      ::closedir(dir);
+      std::sort(entries.begin(), entries.end());
+
+      for (auto const& entry : entries) {
+        struct ::stat st;
+
+        if (::stat(entry.c_str(), &st) != 0) {
+          continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+          listDirectoryFiles(entry, paths);
+        }
+        else if (S_ISREG(st.st_mode)) {
+          paths.push_back(entry);
+        }
+      }
+    }
+
+    /*
+     * Expand the glob patterns and the directories. Paths which
+     * exist are used as they are, even if they contain glob
+     * characters.
+     */
+    std::vector<std::string> expandPaths(const std::vector<std::string>& arguments)
+    {
+      std::vector<std::string> paths;
+
+      for (auto const& argument : arguments) {
+        std::vector<std::string> matches;
+        struct ::stat st;
+
+        if (::stat(argument.c_str(), &st) == 0) {
+          matches.push_back(argument);
+        }
+        else {
+          ::glob_t glob_result;
+          const int retval = ::glob(argument.c_str(), 0, nullptr, &glob_result);
+
+          if (retval == 0) {
+            for (size_t i = 0; i < glob_result.gl_pathc; ++i) {
+              matches.push_back(glob_result.gl_pathv[i]);
+            }
+          }
+
+          ::globfree(&glob_result);
+
+          if (retval != 0 && retval != GLOB_NOMATCH) {
+            throw std::runtime_error(argument + ": cannot expand the pattern");
+          }
+          if (matches.empty()) {
+            throw std::runtime_error(argument + ": no such file");
+          }
+        }
+
+        for (auto const& match : matches) {
+          if (::stat(match.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            listDirectoryFiles(match, paths);
+          }
+          else {
+            paths.push_back(match);
+          }
+        }
+      }
+
+      return paths;
+    }
+
+    std::string csvField(const std::string& value)
+    {
+      if (value.find_first_of(",\"\n\r") == std::string::npos) {
+        return value;
+      }
+
+      std::string quoted = "\"";
+
+      for (const char c : value) {
+        if (c == '"') {
+          quoted.push_back('"');
+        }
+        quoted.push_back(c);
+      }
+
+      quoted.push_back('"');
+      return quoted;
+    }
+
+    /*
+     * The device records are followed by the histogram of the
+     * interface types (the number of devices with each type) and
+     * the device and failure counts. In the CSV format, these are
+     * rows of the "interface-type", "devices" and "failures" record
+     * types with the value in the count column.
+     */
+    void writeSummary(std::ostream& stream, const std::string& format,
+                      const std::vector<std::vector<DeviceSummary>>& file_summaries)
+    {
+      std::map<std::string, size_t> histogram;
+      size_t devices = 0;
+      size_t failures = 0;
+      const bool csv = (format == "csv");
+
+      if (csv) {
+        stream << "record,source,status,size,parsed,vendor_id,product_id,hash,interfaces,count,error\n";
+      }
+
+      for (auto const& summaries : file_summaries) {
+        for (auto const& summary : summaries) {
+          const bool parsed = summary.error.empty();
+
+          ++devices;
+          if (!parsed) {
+            ++failures;
+          }
+
+          std::vector<std::string> types(summary.interfaces);
+          std::sort(types.begin(), types.end());
+          types.erase(std::unique(types.begin(), types.end()), types.end());
+
+          for (auto const& type : types) {
+            ++histogram[type];
+          }
+
+          if (csv) {
+            std::string interfaces;
+            for (auto const& type : summary.interfaces) {
+              interfaces.append(interfaces.empty() ? "" : " ").append(type);
+            }
+            stream << "device," << csvField(summary.source) << ","
+                   << (parsed ? "ok" : "error") << ","
+                   << summary.size << "," << summary.parsed << ","
+                   << summary.vendor_id << "," << summary.product_id << ","
+                   << summary.hash << "," << interfaces << ",,"
+                   << csvField(summary.error) << "\n";
+          }
+          else {
+            json record = {
+              { "record", "device" },
+              { "source", summary.source },
+              { "status", parsed ? "ok" : "error" },
+              { "size", summary.size },
+              { "parsed", summary.parsed }
+            };
+            if (parsed) {
+              record["vendor_id"] = summary.vendor_id;
+              record["product_id"] = summary.product_id;
+              record["hash"] = summary.hash;
+              record["interfaces"] = summary.interfaces;
+            }
+            else {
+              record["error"] = summary.error;
+            }
+            stream << record.dump() << "\n";
+          }
+        }
+      }
+
+      if (csv) {
+        for (auto const& type_count : histogram) {
+          stream << "interface-type,,,,,,,," << type_count.first << "," << type_count.second << ",\n";
+        }
+        stream << "devices,,,,,,,,," << devices << ",\n";
+        stream << "failures,,,,,,,,," << failures << ",\n";
+      }
+      else {
+        const json record = {
+          { "record", "summary" },
+          { "devices", devices },
+          { "failures", failures },
+          { "interface_types", histogram }
+        };
+        stream << record.dump() << "\n";
+      }
+
+      stream.flush();
+    }
+  } /* namespace */
+
+  /*
+   * The files are mapped and parsed concurrently on the shared
+   * thread pool; the records are written in the order of the paths.
+   */
+  static int summarizeDescriptors(const std::vector<std::string>& arguments, const std::string& format,
+                                  size_t thread_count)
+  {
+    if (format != "jsonl" && format != "csv") {
+      throw std::runtime_error("Unknown summary format: " + format);
+    }
+
+    const std::vector<std::string> paths = expandPaths(arguments);
+    std::vector<std::vector<DeviceSummary>> file_summaries(paths.size());
+    SummaryHooks hooks;
+    InventoryDeviceManager manager(hooks);
+    const std::function<void(size_t)> summarize = [&](size_t i) {
+      file_summaries[i] = summarizeFile(manager, paths[i]);
+    };
+
+    if (thread_count <= 1 || paths.size() <= 1) {
+      for (size_t i = 0; i < paths.size(); ++i) {
+        summarize(i);
+      }
+    }
+    else {
+      ThreadPool::shared().parallelFor(paths.size(), summarize, thread_count);
+    }
+
+    writeSummary(std::cout, format, file_summaries);
+    return EXIT_SUCCESS;
+  }
+
   int usbguard_read_descriptor(int argc, char *argv[])
   {
+    bool device_selected = false;
+    uint32_t device_id = 0;
+    std::string summary_format;
+    size_t thread_count = std::thread::hardware_concurrency();
     int opt = 0;
 
     while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
@@ -60,6 +545,22 @@ namespace usbguard
         case 'h':
           showHelp(std::cout);
           return EXIT_SUCCESS;
+        case 'd':
+          device_selected = true;
+          device_id = stringToNumber<uint32_t>(optarg);
+          break;
+        case 's':
+          summary_format = optarg;
+          break;
+        case 'j':
+          thread_count = stringToNumber<size_t>(optarg);
+          break;
+        case 'a':
+          Hash::setDefaultAlgorithm(Hash::algorithmFromString(optarg));
+          break;
+        case 'k':
+          Hash::setDefaultKeyFromFile(optarg);
+          break;
         case '?':
           showHelp(std::cerr);
         default:
@@ -70,6 +571,14 @@ namespace usbguard
     argc -= optind;
     argv += optind;
 
+    if (!summary_format.empty()) {
+      if (argc < 1 || device_selected) {
+        showHelp(std::cerr);
+        return EXIT_FAILURE;
+      }
+      return summarizeDescriptors(std::vector<std::string>(argv, argv + argc), summary_format, thread_count);
+    }
+
     if (argc != 1) {
       showHelp(std::cerr);
       return EXIT_FAILURE;
@@ -80,30 +589,43 @@ namespace usbguard
     if (!descriptor_stream.good()) {
       throw std::runtime_error("Can't open file");
     }
-    else {
-      USBDescriptorParser parser;
-      
-      parser.setHandler(USB_DESCRIPTOR_TYPE_DEVICE, sizeof(USBDeviceDescriptor),
-                        USBParseDeviceDescriptor, printDeviceDescriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_CONFIGURATION, sizeof(USBConfigurationDescriptor),
-                        USBParseConfigurationDescriptor, printConfigurationDescriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_INTERFACE, sizeof(USBInterfaceDescriptor),
-                        USBParseInterfaceDescriptor, printInterfaceDescriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof(USBEndpointDescriptor),
-                        USBParseEndpointDescriptor, printEndpointDescriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof(USBAudioEndpointDescriptor),
-                        USBParseAudioEndpointDescriptor, printAudioEndpointDescriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_UNKNOWN, 0,
-                        parseUnknownDescriptor, printUnknownDescriptor);
 
-      const size_t size_parsed = parser.parse(descriptor_stream);
+    std::ostringstream buffer;
+    buffer << descriptor_stream.rdbuf();
+    const std::string data = buffer.str();
 
-      printf("Bytes parsed: %zu\n", size_parsed);
+    if (!DeviceSnapshot::isSnapshot(data.data(), data.size())) {
+      if (device_selected) {
+        throw std::runtime_error("The --device option requires a device snapshot");
+      }
+      printDescriptors(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+      return EXIT_SUCCESS;
+    }
 
-      for (auto const& count : parser.getDescriptorCounts()) {
-        printf("Descriptor type 0x%02" PRIx8 " count: %zu\n", count.first, count.second);
+    const DeviceSnapshot snapshot(data.data(), data.size());
+    bool found = false;
+
+    for (size_t i = 0; i < snapshot.count(); ++i) {
+      const DeviceSnapshot::Entry entry = snapshot.entry(i);
+
+      if (device_selected && entry.id != device_id) {
+        continue;
       }
+
+      printf("Device %" PRIu32 ": %s:%s \"%s\" port=%s\n\n", entry.id,
+             entry.vendor_id.c_str(), entry.product_id.c_str(), entry.name.c_str(), entry.port.c_str());
+
+      size_t size = 0;
+      const uint8_t * const descriptor_data = snapshot.descriptorData(i, size);
+      printDescriptors(descriptor_data, size);
+      printf("\n");
+      found = true;
     }
+
+    if (device_selected && !found) {
+      throw std::runtime_error("No such device in the snapshot");
+    }
+
     return EXIT_SUCCESS;
   }
 
@@ -0,0 +1,254 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-record-events.hpp"
+
+#include <DeviceEventRecording.hpp>
+#include <libudev.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+
+namespace usbguard
+{
+  static const char *options_short = "hkd:n:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "kernel", no_argument, nullptr, 'k' },
+    { "duration", required_argument, nullptr, 'd' },
+    { "count", required_argument, nullptr, 'n' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " record-events [OPTIONS] <file>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -k, --kernel              Record the kernel uevents instead of the udev events." << std::endl;
+    stream << "  -d, --duration <seconds>  Stop recording after the given time." << std::endl;
+    stream << "  -n, --count <count>       Stop recording after the given number of events." << std::endl;
+    stream << "  -h, --help                Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  static volatile sig_atomic_t G_stop_recording = 0;
+
+  static void stopRecording(int signum)
+  {
+    (void)signum;
+    G_stop_recording = 1;
+  }
+
+  static String readAttribute(const String& syspath, const char *name, bool strip_newline = true)
+  {
+    std::ifstream stream(syspath + "/" + name, std::ios::binary);
+    std::ostringstream value;
+
+    if (stream) {
+      value << stream.rdbuf();
+    }
+
+    String result = value.str();
+
+    while (strip_newline && !result.empty() && result.back() == '\n') {
+      result.pop_back();
+    }
+
+    return result;
+  }
+
+  /*
+   * The attributes are read right away, before the device can
+   * disappear. They're missing from the events of removed devices.
+   */
+  static DeviceEventRecording::Event makeEvent(struct udev_device *dev, const char *action, uint64_t time_ns)
+  {
+    DeviceEventRecording::Event event;
+    const char *sysname = udev_device_get_sysname(dev);
+    const char *syspath = udev_device_get_syspath(dev);
+
+    event.time_ns = time_ns;
+    event.action = action;
+    event.name = sysname != nullptr ? sysname : "";
+
+    if (syspath != nullptr && strcmp(action, "remove") != 0) {
+      event.product = readAttribute(syspath, "product");
+      event.serial = readAttribute(syspath, "serial");
+      event.authorized = readAttribute(syspath, "authorized");
+      event.descriptors = readAttribute(syspath, "descriptors", /*strip_newline=*/false);
+    }
+
+    return event;
+  }
+
+  static bool isUSBDevice(struct udev_device *dev)
+  {
+    const char *devtype = udev_device_get_devtype(dev);
+    return devtype != nullptr && strcmp(devtype, "usb_device") == 0;
+  }
+
+  /*
+   * The devices present when the recording starts are recorded as
+   * "present" events, so that a replay starts with the same tree.
+   */
+  static void recordPresentDevices(struct udev *udev, DeviceEventRecording::Writer& writer, uint64_t time_ns)
+  {
+    struct udev_enumerate *enumerate = udev_enumerate_new(udev);
+
+    if (enumerate == nullptr) {
+      throw std::runtime_error("udev_enumerate_new returned NULL");
+    }
+
+    udev_enumerate_add_match_subsystem(enumerate, "usb");
+    udev_enumerate_scan_devices(enumerate);
+
+    struct udev_list_entry *dlentry = nullptr;
+
+    udev_list_entry_foreach(dlentry, udev_enumerate_get_list_entry(enumerate)) {
+      struct udev_device *dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(dlentry));
+
+      if (dev == nullptr) {
+        continue;
+      }
+      if (isUSBDevice(dev)) {
+        writer.append(makeEvent(dev, "present", time_ns));
+      }
+
+      udev_device_unref(dev);
+    }
+
+    udev_enumerate_unref(enumerate);
+  }
+
+  int usbguard_record_events(int argc, char *argv[])
+  {
+    bool kernel_events = false;
+    uint64_t duration_seconds = 0;
+    uint64_t count = 0;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'k':
+          kernel_events = true;
+          break;
+        case 'd':
+          duration_seconds = std::stoull(optarg);
+          break;
+        case 'n':
+          count = std::stoull(optarg);
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    struct udev *udev = udev_new();
+
+    if (udev == nullptr) {
+      throw std::runtime_error("udev init error");
+    }
+
+    struct udev_monitor *umon = udev_monitor_new_from_netlink(udev, kernel_events ? "kernel" : "udev");
+
+    if (umon == nullptr) {
+      udev_unref(udev);
+      throw std::runtime_error("udev_monitor init error");
+    }
+
+    udev_monitor_filter_add_match_subsystem_devtype(umon, "usb", "usb_device");
+
+    struct sigaction action = { };
+    action.sa_handler = stopRecording;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    try {
+      DeviceEventRecording::Writer writer(argv[0]);
+      const auto started = std::chrono::steady_clock::now();
+      const auto elapsed_ns = [&started]() -> uint64_t {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+      };
+
+      /* Receive the events first, so that none is missed */
+      udev_monitor_enable_receiving(umon);
+      recordPresentDevices(udev, writer, elapsed_ns());
+      writer.flush();
+
+      uint64_t recorded = 0;
+
+      while (!G_stop_recording && (count == 0 || recorded < count)) {
+        if (duration_seconds > 0 && elapsed_ns() >= duration_seconds * 1000000000) {
+          break;
+        }
+
+        struct pollfd umon_pollfd = { udev_monitor_get_fd(umon), POLLIN, 0 };
+
+        if (poll(&umon_pollfd, 1, 100) <= 0) {
+          continue;
+        }
+
+        struct udev_device *dev = nullptr;
+
+        while ((count == 0 || recorded < count) && (dev = udev_monitor_receive_device(umon)) != nullptr) {
+          const char *action_cstr = udev_device_get_action(dev);
+
+          if (action_cstr != nullptr) {
+            writer.append(makeEvent(dev, action_cstr, elapsed_ns()));
+            ++recorded;
+          }
+
+          udev_device_unref(dev);
+        }
+
+        writer.flush();
+      }
+
+      std::cerr << recorded << " events recorded" << std::endl;
+    }
+    catch(...) {
+      udev_monitor_unref(umon);
+      udev_unref(udev);
+      throw;
+    }
+
+    udev_monitor_unref(umon);
+    udev_unref(udev);
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
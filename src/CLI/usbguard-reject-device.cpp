@@ -19,64 +19,12 @@
 #include "usbguard.hpp"
 #include "usbguard-reject-device.hpp"
 
-#include <IPCClient.hpp>
-#include <iostream>
+#include "DeviceTargetCommand.hpp"
 
 namespace usbguard
 {
-  static const char *options_short = "hp";
-
-  static const struct ::option options_long[] = {
-    { "help", no_argument, nullptr, 'h' },
-    { "permanent", no_argument, nullptr, 'p' },
-    { nullptr, 0, nullptr, 0 }
-  };
-
-  static void showHelp(std::ostream& stream)
-  {
-    stream << " Usage: " << usbguard_arg0 << " reject-device [OPTIONS] <device-id>" << std::endl;
-    stream << std::endl;
-    stream << " Options:" << std::endl;
-    stream << "  -p, --permanent  Make the decision permanent. A device specific reject" << std::endl;
-    stream << "                   rule will be appended to or updated in the current policy." << std::endl;
-    stream << "  -h, --help       Show this help." << std::endl;
-    stream << std::endl;
-  }
-
   int usbguard_reject_device(int argc, char *argv[])
   {
-    uint32_t id = 0;
-    bool permanent = false;
-    int opt = 0;
-
-    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
-      switch(opt) {
-        case 'h':
-          showHelp(std::cout);
-          return EXIT_SUCCESS;
-        case 'p':
-          permanent = true;
-          break;
-        case '?':
-          showHelp(std::cerr);
-        default:
-          return EXIT_FAILURE;
-      }
-    }
-
-    argc -= optind;
-    argv += optind;
-
-    if (argc != 1) {
-      showHelp(std::cerr);
-      return EXIT_FAILURE;
-    }
-
-    id = std::stoul(argv[0]);
-
-    usbguard::IPCClient ipc(/*connected=*/true);
-    ipc.rejectDevice(id, permanent, 0);
-
-    return EXIT_SUCCESS;
+    return usbguard_apply_device_target(argc, argv, "reject-device", Rule::Target::Reject);
   }
 } /* namespace usbguard */
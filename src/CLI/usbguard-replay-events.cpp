@@ -0,0 +1,225 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-replay-events.hpp"
+
+#include <DeviceEventRecording.hpp>
+#include <VirtualDeviceManager.hpp>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace usbguard
+{
+  static const char *options_short = "hs:l";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "speed", required_argument, nullptr, 's' },
+    { "list", no_argument, nullptr, 'l' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " replay-events [OPTIONS] <file> <sysfs-root> <event-stream>" << std::endl;
+    stream << "        " << usbguard_arg0 << " replay-events --list <file>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -s, --speed <factor>  Replay speed relative to the recording, 0 for no delays (default: 1)." << std::endl;
+    stream << "  -l, --list            Print the recorded events." << std::endl;
+    stream << "  -h, --help            Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  static void listEvents(DeviceEventRecording::Reader& reader)
+  {
+    DeviceEventRecording::Event event;
+
+    while (reader.next(event)) {
+      std::cout << std::fixed << std::setprecision(6) << (event.time_ns / 1e9)
+                << ' ' << event.action
+                << ' ' << event.name
+                << " authorized=" << (event.authorized.empty() ? String("-") : event.authorized)
+                << " descriptors=" << event.descriptors.size()
+                << " product=\"" << event.product << "\""
+                << " serial=\"" << event.serial << "\"" << std::endl;
+    }
+  }
+
+  /*
+   * Writes the event lines into the event stream of the virtual
+   * backend. The lines are buffered until the next delay.
+   */
+  class EventStreamWriter
+  {
+  public:
+    EventStreamWriter(const String& path)
+    {
+      _fd = ::open(path.c_str(), O_WRONLY|O_CLOEXEC);
+
+      if (_fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+      }
+    }
+
+    ~EventStreamWriter()
+    {
+      ::close(_fd);
+    }
+
+    void write(const String& action, const String& name)
+    {
+      _buffer += action + " " + name + "\n";
+
+      if (_buffer.size() >= 4096) {
+        flush();
+      }
+    }
+
+    void flush()
+    {
+      size_t offset = 0;
+
+      while (offset < _buffer.size()) {
+        const ssize_t size = ::write(_fd, _buffer.data() + offset, _buffer.size() - offset);
+
+        if (size < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw std::runtime_error(String("Cannot write the event stream: ") + strerror(errno));
+        }
+
+        offset += size;
+      }
+
+      _buffer.clear();
+    }
+
+  private:
+    int _fd;
+    String _buffer;
+  };
+
+  /*
+   * The devices are created in the tree when they appear in the
+   * recording, with the recorded attributes, and are linked in
+   * bus/usb/devices while they're plugged in. The "present" devices
+   * are announced with "add" events too, so the daemon may already
+   * be running. Events of other actions (e.g. "change") are skipped,
+   * the virtual backend doesn't process them.
+   */
+  static uint64_t replayEvents(DeviceEventRecording::Reader& reader, const String& root,
+                               const String& stream_path, double speed)
+  {
+    VirtualDeviceManager::createTree(root);
+    EventStreamWriter stream(stream_path);
+    DeviceEventRecording::Event event;
+    uint64_t replayed = 0;
+    const auto started = std::chrono::steady_clock::now();
+
+    while (reader.next(event)) {
+      const bool insertion = event.action == "add" || event.action == "present";
+
+      if (!insertion && event.action != "remove") {
+        continue;
+      }
+
+      if (speed > 0) {
+        const auto due = started + std::chrono::nanoseconds(static_cast<uint64_t>(event.time_ns / speed));
+
+        if (due > std::chrono::steady_clock::now()) {
+          stream.flush();
+          std::this_thread::sleep_until(due);
+        }
+      }
+
+      if (insertion) {
+        VirtualDeviceManager::writeDevice(root, event.name, event.descriptors, event.product, event.serial,
+                                          event.authorized == "1", /*present=*/true);
+        stream.write("add", event.name);
+      }
+      else {
+        stream.write("remove", event.name);
+        ::unlink((root + "/bus/usb/devices/" + event.name).c_str());
+      }
+
+      ++replayed;
+    }
+
+    stream.flush();
+    return replayed;
+  }
+
+  int usbguard_replay_events(int argc, char *argv[])
+  {
+    double speed = 1.0;
+    bool list = false;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 's':
+          speed = std::stod(optarg);
+          if (speed < 0) {
+            std::cerr << "The speed can't be negative." << std::endl;
+            return EXIT_FAILURE;
+          }
+          break;
+        case 'l':
+          list = true;
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != (list ? 1 : 3)) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    DeviceEventRecording::Reader reader(argv[0]);
+
+    if (list) {
+      listEvents(reader);
+      return EXIT_SUCCESS;
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    const uint64_t replayed = replayEvents(reader, argv[1], argv[2], speed);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    std::cerr << replayed << " events replayed in " << std::fixed << std::setprecision(3) << seconds << " s" << std::endl;
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -20,18 +20,27 @@
 #ifndef _GNU_SOURCE
 # define _GNU_SOURCE
 #endif
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <getopt.h>
 #include "Rule.hpp"
 #include "RuleParser.hpp"
 
-static const char *options_short = "hft";
+static const char *options_short = "hftj:q";
 
 static const struct ::option options_long[] = {
   { "help", no_argument, nullptr, 'h' },
   { "file", no_argument, nullptr, 'f' },
   { "trace", no_argument, nullptr, 't' },
+  { "jobs", required_argument, nullptr, 'j' },
+  { "quiet", no_argument, nullptr, 'q' },
   { nullptr, 0, nullptr, 0 }
 };
 
@@ -42,16 +51,320 @@ static void showHelp(std::ostream& stream, const char *usbguard_arg0)
   stream << std::endl;
   stream << " Options:" << std::endl;
   stream << "  -f, --file       Interpret the argument as a path to a file that should be parsed." << std::endl;
+  stream << "                   All the rules in the file are validated and checked for" << std::endl;
+  stream << "                   duplicate and shadowed rules." << std::endl;
+  stream << "  -j, --jobs <n>   Number of threads used to validate a file (default: number of CPUs)." << std::endl;
+  stream << "  -q, --quiet      Don't print the parsed rules, only the errors and warnings." << std::endl;
   stream << "  -t, --trace      Enable parser tracing." << std::endl;
   stream << "  -h, --help       Show this help." << std::endl;
   stream << std::endl;
 }
 
+static void showParserError(const usbguard::RuleParserError& ex, const std::string& rule_spec)
+{
+  std::cerr << "! ERROR: ";
+  if (ex.hasFileInfo()) {
+    std::cerr << ex.fileInfo() << ": ";
+  }
+  std::cerr << ex.hint() << std::endl;
+  std::cerr << "!!  " << rule_spec << std::endl;
+  std::cerr << "!!  ";
+  std::cerr.width(4 + ex.offset());
+  std::cerr << "^-- " << ex.hint() << std::endl;
+  std::cerr.width(1);
+}
+
+/*
+ * Result of parsing one line of a rule file.
+ */
+struct RuleLine
+{
+  std::string spec;
+  usbguard::Rule rule;
+  std::exception_ptr error;
+  size_t duplicate_of = 0;
+  size_t shadowed_by = 0;
+};
+
+static void runConcurrently(size_t count, size_t thread_count, const std::function<void(size_t,size_t)>& range_fn)
+{
+  const size_t range_size = (count + thread_count - 1) / thread_count;
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < thread_count; ++i) {
+    const size_t offset = std::min(i * range_size, count);
+    const size_t range_count = std::min(range_size, count - offset);
+    if (i + 1 < thread_count) {
+      threads.emplace_back(range_fn, offset, range_count);
+    }
+    else {
+      range_fn(offset, range_count);
+    }
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return;
+}
+
+/*
+ * A value of the shadowed rule has to describe a concrete device
+ * attribute value, i.e. it cannot contain a wildcard.
+ */
+template<class ValueType>
+static bool isConcreteAttribute(const usbguard::Rule::Attribute<ValueType>& attribute)
+{
+  if (attribute.setOperator() != usbguard::Rule::SetOperator::Equals) {
+    return false;
+  }
+  for (const auto& value : attribute.values()) {
+    if (usbguard::toRuleString(value).find('*') != std::string::npos) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Check whether every device matched by the shadowed attribute is
+ * also matched by the shadowing attribute. Only the cases where the
+ * answer is known for sure are reported as covered: the shadowing
+ * attribute is a wildcard or the shadowed attribute is a concrete
+ * device value for which the shadowing attribute can be evaluated.
+ */
+template<class ValueType>
+static bool coversAttribute(const usbguard::Rule::Attribute<ValueType>& shadowing,
+                            const usbguard::Rule::Attribute<ValueType>& shadowed)
+{
+  if (shadowing.empty() || shadowing.setOperator() == usbguard::Rule::SetOperator::Match) {
+    return true;
+  }
+  if (shadowed.empty() || !isConcreteAttribute(shadowed)) {
+    return false;
+  }
+  return shadowing.appliesTo(shadowed);
+}
+
+static bool shadowsRule(const usbguard::Rule& shadowing, const usbguard::Rule& shadowed)
+{
+  return coversAttribute(shadowing.attributeDeviceID(), shadowed.attributeDeviceID()) &&
+    coversAttribute(shadowing.attributeSerial(), shadowed.attributeSerial()) &&
+    coversAttribute(shadowing.attributeName(), shadowed.attributeName()) &&
+    coversAttribute(shadowing.attributeHash(), shadowed.attributeHash()) &&
+    coversAttribute(shadowing.attributeParentHash(), shadowed.attributeParentHash()) &&
+    coversAttribute(shadowing.attributeViaPort(), shadowed.attributeViaPort()) &&
+    coversAttribute(shadowing.attributeWithInterface(), shadowed.attributeWithInterface());
+}
+
+/*
+ * Index key of a single valued concrete attribute, or an empty string
+ * if the attribute cannot be used as an index key.
+ */
+template<class ValueType>
+static std::string attributeIndexKey(const usbguard::Rule::Attribute<ValueType>& attribute)
+{
+  if (attribute.count() != 1 || !isConcreteAttribute(attribute)) {
+    return std::string();
+  }
+  return usbguard::toRuleString(attribute.get());
+}
+
+/*
+ * Find duplicate rules and rules which can never be reached because
+ * every device they match is matched by an earlier rule. Only the
+ * unconditional allow, block and reject rules can shadow other rules.
+ * The rules which can shadow others are indexed by their hash and
+ * device id values, so a rule is compared only with the earlier rules
+ * that can possibly match the same devices.
+ */
+static void analyzeRules(std::vector<RuleLine>& lines, size_t thread_count)
+{
+  std::unordered_map<std::string, size_t> rule_strings;
+  std::unordered_map<std::string, std::vector<size_t>> hash_index;
+  std::unordered_map<std::string, std::vector<size_t>> id_index;
+  std::vector<size_t> unindexed;
+
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const usbguard::Rule& rule = lines[i].rule;
+
+    if (lines[i].error || !rule) {
+      continue;
+    }
+
+    const auto inserted = rule_strings.emplace(rule.toString(), i);
+    if (!inserted.second) {
+      lines[i].duplicate_of = inserted.first->second + 1;
+      continue;
+    }
+
+    if (!rule.attributeConditions().empty() ||
+        rule.getTarget() == usbguard::Rule::Target::Match) {
+      continue;
+    }
+
+    const std::string hash_key = attributeIndexKey(rule.attributeHash());
+    if (!hash_key.empty()) {
+      hash_index[hash_key].push_back(i);
+      continue;
+    }
+
+    const std::string id_key = attributeIndexKey(rule.attributeDeviceID());
+    if (!id_key.empty()) {
+      id_index[id_key].push_back(i);
+      continue;
+    }
+
+    unindexed.push_back(i);
+  }
+
+  static const std::vector<size_t> no_candidates;
+
+  auto findCandidates = \
+    [](const std::unordered_map<std::string, std::vector<size_t>>& index, const std::string& key)
+      -> const std::vector<size_t>&
+    {
+      if (key.empty()) {
+        return no_candidates;
+      }
+      const auto it = index.find(key);
+      return it != index.end() ? it->second : no_candidates;
+    };
+
+  runConcurrently(lines.size(), thread_count,
+    [&](size_t offset, size_t count) {
+      for (size_t i = offset; i < offset + count; ++i) {
+        RuleLine& line = lines[i];
+
+        if (line.error || !line.rule || line.duplicate_of != 0) {
+          continue;
+        }
+
+        const std::vector<size_t>* candidate_lists[] = {
+          &unindexed,
+          &findCandidates(hash_index, attributeIndexKey(line.rule.attributeHash())),
+          &findCandidates(id_index, attributeIndexKey(line.rule.attributeDeviceID()))
+        };
+
+        size_t shadowed_by = i;
+        for (const auto candidates : candidate_lists) {
+          for (const size_t candidate : *candidates) {
+            if (candidate >= shadowed_by) {
+              break;
+            }
+            if (shadowsRule(lines[candidate].rule, line.rule)) {
+              shadowed_by = candidate;
+              break;
+            }
+          }
+        }
+
+        if (shadowed_by != i) {
+          line.shadowed_by = shadowed_by + 1;
+        }
+      }
+    });
+
+  return;
+}
+
+static int validateRuleFile(const std::string& rule_file, size_t thread_count, bool quiet, bool trace)
+{
+  std::ifstream stream(rule_file);
+
+  if (!stream.is_open()) {
+    std::cerr << "! ERROR: " << rule_file << ": cannot open the file: " << strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<RuleLine> lines;
+  std::string line_string;
+
+  while (std::getline(stream, line_string)) {
+    lines.emplace_back();
+    lines.back().spec = std::move(line_string);
+  }
+
+  if (trace || thread_count == 0) {
+    thread_count = 1;
+  }
+  thread_count = std::max<size_t>(1, std::min(thread_count, lines.size()));
+
+  runConcurrently(lines.size(), thread_count,
+    [&lines, &rule_file, trace](size_t offset, size_t count) {
+      for (size_t i = offset; i < offset + count; ++i) {
+        try {
+          lines[i].rule = usbguard::parseRuleFromString(lines[i].spec, rule_file, i + 1, trace);
+        }
+        catch(...) {
+          lines[i].error = std::current_exception();
+        }
+      }
+    });
+
+  analyzeRules(lines, thread_count);
+
+  size_t rule_count = 0;
+  size_t error_count = 0;
+  size_t duplicate_count = 0;
+  size_t shadowed_count = 0;
+
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const RuleLine& line = lines[i];
+
+    if (line.error) {
+      ++error_count;
+      try {
+        std::rethrow_exception(line.error);
+      }
+      catch(const usbguard::RuleParserError& ex) {
+        showParserError(ex, line.spec);
+      }
+      catch(const std::exception& ex) {
+        std::cerr << "! EXCEPTION: " << rule_file << ": line=" << i + 1 << ": " << ex.what() << std::endl;
+      }
+      catch(...) {
+        std::cerr << "! EXCEPTION: " << rule_file << ": line=" << i + 1 << ": Unknown" << std::endl;
+      }
+      continue;
+    }
+
+    if (!line.rule) {
+      continue;
+    }
+
+    ++rule_count;
+
+    if (!quiet) {
+      std::cout << "INPUT: " << line.spec << std::endl;
+      std::cout << "OUTPUT: " << line.rule.toString() << std::endl;
+    }
+    if (line.duplicate_of != 0) {
+      ++duplicate_count;
+      std::cerr << "! WARNING: " << rule_file << ": line=" << i + 1
+        << ": duplicate of the rule on line " << line.duplicate_of << std::endl;
+    }
+    else if (line.shadowed_by != 0) {
+      ++shadowed_count;
+      std::cerr << "! WARNING: " << rule_file << ": line=" << i + 1
+        << ": shadowed by the rule on line " << line.shadowed_by << std::endl;
+    }
+  }
+
+  std::cout << rule_file << ": " << rule_count << " rules, "
+    << error_count << " errors, "
+    << duplicate_count << " duplicates, "
+    << shadowed_count << " shadowed" << std::endl;
+
+  return error_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv)
 {
   const char *usbguard_arg0 = argv[0];
   bool trace = false;
   bool from_file = false;
+  bool quiet = false;
+  size_t thread_count = std::thread::hardware_concurrency();
   int opt = 0;
 
   while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
@@ -65,6 +378,15 @@ int main(int argc, char **argv)
       case 't':
         trace = true;
         break;
+      case 'j':
+        thread_count = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'q':
+        quiet = true;
+        break;
+      case '?':
+        showHelp(std::cerr, usbguard_arg0);
+        return EXIT_FAILURE;
     }
   }
 
@@ -80,38 +402,22 @@ int main(int argc, char **argv)
 
   try {
     if (from_file) {
-      const std::string rule_file(argv[0]);
-      std::ifstream stream(rule_file);
-      size_t line = 0;
-
-      while (stream.good()) {
-        rule_spec.clear();
-        std::getline(stream, rule_spec);
-        if (rule_spec.empty()) {
-          break;
-        }
-        ++line;
-        std::cout << "INPUT: " << rule_spec << std::endl;
-        const usbguard::Rule rule = usbguard::parseRuleFromString(rule_spec, rule_file, line, trace);
-        std::cout << "OUTPUT: " << rule.toString() << std::endl;
-      }
-      return EXIT_SUCCESS;
+      return validateRuleFile(argv[0], thread_count, quiet, trace);
     }
     else {
       rule_spec = argv[0];
-      std::cout << "INPUT: " << rule_spec << std::endl;
+      if (!quiet) {
+        std::cout << "INPUT: " << rule_spec << std::endl;
+      }
       const usbguard::Rule rule = usbguard::parseRuleFromString(rule_spec, "<argv>", 0, trace);
-      std::cout << "OUTPUT: " << rule.toString() << std::endl;
+      if (!quiet) {
+        std::cout << "OUTPUT: " << rule.toString() << std::endl;
+      }
       return EXIT_SUCCESS;
      }
   }
   catch(const usbguard::RuleParserError& ex) {
-    std::cerr << "! ERROR: " << ex.what() << std::endl;
-    std::cerr << "!!  " << rule_spec << std::endl;
-    std::cerr << "!!  ";
-    std::cerr.width(4 + ex.offset());
-    std::cerr << "^-- " << ex.hint() << std::endl;
-    std::cerr.width(1);
+    showParserError(ex, rule_spec);
   }
   catch(const std::exception& ex) {
     std::cerr << "! EXCEPTION: " << ex.what() << std::endl;
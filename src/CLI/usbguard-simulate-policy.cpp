@@ -0,0 +1,235 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-simulate-policy.hpp"
+#include "InventoryDevice.hpp"
+
+#include <IPCClient.hpp>
+#include <DeviceSnapshot.hpp>
+#include <PolicySimulator.hpp>
+#include <RuleParser.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+namespace usbguard
+{
+  static const char *options_short = "hai:t:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "all", no_argument, nullptr, 'a' },
+    { "inventory", required_argument, nullptr, 'i' },
+    { "target", required_argument, nullptr, 't' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " simulate-policy [OPTIONS] <file>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -a, --all               List also the devices whose decision" << std::endl;
+    stream << "                          doesn't change." << std::endl;
+    stream << "  -i, --inventory <file>  Evaluate the rules against a device snapshot" << std::endl;
+    stream << "                          written by dump-devices instead of the devices" << std::endl;
+    stream << "                          of the USBGuard daemon. May be repeated." << std::endl;
+    stream << "  -t, --target <target>   Implicit policy target used with --inventory:" << std::endl;
+    stream << "                          allow, block (default) or reject." << std::endl;
+    stream << "  -h, --help              Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  namespace
+  {
+    /*
+     * The inventory device ids are taken from the snapshots, the
+     * devices are never inserted into the device manager.
+     */
+    class InventoryHooks : public DeviceManagerHooks
+    {
+    public:
+      uint32_t dmHookAssignID()
+      {
+        throw std::runtime_error("BUG: Inventory devices have their ids");
+      }
+    };
+  } /* namespace */
+
+  /*
+   * The devices keep the hash values computed by the daemon which
+   * wrote the snapshot, so the results don't depend on the hash
+   * settings of this system.
+   */
+  static void loadInventoryDevices(const std::string& path, InventoryDeviceManager& manager,
+                                   std::vector<PolicySimulator::Device>& devices,
+                                   std::vector<std::string>& sources)
+  {
+    const DeviceSnapshot snapshot(path);
+
+    for (size_t i = 0; i < snapshot.count(); ++i) {
+      const DeviceSnapshot::Entry entry = snapshot.entry(i);
+      auto device = makePointer<InventoryDevice>(manager);
+      PolicySimulator::Device simulated_device;
+
+      device->setID(entry.id);
+      device->setParentID(entry.parent_id);
+      device->setName(entry.name);
+      device->setDeviceID(USBDeviceID(entry.vendor_id, entry.product_id));
+      device->setSerial(entry.serial);
+      device->setPort(entry.port);
+      device->setTarget(entry.target);
+      device->setController(entry.parent_id == Rule::RootID);
+
+      try {
+        size_t size = 0;
+        const uint8_t * const data = snapshot.descriptorData(i, size);
+        device->loadDescriptors(data, size);
+        const std::vector<USBInterfaceType> interface_types = device->getInterfaceTypes();
+        device->restoreDescriptors(entry.descriptors, interface_types, entry.hash);
+      }
+      catch(const std::exception& ex) {
+        throw std::runtime_error(path + ":" + std::to_string(entry.id) + ": " + ex.what());
+      }
+
+      if (!entry.parent_hash.empty()) {
+        device->setParentHash(entry.parent_hash);
+      }
+
+      simulated_device.device_rule = \
+        device->getDeviceRule(/*with_port=*/true, /*with_parent_hash=*/!entry.parent_hash.empty());
+      simulated_device.target = entry.target;
+      simulated_device.rule_id = Rule::DefaultID;
+
+      devices.push_back(std::move(simulated_device));
+      sources.push_back(path);
+    }
+    return;
+  }
+
+  static std::string ruleIDString(uint32_t rule_id, bool known)
+  {
+    if (!known) {
+      return "?";
+    }
+    if (rule_id == Rule::DefaultID) {
+      return "implicit";
+    }
+    return std::to_string(rule_id);
+  }
+
+  int usbguard_simulate_policy(int argc, char *argv[])
+  {
+    bool list_all = false;
+    std::vector<std::string> inventory_paths;
+    Rule::Target implicit_target = Rule::Target::Block;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'a':
+          list_all = true;
+          break;
+        case 'i':
+          inventory_paths.push_back(optarg);
+          break;
+        case 't':
+          implicit_target = Rule::targetFromString(optarg);
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    std::ifstream stream(argv[0]);
+
+    if (!stream.is_open()) {
+      std::cerr << "Cannot open the rule file " << argv[0] << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    std::stringstream rules;
+    rules << stream.rdbuf();
+
+    std::vector<PolicySimulator::Decision> decisions;
+    std::vector<std::string> sources;
+
+    if (inventory_paths.empty()) {
+      usbguard::IPCClient ipc(/*connected=*/true);
+      decisions = ipc.simulatePolicy(rules.str());
+    }
+    else {
+      InventoryHooks hooks;
+      InventoryDeviceManager manager(hooks);
+      std::vector<PolicySimulator::Device> devices;
+
+      for (auto const& path : inventory_paths) {
+        loadInventoryDevices(path, manager, devices, sources);
+      }
+
+      try {
+        const PolicySimulator simulator(rules.str(), implicit_target);
+        decisions = simulator.evaluate(devices);
+      }
+      catch(const RuleParserError& ex) {
+        std::cerr << "Syntax error in " << argv[0] << " on line " << ex.line() << ": " << ex.hint() << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    size_t changed_count = 0;
+
+    for (size_t i = 0; i < decisions.size(); ++i) {
+      const PolicySimulator::Decision& decision = decisions[i];
+
+      if (decision.changed()) {
+        ++changed_count;
+      }
+      else if (!list_all) {
+        continue;
+      }
+
+      if (!sources.empty()) {
+        std::cout << sources[i] << ":";
+      }
+      std::cout << decision.id << ": "
+                << Rule::targetToString(decision.current_target) << " -> "
+                << Rule::targetToString(decision.target) << " (rule "
+                << ruleIDString(decision.current_rule_id, sources.empty()) << " -> "
+                << ruleIDString(decision.rule_id, /*known=*/true) << "): "
+                << decision.device_rule->toString() << std::endl;
+    }
+
+    std::cout << changed_count << " of " << decisions.size() << " device decisions change" << std::endl;
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
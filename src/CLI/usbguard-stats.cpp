@@ -0,0 +1,201 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-stats.hpp"
+
+#include <IPCClient.hpp>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+namespace usbguard
+{
+  static const char *options_short = "hbms";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "buckets", no_argument, nullptr, 'b' },
+    { "memory", no_argument, nullptr, 'm' },
+    { "startup", no_argument, nullptr, 's' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " stats [OPTIONS]" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -b, --buckets  Print the non-empty histogram buckets of each stage." << std::endl;
+    stream << "  -m, --memory   Print the memory usage of the daemon instead." << std::endl;
+    stream << "  -s, --startup  Print the startup profile of the daemon instead." << std::endl;
+    stream << "  -h, --help     Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  static void showMemoryStats(const IPCClient::MemoryStats& stats)
+  {
+    uint64_t total = 0;
+
+    std::cout << std::left << std::setw(18) << "subsystem" << std::right
+              << std::setw(14) << "bytes" << std::endl;
+
+    for (auto const& entry : stats.bytes) {
+      std::cout << std::left << std::setw(18) << entry.first << std::right
+                << std::setw(14) << entry.second << std::endl;
+      total += entry.second;
+    }
+
+    std::cout << std::left << std::setw(18) << "total" << std::right
+              << std::setw(14) << total << std::endl;
+    std::cout << std::left << std::setw(18) << "rss" << std::right
+              << std::setw(14) << stats.rss << std::endl;
+  }
+
+  static void showStartupProfile(const StartupProfile& profile)
+  {
+    std::cout << std::left << std::setw(24) << "phase" << std::right
+              << std::setw(12) << "start(us)"
+              << std::setw(12) << "time(us)" << std::endl;
+
+    for (auto const& phase : profile.phases) {
+      std::cout << std::left << std::setw(24) << phase.name << std::right
+                << std::setw(12) << phase.start_ns / 1000
+                << std::setw(12) << phase.duration_ns / 1000 << std::endl;
+    }
+
+    std::cout << std::left << std::setw(24) << "ready" << std::right
+              << std::setw(12) << profile.ready_ns / 1000 << std::endl;
+    std::cout << std::endl;
+
+    std::cout << std::left << std::setw(24) << "device" << std::right
+              << std::setw(12) << "load(us)"
+              << std::setw(12) << "decide(us)" << std::endl;
+
+    for (auto const& device : profile.devices) {
+      std::cout << std::left << std::setw(24) << device.id << std::right
+                << std::setw(12) << device.load_ns / 1000
+                << std::setw(12) << device.decision_ns / 1000 << std::endl;
+    }
+  }
+
+  int usbguard_stats(int argc, char *argv[])
+  {
+    bool show_buckets = false;
+    bool show_memory = false;
+    bool show_startup = false;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'b':
+          show_buckets = true;
+          break;
+        case 'm':
+          show_memory = true;
+          break;
+        case 's':
+          show_startup = true;
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    usbguard::IPCClient ipc(/*connected=*/true);
+
+    if (show_memory) {
+      showMemoryStats(ipc.getMemoryStats());
+      return EXIT_SUCCESS;
+    }
+
+    if (show_startup) {
+      showStartupProfile(ipc.getStartupProfile());
+      return EXIT_SUCCESS;
+    }
+
+    const std::vector<LatencyStatistics> latency = ipc.getLatencyStatistics();
+
+    /*
+     * The allocations are counted only by a daemon built with
+     * --enable-allocation-stats; the columns are left out otherwise.
+     */
+    const bool show_allocations = \
+      std::any_of(latency.cbegin(), latency.cend(), [](const LatencyStatistics& statistics) {
+        return statistics.allocations > 0;
+      });
+
+    /*
+     * The percentiles are the upper bounds of the histogram
+     * buckets, so they are accurate to a power of two.
+     */
+    std::cout << std::left << std::setw(18) << "stage" << std::right
+              << std::setw(10) << "count"
+              << std::setw(12) << "avg(us)"
+              << std::setw(12) << "p50(us)"
+              << std::setw(12) << "p99(us)"
+              << std::setw(12) << "max(us)";
+    if (show_allocations) {
+      std::cout << std::setw(12) << "allocs/op"
+                << std::setw(12) << "bytes/op";
+    }
+    std::cout << std::endl;
+
+    for (auto const& statistics : latency) {
+      const uint64_t average_us = \
+        statistics.count > 0 ? statistics.total_ns / statistics.count / 1000 : 0;
+
+      std::cout << std::left << std::setw(18) << LatencyStatistics::stageToString(statistics.stage) << std::right
+                << std::setw(10) << statistics.count
+                << std::setw(12) << average_us
+                << std::setw(12) << statistics.percentileUpperBound(50)
+                << std::setw(12) << statistics.percentileUpperBound(99)
+                << std::setw(12) << statistics.max_ns / 1000;
+      if (show_allocations) {
+        std::cout << std::setw(12) << (statistics.count > 0 ? statistics.allocations / statistics.count : 0)
+                  << std::setw(12) << (statistics.count > 0 ? statistics.allocated_bytes / statistics.count : 0);
+      }
+      std::cout << std::endl;
+
+      if (!show_buckets) {
+        continue;
+      }
+
+      for (size_t bucket = 0; bucket < statistics.histogram.size(); ++bucket) {
+        if (statistics.histogram[bucket] == 0) {
+          continue;
+        }
+        std::cout << "  ";
+        if (bucket + 1 < statistics.histogram.size()) {
+          std::cout << "< " << std::setw(10) << (uint64_t(1) << bucket) << "us";
+        }
+        else {
+          std::cout << ">= " << std::setw(9) << (uint64_t(1) << (bucket - 1)) << "us";
+        }
+        std::cout << std::setw(10) << statistics.histogram[bucket] << std::endl;
+      }
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-suggest-rules.hpp"
+
+#include <IPCClient.hpp>
+#include <iostream>
+
+namespace usbguard
+{
+  static const char *options_short = "ht:a:";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "target", required_argument, nullptr, 't' },
+    { "append", required_argument, nullptr, 'a' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " suggest-rules [OPTIONS] <id>" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -t, --target <target>       Target of the suggested rules (default: allow)." << std::endl;
+    stream << "  -a, --append <granularity>  Append the suggested rule with the granularity to the policy." << std::endl;
+    stream << "  -h, --help                  Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  int usbguard_suggest_rules(int argc, char *argv[])
+  {
+    Rule::Target target = Rule::Target::Allow;
+    std::string append_granularity;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 't':
+          target = Rule::targetFromString(optarg);
+          break;
+        case 'a':
+          append_granularity = optarg;
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+      showHelp(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    const uint32_t id = std::stoul(argv[0]);
+
+    usbguard::IPCClient ipc(/*connected=*/true);
+
+    for (auto const& suggestion : ipc.suggestRules(id)) {
+      Rule rule = Rule::fromString(suggestion.rule);
+      rule.setTarget(target);
+      const std::string rule_spec = rule.toString();
+
+      if (!append_granularity.empty()) {
+        if (suggestion.granularity == append_granularity) {
+          const uint32_t rule_id = ipc.appendRule(rule_spec, Rule::LastID, 0);
+          std::cout << rule_id << ": " << rule_spec << std::endl;
+          return EXIT_SUCCESS;
+        }
+        continue;
+      }
+
+      std::cout << suggestion.granularity << ": " << rule_spec << std::endl;
+      std::cout << "    also matches " << suggestion.matching_devices << " other present device(s)" << std::endl;
+    }
+
+    if (!append_granularity.empty()) {
+      std::cerr << "No rule with the granularity " << append_granularity << " was suggested." << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,265 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "usbguard.hpp"
+#include "usbguard-top.hpp"
+
+#include <IPCClient.hpp>
+#include "Common/Utility.hpp"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+namespace usbguard
+{
+  static const char *options_short = "hd:n:r:b";
+
+  static const struct ::option options_long[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "delay", required_argument, nullptr, 'd' },
+    { "iterations", required_argument, nullptr, 'n' },
+    { "rules", required_argument, nullptr, 'r' },
+    { "batch", no_argument, nullptr, 'b' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  static void showHelp(std::ostream& stream)
+  {
+    stream << " Usage: " << usbguard_arg0 << " top [OPTIONS]" << std::endl;
+    stream << std::endl;
+    stream << " Options:" << std::endl;
+    stream << "  -d, --delay <seconds>    Refresh interval, 1 second by default." << std::endl;
+    stream << "  -n, --iterations <count> Exit after this many refreshes." << std::endl;
+    stream << "  -r, --rules <count>      Number of the hottest rules to show (10)." << std::endl;
+    stream << "  -b, --batch              Don't clear the screen between refreshes." << std::endl;
+    stream << "  -h, --help               Show this help." << std::endl;
+    stream << std::endl;
+  }
+
+  namespace
+  {
+    /*
+     * The counters are totals since the daemon started, the
+     * rates are computed from the previous snapshot.
+     */
+    class TopView
+    {
+    public:
+      TopView(const MetricsSnapshot& previous, const MetricsSnapshot& current)
+        : _previous(previous),
+          _current(current),
+          _seconds(current.time_ms > previous.time_ms ? (current.time_ms - previous.time_ms) / 1000.0 : 1.0)
+      {
+      }
+
+      void render(std::ostream& stream) const
+      {
+        stream << std::fixed << std::setprecision(1);
+        stream << "devices " << gauge("devices")
+               << "  rules " << gauge("rules")
+               << "  ipc clients " << gauge("ipc_clients") << std::endl;
+        stream << "queues: device events " << gauge("device_event_queue")
+               << "  ipc read " << gauge("ipc_read_queue")
+               << "  ipc write " << gauge("ipc_write_queue")
+               << "  ipc output " << gauge("ipc_output_queue") << std::endl;
+        stream << std::endl;
+
+        stream << "events/s: inserted " << counterRate("usbguard_devices_inserted_total")
+               << "  removed " << counterRate("usbguard_devices_removed_total")
+               << "  allow " << counterRate("usbguard_decisions_allow_total")
+               << "  block " << counterRate("usbguard_decisions_block_total")
+               << "  reject " << counterRate("usbguard_decisions_reject_total") << std::endl;
+        stream << std::endl;
+
+        renderLatency(stream);
+        stream << std::endl;
+        renderRules(stream);
+        stream << std::endl;
+        renderIPC(stream);
+      }
+
+    private:
+      static uint64_t value(const std::map<std::string, uint64_t>& values, const std::string& name)
+      {
+        auto it = values.find(name);
+        return it != values.end() ? it->second : 0;
+      }
+
+      uint64_t gauge(const std::string& name) const
+      {
+        return value(_current.gauges, name);
+      }
+
+      double rate(uint64_t previous, uint64_t current) const
+      {
+        return current > previous ? (current - previous) / _seconds : 0.0;
+      }
+
+      double counterRate(const std::string& name) const
+      {
+        return rate(value(_previous.counters, name), value(_current.counters, name));
+      }
+
+      /*
+       * The percentiles are computed from the histogram
+       * of the durations recorded during the interval.
+       */
+      void renderLatency(std::ostream& stream) const
+      {
+        stream << std::left << std::setw(18) << "stage" << std::right
+               << std::setw(10) << "count/s"
+               << std::setw(12) << "p50(us)"
+               << std::setw(12) << "p99(us)" << std::endl;
+
+        for (auto const& current : _current.latency) {
+          LatencyStatistics interval = current;
+
+          for (auto const& previous : _previous.latency) {
+            if (previous.stage != current.stage) {
+              continue;
+            }
+            interval.count -= std::min(interval.count, previous.count);
+            for (size_t i = 0; i < interval.histogram.size() && i < previous.histogram.size(); ++i) {
+              interval.histogram[i] -= std::min(interval.histogram[i], previous.histogram[i]);
+            }
+          }
+
+          stream << std::left << std::setw(18) << LatencyStatistics::stageToString(current.stage) << std::right
+                 << std::setw(10) << interval.count / _seconds;
+          if (interval.count > 0) {
+            stream << std::setw(12) << interval.percentileUpperBound(50)
+                   << std::setw(12) << interval.percentileUpperBound(99);
+          }
+          else {
+            stream << std::setw(12) << "-" << std::setw(12) << "-";
+          }
+          stream << std::endl;
+        }
+      }
+
+      void renderRules(std::ostream& stream) const
+      {
+        stream << std::setw(8) << "rule"
+               << std::setw(12) << "applied/s"
+               << std::setw(14) << "evaluated/s"
+               << std::setw(14) << "applied" << std::endl;
+
+        for (auto const& current : _current.hottest_rules) {
+          uint64_t previous_applied = current.applied;
+          uint64_t previous_evaluated = current.evaluated;
+
+          for (auto const& previous : _previous.hottest_rules) {
+            if (previous.rule_id == current.rule_id) {
+              previous_applied = previous.applied;
+              previous_evaluated = previous.evaluated;
+              break;
+            }
+          }
+
+          stream << std::setw(8) << current.rule_id
+                 << std::setw(12) << rate(previous_applied, current.applied)
+                 << std::setw(14) << rate(previous_evaluated, current.evaluated)
+                 << std::setw(14) << current.applied << std::endl;
+        }
+      }
+
+      void renderIPC(std::ostream& stream) const
+      {
+        stream << std::left << std::setw(24) << "ipc method" << std::right
+               << std::setw(10) << "calls/s" << std::endl;
+
+        for (auto const& current : _current.ipc_requests) {
+          const double calls = rate(value(_previous.ipc_requests, current.first), current.second);
+          if (calls == 0.0) {
+            continue;
+          }
+          stream << std::left << std::setw(24) << current.first << std::right
+                 << std::setw(10) << calls << std::endl;
+        }
+      }
+
+      const MetricsSnapshot& _previous;
+      const MetricsSnapshot& _current;
+      const double _seconds;
+    };
+  } /* namespace */
+
+  int usbguard_top(int argc, char *argv[])
+  {
+    double delay_seconds = 1.0;
+    uint64_t iterations = 0;
+    uint32_t top_rules = 10;
+    bool batch = false;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout);
+          return EXIT_SUCCESS;
+        case 'd':
+          delay_seconds = std::stod(optarg);
+          if (delay_seconds <= 0) {
+            std::cerr << "The delay has to be positive." << std::endl;
+            return EXIT_FAILURE;
+          }
+          break;
+        case 'n':
+          iterations = stringToNumber<uint64_t>(optarg);
+          break;
+        case 'r':
+          top_rules = stringToNumber<uint32_t>(optarg);
+          break;
+        case 'b':
+          batch = true;
+          break;
+        case '?':
+          showHelp(std::cerr);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    const bool clear_screen = !batch && isatty(STDOUT_FILENO);
+    const auto delay = std::chrono::milliseconds(static_cast<uint64_t>(delay_seconds * 1000));
+
+    usbguard::IPCClient ipc(/*connected=*/true);
+    MetricsSnapshot previous = ipc.getMetricsSnapshot(top_rules);
+
+    for (uint64_t iteration = 0; iterations == 0 || iteration < iterations; ++iteration) {
+      std::this_thread::sleep_for(delay);
+      const MetricsSnapshot current = ipc.getMetricsSnapshot(top_rules);
+
+      if (clear_screen) {
+        std::cout << "\033[H\033[2J";
+      }
+      else if (iteration > 0) {
+        std::cout << std::endl;
+      }
+
+      TopView(previous, current).render(std::cout);
+      std::cout << std::flush;
+      previous = current;
+    }
+
+    return EXIT_SUCCESS;
+  }
+} /* namespace usbguard */
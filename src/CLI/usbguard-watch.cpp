@@ -20,14 +20,21 @@
 #include "usbguard-list-rules.hpp"
 
 #include <IPCSignalWatcher.hpp>
+#include "Common/Utility.hpp"
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace usbguard
 {
-  static const char *options_short = "h";
+  static const char *options_short = "hf:F:s:m:";
 
   static const struct ::option options_long[] = {
     { "help", no_argument, nullptr, 'h' },
+    { "format", required_argument, nullptr, 'f' },
+    { "flush", required_argument, nullptr, 'F' },
+    { "signals", required_argument, nullptr, 's' },
+    { "match", required_argument, nullptr, 'm' },
     { nullptr, 0, nullptr, 0 }
   };
 
@@ -36,19 +43,65 @@ namespace usbguard
     stream << " Usage: " << usbguard_arg0 << " watch [OPTIONS]" << std::endl;
     stream << std::endl;
     stream << " Options:" << std::endl;
-    stream << "  -h, --help  Show this help." << std::endl;
+    stream << "  -f, --format <format>  Output format: text (default), jsonl (one JSON" << std::endl;
+    stream << "                         object per line) or binary (MessagePack, each" << std::endl;
+    stream << "                         event prefixed by its 32-bit little-endian size)." << std::endl;
+    stream << "  -F, --flush <policy>   When to write the output: event (after each event," << std::endl;
+    stream << "                         the default) or size (when the buffer is full)." << std::endl;
+    stream << "  -s, --signals <list>   Comma separated list of the signals to receive." << std::endl;
+    stream << "  -m, --match <rule>     Receive only the signals about devices matching" << std::endl;
+    stream << "                         the rule, e.g. 'match with-interface 08:*:*'." << std::endl;
+    stream << "  -h, --help             Show this help." << std::endl;
     stream << std::endl;
   }
 
   int usbguard_watch(int argc, char *argv[])
   {
+    IPCSignalWatcher::Format format = IPCSignalWatcher::Format::Text;
+    IPCSignalWatcher::FlushPolicy flush_policy = IPCSignalWatcher::FlushPolicy::Event;
+    std::vector<std::string> signals;
+    std::string device_match;
     int opt = 0;
 
     while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      const std::string value = optarg != nullptr ? optarg : "";
       switch(opt) {
         case 'h':
           showHelp(std::cout);
           return EXIT_SUCCESS;
+        case 'f':
+          if (value == "text") {
+            format = IPCSignalWatcher::Format::Text;
+          }
+          else if (value == "jsonl") {
+            format = IPCSignalWatcher::Format::JSONLines;
+          }
+          else if (value == "binary") {
+            format = IPCSignalWatcher::Format::Binary;
+          }
+          else {
+            showHelp(std::cerr);
+            return EXIT_FAILURE;
+          }
+          break;
+        case 'F':
+          if (value == "event") {
+            flush_policy = IPCSignalWatcher::FlushPolicy::Event;
+          }
+          else if (value == "size") {
+            flush_policy = IPCSignalWatcher::FlushPolicy::Size;
+          }
+          else {
+            showHelp(std::cerr);
+            return EXIT_FAILURE;
+          }
+          break;
+        case 's':
+          tokenizeString(value, signals, ",", /*trim_empty=*/true);
+          break;
+        case 'm':
+          device_match = value;
+          break;
         case '?':
           showHelp(std::cerr);
         default:
@@ -56,7 +109,12 @@ namespace usbguard
       }
     }
 
-    IPCSignalWatcher watcher;
+    IPCSignalWatcher watcher(format, flush_policy);
+
+    /* The filters are applied by the daemon */
+    if (!signals.empty() || !device_match.empty()) {
+      watcher.setSubscription(signals, device_match);
+    }
 
     watcher.connect();
     watcher.wait();
@@ -29,8 +29,14 @@
 
 #include "usbguard.hpp"
 #include "usbguard-list-devices.hpp"
+#include "usbguard-dump-devices.hpp"
 #include "usbguard-list-rules.hpp"
 #include "usbguard-generate-policy.hpp"
+#include "usbguard-optimize-policy.hpp"
+#include "usbguard-simulate-policy.hpp"
+#include "usbguard-explain-device.hpp"
+#include "usbguard-suggest-rules.hpp"
+#include "usbguard-top.hpp"
 #include "usbguard-allow-device.hpp"
 #include "usbguard-block-device.hpp"
 #include "usbguard-reject-device.hpp"
@@ -38,6 +44,13 @@
 #include "usbguard-remove-rule.hpp"
 #include "usbguard-watch.hpp"
 #include "usbguard-read-descriptor.hpp"
+#include "usbguard-audit.hpp"
+#include "usbguard-record-events.hpp"
+#include "usbguard-replay-events.hpp"
+#include "usbguard-stats.hpp"
+#include "usbguard-policy.hpp"
+#include "usbguard-apply-policy.hpp"
+#include "usbguard-compile-policy.hpp"
 
 namespace usbguard
 {
@@ -45,15 +58,28 @@ namespace usbguard
 
   static const std::map<const std::string,int(*)(int, char**)> cmd_handler_map = {
     { "list-devices", &usbguard_list_devices },
+    { "dump-devices", &usbguard_dump_devices },
     { "allow-device", &usbguard_allow_device },
     { "block-device", &usbguard_block_device },
     { "reject-device", &usbguard_reject_device },
     { "list-rules", &usbguard_list_rules },
     { "append-rule", &usbguard_append_rule },
     { "remove-rule", &usbguard_remove_rule },
+    { "policy", &usbguard_policy },
+    { "apply-policy", &usbguard_apply_policy },
     { "generate-policy", &usbguard_generate_policy },
+    { "optimize-policy", &usbguard_optimize_policy },
+    { "simulate-policy", &usbguard_simulate_policy },
+    { "explain-device", &usbguard_explain_device },
+    { "suggest-rules", &usbguard_suggest_rules },
+    { "compile-policy", &usbguard_compile_policy },
     { "watch", &usbguard_watch },
-    { "read-descriptor", &usbguard_read_descriptor }
+    { "top", &usbguard_top },
+    { "read-descriptor", &usbguard_read_descriptor },
+    { "audit", &usbguard_audit },
+    { "record-events", &usbguard_record_events },
+    { "replay-events", &usbguard_replay_events },
+    { "stats", &usbguard_stats }
   };
 
   static void showTopLevelHelp(std::ostream& stream = std::cout)
@@ -65,6 +91,7 @@ namespace usbguard
     stream << "" << std::endl;
     stream << " Commands:" << std::endl;
     stream << "  list-devices        List all USB devices recognized by the USBGuard daemon." << std::endl;
+    stream << "  dump-devices        Write a binary snapshot of the state of all USB devices." << std::endl;
     stream << "  allow-device <id>   Authorize a device to interact with the system." << std::endl;
     stream << "  block-device <id>   Deauthorize a device." << std::endl;
     stream << "  reject-device <id>  Deauthorize and remove a device from the system." << std::endl;
@@ -72,10 +99,22 @@ namespace usbguard
     stream << "  list-rules          List the rule set (policy) used by the USBGuard daemon." << std::endl;
     stream << "  append-rule <rule>  Append a rule to the rule set." << std::endl;
     stream << "  remove-rule <id>    Remove a rule from the rule set." << std::endl;
+    stream << "  policy <command>    Save, list and restore snapshots of the rule set." << std::endl;
+    stream << "  apply-policy <file> Replace the rule set with the rules of a file, keeping unchanged rules." << std::endl;
     stream << std::endl;
     stream << "  generate-policy     Generate a rule set (policy) based on the connected USB devices." << std::endl;
+    stream << "  optimize-policy     Reorder a rule set (policy) so that frequently matched rules come first." << std::endl;
+    stream << "  simulate-policy     Show which device decisions a rule set (policy) would change." << std::endl;
+    stream << "  explain-device      Show how the rules are matched against a device." << std::endl;
+    stream << "  suggest-rules       Suggest rules of different granularity for a device." << std::endl;
+    stream << "  compile-policy      Compile a rule set (policy) into a full or delta policy bundle." << std::endl;
     stream << "  watch               Watch for IPC interface events and print them to stdout." << std::endl;
+    stream << "  top                 Show the event rates, latencies and hottest rules of the daemon." << std::endl;
     stream << "  read-descriptor     Read a USB descriptor from a file and print it in human-readable form." << std::endl;
+    stream << "  audit               Print the records of the authorization decision audit log." << std::endl;
+    stream << "  record-events       Record the USB device events of the system into a file." << std::endl;
+    stream << "  replay-events       Replay recorded device events into the virtual device manager." << std::endl;
+    stream << "  stats               Print the latency statistics of the device authorization stages." << std::endl;
     stream << std::endl;
   }
 
@@ -101,7 +140,7 @@ namespace usbguard
       return EXIT_FAILURE;
     }
 
-    logger->debug("Executing subcommand \"{}\"", subcommand_key);
+    USBGUARD_LOG_DEBUG("Executing subcommand \"{}\"", subcommand_key);
     auto subcommand = iterator->second;
     return subcommand(argc - 1, argv + 1);
   }
@@ -0,0 +1,137 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace usbguard {
+  /*
+   * Length-prefixed binary serialization used by the cache and
+   * checkpoint files. Integers are stored in the host byte order,
+   * the files are meant to be read back by the same host.
+   */
+  class ByteWriter
+  {
+  public:
+    void u8(uint8_t value)
+    {
+      _data.push_back(static_cast<char>(value));
+    }
+
+    void u32(uint32_t value)
+    {
+      _data.append(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+
+    void u64(uint64_t value)
+    {
+      _data.append(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+
+    void string(const String& value)
+    {
+      u32(value.size());
+      _data.append(value);
+    }
+
+    void bytes(const void *buffer, size_t size)
+    {
+      _data.append(static_cast<const char *>(buffer), size);
+    }
+
+    const String& data() const
+    {
+      return _data;
+    }
+
+  private:
+    String _data;
+  };
+
+  /*
+   * Reads the data written by ByteWriter. Reading past the end
+   * of the data throws an exception.
+   */
+  class ByteReader
+  {
+  public:
+    ByteReader(const uint8_t *data, size_t size)
+      : _data(data),
+        _size(size)
+    {
+    }
+
+    uint8_t u8()
+    {
+      return *take(1);
+    }
+
+    uint32_t u32()
+    {
+      uint32_t value;
+      std::memcpy(&value, take(sizeof value), sizeof value);
+      return value;
+    }
+
+    uint64_t u64()
+    {
+      uint64_t value;
+      std::memcpy(&value, take(sizeof value), sizeof value);
+      return value;
+    }
+
+    String string()
+    {
+      const uint32_t size = u32();
+      return String(reinterpret_cast<const char *>(take(size)), size);
+    }
+
+    void bytes(void *buffer, size_t size)
+    {
+      std::memcpy(buffer, take(size), size);
+    }
+
+    bool empty() const
+    {
+      return _size == 0;
+    }
+
+    size_t remaining() const
+    {
+      return _size;
+    }
+
+  private:
+    const uint8_t *take(size_t size)
+    {
+      if (size > _size) {
+        throw std::runtime_error("unexpected end of data");
+      }
+      const uint8_t *ptr = _data;
+      _data += size;
+      _size -= size;
+      return ptr;
+    }
+
+    const uint8_t *_data;
+    size_t _size;
+  };
+} /* namespace usbguard */
@@ -22,11 +22,35 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdexcept>
+
+#if defined(__linux__)
+# include <sys/syscall.h>
+# include <sys/eventfd.h>
+# include <linux/futex.h>
+#endif
 
 #ifndef CCBQUEUE_STATE_BITS
 # define CCBQUEUE_STATE_BITS 32
 #endif
 
+/*
+ * Number of times the *Wait() operations yield the CPU and retry
+ * before they sleep. A short wait is cheaper than a futex sleep and
+ * the wakeup system call in the other thread.
+ */
+#ifndef CCBQUEUE_SPIN_COUNT
+# define CCBQUEUE_SPIN_COUNT 32
+#endif
+
+#ifndef CCBQUEUE_CACHELINE_SIZE
+# define CCBQUEUE_CACHELINE_SIZE 64
+#endif
+
 namespace CCBQueueOpt
 {
   enum BlockingMethod {
@@ -38,6 +62,24 @@ namespace CCBQueueOpt
   };
 }
 
+/*
+ * Concurrent circular buffer queue.
+ *
+ * Items are passed in preallocated slots. A producer acquires a free
+ * slot, fills it and enqueues it; a consumer dequeues a slot, reads
+ * it and releases it. Slots are enqueued and released in the order
+ * they were acquired and dequeued: enqueue() and release() fail for
+ * a slot which isn't the next one, and the caller retries after the
+ * earlier slots were handled by the other threads. With a single
+ * producer or a single consumer that never happens on that side.
+ *
+ * The non-blocking operations are lock-free. The *Wait() operations
+ * sleep on a futex until the queue state changes, and the queue can
+ * optionally signal an eventfd whenever it becomes non-empty, so that
+ * a consumer can wait for items in an epoll or qb_loop event loop.
+ * The slots are raw memory: items with a non-trivial type have to be
+ * constructed and destroyed by the caller.
+ */
 template<typename T,
 	 CCBQueueOpt::BlockingMethod = CCBQueueOpt::NoBlocking,
 	 const struct timespec * sleep_ts = static_cast<const struct timespec *>(nullptr)>
@@ -77,9 +119,31 @@ private:
   uint8_t* _queue_mem;
   const size_t _item_size;
   const count_type _capacity;
+  int _event_fd;
 
+  /*
+   * The state words are written by different threads. Each of them
+   * gets its own cache line, so that producers and consumers don't
+   * invalidate each other's line on every operation.
+   */
+  uint8_t _pad_shared[CCBQUEUE_CACHELINE_SIZE];
   State _r_state; // readability state
+  uint8_t _pad_r_state[CCBQUEUE_CACHELINE_SIZE - sizeof(State)];
   State _w_state; // writability state
+  uint8_t _pad_w_state[CCBQUEUE_CACHELINE_SIZE - sizeof(State)];
+  /*
+   * Futex words, incremented whenever an item was enqueued (_r_futex)
+   * or released (_w_futex), and the number of threads sleeping on
+   * them. A change is only signaled to the kernel if some thread
+   * sleeps.
+   */
+  uint32_t _r_futex;
+  uint32_t _r_waiters;
+  uint8_t _pad_r_futex[CCBQUEUE_CACHELINE_SIZE - 2 * sizeof(uint32_t)];
+  uint32_t _w_futex;
+  uint32_t _w_waiters;
+  uint32_t _closed;
+  uint8_t _pad_w_futex[CCBQUEUE_CACHELINE_SIZE - 3 * sizeof(uint32_t)];
 
 protected:
   T* indexToPointer(index_type index) const __attribute__((/*returns_nonnull,*/ nothrow, hot))
@@ -92,21 +156,35 @@ protected:
     return (index_type)((((uintptr_t)pointer) - ((uintptr_t)_queue_mem)) / _item_size);
   }
 
-  // Modifies write state (++count)
-  index_type acquireFreeIndex() __attribute__((nothrow))
+  index_type wrapIndex(size_t index) const __attribute__((nothrow))
+  {
+    return (index_type)(index % _capacity);
+  }
+
+  static state_type loadState(const State& state) __attribute__((nothrow))
+  {
+    return __atomic_load_n(&state.unified, __ATOMIC_ACQUIRE);
+  }
+
+  // Modifies write state (count += n)
+  index_type acquireFreeIndexes(count_type max_count, count_type& count) __attribute__((nothrow))
   {
     State w_state_old, w_state_new;
     do {
       // Read the current state
-      w_state_old.unified = _w_state.unified;
-      // Check whether there's scape for a new item
-      if (w_state_old.count >= _capacity) {
+      w_state_old.unified = loadState(_w_state);
+      // Check whether there's space for new items
+      if (w_state_old.count >= _capacity || max_count == 0) {
 	// No free index
 	return invalid_index;
       }
+      count = _capacity - w_state_old.count;
+      if (count > max_count) {
+	count = max_count;
+      }
       // Create a new state
       w_state_new.unified = w_state_old.unified;
-      ++w_state_new.count;
+      w_state_new.count += count;
       //
       // Try to atomically update the state, repeat the
       // whole process if it fails
@@ -115,27 +193,29 @@ protected:
 					  w_state_old.unified,
 					  w_state_new.unified));
 
-    return ((w_state_old.begin + w_state_old.count) % _capacity);
+    return wrapIndex((size_t)w_state_old.begin + w_state_old.count);
   }
 
-  // Modifies read state (++begin, --count)
-  index_type acquireReadIndex() __attribute__((nothrow))
+  // Modifies read state (begin += n, count -= n)
+  index_type acquireReadIndexes(count_type max_count, count_type& count) __attribute__((nothrow))
   {
     State r_state_old, r_state_new;
     do {
       // Read the current state
-      r_state_old.unified = _r_state.unified;
+      r_state_old.unified = loadState(_r_state);
       // Check whether there's something to read
-      if (r_state_old.count == 0) {
+      if (r_state_old.count == 0 || max_count == 0) {
 	return invalid_index;
       }
+      count = r_state_old.count;
+      if (count > max_count) {
+	count = max_count;
+      }
       // Create a new state
       r_state_new.unified = r_state_old.unified;
-      --r_state_new.count;
+      r_state_new.count -= count;
       // Wrap the .begin index if needed
-      if (++r_state_new.begin == _capacity) {
-	r_state_new.begin = 0;
-      }
+      r_state_new.begin = wrapIndex((size_t)r_state_old.begin + count);
       //
       // Try to atomically update the state, repeat the
       // while process if it fails
@@ -149,36 +229,137 @@ protected:
   index_type nextEnqueueIndex() __attribute__((nothrow))
   {
     State r_state;
-    r_state.unified = __sync_add_and_fetch(&_r_state.unified, 0);
-    return ((r_state.begin + r_state.count) % _capacity);
+    r_state.unified = loadState(_r_state);
+    return wrapIndex((size_t)r_state.begin + r_state.count);
   }
 
   index_type nextReleaseIndex() __attribute__((nothrow))
   {
     State w_state;
-    w_state.unified = __sync_add_and_fetch(&_w_state.unified, 0);
+    w_state.unified = loadState(_w_state);
     return w_state.begin;
   }
 
+  void notify(uint32_t* futex_word, uint32_t* waiters) __attribute__((nothrow))
+  {
+    __atomic_add_fetch(futex_word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0) {
+#if defined(__linux__)
+      syscall(SYS_futex, futex_word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+  }
+
+  void notifyEventFD() __attribute__((nothrow))
+  {
+#if defined(__linux__)
+    if (_event_fd >= 0) {
+      const uint64_t one = 1;
+      if (write(_event_fd, &one, sizeof one) != sizeof one) {
+	/* The counter is saturated, i.e. the descriptor is readable */
+      }
+    }
+#endif
+  }
+
+  /*
+   * Sleep until the futex word differs from `value', the timeout
+   * expires or a signal interrupts the wait. A negative timeout
+   * never expires. Returns false if the timeout expired.
+   */
+  bool sleep(uint32_t* futex_word, uint32_t* waiters, uint32_t value,
+	     const struct timespec* deadline) __attribute__((nothrow))
+  {
+    struct timespec timeout = { 0, 0 };
+
+    if (deadline != nullptr) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      timeout.tv_sec = deadline->tv_sec - now.tv_sec;
+      timeout.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+      if (timeout.tv_nsec < 0) {
+	timeout.tv_nsec += 1000000000L;
+	--timeout.tv_sec;
+      }
+      if (timeout.tv_sec < 0) {
+	return false;
+      }
+    }
+
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+#if defined(__linux__)
+    const long rc = syscall(SYS_futex, futex_word, FUTEX_WAIT_PRIVATE, value,
+			    deadline != nullptr ? &timeout : nullptr, nullptr, 0);
+    const bool timed_out = (rc != 0 && errno == ETIMEDOUT);
+#else
+    const struct timespec pause = { 0, 100000 };
+    (void)value;
+    nanosleep(&pause, nullptr);
+    const bool timed_out = false;
+#endif
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    return !timed_out;
+  }
+
+  static void makeDeadline(int timeout_ms, struct timespec& deadline) __attribute__((nothrow))
+  {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      ++deadline.tv_sec;
+    }
+  }
+
 public:
-  CCBQueue(uint32_t max_memory_MiB)
+  /*
+   * Create a queue with as many slots as fit into the memory limit
+   * (at most the maximum count_type value). If event_fd is true, the
+   * queue signals a non-blocking eventfd whenever it becomes non-empty.
+   */
+  CCBQueue(uint32_t max_memory_MiB, bool event_fd = false)
     : _item_size(sizeof(T)),
       _capacity(((max_memory_MiB*1<<20)/sizeof(T))>count_type_max?
-		count_type_max:(max_memory_MiB*1<<20)/sizeof(T))
+		count_type_max:(max_memory_MiB*1<<20)/sizeof(T)),
+      _event_fd(-1)
   {
+    if (_capacity == 0) {
+      throw std::runtime_error("CCBQueue: the memory limit is too low");
+    }
+    if (event_fd) {
+#if defined(__linux__)
+      _event_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+#endif
+      if (_event_fd < 0) {
+	throw std::runtime_error("CCBQueue: cannot create an eventfd");
+      }
+    }
     _queue_mem = new uint8_t[_capacity * _item_size];
     _w_state.unified = 0;
     _r_state.unified = 0;
+    _r_futex = 0;
+    _r_waiters = 0;
+    _w_futex = 0;
+    _w_waiters = 0;
+    _closed = 0;
   }
 
   ~CCBQueue()
   {
+    if (_event_fd >= 0) {
+      ::close(_event_fd);
+    }
     delete [] _queue_mem;
   }
 
+  CCBQueue(const CCBQueue&) = delete;
+  CCBQueue& operator=(const CCBQueue&) = delete;
+
   T* acquire() __attribute__((nothrow))
   {
-    const index_type free_index = acquireFreeIndex();
+    count_type count = 0;
+    const index_type free_index = acquireFreeIndexes(1, count);
     if (free_index == invalid_index) {
       /* No free space */
       return nullptr;
@@ -188,8 +369,56 @@ public:
     }
   }
 
-  // Modifies read state (++count)
-  bool enqueue(const T* item) __attribute__((nonnull, nothrow))
+  /*
+   * Acquire up to max_count consecutive free slots and store pointers
+   * to them into items. Returns the number of acquired slots. The
+   * slots are enqueued at once with enqueue(items[0], count).
+   */
+  count_type acquire(T** items, count_type max_count) __attribute__((nonnull, nothrow))
+  {
+    count_type count = 0;
+    const index_type free_index = acquireFreeIndexes(max_count, count);
+    if (free_index == invalid_index) {
+      return 0;
+    }
+    for (count_type i = 0; i < count; ++i) {
+      items[i] = indexToPointer(wrapIndex((size_t)free_index + i));
+    }
+    return count;
+  }
+
+  /*
+   * Like acquire(), but waits for a free slot. Returns nullptr if
+   * the timeout expired or if the queue was closed.
+   */
+  T* acquireWait(int timeout_ms = -1) __attribute__((nothrow))
+  {
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+      makeDeadline(timeout_ms, deadline);
+    }
+    for (unsigned spin = 0; spin < CCBQUEUE_SPIN_COUNT; ++spin) {
+      T* item = acquire();
+      if (item != nullptr) {
+	return item;
+      }
+      sched_yield();
+    }
+    while (true) {
+      const uint32_t value = __atomic_load_n(&_w_futex, __ATOMIC_SEQ_CST);
+      T* item = acquire();
+      if (item != nullptr) {
+	return item;
+      }
+      if (closed() || timeout_ms == 0 ||
+	  !sleep(&_w_futex, &_w_waiters, value, timeout_ms > 0 ? &deadline : nullptr)) {
+	return nullptr;
+      }
+    }
+  }
+
+  // Modifies read state (count += n)
+  bool enqueue(const T* item, count_type count = 1) __attribute__((nonnull, nothrow))
   {
     // Check that we can enqueue the item
     if (pointerToIndex(item) != nextEnqueueIndex()) {
@@ -199,18 +428,24 @@ public:
     State r_state_old, r_state_new;
 
     do {
-      r_state_old.unified = _r_state.unified;
+      r_state_old.unified = loadState(_r_state);
       r_state_new.unified = r_state_old.unified;
-      ++r_state_new.count;
+      r_state_new.count += count;
     } while(!__sync_bool_compare_and_swap(&_r_state.unified,
 					  r_state_old.unified,
 					  r_state_new.unified));
+
+    notify(&_r_futex, &_r_waiters);
+    if (r_state_old.count == 0) {
+      notifyEventFD();
+    }
     return true;
   }
 
   const T* dequeue() __attribute__((nothrow))
   {
-    const index_type index = acquireReadIndex();
+    count_type count = 0;
+    const index_type index = acquireReadIndexes(1, count);
     if (index == invalid_index) {
       return nullptr;
     }
@@ -219,8 +454,59 @@ public:
     }
   }
 
-  // Modifies write state (++begin, --count)
-  bool release(const T* item) __attribute__((nonnull, nothrow))
+  /*
+   * Dequeue up to max_count consecutive items and store pointers to
+   * them into items. Returns the number of dequeued items. The items
+   * are released at once with release(items[0], count).
+   */
+  count_type dequeue(const T** items, count_type max_count) __attribute__((nonnull, nothrow))
+  {
+    count_type count = 0;
+    const index_type index = acquireReadIndexes(max_count, count);
+    if (index == invalid_index) {
+      return 0;
+    }
+    for (count_type i = 0; i < count; ++i) {
+      items[i] = indexToPointer(wrapIndex((size_t)index + i));
+    }
+    return count;
+  }
+
+  /*
+   * Like dequeue(), but waits for an item. Returns nullptr if the
+   * timeout expired or if the queue was closed and is empty.
+   */
+  const T* dequeueWait(int timeout_ms = -1) __attribute__((nothrow))
+  {
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+      makeDeadline(timeout_ms, deadline);
+    }
+    for (unsigned spin = 0; spin < CCBQUEUE_SPIN_COUNT && timeout_ms != 0; ++spin) {
+      const T* item = dequeue();
+      if (item != nullptr) {
+	return item;
+      }
+      if (closed()) {
+	return nullptr;
+      }
+      sched_yield();
+    }
+    while (true) {
+      const uint32_t value = __atomic_load_n(&_r_futex, __ATOMIC_SEQ_CST);
+      const T* item = dequeue();
+      if (item != nullptr) {
+	return item;
+      }
+      if (closed() || timeout_ms == 0 ||
+	  !sleep(&_r_futex, &_r_waiters, value, timeout_ms > 0 ? &deadline : nullptr)) {
+	return nullptr;
+      }
+    }
+  }
+
+  // Modifies write state (begin += n, count -= n)
+  bool release(const T* item, count_type count = 1) __attribute__((nonnull, nothrow))
   {
     // Check that we can release the item
     if (pointerToIndex(item) != nextReleaseIndex()) {
@@ -231,24 +517,77 @@ public:
 
     do {
       // Read the current state
-      w_state_old.unified = _w_state.unified;
+      w_state_old.unified = loadState(_w_state);
       // Create an updated state
       w_state_new.unified = w_state_old.unified;
-      --w_state_new.count;
-      if (++w_state_new.begin == _capacity) {
-	w_state_new.begin = 0;
-      }
+      w_state_new.count -= count;
+      w_state_new.begin = wrapIndex((size_t)w_state_old.begin + count);
       // Atomically update the state
     } while(!__sync_bool_compare_and_swap(&_w_state.unified,
 					  w_state_old.unified,
 					  w_state_new.unified));
+
+    notify(&_w_futex, &_w_waiters);
     return true;
   }
 
+  /*
+   * Wake up all of the waiting threads and make the *Wait() operations
+   * return nullptr instead of sleeping, until open() is called. The
+   * queued items can still be dequeued.
+   */
+  void close() __attribute__((nothrow))
+  {
+    __atomic_store_n(&_closed, 1, __ATOMIC_SEQ_CST);
+    notify(&_r_futex, &_r_waiters);
+    notify(&_w_futex, &_w_waiters);
+    notifyEventFD();
+  }
+
+  void open() __attribute__((nothrow))
+  {
+    __atomic_store_n(&_closed, 0, __ATOMIC_SEQ_CST);
+  }
+
+  bool closed() const __attribute__((nothrow))
+  {
+    return __atomic_load_n(&_closed, __ATOMIC_SEQ_CST) != 0;
+  }
+
+  /*
+   * The eventfd signaled when the queue becomes non-empty, or -1. A
+   * consumer calls clearEvent() and then dequeues until the queue is
+   * empty; an item enqueued after that signals the descriptor again.
+   */
+  int eventFD() const
+  {
+    return _event_fd;
+  }
+
+  void clearEvent() __attribute__((nothrow))
+  {
+#if defined(__linux__)
+    if (_event_fd >= 0) {
+      uint64_t value = 0;
+      if (read(_event_fd, &value, sizeof value) != sizeof value) {
+	/* Not signaled */
+      }
+    }
+#endif
+  }
+
+  // Returns number of slots
+  count_type capacity() const
+  {
+    return _capacity;
+  }
+
   // Returns number of queued items
   count_type count() const
   {
-    return _r_state.count;
+    State r_state;
+    r_state.unified = loadState(_r_state);
+    return r_state.count;
   }
 
 };
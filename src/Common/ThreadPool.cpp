@@ -0,0 +1,308 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+
+namespace usbguard
+{
+  /* The pool and the queue index of the current worker thread */
+  static thread_local const ThreadPool* tl_pool = nullptr;
+  static thread_local size_t tl_queue_index = 0;
+
+  ThreadPool::ThreadPool(size_t thread_count, size_t queue_capacity)
+    : _queue_capacity(std::max<size_t>(1, queue_capacity)),
+      _pending(0),
+      _next_queue(0),
+      _stop(false)
+  {
+    if (thread_count == 0) {
+      thread_count = defaultThreadCount();
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+      _queues.emplace_back(new Queue());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+      _threads.emplace_back(&ThreadPool::run, this, i);
+    }
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+    stop();
+  }
+
+  bool ThreadPool::trySubmit(Job job)
+  {
+    if (_stop || _queues.empty()) {
+      return false;
+    }
+
+    const size_t worker = currentWorker();
+    const size_t first = \
+      (worker != std::numeric_limits<size_t>::max() ? worker : _next_queue++ % _queues.size());
+
+    for (size_t i = 0; i < _queues.size(); ++i) {
+      if (pushJob((first + i) % _queues.size(), job)) {
+        {
+          /* Don't lose the wakeup between a worker's check and its wait */
+          std::unique_lock<std::mutex> lock(_wait_mutex);
+        }
+        _wait_cv.notify_one();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void ThreadPool::submit(Job job)
+  {
+    if (!trySubmit(job)) {
+      try {
+        job();
+      }
+      catch(...) {
+        /* Same as in a worker */
+      }
+    }
+    return;
+  }
+
+  namespace
+  {
+    struct ParallelFor
+    {
+      std::atomic<size_t> next;
+      size_t count;
+      size_t chunk;
+      const std::function<void(size_t)>* fn;
+
+      std::mutex mutex;
+      std::condition_variable cv;
+      size_t active;
+      std::atomic<size_t> error_index;
+      std::exception_ptr error;
+    };
+
+    /*
+     * Process chunks until all of them are claimed. Chunks are claimed
+     * in the index order, so after a failure all of the unclaimed ones
+     * only contain higher indexes and are skipped.
+     */
+    void runChunks(ParallelFor& state)
+    {
+      while (true) {
+        const size_t begin = state.next.fetch_add(state.chunk);
+
+        if (begin >= state.count) {
+          return;
+        }
+
+        const size_t end = std::min(begin + state.chunk, state.count);
+
+        for (size_t i = begin; i < end; ++i) {
+          if (i > state.error_index) {
+            return;
+          }
+          try {
+            (*state.fn)(i);
+          }
+          catch(...) {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            if (i < state.error_index) {
+              state.error_index = i;
+              state.error = std::current_exception();
+            }
+            return;
+          }
+        }
+      }
+    }
+  } /* namespace */
+
+  void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& fn, size_t max_threads)
+  {
+    if (count == 0) {
+      return;
+    }
+
+    size_t threads = _queues.size() + 1;
+
+    if (max_threads > 0) {
+      threads = std::min(threads, max_threads);
+    }
+
+    auto state = std::make_shared<ParallelFor>();
+
+    state->next = 0;
+    state->count = count;
+    state->chunk = std::max<size_t>(1, count / (threads * 4));
+    state->fn = &fn;
+    state->active = 0;
+    state->error_index = std::numeric_limits<size_t>::max();
+
+    const size_t chunks = (count + state->chunk - 1) / state->chunk;
+    const size_t helpers = std::min(threads, chunks) - 1;
+
+    for (size_t i = 0; i < helpers; ++i) {
+      /*
+       * A helper which starts after all of the chunks were claimed
+       * returns without touching `fn', so the call doesn't have to
+       * wait for helpers which didn't start yet.
+       */
+      const bool queued = trySubmit([state]() {
+        {
+          std::unique_lock<std::mutex> lock(state->mutex);
+          ++state->active;
+        }
+        runChunks(*state);
+        {
+          std::unique_lock<std::mutex> lock(state->mutex);
+          --state->active;
+        }
+        state->cv.notify_all();
+      });
+      if (!queued) {
+        break;
+      }
+    }
+
+    runChunks(*state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&state]() { return state->active == 0; });
+
+    if (state->error) {
+      std::rethrow_exception(state->error);
+    }
+    return;
+  }
+
+  void ThreadPool::stop()
+  {
+    {
+      std::unique_lock<std::mutex> lock(_wait_mutex);
+      _stop = true;
+    }
+    _wait_cv.notify_all();
+
+    for (auto& thread : _threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+    return;
+  }
+
+  bool ThreadPool::stopRequested() const
+  {
+    return _stop;
+  }
+
+  size_t ThreadPool::size() const
+  {
+    return _queues.size();
+  }
+
+  size_t ThreadPool::defaultThreadCount()
+  {
+    return std::max(1u, std::min(std::thread::hardware_concurrency(), 16u));
+  }
+
+  ThreadPool& ThreadPool::shared()
+  {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  void ThreadPool::run(size_t index)
+  {
+    tl_pool = this;
+    tl_queue_index = index;
+
+    while (true) {
+      Job job;
+
+      if (popJob(index, job)) {
+        try {
+          job();
+        }
+        catch(...) {
+          /* Jobs report their errors by themselves */
+        }
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(_wait_mutex);
+      _wait_cv.wait(lock, [this]() { return _stop || _pending > 0; });
+
+      if (_stop && _pending == 0) {
+        return;
+      }
+    }
+  }
+
+  bool ThreadPool::pushJob(size_t index, Job& job)
+  {
+    Queue& queue = *_queues[index];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+
+    if (queue.jobs.size() >= _queue_capacity) {
+      return false;
+    }
+
+    queue.jobs.push_back(std::move(job));
+    ++_pending;
+    return true;
+  }
+
+  /*
+   * Take the oldest job of the worker's own queue, or steal the
+   * newest job of another queue.
+   */
+  bool ThreadPool::popJob(size_t index, Job& job)
+  {
+    for (size_t i = 0; i < _queues.size(); ++i) {
+      Queue& queue = *_queues[(index + i) % _queues.size()];
+      std::unique_lock<std::mutex> lock(queue.mutex);
+
+      if (queue.jobs.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+      }
+      else {
+        job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+      }
+      --_pending;
+      return true;
+    }
+    return false;
+  }
+
+  size_t ThreadPool::currentWorker() const
+  {
+    return (tl_pool == this ? tl_queue_index : std::numeric_limits<size_t>::max());
+  }
+} /* namespace usbguard */
@@ -0,0 +1,118 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include "Typedefs.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace usbguard
+{
+  /**
+   * Bounded work-stealing thread pool.
+   *
+   * Every worker has its own bounded job queue. Jobs submitted from a
+   * worker go to the worker's own queue, other jobs are distributed
+   * round-robin. An idle worker takes the oldest job of its own queue
+   * or steals the newest job of another queue. A job which doesn't fit
+   * into any queue, or which is submitted after the pool was stopped,
+   * is run by the submitting thread.
+   *
+   * Stopping the pool lets the workers finish the queued jobs. Long
+   * running jobs may check stopRequested() to finish early.
+   */
+  class DLL_PUBLIC ThreadPool
+  {
+  public:
+    typedef std::function<void()> Job;
+
+    /**
+     * Create a pool of `thread_count' workers (defaultThreadCount()
+     * if zero), each with a queue of at most `queue_capacity' jobs.
+     */
+    ThreadPool(size_t thread_count = 0, size_t queue_capacity = 256);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Queue a job. Returns false if the queues are full or the pool
+     * was stopped. Exceptions thrown by the job are ignored.
+     */
+    bool trySubmit(Job job);
+
+    /**
+     * Queue a job, or run it right away if it can't be queued.
+     */
+    void submit(Job job);
+
+    /**
+     * Call `fn' for every index in [0, count) using at most
+     * `max_threads' threads (all workers if zero), including the
+     * calling thread, which takes part in the work. Safe to call
+     * from a job. If `fn' throws, the indexes after the failing one
+     * may be skipped and the exception of the lowest failing index
+     * is rethrown after the work is finished.
+     */
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn, size_t max_threads = 0);
+
+    void stop();
+    bool stopRequested() const;
+    size_t size() const;
+
+    /**
+     * Number of hardware threads, limited to 16.
+     */
+    static size_t defaultThreadCount();
+
+    /**
+     * The process-wide pool, started on first use.
+     */
+    static ThreadPool& shared();
+
+  private:
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<Job> jobs;
+    };
+
+    void run(size_t index);
+    bool pushJob(size_t index, Job& job);
+    bool popJob(size_t index, Job& job);
+    size_t currentWorker() const;
+
+    const size_t _queue_capacity;
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _wait_mutex;
+    std::condition_variable _wait_cv;
+    std::atomic<size_t> _pending;
+    std::atomic<size_t> _next_queue;
+    std::atomic<bool> _stop;
+  };
+} /* namespace usbguard */
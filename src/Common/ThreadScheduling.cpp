@@ -0,0 +1,197 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include "ThreadScheduling.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace usbguard
+{
+  static bool parseInt(const String& value, long min, long max, long& result)
+  {
+    if (value.empty()) {
+      return false;
+    }
+
+    char *end = nullptr;
+    errno = 0;
+    const long number = strtol(value.c_str(), &end, 10);
+
+    if (errno != 0 || *end != '\0' || number < min || number > max) {
+      return false;
+    }
+
+    result = number;
+    return true;
+  }
+
+  ThreadScheduling::ThreadScheduling()
+  {
+    _policy_set = false;
+    _policy = SCHED_OTHER;
+    _priority_set = false;
+    _priority = 0;
+  }
+
+  bool ThreadScheduling::setCPUs(const String& cpu_list)
+  {
+    std::vector<int> cpus;
+    size_t start = 0;
+
+    while (start <= cpu_list.size()) {
+      const size_t end = std::min(cpu_list.find(',', start), cpu_list.size());
+      const String item = cpu_list.substr(start, end - start);
+      const size_t dash = item.find('-');
+      long first = 0;
+      long last = 0;
+
+      if (dash == String::npos) {
+        if (!parseInt(item, 0, CPU_SETSIZE - 1, first)) {
+          return false;
+        }
+        last = first;
+      }
+      else if (!parseInt(item.substr(0, dash), 0, CPU_SETSIZE - 1, first) ||
+               !parseInt(item.substr(dash + 1), first, CPU_SETSIZE - 1, last)) {
+        return false;
+      }
+
+      for (long cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(static_cast<int>(cpu));
+      }
+      start = end + 1;
+    }
+
+    _cpus = std::move(cpus);
+    return true;
+  }
+
+  bool ThreadScheduling::setPolicy(const String& policy_string)
+  {
+    const size_t colon = policy_string.find(':');
+    const String name = policy_string.substr(0, colon);
+    const bool has_priority = (colon != String::npos);
+    long priority = 0;
+    int policy = 0;
+
+    if (name == "other") {
+      policy = SCHED_OTHER;
+    }
+    else if (name == "batch") {
+      policy = SCHED_BATCH;
+    }
+    else if (name == "idle") {
+      policy = SCHED_IDLE;
+    }
+    else if (name == "fifo") {
+      policy = SCHED_FIFO;
+    }
+    else if (name == "rr") {
+      policy = SCHED_RR;
+    }
+    else {
+      return false;
+    }
+
+    if (policy == SCHED_FIFO || policy == SCHED_RR) {
+      if (!has_priority ||
+          !parseInt(policy_string.substr(colon + 1), 1, 99, priority)) {
+        return false;
+      }
+    }
+    else if (has_priority) {
+      if (policy == SCHED_IDLE ||
+          !parseInt(policy_string.substr(colon + 1), -20, 19, priority)) {
+        return false;
+      }
+    }
+
+    _policy_set = true;
+    _policy = policy;
+    _priority_set = has_priority;
+    _priority = static_cast<int>(priority);
+    return true;
+  }
+
+  bool ThreadScheduling::empty() const
+  {
+    return _cpus.empty() && !_policy_set;
+  }
+
+  /*
+   * The pid 0 of sched_setaffinity and sched_setscheduler refers
+   * to the calling thread, setpriority needs the thread id.
+   */
+  bool ThreadScheduling::apply() const
+  {
+    if (!_cpus.empty()) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+
+      for (const int cpu : _cpus) {
+        CPU_SET(cpu, &cpu_set);
+      }
+      if (sched_setaffinity(0, sizeof cpu_set, &cpu_set) != 0) {
+        return false;
+      }
+    }
+
+    if (_policy_set) {
+      struct sched_param param = { };
+
+      if (_policy == SCHED_FIFO || _policy == SCHED_RR) {
+        param.sched_priority = _priority;
+      }
+      if (sched_setscheduler(0, _policy, &param) != 0) {
+        return false;
+      }
+      if (_priority_set && _policy != SCHED_FIFO && _policy != SCHED_RR) {
+        const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+
+        if (setpriority(PRIO_PROCESS, tid, _priority) != 0) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  bool ThreadScheduling::lowerPriority(int increment)
+  {
+    const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    errno = 0;
+    const int nice_value = getpriority(PRIO_PROCESS, tid);
+
+    if (errno != 0) {
+      return false;
+    }
+
+    return setpriority(PRIO_PROCESS, tid, std::min(nice_value + increment, 19)) == 0;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include "Typedefs.hpp"
+#include <string>
+#include <vector>
+
+namespace usbguard
+{
+  /**
+   * CPU affinity and scheduling policy of a thread.
+   *
+   * The settings are parsed once and applied by each of the threads
+   * they are meant for, from that thread. Nothing is changed for the
+   * settings which weren't set.
+   */
+  class ThreadScheduling
+  {
+  public:
+    ThreadScheduling();
+
+    /**
+     * Set the CPUs the thread may run on from a list like "0,2-3".
+     * Returns false if the list is invalid.
+     */
+    bool setCPUs(const String& cpu_list);
+
+    /**
+     * Set the scheduling policy from a string of the form
+     * policy[:priority]. The policy is one of other, batch, idle,
+     * fifo or rr. The priority is the static priority (1-99) of the
+     * fifo and rr policies, which require it, and the nice value
+     * (-20..19) of the other and batch policies. Returns false if
+     * the string is invalid.
+     */
+    bool setPolicy(const String& policy_string);
+
+    bool empty() const;
+
+    /**
+     * Apply the settings to the calling thread. Returns false and
+     * sets errno if any of them couldn't be applied.
+     */
+    bool apply() const;
+
+    /**
+     * Raise the nice value of the calling thread by increment.
+     * Returns false and sets errno on failure.
+     */
+    static bool lowerPriority(int increment);
+
+  private:
+    std::vector<int> _cpus;
+    bool _policy_set;
+    int _policy;
+    bool _priority_set;
+    int _priority;
+  };
+} /* namespace usbguard */
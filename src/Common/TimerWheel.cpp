@@ -0,0 +1,177 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "TimerWheel.hpp"
+
+namespace usbguard
+{
+  TimerWheel::TimerWheel(Tick now)
+    : _now(now)
+  {
+  }
+
+  void TimerWheel::schedule(ID id, Tick expiration)
+  {
+    cancel(id);
+    insert(id, expiration > _now ? expiration : _now + 1);
+    return;
+  }
+
+  bool TimerWheel::cancel(ID id)
+  {
+    auto it = _locations.find(id);
+
+    if (it == _locations.end()) {
+      return false;
+    }
+
+    const Location& location = it->second;
+    _slots[location.level][location.slot].erase(location.position);
+    _locations.erase(it);
+
+    return true;
+  }
+
+  void TimerWheel::advance(Tick now, std::vector<ID>& expired)
+  {
+    while (_now < now) {
+      if (_locations.empty()) {
+        _now = now;
+        break;
+      }
+      /*
+       * Skip the ticks at which nothing can happen. This
+       * keeps the cost of a long gap (e.g. after a system
+       * suspend) proportional to the number of level 0
+       * rotations instead of the number of ticks.
+       */
+      const Tick next = nextTick();
+
+      if (next > now) {
+        _now = now;
+        break;
+      }
+
+      _now = next;
+
+      for (unsigned level = _level_count - 1; level > 0; --level) {
+        const Tick span_mask = (Tick(1) << (_slot_bits * level)) - 1;
+        if ((_now & span_mask) == 0) {
+          cascade(level);
+        }
+      }
+
+      expire(expired);
+    }
+    return;
+  }
+
+  TimerWheel::Tick TimerWheel::nextTick() const
+  {
+    if (_locations.empty()) {
+      return _now;
+    }
+
+    const Tick boundary = ((_now >> _slot_bits) + 1) << _slot_bits;
+
+    for (Tick tick = _now + 1; tick < boundary; ++tick) {
+      if (!_slots[0][tick & _slot_mask].empty()) {
+        return tick;
+      }
+    }
+
+    return boundary;
+  }
+
+  TimerWheel::Tick TimerWheel::currentTick() const
+  {
+    return _now;
+  }
+
+  bool TimerWheel::isScheduled(ID id) const
+  {
+    return _locations.count(id) > 0;
+  }
+
+  bool TimerWheel::empty() const
+  {
+    return _locations.empty();
+  }
+
+  size_t TimerWheel::size() const
+  {
+    return _locations.size();
+  }
+
+  void TimerWheel::insert(ID id, Tick expiration)
+  {
+    const Tick delta = expiration - _now;
+    const Tick horizon = Tick(1) << (_slot_bits * _level_count);
+    unsigned level = 0;
+
+    while (level < _level_count - 1
+           && delta >= (Tick(1) << (_slot_bits * (level + 1)))) {
+      ++level;
+    }
+
+    /*
+     * Expiration times beyond the range of the wheel are
+     * parked in the last slot reachable from the top level
+     * and redistributed once that slot is cascaded.
+     */
+    const Tick slot_tick = delta < horizon ? expiration : _now + horizon - 1;
+    const unsigned slot = (slot_tick >> (_slot_bits * level)) & _slot_mask;
+
+    Slot& target = _slots[level][slot];
+    target.push_front(id);
+    _locations[id] = Location { expiration, level, slot, target.begin() };
+
+    return;
+  }
+
+  void TimerWheel::cascade(unsigned level)
+  {
+    const unsigned slot = (_now >> (_slot_bits * level)) & _slot_mask;
+    Slot entries;
+
+    entries.swap(_slots[level][slot]);
+
+    /*
+     * Entries of a slot being cascaded never expire before
+     * the current tick, so each of them lands either in a
+     * lower level or in the level 0 slot of the current tick.
+     */
+    for (const ID id : entries) {
+      insert(id, _locations[id].expiration);
+    }
+    return;
+  }
+
+  void TimerWheel::expire(std::vector<ID>& expired)
+  {
+    Slot& slot = _slots[0][_now & _slot_mask];
+
+    for (const ID id : slot) {
+      expired.push_back(id);
+      _locations.erase(id);
+    }
+
+    slot.clear();
+    return;
+  }
+} /* namespace usbguard */
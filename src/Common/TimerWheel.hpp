@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace usbguard
+{
+  /**
+   * Hierarchical timer wheel.
+   *
+   * Keeps track of expiration times of objects identified
+   * by a 32-bit id. Time is measured in abstract ticks
+   * supplied by the caller. The wheel consists of several
+   * levels of 64 slots, each level covering a 64 times
+   * longer period than the previous one. Scheduling and
+   * cancelling is O(1) and advancing the wheel costs O(1)
+   * amortized per tick and expired entry.
+   */
+  class TimerWheel
+  {
+  public:
+    typedef uint32_t ID;
+    typedef uint64_t Tick;
+
+    TimerWheel(Tick now = 0);
+
+    /**
+     * Schedule the expiration of `id' at tick `expiration'.
+     * If the id is already scheduled, the previous expiration
+     * time is replaced. Expiration times which are not in the
+     * future are moved to the next tick.
+     */
+    void schedule(ID id, Tick expiration);
+
+    /**
+     * Cancel the expiration of `id'. Returns false if
+     * the id wasn't scheduled.
+     */
+    bool cancel(ID id);
+
+    /**
+     * Advance the wheel up to tick `now' and append the
+     * ids that expired in the meantime to `expired'.
+     */
+    void advance(Tick now, std::vector<ID>& expired);
+
+    /**
+     * Return the nearest tick at which advancing the wheel
+     * may return expired entries or needs to redistribute
+     * entries of the upper levels. If the wheel is empty,
+     * the current tick is returned.
+     */
+    Tick nextTick() const;
+
+    Tick currentTick() const;
+    bool isScheduled(ID id) const;
+    bool empty() const;
+    size_t size() const;
+
+  private:
+    static const unsigned _slot_bits = 6;
+    static const unsigned _slot_count = 1 << _slot_bits;
+    static const unsigned _slot_mask = _slot_count - 1;
+    static const unsigned _level_count = 4;
+
+    typedef std::list<ID> Slot;
+
+    struct Location
+    {
+      Tick expiration;
+      unsigned level;
+      unsigned slot;
+      Slot::iterator position;
+    };
+
+    void insert(ID id, Tick expiration);
+    void cascade(unsigned level);
+    void expire(std::vector<ID>& expired);
+
+    Tick _now;
+    Slot _slots[_level_count][_slot_count];
+    std::unordered_map<ID,Location> _locations;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,61 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+
+/*
+ * USDT (systemtap SDT) probes of the usbguard provider, for tracing
+ * with bpftrace, perf or systemtap, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/usbguard-daemon:usbguard:ipc_request_end
+ *                { @[str(arg0)] = hist(arg1); }'
+ *
+ * A probe which isn't attached is a single nop instruction; its
+ * arguments are still computed, so they have to be cheap. Without
+ * <sys/sdt.h> (see --enable-usdt) the probes compile to nothing.
+ *
+ * Probes:
+ *   udev_receive(action, syspath)
+ *   device_create_begin(device)
+ *   device_create_end(device, syspath)
+ *   descriptor_parse(syspath, size)
+ *   device_hash(syspath)
+ *   rule_match(rule_id, rules_scanned, cached)
+ *   sysfs_apply(syspath, target)
+ *   ipc_request_begin(method)
+ *   ipc_request_end(method, duration_ns)
+ *   ipc_broadcast(signal, recipients)
+ */
+#if defined(HAVE_USDT)
+# include <sys/sdt.h>
+# define USBGUARD_PROBE1(name, a1) \
+  STAP_PROBE1(usbguard, name, a1)
+# define USBGUARD_PROBE2(name, a1, a2) \
+  STAP_PROBE2(usbguard, name, a1, a2)
+# define USBGUARD_PROBE3(name, a1, a2, a3) \
+  STAP_PROBE3(usbguard, name, a1, a2, a3)
+#else
+/* The arguments are referenced, but never evaluated */
+# define USBGUARD_PROBE1(name, a1) \
+  do { if (false) { (void)(a1); } } while(0)
+# define USBGUARD_PROBE2(name, a1, a2) \
+  do { if (false) { (void)(a1); (void)(a2); } } while(0)
+# define USBGUARD_PROBE3(name, a1, a2, a3) \
+  do { if (false) { (void)(a1); (void)(a2); (void)(a3); } } while(0)
+#endif
@@ -30,6 +30,7 @@
 #include <fcntl.h>
 #include <alloca.h>
 #include <fstream>
+#include <cerrno>
 
 namespace usbguard
 {
@@ -84,6 +85,77 @@ namespace usbguard
     return true;
   }
 
+  static bool writeAll(int fd, const char *data, size_t size)
+  {
+    while (size > 0) {
+      const ssize_t rc = ::write(fd, data, size);
+      if (rc < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += rc;
+      size -= rc;
+    }
+    return true;
+  }
+
+  static bool syncParentDirectory(const String& filepath)
+  {
+    const size_t separator_pos = filepath.find_last_of('/');
+    const String directory = \
+      (separator_pos == String::npos ? "." :
+       separator_pos == 0 ? "/" : filepath.substr(0, separator_pos));
+
+    const int fd = ::open(directory.c_str(), O_RDONLY|O_DIRECTORY);
+    if (fd < 0) {
+      return false;
+    }
+    const int rc = ::fsync(fd);
+    const int saved_errno = errno;
+    ::close(fd);
+    errno = saved_errno;
+    return rc == 0;
+  }
+
+  bool writeFileAtomically(const String& filepath, const String& data)
+  {
+    String tmp_path = filepath + ".XXXXXX";
+    const int fd = ::mkstemp(&tmp_path[0]);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st;
+    bool success = true;
+
+    if (::stat(filepath.c_str(), &st) == 0) {
+      success = (::fchmod(fd, st.st_mode & 07777) == 0);
+    }
+
+    success = success && writeAll(fd, data.c_str(), data.size());
+    success = success && (::fsync(fd) == 0);
+
+    int saved_errno = errno;
+    success = (::close(fd) == 0) && success;
+
+    if (success && ::rename(tmp_path.c_str(), filepath.c_str()) == 0) {
+      /*
+       * The rename is durable only after the directory entry
+       * has been synced too.
+       */
+      return syncParentDirectory(filepath);
+    }
+
+    saved_errno = (success ? errno : saved_errno);
+    ::unlink(tmp_path.c_str());
+    errno = saved_errno;
+
+    return false;
+  }
+
   static void runCommandExecChild(const String& path, const std::vector<String>& args)
   {
     struct rlimit rlim;
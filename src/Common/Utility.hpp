@@ -24,6 +24,7 @@
 #include <regex>
 #include <iomanip>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <iostream>
 
@@ -48,6 +49,19 @@ namespace usbguard
    */
   bool writePID(const String& filepath);
 
+  /**
+   * Replace the content of a file at filepath with data.
+   *
+   * The data are written to a temporary file in the same directory
+   * using a single buffered write. The temporary file is synced to
+   * disk and renamed to filepath, so that the file always contains
+   * either the old or the new content. The permissions of an existing
+   * file are preserved.
+   *
+   * Returns true on success, otherwise returns false and errno is set.
+   */
+  bool writeFileAtomically(const String& filepath, const String& data);
+
   /**
    * Wrappers for the __builtin_expect function.
    */
@@ -141,6 +155,15 @@ namespace usbguard
   template<>
   uint8_t stringToNumber(const String& s, const int base);
 
+  /**
+   * Heap memory used by a string, in bytes. Zero if the value
+   * is stored in the string object itself.
+   */
+  inline size_t stringHeapUsage(const String& value)
+  {
+    return value.capacity() > String().capacity() ? value.capacity() + 1 : 0;
+  }
+
   /**
    * Return the filename part of a path. If include_extension is set to
    * false, then any characters after the last dot character '.' will be
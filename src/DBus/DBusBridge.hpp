@@ -20,6 +20,8 @@
 
 #include <gio/gio.h>
 #include "IPCClient.hpp"
+#include "DBusService.hpp"
+#include "Common/ThreadPool.hpp"
 
 namespace usbguard
 {
@@ -33,13 +35,12 @@ namespace usbguard
     void handleMethodCall(const std::string interface, const std::string method_name,
         GVariant * parameters, GDBusMethodInvocation * invocation);
 
+    void setSignalCoalescing(unsigned int window_ms);
+
   protected:
     void IPCConnected() override;
     void IPCDisconnected(bool exception_initiated, const IPCException& exception) override;
 
-    void handlePolicyMethodCall(const std::string& method_name, GVariant * parameters, GDBusMethodInvocation * invocation);
-    void handleDevicesMethodCall(const std::string& method_name, GVariant * parameters, GDBusMethodInvocation * invocation);
-
     void DevicePresent(uint32_t id,
         const std::map<std::string,std::string>& attributes,
         const std::vector<usbguard::USBInterfaceType>& interfaces,
@@ -69,15 +70,15 @@ namespace usbguard
         bool rule_match,
         uint32_t rule_id) override;
 
-    void emitDevicePolicyDecision(const char *policy_signal,
-        uint32_t id,
-        const std::map<std::string,std::string>& attributes,
-        bool rule_match,
-        uint32_t rule_id);
-
   private:
     GDBusConnection * const p_gdbus_connection;
     void(*p_ipc_callback)(bool);
+    DBusService p_service;
+    /*
+     * Serves the method calls, so that the GLib main loop doesn't
+     * wait for the daemon replies. Destroyed first, it finishes
+     * the queued calls before the service goes away.
+     */
+    ThreadPool p_call_pool;
   };
 } /* namespace usbguard */
-
@@ -0,0 +1,636 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DBusService.hpp"
+
+namespace usbguard
+{
+  static const gchar introspection_xml[] =
+#include "DBusInterface.xml.cstr"
+  ;
+
+  DBusService::DBusService(Interface& backend)
+    : p_backend(backend),
+      p_gdbus_connection(nullptr),
+      p_policy_rid(0),
+      p_devices_rid(0),
+      p_coalesce_window_ms(0),
+      p_coalesce_context(nullptr),
+      p_coalesce_source(nullptr),
+      p_coalesce_sequence(0)
+  {
+    if ((p_introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, nullptr)) == nullptr) {
+      throw std::runtime_error("Failed to parse the D-Bus introspection data");
+    }
+  }
+
+  DBusService::~DBusService()
+  {
+    setSignalCoalescing(0);
+    unregisterObjects();
+    g_dbus_node_info_unref(p_introspection_data);
+  }
+
+  void DBusService::setDispatcher(Dispatcher dispatcher)
+  {
+    p_dispatcher = std::move(dispatcher);
+    return;
+  }
+
+  void DBusService::setSignalCoalescing(unsigned int window_ms, GMainContext *context)
+  {
+    /* Don't lose the signals coalesced with the previous settings */
+    flushCoalescedSignals();
+
+    std::unique_lock<std::mutex> lock(p_coalesce_mutex);
+
+    if (p_coalesce_context != nullptr) {
+      g_main_context_unref(p_coalesce_context);
+      p_coalesce_context = nullptr;
+    }
+    if (window_ms > 0 && context != nullptr) {
+      p_coalesce_context = g_main_context_ref(context);
+    }
+
+    p_coalesce_window_ms = window_ms;
+    return;
+  }
+
+  bool DBusService::registerObjects(GDBusConnection *gdbus_connection)
+  {
+    static const GDBusInterfaceVTable service_interface_vtable =
+    {
+      gdbusMethodCallFn,
+      nullptr,
+      nullptr
+    };
+
+    GDBusInterfaceInfo *policy_info = \
+      g_dbus_node_info_lookup_interface(p_introspection_data, "org.usbguard.Policy");
+    GDBusInterfaceInfo *devices_info = \
+      g_dbus_node_info_lookup_interface(p_introspection_data, "org.usbguard.Devices");
+
+    if (policy_info == nullptr || devices_info == nullptr) {
+      return false;
+    }
+
+    unregisterObjects();
+    setConnection(gdbus_connection);
+
+    std::unique_lock<std::mutex> lock(p_gdbus_connection_mutex);
+
+    p_policy_rid = g_dbus_connection_register_object(gdbus_connection,
+                                                     "/org/usbguard/Policy",
+                                                     policy_info,
+                                                     &service_interface_vtable,
+                                                     /*user_data=*/this,
+                                                     /*user_data_free_func=*/nullptr,
+                                                     /*GError=*/nullptr);
+    p_devices_rid = g_dbus_connection_register_object(gdbus_connection,
+                                                      "/org/usbguard/Devices",
+                                                      devices_info,
+                                                      &service_interface_vtable,
+                                                      /*user_data=*/this,
+                                                      /*user_data_free_func=*/nullptr,
+                                                      /*GError=*/nullptr);
+
+    return p_policy_rid > 0 && p_devices_rid > 0;
+  }
+
+  void DBusService::setConnection(GDBusConnection *gdbus_connection)
+  {
+    std::unique_lock<std::mutex> lock(p_gdbus_connection_mutex);
+
+    if (gdbus_connection != nullptr) {
+      g_object_ref(gdbus_connection);
+    }
+    if (p_gdbus_connection != nullptr) {
+      g_object_unref(p_gdbus_connection);
+    }
+
+    p_gdbus_connection = gdbus_connection;
+    return;
+  }
+
+  void DBusService::unregisterObjects()
+  {
+    std::unique_lock<std::mutex> lock(p_gdbus_connection_mutex);
+
+    if (p_gdbus_connection == nullptr) {
+      return;
+    }
+    if (p_policy_rid > 0) {
+      g_dbus_connection_unregister_object(p_gdbus_connection, p_policy_rid);
+      p_policy_rid = 0;
+    }
+    if (p_devices_rid > 0) {
+      g_dbus_connection_unregister_object(p_gdbus_connection, p_devices_rid);
+      p_devices_rid = 0;
+    }
+
+    g_object_unref(p_gdbus_connection);
+    p_gdbus_connection = nullptr;
+    return;
+  }
+
+  void DBusService::gdbusMethodCallFn(GDBusConnection *connection,
+      const gchar *sender,
+      const gchar *object_path,
+      const gchar *interface_name,
+      const gchar *method_name,
+      GVariant *parameters,
+      GDBusMethodInvocation *invocation,
+      gpointer user_data)
+  {
+    DBusService *service = static_cast<DBusService*>(user_data);
+    service->dispatchMethodCall(interface_name, method_name, invocation);
+    return;
+  }
+
+  void DBusService::dispatchMethodCall(const std::string& interface, const std::string& method_name,
+      GDBusMethodInvocation * invocation)
+  {
+    if (!p_dispatcher) {
+      serveMethodCall(interface, method_name,
+                      g_dbus_method_invocation_get_parameters(invocation), invocation);
+      return;
+    }
+
+    /* The invocation holds the parameters */
+    g_object_ref(invocation);
+
+    const bool dispatched = p_dispatcher(method_name, [this, interface, method_name, invocation]() {
+      serveMethodCall(interface, method_name,
+                      g_dbus_method_invocation_get_parameters(invocation), invocation);
+      g_object_unref(invocation);
+    });
+
+    if (!dispatched) {
+      g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+          G_DBUS_ERROR_LIMITS_EXCEEDED, "Too many pending requests");
+      g_object_unref(invocation);
+    }
+    return;
+  }
+
+  void DBusService::serveMethodCall(const std::string& interface, const std::string& method_name,
+      GVariant * parameters, GDBusMethodInvocation * invocation)
+  {
+    try {
+      handleMethodCall(interface, method_name, parameters, invocation);
+    }
+    catch(const std::exception& ex) {
+      g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+         G_DBUS_ERROR_FAILED, "Exception: %s", ex.what());
+    }
+    catch(...) {
+      g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+         G_DBUS_ERROR_FAILED, "BUG: Unknown exception; method call failed for unknown reasons.");
+    }
+    return;
+  }
+
+  void DBusService::handleMethodCall(const std::string& interface, const std::string& method_name,
+      GVariant * parameters, GDBusMethodInvocation * invocation)
+  {
+    if (interface == "org.usbguard.Policy") {
+      handlePolicyMethodCall(method_name, parameters, invocation);
+      return;
+    }
+    else if (interface == "org.usbguard.Devices") {
+      handleDevicesMethodCall(method_name, parameters, invocation);
+      return;
+    }
+
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+        G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method interface");
+    return;
+  }
+
+  void DBusService::handlePolicyMethodCall(const std::string& method_name, GVariant * parameters, GDBusMethodInvocation * invocation)
+  {
+    if (method_name == "listRules") {
+      auto rule_set = p_backend.listRules();
+      auto rules = rule_set.getRules();
+
+      if (rules.size() > 0) {
+        auto gvbuilder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+        try {
+         for (auto rule : rules) {
+            g_variant_builder_add(gvbuilder, "(us)",
+              rule->getRuleID(),
+              rule->toString().c_str());
+          }
+          g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(us))", gvbuilder));
+        }
+        catch(...) {
+         g_variant_builder_unref(gvbuilder);
+         throw;
+        }
+        g_variant_builder_unref(gvbuilder);
+      }
+      else {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(us))", nullptr));
+      }
+
+      return;
+    }
+
+    if (method_name == "appendRule") {
+      const char *rule_spec_cstr = nullptr;
+      uint32_t parent_id = 0;
+      uint32_t timeout_sec = 0;
+
+      g_variant_get(parameters, "(&su)", &rule_spec_cstr, &parent_id);
+      std::string rule_spec(rule_spec_cstr);
+
+      const uint32_t rule_id = p_backend.appendRule(rule_spec, parent_id, timeout_sec);
+      g_dbus_method_invocation_return_value(invocation, g_variant_new("(u)", rule_id));
+      return;
+    }
+
+    if (method_name == "removeRule") {
+      uint32_t rule_id = 0;
+      g_variant_get(parameters, "(u)", &rule_id);
+      p_backend.removeRule(rule_id);
+      g_dbus_method_invocation_return_value(invocation, nullptr);
+      return;
+    }
+
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+        G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method interface");
+    return;
+  }
+
+  void DBusService::handleDevicesMethodCall(const std::string& method_name, GVariant * parameters, GDBusMethodInvocation * invocation)
+  {
+    if (method_name == "listDevices") {
+      const char *query_cstr = nullptr;
+      g_variant_get(parameters, "(&s)", &query_cstr);
+      std::string query(query_cstr);
+      auto devices = p_backend.listDevices(query);
+
+      if (devices.size() > 0) {
+        auto gvbuilder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+        try {
+         for (auto device_rule : devices) {
+            g_variant_builder_add(gvbuilder, "(us)",
+              device_rule.getRuleID(),
+              device_rule.toString().c_str());
+          }
+          g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(us))", gvbuilder));
+        }
+        catch(...) {
+         g_variant_builder_unref(gvbuilder);
+         throw;
+        }
+        g_variant_builder_unref(gvbuilder);
+      }
+      else {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(us))", nullptr));
+      }
+
+      return;
+    }
+
+    if (method_name == "listDevicesDetailed") {
+      const char *query_cstr = nullptr;
+      g_variant_get(parameters, "(&s)", &query_cstr);
+      std::string query(query_cstr);
+      auto devices = p_backend.listDevices(query.empty() ? "match" : query);
+
+      if (devices.size() > 0) {
+        auto gvbuilder = g_variant_builder_new(G_VARIANT_TYPE("a(ua{sv})"));
+        try {
+          for (auto const& device_rule : devices) {
+            g_variant_builder_open(gvbuilder, G_VARIANT_TYPE("(ua{sv})"));
+            g_variant_builder_add(gvbuilder, "u", device_rule.getRuleID());
+            g_variant_builder_open(gvbuilder, G_VARIANT_TYPE_VARDICT);
+            addDeviceAttributes(gvbuilder, device_rule);
+            g_variant_builder_close(gvbuilder);
+            g_variant_builder_close(gvbuilder);
+          }
+          g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(ua{sv}))", gvbuilder));
+        }
+        catch(...) {
+          g_variant_builder_unref(gvbuilder);
+          throw;
+        }
+        g_variant_builder_unref(gvbuilder);
+      }
+      else {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(ua{sv}))", nullptr));
+      }
+
+      return;
+    }
+
+    if (method_name == "allowDevice" ||
+        method_name == "blockDevice" ||
+        method_name == "rejectDevice") {
+      uint32_t device_id = 0;
+      gboolean permanent = false;
+      uint32_t timeout_sec = 0;
+
+      g_variant_get(parameters, "(ub)", &device_id, &permanent);
+
+      if (method_name == "allowDevice") {
+        p_backend.allowDevice(device_id, permanent, timeout_sec);
+      }
+      else if (method_name == "blockDevice") {
+        p_backend.blockDevice(device_id, permanent, timeout_sec);
+      }
+      else {
+        p_backend.rejectDevice(device_id, permanent, timeout_sec);
+      }
+
+      g_dbus_method_invocation_return_value(invocation, nullptr);
+      return;
+    }
+
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+        G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method ");
+    return;
+  }
+
+  void DBusService::addDeviceAttributes(GVariantBuilder *gv_builder, const Rule& device_rule)
+  {
+    const auto& device_id = device_rule.attributeDeviceID();
+    if (!device_id.empty()) {
+      g_variant_builder_add(gv_builder, "{sv}", "vendor_id",
+          g_variant_new_string(device_id.get().getVendorID().c_str()));
+      g_variant_builder_add(gv_builder, "{sv}", "product_id",
+          g_variant_new_string(device_id.get().getProductID().c_str()));
+    }
+
+    const std::pair<const char *, const Rule::Attribute<String>*> string_attributes[] = {
+      {        "name", &device_rule.attributeName() },
+      {      "serial", &device_rule.attributeSerial() },
+      {        "hash", &device_rule.attributeHash() },
+      { "parent_hash", &device_rule.attributeParentHash() },
+      {        "port", &device_rule.attributeViaPort() }
+    };
+
+    for (auto const& attribute : string_attributes) {
+      if (!attribute.second->empty()) {
+        g_variant_builder_add(gv_builder, "{sv}", attribute.first,
+            g_variant_new_string(attribute.second->get(0).c_str()));
+      }
+    }
+
+    const auto& interfaces = device_rule.attributeWithInterface();
+    if (!interfaces.empty()) {
+      GVariantBuilder *gv_builder_interfaces = g_variant_builder_new(G_VARIANT_TYPE_STRING_ARRAY);
+      for (size_t i = 0; i < interfaces.count(); ++i) {
+        g_variant_builder_add(gv_builder_interfaces, "s", interfaces.get(i).typeString().c_str());
+      }
+      g_variant_builder_add(gv_builder, "{sv}", "interfaces", g_variant_builder_end(gv_builder_interfaces));
+      g_variant_builder_unref(gv_builder_interfaces);
+    }
+
+    g_variant_builder_add(gv_builder, "{sv}", "target",
+        g_variant_new_string(Rule::targetToString(device_rule.getTarget()).c_str()));
+    return;
+  }
+
+  void DBusService::DevicePresent(uint32_t id,
+      const std::map<std::string,std::string>& attributes,
+      const std::vector<usbguard::USBInterfaceType>& interfaces,
+      usbguard::Rule::Target target)
+  {
+    GVariantBuilder *gv_builder_attributes = nullptr;
+    if (!attributes.empty()) {
+      gv_builder_attributes = g_variant_builder_new(G_VARIANT_TYPE_DICTIONARY);
+
+      for (auto kv_pair : attributes) {
+        g_variant_builder_add(gv_builder_attributes, "{ss}", kv_pair.first.c_str(), kv_pair.second.c_str());
+      }
+    }
+
+    GVariantBuilder *gv_builder_interfaces = nullptr;
+    if (!interfaces.empty()) {
+      gv_builder_interfaces = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+      for (auto interface : interfaces) {
+        g_variant_builder_add(gv_builder_interfaces, "s", interface.typeString().c_str());
+      }
+    }
+
+    emitSignal("DevicePresent",
+        g_variant_new("(ua{ss}ass)",
+          id, gv_builder_attributes, gv_builder_interfaces, usbguard::Rule::targetToString(target).c_str()));
+
+    if (gv_builder_interfaces != nullptr) {
+      g_variant_builder_unref(gv_builder_interfaces);
+    }
+    if (gv_builder_attributes != nullptr) {
+      g_variant_builder_unref(gv_builder_attributes);
+    }
+    return;
+  }
+
+  void DBusService::DeviceInserted(uint32_t id,
+      const std::map<std::string,std::string>& attributes,
+      const std::vector<USBInterfaceType>& interfaces,
+      bool rule_match,
+      uint32_t rule_id)
+  {
+    GVariantBuilder *gv_builder_attributes = nullptr;
+    if (!attributes.empty()) {
+      gv_builder_attributes = g_variant_builder_new(G_VARIANT_TYPE_DICTIONARY);
+
+      for (auto kv_pair : attributes) {
+        g_variant_builder_add(gv_builder_attributes, "{ss}", kv_pair.first.c_str(), kv_pair.second.c_str());
+      }
+    }
+
+    GVariantBuilder *gv_builder_interfaces = nullptr;
+    if (!interfaces.empty()) {
+      gv_builder_interfaces = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+      for (auto interface : interfaces) {
+        g_variant_builder_add(gv_builder_interfaces, "s", interface.typeString().c_str());
+      }
+    }
+
+    emitSignal("DeviceInserted",
+        g_variant_new("(ua{ss}asbu)",
+          id, gv_builder_attributes, gv_builder_interfaces, rule_match, rule_id));
+
+    if (gv_builder_interfaces != nullptr) {
+      g_variant_builder_unref(gv_builder_interfaces);
+    }
+    if (gv_builder_attributes != nullptr) {
+      g_variant_builder_unref(gv_builder_attributes);
+    }
+    return;
+  }
+
+  void DBusService::DeviceRemoved(uint32_t id,
+      const std::map<std::string,std::string>& attributes)
+  {
+    GVariantBuilder *gv_builder_attributes = nullptr;
+    if (!attributes.empty()) {
+      gv_builder_attributes = g_variant_builder_new(G_VARIANT_TYPE_DICTIONARY);
+
+      for (auto kv_pair : attributes) {
+        g_variant_builder_add(gv_builder_attributes, "{ss}", kv_pair.first.c_str(), kv_pair.second.c_str());
+      }
+    }
+
+    emitSignal("DeviceRemoved",
+        g_variant_new("(ua{ss})",
+          id, gv_builder_attributes));
+
+    if (gv_builder_attributes != nullptr) {
+      g_variant_builder_unref(gv_builder_attributes);
+    }
+    return;
+  }
+
+  void DBusService::DeviceAllowed(uint32_t id,
+      const std::map<std::string,std::string>& attributes,
+      bool rule_match,
+      uint32_t rule_id)
+  {
+    emitDevicePolicyDecision("DeviceAllowed", id, attributes, rule_match, rule_id);
+  }
+
+
+  void DBusService::DeviceBlocked(uint32_t id,
+      const std::map<std::string,std::string>& attributes,
+      bool rule_match,
+      uint32_t rule_id)
+  {
+    emitDevicePolicyDecision("DeviceBlocked", id, attributes, rule_match, rule_id);
+  }
+
+  void DBusService::DeviceRejected(uint32_t id,
+      const std::map<std::string,std::string>& attributes,
+      bool rule_match,
+      uint32_t rule_id)
+  {
+    emitDevicePolicyDecision("DeviceRejected", id, attributes, rule_match, rule_id);
+  }
+
+  void DBusService::emitDevicePolicyDecision(const char *policy_signal,
+      uint32_t id,
+      const std::map<std::string,std::string>& attributes,
+      bool rule_match,
+      uint32_t rule_id)
+  {
+    GVariantBuilder *gv_builder_attributes = nullptr;
+    if (!attributes.empty()) {
+      gv_builder_attributes = g_variant_builder_new(G_VARIANT_TYPE_DICTIONARY);
+
+      for (auto kv_pair : attributes) {
+        g_variant_builder_add(gv_builder_attributes, "{ss}", kv_pair.first.c_str(), kv_pair.second.c_str());
+      }
+    }
+
+    emitSignal(policy_signal,
+        g_variant_new("(ua{ss}bu)",
+          id, gv_builder_attributes, rule_match, rule_id));
+
+    if (gv_builder_attributes != nullptr) {
+      g_variant_builder_unref(gv_builder_attributes);
+    }
+    return;
+  }
+
+  /*
+   * Takes ownership of a floating parameters reference.
+   */
+  void DBusService::emitSignal(const char *signal_name, GVariant *parameters)
+  {
+    std::unique_lock<std::mutex> lock(p_coalesce_mutex);
+
+    if (p_coalesce_window_ms == 0) {
+      lock.unlock();
+      emitSignalNow(signal_name, parameters);
+      return;
+    }
+
+    p_coalesced.push_back({ p_coalesce_sequence++, signal_name, g_variant_ref_sink(parameters) });
+
+    /*
+     * The first signal in a window arms the timer, the rest
+     * of the window is sent along with it.
+     */
+    if (p_coalesce_source == nullptr) {
+      p_coalesce_source = g_timeout_source_new(p_coalesce_window_ms);
+      g_source_set_callback(p_coalesce_source, gsourceFlushFn, this, nullptr);
+      g_source_attach(p_coalesce_source, p_coalesce_context);
+    }
+    return;
+  }
+
+  gboolean DBusService::gsourceFlushFn(gpointer user_data)
+  {
+    DBusService *service = static_cast<DBusService*>(user_data);
+    service->flushCoalescedSignals();
+    /* The source is destroyed by flushCoalescedSignals() */
+    return TRUE;
+  }
+
+  void DBusService::flushCoalescedSignals()
+  {
+    std::vector<CoalescedSignal> coalesced;
+    {
+      std::unique_lock<std::mutex> lock(p_coalesce_mutex);
+
+      if (p_coalesce_source != nullptr) {
+        g_source_destroy(p_coalesce_source);
+        g_source_unref(p_coalesce_source);
+        p_coalesce_source = nullptr;
+      }
+      coalesced.swap(p_coalesced);
+    }
+
+    if (coalesced.empty()) {
+      return;
+    }
+
+    GVariantBuilder *gv_builder = g_variant_builder_new(G_VARIANT_TYPE("a(tsv)"));
+    for (auto const& coalesced_signal : coalesced) {
+      g_variant_builder_add(gv_builder, "(tsv)",
+          coalesced_signal.sequence,
+          coalesced_signal.signal_name,
+          coalesced_signal.parameters);
+      g_variant_unref(coalesced_signal.parameters);
+    }
+
+    emitSignalNow("DevicesChanged", g_variant_new("(a(tsv))", gv_builder));
+    g_variant_builder_unref(gv_builder);
+    return;
+  }
+
+  void DBusService::emitSignalNow(const char *signal_name, GVariant *parameters)
+  {
+    std::unique_lock<std::mutex> lock(p_gdbus_connection_mutex);
+
+    if (p_gdbus_connection == nullptr) {
+      g_variant_unref(g_variant_ref_sink(parameters));
+      return;
+    }
+
+    g_dbus_connection_emit_signal(p_gdbus_connection, nullptr,
+        "/org/usbguard/Devices", "org.usbguard.Devices", signal_name,
+        parameters, nullptr);
+    return;
+  }
+
+} /* namespace usbguard */
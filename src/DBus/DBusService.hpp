@@ -0,0 +1,170 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include <gio/gio.h>
+#include "Interface.hpp"
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace usbguard
+{
+  /*
+   * The org.usbguard.Policy and org.usbguard.Devices objects backed
+   * by an Interface implementation. Method calls are served by the
+   * backend and the signal methods emit the D-Bus signals. Used by
+   * the usbguard-dbus bridge, which passes everything to the daemon
+   * over IPC, and by the daemon itself when it exports the objects
+   * directly.
+   */
+  class DBusService
+  {
+  public:
+    /*
+     * Runs a method call received on the registered objects. May run
+     * it later or on another thread, or return false to reject it.
+     */
+    typedef std::function<bool(const std::string& method_name, const std::function<void()>& call)> Dispatcher;
+
+    DBusService(Interface& backend);
+    ~DBusService();
+
+    void setDispatcher(Dispatcher dispatcher);
+
+    /*
+     * Coalesce the device signals emitted within a window of
+     * window_ms milliseconds into a single DevicesChanged signal.
+     * The window timer runs in the given main context (the default
+     * one if nullptr). A zero window emits each signal on its own,
+     * which is the default.
+     */
+    void setSignalCoalescing(unsigned int window_ms, GMainContext *context = nullptr);
+
+    /*
+     * Set the connection the signals are emitted on. Registering
+     * the objects on a connection sets it as well.
+     */
+    void setConnection(GDBusConnection *gdbus_connection);
+    bool registerObjects(GDBusConnection *gdbus_connection);
+    void unregisterObjects();
+
+    void handleMethodCall(const std::string& interface, const std::string& method_name,
+        GVariant * parameters, GDBusMethodInvocation * invocation);
+
+    /*
+     * Pass the method call to the dispatcher and serve it with
+     * serveMethodCall once dispatched. Without a dispatcher, the
+     * call is served right away.
+     */
+    void dispatchMethodCall(const std::string& interface, const std::string& method_name,
+        GDBusMethodInvocation * invocation);
+
+    /*
+     * Same as handleMethodCall, but exceptions are returned
+     * to the caller as D-Bus errors.
+     */
+    void serveMethodCall(const std::string& interface, const std::string& method_name,
+        GVariant * parameters, GDBusMethodInvocation * invocation);
+
+    void DevicePresent(uint32_t id,
+        const std::map<std::string,std::string>& attributes,
+        const std::vector<usbguard::USBInterfaceType>& interfaces,
+        usbguard::Rule::Target target);
+
+    void DeviceInserted(uint32_t id,
+        const std::map<std::string,std::string>& attributes,
+        const std::vector<USBInterfaceType>& interfaces,
+        bool rule_match,
+        uint32_t rule_id);
+
+    void DeviceRemoved(uint32_t id,
+        const std::map<std::string,std::string>& attributes);
+
+    void DeviceAllowed(uint32_t id,
+        const std::map<std::string,std::string>& attributes,
+        bool rule_match,
+        uint32_t rule_id);
+
+    void DeviceBlocked(uint32_t id,
+        const std::map<std::string,std::string>& attributes,
+        bool rule_match,
+        uint32_t rule_id);
+
+    void DeviceRejected(uint32_t id,
+        const std::map<std::string,std::string>& attributes,
+        bool rule_match,
+        uint32_t rule_id);
+
+  protected:
+    void handlePolicyMethodCall(const std::string& method_name, GVariant * parameters, GDBusMethodInvocation * invocation);
+    void handleDevicesMethodCall(const std::string& method_name, GVariant * parameters, GDBusMethodInvocation * invocation);
+
+    void emitDevicePolicyDecision(const char *policy_signal,
+        uint32_t id,
+        const std::map<std::string,std::string>& attributes,
+        bool rule_match,
+        uint32_t rule_id);
+
+    void emitSignal(const char *signal_name, GVariant *parameters);
+    void emitSignalNow(const char *signal_name, GVariant *parameters);
+    void flushCoalescedSignals();
+    static gboolean gsourceFlushFn(gpointer user_data);
+
+    /*
+     * Add the device attributes of a device specific rule, as
+     * {sv} entries, to an opened a{sv} builder.
+     */
+    static void addDeviceAttributes(GVariantBuilder *gv_builder, const Rule& device_rule);
+
+    static void gdbusMethodCallFn(GDBusConnection *connection,
+        const gchar *sender,
+        const gchar *object_path,
+        const gchar *interface_name,
+        const gchar *method_name,
+        GVariant *parameters,
+        GDBusMethodInvocation *invocation,
+        gpointer user_data);
+
+  private:
+    Interface& p_backend;
+    Dispatcher p_dispatcher;
+    GDBusConnection *p_gdbus_connection;
+    std::mutex p_gdbus_connection_mutex;
+    GDBusNodeInfo *p_introspection_data;
+    guint p_policy_rid;
+    guint p_devices_rid;
+
+    struct CoalescedSignal
+    {
+      guint64 sequence;
+      const char *signal_name;
+      GVariant *parameters;
+    };
+
+    unsigned int p_coalesce_window_ms;
+    GMainContext *p_coalesce_context;
+    GSource *p_coalesce_source;
+    guint64 p_coalesce_sequence;
+    std::vector<CoalescedSignal> p_coalesced;
+    std::mutex p_coalesce_mutex;
+  };
+} /* namespace usbguard */
@@ -19,6 +19,7 @@
 #include <gio/gio.h>
 #include <stdlib.h>
 #include <iostream>
+#include <string>
 #include <getopt.h>
 #include "DBusBridge.hpp"
 
@@ -33,6 +34,7 @@ static const gchar introspection_xml[] =
 static const unsigned int expected_interface_count = 2;
 
 static int global_ret = EXIT_SUCCESS;
+static unsigned int coalesce_window_ms = 0;
 
 static void
 handle_method_call (GDBusConnection       *connection,
@@ -144,6 +146,7 @@ on_name_acquired (GDBusConnection *connection,
   global_ret = EXIT_SUCCESS;
   try {
     dbus_bridge = new usbguard::DBusBridge(connection);
+    dbus_bridge->setSignalCoalescing(coalesce_window_ms);
     handle_usbguard_ipc_state(/*state=*/false);
   }
   catch(...) {
@@ -165,12 +168,13 @@ on_name_lost (GDBusConnection *connection,
   delete dbus_bridge_local;
 }
 
-static const char *options_short = "sSh";
+static const char *options_short = "sSc:h";
 static const char *usbguard_arg0 = nullptr;
 
 static const struct ::option options_long[] = {
   { "system", no_argument, nullptr, 's' },
   { "session", no_argument, nullptr, 'S' },
+  { "coalesce", required_argument, nullptr, 'c' },
   { "help", no_argument, nullptr, 'h' },
   { nullptr, 0, nullptr, 0 }
 };
@@ -182,6 +186,9 @@ static void showHelp(std::ostream& stream)
   stream << " Options:" << std::endl;
   stream << "  -s, --system   Listen on the system bus." << std::endl;
   stream << "  -S, --session  Listen on the session bus." << std::endl;
+  stream << "  -c, --coalesce <ms>" << std::endl;
+  stream << "                 Emit the device signals in batches, as a single" << std::endl;
+  stream << "                 DevicesChanged signal per <ms> milliseconds." << std::endl;
   stream << "  -h, --help     Show this help." << std::endl;
   stream << std::endl;
 }
@@ -202,6 +209,15 @@ main (int argc, char *argv[])
       case 'S':
         use_system_bus = false;
         break;
+      case 'c':
+        try {
+          coalesce_window_ms = std::stoul(optarg);
+        }
+        catch(...) {
+          std::cerr << "Invalid coalescing window: " << optarg << std::endl;
+          return EXIT_FAILURE;
+        }
+        break;
       case 'h':
         showHelp(std::cout);
         return EXIT_SUCCESS;
@@ -24,6 +24,24 @@
 #include "IPCPrivate.hpp"
 #include "RulePrivate.hpp"
 #include "RuleParser.hpp"
+#include "RuleArena.hpp"
+#include "RuleSetDiff.hpp"
+#include "RuleQueryCache.hpp"
+#include "EvaluationClock.hpp"
+#include "Hash.hpp"
+#include "Base64.hpp"
+#include "DeviceSnapshot.hpp"
+#include "DescriptorCache.hpp"
+#include "StringPool.hpp"
+#include "LatencyStatistics.hpp"
+#include "StartupProfile.hpp"
+#include "USBTrafficMonitor.hpp"
+#include "ModuleCondition.hpp"
+#include "Common/ThreadPool.hpp"
+#include "Common/Tracepoints.hpp"
+#if defined(HAVE_DBUS)
+# include "DBus/DBusService.hpp"
+#endif
 
 #include <sys/select.h>
 #include <sys/time.h>
@@ -34,15 +52,93 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 
 #include <grp.h>
 #include <pwd.h>
 
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <sstream>
+#include <fstream>
+#include <new>
+
 namespace usbguard
 {
   qb_loop_t *G_qb_loop = nullptr;
 
+  /*
+   * Upper bounds for the off-loop IPC request processing:
+   * the number of workers serving read-only method calls
+   * and the number of requests waiting in each lane.
+   */
+  static const unsigned G_ipc_read_workers_max = 4;
+  static const size_t G_ipc_queue_size_max = 256;
+
+  /*
+   * Admission control of a single client: the number of its
+   * requests being processed at once, and a token bucket limiting
+   * the rate of its read-only calls (requests per second and the
+   * burst size). Calls which change the device state or the rules
+   * are only subject to the outstanding request limit.
+   */
+  static const size_t G_ipc_outstanding_max = 16;
+  static const double G_ipc_read_rate = 50.0;
+  static const double G_ipc_read_burst = 100.0;
+
+  /*
+   * The read-only calls and the logging worker run with a lower
+   * scheduling priority (a higher nice value by this much, unless
+   * BackgroundThreadNice is set) than the authorization path, so
+   * that bulk reads don't compete with it for the CPU.
+   */
+  static const int G_background_nice_default = 5;
+
+  /*
+   * Limit on the data waiting to be sent to a single client and
+   * the interval between attempts to send it.
+   */
+  static const size_t G_ipc_pending_size_max = 4 << 20;
+  static const uint64_t G_ipc_retry_interval_ns = 10 * 1000000ULL;
+
+  /*
+   * Connection send buffers larger than this are released
+   * after use instead of being kept for the next message.
+   */
+  static const size_t G_ipc_send_buffer_size_max = 64 << 10;
+
+  /*
+   * Number of items sent in one message of a streamed
+   * listRules or listDevices reply.
+   */
+  static const size_t G_ipc_stream_chunk_size = 128;
+
+  /*
+   * Number of device and rule changes remembered
+   * for getChangesSince.
+   */
+  static const size_t G_state_log_size_max = 4096;
+
+  /*
+   * Smallest batch of present devices for which the device
+   * rules are generated on the thread pool.
+   */
+  static const size_t G_present_parallel_min_devices = 8;
+
+  /*
+   * How long the IPC ACL decision for a uid/gid pair is reused
+   * before the user and group databases are consulted again, and
+   * how many decisions are remembered.
+   */
+  static const std::chrono::seconds G_ipc_acl_cache_ttl(60);
+  static const size_t G_ipc_acl_cache_size_max = 1024;
+
   /*
    * Recognized configuration option names. If an
    * unknown setting is found in the config file,
@@ -50,18 +146,70 @@ namespace usbguard
    */
   const StringVector G_config_known_names = {
     "RuleFile",
+    "RuleCacheFile",
+    "RuleFolder",
+    "PolicyBundleFile",
+    "PolicyBundleKeyFile",
     "ImplicitPolicyTarget",
+    "DecisionTimeout",
+    "DecisionTimeoutTarget",
+    "DecisionTimeoutCorrect",
     "PresentDevicePolicy",
     "PresentControllerPolicy",
     "IPCAllowedUsers",
     "IPCAllowedGroups",
-    "DeviceRulesWithPort"
+    "DeviceRulesWithPort",
+    "SealedPolicy",
+    "DeviceHashAlgorithm",
+    "DeviceHashKeyFile",
+    "DBusExport",
+    "DBusSignalCoalesceWindow",
+    "LogAsync",
+    "LogQueueSize",
+    "LogOverflowPolicy",
+    "AuditLogFile",
+    "AuditLogRecords",
+    "AuditLogKeep",
+    "MetricsEndpoint",
+    "DeviceCheckpointFile",
+    "RuleStatisticsFile",
+    "RuleStatisticsInterval",
+    "InterfaceAuthorization",
+    "ControllerAuthorizedDefault",
+    "USBTrafficMonitor",
+    "DeviceEventSource",
+    "DeviceEventBufferSize",
+    "DeviceManagerBackend",
+    "VirtualSysfsRoot",
+    "VirtualEventStream",
+    "IPCTransport",
+    "DeviceThreadCPUs",
+    "DeviceThreadScheduling",
+    "BackgroundThreadNice",
+    "RuleConditionModules"
   };
 
   Daemon::Daemon()
     : _config(G_config_known_names),
-      _ruleset(this)
+      _ruleset(this),
+      _device_events(/*max_memory_MiB=*/1),
+      _rule_timers(ruleTimerNow())
   {
+    _ipc_read_lane.running = false;
+    _ipc_write_lane.running = false;
+    _ipc_wakeup_fd = -1;
+    _loop_thread_id = std::this_thread::get_id();
+    _ipc_retry_timer_handle = nullptr;
+    _ipc_retry_timer_armed = false;
+    _ipc_connections = 0;
+    _ipc_buffer_bytes = 0;
+    _background_nice = G_background_nice_default;
+    _qb_service = nullptr;
+    _ipc_transport = QB_IPC_NATIVE;
+    _rule_timer_rearm = false;
+    _condition_timer_rearm = false;
+    _ready = false;
+
     G_qb_loop = _qb_loop = qb_loop_create();
 
     if (!_qb_loop) {
@@ -69,7 +217,7 @@ namespace usbguard
     }
 
     try {
-      _dm = DeviceManager::create(*this);
+      StartupProfile::Scope phase("init-ipc");
       initIPC();
     } catch(...) {
       qb_loop_destroy(_qb_loop);
@@ -80,22 +228,71 @@ namespace usbguard
     for (int signum : { SIGINT, SIGTERM, SIGSYS }) {
       if (qb_loop_signal_add(_qb_loop, QB_LOOP_HIGH, signum,
 			     _qb_loop, Daemon::qbSignalHandlerFn, NULL) != 0) {
-	logger->debug("Cannot register signal #{} handler", signum);
+	USBGUARD_LOG_DEBUG("Cannot register signal #{} handler", signum);
 	throw std::runtime_error("signal init error");
       }
     }
 
+    if (qb_loop_signal_add(_qb_loop, QB_LOOP_HIGH, SIGHUP,
+                           this, Daemon::qbReloadSignalFn, NULL) != 0) {
+      USBGUARD_LOG_DEBUG("Cannot register signal #{} handler", SIGHUP);
+      throw std::runtime_error("signal init error");
+    }
+
     _ipc_dac_acl = false;
     _implicit_policy_target = Rule::Target::Block;
+    _decision_timeout.timeout = std::chrono::milliseconds(0);
+    _decision_timeout.target = Rule::Target::Block;
+    _decision_timeout.correct = true;
+    _decisions_pending = 0;
     _present_device_policy = PresentDevicePolicy::Keep;
     _present_controller_policy = PresentDevicePolicy::Allow;
     _device_rules_with_port = false;
+    _sealed_policy = false;
+    _interface_authorization = false;
+    _dbus_export_bus = "none";
+    _dbus_signal_coalesce_window_ms = 0;
+
+    _rule_timer_handle = nullptr;
+    _rule_timer_armed = false;
+    _rule_timer_tick = 0;
+
+    _traffic_timer_handle = nullptr;
+    _traffic_timer_armed = false;
+
+    _rule_statistics_interval_s = 300;
+    _rule_statistics_timer_handle = nullptr;
+    _rule_statistics_timer_armed = false;
+
+    _condition_timer_handle = nullptr;
+    _condition_timer_armed = false;
+
+    _state_generation = std::chrono::duration_cast<std::chrono::microseconds>(\
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    _state_log_floor = _state_generation;
 
     return;
   }
 
   Daemon::~Daemon()
   {
+    stopDBusExport();
+    stopIPCWorkers();
+    if (_ipc_retry_timer_armed) {
+      qb_loop_timer_del(_qb_loop, _ipc_retry_timer_handle);
+    }
+    if (_rule_timer_armed) {
+      qb_loop_timer_del(_qb_loop, _rule_timer_handle);
+    }
+    if (_traffic_timer_armed) {
+      qb_loop_timer_del(_qb_loop, _traffic_timer_handle);
+    }
+    if (_rule_statistics_timer_armed) {
+      qb_loop_timer_del(_qb_loop, _rule_statistics_timer_handle);
+    }
+    if (_condition_timer_armed) {
+      qb_loop_timer_del(_qb_loop, _condition_timer_handle);
+    }
     finiIPC();
     _config.close();
     qb_loop_destroy(_qb_loop);
@@ -103,14 +300,228 @@ namespace usbguard
     return;
   }
 
+  /*
+   * The settings missing from the file get their default values:
+   * no time budget, the block target and corrected decisions.
+   */
+  static void readDecisionTimeout(const ConfigFile& config, std::chrono::milliseconds& timeout,
+                                  Rule::Target& target, bool& correct)
+  {
+    timeout = std::chrono::milliseconds(0);
+    target = Rule::Target::Block;
+    correct = true;
+
+    if (config.hasSettingValue("DecisionTimeout")) {
+      timeout = std::chrono::milliseconds(stringToNumber<unsigned int>(config.getSettingValue("DecisionTimeout")));
+    }
+    if (config.hasSettingValue("DecisionTimeoutTarget")) {
+      target = Rule::targetFromString(config.getSettingValue("DecisionTimeoutTarget"));
+      if (target != Rule::Target::Allow && target != Rule::Target::Block && target != Rule::Target::Reject) {
+        throw std::runtime_error("Invalid DecisionTimeoutTarget value.");
+      }
+    }
+    if (config.hasSettingValue("DecisionTimeoutCorrect")) {
+      const String value = config.getSettingValue("DecisionTimeoutCorrect");
+      if (value != "true" && value != "false") {
+        throw std::runtime_error("Invalid DecisionTimeoutCorrect value.");
+      }
+      correct = (value == "true");
+    }
+  }
+
   void Daemon::loadConfiguration(const String& path)
   {
-    logger->debug("Loading configuration from {}", path);
+    StartupProfile::Scope phase("load-configuration");
+    USBGUARD_LOG_DEBUG("Loading configuration from {}", path);
     _config.open(path);
+    _config_path = path;
+
+    /*
+     * DeviceThreadCPUs, DeviceThreadScheduling, BackgroundThreadNice
+     *
+     * Parsed before the asynchronous logger and the device manager
+     * are created, the threads apply them when they start.
+     */
+    if (_config.hasSettingValue("DeviceThreadCPUs")) {
+      const String value = _config.getSettingValue("DeviceThreadCPUs");
+      if (!_device_thread_scheduling.setCPUs(value)) {
+        throw std::runtime_error("Invalid DeviceThreadCPUs value.");
+      }
+      USBGUARD_LOG_DEBUG("DeviceThreadCPUs set to {}", value);
+    }
+    if (_config.hasSettingValue("DeviceThreadScheduling")) {
+      const String value = _config.getSettingValue("DeviceThreadScheduling");
+      if (!_device_thread_scheduling.setPolicy(value)) {
+        throw std::runtime_error("Invalid DeviceThreadScheduling value.");
+      }
+      USBGUARD_LOG_DEBUG("DeviceThreadScheduling set to {}", value);
+    }
+    if (_config.hasSettingValue("BackgroundThreadNice")) {
+      const int value = stringToNumber<int>(_config.getSettingValue("BackgroundThreadNice"));
+      if (value < 0 || value > 39) {
+        throw std::runtime_error("Invalid BackgroundThreadNice value.");
+      }
+      _background_nice = value;
+      USBGUARD_LOG_DEBUG("BackgroundThreadNice set to {}", value);
+    }
+
+    /*
+     * LogAsync, LogQueueSize, LogOverflowPolicy
+     *
+     * Applied first, so that the rest of the daemon, including
+     * the device authorization path, never waits on the sinks.
+     */
+    if (_config.hasSettingValue("LogAsync")) {
+      const String value = _config.getSettingValue("LogAsync");
+      bool async_enabled = false;
+      size_t queue_size = 8192;
+      Logger::OverflowPolicy policy = Logger::OverflowPolicy::Block;
+
+      if (value == "true") {
+        async_enabled = true;
+      }
+      else if (value != "false") {
+        throw std::runtime_error("Invalid LogAsync value.");
+      }
+      if (_config.hasSettingValue("LogQueueSize")) {
+        queue_size = stringToNumber<size_t>(_config.getSettingValue("LogQueueSize"));
+      }
+      if (_config.hasSettingValue("LogOverflowPolicy")) {
+        policy = Logger::overflowPolicyFromString(_config.getSettingValue("LogOverflowPolicy"));
+      }
+
+      /*
+       * The worker can't log from here, the logger is being created.
+       */
+      const int background_nice = _background_nice;
+      Logger::setAsyncMode(async_enabled, queue_size, policy,
+                           [background_nice]() { ThreadScheduling::lowerPriority(background_nice); });
+      USBGUARD_LOG_DEBUG("LogAsync set to {}", async_enabled);
+    }
+
+    /*
+     * DeviceHashAlgorithm, DeviceHashKeyFile
+     *
+     * Set before anything gets hashed, the values apply to
+     * all device hashes computed by this process.
+     */
+    if (_config.hasSettingValue("DeviceHashAlgorithm")) {
+      const String& algorithm_string = _config.getSettingValue("DeviceHashAlgorithm");
+      Hash::setDefaultAlgorithm(Hash::algorithmFromString(algorithm_string));
+      USBGUARD_LOG_DEBUG("DeviceHashAlgorithm set to {}", algorithm_string);
+    }
+    if (_config.hasSettingValue("DeviceHashKeyFile")) {
+      USBGUARD_LOG_DEBUG("Loading the device hash key");
+      Hash::setDefaultKeyFromFile(_config.getSettingValue("DeviceHashKeyFile"));
+    }
+
+    /*
+     * DeviceManagerBackend, VirtualSysfsRoot, VirtualEventStream
+     *
+     * The device manager is created here, so that the udev and
+     * sysfs of the system aren't touched with the virtual backend.
+     */
+    {
+      const String backend = _config.hasSettingValue("DeviceManagerBackend") ?
+        _config.getSettingValue("DeviceManagerBackend") : String("linux");
+
+      if (backend != "linux" && backend != "virtual") {
+        throw std::runtime_error("Invalid DeviceManagerBackend value.");
+      }
+
+      _dm = DeviceManager::create(*this, backend);
+      USBGUARD_LOG_DEBUG("DeviceManagerBackend set to {}", backend);
+    }
+    if (_config.hasSettingValue("VirtualSysfsRoot")) {
+      const String& root = _config.getSettingValue("VirtualSysfsRoot");
+      _dm->setSysfsRoot(root);
+      USBGUARD_LOG_DEBUG("VirtualSysfsRoot set to {}", root);
+    }
+    if (_config.hasSettingValue("VirtualEventStream")) {
+      const String& stream = _config.getSettingValue("VirtualEventStream");
+      _dm->setEventStream(stream);
+      USBGUARD_LOG_DEBUG("VirtualEventStream set to {}", stream);
+    }
+
+    /* DeviceCheckpointFile */
+    if (_config.hasSettingValue("DeviceCheckpointFile")) {
+      const String& checkpoint_path = _config.getSettingValue("DeviceCheckpointFile");
+      _dm->setCheckpointFile(checkpoint_path);
+      USBGUARD_LOG_DEBUG("DeviceCheckpointFile set to {}", checkpoint_path);
+    }
+
+    /* DeviceEventSource */
+    if (_config.hasSettingValue("DeviceEventSource")) {
+      const String& source = _config.getSettingValue("DeviceEventSource");
+      if (source == "kernel") {
+        _dm->setKernelEventSource(true);
+      }
+      else if (source == "udev") {
+        _dm->setKernelEventSource(false);
+      }
+      else {
+        throw std::runtime_error("Invalid DeviceEventSource value.");
+      }
+      USBGUARD_LOG_DEBUG("DeviceEventSource set to {}", source);
+    }
 
-    /* RuleFile */
-    if (_config.hasSettingValue("RuleFile")) {
-      logger->debug("Setting rules file path from configuration file");
+    /* DeviceEventBufferSize */
+    if (_config.hasSettingValue("DeviceEventBufferSize")) {
+      const size_t size_MiB = stringToNumber<size_t>(_config.getSettingValue("DeviceEventBufferSize"));
+      if (size_MiB == 0 || size_MiB > 1024) {
+        throw std::runtime_error("Invalid DeviceEventBufferSize value.");
+      }
+      _dm->setEventBufferSize(size_MiB * 1024 * 1024);
+      USBGUARD_LOG_DEBUG("DeviceEventBufferSize set to {} MiB", size_MiB);
+    }
+
+    /* IPCTransport */
+    if (_config.hasSettingValue("IPCTransport")) {
+      const String& transport = _config.getSettingValue("IPCTransport");
+      enum qb_ipc_type type = QB_IPC_NATIVE;
+      if (transport == "native") {
+        type = QB_IPC_NATIVE;
+      }
+      else if (transport == "shm") {
+        type = QB_IPC_SHM;
+      }
+      else if (transport == "socket") {
+        type = QB_IPC_SOCKET;
+      }
+      else {
+        throw std::runtime_error("Invalid IPCTransport value.");
+      }
+      /*
+       * No client is connected before the daemon runs, so the
+       * service can be recreated with the selected transport.
+       */
+      if (type != _ipc_transport) {
+        stopIPCService();
+        _ipc_transport = type;
+        startIPCService();
+      }
+      USBGUARD_LOG_DEBUG("IPCTransport set to {}", transport);
+    }
+
+    /* RuleConditionModules, before the rules which use them are parsed */
+    if (_config.hasSettingValue("RuleConditionModules")) {
+      StringVector paths;
+      tokenizeString(_config.getSettingValue("RuleConditionModules"), paths, " ", /*trim_empty=*/true);
+
+      for (const String& path : paths) {
+        ConditionModule::load(path);
+      }
+    }
+
+    /* RuleFolder, PolicyBundleFile, RuleFile */
+    if (_config.hasSettingValue("RuleFolder")) {
+      loadRuleFolder(_config.getSettingValue("RuleFolder"));
+    }
+    else if (_config.hasSettingValue("PolicyBundleFile")) {
+      loadPolicyBundle(_config.getSettingValue("PolicyBundleFile"));
+    }
+    else if (_config.hasSettingValue("RuleFile")) {
+      USBGUARD_LOG_DEBUG("Setting rules file path from configuration file");
       const String& rule_file = _config.getSettingValue("RuleFile");
       try {
 	loadRules(rule_file);
@@ -123,7 +534,27 @@ namespace usbguard
         logger->warn("The configured rule file doesn't yet exists. Starting with an empty rule set.");
       }
     } else {
-      logger->debug("No rules file path specified.");
+      USBGUARD_LOG_DEBUG("No rules file path specified.");
+    }
+
+    /*
+     * RuleStatisticsFile, RuleStatisticsInterval
+     *
+     * Restored after the rules are loaded, the saved counters
+     * are matched to the rules by their text.
+     */
+    if (_config.hasSettingValue("RuleStatisticsInterval")) {
+      _rule_statistics_interval_s = stringToNumber<unsigned int>(_config.getSettingValue("RuleStatisticsInterval"));
+      if (_rule_statistics_interval_s == 0) {
+        throw std::runtime_error("Invalid RuleStatisticsInterval value.");
+      }
+    }
+    if (_config.hasSettingValue("RuleStatisticsFile")) {
+      const String& statistics_path = _config.getSettingValue("RuleStatisticsFile");
+      _rule_statistics = makePointer<RuleStatisticsFile>(statistics_path);
+      const size_t restored = _rule_statistics->restore(_ruleset);
+      USBGUARD_LOG_DEBUG("RuleStatisticsFile set to {}, restored the counters of {} rules",
+                         statistics_path, restored);
     }
 
     /* ImplicitPolicyTarget */
@@ -133,6 +564,13 @@ namespace usbguard
       setImplicitPolicyTarget(target);
     }
 
+    /* DecisionTimeout, DecisionTimeoutTarget, DecisionTimeoutCorrect */
+    readDecisionTimeout(_config, _decision_timeout.timeout, _decision_timeout.target, _decision_timeout.correct);
+    if (_decision_timeout.timeout.count() > 0) {
+      USBGUARD_LOG_DEBUG("DecisionTimeout set to {} ms, fallback target {}",
+                         _decision_timeout.timeout.count(), Rule::targetToString(_decision_timeout.target));
+    }
+
     /* PresentDevicePolicy */
     if (_config.hasSettingValue("PresentDevicePolicy")) {
       const String& policy_string = _config.getSettingValue("PresentDevicePolicy");
@@ -149,12 +587,12 @@ namespace usbguard
 
     /* IPCAllowedUsers */
     if (_config.hasSettingValue("IPCAllowedUsers")) {
-      logger->debug("Setting allowed IPC users");
+      USBGUARD_LOG_DEBUG("Setting allowed IPC users");
       StringVector usernames;
       tokenizeString(_config.getSettingValue("IPCAllowedUsers"),
 		     usernames, " ", /*trim_empty=*/true);
       for (auto const& username : usernames) {
-	logger->debug("Allowed IPC user: {}", username);
+	USBGUARD_LOG_DEBUG("Allowed IPC user: {}", username);
 	DACAddAllowedUID(username);
       }
       _ipc_dac_acl = true;
@@ -162,12 +600,12 @@ namespace usbguard
 
     /* IPCAllowedGroups */
     if (_config.hasSettingValue("IPCAllowedGroups")) {
-      logger->debug("Setting allowed IPC groups");
+      USBGUARD_LOG_DEBUG("Setting allowed IPC groups");
       StringVector groupnames;
       tokenizeString(_config.getSettingValue("IPCAllowedGroups"),
 		     groupnames, " ", /*trim_empty=*/true);
       for (auto const& groupname : groupnames) {
-	logger->debug("Allowed IPC group: {}", groupname);
+	USBGUARD_LOG_DEBUG("Allowed IPC group: {}", groupname);
 	DACAddAllowedGID(groupname);
       }
       _ipc_dac_acl = true;
@@ -185,961 +623,5003 @@ namespace usbguard
       else {
         throw std::runtime_error("Invalid DeviceRulesWithPort value.");
       }
-      logger->debug("DeviceRulesWithPort set to {}", _device_rules_with_port);
+      USBGUARD_LOG_DEBUG("DeviceRulesWithPort set to {}", _device_rules_with_port.load());
+    }
+
+    /* SealedPolicy */
+    if (_config.hasSettingValue("SealedPolicy")) {
+      const String value = _config.getSettingValue("SealedPolicy");
+      if (value == "true") {
+        _sealed_policy = true;
+      }
+      else if (value == "false") {
+        _sealed_policy = false;
+      }
+      else {
+        throw std::runtime_error("Invalid SealedPolicy value.");
+      }
+      USBGUARD_LOG_DEBUG("SealedPolicy set to {}", _sealed_policy.load());
+    }
+    /*
+     * Sealing the rule set before the rules are loaded builds the
+     * sealed index only once, for the loaded rules.
+     */
+    _ruleset.setSealed(_sealed_policy);
+
+    /* InterfaceAuthorization */
+    if (_config.hasSettingValue("InterfaceAuthorization")) {
+      const String value = _config.getSettingValue("InterfaceAuthorization");
+      if (value == "true") {
+        _interface_authorization = true;
+      }
+      else if (value == "false") {
+        _interface_authorization = false;
+      }
+      else {
+        throw std::runtime_error("Invalid InterfaceAuthorization value.");
+      }
+      _dm->setInterfaceAuthorization(_interface_authorization);
+      USBGUARD_LOG_DEBUG("InterfaceAuthorization set to {}", _interface_authorization);
+    }
+
+    /* ControllerAuthorizedDefault */
+    if (_config.hasSettingValue("ControllerAuthorizedDefault")) {
+      StringVector entries;
+      std::map<String, DeviceManager::AuthorizedDefault> controllers;
+      tokenizeString(_config.getSettingValue("ControllerAuthorizedDefault"),
+                     entries, " ", /*trim_empty=*/true);
+
+      for (auto const& entry : entries) {
+        /* Split at the first colon, PCI addresses contain colons */
+        const size_t colon = entry.find(':');
+
+        if (colon == String::npos || colon + 1 == entry.size()) {
+          throw std::runtime_error("Invalid ControllerAuthorizedDefault value.");
+        }
+
+        const String mode = entry.substr(0, colon);
+        const String controller = entry.substr(colon + 1);
+
+        if (mode == "none") {
+          controllers[controller] = DeviceManager::AuthorizedDefault::None;
+        }
+        else if (mode == "all") {
+          controllers[controller] = DeviceManager::AuthorizedDefault::All;
+        }
+        else if (mode == "internal") {
+          controllers[controller] = DeviceManager::AuthorizedDefault::Internal;
+        }
+        else {
+          throw std::runtime_error("Invalid ControllerAuthorizedDefault value.");
+        }
+        USBGUARD_LOG_DEBUG("ControllerAuthorizedDefault: {} for {}", mode, controller);
+      }
+      _dm->setControllerAuthorizedDefault(controllers);
+    }
+
+    /* AuditLogFile, AuditLogRecords, AuditLogKeep */
+    if (_config.hasSettingValue("AuditLogFile")) {
+      const String audit_path = _config.getSettingValue("AuditLogFile");
+      size_t audit_records = 65536;
+      size_t audit_keep = 4;
+
+      if (_config.hasSettingValue("AuditLogRecords")) {
+        audit_records = stringToNumber<size_t>(_config.getSettingValue("AuditLogRecords"));
+      }
+      if (_config.hasSettingValue("AuditLogKeep")) {
+        audit_keep = stringToNumber<size_t>(_config.getSettingValue("AuditLogKeep"));
+      }
+
+      _audit_log = makePointer<AuditLog>(audit_path, audit_records, audit_keep);
+      USBGUARD_LOG_DEBUG("AuditLogFile set to {} ({} records, {} rotated files)",
+                         audit_path, audit_records, audit_keep);
+    }
+
+    /* MetricsEndpoint */
+    if (_config.hasSettingValue("MetricsEndpoint")) {
+      const String value = _config.getSettingValue("MetricsEndpoint");
+      if (value != "none") {
+        _metrics_endpoint = makePointer<MetricsEndpoint>(value, [this]() { return renderMetrics(); });
+      }
+      USBGUARD_LOG_DEBUG("MetricsEndpoint set to {}", value);
     }
 
-    logger->debug("Configuration loaded successfully");
+    /* USBTrafficMonitor */
+    if (_config.hasSettingValue("USBTrafficMonitor")) {
+      const String value = _config.getSettingValue("USBTrafficMonitor");
+      _usbmon_path = (value != "none" ? value : String());
+      USBGUARD_LOG_DEBUG("USBTrafficMonitor set to {}", value);
+    }
+
+    /* DBusExport */
+    if (_config.hasSettingValue("DBusExport")) {
+      const String value = _config.getSettingValue("DBusExport");
+      if (value != "none" && value != "system" && value != "session") {
+        throw std::runtime_error("Invalid DBusExport value.");
+      }
+#if !defined(HAVE_DBUS)
+      if (value != "none") {
+        throw std::runtime_error("DBusExport: compiled without D-Bus support.");
+      }
+#endif
+      _dbus_export_bus = value;
+      USBGUARD_LOG_DEBUG("DBusExport set to {}", _dbus_export_bus);
+    }
+
+    /* DBusSignalCoalesceWindow */
+    if (_config.hasSettingValue("DBusSignalCoalesceWindow")) {
+      const String value = _config.getSettingValue("DBusSignalCoalesceWindow");
+      _dbus_signal_coalesce_window_ms = stringToNumber<unsigned int>(value);
+      USBGUARD_LOG_DEBUG("DBusSignalCoalesceWindow set to {}", _dbus_signal_coalesce_window_ms);
+    }
+
+    USBGUARD_LOG_DEBUG("Configuration loaded successfully");
     return;
   }
 
   void Daemon::loadRules(const String& path)
   {
+    StartupProfile::Scope phase("load-rules");
+
+    if (!_config.hasSettingValue("RuleCacheFile")) {
+      _ruleset.load(path);
+      return;
+    }
+
+    const String& cache_path = _config.getSettingValue("RuleCacheFile");
+
+    if (_ruleset.loadCache(cache_path, path)) {
+      USBGUARD_LOG_DEBUG("Loaded the rule set from the rule cache {}", cache_path);
+      return;
+    }
+
     _ruleset.load(path);
-    return;
-  }
 
-  void Daemon::setImplicitPolicyTarget(Rule::Target target)
-  {
-    _implicit_policy_target = target;
-    _ruleset.setDefaultTarget(target);
+    try {
+      _ruleset.saveCache(cache_path, path);
+    }
+    catch(const std::exception& ex) {
+      logger->warn("Cannot update the rule cache {}: {}", cache_path, ex.what());
+    }
     return;
   }
 
-  void Daemon::setPresentDevicePolicy(PresentDevicePolicy policy)
+  /*
+   * Load the fragments of the rule folder followed by the rule file
+   * (see RuleFolder). The rule file and the rule cache file are
+   * optional; rules added over IPC are stored only if a rule file
+   * is configured.
+   */
+  void Daemon::loadRuleFolder(const String& folder_path)
   {
-    _present_device_policy = policy;
-    return;
-  }
+    StartupProfile::Scope phase("load-rules");
+    USBGUARD_LOG_DEBUG("Loading the rules from the rule folder {}", folder_path);
+    _rule_folder = makePointer<RuleFolder>(folder_path,
+      _config.hasSettingValue("RuleFile") ? _config.getSettingValue("RuleFile") : String(),
+      _config.hasSettingValue("RuleCacheFile") ? _config.getSettingValue("RuleCacheFile") : String());
 
-  void Daemon::setPresentControllerPolicy(PresentDevicePolicy policy)
-  {
-    _present_controller_policy = policy;
-    return;
-  }
+    RuleFolder::Contents contents;
 
-  void Daemon::run()
-  {
-    _dm->start();
-    qb_loop_run(_qb_loop);
-    return;
-  }
+    try {
+      contents = _rule_folder->read(_ruleset);
+    }
+    catch(const RuleParserError& ex) {
+      logger->error("Syntax error in the rule file {} on line {}: {}", ex.file(), ex.line(), ex.hint());
+      throw;
+    }
 
-  void Daemon::quit()
-  {
-    qb_loop_stop(_qb_loop);
-    return;
-  }
+    std::vector<RuleSet::Operation> operations;
 
-  uint32_t Daemon::assignID()
-  {
-    return _ruleset.assignID();
+    for (auto const& rule : contents.rules) {
+      operations.push_back(RuleSet::Operation::append(rule));
+    }
+
+    const std::vector<uint32_t> ids = _ruleset.applyBatch(operations);
+    _rule_folder->assign(ids, std::move(contents));
+
+    USBGUARD_LOG_DEBUG("Loaded {} rules from {} rule files", ids.size(), _rule_folder->fragments().size());
+    return;
   }
 
   /*
-   * Search for a rule that matches `match_spec' rule and
-   * update it with a rule specified by `rule_spec'. Fail
-   * if multiple rules match. If there are no matching
-   * rules, append the `rule_spec' rule.
-   *
-   * Return the id of the updated or new rule.
+   * Load the rules from a full policy bundle. The bundle has to be
+   * signed if a PolicyBundleKeyFile is configured. Delta bundles are
+   * accepted only by reloadConfiguration(), once their base version
+   * is loaded.
    */
-  uint32_t Daemon::upsertRule(const std::string& match_spec,
-                              const std::string& rule_spec,
-                              const bool parent_insensitive)
+  void Daemon::loadPolicyBundle(const String& bundle_path)
   {
-    const Rule match_rule = Rule::fromString(match_spec);
-    const Rule new_rule = Rule::fromString(rule_spec);
-    logger->debug("Upserting rule: match={}, new={}", match_spec, rule_spec);
-    const uint32_t id = _ruleset.upsertRule(match_rule, new_rule, parent_insensitive);
-    if (_config.hasSettingValue("RuleFile")) {
-      _ruleset.save(_config.getSettingValue("RuleFile"));
+    StartupProfile::Scope phase("load-rules");
+    USBGUARD_LOG_DEBUG("Loading the rules from the policy bundle {}", bundle_path);
+
+    if (_config.hasSettingValue("PolicyBundleKeyFile")) {
+      _policy_bundle_key = Hash::readKeyFile(_config.getSettingValue("PolicyBundleKeyFile"));
     }
-    return id;
+
+    auto bundle = makePointer<PolicyBundle>(PolicyBundle::load(bundle_path, _policy_bundle_key));
+
+    if (bundle->getType() != PolicyBundle::Type::Full) {
+      throw std::runtime_error("The policy bundle " + bundle_path + " is a delta bundle, a full bundle is needed on startup");
+    }
+
+    std::vector<RuleSet::Operation> operations;
+
+    for (auto const& rule : bundle->getRules()) {
+      operations.push_back(RuleSet::Operation::append(rule));
+    }
+
+    _ruleset.applyBatch(operations);
+    _policy_bundle = bundle;
+
+    logger->info("Loaded version {} of the policy bundle {} with {} rules",
+                 bundle->getVersion(), bundle_path, operations.size());
+    return;
   }
 
   /*
-   * IPC service methods
+   * Settings which are applied only when the daemon starts. A change
+   * of any of them is reported by reloadConfiguration().
    */
-  uint32_t Daemon::appendRule(const std::string& rule_spec,
-			      uint32_t parent_id,
-			      uint32_t timeout_sec)
+  static const StringVector G_config_startup_names = {
+    "RuleFolder",
+    "PolicyBundleFile",
+    "PolicyBundleKeyFile",
+    "DeviceHashAlgorithm",
+    "DeviceHashKeyFile",
+    "DBusExport",
+    "DBusSignalCoalesceWindow",
+    "LogAsync",
+    "LogQueueSize",
+    "LogOverflowPolicy",
+    "AuditLogFile",
+    "AuditLogRecords",
+    "AuditLogKeep",
+    "MetricsEndpoint",
+    "DeviceCheckpointFile",
+    "RuleStatisticsFile",
+    "RuleStatisticsInterval",
+    "InterfaceAuthorization",
+    "ControllerAuthorizedDefault",
+    "USBTrafficMonitor",
+    "DeviceEventSource",
+    "DeviceEventBufferSize",
+    "DeviceManagerBackend",
+    "VirtualSysfsRoot",
+    "VirtualEventStream",
+    "IPCTransport",
+    "DeviceThreadCPUs",
+    "DeviceThreadScheduling",
+    "BackgroundThreadNice",
+    "RuleConditionModules"
+  };
+
+  static bool configSettingChanged(const ConfigFile& previous, const ConfigFile& current, const String& name)
   {
-    (void)timeout_sec; /* TODO */
-    const Rule rule = Rule::fromString(rule_spec);
-    /* TODO: reevaluate the firewall rules for all active devices */
-    logger->debug("Appending rule: {}", rule_spec);
-    const uint32_t id = _ruleset.appendRule(rule, parent_id);
-    if (_config.hasSettingValue("RuleFile")) {
-      _ruleset.save(_config.getSettingValue("RuleFile"));
+    if (previous.hasSettingValue(name) != current.hasSettingValue(name)) {
+      return true;
     }
-    return id;
+    return current.hasSettingValue(name) &&
+      previous.getSettingValue(name) != current.getSettingValue(name);
   }
 
-  void Daemon::removeRule(uint32_t id)
+  /*
+   * Re-read the configuration file and the rule file and apply only
+   * what changed. Everything is parsed and validated first, so that
+   * an invalid file leaves the running configuration untouched. The
+   * device state is kept: the rule file is diffed against the rule
+   * set and only the devices affected by the changed rules, or by a
+   * changed implicit policy target, are re-evaluated. A setting
+   * missing from the file gets its default value, the same as on a
+   * restart.
+   */
+  void Daemon::reloadConfiguration()
   {
-    logger->debug("Removing rule: id={}", id);
-    _ruleset.removeRule(id);
-    if (_config.hasSettingValue("RuleFile")) {
-      _ruleset.save(_config.getSettingValue("RuleFile"));
+    logger->info("Reloading configuration from {}", _config_path);
+
+    ConfigFile config(G_config_known_names);
+    config.open(_config_path);
+
+    Rule::Target implicit_target = Rule::Target::Block;
+    PresentDevicePolicy present_device_policy = PresentDevicePolicy::Keep;
+    PresentDevicePolicy present_controller_policy = PresentDevicePolicy::Allow;
+    bool device_rules_with_port = false;
+    bool sealed_policy = false;
+    bool ipc_dac_acl = false;
+    DecisionTimeout decision_timeout;
+    std::vector<uid_t> ipc_allowed_uids;
+    std::vector<gid_t> ipc_allowed_gids;
+    StringVector names;
+
+    if (config.hasSettingValue("ImplicitPolicyTarget")) {
+      implicit_target = Rule::targetFromString(config.getSettingValue("ImplicitPolicyTarget"));
     }
+    if (config.hasSettingValue("PresentDevicePolicy")) {
+      present_device_policy = presentDevicePolicyFromString(config.getSettingValue("PresentDevicePolicy"));
+    }
+    if (config.hasSettingValue("PresentControllerPolicy")) {
+      present_controller_policy = presentDevicePolicyFromString(config.getSettingValue("PresentControllerPolicy"));
+    }
+    readDecisionTimeout(config, decision_timeout.timeout, decision_timeout.target, decision_timeout.correct);
+    if (config.hasSettingValue("DeviceRulesWithPort")) {
+      const String value = config.getSettingValue("DeviceRulesWithPort");
+      if (value != "true" && value != "false") {
+        throw std::runtime_error("Invalid DeviceRulesWithPort value.");
+      }
+      device_rules_with_port = (value == "true");
+    }
+    if (config.hasSettingValue("SealedPolicy")) {
+      const String value = config.getSettingValue("SealedPolicy");
+      if (value != "true" && value != "false") {
+        throw std::runtime_error("Invalid SealedPolicy value.");
+      }
+      sealed_policy = (value == "true");
+    }
+    if (config.hasSettingValue("IPCAllowedUsers")) {
+      tokenizeString(config.getSettingValue("IPCAllowedUsers"), names, " ", /*trim_empty=*/true);
+      for (auto const& username : names) {
+        ipc_allowed_uids.push_back(DACLookupUID(username));
+      }
+      ipc_dac_acl = true;
+    }
+    if (config.hasSettingValue("IPCAllowedGroups")) {
+      names.clear();
+      tokenizeString(config.getSettingValue("IPCAllowedGroups"), names, " ", /*trim_empty=*/true);
+      for (auto const& groupname : names) {
+        ipc_allowed_gids.push_back(DACLookupGID(groupname));
+      }
+      ipc_dac_acl = true;
+    }
+
+    const String rule_file = config.hasSettingValue("RuleFile") ? config.getSettingValue("RuleFile") : String();
+    RuleFolder::Contents folder_contents;
+    Pointer<PolicyBundle> policy_bundle;
+    bool policy_bundle_delta = false;
+    std::vector<RuleSet::Operation> operations;
+
+    /*
+     * The rule folder is re-read with the rule files it was created
+     * with. Only the fragments which changed since they were loaded
+     * or stored are parsed.
+     */
+    if (_rule_folder) {
+      try {
+        folder_contents = _rule_folder->read(_ruleset);
+      }
+      catch(const RuleParserError& ex) {
+        throw std::runtime_error("Syntax error in the rule file " + ex.file() + " on line " +
+                                 std::to_string(ex.line()) + ": " + ex.hint());
+      }
+      operations = ruleChanges(folder_contents.rules);
+    }
+    else if (_policy_bundle) {
+      policy_bundle = readPolicyBundleUpdate(policy_bundle_delta);
+      operations = ruleChanges(policy_bundle->getRules());
+    }
+    else {
+      operations = ruleFileChanges(rule_file);
+    }
+
+    /*
+     * Everything is valid, apply the changes.
+     */
+    size_t changed_count = 0;
+
+    for (auto const& name : G_config_known_names) {
+      if (!configSettingChanged(_config, config, name)) {
+        continue;
+      }
+      ++changed_count;
+      if (std::find(G_config_startup_names.cbegin(), G_config_startup_names.cend(), name) != G_config_startup_names.cend() ||
+          ((_rule_folder || _policy_bundle) && (name == "RuleFile" || name == "RuleCacheFile"))) {
+        logger->warn("{} was changed, the new value will be used after a restart of the daemon", name);
+      }
+      else {
+        USBGUARD_LOG_DEBUG("{} was changed", name);
+      }
+    }
+
+    config.close();
+    _config.close();
+    _config.open(_config_path);
+
+    setPresentDevicePolicy(present_device_policy);
+    setPresentControllerPolicy(present_controller_policy);
+    {
+      std::unique_lock<std::mutex> decision_timeout_lock(_decision_timeout_mutex);
+      _decision_timeout = decision_timeout;
+    }
+    _device_rules_with_port = device_rules_with_port;
+    if (sealed_policy != _sealed_policy) {
+      _sealed_policy = sealed_policy;
+      _ruleset.setSealed(sealed_policy);
+    }
+    {
+      std::unique_lock<std::mutex> acl_lock(_ipc_acl_mutex);
+      _ipc_dac_acl = ipc_dac_acl;
+      _ipc_allowed_uids = std::move(ipc_allowed_uids);
+      _ipc_allowed_gids = std::move(ipc_allowed_gids);
+      _ipc_acl_cache.clear();
+    }
+
+    const bool implicit_target_changed = (implicit_target != _implicit_policy_target);
+    setImplicitPolicyTarget(implicit_target);
+
+    if (!operations.empty()) {
+      saveAutomaticSnapshot("reloadConfiguration");
+      applyRuleOperations(operations, /*store=*/false);
+
+      if (!_rule_folder && !_policy_bundle && _config.hasSettingValue("RuleCacheFile")) {
+        try {
+          _ruleset.saveCache(_config.getSettingValue("RuleCacheFile"), rule_file);
+        }
+        catch(const std::exception& ex) {
+          logger->warn("Cannot update the rule cache: {}", ex.what());
+        }
+      }
+    }
+
+    /* The rule set now holds the folder rules in the same order */
+    if (_rule_folder) {
+      std::vector<uint32_t> ids;
+      for (auto const& rule : _ruleset.getRules()) {
+        ids.push_back(rule->getRuleID());
+      }
+      _rule_folder->assign(ids, std::move(folder_contents));
+    }
+
+    if (policy_bundle) {
+      updatePolicyBundle(policy_bundle, policy_bundle_delta);
+    }
+
+    if (implicit_target_changed) {
+      reevaluateDevices({ }, { Rule::DefaultID });
+    }
+
+    logger->info("Configuration reloaded: {} changed settings, {} rule operations",
+                 changed_count, operations.size());
+    return;
+  }
+
+  /*
+   * Read the policy bundle file again. A delta bundle is applied to
+   * the loaded version, a full bundle replaces it. An older version
+   * than the loaded one is refused, so that a signed bundle cannot
+   * be used to roll the policy back.
+   */
+  Pointer<PolicyBundle> Daemon::readPolicyBundleUpdate(bool& delta)
+  {
+    const String& bundle_path = _config.getSettingValue("PolicyBundleFile");
+    const PolicyBundle bundle = PolicyBundle::load(bundle_path, _policy_bundle_key);
+
+    delta = (bundle.getType() == PolicyBundle::Type::Delta);
+
+    if (bundle.getVersion() < _policy_bundle->getVersion()) {
+      throw std::runtime_error("The policy bundle version " + std::to_string(bundle.getVersion()) +
+                               " is older than the loaded version " + std::to_string(_policy_bundle->getVersion()));
+    }
+    if (delta) {
+      return makePointer<PolicyBundle>(bundle.applyTo(*_policy_bundle));
+    }
+    return makePointer<PolicyBundle>(bundle);
+  }
+
+  /*
+   * Make `bundle' the loaded version. The result of a delta bundle
+   * replaces it in the policy bundle file, so that the daemon starts
+   * with the same version.
+   */
+  void Daemon::updatePolicyBundle(const Pointer<PolicyBundle>& bundle, bool delta)
+  {
+    if (delta) {
+      const String& bundle_path = _config.getSettingValue("PolicyBundleFile");
+      try {
+        bundle->save(bundle_path, _policy_bundle_key);
+      }
+      catch(const std::exception& ex) {
+        logger->warn("Cannot store version {} of the policy bundle: {}", bundle->getVersion(), ex.what());
+      }
+    }
+    if (bundle->getVersion() != _policy_bundle->getVersion()) {
+      logger->info("Policy bundle updated from version {} to {}",
+                   _policy_bundle->getVersion(), bundle->getVersion());
+    }
+    _policy_bundle = bundle;
+    return;
+  }
+
+  /*
+   * Compute the rule operations which turn the current rule set
+   * into the rules in `rule_file'. An empty path means no rules.
+   */
+  std::vector<RuleSet::Operation> Daemon::ruleFileChanges(const String& rule_file)
+  {
+    RuleSet file_ruleset(this);
+
+    if (!rule_file.empty()) {
+      try {
+        file_ruleset.load(rule_file);
+      }
+      catch(const RuleParserError& ex) {
+        throw std::runtime_error("Syntax error in the rule file on line " +
+                                 std::to_string(ex.line()) + ": " + ex.hint());
+      }
+    }
+
+    std::vector<Rule> rules;
+
+    for (auto const& rule : file_ruleset.getRules()) {
+      rules.push_back(*rule);
+    }
+
+    return ruleChanges(rules);
+  }
+
+  /*
+   * Compute the rule operations which turn the current rule set
+   * into `file_rules'. The ids and the statistics of the rules
+   * which weren't changed are kept, see RuleSetDiff.
+   */
+  std::vector<RuleSet::Operation> Daemon::ruleChanges(const std::vector<Rule>& file_rules)
+  {
+    const RuleSetDiff diff(_ruleset.getRules(), file_rules);
+    return diff.operations();
+  }
+
+  void Daemon::setImplicitPolicyTarget(Rule::Target target)
+  {
+    _implicit_policy_target = target;
+    _ruleset.setDefaultTarget(target);
+    return;
+  }
+
+  void Daemon::setPresentDevicePolicy(PresentDevicePolicy policy)
+  {
+    _present_device_policy = policy;
+    return;
+  }
+
+  void Daemon::setPresentControllerPolicy(PresentDevicePolicy policy)
+  {
+    _present_controller_policy = policy;
+    return;
+  }
+
+  void Daemon::run()
+  {
+    _loop_thread_id = std::this_thread::get_id();
+    if (!_dm) {
+      /* No configuration was loaded */
+      _dm = DeviceManager::create(*this);
+    }
+    {
+      StartupProfile::Scope phase("start-services");
+      startIPCWorkers();
+      startDBusExport();
+      if (_metrics_endpoint) {
+        _metrics_endpoint->start();
+      }
+      startTrafficMonitor();
+      startRuleStatistics();
+    }
+    _dm->start();
+    qb_loop_run(_qb_loop);
+    /*
+     * Stop the device manager first, so that the write worker
+     * processes all of its queued events before it exits.
+     */
+    _dm->stop();
+    waitForPendingDecisions();
+    stopTrafficMonitor();
+    stopRuleStatistics();
+    if (_metrics_endpoint) {
+      _metrics_endpoint->stop();
+    }
+    stopDBusExport();
+    stopIPCWorkers();
+    releaseReadyWaiters();
+    return;
+  }
+
+  /*
+   * Called from the metrics endpoint thread. The counters are
+   * lock-free, the rule set and the device list are read the same
+   * way as by the read-only IPC methods.
+   */
+  String Daemon::renderMetrics()
+  {
+    Metrics::Gauges gauges;
+    gauges.rules = _ruleset.getRules().size();
+    gauges.devices = _dm->getDeviceList().size();
+
+    const USBTrafficMonitor::Statistics usbmon = USBTrafficMonitor::instance().getStatistics();
+    gauges.usbmon_events = usbmon.events;
+    gauges.usbmon_dropped = usbmon.dropped;
+
+    std::ostringstream stream;
+    Metrics::render(stream, gauges);
+    return stream.str();
+  }
+
+#if defined(HAVE_DBUS)
+  /*
+   * The bus connection is served by a GLib main loop running in
+   * a dedicated thread. Method calls are executed by the IPC
+   * workers, the same way as the IPC method calls, and call the
+   * daemon directly instead of going through the IPC bridge.
+   */
+  struct Daemon::DBusExport
+  {
+    DBusExport(Daemon& daemon, GBusType bus_type_)
+      : service(daemon),
+        bus_type(bus_type_),
+        context(g_main_context_new()),
+        loop(g_main_loop_new(context, FALSE)),
+        owner_id(0)
+    {
+    }
+
+    ~DBusExport()
+    {
+      g_main_loop_unref(loop);
+      g_main_context_unref(context);
+    }
+
+    DBusService service;
+    const GBusType bus_type;
+    GMainContext * const context;
+    GMainLoop * const loop;
+    guint owner_id;
+    std::thread thread;
+  };
+
+  static void dbusExportBusAcquiredFn(GDBusConnection *connection, const gchar *name, gpointer user_data)
+  {
+    DBusService *service = static_cast<DBusService*>(user_data);
+    if (!service->registerObjects(connection)) {
+      logger->error("Unable to register the D-Bus objects");
+    }
+    return;
+  }
+
+  static void dbusExportNameLostFn(GDBusConnection *connection, const gchar *name, gpointer user_data)
+  {
+    logger->warn("Cannot own the {} D-Bus name. Is usbguard-dbus running?", name);
+    return;
+  }
+#endif
+
+  void Daemon::startDBusExport()
+  {
+    if (_dbus_export_bus == "none" || _dbus_export) {
+      return;
+    }
+#if defined(HAVE_DBUS)
+    USBGUARD_LOG_DEBUG("Exporting the D-Bus objects on the {} bus", _dbus_export_bus);
+
+    const GBusType bus_type = \
+      _dbus_export_bus == "session" ? G_BUS_TYPE_SESSION : G_BUS_TYPE_SYSTEM;
+    auto dbus_export = makePointer<DBusExport>(*this, bus_type);
+    DBusExport *const exported = dbus_export.get();
+
+    exported->service.setDispatcher([this](const std::string& method_name, const std::function<void()>& call) {
+      return queueIPCJob(isReadOnlyMethod(method_name) ? _ipc_read_lane : _ipc_write_lane, call);
+    });
+    exported->service.setSignalCoalescing(_dbus_signal_coalesce_window_ms, exported->context);
+
+    exported->thread = std::thread([exported]() {
+      g_main_context_push_thread_default(exported->context);
+      exported->owner_id = g_bus_own_name(exported->bus_type, "org.usbguard",
+                                          G_BUS_NAME_OWNER_FLAGS_NONE,
+                                          dbusExportBusAcquiredFn,
+                                          /*name_acquired_handler=*/nullptr,
+                                          dbusExportNameLostFn,
+                                          &exported->service,
+                                          /*user_data_free_func=*/nullptr);
+      g_main_loop_run(exported->loop);
+      g_bus_unown_name(exported->owner_id);
+      exported->service.unregisterObjects();
+      g_main_context_pop_thread_default(exported->context);
+    });
+
+    _dbus_export = dbus_export;
+#endif
+    return;
+  }
+
+  /*
+   * The export object is kept, so that signals emitted by the
+   * other threads while the daemon shuts down are just dropped.
+   */
+  void Daemon::stopDBusExport()
+  {
+#if defined(HAVE_DBUS)
+    if (_dbus_export && _dbus_export->thread.joinable()) {
+      g_main_loop_quit(_dbus_export->loop);
+      _dbus_export->thread.join();
+    }
+#endif
+    return;
+  }
+
+  void Daemon::quit()
+  {
+    qb_loop_stop(_qb_loop);
+    return;
+  }
+
+  uint32_t Daemon::assignID()
+  {
+    return _ruleset.assignID();
+  }
+
+  /*
+   * Search for a rule that matches `match_spec' rule and
+   * update it with a rule specified by `rule_spec'. Fail
+   * if multiple rules match. If there are no matching
+   * rules, append the `rule_spec' rule.
+   *
+   * Return the id of the updated or new rule.
+   */
+  uint32_t Daemon::upsertRule(const std::string& match_spec,
+                              const std::string& rule_spec,
+                              const bool parent_insensitive)
+  {
+    const Rule match_rule = Rule::fromString(match_spec);
+    const Rule new_rule = Rule::fromString(rule_spec);
+    checkPolicyMutable();
+    USBGUARD_LOG_DEBUG("Upserting rule: match={}, new={}", match_spec, rule_spec);
+    saveAutomaticSnapshot("upsertRule");
+    const uint32_t id = _ruleset.upsertRule(match_rule, new_rule, parent_insensitive);
+    storeRules({ id });
+    ruleChanged(id);
+    reevaluateDevices({ new_rule }, { id });
+    return id;
+  }
+
+  /*
+   * IPC service methods
+   */
+  uint32_t Daemon::appendRule(const std::string& rule_spec,
+			      uint32_t parent_id,
+			      uint32_t timeout_sec)
+  {
+    checkPolicyMutable();
+    Rule rule = Rule::fromString(rule_spec);
+    rule.setTimeoutSeconds(timeout_sec);
+    USBGUARD_LOG_DEBUG("Appending rule: {}", rule_spec);
+    saveAutomaticSnapshot("appendRule");
+    const uint32_t id = _ruleset.appendRule(rule, parent_id);
+    scheduleRuleExpiration(id, timeout_sec);
+    storeRules({ id });
+    ruleChanged(id);
+    reevaluateDevices({ rule }, { });
+    return id;
+  }
+
+  void Daemon::removeRule(uint32_t id)
+  {
+    checkPolicyMutable();
+    USBGUARD_LOG_DEBUG("Removing rule: id={}", id);
+    saveAutomaticSnapshot("removeRule");
+    _ruleset.removeRule(id);
+    cancelRuleExpiration(id);
+    storeRules({ id });
+    ruleChanged(id);
+    reevaluateDevices({ }, { id });
+    return;
+  }
+
+  const RuleSet Daemon::listRules()
+  {
+    return _ruleset;
+  }
+
+  const std::vector<Rule> Daemon::listRules(const RuleFilter& filter)
+  {
+    std::vector<Rule> rules;
+
+    for (auto const& rule : selectRules(filter)) {
+      if (filter.limit != 0 && rules.size() >= filter.limit) {
+        break;
+      }
+      rules.push_back(*rule);
+    }
+
+    return rules;
+  }
+
+  /*
+   * With a device rule, only the candidates from the match index
+   * of the rule set are filtered, instead of all the rules.
+   */
+  PointerVector<const Rule> Daemon::selectRules(const RuleFilter& filter)
+  {
+    bool with_target = false;
+    Rule::Target target = Rule::Target::Invalid;
+
+    if (!filter.target.empty()) {
+      try {
+        target = Rule::targetFromString(filter.target);
+        with_target = true;
+      }
+      catch(const std::exception&) {
+        throw IPCException(IPCException::InvalidArgument, "Invalid rule target: " + filter.target);
+      }
+    }
+
+    const PointerVector<const Rule> candidates = filter.device.empty() ? \
+      _ruleset.getRules() : _ruleset.getApplyingRules(Rule::fromString(filter.device));
+
+    PointerVector<const Rule> rules;
+    uint32_t skipped = 0;
+
+    for (auto const& rule : candidates) {
+      const uint32_t id = rule->getRuleID();
+
+      if ((with_target && rule->getTarget() != target) ||
+          id < filter.first_id ||
+          (filter.last_id != 0 && id > filter.last_id)) {
+        continue;
+      }
+      if (skipped < filter.offset) {
+        ++skipped;
+        continue;
+      }
+      rules.push_back(rule);
+    }
+
+    return rules;
+  }
+
+  const std::vector<uint32_t> Daemon::applyRuleBatch(const std::vector<RuleSet::Operation>& operations)
+  {
+    checkPolicyMutable();
+    saveAutomaticSnapshot("applyRuleBatch");
+    return applyRuleOperations(operations, /*store=*/true);
+  }
+
+  /*
+   * A sealed policy is changed only by editing the rule file and
+   * reloading the daemon. The rule set itself can be modified (and
+   * its sealed index rebuilt), so the loaded rules are still kept
+   * in sync with the file by reloadConfiguration().
+   */
+  void Daemon::checkPolicyMutable() const
+  {
+    if (_sealed_policy) {
+      throw IPCException(IPCException::PermissionDenied, "The policy is sealed");
+    }
+    return;
+  }
+
+  /*
+   * Saving a snapshot only takes a reference to the current
+   * rules, so one is saved before each IPC modification. The
+   * oldest ones are dropped by the rule set.
+   */
+  void Daemon::saveAutomaticSnapshot(const std::string& method)
+  {
+    _ruleset.saveSnapshot("before " + method);
+    return;
+  }
+
+  uint32_t Daemon::saveRuleSetSnapshot(const std::string& name)
+  {
+    USBGUARD_LOG_DEBUG("Saving a rule set snapshot: {}", name);
+    return _ruleset.saveSnapshot(name);
+  }
+
+  const std::vector<RuleSet::SnapshotInfo> Daemon::listRuleSetSnapshots()
+  {
+    return _ruleset.listSnapshots();
+  }
+
+  /*
+   * The restored rules are published as they were saved. Only
+   * the devices matched by the rules which differ between the
+   * two versions are re-evaluated, the same as after a batch
+   * of rule operations. A restored temporary rule gets its full
+   * timeout again.
+   */
+  void Daemon::rollbackRuleSet(uint32_t version)
+  {
+    checkPolicyMutable();
+    USBGUARD_LOG_DEBUG("Rolling back the rule set to version {}", version);
+
+    RuleSet::Changes changes;
+
+    if (!_ruleset.rollback(version, changes, "before rollbackRuleSet")) {
+      throw IPCException(IPCException::NotFound, "No such rule set snapshot");
+    }
+
+    std::set<uint32_t> changed_ids(changes.removed_ids.cbegin(), changes.removed_ids.cend());
+
+    for (auto const& rule : changes.rules) {
+      changed_ids.insert(rule.getRuleID());
+    }
+    storeRules(changed_ids);
+
+    for (const uint32_t id : changes.removed_ids) {
+      cancelRuleExpiration(id);
+      ruleChanged(id);
+    }
+    for (auto const& rule : changes.rules) {
+      updateDeviceRuleExpiration(rule.getRuleID(), rule.getTimeoutSeconds());
+      ruleChanged(rule.getRuleID());
+    }
+
+    reevaluateDevices(changes.rules,
+      std::set<uint32_t>(changes.removed_ids.cbegin(), changes.removed_ids.cend()));
+    return;
+  }
+  /*
+   * Switching a group doesn't modify the rules, so neither the
+   * rule file nor the snapshots are written. The devices matched
+   * by the rules of the group, or those the rules apply to, are
+   * re-evaluated.
+   */
+  void Daemon::setRuleGroupEnabled(const std::string& group, bool enabled)
+  {
+    checkPolicyMutable();
+
+    bool changed = false;
+
+    try {
+      changed = _ruleset.setGroupEnabled(group, enabled);
+    }
+    catch(const std::exception& ex) {
+      throw IPCException(IPCException::InvalidArgument, ex.what());
+    }
+
+    if (!changed) {
+      return;
+    }
+
+    logger->info("Rule group {} {}", group, enabled ? "enabled" : "disabled");
+
+    std::vector<Rule> group_rules;
+    std::set<uint32_t> group_ids;
+
+    for (auto const& rule : _ruleset.getRules()) {
+      if (rule->getGroup() == group) {
+        group_rules.push_back(*rule);
+        group_ids.insert(rule->getRuleID());
+      }
+    }
+
+    reevaluateDevices(group_rules, group_ids);
+    return;
+  }
+
+
+  /*
+   * The device rule is the same one the device is matched with
+   * when it's inserted. The interfaces of a device authorized per
+   * interface aren't traced individually.
+   */
+  const std::vector<RuleSet::MatchTraceStep> Daemon::explainDevice(uint32_t id)
+  {
+    USBGUARD_LOG_DEBUG("Explaining the rule match of device {}", id);
+    Pointer<Device> device = _dm->getDevice(id);
+    const bool with_hash = dmHookDeviceHashRequired();
+    Pointer<const Rule> device_rule = \
+      device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/with_hash, with_hash);
+
+    return _ruleset.explainMatch(device_rule);
+  }
+
+  /*
+   * The candidates are built from the device rule the device is
+   * matched with and are matched against the device rules of all
+   * the other present devices in one pass over the device list.
+   */
+  const std::vector<Interface::RuleSuggestion> Daemon::suggestRules(uint32_t id)
+  {
+    USBGUARD_LOG_DEBUG("Suggesting rules for device {}", id);
+    Pointer<Device> device = _dm->getDevice(id);
+    Pointer<const Rule> device_rule = \
+      device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/true, /*with_hash=*/true);
+
+    Rule port_rule;
+    port_rule.setTarget(Rule::Target::Allow);
+    port_rule.attributeHash() = device_rule->attributeHash();
+    port_rule.attributeParentHash() = device_rule->attributeParentHash();
+    port_rule.attributeViaPort() = device_rule->attributeViaPort();
+
+    Rule hash_rule;
+    hash_rule.setTarget(Rule::Target::Allow);
+    hash_rule.attributeHash() = device_rule->attributeHash();
+
+    Rule serial_rule;
+    serial_rule.setTarget(Rule::Target::Allow);
+    serial_rule.attributeDeviceID() = device_rule->attributeDeviceID();
+    serial_rule.attributeSerial() = device_rule->attributeSerial();
+    serial_rule.attributeWithInterface() = device_rule->attributeWithInterface();
+
+    Rule id_rule;
+    id_rule.setTarget(Rule::Target::Allow);
+    id_rule.attributeDeviceID() = device_rule->attributeDeviceID();
+    id_rule.attributeWithInterface() = device_rule->attributeWithInterface();
+
+    std::vector<RuleSuggestion> suggestions = {
+      { "port", port_rule.toString(), 0 },
+      { "hash", hash_rule.toString(), 0 },
+      { "id-serial", serial_rule.toString(), 0 },
+      { "id", id_rule.toString(), 0 }
+    };
+    const Rule * const candidates[] = { &port_rule, &hash_rule, &serial_rule, &id_rule };
+
+    for (const auto& other_device : _dm->getDeviceList()) {
+      if (other_device->getID() == id) {
+        continue;
+      }
+
+      Pointer<const Rule> other_rule;
+
+      try {
+        other_rule = \
+          other_device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/true, /*with_hash=*/true);
+      }
+      catch(const std::exception& ex) {
+        USBGUARD_LOG_DEBUG("Device {}: cannot generate the device rule: {}", other_device->getID(), ex.what());
+        continue;
+      }
+
+      for (size_t i = 0; i < suggestions.size(); ++i) {
+        if (candidates[i]->appliesTo(other_rule)) {
+          ++suggestions[i].matching_devices;
+        }
+      }
+    }
+
+    return suggestions;
+  }
+
+  /*
+   * The candidate rules are matched against the same device rules
+   * the daemon uses when a device is inserted. The present device
+   * policies and the partial interface authorization aren't part
+   * of the simulation.
+   */
+  const std::vector<PolicySimulator::Decision> Daemon::simulatePolicy(const std::string& rules)
+  {
+    USBGUARD_LOG_DEBUG("Simulating a policy of {} bytes", rules.size());
+    Pointer<PolicySimulator> simulator;
+
+    try {
+      simulator = makePointer<PolicySimulator>(rules, _implicit_policy_target.load(), this);
+    }
+    catch(const RuleParserError& ex) {
+      throw IPCException(IPCException::InvalidArgument,
+                         "Syntax error in the rules on line " + std::to_string(ex.line()) + ": " + ex.hint());
+    }
+
+    const bool with_hash = dmHookDeviceHashRequired();
+    std::vector<PolicySimulator::Device> devices;
+
+    for (const auto& device : _dm->getDeviceList()) {
+      PolicySimulator::Device simulated_device;
+
+      try {
+        simulated_device.device_rule = \
+          device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/with_hash, with_hash);
+      }
+      catch(const std::exception& ex) {
+        USBGUARD_LOG_DEBUG("Device {}: cannot generate the device rule: {}", device->getID(), ex.what());
+        continue;
+      }
+      simulated_device.target = device->getTarget();
+      simulated_device.rule_id = Rule::DefaultID;
+      {
+        std::unique_lock<std::mutex> lock(_device_matches_mutex);
+        auto it = _device_matches.find(device->getID());
+        if (it != _device_matches.end()) {
+          simulated_device.rule_id = it->second;
+        }
+      }
+      devices.push_back(std::move(simulated_device));
+    }
+
+    return simulator->evaluate(devices);
+  }
+
+  /*
+   * With a rule folder only the fragments of the changed rules
+   * are rewritten, otherwise the whole rule set is saved to the
+   * rule file.
+   */
+  void Daemon::storeRules(const std::set<uint32_t>& ids)
+  {
+    if (_rule_folder) {
+      _rule_folder->store(_ruleset, ids);
+    }
+    else if (_policy_bundle) {
+      USBGUARD_LOG_DEBUG("The rules come from a policy bundle, the changes aren't stored");
+    }
+    else if (_config.hasSettingValue("RuleFile")) {
+      _ruleset.save(_config.getSettingValue("RuleFile"));
+    }
+    return;
+  }
+
+  /*
+   * Apply all the operations as a single transaction and
+   * store the resulting ruleset only once. The ruleset isn't
+   * stored if `store' is false, e.g. when the operations were
+   * computed from the rule file itself.
+   */
+  const std::vector<uint32_t> Daemon::applyRuleOperations(const std::vector<RuleSet::Operation>& operations, bool store)
+  {
+    USBGUARD_LOG_DEBUG("Applying a batch of {} rule operations", operations.size());
+    const std::vector<uint32_t> ids = _ruleset.applyBatch(operations);
+    if (store) {
+      storeRules(std::set<uint32_t>(ids.cbegin(), ids.cend()));
+    }
+
+    std::vector<Rule> changed_rules;
+    std::set<uint32_t> changed_ids;
+
+    for (size_t i = 0; i < operations.size(); ++i) {
+      const RuleSet::Operation& operation = operations[i];
+      switch(operation.type) {
+      case RuleSet::Operation::Type::Append:
+        changed_rules.push_back(operation.rule);
+        ruleChanged(ids[i]);
+        break;
+      case RuleSet::Operation::Type::Remove:
+        changed_ids.insert(operation.id);
+        cancelRuleExpiration(operation.id);
+        ruleChanged(operation.id);
+        break;
+      case RuleSet::Operation::Type::Upsert:
+        changed_rules.push_back(operation.rule);
+        changed_ids.insert(ids[i]);
+        ruleChanged(ids[i]);
+        break;
+      }
+    }
+
+    reevaluateDevices(changed_rules, changed_ids);
+    return ids;
+  }
+
+  /*
+   * The counters are read without taking any rule set lock.
+   */
+  const std::vector<Rule::Statistics> Daemon::getRuleStatistics()
+  {
+    std::vector<Rule::Statistics> statistics;
+
+    for (auto const& rule : _ruleset.getRules()) {
+      statistics.push_back(rule->getStatistics());
+    }
+
+    return statistics;
+  }
+
+  /*
+   * The histograms are process-wide and lock-free, see LatencyStatistics.
+   */
+  const std::vector<LatencyStatistics> Daemon::getLatencyStatistics()
+  {
+    return LatencyStatistics::get();
+  }
+
+  /*
+   * Everything is read without blocking the device or IPC
+   * processing: the counters are lock-free and the queues are
+   * only locked to read their length.
+   */
+  const MetricsSnapshot Daemon::getMetricsSnapshot(uint32_t top_rules)
+  {
+    MetricsSnapshot snapshot;
+
+    snapshot.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(\
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    Metrics::read(snapshot);
+    snapshot.latency = LatencyStatistics::get();
+
+    for (auto const& rule : _ruleset.getRules()) {
+      snapshot.hottest_rules.push_back(rule->getStatistics());
+    }
+    snapshot.gauges["rules"] = snapshot.hottest_rules.size();
+
+    const size_t top_count = std::min(snapshot.hottest_rules.size(), static_cast<size_t>(top_rules));
+    std::partial_sort(snapshot.hottest_rules.begin(), snapshot.hottest_rules.begin() + top_count,
+                      snapshot.hottest_rules.end(),
+                      [](const Rule::Statistics& a, const Rule::Statistics& b) {
+                        return a.applied > b.applied;
+                      });
+    snapshot.hottest_rules.resize(top_count);
+
+    snapshot.gauges["devices"] = _dm->getDeviceList().size();
+    snapshot.gauges["device_event_queue"] = _device_events.count();
+    {
+      std::unique_lock<std::mutex> lock(_ipc_read_lane.mutex);
+      snapshot.gauges["ipc_read_queue"] = _ipc_read_lane.jobs.size();
+    }
+    {
+      std::unique_lock<std::mutex> lock(_ipc_write_lane.mutex);
+      snapshot.gauges["ipc_write_queue"] = _ipc_write_lane.jobs.size();
+    }
+    {
+      std::unique_lock<std::mutex> lock(_ipc_output_mutex);
+      snapshot.gauges["ipc_output_queue"] = _ipc_output.size();
+    }
+
+    return snapshot;
+  }
+
+  /*
+   * The estimates are computed on each call by walking the rules
+   * and devices, which is cheap compared to the IPC round trip.
+   */
+  const Interface::MemoryStats Daemon::getMemoryStats()
+  {
+    MemoryStats stats;
+    stats.rss = 0;
+
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size_pages = 0;
+    uint64_t rss_pages = 0;
+    if (statm >> size_pages >> rss_pages) {
+      stats.rss = rss_pages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    uint64_t rules_bytes = 0;
+    for (auto const& rule : _ruleset.getRules()) {
+      rules_bytes += rule->getMemoryUsage();
+    }
+    stats.bytes["rules"] = rules_bytes;
+
+    uint64_t devices_bytes = 0;
+    for (auto const& device : _dm->getDeviceList()) {
+      devices_bytes += device->getMemoryUsage();
+    }
+    stats.bytes["devices"] = devices_bytes;
+    stats.bytes["descriptors"] = DescriptorCache::instance().memoryUsage();
+    stats.bytes["strings"] = StringPool::instance().memoryUsage();
+    stats.bytes["device_events"] = _device_events.capacity() * sizeof(DeviceEvent);
+
+    uint64_t ipc_bytes = _ipc_buffer_bytes;
+    {
+      std::unique_lock<std::mutex> lock(_ipc_output_mutex);
+      for (auto const& output : _ipc_output) {
+        ipc_bytes += sizeof(IPCOutput) + output.data.capacity();
+      }
+    }
+    stats.bytes["ipc_buffers"] = ipc_bytes;
+    stats.bytes["log_queue"] = Logger::getQueueMemoryUsage();
+
+    return stats;
+  }
+
+  const StartupProfile Daemon::getStartupProfile()
+  {
+    return StartupProfile::get();
+  }
+
+  void Daemon::allowDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    USBGUARD_LOG_DEBUG("Allowing device: {}", id);
+    if (permanent) {
+      checkPolicyMutable();
+    }
+    const DecisionTime started = std::chrono::steady_clock::now();
+    Pointer<const Rule> rule;
+    /*
+     * An explicit decision overrides the rule set evaluation. The device
+     * is tracked again only if a permanent device rule was created.
+     */
+    forgetDeviceMatch(id);
+    if (permanent) {
+      rule = upsertDeviceRule(id, Rule::Target::Allow, timeout_sec);
+    }
+    else {
+      rule = makePointer<Rule>();
+    }
+    allowDevice(id, rule, AuditLog::Event::Policy, started);
+    if (permanent) {
+      recordDeviceMatch(id, rule->getRuleID());
+    }
+    return;
+  }
+
+  void Daemon::blockDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    USBGUARD_LOG_DEBUG("Blocking device: {}", id);
+    if (permanent) {
+      checkPolicyMutable();
+    }
+    const DecisionTime started = std::chrono::steady_clock::now();
+    Pointer<const Rule> rule;
+    forgetDeviceMatch(id);
+    if (permanent) {
+      rule = upsertDeviceRule(id, Rule::Target::Block, timeout_sec);
+    }
+    else {
+      rule = makePointer<Rule>();
+    }
+    blockDevice(id, rule, AuditLog::Event::Policy, started);
+    if (permanent) {
+      recordDeviceMatch(id, rule->getRuleID());
+    }
+    return;
+  }
+
+  void Daemon::rejectDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    USBGUARD_LOG_DEBUG("Rejecting device: {}", id);
+    if (permanent) {
+      checkPolicyMutable();
+    }
+    const DecisionTime started = std::chrono::steady_clock::now();
+    Pointer<const Rule> rule;
+    forgetDeviceMatch(id);
+    if (permanent) {
+      rule = upsertDeviceRule(id, Rule::Target::Reject, timeout_sec);
+    }
+    else {
+      rule = makePointer<Rule>();
+    }
+    rejectDevice(id, rule, AuditLog::Event::Policy, started);
+    if (permanent) {
+      recordDeviceMatch(id, rule->getRuleID());
+    }
+    return;
+  }
+
+  void Daemon::applyDevicePolicy(const std::vector<DeviceTarget>& targets, bool permanent, uint32_t timeout_sec)
+  {
+    USBGUARD_LOG_DEBUG("Applying the target of {} devices", targets.size());
+    if (permanent) {
+      checkPolicyMutable();
+    }
+    const DecisionTime started = std::chrono::steady_clock::now();
+
+    /*
+     * Build the device rules first, so that an unknown device
+     * or an invalid target fails the call before any change.
+     */
+    std::vector<RuleSet::Operation> operations;
+    for (auto const& device_target : targets) {
+      if (permanent) {
+        operations.push_back(deviceRuleUpsert(device_target.id, device_target.target));
+      }
+      else if (device_target.target != Rule::Target::Allow &&
+               device_target.target != Rule::Target::Block &&
+               device_target.target != Rule::Target::Reject) {
+        throw std::runtime_error("applyDevicePolicy: invalid device target");
+      }
+    }
+
+    for (auto const& device_target : targets) {
+      forgetDeviceMatch(device_target.id);
+    }
+
+    std::vector<uint32_t> rule_ids;
+    if (permanent) {
+      rule_ids = applyRuleBatch(operations);
+      for (const uint32_t rule_id : rule_ids) {
+        updateDeviceRuleExpiration(rule_id, timeout_sec);
+      }
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i) {
+      const uint32_t id = targets[i].id;
+      Pointer<const Rule> rule;
+      if (permanent) {
+        rule = _ruleset.getRule(rule_ids[i]);
+      }
+      else {
+        rule = makePointer<Rule>();
+      }
+      switch(targets[i].target) {
+        case Rule::Target::Allow:
+          allowDevice(id, rule, AuditLog::Event::Policy, started);
+          break;
+        case Rule::Target::Block:
+          blockDevice(id, rule, AuditLog::Event::Policy, started);
+          break;
+        default:
+          rejectDevice(id, rule, AuditLog::Event::Policy, started);
+      }
+      if (permanent) {
+        recordDeviceMatch(id, rule->getRuleID());
+      }
+    }
+    return;
+  }
+
+  void Daemon::DeviceInserted(uint32_t id,
+			      const std::map<std::string,std::string>& attributes,
+			      const std::vector<USBInterfaceType>& interfaces,
+			      bool rule_match,
+			      uint32_t rule_id)
+  {
+    signalDeviceInserted(nullptr, id, attributes, interfaces, rule_match, rule_id);
+    return;
+  }
+
+  void Daemon::DevicePresent(uint32_t id,
+			     const std::map<std::string,std::string>& attributes,
+			     const std::vector<USBInterfaceType>& interfaces,
+			     Rule::Target target)
+  {
+    signalDevicePresent(nullptr, id, attributes, interfaces, target);
+    return;
+  }
+
+  void Daemon::DeviceRemoved(uint32_t id,
+			     const std::map<std::string,std::string>& attributes)
+  {
+    signalDeviceRemoved(nullptr, id, attributes);
+    return;
+  }
+
+  void Daemon::DeviceAllowed(uint32_t id,
+			     const std::map<std::string,std::string>& attributes,
+			     bool rule_match,
+			     uint32_t rule_id)
+  {
+    signalDeviceAllowed(nullptr, id, attributes, rule_match, rule_id);
+    return;
+  }
+
+  void Daemon::DeviceBlocked(uint32_t id,
+			     const std::map<std::string,std::string>& attributes,
+			     bool rule_match,
+			     uint32_t rule_id)
+  {
+    signalDeviceBlocked(nullptr, id, attributes, rule_match, rule_id);
+    return;
+  }
+
+  void Daemon::DeviceRejected(uint32_t id,
+			      const std::map<std::string,std::string>& attributes,
+			      bool rule_match,
+			      uint32_t rule_id)
+  {
+    signalDeviceRejected(nullptr, id, attributes, rule_match, rule_id);
+    return;
+  }
+
+  void Daemon::RuleChanged(uint32_t id,
+                           bool removed,
+                           const std::string& rule_spec,
+                           uint64_t generation)
+  {
+    USBGUARD_LOG_DEBUG("RuleChanged: id={}, removed={}", id, removed);
+
+    const json j = {
+      {         "_s", "RuleChanged" },
+      {         "id", id },
+      {    "removed", removed },
+      {       "rule", rule_spec },
+      { "generation", generation }
+    };
+
+    qbIPCBroadcastJSON(j);
+    return;
+  }
+
+  void Daemon::signalDeviceInserted(const Pointer<const Rule>& device_rule,
+                                    uint32_t id,
+                                    const std::map<std::string,std::string>& attributes,
+                                    const std::vector<USBInterfaceType>& interfaces,
+                                    bool rule_match,
+                                    uint32_t rule_id)
+  {
+    USBGUARD_LOG_DEBUG("DeviceInserted: id={}, rule_match={}, rule_id={}",
+		  id, rule_match, rule_id);
+
+    json interfaces_json;
+    for (auto const& type : interfaces) {
+      interfaces_json.push_back(type.typeString());
+    }
+
+    const json j = {
+      {         "_s", "DeviceInserted" },
+      {       "id", id },
+      { "attributes", attributes },
+      { "interfaces", interfaces_json },
+      { "rule_match", rule_match },
+      {  "rule_id", rule_id }
+    };
+
+    recordStateChange(/*device=*/true, id);
+    qbIPCBroadcastJSON(j, device_rule);
+#if defined(HAVE_DBUS)
+    if (_dbus_export) {
+      _dbus_export->service.DeviceInserted(id, attributes, interfaces, rule_match, rule_id);
+    }
+#endif
+    return;
+  }
+
+  void Daemon::signalDevicePresent(const Pointer<const Rule>& device_rule,
+                                   uint32_t id,
+                                   const std::map<std::string,std::string>& attributes,
+                                   const std::vector<USBInterfaceType>& interfaces,
+                                   Rule::Target target)
+  {
+    USBGUARD_LOG_DEBUG("DevicePresent: id={}, target={}", id, Rule::targetToString(target));
+
+    json interfaces_json;
+    for (auto const& type : interfaces) {
+      interfaces_json.push_back(type.typeString());
+    }
+
+    const json j = {
+      {         "_s", "DevicePresent" },
+      {       "id", id },
+      { "attributes", attributes },
+      { "interfaces", interfaces_json },
+      {     "target", Rule::targetToString(target) },
+    };
+
+    recordStateChange(/*device=*/true, id);
+    qbIPCBroadcastJSON(j, device_rule);
+#if defined(HAVE_DBUS)
+    if (_dbus_export) {
+      _dbus_export->service.DevicePresent(id, attributes, interfaces, target);
+    }
+#endif
+    return;
+  }
+
+  void Daemon::signalDeviceRemoved(const Pointer<const Rule>& device_rule,
+                                   uint32_t id,
+                                   const std::map<std::string,std::string>& attributes)
+
+  {
+    USBGUARD_LOG_DEBUG("DeviceRemoved: id={}", id);
+
+    const json j = {
+      {         "_s", "DeviceRemoved" },
+                                   {       "id", id },
+                                   { "attributes", attributes }
+    };
+
+    recordStateChange(/*device=*/true, id);
+    qbIPCBroadcastJSON(j, device_rule);
+#if defined(HAVE_DBUS)
+    if (_dbus_export) {
+      _dbus_export->service.DeviceRemoved(id, attributes);
+    }
+#endif
+    return;
+  }
+
+  void Daemon::signalDevicesRemoved(const json& devices_json)
+  {
+    USBGUARD_LOG_DEBUG("DevicesRemoved: count={}", devices_json.size());
+
+    const json j = {
+      {      "_s", "DevicesRemoved" },
+      { "devices", devices_json }
+    };
+
+    qbIPCBroadcastJSON(j, nullptr);
+    return;
+  }
+
+  void Daemon::signalDevicesPresent(const json& devices_json)
+  {
+    USBGUARD_LOG_DEBUG("DevicesPresent: count={}", devices_json.size());
+
+    const json j = {
+      {      "_s", "DevicesPresent" },
+      { "devices", devices_json }
+    };
+
+    qbIPCBroadcastJSON(j, nullptr);
+    return;
+  }
+
+  void Daemon::signalDeviceAllowed(const Pointer<const Rule>& device_rule,
+                                   uint32_t id,
+                                   const std::map<std::string,std::string>& attributes,
+                                   bool rule_match,
+                                   uint32_t rule_id)
+  {
+    USBGUARD_LOG_DEBUG("DeviceAllowed: id={}, rule_match={}, rule_id={}",
+		  id, rule_match, rule_id);
+
+    const json j = {
+      {         "_s", "DeviceAllowed" },
+      {       "id", id },
+      { "attributes", attributes },
+      { "rule_match", rule_match },
+      {  "rule_id", rule_id }
+    };
+
+    recordStateChange(/*device=*/true, id);
+    qbIPCBroadcastJSON(j, device_rule);
+#if defined(HAVE_DBUS)
+    if (_dbus_export) {
+      _dbus_export->service.DeviceAllowed(id, attributes, rule_match, rule_id);
+    }
+#endif
+    return;
+  }
+
+  void Daemon::signalDeviceBlocked(const Pointer<const Rule>& device_rule,
+                                   uint32_t id,
+                                   const std::map<std::string,std::string>& attributes,
+                                   bool rule_match,
+                                   uint32_t rule_id)
+  {
+    USBGUARD_LOG_DEBUG("DeviceBlocked: id={}, rule_match={}, rule_id={}",
+		  id, rule_match, rule_id);
+
+    const json j = {
+      {         "_s", "DeviceBlocked" },
+      {       "id", id },
+      { "attributes", attributes },
+      { "rule_match", rule_match },
+      {  "rule_id", rule_id }
+    };
+
+    recordStateChange(/*device=*/true, id);
+    qbIPCBroadcastJSON(j, device_rule);
+#if defined(HAVE_DBUS)
+    if (_dbus_export) {
+      _dbus_export->service.DeviceBlocked(id, attributes, rule_match, rule_id);
+    }
+#endif
+    return;
+  }
+
+  void Daemon::signalDeviceRejected(const Pointer<const Rule>& device_rule,
+                                    uint32_t id,
+                                    const std::map<std::string,std::string>& attributes,
+                                    bool rule_match,
+                                    uint32_t rule_id)
+  {
+    USBGUARD_LOG_DEBUG("DeviceRejected: id={}, rule_match={}, rule_id={}",
+		  id, rule_match, rule_id);
+
+    const json j = {
+      {         "_s", "DeviceRejected" },
+      {       "id", id },
+      { "attributes", attributes },
+      { "rule_match", rule_match },
+      {  "rule_id", rule_id }
+    };
+
+    recordStateChange(/*device=*/true, id);
+    qbIPCBroadcastJSON(j, device_rule);
+#if defined(HAVE_DBUS)
+    if (_dbus_export) {
+      _dbus_export->service.DeviceRejected(id, attributes, rule_match, rule_id);
+    }
+#endif
+    return;
+  }
+
+  void Daemon::dmHookDeviceInserted(Pointer<Device> device)
+  {
+    queueDeviceEvent(DeviceEvent::Type::Inserted, device);
+    return;
+  }
+
+  void Daemon::dmHookDevicePresent(Pointer<Device> device)
+  {
+    queueDeviceEvent(DeviceEvent::Type::Present, device);
+    return;
+  }
+
+  void Daemon::dmHookDevicesPresent(const PointerVector<Device>& devices)
+  {
+    queueDeviceEvent(DeviceEvent::Type::PresentBatch, nullptr, devices);
+    return;
+  }
+
+  void Daemon::dmHookDeviceRemoved(Pointer<Device> device)
+  {
+    queueDeviceEvent(DeviceEvent::Type::Removed, device);
+    return;
+  }
+
+  void Daemon::dmHookDevicesRemoved(const PointerVector<Device>& devices)
+  {
+    queueDeviceEvent(DeviceEvent::Type::RemovedBatch, nullptr, devices);
+    return;
+  }
+
+  /*
+   * Called from the device manager threads. The event is passed to
+   * the write worker, or processed right away if the workers aren't
+   * running. The device manager isn't running without the workers,
+   * except for an explicit scan.
+   */
+  void Daemon::queueDeviceEvent(DeviceEvent::Type type, Pointer<Device> device, PointerVector<Device> devices)
+  {
+    DeviceEvent event;
+    event.type = type;
+    event.device = std::move(device);
+    event.devices = std::move(devices);
+    queueDeviceEvent(std::move(event));
+    return;
+  }
+
+  void Daemon::queueDeviceEvent(DeviceEvent&& local_event)
+  {
+    local_event.queued = std::chrono::steady_clock::now();
+    {
+      std::unique_lock<std::mutex> lock(_ipc_write_lane.mutex);
+      if (!_ipc_write_lane.running) {
+        lock.unlock();
+        processDeviceEvent(local_event);
+        return;
+      }
+    }
+
+    DeviceEvent *event = nullptr;
+
+    while ((event = _device_events.acquire()) == nullptr) {
+      /* The queue is full, wait for the write worker */
+      std::this_thread::yield();
+    }
+
+    new (event) DeviceEvent(std::move(local_event));
+
+    /* Events acquired by other producers earlier are enqueued first */
+    while (!_device_events.enqueue(event)) {
+      std::this_thread::yield();
+    }
+
+    /*
+     * Take the lane mutex, so that the wakeup can't get lost between
+     * the worker's check of the queue and its wait.
+     */
+    {
+      std::unique_lock<std::mutex> lock(_ipc_write_lane.mutex);
+    }
+    _ipc_write_lane.cv.notify_one();
+    return;
+  }
+
+  /*
+   * Called from the write worker. Processes all of the queued
+   * device events.
+   */
+  void Daemon::processDeviceEvents()
+  {
+    const DeviceEvent *queued_event = nullptr;
+
+    while ((queued_event = _device_events.dequeue()) != nullptr) {
+      DeviceEvent *event = const_cast<DeviceEvent*>(queued_event);
+      const DeviceEvent local_event = std::move(*event);
+
+      event->~DeviceEvent();
+      _device_events.release(event);
+
+      LatencyStatistics::record(LatencyStatistics::Stage::EventQueue,
+                                std::chrono::steady_clock::now() - local_event.queued);
+      try {
+        LatencyStatistics::Timer timer(LatencyStatistics::Stage::EventProcess);
+        processDeviceEvent(local_event);
+      }
+      catch(const std::exception& ex) {
+        logger->error("Device event: Exception: {}", ex.what());
+      }
+    }
+    return;
+  }
+
+  void Daemon::processDeviceEvent(const DeviceEvent& event)
+  {
+    /* One time for the matching and the rule metadata updates */
+    const EvaluationClock::Scope clock_scope;
+
+    switch(event.type) {
+    case DeviceEvent::Type::Inserted:
+      processDeviceInserted(event.device, event.queued);
+      scheduleConditionChanges();
+      break;
+    case DeviceEvent::Type::Present:
+      processDevicePresent(event.device, event.queued);
+      scheduleConditionChanges();
+      break;
+    case DeviceEvent::Type::Removed:
+      processDeviceRemoved(event.device);
+      break;
+    case DeviceEvent::Type::RemovedBatch:
+      processDevicesRemoved(event.devices);
+      break;
+    case DeviceEvent::Type::PresentBatch:
+      StartupProfile::recordPhase("present-devices-queue", event.queued, std::chrono::steady_clock::now());
+      processDevicesPresent(event.devices, event.queued);
+      scheduleConditionChanges();
+      markReady();
+      break;
+    case DeviceEvent::Type::Decided:
+      processDeviceDecided(event);
+      break;
+    }
+    return;
+  }
+
+  void Daemon::processDeviceInserted(Pointer<Device> device, DecisionTime started)
+  {
+    Metrics::increment(Metrics::Counter::DevicesInserted);
+    /*
+     * Since we search for a matching rule later, we have to generate a port
+     * specific rule here.
+     */
+    const bool with_hash = dmHookDeviceHashRequired();
+    Pointer<const Rule> device_rule = \
+      device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/with_hash, with_hash);
+    std::vector<USBInterfaceType> allowed_interfaces;
+    /*
+     * A device already authorized by the kernel because of the
+     * ControllerAuthorizedDefault setting needs no decision.
+     */
+    const bool authorized_by_default = (device->getTarget() == Rule::Target::Allow &&
+      _dm->getAuthorizedDefault(*device) != DeviceManager::AuthorizedDefault::None);
+    Pointer<Rule> matched_rule = nullptr;
+    const DecisionTimeout decision_timeout = decisionTimeout();
+
+    if (authorized_by_default) {
+      USBGUARD_LOG_DEBUG("Device {} authorized by the default of its controller", device_rule->getRuleID());
+      matched_rule = makePointer<Rule>();
+      matched_rule->setTarget(Rule::Target::Allow);
+    }
+    else {
+      matched_rule = matchDeviceWithDeadline(device, device_rule, allowed_interfaces, started, decision_timeout);
+    }
+
+    const bool timed_out = (matched_rule == nullptr);
+
+    if (timed_out) {
+      logger->warn("Device {}: the evaluation exceeded DecisionTimeout, applying the {} target",
+                   device_rule->getRuleID(), Rule::targetToString(decision_timeout.target));
+      Metrics::increment(Metrics::Counter::DecisionTimeouts);
+      auto fallback_rule = makePointer<Rule>();
+      fallback_rule->setTarget(decision_timeout.target);
+      matched_rule = fallback_rule;
+    }
+
+    std::map<std::string,std::string> attributes;
+    
+    attributes["name"] = device_rule->getName();
+    attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
+    attributes["product_id"] = device_rule->getDeviceID().getProductID();
+    attributes["serial"] = device_rule->getSerial();
+    attributes["hash"] = device_rule->getHash();
+
+    signalDeviceInserted(device_rule,
+                         device_rule->getRuleID(),
+                         attributes,
+                         device_rule->attributeWithInterface().values(),
+                         matched_rule->isImplicit() ? false : true,
+                         matched_rule->getRuleID());
+
+    if (authorized_by_default) {
+      signalDeviceTarget(device, Rule::Target::Allow, matched_rule, AuditLog::Event::Insert, started);
+      return;
+    }
+
+    switch(matched_rule->getTarget()) {
+    case Rule::Target::Allow:
+      allowDevice(device_rule->getRuleID(), matched_rule, AuditLog::Event::Insert, started, allowed_interfaces);
+      break;
+    case Rule::Target::Block:
+      blockDevice(device_rule->getRuleID(), matched_rule, AuditLog::Event::Insert, started);
+      break;
+    case Rule::Target::Reject:
+      rejectDevice(device_rule->getRuleID(), matched_rule, AuditLog::Event::Insert, started);
+      break;
+    default:
+      throw std::runtime_error("BUG: Wrong matched_rule target");
+    }
+
+    if (timed_out) {
+      return;
+    }
+
+    matched_rule->updateMetaDataCounters(/*applied=*/true);
+    recordDeviceMatch(device_rule->getRuleID(), matched_rule->getRuleID());
+
+    return;
+  }
+
+  /*
+   * The evaluation of an inserted device exceeded DecisionTimeout
+   * and has finished since. Its result replaces the fallback target,
+   * unless the device is gone or its target was changed meanwhile.
+   */
+  void Daemon::processDeviceDecided(const DeviceEvent& event)
+  {
+    const uint32_t id = event.device->getID();
+    Pointer<Device> device;
+
+    try {
+      device = _dm->getDevice(id);
+    }
+    catch(const std::out_of_range&) {
+      USBGUARD_LOG_DEBUG("Device {}: removed before its evaluation finished", id);
+      return;
+    }
+
+    if (device != event.device || device->getTarget() != event.timeout_target) {
+      USBGUARD_LOG_DEBUG("Device {}: the target was changed before the evaluation finished", id);
+      return;
+    }
+
+    const Pointer<Rule>& matched_rule = event.matched_rule;
+    const Rule::Target target = matched_rule->getTarget();
+
+    if (target != event.timeout_target || !event.allowed_interfaces.empty()) {
+      logger->info("Device {}: correcting the {} target applied after DecisionTimeout to {}",
+                   id, Rule::targetToString(event.timeout_target), Rule::targetToString(target));
+
+      switch(target) {
+      case Rule::Target::Allow:
+        allowDevice(id, matched_rule, AuditLog::Event::Insert, event.started, event.allowed_interfaces);
+        break;
+      case Rule::Target::Block:
+        blockDevice(id, matched_rule, AuditLog::Event::Insert, event.started);
+        break;
+      case Rule::Target::Reject:
+        rejectDevice(id, matched_rule, AuditLog::Event::Insert, event.started);
+        break;
+      default:
+        throw std::runtime_error("BUG: Wrong matched_rule target");
+      }
+    }
+
+    matched_rule->updateMetaDataCounters(/*applied=*/true);
+    recordDeviceMatch(id, matched_rule->getRuleID());
+    return;
+  }
+
+  void Daemon::processDevicePresent(Pointer<Device> device, DecisionTime started)
+  {
+    processDevicesPresent(PointerVector<Device>({ device }), started);
+    return;
+  }
+
+  /*
+   * The devices found at startup are processed in three steps: the
+   * device rules are generated and matched for all the devices, the
+   * targets are applied in one batch and then the devices are
+   * signalled. Every device gets its own DevicePresent signal, for
+   * the clients that don't know about batches, and the whole batch is
+   * signalled once more with DevicesPresent.
+   */
+  void Daemon::processDevicesPresent(const PointerVector<Device>& devices, DecisionTime started)
+  {
+    struct Decision
+    {
+      Pointer<const Rule> device_rule;
+      Pointer<Rule> matched_rule;
+      PresentDevicePolicy policy;
+      std::vector<USBInterfaceType> allowed_interfaces;
+      std::exception_ptr error;
+    };
+
+    StartupProfile::Scope phase("present-devices-policy");
+    std::vector<Decision> decisions(devices.size());
+    const bool with_hash = dmHookDeviceHashRequired();
+
+    auto decide = [this, &devices, &decisions, with_hash](size_t i) {
+      Decision& decision = decisions[i];
+      const Pointer<Device>& device = devices[i];
+      const auto decision_started = std::chrono::steady_clock::now();
+
+      try {
+        /*
+         * Since we search for a matching rule later, we have to generate a port
+         * specific rule here.
+         */
+        decision.device_rule = \
+          device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/with_hash, with_hash);
+        decision.policy = \
+          device->isController() ? _present_controller_policy : _present_device_policy;
+
+        Rule::Target target = Rule::Target::Invalid;
+
+        switch (decision.policy) {
+        case PresentDevicePolicy::Allow:
+          target = Rule::Target::Allow;
+          break;
+        case PresentDevicePolicy::Block:
+          target = Rule::Target::Block;
+          break;
+        case PresentDevicePolicy::Reject:
+          target = Rule::Target::Reject;
+          break;
+        case PresentDevicePolicy::Keep:
+          target = device->getTarget();
+          break;
+        case PresentDevicePolicy::ApplyPolicy:
+          decision.matched_rule = matchDevice(decision.device_rule, decision.allowed_interfaces);
+          target = decision.matched_rule->getTarget();
+          break;
+        }
+
+        if (decision.matched_rule == nullptr) {
+          auto rule = makePointer<Rule>();
+          rule->setTarget(target);
+          decision.matched_rule = rule;
+        }
+
+        switch(target) {
+        case Rule::Target::Allow:
+        case Rule::Target::Block:
+        case Rule::Target::Reject:
+          break;
+        default:
+          throw std::runtime_error("BUG: Wrong matched_rule target");
+        }
+      }
+      catch(...) {
+        decision.error = std::current_exception();
+      }
+
+      StartupProfile::recordDeviceDecision(device->getID(), std::chrono::steady_clock::now() - decision_started);
+    };
+
+    /*
+     * Generating the device rules (and the deferred hashes) is done
+     * concurrently. The matching itself is serialized by the rule set.
+     */
+    if (devices.size() < G_present_parallel_min_devices) {
+      for (size_t i = 0; i < devices.size(); ++i) {
+        decide(i);
+      }
+    }
+    else {
+      ThreadPool::shared().parallelFor(devices.size(), decide);
+    }
+
+    /*
+     * Partial authorizations are applied individually, the batch
+     * applies targets to whole devices.
+     */
+    std::vector<std::pair<uint32_t, Rule::Target>> targets;
+    std::vector<size_t> target_decisions;
+
+    for (size_t i = 0; i < decisions.size(); ++i) {
+      Decision& decision = decisions[i];
+      Metrics::increment(Metrics::Counter::DevicesPresent);
+
+      if (decision.error) {
+        try {
+          std::rethrow_exception(decision.error);
+        }
+        catch(const std::exception& ex) {
+          logger->error("Device event: Exception: {}", ex.what());
+        }
+        continue;
+      }
+
+      if (!decision.allowed_interfaces.empty()) {
+        allowDevice(decision.device_rule->getRuleID(), decision.matched_rule,
+                    AuditLog::Event::Present, started, decision.allowed_interfaces);
+        continue;
+      }
+
+      targets.emplace_back(decision.device_rule->getRuleID(), decision.matched_rule->getTarget());
+      target_decisions.push_back(i);
+    }
+
+    const auto apply_started = std::chrono::steady_clock::now();
+    const auto results = _dm->applyDeviceTargets(targets);
+    StartupProfile::recordPhase("apply-present-targets", apply_started, std::chrono::steady_clock::now());
+
+    for (size_t i = 0; i < results.size(); ++i) {
+      const auto& result = results[i];
+      Decision& decision = decisions[target_decisions[i]];
+
+      if (!result.device) {
+        logger->warn("Cannot apply target {} to device {}: {}",
+                     Rule::targetToString(result.target), result.id, result.error);
+        decision.error = std::make_exception_ptr(std::runtime_error(result.error));
+        continue;
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(_device_matches_mutex);
+        _partially_allowed_devices.erase(result.id);
+      }
+      signalDeviceTarget(result.device, result.target, decision.matched_rule,
+                         AuditLog::Event::Present, started);
+    }
+
+    json devices_json = json::array();
+
+    for (auto& decision : decisions) {
+      if (decision.error) {
+        continue;
+      }
+
+      const Pointer<const Rule>& device_rule = decision.device_rule;
+      const Rule::Target target = decision.matched_rule->getTarget();
+      std::map<std::string,std::string> attributes;
+
+      attributes["name"] = device_rule->getName();
+      attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
+      attributes["product_id"] = device_rule->getDeviceID().getProductID();
+      attributes["serial"] = device_rule->getSerial();
+      attributes["hash"] = device_rule->getHash();
+
+      decision.matched_rule->updateMetaDataCounters(/*applied=*/true);
+
+      if (decision.policy == PresentDevicePolicy::ApplyPolicy) {
+        recordDeviceMatch(device_rule->getRuleID(), decision.matched_rule->getRuleID());
+      }
+
+      signalDevicePresent(device_rule,
+                          device_rule->getRuleID(),
+                          attributes,
+                          device_rule->attributeWithInterface().values(),
+                          target);
+
+      json interfaces_json = json::array();
+      for (auto const& type : device_rule->attributeWithInterface().values()) {
+        interfaces_json.push_back(type.typeString());
+      }
+      devices_json.push_back({
+        { "id", device_rule->getRuleID() },
+        { "attributes", attributes },
+        { "interfaces", interfaces_json },
+        { "target", Rule::targetToString(target) }
+      });
+    }
+
+    if (!devices_json.empty()) {
+      signalDevicesPresent(devices_json);
+    }
+    return;
+  }
+
+  void Daemon::processDeviceRemoved(Pointer<Device> device)
+  {
+    processDevicesRemoved(PointerVector<Device>({ device }));
+    return;
+  }
+
+  /*
+   * Every device gets its own DeviceRemoved signal, for the clients
+   * that don't know about batches. The whole batch is signalled once
+   * more with DevicesRemoved.
+   */
+  void Daemon::processDevicesRemoved(const PointerVector<Device>& devices)
+  {
+    const bool with_hash = dmHookDeviceHashRequired();
+    json devices_json = json::array();
+
+    for (auto const& device : devices) {
+      Metrics::increment(Metrics::Counter::DevicesRemoved);
+      /* We don't care about ports here, use the default */
+      Pointer<const Rule> device_rule = \
+        device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/with_hash, with_hash);
+
+      std::map<std::string,std::string> attributes;
+
+      attributes["name"] = device_rule->getName();
+      attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
+      attributes["product_id"] = device_rule->getDeviceID().getProductID();
+      attributes["serial"] = device_rule->getSerial();
+      attributes["hash"] = device_rule->getHash();
+
+      forgetDeviceMatch(device_rule->getRuleID());
+      signalDeviceRemoved(device_rule, device_rule->getRuleID(), attributes);
+      devices_json.push_back({
+        { "id", device_rule->getRuleID() },
+        { "attributes", attributes }
+      });
+    }
+
+    signalDevicesRemoved(devices_json);
+    return;
+  }
+
+  void Daemon::dmHookDeviceAllowed(Pointer<Device> device)
+  {
+    return;
+  }
+
+  void Daemon::dmHookDeviceBlocked(Pointer<Device> device)
+  {
+    return;
+  }
+
+  void Daemon::dmHookDeviceRejected(Pointer<Device> device)
+  {
+    return;
+  }
+
+  /*
+   * Called from the device manager's sysfs I/O thread. The failure
+   * itself is logged by the device manager.
+   */
+  void Daemon::dmHookDeviceTargetApplied(uint32_t id, Rule::Target target, int error)
+  {
+    if (error != 0) {
+      Metrics::increment(Metrics::Counter::SysfsWriteFailures);
+    }
+    return;
+  }
+
+  uint32_t Daemon::dmHookAssignID()
+  {
+    return assignID();
+  }
+
+  void Daemon::dmHookThreadStarted()
+  {
+    if (!_device_thread_scheduling.empty() && !_device_thread_scheduling.apply()) {
+      logger->warn("Cannot apply the scheduling settings to a device manager thread: {}", strerror(errno));
+    }
+    return;
+  }
+
+  /*
+   * The device hash is needed on the insertion path only if a rule
+   * matches on the hash or the parent hash, or if it's reported to
+   * someone: an IPC or D-Bus client or the audit log. Otherwise it's
+   * computed when it's first accessed, e.g. by listDevices.
+   */
+  bool Daemon::dmHookDeviceHashRequired()
+  {
+    if (_audit_log || _ipc_connections > 0) {
+      return true;
+    }
+#if defined(HAVE_DBUS)
+    if (_dbus_export) {
+      return true;
+    }
+#endif
+    return _ruleset.usesDeviceHash();
+  }
+
+  int32_t Daemon::qbSignalHandlerFn(int32_t signal, void *arg)
+  {
+    qb_loop_t *qb_loop = (qb_loop_t *)arg;
+    USBGUARD_LOG_DEBUG("Stopping main loop from signal handler");
+    qb_loop_stop(qb_loop);
+
+    if (signal == SIGSYS) {
+      logger->warn("Stopped due to SIGSYS: A system call was used which is not whitelisted.");
+    }
+
+    return QB_FALSE;
+  }
+
+  /*
+   * The reload modifies the rule set, so it's serialized with
+   * the IPC calls doing the same. A failed reload leaves the
+   * running configuration untouched.
+   */
+  int32_t Daemon::qbReloadSignalFn(int32_t signal, void *arg)
+  {
+    Daemon *daemon = static_cast<Daemon*>(arg);
+    auto reload = [daemon]() {
+      try {
+        daemon->reloadConfiguration();
+      }
+      catch(const std::exception& ex) {
+        logger->error("Cannot reload the configuration: {}", ex.what());
+      }
+    };
+
+    (void)signal;
+
+    if (!daemon->queueIPCJob(daemon->_ipc_write_lane, reload, /*bounded=*/false)) {
+      reload();
+    }
+
+    return QB_TRUE;
+  }
+
+  void Daemon::qbRuleTimerFn(void *arg)
+  {
+    Daemon *daemon = static_cast<Daemon*>(arg);
+    daemon->_rule_timer_armed = false;
+    /*
+     * Expiring rules modifies the rule set, so it has to be
+     * serialized with the IPC calls doing the same.
+     */
+    if (!daemon->queueIPCJob(daemon->_ipc_write_lane, [daemon]() { daemon->expireRules(); },
+                             /*bounded=*/false)) {
+      daemon->expireRules();
+    }
+    return;
+  }
+
+  void Daemon::qbTrafficTimerFn(void *arg)
+  {
+    Daemon *daemon = static_cast<Daemon*>(arg);
+    daemon->_traffic_timer_armed = false;
+    /*
+     * Re-evaluation applies targets, so it's serialized with the
+     * rule set modifications the same way as rule expiration.
+     */
+    if (!daemon->queueIPCJob(daemon->_ipc_write_lane, [daemon]() { daemon->reevaluateTrafficRules(); },
+                             /*bounded=*/false)) {
+      daemon->reevaluateTrafficRules();
+    }
+    daemon->armTrafficTimer();
+    return;
+  }
+
+  /*
+   * Only the counters are read here, the records are hashed
+   * and written by the thread of the statistics file.
+   */
+  void Daemon::qbRuleStatisticsTimerFn(void *arg)
+  {
+    Daemon *daemon = static_cast<Daemon*>(arg);
+    daemon->_rule_statistics_timer_armed = false;
+    daemon->_rule_statistics->checkpoint(daemon->_ruleset.getRules());
+    daemon->armRuleStatisticsTimer();
+    return;
+  }
+
+  void Daemon::qbConditionTimerFn(void *arg)
+  {
+    Daemon *daemon = static_cast<Daemon*>(arg);
+    daemon->_condition_timer_armed = false;
+
+    if (!daemon->queueIPCJob(daemon->_ipc_write_lane, [daemon]() { daemon->reevaluateTimedRules(); },
+                             /*bounded=*/false)) {
+      daemon->reevaluateTimedRules();
+    }
+    return;
+  }
+
+  int32_t Daemon::qbIPCConnectionAcceptFn(qb_ipcs_connection_t *conn, uid_t uid, gid_t gid)
+  {
+    Daemon* daemon = \
+      static_cast<Daemon*>(qb_ipcs_connection_service_context_get(conn));
+
+    const bool auth = daemon->qbIPCConnectionAllowed(uid, gid);
+
+    if (auth) {
+      USBGUARD_LOG_DEBUG("IPC Connection accepted. "
+		    "Setting SHM permissions to uid={} gid={} mode=0660", uid, 0);
+      qb_ipcs_connection_auth_set(conn, uid, 0, 0660);
+      return 0;
+    }
+    else {
+      USBGUARD_LOG_DEBUG("IPC Connection rejected");
+      return -1;
+    }
+  }
+
+  /*
+   * The group membership checks go through NSS, which may have to
+   * ask a directory service. The decisions are therefore cached for
+   * G_ipc_acl_cache_ttl. The cache is dropped whenever the ACL is
+   * changed. Decisions made while a lookup failed aren't cached.
+   */
+  bool Daemon::qbIPCConnectionAllowed(uid_t uid, gid_t gid)
+  {
+    std::unique_lock<std::mutex> acl_lock(_ipc_acl_mutex);
+
+    if (_ipc_dac_acl) {
+      USBGUARD_LOG_DEBUG("Using DAC IPC ACL");
+      USBGUARD_LOG_DEBUG("Connection request from uid={} gid={}", uid, gid);
+
+      const auto now = std::chrono::steady_clock::now();
+      const auto key = std::make_pair(uid, gid);
+      auto const it = _ipc_acl_cache.find(key);
+
+      if (it != _ipc_acl_cache.end()) {
+        if (now < it->second.expires) {
+          USBGUARD_LOG_DEBUG("Using the cached IPC ACL decision");
+          return it->second.allowed;
+        }
+        _ipc_acl_cache.erase(it);
+      }
+
+      bool cacheable = true;
+      const bool allowed = DACAuthenticateIPCConnection(uid, gid, cacheable);
+
+      if (cacheable) {
+        if (_ipc_acl_cache.size() >= G_ipc_acl_cache_size_max) {
+          _ipc_acl_cache.clear();
+        }
+        _ipc_acl_cache[key] = IPCACLCacheEntry { allowed, now + G_ipc_acl_cache_ttl };
+      }
+
+      return allowed;
+    }
+    else {
+      USBGUARD_LOG_DEBUG("IPC authentication is turned off.");
+      return true;
+    }
+  }
+
+  Daemon::PresentDevicePolicy Daemon::presentDevicePolicyFromString(const String& policy_string)
+  {
+    const std::vector<std::pair<String,Daemon::PresentDevicePolicy> > policy_ttable = {
+      { "allow", PresentDevicePolicy::Allow },
+      { "block", PresentDevicePolicy::Block },
+      { "reject", PresentDevicePolicy::Reject },
+      { "keep", PresentDevicePolicy::Keep },
+      { "apply-policy", PresentDevicePolicy::ApplyPolicy }
+    };
+
+    for (auto ttable_entry : policy_ttable) {
+      if (ttable_entry.first == policy_string) {
+	return ttable_entry.second;
+      }
+    }
+
+    throw std::runtime_error("Invalid present device policy string");
+  }
+
+  void Daemon::qbIPCConnectionCreatedFn(qb_ipcs_connection_t *conn)
+  {
+    USBGUARD_LOG_DEBUG("Connection created");
+    Metrics::increment(Metrics::Counter::IPCConnectionsOpened);
+    Daemon* daemon = \
+      static_cast<Daemon*>(qb_ipcs_connection_service_context_get(conn));
+    ++daemon->_ipc_connections;
+    IPCConnectionState *state = new IPCConnectionState();
+    state->format = IPCPrivate::WireFormat::JSON;
+    state->pending_size = 0;
+    state->lagging = false;
+    state->outstanding = 0;
+    state->read_tokens = G_ipc_read_burst;
+    state->read_tokens_updated = std::chrono::steady_clock::now();
+    qb_ipcs_context_set(conn, state);
+  }
+
+  void Daemon::qbIPCConnectionDestroyedFn(qb_ipcs_connection_t *conn)
+  {
+    USBGUARD_LOG_DEBUG("Connection destroyed");
+    Metrics::increment(Metrics::Counter::IPCConnectionsClosed);
+    Daemon* daemon = \
+      static_cast<Daemon*>(qb_ipcs_connection_service_context_get(conn));
+    --daemon->_ipc_connections;
+    IPCConnectionState *state = qbIPCConnectionState(conn);
+    if (state != nullptr) {
+      daemon->_ipc_buffer_bytes -= state->pending_size + state->send_buffer.capacity();
+    }
+    delete state;
+    qb_ipcs_context_set(conn, nullptr);
+  }
+
+  int32_t Daemon::qbIPCConnectionClosedFn(qb_ipcs_connection_t *conn)
+  {
+    USBGUARD_LOG_DEBUG("Connection closed");
+    return 0;
+  }
+
+  json Daemon::processJSON(const json& jobj, const std::function<void(const json&)>& emit)
+  {
+    USBGUARD_LOG_DEBUG("Processing JSON object: {}", jobj.dump());
+
+    if (jobj.count("_m")) {
+      return processMethodCallJSON(jobj, emit);
+    }
+    else {
+      throw IPCException(IPCException::ProtocolError, "Invalid message");
+    }
+    return json();
+  }
+
+  /*
+   * Builds the "retval" array of a listRules or listDevices reply.
+   *
+   * The optional "cursor" and "limit" request values select a page:
+   * at most limit items (all if 0) following the item identified by
+   * the cursor (from the start if 0). The "cursor" value of the reply
+   * identifies the last item of the page if more items follow and
+   * is 0 otherwise.
+   *
+   * If the request sets "stream" and the caller can emit messages
+   * before the reply, the items are sent in chunks, each in a reply
+   * message marked with "_c". The final reply carries the rest.
+   */
+  class IPCListReply
+  {
+  public:
+    IPCListReply(json& reply, const std::string& name, const json& request,
+                 const std::function<void(const json&)>& emit)
+      : _reply(reply),
+        _name(name),
+        _id(request.at("_i").get<uint64_t>()),
+        _cursor(request.value("cursor", uint32_t(0))),
+        _limit(request.value("limit", uint32_t(0))),
+        _count(0),
+        _items(json::array())
+    {
+      if (request.value("stream", false)) {
+        _emit = emit;
+      }
+    }
+
+    uint32_t cursor() const
+    {
+      return _cursor;
+    }
+
+    bool full() const
+    {
+      return _limit != 0 && _count >= _limit;
+    }
+
+    void push(json item)
+    {
+      _items.push_back(std::move(item));
+      ++_count;
+
+      if (_emit && _items.size() >= G_ipc_stream_chunk_size) {
+        const json chunk = {
+          { "_i", _id },
+          { "_r", _name },
+          { "_c", true },
+          { "retval", std::move(_items) }
+        };
+        _emit(chunk);
+        _items = json::array();
+      }
+      return;
+    }
+
+    void finish(uint32_t next_cursor)
+    {
+      _reply["retval"] = std::move(_items);
+      _reply["cursor"] = next_cursor;
+      return;
+    }
+
+  private:
+    json& _reply;
+    const std::string _name;
+    const uint64_t _id;
+    const uint32_t _cursor;
+    const uint32_t _limit;
+    uint32_t _count;
+    json _items;
+    std::function<void(const json&)> _emit;
+  };
+
+  static json ruleStatisticsToJSON(const std::vector<Rule::Statistics>& statistics)
+  {
+    json statistics_json = json::array();
+    for (auto const& rule_statistics : statistics) {
+      json rule_statistics_json = {
+        { "id", rule_statistics.rule_id },
+        { "evaluated", rule_statistics.evaluated },
+        { "applied", rule_statistics.applied },
+        { "last_evaluated", rule_statistics.last_evaluated },
+        { "last_applied", rule_statistics.last_applied },
+        { "match_time_histogram", rule_statistics.match_time_histogram }
+      };
+      statistics_json.push_back(rule_statistics_json);
+    }
+    return statistics_json;
+  }
+
+  static json latencyStatisticsToJSON(const std::vector<LatencyStatistics>& statistics)
+  {
+    json statistics_json = json::array();
+    for (auto const& stage_statistics : statistics) {
+      json stage_statistics_json = {
+        { "stage", static_cast<uint32_t>(stage_statistics.stage) },
+        { "count", stage_statistics.count },
+        { "total_ns", stage_statistics.total_ns },
+        { "max_ns", stage_statistics.max_ns },
+        { "histogram", stage_statistics.histogram },
+        { "allocations", stage_statistics.allocations },
+        { "allocated_bytes", stage_statistics.allocated_bytes }
+      };
+      statistics_json.push_back(stage_statistics_json);
+    }
+    return statistics_json;
+  }
+
+  json Daemon::processMethodCallJSON(const json& jobj, const std::function<void(const json&)>& emit)
+  {
+    USBGUARD_LOG_DEBUG("Processing method call");
+
+    json retval = {
+      { "_i", jobj.at("_i").get<uint64_t>() }
+    };
+
+    try {
+      const std::string name = jobj.at("_m").get<std::string>();
+      Metrics::IPCRequestTimer request_timer(name);
+
+      USBGUARD_LOG_DEBUG("Method name = {}", name);
+
+      if (name == "appendRule") {
+        uint32_t val = appendRule(jobj["rule_spec"], jobj["parent_id"], jobj["timeout_sec"]);
+        retval["retval"] = val;
+      }
+      else if (name == "removeRule") {
+        removeRule(jobj["id"]);
+      }
+      else if (name == "listRules") {
+        IPCListReply reply(retval, name, jobj, emit);
+        /* The limit is applied by the reply, after the cursor */
+        RuleFilter filter;
+        filter.target = jobj.value("target", std::string());
+        filter.device = jobj.value("device", std::string());
+        filter.first_id = jobj.value("first_id", uint32_t(0));
+        filter.last_id = jobj.value("last_id", uint32_t(0));
+        filter.offset = jobj.value("offset", uint32_t(0));
+        const auto rules = selectRules(filter);
+        auto it = rules.cbegin();
+        if (reply.cursor() != 0) {
+          it = std::find_if(rules.cbegin(), rules.cend(), [&reply](const Pointer<const Rule>& rule) {
+            return rule->getRuleID() == reply.cursor();
+          });
+          if (it == rules.cend()) {
+            throw IPCException(IPCException::NotFound, "Unknown rule list cursor");
+          }
+          ++it;
+        }
+        uint32_t last_id = 0;
+        for (; it != rules.cend() && !reply.full(); ++it) {
+          json rule_json = {
+            { "id", (*it)->getRuleID() },
+            { "rule", (*it)->toString() }
+          };
+          reply.push(std::move(rule_json));
+          last_id = (*it)->getRuleID();
+        }
+        reply.finish(it != rules.cend() ? last_id : 0);
+      }
+      else if (name == "getRuleStatistics") {
+        retval["retval"] = ruleStatisticsToJSON(getRuleStatistics());
+      }
+      else if (name == "getLatencyStatistics") {
+        retval["retval"] = latencyStatisticsToJSON(getLatencyStatistics());
+      }
+      else if (name == "getMetricsSnapshot") {
+        const MetricsSnapshot snapshot = getMetricsSnapshot(jobj.at("top_rules"));
+        retval["retval"] = {
+          { "time_ms", snapshot.time_ms },
+          { "counters", snapshot.counters },
+          { "gauges", snapshot.gauges },
+          { "ipc_requests", snapshot.ipc_requests },
+          { "latency", latencyStatisticsToJSON(snapshot.latency) },
+          { "hottest_rules", ruleStatisticsToJSON(snapshot.hottest_rules) }
+        };
+      }
+      else if (name == "getMemoryStats") {
+        const MemoryStats stats = getMemoryStats();
+        retval["retval"] = {
+          { "rss", stats.rss },
+          { "bytes", stats.bytes }
+        };
+      }
+      else if (name == "getStartupProfile") {
+        const StartupProfile profile = getStartupProfile();
+        json phases_json = json::array();
+        json devices_json = json::array();
+
+        for (auto const& phase : profile.phases) {
+          phases_json.push_back({
+            { "name", phase.name },
+            { "start_ns", phase.start_ns },
+            { "duration_ns", phase.duration_ns }
+          });
+        }
+        for (auto const& device : profile.devices) {
+          devices_json.push_back({
+            { "id", device.id },
+            { "load_ns", device.load_ns },
+            { "decision_ns", device.decision_ns }
+          });
+        }
+        retval["retval"] = {
+          { "ready_ns", profile.ready_ns },
+          { "phases", phases_json },
+          { "devices", devices_json }
+        };
+      }
+      else if (name == "applyRuleBatch") {
+        const json& operations_json = jobj.at("operations");
+        std::vector<RuleSet::Operation> operations;
+        /* Parse the whole batch into one block; see RuleArena */
+        RuleArena arena(2 * operations_json.size());
+        for (auto const& operation_json : operations_json) {
+          const std::string type = operation_json.at("type");
+          if (type == "append") {
+            operations.push_back(RuleSet::Operation::append(Rule::fromString(operation_json.at("rule_spec"), arena),
+                                                            operation_json.at("parent_id")));
+          }
+          else if (type == "remove") {
+            operations.push_back(RuleSet::Operation::remove(operation_json.at("id")));
+          }
+          else if (type == "upsert") {
+            operations.push_back(RuleSet::Operation::upsert(Rule::fromString(operation_json.at("match_spec"), arena),
+                                                            Rule::fromString(operation_json.at("rule_spec"), arena),
+                                                            operation_json.at("parent_insensitive")));
+          }
+          else {
+            throw IPCException(IPCException::InvalidArgument, "Unknown rule operation type");
+          }
+        }
+        json ids_json = json::array();
+        for (auto id : applyRuleBatch(operations)) {
+          ids_json.push_back(id);
+        }
+        retval["retval"] = ids_json;
+      }
+      else if (name == "allowDevice") {
+        allowDevice(jobj["id"], jobj["permanent"], jobj["timeout_sec"]);
+      }
+      else if (name == "blockDevice") {
+        blockDevice(jobj["id"], jobj["permanent"], jobj["timeout_sec"]);
+      }
+      else if (name == "rejectDevice") {
+        rejectDevice(jobj["id"], jobj["permanent"], jobj["timeout_sec"]);
+      }
+      else if (name == "applyDevicePolicy") {
+        std::vector<DeviceTarget> targets;
+        for (auto const& device_json : jobj.at("devices")) {
+          targets.push_back({ device_json.at("id").get<uint32_t>(),
+                              Rule::targetFromString(device_json.at("target")) });
+        }
+        applyDevicePolicy(targets, jobj.at("permanent"), jobj.at("timeout_sec"));
+      }
+      else if (name == "listDevices") {
+        IPCListReply reply(retval, name, jobj, emit);
+        std::vector<Rule> device_rules = listDevices(jobj["query"]);
+        /* Device pages are ordered by id, the cursor is the last id seen */
+        std::sort(device_rules.begin(), device_rules.end(), [](const Rule& a, const Rule& b) {
+          return a.getRuleID() < b.getRuleID();
+        });
+        auto it = std::upper_bound(device_rules.cbegin(), device_rules.cend(), reply.cursor(),
+                                   [](uint32_t cursor, const Rule& rule) {
+          return cursor < rule.getRuleID();
+        });
+        uint32_t last_id = 0;
+        for (; it != device_rules.cend() && !reply.full(); ++it) {
+          json device_json = {
+            { "id", it->getRuleID() },
+            { "device", it->toString() }
+          };
+          reply.push(std::move(device_json));
+          last_id = it->getRuleID();
+        }
+        reply.finish(it != device_rules.cend() ? last_id : 0);
+      }
+      else if (name == "listDeviceSubtree") {
+        /* Not paged, the devices are kept in topology order */
+        json devices_json = json::array();
+        for (auto const& device_rule : listDeviceSubtree(jobj.at("id"), jobj.at("query"))) {
+          devices_json.push_back({
+            { "id", device_rule.getRuleID() },
+            { "device", device_rule.toString() }
+          });
+        }
+        retval["retval"] = devices_json;
+      }
+      else if (name == "listDeviceFields") {
+        /* Not paged, the devices are kept in topology order */
+        json devices_json = json::array();
+        for (auto const& device : listDeviceFields(jobj.at("id"), jobj.at("query"),
+                                                   jobj.at("fields").get<std::vector<std::string>>())) {
+          devices_json.push_back({
+            { "id", device.id },
+            { "parent_id", device.parent_id },
+            { "values", device.values }
+          });
+        }
+        retval["retval"] = devices_json;
+      }
+      else if (name == "getChangesSince") {
+        const StateChanges changes = getChangesSince(jobj.at("generation").get<uint64_t>());
+        json devices_json = json::array();
+        for (auto const& change : changes.devices) {
+          json change_json = {
+            { "id", change.id },
+            { "removed", change.removed }
+          };
+          if (!change.removed) {
+            change_json["device"] = change.rule.toString();
+          }
+          devices_json.push_back(change_json);
+        }
+        json rules_json = json::array();
+        for (auto const& change : changes.rules) {
+          json change_json = {
+            { "id", change.id },
+            { "removed", change.removed }
+          };
+          if (!change.removed) {
+            change_json["rule"] = change.rule.toString();
+          }
+          rules_json.push_back(change_json);
+        }
+        retval["retval"] = {
+          { "generation", changes.generation },
+          { "complete", changes.complete },
+          { "devices", devices_json },
+          { "rules", rules_json }
+        };
+      }
+      else if (name == "dumpDevices") {
+        retval["retval"] = base64Encode(dumpDevices());
+      }
+      else if (name == "reloadConfiguration") {
+        reloadConfiguration();
+      }
+      else if (name == "saveRuleSetSnapshot") {
+        retval["retval"] = saveRuleSetSnapshot(jobj.at("name"));
+      }
+      else if (name == "listRuleSetSnapshots") {
+        json snapshots_json = json::array();
+        for (auto const& snapshot : listRuleSetSnapshots()) {
+          snapshots_json.push_back({
+            { "version", snapshot.version },
+            { "name", snapshot.name },
+            { "time", snapshot.time },
+            { "rule_count", snapshot.rule_count }
+          });
+        }
+        retval["retval"] = snapshots_json;
+      }
+      else if (name == "rollbackRuleSet") {
+        rollbackRuleSet(jobj.at("version"));
+      }
+      else if (name == "setRuleGroupEnabled") {
+        setRuleGroupEnabled(jobj.at("group"), jobj.at("enabled"));
+      }
+      else if (name == "explainDevice") {
+        json steps_json = json::array();
+        for (auto const& step : explainDevice(jobj.at("id"))) {
+          json conditions_json = json::array();
+          for (auto const& condition : step.conditions) {
+            conditions_json.push_back({ { "condition", condition.first }, { "result", condition.second } });
+          }
+          steps_json.push_back({
+            { "rule_id", step.rule_id },
+            { "target", Rule::targetToString(step.target) },
+            { "rejected_by", step.rejected_by },
+            { "conditions", conditions_json },
+            { "matched", step.matched },
+            { "time_ns", step.time_ns }
+          });
+        }
+        retval["retval"] = steps_json;
+      }
+      else if (name == "suggestRules") {
+        json suggestions_json = json::array();
+        for (auto const& suggestion : suggestRules(jobj.at("id"))) {
+          suggestions_json.push_back({
+            { "granularity", suggestion.granularity },
+            { "rule", suggestion.rule },
+            { "matching_devices", suggestion.matching_devices }
+          });
+        }
+        retval["retval"] = suggestions_json;
+      }
+      else if (name == "simulatePolicy") {
+        json decisions_json = json::array();
+        for (auto const& decision : simulatePolicy(jobj.at("rules"))) {
+          decisions_json.push_back({
+            { "id", decision.id },
+            { "device", decision.device_rule->toString() },
+            { "current_target", Rule::targetToString(decision.current_target) },
+            { "current_rule_id", decision.current_rule_id },
+            { "target", Rule::targetToString(decision.target) },
+            { "rule_id", decision.rule_id }
+          });
+        }
+        retval["retval"] = decisions_json;
+      }
+      else {
+        throw IPCException(IPCException::InvalidArgument, "Unknown method: " + name);
+      }
+      retval["_r"] = name;
+    }
+    catch(IPCException& ex) {
+      /* Set request id and forward to upper levels */
+      ex.setRequestID(jobj.at("_i").get<uint64_t>());
+      throw;
+    }
+    catch(const std::out_of_range& ex) {
+      throw IPCException(IPCException::NotFound,
+                         "Requested action depends on a resource which is not available",
+                         jobj.at("_i").get<uint64_t>());
+    }
+    catch(const std::exception& ex) {
+      logger->error("Exception: {}", ex.what());
+      throw IPCException(IPCException::InternalError, ex.what(), jobj.at("_i").get<uint64_t>());
+    }
+
+    USBGUARD_LOG_DEBUG("Returning JSON object: {}", retval.dump());
+    return retval;
+  }
+
+  Daemon::IPCConnectionState* Daemon::qbIPCConnectionState(qb_ipcs_connection_t *qb_conn)
+  {
+    return static_cast<IPCConnectionState*>(qb_ipcs_context_get(qb_conn));
+  }
+
+  void Daemon::qbIPCSendJSON(qb_ipcs_connection_t *qb_conn, const json& jobj)
+  {
+    const IPCPrivate::WireFormat format = qbIPCWireFormat(qb_conn);
+    IPCConnectionState *state = qbIPCConnectionState(qb_conn);
+
+    if (state == nullptr || state->lagging || !state->pending.empty()) {
+      qbIPCSendMessage(qb_conn, makePointer<const std::string>(IPCPrivate::encodeMessage(jobj, format)), format);
+      return;
+    }
+
+    /*
+     * Serialize into the connection buffer. The message is
+     * copied only if the client has no room for it now.
+     */
+    Daemon* daemon = \
+      static_cast<Daemon*>(qb_ipcs_connection_service_context_get(qb_conn));
+    daemon->_ipc_buffer_bytes -= state->send_buffer.capacity();
+    IPCPrivate::encodeMessage(jobj, format, state->send_buffer);
+
+    if (qbIPCTrySendMessage(qb_conn, state->send_buffer, format) == -EAGAIN) {
+      qbIPCQueueMessage(qb_conn, *state, makePointer<const std::string>(state->send_buffer), format);
+    }
+    if (state->send_buffer.capacity() > G_ipc_send_buffer_size_max) {
+      std::string().swap(state->send_buffer);
+    }
+    daemon->_ipc_buffer_bytes += state->send_buffer.capacity();
+    return;
+  }
+
+  /*
+   * Send the message now if nothing is pending for the connection
+   * and the client has room for it, otherwise queue it. Called by
+   * the loop thread only.
+   */
+  void Daemon::qbIPCSendMessage(qb_ipcs_connection_t *qb_conn, const Pointer<const std::string>& s, IPCPrivate::WireFormat format)
+  {
+    IPCConnectionState *state = qbIPCConnectionState(qb_conn);
+
+    if (state == nullptr) {
+      qbIPCTrySendMessage(qb_conn, *s, format);
+      return;
+    }
+    if (state->lagging) {
+      return;
+    }
+    if (state->pending.empty() && qbIPCTrySendMessage(qb_conn, *s, format) != -EAGAIN) {
+      return;
+    }
+
+    qbIPCQueueMessage(qb_conn, *state, s, format);
+    return;
+  }
+
+  void Daemon::qbIPCQueueMessage(qb_ipcs_connection_t *qb_conn, IPCConnectionState& state,
+                                 const Pointer<const std::string>& s, IPCPrivate::WireFormat format)
+  {
+    Daemon* daemon = \
+      static_cast<Daemon*>(qb_ipcs_connection_service_context_get(qb_conn));
+
+    if (state.pending_size + s->size() > G_ipc_pending_size_max) {
+      logger->warn("IPC client doesn't keep up with receiving messages. Disconnecting from the client.");
+      Metrics::increment(Metrics::Counter::IPCLaggingClients);
+      state.lagging = true;
+      state.pending.clear();
+      daemon->_ipc_buffer_bytes -= state.pending_size;
+      state.pending_size = 0;
+    }
+    else {
+      state.pending.emplace_back(s, format);
+      state.pending_size += s->size();
+      daemon->_ipc_buffer_bytes += s->size();
+    }
+
+    daemon->armIPCRetryTimer();
+    return;
+  }
+
+  /*
+   * Returns the result of qb_ipcs_event_sendv. Errors other
+   * than -EAGAIN (the client has no room for the message) are
+   * logged here.
+   */
+  ssize_t Daemon::qbIPCTrySendMessage(qb_ipcs_connection_t *qb_conn, const std::string& s, IPCPrivate::WireFormat format)
+  {
+    struct qb_ipc_response_header hdr;
+    struct iovec iov[2];
+
+    hdr.id = static_cast<int32_t>(format);
+    hdr.size = sizeof hdr + s.size();
+    hdr.error = 0;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof hdr;
+    iov[1].iov_base = (void *)s.c_str();
+    iov[1].iov_len = s.size();
+
+    const size_t total_size = hdr.size;
+    const ssize_t rc = qb_ipcs_event_sendv(qb_conn, iov, 2);
+
+    if (rc == -EAGAIN) {
+      return rc;
+    }
+    else if (rc < 0) {
+      /* FIXME: There's no client identification value in the message */
+      logger->warn("Failed to send data: {}", strerror((int)-rc));
+      Metrics::increment(Metrics::Counter::IPCSendFailures);
+    }
+    else if ((size_t)rc != total_size) {
+      /* FIXME: There's no client identification value in the message */
+      logger->warn("Sent less data than expected. Expected {}, send {}.",
+		   total_size, rc);
+      Metrics::increment(Metrics::Counter::IPCShortSends);
+    }
+
+    return rc;
+  }
+
+  /*
+   * Returns true if nothing is left pending.
+   */
+  bool Daemon::qbIPCFlushPending(qb_ipcs_connection_t *qb_conn, IPCConnectionState& state)
+  {
+    Daemon* daemon = \
+      static_cast<Daemon*>(qb_ipcs_connection_service_context_get(qb_conn));
+
+    while (!state.pending.empty()) {
+      auto const& message = state.pending.front();
+
+      if (qbIPCTrySendMessage(qb_conn, *message.first, message.second) == -EAGAIN) {
+        return false;
+      }
+
+      state.pending_size -= message.first->size();
+      daemon->_ipc_buffer_bytes -= message.first->size();
+      state.pending.pop_front();
+    }
+    return true;
+  }
+
+  IPCPrivate::WireFormat Daemon::qbIPCWireFormat(qb_ipcs_connection_t *qb_conn)
+  {
+    const IPCConnectionState *state = qbIPCConnectionState(qb_conn);
+    return state != nullptr ? state->format : IPCPrivate::WireFormat::JSON;
+  }
+
+  void Daemon::qbIPCSetWireFormat(qb_ipcs_connection_t *qb_conn, IPCPrivate::WireFormat format)
+  {
+    IPCConnectionState *state = qbIPCConnectionState(qb_conn);
+    if (state != nullptr) {
+      state->format = format;
+    }
+    return;
+  }
+
+  /*
+   * A signal about an unknown device is sent only to clients
+   * without a device filter.
+   */
+  bool Daemon::qbIPCWantsSignal(const IPCConnectionState& state, const json& jobj, const Pointer<const Rule>& device_rule)
+  {
+    auto const name_it = jobj.find("_s");
+    const bool named = name_it != jobj.end() && name_it->is_string();
+
+    if (named && name_it->get_ref<const json::string_t&>() == "RuleChanged") {
+      /*
+       * Not about a device and unknown to older clients, which
+       * disconnect on unknown signals: sent only when subscribed
+       * to explicitly.
+       */
+      return state.signals.count("RuleChanged") > 0;
+    }
+    if (named && (name_it->get_ref<const json::string_t&>() == "DevicesRemoved" ||
+                  name_it->get_ref<const json::string_t&>() == "DevicesPresent")) {
+      /*
+       * Unknown to older clients too. It's about a batch of
+       * devices, so the device match isn't applied.
+       */
+      return state.signals.count(name_it->get_ref<const json::string_t&>()) > 0;
+    }
+    if (!state.signals.empty() && named &&
+        state.signals.count(name_it->get_ref<const json::string_t&>()) == 0) {
+      return false;
+    }
+    if (state.device_match) {
+      return device_rule && state.device_match->appliesTo(*device_rule);
+    }
+    return true;
+  }
+
+  /*
+   * Handle a setSubscription call. It's connection specific, so
+   * it's processed by the loop thread. An empty signal list and
+   * an empty device match mean no filtering.
+   */
+  json Daemon::processSubscriptionJSON(qb_ipcs_connection_t *qb_conn, const json& jobj)
+  {
+    static const std::set<std::string> known_signals = {
+      "DeviceInserted", "DevicePresent", "DeviceRemoved",
+      "DeviceAllowed", "DeviceBlocked", "DeviceRejected",
+      "RuleChanged", "DevicesRemoved", "DevicesPresent"
+    };
+
+    const uint64_t request_id = jobj.at("_i").get<uint64_t>();
+    IPCConnectionState *state = qbIPCConnectionState(qb_conn);
+
+    if (state == nullptr) {
+      throw IPCException(IPCException::InternalError, "No connection state", request_id);
+    }
+
+    std::set<std::string> signals;
+    Pointer<const Rule> device_match;
+
+    try {
+      for (auto const& name_json : jobj.at("signals")) {
+        const std::string name = name_json.get<std::string>();
+        if (known_signals.count(name) == 0) {
+          throw IPCException(IPCException::InvalidArgument, "Unknown signal name: " + name, request_id);
+        }
+        signals.insert(name);
+      }
+
+      const std::string match_spec = jobj.at("device_match").get<std::string>();
+      if (!match_spec.empty()) {
+        device_match = RuleQueryCache::shared().get(match_spec);
+      }
+    }
+    catch(const IPCException&) {
+      throw;
+    }
+    catch(const std::exception& ex) {
+      throw IPCException(IPCException::InvalidArgument, ex.what(), request_id);
+    }
+
+    USBGUARD_LOG_DEBUG("Setting IPC subscription: signals={}, device_match={}",
+                  signals.size(), device_match ? device_match->toString() : std::string());
+
+    state->signals = std::move(signals);
+    state->device_match = device_match;
+
+    return json {
+      { "_r", "setSubscription" },
+      { "_i", request_id }
+    };
+  }
+
+  /*
+   * Send a state notification to the service manager, if the
+   * daemon was started by one. This is what sd_notify() does,
+   * without depending on libsystemd for it.
+   */
+  static void sdNotify(const char *state)
+  {
+    const char * const socket_path = getenv("NOTIFY_SOCKET");
+
+    if (socket_path == nullptr || (socket_path[0] != '/' && socket_path[0] != '@')) {
+      return;
+    }
+
+    struct sockaddr_un address;
+    const size_t path_length = strlen(socket_path);
+
+    if (path_length >= sizeof address.sun_path) {
+      logger->warn("Cannot notify the service manager: NOTIFY_SOCKET path too long");
+      return;
+    }
+
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, socket_path, path_length);
+
+    /* Abstract socket namespace */
+    if (address.sun_path[0] == '@') {
+      address.sun_path[0] = '\0';
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+      logger->warn("Cannot notify the service manager: {}", strerror(errno));
+      return;
+    }
+
+    const socklen_t address_length = offsetof(struct sockaddr_un, sun_path) + path_length;
+
+    if (sendto(fd, state, strlen(state), MSG_NOSIGNAL,
+               reinterpret_cast<const struct sockaddr*>(&address), address_length) < 0) {
+      logger->warn("Cannot notify the service manager: {}", strerror(errno));
+    }
+
+    close(fd);
+    return;
+  }
+
+  /*
+   * Handle a waitForReady call. Called by the loop thread; the
+   * connection is referenced while the reply is held back.
+   */
+  void Daemon::waitForReady(qb_ipcs_connection_t *conn, const json& jobj)
+  {
+    const uint64_t request_id = jobj.at("_i").get<uint64_t>();
+    {
+      std::unique_lock<std::mutex> lock(_ready_mutex);
+      if (!_ready) {
+        qb_ipcs_connection_ref(conn);
+        _ready_waiters.push_back(ReadyWaiter { conn, request_id, qbIPCWireFormat(conn) });
+        return;
+      }
+    }
+    qbIPCSendJSON(conn, json {
+      { "_r", "waitForReady" },
+      { "_i", request_id }
+    });
+    return;
+  }
+
+  /*
+   * Called by the write worker once the devices present at startup
+   * were processed and the policy was applied to them.
+   */
+  void Daemon::markReady()
+  {
+    std::vector<ReadyWaiter> waiters;
+    {
+      std::unique_lock<std::mutex> lock(_ready_mutex);
+      if (_ready) {
+        return;
+      }
+      _ready = true;
+      waiters.swap(_ready_waiters);
+    }
+
+    for (auto const& waiter : waiters) {
+      const json reply = {
+        { "_r", "waitForReady" },
+        { "_i", waiter.request_id }
+      };
+      queueIPCOutput(IPCOutput { waiter.conn, IPCPrivate::encodeMessage(reply, waiter.format),
+                                 waiter.format, json(), nullptr, true });
+    }
+
+    logger->info("Initial device enumeration done, ready");
+    if (StartupProfile::finish()) {
+      logger->info("Startup profile: {}", StartupProfile::get().toString());
+    }
+    sdNotify("READY=1");
+    return;
+  }
+
+  /*
+   * Drop the references of the clients still waiting when the
+   * daemon stops before becoming ready.
+   */
+  void Daemon::releaseReadyWaiters()
+  {
+    std::vector<ReadyWaiter> waiters;
+    {
+      std::unique_lock<std::mutex> lock(_ready_mutex);
+      waiters.swap(_ready_waiters);
+    }
+    for (auto const& waiter : waiters) {
+      qb_ipcs_connection_unref(waiter.conn);
+    }
+    return;
+  }
+
+  void Daemon::qbIPCRetryTimerFn(void *arg)
+  {
+    Daemon *daemon = static_cast<Daemon*>(arg);
+    daemon->_ipc_retry_timer_armed = false;
+    daemon->retryIPCSends();
+    return;
+  }
+
+  void Daemon::armIPCRetryTimer()
+  {
+    if (_ipc_retry_timer_armed) {
+      return;
+    }
+    if (qb_loop_timer_add(_qb_loop, QB_LOOP_HIGH, G_ipc_retry_interval_ns,
+                          this, Daemon::qbIPCRetryTimerFn, &_ipc_retry_timer_handle) != 0) {
+      logger->error("Cannot schedule sending of pending IPC messages");
+      return;
+    }
+    _ipc_retry_timer_armed = true;
+    return;
+  }
+
+  /*
+   * Send the pending messages of all the connections and
+   * disconnect the lagging clients. The disconnects are done
+   * after walking the connection list, which they modify.
+   */
+  void Daemon::retryIPCSends()
+  {
+    std::vector<qb_ipcs_connection_t*> lagging;
+    bool pending = false;
+
+    auto qb_conn = qb_ipcs_connection_first_get(_qb_service);
+
+    while (qb_conn != nullptr) {
+      IPCConnectionState *state = qbIPCConnectionState(qb_conn);
+
+      if (state != nullptr) {
+        if (state->lagging) {
+          qb_ipcs_connection_ref(qb_conn);
+          lagging.push_back(qb_conn);
+        }
+        else if (!qbIPCFlushPending(qb_conn, *state)) {
+          pending = true;
+        }
+      }
+
+      auto qb_conn_next = qb_ipcs_connection_next_get(_qb_service, qb_conn);
+      qb_ipcs_connection_unref(qb_conn);
+      qb_conn = qb_conn_next;
+    }
+
+    for (auto lagging_conn : lagging) {
+      qb_ipcs_disconnect(lagging_conn);
+      qb_ipcs_connection_unref(lagging_conn);
+    }
+
+    if (pending) {
+      armIPCRetryTimer();
+    }
+
+    return;
+  }
+
+  int32_t Daemon::qbIPCMessageProcessFn(qb_ipcs_connection_t *conn, void *data, size_t size)
+  {
+    if (size <= sizeof (struct qb_ipc_request_header)) {
+      logger->error("Received invalid IPC data. Disconnecting from the client.");
+      qb_ipcs_disconnect(conn);
+      return 0;
+    }
+
+    const struct qb_ipc_request_header *hdr = \
+      (const struct qb_ipc_request_header *)data;
+
+    if (size != (size_t)hdr->size) {
+      logger->error("Invalid size in IPC header. Disconnecting from the client.");
+      qb_ipcs_disconnect(conn);
+      return 0;
+    }
+    if (size > 1<<20) {
+      logger->error("Message too large. Disconnecting from the client.");
+      qb_ipcs_disconnect(conn);
+      return 0;
+    }
+
+    IPCPrivate::WireFormat format = IPCPrivate::WireFormat::JSON;
+
+    if (!IPCPrivate::wireFormatFromHeaderID(hdr->id, format)) {
+      logger->error("Unknown wire format in IPC header. Disconnecting from the client.");
+      qb_ipcs_disconnect(conn);
+      return 0;
+    }
+
+    try {
+      const char *jdata = (char *)data + sizeof(struct qb_ipc_request_header);
+      const size_t jsize = size - sizeof(struct qb_ipc_request_header);
+      const json jobj = IPCPrivate::decodeMessage(jdata, jsize, format);
+
+      USBGUARD_LOG_DEBUG("Received JSON object: {}", jobj.dump());
+
+      /*
+       * Switch the connection to the format preferred by
+       * the client. The reply is already sent that way.
+       */
+      auto const format_it = jobj.find(IPCPrivate::wire_format_key);
+      if (format_it != jobj.end() && format_it->is_string()) {
+        IPCPrivate::WireFormat preferred_format = IPCPrivate::WireFormat::JSON;
+        if (IPCPrivate::wireFormatFromString(format_it->get<std::string>(), preferred_format)) {
+          qbIPCSetWireFormat(conn, preferred_format);
+        }
+      }
+
+      Daemon* daemon = \
+        static_cast<Daemon*>(qb_ipcs_connection_service_context_get(conn));
+
+      auto const method_it = jobj.find("_m");
+      if (method_it != jobj.end() && *method_it == "setSubscription") {
+        qbIPCSendJSON(conn, processSubscriptionJSON(conn, jobj));
+        return 0;
+      }
+      if (method_it != jobj.end() && *method_it == "waitForReady") {
+        daemon->waitForReady(conn, jobj);
+        return 0;
+      }
+
+      if (daemon->queueIPCRequest(conn, jobj)) {
+        return 0;
+      }
+
+      const json retval = daemon->processJSON(jobj);
+
+      if (!retval.is_null()) {
+        qbIPCSendJSON(conn, retval);
+      }
+    }
+    catch(const IPCException& ex) {
+      logger->warn("IPCException: {}: {}", ex.codeAsString(), ex.what());
+      qbIPCSendJSON(conn, IPCPrivate::IPCExceptionToJSON(ex));
+    }
+    catch(const std::out_of_range& ex) {
+      logger->warn("Out-of-range exception caught while processing IPC message.");
+      const IPCException ipc_exception(IPCException::NotFound, "Not found");
+      qbIPCSendJSON(conn, IPCPrivate::IPCExceptionToJSON(ipc_exception));
+    }
+    catch(const std::exception& ex) {
+      logger->error("Exception: {}", ex.what());
+      logger->error("Invalid JSON object received. Disconnecting from the client.");
+      qb_ipcs_disconnect(conn);
+      /* FALLTHROUGH */
+    }
+
+    return 0;
+  }
+
+  int32_t Daemon::qbIPCJobAdd(enum qb_loop_priority p, void *data, qb_loop_job_dispatch_fn fn)
+  {
+    return qb_loop_job_add(G_qb_loop, p, data, fn);
+  }
+
+  int32_t Daemon::qbIPCDispatchAdd(enum qb_loop_priority p, int32_t fd, int32_t evts,
+				   void *data, qb_ipcs_dispatch_fn_t fn)
+  {
+    return qb_loop_poll_add(G_qb_loop, p, fd, evts, data, fn);
+  }
+
+  int32_t Daemon::qbIPCDispatchMod(enum qb_loop_priority p, int32_t fd, int32_t evts,
+				   void *data, qb_ipcs_dispatch_fn_t fn)
+  {
+    return qb_loop_poll_mod(G_qb_loop, p, fd, evts, data, fn);
+  }
+
+  int32_t Daemon::qbIPCDispatchDel(int32_t fd)
+  {
+    return qb_loop_poll_del(G_qb_loop, fd);
+  }
+
+  void Daemon::initIPC()
+  {
+    startIPCService();
+
+    _ipc_wakeup_fd = eventfd(0, 0);
+    if (_ipc_wakeup_fd < 0) {
+      throw std::runtime_error("Cannot create the IPC wakeup eventfd");
+    }
+    fcntl(_ipc_wakeup_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(_ipc_wakeup_fd, F_SETFL, O_NONBLOCK);
+
+    if (qb_loop_poll_add(_qb_loop, QB_LOOP_HIGH, _ipc_wakeup_fd, POLLIN,
+                         this, Daemon::qbIPCOutputFn) != 0) {
+      throw std::runtime_error("Cannot register the IPC wakeup eventfd");
+    }
+
     return;
   }
 
-  const RuleSet Daemon::listRules()
+  void Daemon::finiIPC()
   {
-    return _ruleset;
+    if (_ipc_wakeup_fd >= 0) {
+      qb_loop_poll_del(_qb_loop, _ipc_wakeup_fd);
+      close(_ipc_wakeup_fd);
+      _ipc_wakeup_fd = -1;
+    }
+    stopIPCService();
+    return;
   }
 
-  void Daemon::allowDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  /*
+   * Create the libqb service with the transport selected by
+   * `_ipc_transport'. The clients learn the transport from the
+   * daemon when they connect.
+   */
+  void Daemon::startIPCService()
   {
-    logger->debug("Allowing device: {}", id);
-    Pointer<const Rule> rule;
-    if (permanent) {
-      rule = upsertDeviceRule(id, Rule::Target::Allow, timeout_sec);
+    static struct qb_ipcs_service_handlers service_handlers = {
+      Daemon::qbIPCConnectionAcceptFn,
+      Daemon::qbIPCConnectionCreatedFn,
+      Daemon::qbIPCMessageProcessFn,
+      Daemon::qbIPCConnectionClosedFn,
+      Daemon::qbIPCConnectionDestroyedFn
+    };
+
+    _qb_service = qb_ipcs_create("usbguard", 0,
+				 _ipc_transport, &service_handlers);
+
+    if (_qb_service == nullptr) {
+      throw std::runtime_error("Cannot create qb_service object");
     }
-    else {
-      rule = makePointer<Rule>();
+
+    qb_ipcs_service_context_set(_qb_service, this);
+
+    static struct qb_ipcs_poll_handlers poll_handlers = {
+      Daemon::qbIPCJobAdd,
+      Daemon::qbIPCDispatchAdd,
+      Daemon::qbIPCDispatchMod,
+      Daemon::qbIPCDispatchDel
+    };
+
+    qb_ipcs_poll_handlers_set(_qb_service, &poll_handlers);
+
+    auto rc = qb_ipcs_run(_qb_service);
+    if (rc != 0) {
+      logger->error("Cannot start the IPC server: qb_ipcs_run failed: {}", strerror((int)-rc));
+      throw std::runtime_error("IPC server error");
     }
-    allowDevice(id, rule);
+
     return;
   }
 
-  void Daemon::blockDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  void Daemon::stopIPCService()
   {
-    logger->debug("Blocking device: {}", id);
-    Pointer<const Rule> rule;
-    if (permanent) {
-      rule = upsertDeviceRule(id, Rule::Target::Block, timeout_sec);
+    if (_qb_service != nullptr) {
+      qb_ipcs_destroy(_qb_service);
+      _qb_service = nullptr;
     }
-    else {
-      rule = makePointer<Rule>();
+    return;
+  }
+
+  bool Daemon::isReadOnlyMethod(const std::string& name)
+  {
+    return name == "listRules" ||
+      name == "getRuleStatistics" ||
+      name == "getLatencyStatistics" ||
+      name == "listDevices" ||
+      name == "listDevicesDetailed" ||
+      name == "listDeviceSubtree" ||
+      name == "listDeviceFields" ||
+      name == "getChangesSince" ||
+      name == "dumpDevices" ||
+      name == "listRuleSetSnapshots" ||
+      name == "simulatePolicy" ||
+      name == "explainDevice" ||
+      name == "suggestRules" ||
+      name == "getMetricsSnapshot" ||
+      name == "getMemoryStats" ||
+      name == "getStartupProfile";
+  }
+
+  void Daemon::startIPCWorkers()
+  {
+    const unsigned read_workers = \
+      std::max(1u, std::min(std::thread::hardware_concurrency(), G_ipc_read_workers_max));
+
+    USBGUARD_LOG_DEBUG("Starting {} IPC read workers and one IPC write worker", read_workers);
+
+    _ipc_read_lane.running = true;
+    _ipc_write_lane.running = true;
+
+    for (unsigned i = 0; i < read_workers; ++i) {
+      _ipc_read_lane.threads.emplace_back(&Daemon::runIPCWorker, this, std::ref(_ipc_read_lane));
     }
-    blockDevice(id, rule);
+    _ipc_write_lane.threads.emplace_back(&Daemon::runIPCWorker, this, std::ref(_ipc_write_lane));
+
     return;
   }
 
-  void Daemon::rejectDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  /*
+   * Let the workers finish the jobs which are already queued
+   * and send the remaining output. Safe to call repeatedly.
+   */
+  void Daemon::stopIPCWorkers()
   {
-    logger->debug("Rejecting device: {}", id);
-    Pointer<const Rule> rule;
-    if (permanent) {
-      rule = upsertDeviceRule(id, Rule::Target::Reject, timeout_sec);
+    for (IPCWorkerLane* lane : { &_ipc_read_lane, &_ipc_write_lane }) {
+      {
+        std::unique_lock<std::mutex> lock(lane->mutex);
+        lane->running = false;
+      }
+      lane->cv.notify_all();
+      for (auto& thread : lane->threads) {
+        thread.join();
+      }
+      lane->threads.clear();
     }
-    else {
-      rule = makePointer<Rule>();
+
+    flushIPCOutput();
+    return;
+  }
+
+  void Daemon::runIPCWorker(IPCWorkerLane& lane)
+  {
+    const bool device_events = (&lane == &_ipc_write_lane);
+
+    if (!device_events) {
+      if (!ThreadScheduling::lowerPriority(_background_nice)) {
+        USBGUARD_LOG_DEBUG("Cannot lower the priority of an IPC read worker: {}", strerror(errno));
+      }
+    }
+    else if (!_device_thread_scheduling.empty() && !_device_thread_scheduling.apply()) {
+      logger->warn("Cannot apply the scheduling settings to the IPC write worker: {}", strerror(errno));
+    }
+
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(lane.mutex);
+        lane.cv.wait(lock, [this, &lane, device_events]() {
+          return !lane.running || !lane.jobs.empty() ||
+            (device_events && _device_events.count() > 0);
+        });
+
+        if (device_events && _device_events.count() > 0) {
+          lock.unlock();
+          processDeviceEvents();
+          continue;
+        }
+        if (lane.jobs.empty()) {
+          return;
+        }
+
+        job = std::move(lane.jobs.front());
+        lane.jobs.pop_front();
+      }
+      try {
+        job();
+      }
+      catch(const std::exception& ex) {
+        logger->error("IPC worker: Exception: {}", ex.what());
+      }
     }
-    rejectDevice(id, rule);
     return;
   }
 
-  void Daemon::DeviceInserted(uint32_t id,
-			      const std::map<std::string,std::string>& attributes,
-			      const std::vector<USBInterfaceType>& interfaces,
-			      bool rule_match,
-			      uint32_t rule_id)
+  /*
+   * Returns false if the lane isn't running or if it's full and
+   * the job is subject to the queue size limit.
+   */
+  bool Daemon::queueIPCJob(IPCWorkerLane& lane, std::function<void()> job, bool bounded)
   {
-    logger->debug("DeviceInserted: id={}, rule_match={}, rule_id={}",
-		  id, rule_match, rule_id);
+    {
+      std::unique_lock<std::mutex> lock(lane.mutex);
+      if (!lane.running || (bounded && lane.jobs.size() >= G_ipc_queue_size_max)) {
+        return false;
+      }
+      lane.jobs.push_back(std::move(job));
+    }
+    lane.cv.notify_one();
+    return true;
+  }
 
-    json interfaces_json;
-    for (auto const& type : interfaces) {
-      interfaces_json.push_back(type.typeString());
+  /*
+   * Queue a method call for processing by one of the workers. The
+   * connection is referenced until the reply is sent. Returns false
+   * if the request should be processed synchronously instead, which
+   * is the case for malformed requests (so that the error handling
+   * stays the same) and for requests received while the workers are
+   * not running. A request which doesn't fit into a full lane is
+   * rejected with a transient error.
+   */
+  bool Daemon::queueIPCRequest(qb_ipcs_connection_t *conn, const json& jobj)
+  {
+    if (jobj.count("_m") == 0 || !jobj["_m"].is_string() ||
+        jobj.count("_i") == 0 || !jobj["_i"].is_number_unsigned()) {
+      return false;
     }
 
-    const json j = {
-      {         "_s", "DeviceInserted" },
-      {       "id", id },
-      { "attributes", attributes },
-      { "interfaces", interfaces_json },
-      { "rule_match", rule_match },
-      {  "rule_id", rule_id }
-    };
+    const std::string name = jobj["_m"].get<std::string>();
+    const bool read_only = isReadOnlyMethod(name);
+    IPCWorkerLane& lane = read_only ? _ipc_read_lane : _ipc_write_lane;
 
-    qbIPCBroadcastJSON(j);
+    {
+      std::unique_lock<std::mutex> lock(lane.mutex);
+      if (!lane.running) {
+        return false;
+      }
+    }
+
+    IPCConnectionState *state = qbIPCConnectionState(conn);
+
+    if (state != nullptr && !qbIPCAdmitRequest(*state, read_only)) {
+      Metrics::increment(Metrics::Counter::IPCRequestsThrottled);
+      USBGUARD_LOG_DEBUG("Throttling IPC request {}", name);
+      const IPCException ex(IPCException::TransientError,
+                            "Request rate limit exceeded", jobj["_i"].get<uint64_t>());
+      qbIPCSendJSON(conn, IPCPrivate::IPCExceptionToJSON(ex));
+      return true;
+    }
+
+    const IPCPrivate::WireFormat format = qbIPCWireFormat(conn);
+
+    qb_ipcs_connection_ref(conn);
+    if (state != nullptr) {
+      ++state->outstanding;
+    }
+
+    const bool queued = queueIPCJob(lane, [this, conn, jobj, format]() {
+      auto emit = [this, conn, format](const json& message) {
+        queueIPCOutput(IPCOutput { conn, IPCPrivate::encodeMessage(message, format), format, json(), nullptr, false });
+      };
+      queueIPCOutput(IPCOutput { conn, processIPCRequest(jobj, format, emit), format, json(), nullptr, true });
+    });
+
+    if (!queued) {
+      if (state != nullptr) {
+        --state->outstanding;
+      }
+      qb_ipcs_connection_unref(conn);
+      logger->warn("Too many pending IPC requests, rejecting {}", name);
+      const IPCException ex(IPCException::TransientError,
+                            "Too many pending requests", jobj["_i"].get<uint64_t>());
+      qbIPCSendJSON(conn, IPCPrivate::IPCExceptionToJSON(ex));
+    }
+
+    return true;
+  }
+
+  /*
+   * Admission control of a request, see G_ipc_outstanding_max.
+   * Called by the loop thread, which owns the connection state.
+   */
+  bool Daemon::qbIPCAdmitRequest(IPCConnectionState& state, bool read_only)
+  {
+    if (state.outstanding >= G_ipc_outstanding_max) {
+      return false;
+    }
+    if (!read_only) {
+      return true;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - state.read_tokens_updated).count();
+
+    state.read_tokens = std::min(G_ipc_read_burst, state.read_tokens + elapsed * G_ipc_read_rate);
+    state.read_tokens_updated = now;
+
+    if (state.read_tokens < 1.0) {
+      return false;
+    }
+
+    state.read_tokens -= 1.0;
+    return true;
+  }
+
+  /*
+   * Worker side of qbIPCMessageProcessFn. Returns the serialized
+   * reply, which may be empty. Parts of a streamed reply are
+   * passed to emit.
+   */
+  std::string Daemon::processIPCRequest(const json& jobj, IPCPrivate::WireFormat format,
+                                        const std::function<void(const json&)>& emit)
+  {
+    try {
+      const json retval = processJSON(jobj, emit);
+      if (!retval.is_null()) {
+        return IPCPrivate::encodeMessage(retval, format);
+      }
+    }
+    catch(const IPCException& ex) {
+      logger->warn("IPCException: {}: {}", ex.codeAsString(), ex.what());
+      return IPCPrivate::encodeMessage(IPCPrivate::IPCExceptionToJSON(ex), format);
+    }
+    catch(const std::out_of_range& ex) {
+      logger->warn("Out-of-range exception caught while processing IPC message.");
+      const IPCException ipc_exception(IPCException::NotFound, "Not found");
+      return IPCPrivate::encodeMessage(IPCPrivate::IPCExceptionToJSON(ipc_exception), format);
+    }
+    catch(const std::exception& ex) {
+      logger->error("Exception: {}", ex.what());
+      const IPCException ipc_exception(IPCException::InternalError, ex.what(), jobj["_i"].get<uint64_t>());
+      return IPCPrivate::encodeMessage(IPCPrivate::IPCExceptionToJSON(ipc_exception), format);
+    }
+    return std::string();
+  }
+
+  void Daemon::queueIPCOutput(IPCOutput output)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_ipc_output_mutex);
+      _ipc_output.push_back(std::move(output));
+    }
+    wakeLoop();
+    return;
+  }
+
+  void Daemon::wakeLoop()
+  {
+    const uint64_t value = 1;
+    if (write(_ipc_wakeup_fd, &value, sizeof value) != sizeof value) {
+      /*
+       * The counter would have to overflow (EAGAIN); the loop
+       * has a wakeup pending anyway.
+       */
+      USBGUARD_LOG_DEBUG("Cannot signal the IPC wakeup eventfd: {}", strerror(errno));
+    }
     return;
   }
 
-  void Daemon::DevicePresent(uint32_t id,
-			     const std::map<std::string,std::string>& attributes,
-			     const std::vector<USBInterfaceType>& interfaces,
-			     Rule::Target target)
+  int32_t Daemon::qbIPCOutputFn(int32_t fd, int32_t revents, void *arg)
   {
-    logger->debug("DevicePresent: id={}, target={}", id, Rule::targetToString(target));
+    Daemon *daemon = static_cast<Daemon*>(arg);
+    uint64_t value = 0;
 
-    json interfaces_json;
-    for (auto const& type : interfaces) {
-      interfaces_json.push_back(type.typeString());
+    if (read(fd, &value, sizeof value) < 0 && errno != EAGAIN) {
+      logger->warn("Cannot read the IPC wakeup eventfd: {}", strerror(errno));
     }
 
-    const json j = {
-      {         "_s", "DevicePresent" },
-      {       "id", id },
-      { "attributes", attributes },
-      { "interfaces", interfaces_json },
-      {     "target", Rule::targetToString(target) },
-    };
+    daemon->flushIPCOutput();
 
-    qbIPCBroadcastJSON(j);
-    return;
-  }
+    if (daemon->_rule_timer_rearm.exchange(false)) {
+      daemon->armRuleTimer();
+    }
+    if (daemon->_condition_timer_rearm.exchange(false)) {
+      daemon->armConditionTimer();
+    }
 
-  void Daemon::DeviceRemoved(uint32_t id,
-			     const std::map<std::string,std::string>& attributes)
+    return 0;
+  }
 
+  /*
+   * Send the output of the workers in the order it was queued.
+   * Called by the loop thread only.
+   */
+  void Daemon::flushIPCOutput()
   {
-    logger->debug("DeviceRemoved: id={}", id);
+    std::deque<IPCOutput> output;
+    {
+      std::unique_lock<std::mutex> lock(_ipc_output_mutex);
+      output.swap(_ipc_output);
+    }
 
-    const json j = {
-      {         "_s", "DeviceRemoved" },
-      {       "id", id },
-      { "attributes", attributes }
-    };
+    for (auto& item : output) {
+      if (item.conn == nullptr) {
+        qbIPCBroadcastJSON(item.broadcast, item.broadcast_device_rule);
+        continue;
+      }
+      if (!item.data.empty()) {
+        qbIPCSendMessage(item.conn, makePointer<const std::string>(std::move(item.data)), item.format);
+      }
+      if (item.release) {
+        IPCConnectionState *state = qbIPCConnectionState(item.conn);
+        if (state != nullptr && state->outstanding > 0) {
+          --state->outstanding;
+        }
+        qb_ipcs_connection_unref(item.conn);
+      }
+    }
 
-    qbIPCBroadcastJSON(j);
     return;
   }
 
-  void Daemon::DeviceAllowed(uint32_t id,
-			     const std::map<std::string,std::string>& attributes,
-			     bool rule_match,
-			     uint32_t rule_id)
+  bool Daemon::onLoopThread() const
   {
-    logger->debug("DeviceAllowed: id={}, rule_match={}, rule_id={}",
-		  id, rule_match, rule_id);
-
-    const json j = {
-      {         "_s", "DeviceAllowed" },
-      {       "id", id },
-      { "attributes", attributes },
-      { "rule_match", rule_match },
-      {  "rule_id", rule_id }
-    };
-
-    qbIPCBroadcastJSON(j);
-    return;
+    return std::this_thread::get_id() == _loop_thread_id;
   }
 
-  void Daemon::DeviceBlocked(uint32_t id,
-			     const std::map<std::string,std::string>& attributes,
-			     bool rule_match,
-			     uint32_t rule_id)
+  /*
+   * The message is encoded at most once per wire format in use
+   * and the encoded payload is shared by all the connections.
+   * Broadcasts from the IPC workers are passed to the loop thread
+   * and sent in order with the replies.
+   */
+  void Daemon::qbIPCBroadcastJSON(const json& jobj, const Pointer<const Rule>& device_rule)
   {
-    logger->debug("DeviceBlocked: id={}, rule_match={}, rule_id={}",
-		  id, rule_match, rule_id);
+    if (!onLoopThread()) {
+      queueIPCOutput(IPCOutput { nullptr, std::string(), IPCPrivate::WireFormat::JSON, jobj, device_rule, false });
+      return;
+    }
 
-    const json j = {
-      {         "_s", "DeviceBlocked" },
-      {       "id", id },
-      { "attributes", attributes },
-      { "rule_match", rule_match },
-      {  "rule_id", rule_id }
-    };
+    LatencyStatistics::Timer timer(LatencyStatistics::Stage::IPCBroadcast);
 
-    qbIPCBroadcastJSON(j);
+    std::map<IPCPrivate::WireFormat, Pointer<const std::string>> encoded;
+    size_t recipients = 0;
+
+    auto qb_conn = qb_ipcs_connection_first_get(_qb_service);
+
+    while (qb_conn != nullptr) {
+      const IPCConnectionState *state = qbIPCConnectionState(qb_conn);
+
+      if (state != nullptr && !qbIPCWantsSignal(*state, jobj, device_rule)) {
+        auto qb_conn_next = qb_ipcs_connection_next_get(_qb_service, qb_conn);
+        qb_ipcs_connection_unref(qb_conn);
+        qb_conn = qb_conn_next;
+        continue;
+      }
+
+      const IPCPrivate::WireFormat format = qbIPCWireFormat(qb_conn);
+      auto encoded_it = encoded.find(format);
+
+      if (encoded_it == encoded.end()) {
+        encoded_it = encoded.emplace(format, makePointer<const std::string>(IPCPrivate::encodeMessage(jobj, format))).first;
+      }
+
+      qbIPCSendMessage(qb_conn, encoded_it->second, format);
+      ++recipients;
+
+      /* Get the next connection */
+      auto qb_conn_next = qb_ipcs_connection_next_get(_qb_service, qb_conn);
+      qb_ipcs_connection_unref(qb_conn);
+      qb_conn = qb_conn_next;
+    }
+
+    auto const name_it = jobj.find("_s");
+    const bool named = name_it != jobj.end() && name_it->is_string();
+    USBGUARD_PROBE2(ipc_broadcast, named ? name_it->get_ref<const json::string_t&>().c_str() : "", recipients);
     return;
   }
 
-  void Daemon::DeviceRejected(uint32_t id,
-			      const std::map<std::string,std::string>& attributes,
-			      bool rule_match,
-			      uint32_t rule_id)
+  /*
+   * Find the rule which decides the target of a device. If interface
+   * authorization is enabled and no explicit rule matches the whole
+   * device, its interfaces are matched individually, all in one pass
+   * over the rule set. If some, but not all, of the interfaces are
+   * allowed, the first rule which allows an interface is returned and
+   * `allowed_interfaces' is set to the types of the allowed interfaces.
+   * If none is allowed, the first explicit rule matching an interface
+   * decides the target of the whole device. Otherwise, and always
+   * when the whole device is allowed, `allowed_interfaces' is empty.
+   */
+  /*
+   * Match the device on the thread pool and wait at most
+   * DecisionTimeout for the result. Returns nullptr if the time ran
+   * out; the evaluation then continues and, if DecisionTimeoutCorrect
+   * is set, its result is queued as a Decided device event. The
+   * matching is done right away if there's no time budget or the
+   * pool can't take the job.
+   */
+  Pointer<Rule> Daemon::matchDeviceWithDeadline(Pointer<Device> device, Pointer<const Rule> device_rule,
+                                                std::vector<USBInterfaceType>& allowed_interfaces, DecisionTime started,
+                                                const DecisionTimeout& decision_timeout)
   {
-    logger->debug("DeviceRejected: id={}, rule_match={}, rule_id={}",
-		  id, rule_match, rule_id);
+    if (decision_timeout.timeout.count() == 0) {
+      return matchDevice(device_rule, allowed_interfaces);
+    }
 
-    const json j = {
-      {         "_s", "DeviceRejected" },
-      {       "id", id },
-      { "attributes", attributes },
-      { "rule_match", rule_match },
-      {  "rule_id", rule_id }
+    struct PendingDecision
+    {
+      std::mutex mutex;
+      std::condition_variable cv;
+      bool done = false;
+      bool correct = false;
+      Pointer<Rule> matched_rule;
+      std::vector<USBInterfaceType> allowed_interfaces;
+      std::exception_ptr error;
     };
 
-    qbIPCBroadcastJSON(j);
-    return;
-  }
+    auto pending = makePointer<PendingDecision>();
+    {
+      std::unique_lock<std::mutex> lock(_decisions_mutex);
+      ++_decisions_pending;
+    }
 
-  void Daemon::dmHookDeviceInserted(Pointer<Device> device)
-  {
-    /*
-     * Since we search for a matching rule later, we have to generate a port
-     * specific rule here.
-     */
-    Pointer<Rule> device_rule = device->getDeviceRule(/*include_port=*/true);
-    Pointer<Rule> matched_rule = _ruleset.getFirstMatchingRule(device_rule);
+    const Rule::Target timeout_target = decision_timeout.target;
+    auto evaluate = [this, pending, device, device_rule, started, timeout_target]() {
+      {
+        const EvaluationClock::Scope clock_scope;
+        try {
+          pending->matched_rule = matchDevice(device_rule, pending->allowed_interfaces);
+        }
+        catch(...) {
+          pending->error = std::current_exception();
+        }
+      }
 
-    std::map<std::string,std::string> attributes;
-    
-    attributes["name"] = device_rule->getName();
-    attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
-    attributes["product_id"] = device_rule->getDeviceID().getProductID();
-    attributes["serial"] = device_rule->getSerial();
-    attributes["hash"] = device_rule->getHash();
+      bool correct = false;
+      {
+        std::unique_lock<std::mutex> lock(pending->mutex);
+        pending->done = true;
+        correct = pending->correct;
+      }
+      pending->cv.notify_one();
+
+      if (correct && !pending->error) {
+        DeviceEvent event;
+        event.type = DeviceEvent::Type::Decided;
+        event.device = device;
+        event.timeout_target = timeout_target;
+        event.matched_rule = pending->matched_rule;
+        event.allowed_interfaces = pending->allowed_interfaces;
+        event.started = started;
+        queueDeviceEvent(std::move(event));
+      }
 
-    DeviceInserted(device_rule->getRuleID(),
-		   attributes,
-		   device_rule->attributeWithInterface().values(),
-		   matched_rule->isImplicit() ? false : true,
-		   matched_rule->getRuleID());
+      std::unique_lock<std::mutex> lock(_decisions_mutex);
+      --_decisions_pending;
+      _decisions_cv.notify_all();
+    };
 
-    switch(matched_rule->getTarget()) {
-    case Rule::Target::Allow:
-      allowDevice(device_rule->getRuleID(), matched_rule);
-      break;
-    case Rule::Target::Block:
-      blockDevice(device_rule->getRuleID(), matched_rule);
-      break;
-    case Rule::Target::Reject:
-      rejectDevice(device_rule->getRuleID(), matched_rule);
-      break;
-    default:
-      throw std::runtime_error("BUG: Wrong matched_rule target");
+    if (!ThreadPool::shared().trySubmit(evaluate)) {
+      evaluate();
     }
 
-    matched_rule->updateMetaDataCounters(/*applied=*/true);
+    std::unique_lock<std::mutex> lock(pending->mutex);
 
-    return;
+    if (!pending->cv.wait_for(lock, decision_timeout.timeout, [&pending]() { return pending->done; })) {
+      pending->correct = decision_timeout.correct;
+      return nullptr;
+    }
+    if (pending->error) {
+      std::rethrow_exception(pending->error);
+    }
+
+    allowed_interfaces = std::move(pending->allowed_interfaces);
+    return pending->matched_rule;
   }
 
-  void Daemon::dmHookDevicePresent(Pointer<Device> device)
+  /*
+   * Called after the device manager was stopped, so that the late
+   * evaluation results are queued before the write worker exits.
+   */
+  void Daemon::waitForPendingDecisions()
   {
-    /*
-     * Since we search for a matching rule later, we have to generate a port
-     * specific rule here.
-     */
-    Pointer<Rule> device_rule = device->getDeviceRule(/*include_port=*/true);
-    std::map<std::string,std::string> attributes;
+    std::unique_lock<std::mutex> lock(_decisions_mutex);
+    _decisions_cv.wait(lock, [this]() { return _decisions_pending == 0; });
+  }
 
-    attributes["name"] = device_rule->getName();
-    attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
-    attributes["product_id"] = device_rule->getDeviceID().getProductID();
-    attributes["serial"] = device_rule->getSerial();
-    attributes["hash"] = device_rule->getHash();
+  Daemon::DecisionTimeout Daemon::decisionTimeout()
+  {
+    std::unique_lock<std::mutex> lock(_decision_timeout_mutex);
+    return _decision_timeout;
+  }
 
-    const PresentDevicePolicy policy = \
-      device->isController() ? _present_controller_policy : _present_device_policy;
+  Pointer<Rule> Daemon::matchDevice(Pointer<const Rule> device_rule, std::vector<USBInterfaceType>& allowed_interfaces)
+  {
+    allowed_interfaces.clear();
+    Pointer<Rule> matched_rule = _ruleset.getFirstMatchingRule(device_rule);
 
-    Rule::Target target = Rule::Target::Invalid;
-    Pointer<Rule> matched_rule = nullptr;
+    if (!_interface_authorization || !matched_rule->isImplicit() ||
+        device_rule->attributeWithInterface().count() < 2) {
+      return matched_rule;
+    }
 
-    switch (policy) {
-    case PresentDevicePolicy::Allow:
-      target = Rule::Target::Allow;
-      break;
-    case PresentDevicePolicy::Block:
-      target = Rule::Target::Block;
-      break;
-    case PresentDevicePolicy::Reject:
-      target = Rule::Target::Reject;
-      break;
-    case PresentDevicePolicy::Keep:
-      target = device->getTarget();
-      break;
-    case PresentDevicePolicy::ApplyPolicy:
-      matched_rule = _ruleset.getFirstMatchingRule(device_rule);
-      target = matched_rule->getTarget();
-      break;
+    const auto& interface_types = device_rule->attributeWithInterface().values();
+    const PointerVector<Rule> interface_rules = _ruleset.getFirstMatchingInterfaceRules(device_rule);
+    Pointer<Rule> allowing_rule = nullptr;
+    Pointer<Rule> explicit_rule = nullptr;
+
+    for (size_t i = 0; i < interface_rules.size(); ++i) {
+      const Pointer<Rule>& interface_rule = interface_rules[i];
+
+      if (interface_rule->getTarget() == Rule::Target::Allow) {
+        if (!allowing_rule) {
+          allowing_rule = interface_rule;
+        }
+        allowed_interfaces.push_back(interface_types[i]);
+      }
+      else if (!explicit_rule && !interface_rule->isImplicit()) {
+        explicit_rule = interface_rule;
+      }
     }
 
-    if (matched_rule == nullptr) {
-      auto rule = makePointer<Rule>();
-      rule->setTarget(target);
-      matched_rule = rule;
+    if (!allowing_rule) {
+      return explicit_rule ? explicit_rule : matched_rule;
+    }
+    if (allowed_interfaces.size() == interface_types.size()) {
+      allowed_interfaces.clear();
     }
 
-    switch(target) {
-    case Rule::Target::Allow:
-      allowDevice(device_rule->getRuleID(), matched_rule);
-      break;
-    case Rule::Target::Block:
-      blockDevice(device_rule->getRuleID(), matched_rule);
-      break;
-    case Rule::Target::Reject:
-      rejectDevice(device_rule->getRuleID(), matched_rule);
-      break;
-    default:
-      throw std::runtime_error("BUG: Wrong matched_rule target");
+    return allowing_rule;
+  }
+
+  /*
+   * If `allowed_interfaces' isn't empty, only the interfaces of those
+   * types are authorized. The device is blocked if that fails.
+   */
+  void Daemon::allowDevice(uint32_t id, Pointer<const Rule> matched_rule,
+                           AuditLog::Event event, DecisionTime started,
+                           const std::vector<USBInterfaceType>& allowed_interfaces)
+  {
+    Pointer<Device> device = nullptr;
+
+    if (allowed_interfaces.empty()) {
+      device = _dm->allowDevice(id);
+    }
+    else {
+      try {
+        device = _dm->allowDeviceInterfaces(id, allowed_interfaces);
+      }
+      catch(const std::exception& ex) {
+        logger->warn("Cannot allow the interfaces of device {}, blocking it: {}", id, ex.what());
+        blockDevice(id, matched_rule, event, started);
+        return;
+      }
+    }
+    {
+      std::unique_lock<std::mutex> lock(_device_matches_mutex);
+      if (allowed_interfaces.empty()) {
+        _partially_allowed_devices.erase(id);
+      }
+      else {
+        _partially_allowed_devices.insert(id);
+      }
     }
+    signalDeviceTarget(device, Rule::Target::Allow, matched_rule, event, started);
+    return;
+  }
 
-    matched_rule->updateMetaDataCounters(/*applied=*/true);
+  void Daemon::blockDevice(uint32_t id, Pointer<const Rule> matched_rule,
+                           AuditLog::Event event, DecisionTime started)
+  {
+    Pointer<Device> device = _dm->blockDevice(id);
+    {
+      std::unique_lock<std::mutex> lock(_device_matches_mutex);
+      _partially_allowed_devices.erase(id);
+    }
+    signalDeviceTarget(device, Rule::Target::Block, matched_rule, event, started);
+    return;
+  }
 
-    DevicePresent(device_rule->getRuleID(),
-		  attributes,
-		  device_rule->attributeWithInterface().values(),
-		  target);
+  void Daemon::rejectDevice(uint32_t id, Pointer<const Rule> matched_rule,
+                           AuditLog::Event event, DecisionTime started)
+  {
+    Pointer<Device> device = _dm->rejectDevice(id);
+    signalDeviceTarget(device, Rule::Target::Reject, matched_rule, event, started);
     return;
   }
 
-  void Daemon::dmHookDeviceRemoved(Pointer<Device> device)
+  void Daemon::signalDeviceTarget(Pointer<Device> device, Rule::Target target, Pointer<const Rule> matched_rule,
+                                  AuditLog::Event event, DecisionTime started)
   {
-    /* We don't care about ports here, use the default */
-    Pointer<Rule> device_rule = device->getDeviceRule();
+    if (_audit_log) {
+      const uint64_t latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(\
+        std::chrono::steady_clock::now() - started).count();
+      _audit_log->append(latency_ns, device->getID(), matched_rule->getRuleID(),
+                         event, target, device->getHash(), device->getPort());
+    }
+
+    /*
+     * We don't care about include_port value here, the generated rule isn't
+     * used for policy evaluation.
+     */
+    const bool with_hash = dmHookDeviceHashRequired();
+    Pointer<const Rule> device_rule = \
+      device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/with_hash, with_hash);
 
     std::map<std::string,std::string> attributes;
     
     attributes["name"] = device_rule->getName();
     attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
     attributes["product_id"] = device_rule->getDeviceID().getProductID();
-    attributes["serial"] = device_rule->getSerial();
-    attributes["hash"] = device_rule->getHash();
 
-    DeviceRemoved(device_rule->getRuleID(), attributes);
+    const bool rule_match = (matched_rule->getRuleID() != Rule::DefaultID);
+
+    switch(target) {
+      case Rule::Target::Allow:
+        Metrics::increment(Metrics::Counter::DecisionsAllow);
+        signalDeviceAllowed(device_rule, device_rule->getRuleID(), attributes, rule_match, matched_rule->getRuleID());
+        break;
+      case Rule::Target::Block:
+        Metrics::increment(Metrics::Counter::DecisionsBlock);
+        signalDeviceBlocked(device_rule, device_rule->getRuleID(), attributes, rule_match, matched_rule->getRuleID());
+        break;
+      case Rule::Target::Reject:
+        Metrics::increment(Metrics::Counter::DecisionsReject);
+        signalDeviceRejected(device_rule, device_rule->getRuleID(), attributes, rule_match, matched_rule->getRuleID());
+        break;
+      default:
+        throw std::runtime_error("BUG: Wrong device target");
+    }
     return;
   }
 
-  void Daemon::dmHookDeviceAllowed(Pointer<Device> device)
+  const std::vector<Rule> Daemon::listDevices(const std::string& query)
   {
-    return;
+    return queryDevices(*RuleQueryCache::shared().get(query));
   }
 
-  void Daemon::dmHookDeviceBlocked(Pointer<Device> device)
+  const std::vector<Rule> Daemon::queryDevices(const Rule& query)
   {
-    return;
+    std::vector<Rule> device_rules;
+
+    for (auto const& device : _dm->getDeviceList(query)) {
+      device_rules.push_back(*device->getCachedDeviceRule());
+    }
+
+    return device_rules;
   }
 
-  void Daemon::dmHookDeviceRejected(Pointer<Device> device)
+  const std::vector<Rule> Daemon::listDeviceSubtree(uint32_t id, const std::string& query)
   {
-    return;
+    std::vector<Rule> device_rules;
+
+    for (auto const& device : _dm->getDeviceSubtree(id, *RuleQueryCache::shared().get(query))) {
+      device_rules.push_back(*device->getCachedDeviceRule());
+    }
+
+    return device_rules;
   }
 
-  uint32_t Daemon::dmHookAssignID()
+  template<typename ValueType>
+  static std::string attributeRuleString(const Rule::Attribute<ValueType>& attribute)
   {
-    return assignID();
+    return attribute.empty() ? std::string() : attribute.toRuleString();
   }
 
-  int32_t Daemon::qbSignalHandlerFn(int32_t signal, void *arg)
+  /*
+   * The fields are resolved before the device tree is walked, so
+   * that an unknown field fails the call without any work done.
+   */
+  const std::vector<Interface::DeviceFields> Daemon::listDeviceFields(uint32_t id, const std::string& query,
+                                                                      const std::vector<std::string>& fields)
   {
-    qb_loop_t *qb_loop = (qb_loop_t *)arg;
-    logger->debug("Stopping main loop from signal handler");
-    qb_loop_stop(qb_loop);
+    typedef std::string(*FieldValue)(const Rule&);
+
+    static const std::map<std::string, FieldValue> field_values = {
+      { "target", [](const Rule& rule) -> std::string { return Rule::targetToString(rule.getTarget()); } },
+      { "id", [](const Rule& rule) -> std::string { return attributeRuleString(rule.attributeDeviceID()); } },
+      { "name", [](const Rule& rule) -> std::string { return attributeRuleString(rule.attributeName()); } },
+      { "serial", [](const Rule& rule) -> std::string { return attributeRuleString(rule.attributeSerial()); } },
+      { "hash", [](const Rule& rule) -> std::string { return attributeRuleString(rule.attributeHash()); } },
+      { "parent-hash", [](const Rule& rule) -> std::string { return attributeRuleString(rule.attributeParentHash()); } },
+      { "via-port", [](const Rule& rule) -> std::string { return attributeRuleString(rule.attributeViaPort()); } },
+      { "with-interface", [](const Rule& rule) -> std::string { return attributeRuleString(rule.attributeWithInterface()); } },
+      { "rule", [](const Rule& rule) -> std::string { return rule.toString(); } }
+    };
+
+    std::vector<FieldValue> selected;
+    selected.reserve(fields.size());
+
+    for (auto const& field : fields) {
+      auto it = field_values.find(field);
+      if (it == field_values.end()) {
+        throw IPCException(IPCException::InvalidArgument, "Unknown device field: " + field);
+      }
+      selected.push_back(it->second);
+    }
+
+    std::vector<DeviceFields> devices;
 
-    if (signal == SIGSYS) {
-      logger->warn("Stopped due to SIGSYS: A system call was used which is not whitelisted.");
+    for (auto const& device : _dm->getDeviceSubtree(id, *RuleQueryCache::shared().get(query))) {
+      Pointer<const Rule> device_rule = device->getCachedDeviceRule();
+      DeviceFields device_fields;
+
+      device_fields.id = device->getID();
+      device_fields.parent_id = device->getParentID();
+      device_fields.values.reserve(selected.size());
+
+      for (auto const& field_value : selected) {
+        device_fields.values.push_back(field_value(*device_rule));
+      }
+
+      devices.push_back(std::move(device_fields));
     }
 
-    return QB_FALSE;
+    return devices;
   }
 
-  int32_t Daemon::qbIPCConnectionAcceptFn(qb_ipcs_connection_t *conn, uid_t uid, gid_t gid)
+  Pointer<const Rule> Daemon::upsertDeviceRule(uint32_t id, Rule::Target target, uint32_t timeout_sec)
   {
-    Daemon* daemon = \
-      static_cast<Daemon*>(qb_ipcs_connection_service_context_get(conn));
-
-    const bool auth = daemon->qbIPCConnectionAllowed(uid, gid);
+    const RuleSet::Operation upsert = deviceRuleUpsert(id, target);
+    const uint32_t rule_id = upsertRule(upsert.match_rule.toString(),
+                                        upsert.rule.toString(), upsert.parent_insensitive);
 
-    if (auth) {
-      logger->debug("IPC Connection accepted. "
-		    "Setting SHM permissions to uid={} gid={} mode=0660", uid, 0);
-      qb_ipcs_connection_auth_set(conn, uid, 0, 0660);
-      return 0;
-    }
-    else {
-      logger->debug("IPC Connection rejected");
-      return -1;
-    }
+    updateDeviceRuleExpiration(rule_id, timeout_sec);
+    return _ruleset.getRule(rule_id);
   }
 
-  bool Daemon::qbIPCConnectionAllowed(uid_t uid, gid_t gid)
+  /*
+   * A permanent decision replaces a previous temporary one
+   * for the same device, so drop any pending expiration.
+   */
+  void Daemon::updateDeviceRuleExpiration(uint32_t rule_id, uint32_t timeout_sec)
   {
-    if (_ipc_dac_acl) {
-      logger->debug("Using DAC IPC ACL");
-      logger->debug("Connection request from uid={} gid={}", uid, gid);
-      return DACAuthenticateIPCConnection(uid, gid);
+    if (timeout_sec > 0) {
+      scheduleRuleExpiration(rule_id, timeout_sec);
     }
     else {
-      logger->debug("IPC authentication is turned off.");
-      return true;
+      cancelRuleExpiration(rule_id);
     }
+    return;
   }
 
-  Daemon::PresentDevicePolicy Daemon::presentDevicePolicyFromString(const String& policy_string)
+  /*
+   * Build the upsert operation which stores the device rule
+   * of a device with the given target.
+   */
+  RuleSet::Operation Daemon::deviceRuleUpsert(uint32_t id, Rule::Target target)
   {
-    const std::vector<std::pair<String,Daemon::PresentDevicePolicy> > policy_ttable = {
-      { "allow", PresentDevicePolicy::Allow },
-      { "block", PresentDevicePolicy::Block },
-      { "reject", PresentDevicePolicy::Reject },
-      { "keep", PresentDevicePolicy::Keep },
-      { "apply-policy", PresentDevicePolicy::ApplyPolicy }
-    };
+    Pointer<Device> device = _dm->getDevice(id);
 
-    for (auto ttable_entry : policy_ttable) {
-      if (ttable_entry.first == policy_string) {
-	return ttable_entry.second;
-      }
+    bool with_port = true && _device_rules_with_port;
+    bool with_parent_hash = true;
+
+    /*
+     * Generate a port specific or agnostic rule depending on the target
+     */
+    switch(target) {
+      case Rule::Target::Allow:
+        with_port = true && with_port;
+        with_parent_hash = true;
+        break;
+      case Rule::Target::Block:
+        /*
+         * Block the device using a port agnostic rule, so that the same device
+         * inserted in a different port is still blocked. Note that allowDevice
+         * generates a port specific rule and the same device won't be allowed
+         * when inserted in a different port.
+         */
+        with_port = false;
+        with_parent_hash = false;
+        break;
+      case Rule::Target::Reject:
+        /*
+         * Reject the device using a port agnostic port. When we explicitly
+         * reject a device, we don't want to reject it again when the same
+         * device is inserted in a different port.
+         */
+        with_port = false;
+        with_parent_hash = false;
+        break;
+      default:
+        throw std::runtime_error("deviceRuleUpsert: invalid device rule target");
     }
 
-    throw std::runtime_error("Invalid present device policy string");
-  }
+    /* Generate a match rule for upsert */
+    Pointer<Rule> match_rule = device->getDeviceRule(false, false);
+    match_rule->setTarget(Rule::Target::Match);
 
-  void Daemon::qbIPCConnectionCreatedFn(qb_ipcs_connection_t *conn)
-  {
-    logger->debug("Connection created");
-  }
+    /* Generate new device rule */
+    Pointer<Rule> device_rule = device->getDeviceRule(with_port, with_parent_hash); 
+    device_rule->setTarget(target);
 
-  void Daemon::qbIPCConnectionDestroyedFn(qb_ipcs_connection_t *conn)
-  {
-    logger->debug("Connection destroyed");
+    return RuleSet::Operation::upsert(*match_rule, *device_rule, /*parent_insensitive=*/true);
   }
 
-  int32_t Daemon::qbIPCConnectionClosedFn(qb_ipcs_connection_t *conn)
+  void Daemon::recordDeviceMatch(uint32_t id, uint32_t rule_id)
   {
-    logger->debug("Connection closed");
-    return 0;
+    std::unique_lock<std::mutex> lock(_device_matches_mutex);
+    _device_matches[id] = rule_id;
+    return;
   }
 
-  json Daemon::processJSON(const json& jobj)
+  void Daemon::forgetDeviceMatch(uint32_t id)
   {
-    logger->debug("Processing JSON object: {}", jobj.dump());
-
-    if (jobj.count("_m")) {
-      return processMethodCallJSON(jobj);
-    }
-    else {
-      throw IPCException(IPCException::ProtocolError, "Invalid message");
-    }
-    return json();
+    std::unique_lock<std::mutex> lock(_device_matches_mutex);
+    _device_matches.erase(id);
+    _partially_allowed_devices.erase(id);
+    return;
   }
 
-  json Daemon::processMethodCallJSON(const json& jobj)
+  /*
+   * Re-evaluate the present devices after a rule set change. Only
+   * devices whose match could have changed are evaluated again: those
+   * matched by one of the `changed_ids' rules (removed or updated) and
+   * those a new rule from `changed_rules' applies to. A new rule can only
+   * take over devices matched by a rule at or after its position, which
+   * the evaluation of the rule set resolves. Devices which were authorized
+   * explicitly, without a permanent rule, are left alone.
+   */
+  void Daemon::reevaluateDevices(const std::vector<Rule>& changed_rules,
+                                 const std::set<uint32_t>& changed_ids)
   {
-    logger->debug("Processing method call");
-
-    json retval = {
-      { "_i", jobj.at("_i").get<uint64_t>() }
-    };
+    std::map<uint32_t,uint32_t> device_matches;
+    std::set<uint32_t> partially_allowed_devices;
+    {
+      std::unique_lock<std::mutex> lock(_device_matches_mutex);
+      device_matches = _device_matches;
+      partially_allowed_devices = _partially_allowed_devices;
+    }
 
-    try {
-      const std::string name = jobj.at("_m").get<std::string>();
+    const DecisionTime started = std::chrono::steady_clock::now();
+    const bool with_hash = dmHookDeviceHashRequired();
+    std::vector<std::pair<uint32_t, Rule::Target>> targets;
+    PointerVector<Rule> matched_rules;
 
-      logger->debug("Method name = {}", name);
+    for (auto const& device_match : device_matches) {
+      Pointer<Device> device;
 
-      if (name == "appendRule") {
-        uint32_t val = appendRule(jobj["rule_spec"], jobj["parent_id"], jobj["timeout_sec"]);
-        retval["retval"] = val;
+      try {
+        device = _dm->getDevice(device_match.first);
       }
-      else if (name == "removeRule") {
-        removeRule(jobj["id"]);
+      catch(const std::out_of_range&) {
+        forgetDeviceMatch(device_match.first);
+        continue;
       }
-      else if (name == "listRules") {
-        json ruleset_json = json::array();
-        RuleSet ruleset = listRules();
-        for (auto rule : ruleset.getRules()) {
-          json rule_json = {
-            { "id", rule->getRuleID() },
-            { "rule", rule->toString() }
-          };
-          ruleset_json.push_back(rule_json);
-        }
-        retval["retval"] = ruleset_json;
+
+      Pointer<const Rule> device_rule = \
+        device->getCachedDeviceRule(/*include_port=*/true, /*with_parent_hash=*/with_hash, with_hash);
+      const bool partially_allowed = partially_allowed_devices.count(device_match.first) > 0;
+      bool affected = changed_ids.count(device_match.second) > 0;
+
+      /*
+       * Interface rules don't apply to the whole device rule, so
+       * devices whose interfaces were matched individually are
+       * affected by any change.
+       */
+      if (_interface_authorization &&
+          (partially_allowed || device_match.second == Rule::DefaultID)) {
+        affected = true;
       }
-      else if (name == "allowDevice") {
-        allowDevice(jobj["id"], jobj["permanent"], jobj["timeout_sec"]);
+
+      for (auto it = changed_rules.cbegin(); !affected && it != changed_rules.cend(); ++it) {
+        affected = it->appliesTo(*device_rule);
       }
-      else if (name == "blockDevice") {
-        blockDevice(jobj["id"], jobj["permanent"], jobj["timeout_sec"]);
+
+      if (!affected) {
+        continue;
       }
-      else if (name == "rejectDevice") {
-        rejectDevice(jobj["id"], jobj["permanent"], jobj["timeout_sec"]);
+
+      std::vector<USBInterfaceType> allowed_interfaces;
+      Pointer<Rule> matched_rule = matchDevice(device_rule, allowed_interfaces);
+      recordDeviceMatch(device_match.first, matched_rule->getRuleID());
+
+      /*
+       * Partial authorizations are applied individually, the batch
+       * applies targets to whole devices.
+       */
+      if (!allowed_interfaces.empty()) {
+        allowDevice(device_match.first, matched_rule, AuditLog::Event::Reevaluate, started, allowed_interfaces);
+        matched_rule->updateMetaDataCounters(/*applied=*/true);
+        continue;
       }
-      else if (name == "listDevices") {
-        json devices_json = json::array();
-        for (auto device_rule : listDevices(jobj["query"])) {
-          json device_json = {
-            { "id", device_rule.getRuleID() },
-            { "device", device_rule.toString() }
-          };
-          devices_json.push_back(device_json);
-        }
-        retval["retval"] = devices_json;
+
+      if (matched_rule->getTarget() == device->getTarget() && !partially_allowed) {
+        continue;
       }
-      else {
-        throw 0;
+
+      USBGUARD_LOG_DEBUG("Re-evaluated device {}: rule_id={}, target={}",
+                    device_match.first, matched_rule->getRuleID(),
+                    Rule::targetToString(matched_rule->getTarget()));
+
+      switch(matched_rule->getTarget()) {
+      case Rule::Target::Allow:
+      case Rule::Target::Block:
+      case Rule::Target::Reject:
+        break;
+      default:
+        throw std::runtime_error("BUG: Wrong matched_rule target");
       }
-      retval["_r"] = name;
-    }
-    catch(IPCException& ex) {
-      /* Set request id and forward to upper levels */
-      ex.setRequestID(jobj.at("_i").get<uint64_t>());
-      throw;
-    }
-    catch(const std::out_of_range& ex) {
-      throw IPCException(IPCException::NotFound,
-                         "Requested action depends on a resource which is not available",
-                         jobj.at("_i").get<uint64_t>());
-    }
-    catch(const std::exception& ex) {
-      logger->error("Exception: {}", ex.what());
-      throw IPCException(IPCException::InternalError, ex.what(), jobj.at("_i").get<uint64_t>());
+
+      targets.emplace_back(device_match.first, matched_rule->getTarget());
+      matched_rules.push_back(matched_rule);
     }
 
-    logger->debug("Returning JSON object: {}", retval.dump());
-    return retval;
-  }
+    /*
+     * Apply all the changed targets in one batch.
+     */
+    const auto results = _dm->applyDeviceTargets(targets);
 
-  void Daemon::qbIPCSendJSON(qb_ipcs_connection_t *qb_conn, const json& jobj)
-  {
-    const std::string s = jobj.dump();
-    struct qb_ipc_response_header hdr;
-    struct iovec iov[2];
+    for (size_t i = 0; i < results.size(); ++i) {
+      const auto& result = results[i];
 
-    hdr.id = 0;
-    hdr.size = sizeof hdr + s.size();
-    hdr.error = 0;
+      if (!result.device) {
+        logger->warn("Cannot apply target {} to device {}: {}",
+                     Rule::targetToString(result.target), result.id, result.error);
+        continue;
+      }
 
-    iov[0].iov_base = &hdr;
-    iov[0].iov_len = sizeof hdr;
-    iov[1].iov_base = (void *)s.c_str();
-    iov[1].iov_len = s.size();
+      {
+        std::unique_lock<std::mutex> lock(_device_matches_mutex);
+        _partially_allowed_devices.erase(result.id);
+      }
 
-    const size_t total_size = hdr.size;
-    const ssize_t rc = qb_ipcs_event_sendv(qb_conn, iov, 2);
+      signalDeviceTarget(result.device, result.target, matched_rules[i],
+                         AuditLog::Event::Reevaluate, started);
 
-    if (rc < 0) {
-      /* FIXME: There's no client identification value in the message */
-      logger->warn("Failed to send data: {}", strerror((int)-rc));
-    }
-    else if ((size_t)rc != total_size) {
-      /* FIXME: There's no client identification value in the message */
-      logger->warn("Sent less data than expected. Expected {}, send {}.",
-		   total_size, rc);
+      if (result.target == Rule::Target::Reject) {
+        forgetDeviceMatch(result.id);
+      }
+
+      matched_rules[i]->updateMetaDataCounters(/*applied=*/true);
     }
 
+    scheduleConditionChanges();
     return;
   }
 
-  int32_t Daemon::qbIPCMessageProcessFn(qb_ipcs_connection_t *conn, void *data, size_t size)
+  /*
+   * The monitor is optional: if usbmon isn't available, the daemon
+   * runs without it and usb-traffic-rate conditions evaluate to false.
+   */
+  void Daemon::startTrafficMonitor()
   {
-    if (size <= sizeof (struct qb_ipc_request_header)) {
-      logger->error("Received invalid IPC data. Disconnecting from the client.");
-      qb_ipcs_disconnect(conn);
-      return 0;
-    }
-
-    const struct qb_ipc_request_header *hdr = \
-      (const struct qb_ipc_request_header *)data;
-
-    if (size != (size_t)hdr->size) {
-      logger->error("Invalid size in IPC header. Disconnecting from the client.");
-      qb_ipcs_disconnect(conn);
-      return 0;
-    }
-    if (size > 1<<20) {
-      logger->error("Message too large. Disconnecting from the client.");
-      qb_ipcs_disconnect(conn);
-      return 0;
+    if (_usbmon_path.empty()) {
+      return;
     }
 
     try {
-      const char *jdata = (char *)data + sizeof(struct qb_ipc_request_header);
-      const size_t jsize = size - sizeof(struct qb_ipc_request_header);
-      const std::string json_string((const char *)jdata, jsize);
-      const json jobj = json::parse(json_string);
-
-      logger->debug("Received JSON object: {}", jobj.dump());
-
-      Daemon* daemon = \
-        static_cast<Daemon*>(qb_ipcs_connection_service_context_get(conn));
-
-      const json retval = daemon->processJSON(jobj);
-
-      if (!retval.is_null()) {
-        qbIPCSendJSON(conn, retval);
-      }
-    }
-    catch(const IPCException& ex) {
-      logger->warn("IPCException: {}: {}", ex.codeAsString(), ex.what());
-      qbIPCSendJSON(conn, IPCPrivate::IPCExceptionToJSON(ex));
-    }
-    catch(const std::out_of_range& ex) {
-      logger->warn("Out-of-range exception caught while processing IPC message.");
-      const IPCException ipc_exception(IPCException::NotFound, "Not found");
-      qbIPCSendJSON(conn, IPCPrivate::IPCExceptionToJSON(ipc_exception));
+      USBTrafficMonitor::instance().start(_usbmon_path);
     }
     catch(const std::exception& ex) {
-      logger->error("Exception: {}", ex.what());
-      logger->error("Invalid JSON object received. Disconnecting from the client.");
-      qb_ipcs_disconnect(conn);
-      /* FALLTHROUGH */
+      logger->error("Cannot start the USB traffic monitor: {}", ex.what());
+      return;
     }
 
-    return 0;
+    armTrafficTimer();
+    return;
   }
 
-  int32_t Daemon::qbIPCJobAdd(enum qb_loop_priority p, void *data, qb_loop_job_dispatch_fn fn)
+  void Daemon::stopTrafficMonitor()
   {
-    return qb_loop_job_add(G_qb_loop, p, data, fn);
+    if (_traffic_timer_armed) {
+      qb_loop_timer_del(_qb_loop, _traffic_timer_handle);
+      _traffic_timer_armed = false;
+    }
+    USBTrafficMonitor::instance().stop();
+    return;
   }
 
-  int32_t Daemon::qbIPCDispatchAdd(enum qb_loop_priority p, int32_t fd, int32_t evts,
-				   void *data, qb_ipcs_dispatch_fn_t fn)
+  void Daemon::armTrafficTimer()
   {
-    return qb_loop_poll_add(G_qb_loop, p, fd, evts, data, fn);
+    if (_traffic_timer_armed || !USBTrafficMonitor::instance().running()) {
+      return;
+    }
+    if (qb_loop_timer_add(_qb_loop, QB_LOOP_MED, 1000000000ULL,
+                          this, Daemon::qbTrafficTimerFn, &_traffic_timer_handle) != 0) {
+      logger->error("Cannot schedule the re-evaluation of the USB traffic rules");
+      return;
+    }
+    _traffic_timer_armed = true;
+    return;
   }
 
-  int32_t Daemon::qbIPCDispatchMod(enum qb_loop_priority p, int32_t fd, int32_t evts,
-				   void *data, qb_ipcs_dispatch_fn_t fn)
+  void Daemon::startRuleStatistics()
   {
-    return qb_loop_poll_mod(G_qb_loop, p, fd, evts, data, fn);
+    if (!_rule_statistics) {
+      return;
+    }
+    _rule_statistics->start();
+    armRuleStatisticsTimer();
+    return;
+  }
+
+  /*
+   * The last checkpoint is written after the device manager
+   * stopped, so it includes all of the decisions.
+   */
+  void Daemon::stopRuleStatistics()
+  {
+    if (!_rule_statistics) {
+      return;
+    }
+    if (_rule_statistics_timer_armed) {
+      qb_loop_timer_del(_qb_loop, _rule_statistics_timer_handle);
+      _rule_statistics_timer_armed = false;
+    }
+    _rule_statistics->checkpoint(_ruleset.getRules());
+    _rule_statistics->stop();
+    return;
   }
 
-  int32_t Daemon::qbIPCDispatchDel(int32_t fd)
+  void Daemon::armRuleStatisticsTimer()
   {
-    return qb_loop_poll_del(G_qb_loop, fd);
+    if (_rule_statistics_timer_armed) {
+      return;
+    }
+    if (qb_loop_timer_add(_qb_loop, QB_LOOP_LOW, _rule_statistics_interval_s * 1000000000ULL,
+                          this, Daemon::qbRuleStatisticsTimerFn, &_rule_statistics_timer_handle) != 0) {
+      logger->error("Cannot schedule the checkpoint of the rule statistics");
+      return;
+    }
+    _rule_statistics_timer_armed = true;
+    return;
   }
 
-  void Daemon::initIPC()
+  /*
+   * The counters change all the time, so the devices the traffic
+   * rules apply to are re-evaluated as if the rules were new.
+   */
+  void Daemon::reevaluateTrafficRules()
   {
-    static struct qb_ipcs_service_handlers service_handlers = {
-      Daemon::qbIPCConnectionAcceptFn,
-      Daemon::qbIPCConnectionCreatedFn,
-      Daemon::qbIPCMessageProcessFn,
-      Daemon::qbIPCConnectionClosedFn,
-      Daemon::qbIPCConnectionDestroyedFn
-    };
-
-    _qb_service = qb_ipcs_create("usbguard", 0,
-				 QB_IPC_NATIVE, &service_handlers);
+    std::vector<Rule> traffic_rules;
 
-    if (_qb_service == nullptr) {
-      throw std::runtime_error("Cannot create qb_service object");
+    for (auto const& rule : _ruleset.getRules()) {
+      for (auto const& condition : rule->attributeConditions().values()) {
+        if (condition->identifier() == "usb-traffic-rate") {
+          traffic_rules.push_back(*rule);
+          break;
+        }
+      }
     }
 
-    qb_ipcs_service_context_set(_qb_service, this);
+    if (!traffic_rules.empty()) {
+      reevaluateDevices(traffic_rules, { });
+    }
+    return;
+  }
 
-    static struct qb_ipcs_poll_handlers poll_handlers = {
-      Daemon::qbIPCJobAdd,
-      Daemon::qbIPCDispatchAdd,
-      Daemon::qbIPCDispatchMod,
-      Daemon::qbIPCDispatchDel
-    };
+  /*
+   * Append a change to the state log and return its generation.
+   */
+  uint64_t Daemon::recordStateChange(bool device, uint32_t id)
+  {
+    std::unique_lock<std::mutex> lock(_state_log_mutex);
+    const uint64_t generation = ++_state_generation;
 
-    qb_ipcs_poll_handlers_set(_qb_service, &poll_handlers);
+    _state_log.push_back(StateLogEntry { generation, device, id });
 
-    auto rc = qb_ipcs_run(_qb_service);
-    if (rc != 0) {
-      logger->error("Cannot start the IPC server: qb_ipcs_run failed: {}", strerror((int)-rc));
-      throw std::runtime_error("IPC server error");
+    if (_state_log.size() > G_state_log_size_max) {
+      _state_log_floor = _state_log.front().generation;
+      _state_log.pop_front();
     }
 
-    return;
+    return generation;
   }
 
-  void Daemon::finiIPC()
+  /*
+   * Record a rule set change and signal it with the current
+   * state of the rule.
+   */
+  void Daemon::ruleChanged(uint32_t id)
   {
-    qb_ipcs_destroy(_qb_service);
-    _qb_service = nullptr;
+    Pointer<const Rule> rule;
+
+    try {
+      rule = _ruleset.getRule(id);
+    }
+    catch(const std::out_of_range& ex) {
+      rule = nullptr;
+    }
+
+    const uint64_t generation = recordStateChange(/*device=*/false, id);
+    RuleChanged(id, !rule, rule ? rule->toString() : std::string(), generation);
     return;
   }
 
-  void Daemon::qbIPCBroadcastData(const struct iovec *iov, size_t iov_len)
+  /*
+   * The changed devices and rules are collected from the log
+   * and reported with their current state, so a change made
+   * while this runs may be reported again by the next call.
+   */
+  const Interface::StateChanges Daemon::getChangesSince(uint64_t generation)
   {
-    auto qb_conn = qb_ipcs_connection_first_get(_qb_service);
-    size_t total_size = 0;
+    StateChanges changes;
+    std::set<uint32_t> device_ids;
+    std::set<uint32_t> rule_ids;
+
+    {
+      std::unique_lock<std::mutex> lock(_state_log_mutex);
+      changes.generation = _state_generation;
+      changes.complete = \
+        generation >= _state_log_floor && generation <= _state_generation;
+
+      if (!changes.complete) {
+        return changes;
+      }
 
-    for (size_t i = 0; i < iov_len; ++i) {
-      total_size += iov[i].iov_len;
-    }
+      auto it = std::upper_bound(_state_log.cbegin(), _state_log.cend(), generation,
+                                 [](uint64_t generation, const StateLogEntry& entry) {
+        return generation < entry.generation;
+      });
 
-    logger->debug("Sending data of total size {}.", total_size);
+      for (; it != _state_log.cend(); ++it) {
+        (it->device ? device_ids : rule_ids).insert(it->id);
+      }
+    }
 
-    while (qb_conn != nullptr) {
-      /* Send the data */
-      ssize_t rc = qb_ipcs_event_sendv(qb_conn, iov, iov_len);
+    for (const uint32_t id : device_ids) {
+      StateChanges::Change change { id, false, Rule() };
+      try {
+        change.rule = *_dm->getDevice(id)->getCachedDeviceRule();
+      }
+      catch(const std::out_of_range& ex) {
+        change.removed = true;
+      }
+      changes.devices.push_back(std::move(change));
+    }
 
-      if (rc < 0) {
-	/* FIXME: There's no client identification value in the message */
-	logger->warn("Failed to send broadcast data to: {}", strerror((int)-rc));
+    for (const uint32_t id : rule_ids) {
+      StateChanges::Change change { id, false, Rule() };
+      try {
+        change.rule = *_ruleset.getRule(id);
       }
-      else if ((size_t)rc != total_size) {
-	/* FIXME: There's no client identification value in the message */
-	logger->warn("Sent less data than expected to. Expected {}, send {}.",
-		     total_size, rc);
+      catch(const std::out_of_range& ex) {
+        change.removed = true;
       }
-      
-      /* Get the next connection */
-      auto qb_conn_next = qb_ipcs_connection_next_get(_qb_service, qb_conn);
-      qb_ipcs_connection_unref(qb_conn);
-      qb_conn = qb_conn_next;
+      changes.rules.push_back(std::move(change));
     }
 
-    return;
+    return changes;
   }
 
-  void Daemon::qbIPCBroadcastJSON(const json& jobj)
+  const std::string Daemon::dumpDevices()
   {
-    const std::string jobj_string = jobj.dump();
-    struct qb_ipc_response_header hdr;
-    struct iovec iov[2];
+    std::vector<DeviceSnapshot::Entry> entries;
 
-    hdr.id = 0;
-    hdr.size = sizeof hdr + jobj_string.size();
-    hdr.error = 0;
+    /*
+     * Generating a device rule may look up the parent device, so
+     * the devices are visited outside of the device map locks. The
+     * list is ordered by the device id.
+     */
+    for (const auto& device : _dm->getDeviceList()) {
+      DeviceSnapshot::Entry entry;
+      Pointer<const Rule> device_rule;
 
-    iov[0].iov_base = &hdr;
-    iov[0].iov_len = sizeof hdr;
-    iov[1].iov_base = (void *)jobj_string.c_str();
-    iov[1].iov_len = jobj_string.size();
+      try {
+        device_rule = device->getCachedDeviceRule();
+      }
+      catch(const std::exception& ex) {
+        USBGUARD_LOG_DEBUG("Device {}: cannot generate the device rule: {}", device->getID(), ex.what());
+        device_rule = device->getCachedDeviceRule(/*with_port=*/true, /*with_parent_hash=*/false);
+      }
 
-    qbIPCBroadcastData(iov, 2);
-    return;
+      entry.id = device->getID();
+      entry.parent_id = device->getParentID();
+      entry.target = device->getTarget();
+      entry.vendor_id = device->getDeviceID().getVendorID();
+      entry.product_id = device->getDeviceID().getProductID();
+      entry.name = device->getName();
+      entry.serial = device->getSerial();
+      entry.port = device->getPort();
+      entry.hash = device->getHash();
+      if (!device_rule->attributeParentHash().empty()) {
+        entry.parent_hash = device_rule->getParentHash();
+      }
+      entry.descriptors = device->getDescriptorData();
+      entries.push_back(std::move(entry));
+    }
+
+    return DeviceSnapshot::encode(entries);
   }
 
-  void Daemon::qbIPCBroadcastString(const std::string& s)
+  TimerWheel::Tick Daemon::ruleTimerNow() const
   {
-    struct qb_ipc_response_header hdr;
-    struct iovec iov[2];
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::seconds>(now).count();
+  }
 
-    hdr.id = 0;
-    hdr.size = sizeof hdr + s.size();
-    hdr.error = 0;
+  void Daemon::scheduleRuleExpiration(uint32_t rule_id, uint32_t timeout_sec)
+  {
+    if (timeout_sec == 0) {
+      return;
+    }
 
-    iov[0].iov_base = &hdr;
-    iov[0].iov_len = sizeof hdr;
-    iov[1].iov_base = (void *)s.c_str();
-    iov[1].iov_len = s.size();
+    USBGUARD_LOG_DEBUG("Rule {} expires in {} seconds", rule_id, timeout_sec);
+    {
+      std::unique_lock<std::mutex> lock(_rule_timers_mutex);
+      _rule_timers.schedule(rule_id, ruleTimerNow() + timeout_sec);
+    }
+    armRuleTimer();
+    return;
+  }
 
-    qbIPCBroadcastData(iov, 2);
+  void Daemon::cancelRuleExpiration(uint32_t rule_id)
+  {
+    bool cancelled = false;
+    {
+      std::unique_lock<std::mutex> lock(_rule_timers_mutex);
+      cancelled = _rule_timers.cancel(rule_id);
+    }
+    if (cancelled) {
+      armRuleTimer();
+    }
     return;
   }
 
-  void Daemon::allowDevice(uint32_t id, Pointer<const Rule> matched_rule)
+  /*
+   * Collect the next state change times of the time dependent
+   * conditions of all the rules. Rules without such conditions
+   * cost a lookup of their (usually empty) condition set.
+   */
+  void Daemon::scheduleConditionChanges()
   {
-    Pointer<Device> device = _dm->allowDevice(id);
-    /*
-     * We don't care about include_port value here, the generated rule isn't
-     * used for policy evaluation.
-     */
-    Pointer<Rule> device_rule = device->getDeviceRule();
+    const EvaluationClock::TimePoint now = EvaluationClock::now();
+    std::map<uint32_t, EvaluationClock::TimePoint> changes;
 
-    std::map<std::string,std::string> attributes;
-    
-    attributes["name"] = device_rule->getName();
-    attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
-    attributes["product_id"] = device_rule->getDeviceID().getProductID();
+    for (auto const& rule : _ruleset.getRules()) {
+      for (auto const& condition : rule->attributeConditions().values()) {
+        EvaluationClock::TimePoint change_time;
+
+        if (!condition->nextStateChange(*rule, change_time)) {
+          continue;
+        }
+
+        auto it = changes.find(rule->getRuleID());
+
+        if (it == changes.end()) {
+          changes.emplace(rule->getRuleID(), change_time);
+        }
+        else if (change_time < it->second) {
+          it->second = change_time;
+        }
+      }
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(_condition_changes_mutex);
+
+      for (auto const& change : _condition_changes) {
+        if (change.second <= now) {
+          changes[change.first] = change.second;
+        }
+      }
+
+      _condition_changes.swap(changes);
+    }
 
-    DeviceAllowed(device_rule->getRuleID(),
-		  attributes,
-		  (matched_rule->getRuleID() != Rule::DefaultID),
-		  matched_rule->getRuleID());
+    armConditionTimer();
     return;
   }
 
-  void Daemon::blockDevice(uint32_t id, Pointer<const Rule> matched_rule)
+  void Daemon::armConditionTimer()
   {
-    Pointer<Device> device = _dm->blockDevice(id);
-    /*
-     * We don't care about include_port value here, the generated rule isn't
-     * used for policy evaluation.
-     */
-    Pointer<Rule> device_rule = device->getDeviceRule();
+    if (!onLoopThread()) {
+      _condition_timer_rearm = true;
+      wakeLoop();
+      return;
+    }
 
-    std::map<std::string,std::string> attributes;
-    
-    attributes["name"] = device_rule->getName();
-    attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
-    attributes["product_id"] = device_rule->getDeviceID().getProductID();
+    bool changes_empty = true;
+    EvaluationClock::TimePoint next_time;
+    {
+      std::unique_lock<std::mutex> lock(_condition_changes_mutex);
+
+      for (auto const& change : _condition_changes) {
+        if (changes_empty || change.second < next_time) {
+          next_time = change.second;
+          changes_empty = false;
+        }
+      }
+    }
+
+    if (changes_empty) {
+      if (_condition_timer_armed) {
+        qb_loop_timer_del(_qb_loop, _condition_timer_handle);
+        _condition_timer_armed = false;
+      }
+      return;
+    }
+
+    if (_condition_timer_armed) {
+      if (_condition_timer_time == next_time) {
+        return;
+      }
+      qb_loop_timer_del(_qb_loop, _condition_timer_handle);
+      _condition_timer_armed = false;
+    }
+
+    const EvaluationClock::TimePoint now = std::chrono::steady_clock::now();
+    const uint64_t delay_ns = next_time > now ? \
+      std::chrono::duration_cast<std::chrono::nanoseconds>(next_time - now).count() : 0;
+
+    if (qb_loop_timer_add(_qb_loop, QB_LOOP_MED, delay_ns,
+                          this, Daemon::qbConditionTimerFn, &_condition_timer_handle) != 0) {
+      logger->error("Cannot schedule the re-evaluation of the time dependent rules");
+      return;
+    }
 
-    DeviceBlocked(device_rule->getRuleID(),
-		  attributes,
-		  (matched_rule->getRuleID() != Rule::DefaultID),
-		  matched_rule->getRuleID());
+    _condition_timer_armed = true;
+    _condition_timer_time = next_time;
     return;
   }
 
-  void Daemon::rejectDevice(uint32_t id, Pointer<const Rule> matched_rule)
+  /*
+   * Re-evaluate the devices the rules whose conditions changed their
+   * state apply to, or which are matched by them.
+   */
+  void Daemon::reevaluateTimedRules()
   {
-    Pointer<Device> device = _dm->rejectDevice(id);
-    /*
-     * We don't care about include_port value here, the generated rule isn't
-     * used for policy evaluation.
-     */
-    Pointer<Rule> device_rule = device->getDeviceRule();
+    const EvaluationClock::Scope clock_scope;
+    const EvaluationClock::TimePoint now = EvaluationClock::now();
+    std::vector<uint32_t> due_ids;
+    {
+      std::unique_lock<std::mutex> lock(_condition_changes_mutex);
+
+      for (auto it = _condition_changes.begin(); it != _condition_changes.end();) {
+        if (it->second <= now) {
+          due_ids.push_back(it->first);
+          it = _condition_changes.erase(it);
+        }
+        else {
+          ++it;
+        }
+      }
+    }
 
-    std::map<std::string,std::string> attributes;
-    
-    attributes["name"] = device_rule->getName();
-    attributes["vendor_id"] = device_rule->getDeviceID().getVendorID();
-    attributes["product_id"] = device_rule->getDeviceID().getProductID();
+    std::vector<Rule> due_rules;
+    std::set<uint32_t> due_rule_ids;
 
-    DeviceRejected(device_rule->getRuleID(),
-		   attributes,
-		   (matched_rule->getRuleID() != Rule::DefaultID),
-		   matched_rule->getRuleID());
+    for (const uint32_t rule_id : due_ids) {
+      try {
+        due_rules.push_back(*_ruleset.getRule(rule_id));
+        due_rule_ids.insert(rule_id);
+      }
+      catch(const std::out_of_range& ex) {
+        USBGUARD_LOG_DEBUG("Rule {} with a time dependent condition was removed", rule_id);
+      }
+    }
+
+    if (!due_rules.empty()) {
+      USBGUARD_LOG_DEBUG("Re-evaluating devices for {} time dependent rules", due_rules.size());
+      reevaluateDevices(due_rules, due_rule_ids);
+    }
+    else {
+      scheduleConditionChanges();
+    }
     return;
   }
 
-  const std::vector<Rule> Daemon::listDevices(const std::string& query)
+  /*
+   * Make sure the loop timer fires at the nearest tick the timer
+   * wheel needs to see. The timer is disarmed while there are no
+   * temporary rules, so an idle daemon doesn't wake up at all.
+   */
+  void Daemon::armRuleTimer()
   {
-    std::vector<Rule> device_rules;
-    const Rule query_rule = Rule::fromString(query);
+    if (!onLoopThread()) {
+      _rule_timer_rearm = true;
+      wakeLoop();
+      return;
+    }
 
-    for (auto const& device : _dm->getDeviceList(query_rule)) {
-      device_rules.push_back(*device->getDeviceRule());
+    bool timers_empty = false;
+    TimerWheel::Tick next_tick = 0;
+    {
+      std::unique_lock<std::mutex> lock(_rule_timers_mutex);
+      timers_empty = _rule_timers.empty();
+      if (!timers_empty) {
+        next_tick = _rule_timers.nextTick();
+      }
     }
 
-    return device_rules;
-  }
+    if (timers_empty) {
+      if (_rule_timer_armed) {
+        qb_loop_timer_del(_qb_loop, _rule_timer_handle);
+        _rule_timer_armed = false;
+      }
+      return;
+    }
 
-  Pointer<const Rule> Daemon::upsertDeviceRule(uint32_t id, Rule::Target target, uint32_t timeout_sec)
-  {
-    Pointer<Device> device = _dm->getDevice(id);
+    if (_rule_timer_armed) {
+      if (_rule_timer_tick <= next_tick) {
+        return;
+      }
+      qb_loop_timer_del(_qb_loop, _rule_timer_handle);
+      _rule_timer_armed = false;
+    }
 
-    bool with_port = true && _device_rules_with_port;
-    bool with_parent_hash = true;
+    const TimerWheel::Tick now = ruleTimerNow();
+    const uint64_t delay_sec = next_tick > now ? next_tick - now : 0;
 
-    /*
-     * Generate a port specific or agnostic rule depending on the target
-     */
-    switch(target) {
-      case Rule::Target::Allow:
-        with_port = true && with_port;
-        with_parent_hash = true;
-        break;
-      case Rule::Target::Block:
-        /*
-         * Block the device using a port agnostic rule, so that the same device
-         * inserted in a different port is still blocked. Note that allowDevice
-         * generates a port specific rule and the same device won't be allowed
-         * when inserted in a different port.
-         */
-        with_port = false;
-        with_parent_hash = false;
-        break;
-      case Rule::Target::Reject:
-        /*
-         * Reject the device using a port agnostic port. When we explicitly
-         * reject a device, we don't want to reject it again when the same
-         * device is inserted in a different port.
-         */
-        with_port = false;
-        with_parent_hash = false;
-        break;
-      default:
-        throw std::runtime_error("upsertDeviceRule: invalid device rule target");
+    if (qb_loop_timer_add(_qb_loop, QB_LOOP_MED, delay_sec * 1000000000ULL,
+                          this, Daemon::qbRuleTimerFn, &_rule_timer_handle) != 0) {
+      logger->error("Cannot schedule the expiration of temporary rules");
+      return;
     }
 
-    /* Generate a match rule for upsert */
-    Pointer<Rule> match_rule = device->getDeviceRule(false, false);
-    match_rule->setTarget(Rule::Target::Match);
-    const String match_spec = match_rule->toString();
+    _rule_timer_armed = true;
+    _rule_timer_tick = next_tick;
+    return;
+  }
 
-    /* Generate new device rule */
-    Pointer<Rule> device_rule = device->getDeviceRule(with_port, with_parent_hash); 
-    device_rule->setTarget(target);
-    const String rule_spec = device_rule->toString();
+  /*
+   * Remove all the temporary rules which expired since the last
+   * run in a single batch, so that the rule file is stored and
+   * the present devices are re-evaluated only once per expiry.
+   */
+  void Daemon::expireRules()
+  {
+    std::vector<uint32_t> expired_ids;
+    {
+      std::unique_lock<std::mutex> lock(_rule_timers_mutex);
+      _rule_timers.advance(ruleTimerNow(), expired_ids);
+    }
 
-    /* Upsert */
-    const uint32_t rule_id = upsertRule(match_spec, rule_spec, /*parent_insensitive=*/true);
+    std::vector<RuleSet::Operation> operations;
 
-    return _ruleset.getRule(rule_id);
+    for (const uint32_t rule_id : expired_ids) {
+      try {
+        _ruleset.getRule(rule_id);
+        operations.push_back(RuleSet::Operation::remove(rule_id));
+      }
+      catch(const std::out_of_range& ex) {
+        USBGUARD_LOG_DEBUG("Expired rule {} was already removed", rule_id);
+      }
+    }
+
+    if (!operations.empty()) {
+      USBGUARD_LOG_DEBUG("Removing {} expired rules", operations.size());
+      applyRuleOperations(operations, /*store=*/true);
+    }
+
+    armRuleTimer();
+    return;
   }
 
-  bool Daemon::DACAuthenticateIPCConnection(uid_t uid, gid_t gid)
+  /*
+   * Sets `cacheable' to false if a user or group lookup failed,
+   * which may be a transient failure of the directory service.
+   */
+  bool Daemon::DACAuthenticateIPCConnection(uid_t uid, gid_t gid, bool& cacheable)
   {
     /* Check for UID match */
     for (auto allowed_uid : _ipc_allowed_uids) {
       if (allowed_uid == uid) {
-	logger->debug("uid {} is an allowed uid", uid);
+	USBGUARD_LOG_DEBUG("uid {} is an allowed uid", uid);
 	return true;
       }
     }
@@ -1153,12 +5633,13 @@ namespace usbguard
 		   pw_string_buffer, sizeof pw_string_buffer, &pwptr) != 0) {
       logger->warn("Cannot lookup username for uid {}. Won't check group membership.", uid);
       check_group_membership = false;
+      cacheable = false;
     }
 
     /* Check for GID match or group member match */
     for (auto allowed_gid : _ipc_allowed_gids) {
       if (allowed_gid == gid) {
-	logger->debug("gid {} is an allowed gid", gid);
+	USBGUARD_LOG_DEBUG("gid {} is an allowed gid", gid);
 	return true;
       }
       else if (check_group_membership) {
@@ -1170,13 +5651,14 @@ namespace usbguard
 		       gr_string_buffer, sizeof gr_string_buffer, &grptr) != 0) {
 	  logger->warn("Cannot lookup groupname for gid {}. "
 		       "Won't check group membership of uid {}", allowed_gid, uid);
+	  cacheable = false;
 	  continue;
 	}
 
 	/* Check for username match among group members */
 	for (size_t i = 0; gr.gr_mem[i] != nullptr; ++i) {
 	  if (strcmp(pw.pw_name, gr.gr_mem[i]) == 0) {
-	    logger->debug("uid {} ({}) is a member of an allowed group with gid {} ({})",
+	    USBGUARD_LOG_DEBUG("uid {} ({}) is a member of an allowed group with gid {} ({})",
 			  uid, pw.pw_name, allowed_gid, gr.gr_name);
 	    return true;
 	  }
@@ -1190,41 +5672,53 @@ namespace usbguard
   void Daemon::DACAddAllowedUID(uid_t uid)
   {
     _ipc_allowed_uids.push_back(uid);
+    _ipc_acl_cache.clear();
     return;
   }
 
   void Daemon::DACAddAllowedGID(gid_t gid)
   {
     _ipc_allowed_gids.push_back(gid);
+    _ipc_acl_cache.clear();
     return;
   }
 
   void Daemon::DACAddAllowedUID(const String& username)
+  {
+    DACAddAllowedUID(DACLookupUID(username));
+    return;
+  }
+
+  void Daemon::DACAddAllowedGID(const String& groupname)
+  {
+    DACAddAllowedGID(DACLookupGID(groupname));
+    return;
+  }
+
+  uid_t Daemon::DACLookupUID(const String& username)
   {
     char string_buffer[4096];
     struct passwd pw, *pwptr = nullptr;
 
     if (getpwnam_r(username.c_str(), &pw,
-		   string_buffer, sizeof string_buffer, &pwptr) != 0) {
+		   string_buffer, sizeof string_buffer, &pwptr) != 0 || pwptr == nullptr) {
       throw std::runtime_error("cannot lookup username");
     }
 
-    DACAddAllowedUID(pw.pw_uid);
-    return;
+    return pw.pw_uid;
   }
 
-  void Daemon::DACAddAllowedGID(const String& groupname)
+  gid_t Daemon::DACLookupGID(const String& groupname)
   {
     char string_buffer[4096];
     struct group gr, *grptr = nullptr;
 
     if (getgrnam_r(groupname.c_str(), &gr,
-		   string_buffer, sizeof string_buffer, &grptr) != 0) {
+		   string_buffer, sizeof string_buffer, &grptr) != 0 || grptr == nullptr) {
       throw std::runtime_error("cannot lookup groupname");
     }
 
-    DACAddAllowedGID(gr.gr_gid);
-    return;
+    return gr.gr_gid;
   }
 
 } /* namespace usbguard */
@@ -21,16 +21,33 @@
 #include "Typedefs.hpp"
 #include "ConfigFile.hpp"
 #include "IPC.hpp"
+#include "IPCPrivate.hpp"
 #include "RuleSet.hpp"
+#include "RuleFolder.hpp"
+#include "PolicyBundle.hpp"
+#include "RuleStatisticsFile.hpp"
 #include "Rule.hpp"
 #include "Device.hpp"
 #include "DeviceManager.hpp"
 #include "DeviceManagerHooks.hpp"
+#include "AuditLog.hpp"
+#include "Metrics.hpp"
+#include "EvaluationClock.hpp"
 
 #include "Common/Thread.hpp"
 #include "Common/JSON.hpp"
+#include "Common/TimerWheel.hpp"
+#include "Common/CCBQueue.hpp"
+#include "Common/ThreadScheduling.hpp"
 
 #include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <set>
 #include <qb/qbipcs.h>
 #include <qb/qbloop.h>
 
@@ -52,6 +69,8 @@ namespace usbguard
 
     void loadConfiguration(const String& path);
     void loadRules(const String& path);
+    void loadRuleFolder(const String& folder_path);
+    void loadPolicyBundle(const String& bundle_path);
 
     void setImplicitPolicyTarget(Rule::Target target);
     void setPresentDevicePolicy(PresentDevicePolicy policy);
@@ -70,11 +89,33 @@ namespace usbguard
     uint32_t appendRule(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec);
     void removeRule(uint32_t id);
     const RuleSet listRules();
+    const std::vector<Rule> listRules(const RuleFilter& filter);
+    const std::vector<uint32_t> applyRuleBatch(const std::vector<RuleSet::Operation>& operations);
+    const std::vector<Rule::Statistics> getRuleStatistics();
+    const std::vector<LatencyStatistics> getLatencyStatistics();
+    const MetricsSnapshot getMetricsSnapshot(uint32_t top_rules);
+    const MemoryStats getMemoryStats();
+    const StartupProfile getStartupProfile();
 
     void allowDevice(uint32_t id, bool permanent,  uint32_t timeout_sec);
     void blockDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
     void rejectDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
+    void applyDevicePolicy(const std::vector<DeviceTarget>& targets, bool permanent, uint32_t timeout_sec);
     const std::vector<Rule> listDevices(const std::string& query);
+    const std::vector<Rule> queryDevices(const Rule& query);
+    const std::vector<Rule> listDeviceSubtree(uint32_t id, const std::string& query);
+    const std::vector<DeviceFields> listDeviceFields(uint32_t id, const std::string& query,
+                                                     const std::vector<std::string>& fields);
+    const StateChanges getChangesSince(uint64_t generation);
+    const std::string dumpDevices();
+    void reloadConfiguration();
+    uint32_t saveRuleSetSnapshot(const std::string& name);
+    const std::vector<RuleSet::SnapshotInfo> listRuleSetSnapshots();
+    void rollbackRuleSet(uint32_t version);
+    void setRuleGroupEnabled(const std::string& group, bool enabled);
+    const std::vector<PolicySimulator::Decision> simulatePolicy(const std::string& rules);
+    const std::vector<RuleSet::MatchTraceStep> explainDevice(uint32_t id);
+    const std::vector<RuleSuggestion> suggestRules(uint32_t id);
 
     /* IPC Signals */
     void DeviceInserted(uint32_t id,
@@ -106,23 +147,80 @@ namespace usbguard
 			bool rule_match,
 			uint32_t rule_id);
 
+    void RuleChanged(uint32_t id,
+                     bool removed,
+                     const std::string& rule_spec,
+                     uint64_t generation);
+
     /* Device manager hooks */
     void dmHookDeviceInserted(Pointer<Device> device);
     void dmHookDevicePresent(Pointer<Device> device);
+    void dmHookDevicesPresent(const PointerVector<Device>& devices);
     void dmHookDeviceRemoved(Pointer<Device> device);
+    void dmHookDevicesRemoved(const PointerVector<Device>& devices);
     void dmHookDeviceAllowed(Pointer<Device> device);
     void dmHookDeviceBlocked(Pointer<Device> device);
     void dmHookDeviceRejected(Pointer<Device> device);
+    void dmHookDeviceTargetApplied(uint32_t id, Rule::Target target, int error);
+    bool dmHookDeviceHashRequired();
+    void dmHookThreadStarted();
     uint32_t dmHookAssignID();
 
-    json processJSON(const json& jobj);
-    json processMethodCallJSON(const json& jobj);
+    json processJSON(const json& jobj, const std::function<void(const json&)>& emit = nullptr);
+    json processMethodCallJSON(const json& jobj, const std::function<void(const json&)>& emit = nullptr);
     bool qbIPCConnectionAllowed(uid_t uid, gid_t gid);
 
     static PresentDevicePolicy presentDevicePolicyFromString(const String& policy_string);
   protected:
+    /*
+     * Per connection state, kept in the libqb connection context.
+     * Messages which cannot be sent right away, because the client
+     * doesn't keep up with reading them, wait in `pending' and are
+     * retried from a loop timer. The encoded payloads are shared by
+     * all the connections they are queued for. A client with too
+     * much pending data is marked as lagging and disconnected.
+     *
+     * A client may subscribe to a subset of the signals. If
+     * `signals' is not empty, only the named signals are sent.
+     * If `device_match' is set, only signals about devices it
+     * applies to are sent.
+     *
+     * Replies sent by the loop thread are serialized into
+     * `send_buffer', which is reused for the next message.
+     */
+    struct IPCConnectionState {
+      IPCPrivate::WireFormat format;
+      std::deque<std::pair<Pointer<const std::string>, IPCPrivate::WireFormat>> pending;
+      size_t pending_size;
+      bool lagging;
+      std::set<std::string> signals;
+      Pointer<const Rule> device_match;
+      std::string send_buffer;
+      /* Admission control, see qbIPCAdmitRequest() */
+      size_t outstanding;
+      double read_tokens;
+      std::chrono::steady_clock::time_point read_tokens_updated;
+    };
+
+    static IPCConnectionState* qbIPCConnectionState(qb_ipcs_connection_t *qb_conn);
     static void qbIPCSendJSON(qb_ipcs_connection_t *qb_conn, const json& jobj);
+    static void qbIPCSendMessage(qb_ipcs_connection_t *qb_conn, const Pointer<const std::string>& s, IPCPrivate::WireFormat format);
+    static void qbIPCQueueMessage(qb_ipcs_connection_t *qb_conn, IPCConnectionState& state,
+                                  const Pointer<const std::string>& s, IPCPrivate::WireFormat format);
+    static ssize_t qbIPCTrySendMessage(qb_ipcs_connection_t *qb_conn, const std::string& s, IPCPrivate::WireFormat format);
+    static bool qbIPCFlushPending(qb_ipcs_connection_t *qb_conn, IPCConnectionState& state);
+    static IPCPrivate::WireFormat qbIPCWireFormat(qb_ipcs_connection_t *qb_conn);
+    static void qbIPCSetWireFormat(qb_ipcs_connection_t *qb_conn, IPCPrivate::WireFormat format);
+    static void qbIPCRetryTimerFn(void *arg);
+    static bool qbIPCAdmitRequest(IPCConnectionState& state, bool read_only);
+    static bool qbIPCWantsSignal(const IPCConnectionState& state, const json& jobj, const Pointer<const Rule>& device_rule);
+    static json processSubscriptionJSON(qb_ipcs_connection_t *qb_conn, const json& jobj);
     static int32_t qbSignalHandlerFn(int32_t signal, void *arg);
+    static int32_t qbReloadSignalFn(int32_t signal, void *arg);
+    static void qbRuleTimerFn(void *arg);
+    static void qbTrafficTimerFn(void *arg);
+    static void qbRuleStatisticsTimerFn(void *arg);
+    static void qbConditionTimerFn(void *arg);
     static int32_t qbUDevEventFn(int32_t fd, int32_t revents, void *arg);
     static int32_t qbIPCConnectionAcceptFn(qb_ipcs_connection_t *, uid_t, gid_t);
     static void qbIPCConnectionCreatedFn(qb_ipcs_connection_t *);
@@ -133,32 +231,244 @@ namespace usbguard
     static int32_t qbIPCDispatchAdd(enum qb_loop_priority p, int32_t fd, int32_t evts, void *data, qb_ipcs_dispatch_fn_t fn);
     static int32_t qbIPCDispatchMod(enum qb_loop_priority p, int32_t fd, int32_t evts, void *data, qb_ipcs_dispatch_fn_t fn);
     static int32_t qbIPCDispatchDel(int32_t fd);
+    static int32_t qbIPCOutputFn(int32_t fd, int32_t revents, void *arg);
 
     void initIPC();
     void finiIPC();
+    void startIPCService();
+    void stopIPCService();
+
+    /*
+     * A queue of jobs served by one or more worker threads.
+     */
+    struct IPCWorkerLane {
+      std::deque<std::function<void()>> jobs;
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::vector<std::thread> threads;
+      bool running;
+    };
+
+    /*
+     * Data waiting to be sent by the loop thread: either an
+     * encoded reply or, if the connection is null, a broadcast
+     * which gets encoded for each connection's wire format.
+     * The connection reference taken for a request is released
+     * with its final reply; intermediate replies of a streamed
+     * list don't set release.
+     */
+    struct IPCOutput {
+      qb_ipcs_connection_t *conn;
+      std::string data;
+      IPCPrivate::WireFormat format;
+      json broadcast;
+      Pointer<const Rule> broadcast_device_rule;
+      bool release;
+    };
+
+    static bool isReadOnlyMethod(const std::string& name);
+    void startIPCWorkers();
+    void stopIPCWorkers();
+    void runIPCWorker(IPCWorkerLane& lane);
+    bool queueIPCJob(IPCWorkerLane& lane, std::function<void()> job, bool bounded = true);
 
-    void qbIPCBroadcastData(const struct iovec *iov, size_t iov_len);
-    void qbIPCBroadcastString(const std::string& s);
-    void qbIPCBroadcastJSON(const json& jobj);
+    /*
+     * A device event received from the device manager, waiting
+     * to be processed by the write worker.
+     */
+    struct DeviceEvent {
+      enum class Type : uint8_t {
+        Inserted,
+        Present,
+        Removed,
+        /* A batch of removed devices, see dmHookDevicesRemoved */
+        RemovedBatch,
+        /* All the devices found at startup, see dmHookDevicesPresent */
+        PresentBatch,
+        /* A late evaluation result, see matchDeviceWithDeadline */
+        Decided
+      };
+      Type type;
+      Pointer<Device> device;
+      PointerVector<Device> devices;
+      std::chrono::steady_clock::time_point queued;
+      /* Decided only */
+      Rule::Target timeout_target;
+      Pointer<Rule> matched_rule;
+      std::vector<USBInterfaceType> allowed_interfaces;
+      std::chrono::steady_clock::time_point started;
+    };
+
+    void queueDeviceEvent(DeviceEvent::Type type, Pointer<Device> device,
+                          PointerVector<Device> devices = PointerVector<Device>());
+    void queueDeviceEvent(DeviceEvent&& event);
+    void processDeviceEvents();
+    void processDeviceEvent(const DeviceEvent& event);
+    bool queueIPCRequest(qb_ipcs_connection_t *conn, const json& jobj);
+    std::string processIPCRequest(const json& jobj, IPCPrivate::WireFormat format,
+                                  const std::function<void(const json&)>& emit);
+    void queueIPCOutput(IPCOutput output);
+    void wakeLoop();
+    void flushIPCOutput();
+    bool onLoopThread() const;
+    void armIPCRetryTimer();
+    void retryIPCSends();
+
+    void qbIPCBroadcastJSON(const json& jobj, const Pointer<const Rule>& device_rule = nullptr);
+
+    /*
+     * Readiness: the daemon is ready once the devices present at
+     * startup were processed. waitForReady requests are answered
+     * right away when ready, otherwise they're held until then.
+     */
+    void waitForReady(qb_ipcs_connection_t *conn, const json& jobj);
+    void markReady();
+    void releaseReadyWaiters();
 
-    void allowDevice(uint32_t id, Pointer<const Rule> matched_rule);
-    void blockDevice(uint32_t id, Pointer<const Rule> matched_rule);
-    void rejectDevice(uint32_t id, Pointer<const Rule> matched_rule);
+    const std::vector<uint32_t> applyRuleOperations(const std::vector<RuleSet::Operation>& operations, bool store);
+    std::vector<RuleSet::Operation> ruleFileChanges(const String& rule_file);
+    std::vector<RuleSet::Operation> ruleChanges(const std::vector<Rule>& rules);
+    Pointer<PolicyBundle> readPolicyBundleUpdate(bool& delta);
+    void updatePolicyBundle(const Pointer<PolicyBundle>& bundle, bool delta);
+    /* Store the rule set after the rules `ids' were added, modified or removed */
+    void storeRules(const std::set<uint32_t>& ids);
+
+    /*
+     * The signals with the rule of the device they are about,
+     * used for filtering by the client subscriptions.
+     */
+    void signalDeviceInserted(const Pointer<const Rule>& device_rule,
+                              uint32_t id,
+                              const std::map<std::string,std::string>& attributes,
+                              const std::vector<USBInterfaceType>& interfaces,
+                              bool rule_match,
+                              uint32_t rule_id);
+    void signalDevicePresent(const Pointer<const Rule>& device_rule,
+                             uint32_t id,
+                             const std::map<std::string,std::string>& attributes,
+                             const std::vector<USBInterfaceType>& interfaces,
+                             Rule::Target target);
+    void signalDeviceRemoved(const Pointer<const Rule>& device_rule,
+                             uint32_t id,
+                             const std::map<std::string,std::string>& attributes);
+    void signalDevicesRemoved(const json& devices_json);
+    void signalDevicesPresent(const json& devices_json);
+    void signalDeviceAllowed(const Pointer<const Rule>& device_rule,
+                             uint32_t id,
+                             const std::map<std::string,std::string>& attributes,
+                             bool rule_match,
+                             uint32_t rule_id);
+    void signalDeviceBlocked(const Pointer<const Rule>& device_rule,
+                             uint32_t id,
+                             const std::map<std::string,std::string>& attributes,
+                             bool rule_match,
+                             uint32_t rule_id);
+    void signalDeviceRejected(const Pointer<const Rule>& device_rule,
+                              uint32_t id,
+                              const std::map<std::string,std::string>& attributes,
+                              bool rule_match,
+                              uint32_t rule_id);
+
+    using DecisionTime = std::chrono::steady_clock::time_point;
+
+    /*
+     * Time budget of the evaluation of an inserted device (zero if
+     * unlimited) and the target applied when it's exceeded. If
+     * `correct' is set, the result of the finished evaluation
+     * replaces the fallback target.
+     */
+    struct DecisionTimeout {
+      std::chrono::milliseconds timeout;
+      Rule::Target target;
+      bool correct;
+    };
+
+    /*
+     * The settings may be replaced by reloadConfiguration(), so
+     * each decision reads them once.
+     */
+    DecisionTimeout decisionTimeout();
+
+    Pointer<Rule> matchDevice(Pointer<const Rule> device_rule, std::vector<USBInterfaceType>& allowed_interfaces);
+    Pointer<Rule> matchDeviceWithDeadline(Pointer<Device> device, Pointer<const Rule> device_rule,
+                                          std::vector<USBInterfaceType>& allowed_interfaces, DecisionTime started,
+                                          const DecisionTimeout& decision_timeout);
+    void waitForPendingDecisions();
+    void allowDevice(uint32_t id, Pointer<const Rule> matched_rule, AuditLog::Event event, DecisionTime started,
+                     const std::vector<USBInterfaceType>& allowed_interfaces = std::vector<USBInterfaceType>());
+    void blockDevice(uint32_t id, Pointer<const Rule> matched_rule, AuditLog::Event event, DecisionTime started);
+    void rejectDevice(uint32_t id, Pointer<const Rule> matched_rule, AuditLog::Event event, DecisionTime started);
+    void signalDeviceTarget(Pointer<Device> device, Rule::Target target, Pointer<const Rule> matched_rule,
+                            AuditLog::Event event, DecisionTime started);
 
     Pointer<const Rule> upsertDeviceRule(uint32_t id, Rule::Target target, uint32_t timeout_sec);
+    /* The rules selected by the filter, except for its limit */
+    PointerVector<const Rule> selectRules(const RuleFilter& filter);
+    /* Throws if the rule set may not be modified over IPC (SealedPolicy) */
+    void checkPolicyMutable() const;
+    /* Save the rule set before it's modified by `method' */
+    void saveAutomaticSnapshot(const std::string& method);
+    RuleSet::Operation deviceRuleUpsert(uint32_t id, Rule::Target target);
+    void updateDeviceRuleExpiration(uint32_t rule_id, uint32_t timeout_sec);
+
+    void recordDeviceMatch(uint32_t id, uint32_t rule_id);
+    void forgetDeviceMatch(uint32_t id);
+    void reevaluateDevices(const std::vector<Rule>& changed_rules, const std::set<uint32_t>& changed_ids);
+
+    void processDeviceInserted(Pointer<Device> device, DecisionTime started);
+    void processDeviceDecided(const DeviceEvent& event);
+    void processDevicePresent(Pointer<Device> device, DecisionTime started);
+    void processDevicesPresent(const PointerVector<Device>& devices, DecisionTime started);
+    void processDeviceRemoved(Pointer<Device> device);
+    void processDevicesRemoved(const PointerVector<Device>& devices);
+
+    uint64_t recordStateChange(bool device, uint32_t id);
+    void ruleChanged(uint32_t id);
+
+    TimerWheel::Tick ruleTimerNow() const;
+    void scheduleRuleExpiration(uint32_t rule_id, uint32_t timeout_sec);
+    void cancelRuleExpiration(uint32_t rule_id);
+    void armRuleTimer();
+    void expireRules();
 
-    bool DACAuthenticateIPCConnection(uid_t uid, gid_t gid);
+    void startTrafficMonitor();
+    void stopTrafficMonitor();
+    void armTrafficTimer();
+    void reevaluateTrafficRules();
+
+    void startRuleStatistics();
+    void stopRuleStatistics();
+    void armRuleStatisticsTimer();
+
+    void scheduleConditionChanges();
+    void armConditionTimer();
+    void reevaluateTimedRules();
+
+    void startDBusExport();
+    void stopDBusExport();
+    String renderMetrics();
+
+    bool DACAuthenticateIPCConnection(uid_t uid, gid_t gid, bool& cacheable);
     void DACAddAllowedUID(uid_t uid);
     void DACAddAllowedGID(gid_t gid);
     void DACAddAllowedUID(const String& username);
     void DACAddAllowedGID(const String& groupname);
+    static uid_t DACLookupUID(const String& username);
+    static gid_t DACLookupGID(const String& groupname);
 
   private:
     ConfigFile _config;
+    String _config_path;
     RuleSet _ruleset;
+    /* Set if the rules are loaded from a RuleFolder */
+    Pointer<RuleFolder> _rule_folder;
+    /* Set if the rules are loaded from a PolicyBundleFile */
+    Pointer<PolicyBundle> _policy_bundle;
+    String _policy_bundle_key;
     Pointer<DeviceManager> _dm;
     qb_loop_t *_qb_loop;
     qb_ipcs_service_t *_qb_service;
+    enum qb_ipc_type _ipc_transport;
     
     /*
      * == Runtime parameters ==
@@ -166,11 +476,188 @@ namespace usbguard
     bool _ipc_dac_acl;
     std::vector<uid_t> _ipc_allowed_uids;
     std::vector<gid_t> _ipc_allowed_gids;
+    /* Cached ACL decisions, see qbIPCConnectionAllowed() */
+    struct IPCACLCacheEntry {
+      bool allowed;
+      std::chrono::steady_clock::time_point expires;
+    };
+    std::map<std::pair<uid_t,gid_t>, IPCACLCacheEntry> _ipc_acl_cache;
+    /* Guards the ACL, which may be replaced by reloadConfiguration() */
+    std::mutex _ipc_acl_mutex;
 
-    Rule::Target _implicit_policy_target;
-    PresentDevicePolicy _present_device_policy;
-    PresentDevicePolicy _present_controller_policy;
+    /*
+     * The settings below may be changed by reloadConfiguration()
+     * while the device events are processed.
+     */
+    std::atomic<Rule::Target> _implicit_policy_target;
+    DecisionTimeout _decision_timeout;
+    std::mutex _decision_timeout_mutex;
+    /* Evaluations running on the thread pool, see matchDeviceWithDeadline() */
+    size_t _decisions_pending;
+    std::mutex _decisions_mutex;
+    std::condition_variable _decisions_cv;
+    std::atomic<PresentDevicePolicy> _present_device_policy;
+    std::atomic<PresentDevicePolicy> _present_controller_policy;
+
+    std::atomic_bool _device_rules_with_port;
+    std::atomic_bool _sealed_policy;
+    bool _interface_authorization;
+    String _dbus_export_bus;
+    unsigned int _dbus_signal_coalesce_window_ms;
+
+    /*
+     * Binary log of the authorization decisions, see AuditLog.
+     * Opened by loadConfiguration() if AuditLogFile is set.
+     */
+    Pointer<AuditLog> _audit_log;
+
+    /*
+     * Prometheus metrics endpoint, see MetricsEndpoint.
+     * Opened by loadConfiguration() if MetricsEndpoint is set.
+     */
+    Pointer<MetricsEndpoint> _metrics_endpoint;
+
+    /*
+     * usbmon device read by the USB traffic monitor, empty if the
+     * traffic isn't monitored. While the monitor runs, the devices
+     * are re-evaluated against the rules with a usb-traffic-rate
+     * condition on every tick of the traffic timer.
+     */
+    String _usbmon_path;
+    qb_loop_timer_handle _traffic_timer_handle;
+    bool _traffic_timer_armed;
+
+    /*
+     * Saved rule usage counters, see RuleStatisticsFile. Opened
+     * by loadConfiguration() if RuleStatisticsFile is set. The
+     * counters are checkpointed every `_rule_statistics_interval_s'
+     * seconds and when the daemon stops.
+     */
+    Pointer<RuleStatisticsFile> _rule_statistics;
+    unsigned int _rule_statistics_interval_s;
+    qb_loop_timer_handle _rule_statistics_timer_handle;
+    bool _rule_statistics_timer_armed;
 
-    bool _device_rules_with_port;
+    /*
+     * == IPC request processing ==
+     *
+     * Method calls are processed off the loop thread. Read-only
+     * calls are served by a pool of workers and run concurrently.
+     * Calls which modify the rule set or the device state are
+     * served by a single worker in the order they were received.
+     * Replies and broadcasts produced by the workers are sent by
+     * the loop thread, because the libqb connection API isn't
+     * thread safe. The workers wake the loop using an eventfd.
+     */
+    IPCWorkerLane _ipc_read_lane;
+    IPCWorkerLane _ipc_write_lane;
+    /*
+     * Device events are passed from the device manager threads
+     * to the write worker through a lock-free queue, so that the
+     * device manager never waits for a method call to finish. The
+     * write worker processes them in the order they were queued,
+     * which keeps the events of each device in order, and before
+     * the queued method calls.
+     */
+    CCBQueue<DeviceEvent> _device_events;
+    std::deque<IPCOutput> _ipc_output;
+    std::mutex _ipc_output_mutex;
+    int _ipc_wakeup_fd;
+    std::thread::id _loop_thread_id;
+    qb_loop_timer_handle _ipc_retry_timer_handle;
+    bool _ipc_retry_timer_armed;
+    /* Number of open IPC connections, see dmHookDeviceHashRequired() */
+    std::atomic<size_t> _ipc_connections;
+    /* Bytes held by the pending messages and send buffers of the connections */
+    std::atomic<size_t> _ipc_buffer_bytes;
+
+    /*
+     * Scheduling of the threads on the device authorization path:
+     * the device manager threads and the write worker. The IPC read
+     * workers and the logging worker have their nice value raised by
+     * _background_nice instead.
+     */
+    ThreadScheduling _device_thread_scheduling;
+    int _background_nice;
+
+    /*
+     * Clients waiting for the daemon to become ready. Each one is
+     * referenced until it gets its reply, see waitForReady().
+     */
+    struct ReadyWaiter {
+      qb_ipcs_connection_t *conn;
+      uint64_t request_id;
+      IPCPrivate::WireFormat format;
+    };
+    bool _ready;
+    std::vector<ReadyWaiter> _ready_waiters;
+    std::mutex _ready_mutex;
+
+    /*
+     * Maps the id of each present device which was authorized
+     * by the rule set to the id of the rule that matched it.
+     */
+    std::map<uint32_t,uint32_t> _device_matches;
+    /* Devices with only some of their interfaces allowed */
+    std::set<uint32_t> _partially_allowed_devices;
+    std::mutex _device_matches_mutex;
+
+    /*
+     * Expiration times (in seconds) of temporary rules. The
+     * loop timer is armed only while some rule is scheduled
+     * and fires at the nearest tick the wheel cares about.
+     * The wheel may be updated by the IPC workers. The loop
+     * timer itself is only touched by the loop thread; the
+     * workers request re-arming it via `_rule_timer_rearm'.
+     */
+    TimerWheel _rule_timers;
+    std::mutex _rule_timers_mutex;
+    std::atomic_bool _rule_timer_rearm;
+    qb_loop_timer_handle _rule_timer_handle;
+    bool _rule_timer_armed;
+    TimerWheel::Tick _rule_timer_tick;
+
+    /*
+     * Next state change times of the time dependent rule conditions,
+     * e.g. localtime(...), keyed by the rule id. The loop timer fires
+     * at the nearest one and only the devices the due rules apply to
+     * are re-evaluated. The times are updated by scheduleConditionChanges()
+     * after the rules or their metadata change; due times which weren't
+     * processed yet are kept. The loop timer is handled like the rule
+     * expiration timer.
+     */
+    std::map<uint32_t, EvaluationClock::TimePoint> _condition_changes;
+    std::mutex _condition_changes_mutex;
+    std::atomic_bool _condition_timer_rearm;
+    qb_loop_timer_handle _condition_timer_handle;
+    bool _condition_timer_armed;
+    EvaluationClock::TimePoint _condition_timer_time;
+
+    /*
+     * Log of the device and rule changes for getChangesSince.
+     * Each change gets the next generation number. The counter
+     * starts at the daemon start time in microseconds, so that
+     * generations of a previous instance are older than any of
+     * the current one. Only the latest changes are remembered;
+     * `_state_log_floor' is the newest generation which isn't
+     * covered by the log anymore.
+     */
+    struct StateLogEntry {
+      uint64_t generation;
+      bool device;
+      uint32_t id;
+    };
+
+    std::deque<StateLogEntry> _state_log;
+    uint64_t _state_generation;
+    uint64_t _state_log_floor;
+    std::mutex _state_log_mutex;
+
+    /*
+     * D-Bus objects exported by the daemon, if enabled by the
+     * DBusExport setting. Defined only in builds with D-Bus.
+     */
+    struct DBusExport;
+    Pointer<DBusExport> _dbus_export;
   };
 } /* namespace usbguard */
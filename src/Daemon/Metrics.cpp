@@ -0,0 +1,529 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "Metrics.hpp"
+#include "LatencyStatistics.hpp"
+#include "LoggerPrivate.hpp"
+#include "Common/Utility.hpp"
+#include "Common/Tracepoints.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace usbguard
+{
+  const size_t Metrics::CounterCount;
+  const size_t Metrics::Buckets;
+
+  /*
+   * The IPC methods get their own histograms, anything else
+   * is counted as "other".
+   */
+  static const char * const ipc_methods[] = {
+    "appendRule",
+    "removeRule",
+    "listRules",
+    "getRuleStatistics",
+    "getLatencyStatistics",
+    "applyRuleBatch",
+    "allowDevice",
+    "blockDevice",
+    "rejectDevice",
+    "applyDevicePolicy",
+    "listDevices",
+    "listDevicesDetailed",
+    "listDeviceSubtree",
+    "listDeviceFields",
+    "getChangesSince",
+    "dumpDevices",
+    "reloadConfiguration",
+    "saveRuleSetSnapshot",
+    "listRuleSetSnapshots",
+    "rollbackRuleSet",
+    "setRuleGroupEnabled",
+    "simulatePolicy",
+    "explainDevice",
+    "suggestRules",
+    "getMetricsSnapshot",
+    "getMemoryStats",
+    "getStartupProfile",
+    "other"
+  };
+
+  static const size_t ipc_method_count = sizeof ipc_methods / sizeof ipc_methods[0];
+
+  static const struct {
+    const char *name;
+    const char *help;
+  } counter_info[Metrics::CounterCount] = {
+    { "usbguard_devices_inserted_total", "Devices inserted while the daemon was running." },
+    { "usbguard_devices_present_total", "Devices found present at startup." },
+    { "usbguard_devices_removed_total", "Devices removed." },
+    { "usbguard_decisions_allow_total", "Authorization decisions with the allow target." },
+    { "usbguard_decisions_block_total", "Authorization decisions with the block target." },
+    { "usbguard_decisions_reject_total", "Authorization decisions with the reject target." },
+    { "usbguard_ipc_connections_opened_total", "IPC connections opened." },
+    { "usbguard_ipc_connections_closed_total", "IPC connections closed." },
+    { "usbguard_ipc_send_failures_total", "IPC messages which failed to be sent." },
+    { "usbguard_ipc_short_sends_total", "IPC messages which were sent only partially." },
+    { "usbguard_ipc_lagging_clients_total", "IPC clients disconnected because they didn't keep up." },
+    { "usbguard_ipc_requests_throttled_total", "IPC requests rejected by the per-client admission control." },
+    { "usbguard_sysfs_write_failures_total", "Device targets which failed to be written to sysfs." },
+    { "usbguard_decision_timeouts_total", "Inserted devices which got the DecisionTimeoutTarget." }
+  };
+
+  /*
+   * The shards are allocated separately and padded, so that the
+   * counters of two threads never share a cache line.
+   */
+  struct MetricsShard
+  {
+    MetricsShard()
+    {
+      for (auto& counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+      }
+      for (size_t m = 0; m < ipc_method_count; ++m) {
+        ipc_count[m].store(0, std::memory_order_relaxed);
+        ipc_total_ns[m].store(0, std::memory_order_relaxed);
+        for (auto& bucket : ipc_histogram[m]) {
+          bucket.store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /* Only the owning thread writes, so add() doesn't need a locked instruction */
+    static void add(std::atomic<uint64_t>& value, uint64_t delta)
+    {
+      value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    char padding_head[64];
+    std::atomic<uint64_t> counters[Metrics::CounterCount];
+    std::atomic<uint64_t> ipc_count[ipc_method_count];
+    std::atomic<uint64_t> ipc_total_ns[ipc_method_count];
+    std::atomic<uint64_t> ipc_histogram[ipc_method_count][Metrics::Buckets];
+    char padding_tail[64];
+  };
+
+  /*
+   * The shards are never released, the counters of exited threads
+   * are still part of the totals.
+   */
+  static std::mutex shards_mutex;
+  static std::vector<std::unique_ptr<MetricsShard>> shards;
+  static thread_local MetricsShard *thread_shard = nullptr;
+
+  static MetricsShard& threadShard()
+  {
+    if (thread_shard == nullptr) {
+      std::unique_ptr<MetricsShard> shard(new MetricsShard());
+      std::unique_lock<std::mutex> lock(shards_mutex);
+      thread_shard = shard.get();
+      shards.push_back(std::move(shard));
+    }
+    return *thread_shard;
+  }
+
+  static size_t ipcMethodIndex(const std::string& method)
+  {
+    for (size_t m = 0; m < ipc_method_count - 1; ++m) {
+      if (method == ipc_methods[m]) {
+        return m;
+      }
+    }
+    return ipc_method_count - 1;
+  }
+
+  void Metrics::increment(Counter counter, uint64_t value)
+  {
+    MetricsShard::add(threadShard().counters[static_cast<size_t>(counter)], value);
+    return;
+  }
+
+  void Metrics::recordIPCRequest(const std::string& method, std::chrono::steady_clock::duration duration)
+  {
+    MetricsShard& shard = threadShard();
+    const size_t m = ipcMethodIndex(method);
+    const uint64_t nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    const uint64_t usec = nsec / 1000;
+    size_t bucket = 0;
+
+    while (bucket < Buckets - 1 && usec >= (uint64_t(1) << bucket)) {
+      ++bucket;
+    }
+
+    MetricsShard::add(shard.ipc_count[m], 1);
+    MetricsShard::add(shard.ipc_total_ns[m], nsec);
+    MetricsShard::add(shard.ipc_histogram[m][bucket], 1);
+    return;
+  }
+
+  Metrics::IPCRequestTimer::IPCRequestTimer(const std::string& method)
+    : _method(method),
+      _started(std::chrono::steady_clock::now())
+  {
+    USBGUARD_PROBE1(ipc_request_begin, _method.c_str());
+  }
+
+  Metrics::IPCRequestTimer::~IPCRequestTimer()
+  {
+    const auto duration = std::chrono::steady_clock::now() - _started;
+    USBGUARD_PROBE2(ipc_request_end, _method.c_str(),
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    recordIPCRequest(_method, duration);
+  }
+
+  uint64_t Metrics::read(Counter counter)
+  {
+    std::unique_lock<std::mutex> lock(shards_mutex);
+    uint64_t value = 0;
+
+    for (const auto& shard : shards) {
+      value += shard->counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+    }
+
+    return value;
+  }
+
+  void Metrics::read(MetricsSnapshot& snapshot)
+  {
+    uint64_t counters[CounterCount] = { 0 };
+    uint64_t ipc_count[ipc_method_count] = { 0 };
+
+    {
+      std::unique_lock<std::mutex> lock(shards_mutex);
+      for (const auto& shard : shards) {
+        for (size_t c = 0; c < CounterCount; ++c) {
+          counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+        }
+        for (size_t m = 0; m < ipc_method_count; ++m) {
+          ipc_count[m] += shard->ipc_count[m].load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    for (size_t c = 0; c < CounterCount; ++c) {
+      snapshot.counters[counter_info[c].name] = counters[c];
+    }
+    for (size_t m = 0; m < ipc_method_count; ++m) {
+      snapshot.ipc_requests[ipc_methods[m]] = ipc_count[m];
+    }
+
+    const uint64_t opened = counters[static_cast<size_t>(Counter::IPCConnectionsOpened)];
+    const uint64_t closed = counters[static_cast<size_t>(Counter::IPCConnectionsClosed)];
+    snapshot.gauges["ipc_clients"] = opened > closed ? opened - closed : 0;
+    return;
+  }
+
+  static void renderHeader(std::ostream& stream, const char *name, const char *type, const char *help)
+  {
+    stream << "# HELP " << name << ' ' << help << '\n';
+    stream << "# TYPE " << name << ' ' << type << '\n';
+  }
+
+  /*
+   * Write the bucket counts (non-cumulative, bucket `i' holds the
+   * values below 2^i microseconds) as a cumulative histogram.
+   */
+  static void renderHistogram(std::ostream& stream, const char *name, const String& labels,
+                              const std::vector<uint64_t>& buckets, uint64_t count, uint64_t total_ns)
+  {
+    const String separator = labels.empty() ? "" : ",";
+    uint64_t cumulative = 0;
+
+    for (size_t bucket = 0; bucket + 1 < buckets.size(); ++bucket) {
+      cumulative += buckets[bucket];
+      stream << name << "_bucket{" << labels << separator
+             << "le=\"" << (double(uint64_t(1) << bucket) / 1e6) << "\"} " << cumulative << '\n';
+    }
+
+    stream << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << count << '\n';
+    stream << name << "_sum{" << labels << "} " << (double(total_ns) / 1e9) << '\n';
+    stream << name << "_count{" << labels << "} " << count << '\n';
+  }
+
+  void Metrics::render(std::ostream& stream, const Gauges& gauges)
+  {
+    uint64_t counters[CounterCount] = { 0 };
+    uint64_t ipc_count[ipc_method_count] = { 0 };
+    uint64_t ipc_total_ns[ipc_method_count] = { 0 };
+    std::vector<std::vector<uint64_t>> ipc_histogram(ipc_method_count, std::vector<uint64_t>(Buckets, 0));
+
+    {
+      std::unique_lock<std::mutex> lock(shards_mutex);
+      for (const auto& shard : shards) {
+        for (size_t c = 0; c < CounterCount; ++c) {
+          counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+        }
+        for (size_t m = 0; m < ipc_method_count; ++m) {
+          ipc_count[m] += shard->ipc_count[m].load(std::memory_order_relaxed);
+          ipc_total_ns[m] += shard->ipc_total_ns[m].load(std::memory_order_relaxed);
+          for (size_t bucket = 0; bucket < Buckets; ++bucket) {
+            ipc_histogram[m][bucket] += shard->ipc_histogram[m][bucket].load(std::memory_order_relaxed);
+          }
+        }
+      }
+    }
+
+    for (size_t c = 0; c < CounterCount; ++c) {
+      renderHeader(stream, counter_info[c].name, "counter", counter_info[c].help);
+      stream << counter_info[c].name << ' ' << counters[c] << '\n';
+    }
+
+    const uint64_t opened = counters[static_cast<size_t>(Counter::IPCConnectionsOpened)];
+    const uint64_t closed = counters[static_cast<size_t>(Counter::IPCConnectionsClosed)];
+
+    renderHeader(stream, "usbguard_ipc_clients", "gauge", "Connected IPC clients.");
+    stream << "usbguard_ipc_clients " << (opened > closed ? opened - closed : 0) << '\n';
+    renderHeader(stream, "usbguard_rules", "gauge", "Rules in the rule set.");
+    stream << "usbguard_rules " << gauges.rules << '\n';
+    renderHeader(stream, "usbguard_devices", "gauge", "Devices known to the daemon.");
+    stream << "usbguard_devices " << gauges.devices << '\n';
+    renderHeader(stream, "usbguard_usbmon_events_total", "counter", "Events processed by the USB traffic monitor.");
+    stream << "usbguard_usbmon_events_total " << gauges.usbmon_events << '\n';
+    renderHeader(stream, "usbguard_usbmon_dropped_total", "counter", "Events dropped by usbmon because the ring buffer was full.");
+    stream << "usbguard_usbmon_dropped_total " << gauges.usbmon_dropped << '\n';
+
+    renderHeader(stream, "usbguard_ipc_request_duration_seconds", "histogram",
+                 "Time spent processing IPC method calls.");
+    for (size_t m = 0; m < ipc_method_count; ++m) {
+      renderHistogram(stream, "usbguard_ipc_request_duration_seconds",
+                      String("method=\"") + ipc_methods[m] + "\"",
+                      ipc_histogram[m], ipc_count[m], ipc_total_ns[m]);
+    }
+
+    renderHeader(stream, "usbguard_stage_duration_seconds", "histogram",
+                 "Time spent in the stages of the device authorization path.");
+    for (const auto& statistics : LatencyStatistics::get()) {
+      renderHistogram(stream, "usbguard_stage_duration_seconds",
+                      "stage=\"" + LatencyStatistics::stageToString(statistics.stage) + "\"",
+                      statistics.histogram, statistics.count, statistics.total_ns);
+    }
+
+    if (LatencyStatistics::countsAllocations()) {
+      const auto latency = LatencyStatistics::get();
+
+      renderHeader(stream, "usbguard_stage_allocations_total", "counter",
+                   "Heap allocations made in the stages of the device authorization path.");
+      for (const auto& statistics : latency) {
+        stream << "usbguard_stage_allocations_total{stage=\"" << LatencyStatistics::stageToString(statistics.stage)
+               << "\"} " << statistics.allocations << '\n';
+      }
+      renderHeader(stream, "usbguard_stage_allocated_bytes_total", "counter",
+                   "Bytes requested by the heap allocations of the stages.");
+      for (const auto& statistics : latency) {
+        stream << "usbguard_stage_allocated_bytes_total{stage=\"" << LatencyStatistics::stageToString(statistics.stage)
+               << "\"} " << statistics.allocated_bytes << '\n';
+      }
+    }
+
+    return;
+  }
+
+  MetricsEndpoint::MetricsEndpoint(const String& endpoint, std::function<String()> render)
+    : _render(render),
+      _listen_fd(-1),
+      _wakeup_fd(-1)
+  {
+    if (endpoint.compare(0, 5, "unix:") == 0) {
+      _unix_path = endpoint.substr(5);
+
+      struct sockaddr_un address;
+      std::memset(&address, 0, sizeof address);
+      address.sun_family = AF_UNIX;
+
+      if (_unix_path.empty() || _unix_path.size() >= sizeof address.sun_path) {
+        throw std::runtime_error("MetricsEndpoint: invalid socket path");
+      }
+      std::memcpy(address.sun_path, _unix_path.c_str(), _unix_path.size());
+
+      _listen_fd = ::socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+      if (_listen_fd < 0) {
+        throw std::runtime_error(String("MetricsEndpoint: socket: ") + strerror(errno));
+      }
+      ::unlink(_unix_path.c_str());
+      if (::bind(_listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof address) != 0) {
+        const int saved_errno = errno;
+        ::close(_listen_fd);
+        throw std::runtime_error("MetricsEndpoint: cannot bind " + _unix_path + ": " + strerror(saved_errno));
+      }
+    }
+    else if (endpoint.compare(0, 4, "tcp:") == 0) {
+      const uint16_t port = stringToNumber<uint16_t>(endpoint.substr(4));
+
+      struct sockaddr_in address;
+      std::memset(&address, 0, sizeof address);
+      address.sin_family = AF_INET;
+      address.sin_port = htons(port);
+      /* Only local scrapers, the endpoint has no access control */
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+      _listen_fd = ::socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+      if (_listen_fd < 0) {
+        throw std::runtime_error(String("MetricsEndpoint: socket: ") + strerror(errno));
+      }
+      const int reuse = 1;
+      ::setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+      if (::bind(_listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof address) != 0) {
+        const int saved_errno = errno;
+        ::close(_listen_fd);
+        throw std::runtime_error("MetricsEndpoint: cannot bind port " + numberToString(port) + ": " + strerror(saved_errno));
+      }
+    }
+    else {
+      throw std::runtime_error("MetricsEndpoint: invalid endpoint: " + endpoint);
+    }
+
+    if (::listen(_listen_fd, 16) != 0) {
+      const int saved_errno = errno;
+      ::close(_listen_fd);
+      throw std::runtime_error(String("MetricsEndpoint: listen: ") + strerror(saved_errno));
+    }
+
+    _wakeup_fd = ::eventfd(0, EFD_CLOEXEC);
+    if (_wakeup_fd < 0) {
+      const int saved_errno = errno;
+      ::close(_listen_fd);
+      throw std::runtime_error(String("MetricsEndpoint: eventfd: ") + strerror(saved_errno));
+    }
+  }
+
+  MetricsEndpoint::~MetricsEndpoint()
+  {
+    stop();
+    ::close(_wakeup_fd);
+    ::close(_listen_fd);
+    if (!_unix_path.empty()) {
+      ::unlink(_unix_path.c_str());
+    }
+  }
+
+  void MetricsEndpoint::start()
+  {
+    if (!_thread.joinable()) {
+      _thread = std::thread(&MetricsEndpoint::thread, this);
+    }
+    return;
+  }
+
+  void MetricsEndpoint::stop()
+  {
+    if (_thread.joinable()) {
+      const uint64_t one = 1;
+      if (::write(_wakeup_fd, &one, sizeof one) != sizeof one) {
+        logger->warn("MetricsEndpoint: cannot wake up the endpoint thread: {}", strerror(errno));
+      }
+      _thread.join();
+    }
+    return;
+  }
+
+  void MetricsEndpoint::thread()
+  {
+    struct pollfd fds[2];
+
+    fds[0].fd = _listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = _wakeup_fd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+      fds[0].revents = 0;
+      fds[1].revents = 0;
+
+      if (::poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        logger->error("MetricsEndpoint: poll failed: {}", strerror(errno));
+        return;
+      }
+      if (fds[1].revents != 0) {
+        return;
+      }
+      if (fds[0].revents & POLLIN) {
+        const int client_fd = ::accept(_listen_fd, nullptr, nullptr);
+        if (client_fd >= 0) {
+          serve(client_fd);
+          ::close(client_fd);
+        }
+      }
+    }
+  }
+
+  void MetricsEndpoint::serve(int client_fd)
+  {
+    /*
+     * A stalled client must not hold the endpoint for long. The
+     * request itself isn't interpreted, every request gets the
+     * metrics.
+     */
+    struct timeval timeout = { 1, 0 };
+    ::setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    ::setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+    char request[4096];
+    if (::recv(client_fd, request, sizeof request, 0) <= 0) {
+      return;
+    }
+
+    String body;
+    try {
+      body = _render();
+    }
+    catch(const std::exception& ex) {
+      logger->error("MetricsEndpoint: cannot render the metrics: {}", ex.what());
+      return;
+    }
+
+    const String response = \
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+      "Content-Length: " + numberToString(body.size()) + "\r\n"
+      "Connection: close\r\n"
+      "\r\n" + body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+      const ssize_t rc = ::send(client_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (rc <= 0) {
+        if (rc < 0 && errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      sent += rc;
+    }
+    return;
+  }
+} /* namespace usbguard */
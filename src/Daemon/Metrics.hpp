@@ -0,0 +1,145 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include "Typedefs.hpp"
+#include "MetricsSnapshot.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace usbguard
+{
+  /*
+   * Daemon counters for the metrics endpoint.
+   *
+   * Every thread updates its own cache line aligned shard of
+   * counters, so recording an event is a relaxed load and store
+   * without any lock or contended atomic operation. The shards are
+   * summed up when the metrics are rendered.
+   */
+  class Metrics
+  {
+  public:
+    enum class Counter : size_t {
+      DevicesInserted = 0,
+      DevicesPresent,
+      DevicesRemoved,
+      DecisionsAllow,
+      DecisionsBlock,
+      DecisionsReject,
+      IPCConnectionsOpened,
+      IPCConnectionsClosed,
+      IPCSendFailures,
+      IPCShortSends,
+      IPCLaggingClients,
+      IPCRequestsThrottled,
+      SysfsWriteFailures,
+      DecisionTimeouts,
+      Count
+    };
+
+    static const size_t CounterCount = static_cast<size_t>(Counter::Count);
+
+    /*
+     * Bucket `i' of the IPC request histograms counts the requests
+     * which took less than 2^i microseconds.
+     */
+    static const size_t Buckets = 20;
+
+    /*
+     * Values which are read at render time instead of being counted.
+     */
+    struct Gauges
+    {
+      uint64_t rules;
+      uint64_t devices;
+      uint64_t usbmon_events; /**< Events processed by the USB traffic monitor */
+      uint64_t usbmon_dropped; /**< Events dropped by usbmon */
+    };
+
+    static void increment(Counter counter, uint64_t value = 1);
+    static void recordIPCRequest(const std::string& method, std::chrono::steady_clock::duration duration);
+    static uint64_t read(Counter counter);
+
+    /*
+     * Fill in the counters, the IPC request counts and the number
+     * of connected IPC clients.
+     */
+    static void read(MetricsSnapshot& snapshot);
+
+    /*
+     * Write all the metrics in the Prometheus text exposition format.
+     */
+    static void render(std::ostream& stream, const Gauges& gauges);
+
+    /*
+     * Records the lifetime of the instance as the duration of an
+     * IPC method call, also when the call throws.
+     */
+    class IPCRequestTimer
+    {
+    public:
+      IPCRequestTimer(const std::string& method);
+      ~IPCRequestTimer();
+
+    private:
+      const std::string& _method;
+      const std::chrono::steady_clock::time_point _started;
+    };
+  };
+
+  /*
+   * Serves the rendered metrics over HTTP from a dedicated thread,
+   * either on a Unix socket or on a localhost TCP port:
+   *
+   *   unix:<path>
+   *   tcp:<port>
+   *
+   * Each request is answered with the current metrics and the
+   * connection is closed.
+   */
+  class MetricsEndpoint
+  {
+  public:
+    MetricsEndpoint(const String& endpoint, std::function<String()> render);
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    const MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    void start();
+    void stop();
+
+  private:
+    void thread();
+    void serve(int client_fd);
+
+    const std::function<String()> _render;
+    String _unix_path;
+    int _listen_fd;
+    int _wakeup_fd;
+    std::thread _thread;
+  };
+} /* namespace usbguard */
@@ -22,6 +22,8 @@
 
 #include "LoggerPrivate.hpp"
 #include "Daemon.hpp"
+#include "USBTrafficMonitor.hpp"
+#include "StartupProfile.hpp"
 #include "Common/Utility.hpp"
 
 #include <iostream>
@@ -32,6 +34,7 @@
 # include <errno.h>
 # include <sys/resource.h>
 # include <sys/socket.h>
+# include <sys/eventfd.h>
 # include <linux/netlink.h>
 # include <sys/mman.h>
 # if defined(HAVE_LIBCAPNG)
@@ -156,6 +159,7 @@ int main(int argc, char *argv[])
   /* Start the daemon */
   int ret = EXIT_SUCCESS;
   try {
+    usbguard::StartupProfile::start();
     usbguard::Daemon daemon;
     if (!conf_file.empty()) {
       daemon.loadConfiguration(conf_file);
@@ -172,7 +176,7 @@ int main(int argc, char *argv[])
 #if defined(HAVE_SECCOMP)
  static void setupSeccompWhitelist(void)
  {
-   logger->debug("Applying seccomp whitelist");
+   USBGUARD_LOG_DEBUG("Applying seccomp whitelist");
    /* TODO: Use SCMP_ACT_TRAP. Switch to EACCES for 1.x releases */
    scmp_filter_ctx ctx = seccomp_init(/*SCMP_ACT_ERRNO(EACCES)*/SCMP_ACT_TRAP);
 
@@ -201,6 +205,9 @@ int main(int argc, char *argv[])
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(stat), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(readlink), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(access), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(rename), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fsync), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(fchmod), 0);
 
    /* memory */
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(brk), 0);
@@ -220,6 +227,12 @@ int main(int argc, char *argv[])
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clock_gettime), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clock_getres), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(gettid), 0);
+   /* Lowered priority of the IPC read workers */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(getpriority), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(setpriority), 0);
+   /* DeviceThreadCPUs, DeviceThreadScheduling */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(sched_setaffinity), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(sched_setscheduler), 0);
 
    /* epoll */
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(epoll_create1), 0);
@@ -236,6 +249,17 @@ int main(int argc, char *argv[])
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(futex), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit_group), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(set_robust_list), 0);
+   /* IPC worker threads: thread exit and stack release */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(madvise), 0);
+   /* Asynchronous logging worker: idle backoff */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(sched_yield), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(nanosleep), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clock_nanosleep), 0);
+#if defined(__SNR_clone3)
+   /* Make glibc fall back to clone */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOSYS), SCMP_SYS(clone3), 0);
+#endif
 
    /* STRACE:
     *  getrlimit(RLIMIT_NOFILE, {rlim_cur=1024, rlim_max=4*1024}) = 0
@@ -253,6 +277,13 @@ int main(int argc, char *argv[])
 			   SCMP_A0(SCMP_CMP_EQ, 0),
 			   SCMP_A1(SCMP_CMP_EQ, 0));
 
+   /* STRACE (metrics endpoint wakeup):
+    *  eventfd2(0, EFD_CLOEXEC)
+    */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(eventfd2), 2,
+			   SCMP_A0(SCMP_CMP_EQ, 0),
+			   SCMP_A1(SCMP_CMP_EQ, EFD_CLOEXEC));
+
    /* socket */
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(socket), 1,
 			   SCMP_A0(SCMP_CMP_EQ, PF_LOCAL),
@@ -262,6 +293,11 @@ int main(int argc, char *argv[])
 			   SCMP_A0(SCMP_CMP_EQ, PF_NETLINK),
 			   SCMP_A2(SCMP_CMP_EQ, NETLINK_KOBJECT_UEVENT));
 
+   /* Service manager readiness notification (NOTIFY_SOCKET) */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(socket), 2,
+			   SCMP_A0(SCMP_CMP_EQ, PF_LOCAL),
+			   SCMP_A1(SCMP_CMP_MASKED_EQ, 0xf, SOCK_DGRAM));
+
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(bind), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(accept), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(listen), 0);
@@ -273,6 +309,24 @@ int main(int argc, char *argv[])
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(select), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(connect), 0);
    ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(getsockname), 0);
+   /* Metrics endpoint: tcp:<port> listens on the loopback address */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(socket), 2,
+			   SCMP_A0(SCMP_CMP_EQ, AF_INET),
+			   SCMP_A1(SCMP_CMP_MASKED_EQ, 0xf, SOCK_STREAM));
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(poll), 0);
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ppoll), 0);
+
+   /* USB traffic monitor: usbmon ring buffer */
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ioctl), 1,
+			   SCMP_A1(SCMP_CMP_EQ, USBMON_IOCX_MFETCH));
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ioctl), 1,
+			   SCMP_A1(SCMP_CMP_EQ, USBMON_IOCH_MFLUSH));
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ioctl), 1,
+			   SCMP_A1(SCMP_CMP_EQ, USBMON_IOCG_STATS));
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ioctl), 1,
+			   SCMP_A1(SCMP_CMP_EQ, USBMON_IOCT_RING_SIZE));
+   ret |= seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ioctl), 1,
+			   SCMP_A1(SCMP_CMP_EQ, USBMON_IOCQ_RING_SIZE));
 
 #if defined(HAVE_LIBCAPNG)
    /* capabilities */
@@ -307,7 +361,7 @@ int main(int argc, char *argv[])
 #if defined(HAVE_LIBCAPNG)
  static void setupCapabilities(void)
  {
-   logger->debug("Dropping capabilities");
+   USBGUARD_LOG_DEBUG("Dropping capabilities");
    capng_clear(CAPNG_SELECT_BOTH);
    capng_updatev(CAPNG_ADD, (capng_type_t)(CAPNG_EFFECTIVE|CAPNG_PERMITTED),
 		 CAP_CHOWN, CAP_FOWNER,-1);
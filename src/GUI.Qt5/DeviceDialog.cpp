@@ -33,7 +33,7 @@ DeviceDialog::DeviceDialog(quint32 id, QWidget *parent) :
   setWindowFlags(Qt::CustomizeWindowHint|Qt::WindowStaysOnTopHint);
   connect(&timer, SIGNAL(timeout()), this, SLOT(timerUpdate()));
 
-  device_id = id;
+  device_ids.append(id);
 
   setDecisionMethod(DecisionMethod::Buttons);
   setDefaultDecisionTimeout(23);
@@ -53,12 +53,14 @@ DeviceDialog::DeviceDialog(quint32 id, QWidget *parent) :
 
 void DeviceDialog::setName(const QString& name)
 {
+  _name = name;
   ui->name_label->setText(name);
 }
 
 void DeviceDialog::setDeviceID(const QString& vendor_id, const QString& product_id)
 {
-  ui->deviceid_label->setText(QString("%1:%2").arg(vendor_id).arg(product_id));
+  _device_id = QString("%1:%2").arg(vendor_id).arg(product_id);
+  ui->deviceid_label->setText(_device_id);
 }
 
 void DeviceDialog::setSerial(const QString &serial)
@@ -84,6 +86,22 @@ void DeviceDialog::setInterfaceTypes(const std::vector<usbguard::USBInterfaceTyp
   }
 }
 
+void DeviceDialog::addDevice(quint32 id, const QString& name, const QString& vendor_id, const QString& product_id)
+{
+  if (device_ids.size() == 1) {
+    /* Replace the details of the first device with the device list */
+    ui->interface_list->clear();
+    ui->interface_list->addItem(QString("%1 %2").arg(_device_id).arg(_name));
+    ui->serial_label->clear();
+    ui->deviceid_label->clear();
+    setWindowTitle(QString(tr("USB Devices Inserted")));
+  }
+
+  device_ids.append(id);
+  ui->interface_list->addItem(QString("%1:%2 %3").arg(vendor_id).arg(product_id).arg(name));
+  ui->name_label->setText(QString(tr("%1 devices")).arg(device_ids.size()));
+}
+
 void DeviceDialog::setDefaultDecision(usbguard::Rule::Target target)
 {
   switch(target)
@@ -234,19 +252,25 @@ DeviceDialog::~DeviceDialog()
 
 void DeviceDialog::on_allow_button_clicked()
 {
-  emit allowed(device_id, ui->permanent_checkbox->isChecked());
+  for (auto id : device_ids) {
+    emit allowed(id, ui->permanent_checkbox->isChecked());
+  }
   accept();
 }
 
 void DeviceDialog::on_block_button_clicked()
 {
-  emit blocked(device_id, ui->permanent_checkbox->isChecked());
+  for (auto id : device_ids) {
+    emit blocked(id, ui->permanent_checkbox->isChecked());
+  }
   accept();
 }
 
 void DeviceDialog::on_reject_button_clicked()
 {
-  emit rejected(device_id, ui->permanent_checkbox->isChecked());
+  for (auto id : device_ids) {
+    emit rejected(id, ui->permanent_checkbox->isChecked());
+  }
   accept();
 }
 
@@ -20,6 +20,7 @@
 
 #include <QDialog>
 #include <QTimer>
+#include <QList>
 #include <USB.hpp>
 #include <Rule.hpp>
 
@@ -45,6 +46,12 @@ public:
   void setDeviceID(const QString& vendor_id, const QString& product_id);
   void setInterfaceTypes(const std::vector<usbguard::USBInterfaceType>& interfaces);
 
+  /*
+   * Add another device to the dialog. The dialog then shows a list
+   * of the devices and the decision applies to all of them.
+   */
+  void addDevice(quint32 id, const QString& name, const QString& vendor_id, const QString& product_id);
+
   void setDefaultDecision(usbguard::Rule::Target target);
   void setDefaultDecisionTimeout(quint32 seconds);
   void setDecisionMethod(DecisionMethod method);
@@ -87,7 +94,7 @@ private:
   QTimer timer;
   int time_left;
 
-  quint32 device_id;
+  QList<quint32> device_ids;
 
   QString _name;
   QString _serial;
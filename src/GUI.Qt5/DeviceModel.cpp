@@ -329,20 +329,24 @@ Qt::ItemFlags DeviceModel::flags(const QModelIndex &index) const
 void DeviceModel::insertDevice(const usbguard::Rule &device_rule)
 {
   const uint32_t device_id = device_rule.getRuleID();
+
+  if (containsDevice(device_id)) {
+    updateDeviceTarget(device_id, device_rule.getTarget());
+    return;
+  }
+
   const QString device_hash = QString::fromStdString(device_rule.getHash());
   const QString parent_hash = QString::fromStdString(device_rule.getParentHash());
 
   DeviceModelItem* parent_item = _hash_map.value(parent_hash, _root_item);
   DeviceModelItem* child_item = new DeviceModelItem(device_rule, parent_item);
 
-  layoutAboutToBeChanged();
-  beginInsertRows(createIndex(parent_item->row(), 0, parent_item),
+  beginInsertRows(createItemIndex(parent_item),
                   parent_item->childCount(), parent_item->childCount());
   parent_item->appendChild(child_item);
   _hash_map.insert(device_hash, child_item);
   _id_map.insert(device_id, child_item);
   endInsertRows();
-  layoutChanged();
 }
 
 void DeviceModel::updateDeviceTarget(quint32 device_id, usbguard::Rule::Target target)
@@ -355,8 +359,8 @@ void DeviceModel::updateDeviceTarget(quint32 device_id, usbguard::Rule::Target t
 
   if (item->getDeviceTarget() != target) {
     item->setDeviceTarget(target);
-    emit dataChanged(createIndex(item->row(), 0, item),
-                     createIndex(item->row(), item->columnCount() - 1, item),
+    emit dataChanged(createItemIndex(item),
+                     createItemIndex(item, item->columnCount() - 1),
                      QVector<int>() << Qt::DisplayRole);
   }
 }
@@ -365,8 +369,8 @@ void DeviceModel::updateRequestedTarget(DeviceModelItem *item, usbguard::Rule::T
 {
   if (item->getRequestedTarget() != target) {
     item->setRequestedTarget(target);
-    emit dataChanged(createIndex(item->row(), 0, item),
-                     createIndex(item->row(), item->columnCount() - 1, item),
+    emit dataChanged(createItemIndex(item),
+                     createItemIndex(item, item->columnCount() - 1),
                      QVector<int>() << Qt::DisplayRole);
   }
 }
@@ -379,7 +383,7 @@ void DeviceModel::removeDevice(quint32 device_id)
     return;
   }
   else {
-    removeDevice(item);
+    removeDevice(item, /*notify=*/true);
   }
 }
 
@@ -390,27 +394,43 @@ void DeviceModel::removeDevice(DeviceModelItem* item, bool notify) {
     return;
   }
 
+  /*
+   * Removing the row removes the whole subtree of the item
+   * from the views, so the children don't need their own
+   * notifications.
+   */
   if (notify) {
-    layoutAboutToBeChanged();
-    beginRemoveRows(createIndex(parent_item->row(), 0, parent_item), item->row(), item->row());
-  }
-
-  while (item->childCount() > 0) {
-    removeDevice(item->child(0), notify);
+    const int row = item->row();
+    beginRemoveRows(createItemIndex(parent_item), row, row);
   }
 
-  _hash_map.remove(item->getDeviceHash());
-  _id_map.remove(item->getDeviceID());
+  forgetDevice(item);
+  parent_item->removeChild(item);
 
   if (notify) {
     endRemoveRows();
-    layoutChanged();
   }
 
-  parent_item->removeChild(item);
   delete item;
 }
 
+void DeviceModel::forgetDevice(DeviceModelItem* item)
+{
+  for (int row = 0; row < item->childCount(); ++row) {
+    forgetDevice(item->child(row));
+  }
+  _hash_map.remove(item->getDeviceHash());
+  _id_map.remove(item->getDeviceID());
+}
+
+QModelIndex DeviceModel::createItemIndex(DeviceModelItem* item, int column) const
+{
+  if (item == _root_item) {
+    return QModelIndex();
+  }
+  return createIndex(item->row(), column, item);
+}
+
 bool DeviceModel::containsDevice(quint32 device_id) const
 {
   return _id_map.count(device_id) > 0;
@@ -93,6 +93,9 @@ public:
   void clear();
 
 private:
+  QModelIndex createItemIndex(DeviceModelItem* item, int column = 0) const;
+  void forgetDevice(DeviceModelItem* item);
+
   QMap<QString, DeviceModelItem*> _hash_map;
   QMap<uint32_t, DeviceModelItem*> _id_map;
   DeviceModelItem *_root_item;
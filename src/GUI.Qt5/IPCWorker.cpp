@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "IPCWorker.h"
+
+IPCWorker::IPCWorker(usbguard::IPCClient& ipc, QObject *parent)
+  : QObject(parent),
+    _ipc(ipc)
+{
+}
+
+/*
+ * Runs the request and reports a failure with requestFailed().
+ * Returns true if the request succeeded.
+ */
+template<typename Request>
+bool IPCWorker::call(const char *method, Request request)
+{
+  try {
+    request();
+    return true;
+  }
+  catch(const usbguard::IPCException& ex) {
+    emit requestFailed(method, QString("%1: %2")
+                       .arg(QString::fromStdString(ex.codeAsString()))
+                       .arg(QString::fromStdString(ex.message())));
+  }
+  catch(const std::exception& ex) {
+    emit requestFailed(method, QString("std::exception: %1")
+                       .arg(QString::fromStdString(ex.what())));
+  }
+  return false;
+}
+
+void IPCWorker::loadDevices()
+{
+  usbguard::Interface::StateChanges changes;
+
+  const bool loaded = call("listDevices", [&]() {
+    /*
+     * Get the generation before listing the devices, so that
+     * changes made meanwhile are picked up by the next sync.
+     */
+    changes.generation = _ipc.getChangesSince(0).generation;
+    changes.complete = true;
+    for (auto const& device_rule : _ipc.listDevices()) {
+      changes.devices.push_back({ device_rule.getRuleID(), false, device_rule });
+    }
+  });
+
+  if (loaded) {
+    emit devicesLoaded(changes);
+  }
+}
+
+void IPCWorker::syncDevices(quint64 generation)
+{
+  usbguard::Interface::StateChanges changes;
+
+  if (call("getChangesSince", [&]() { changes = _ipc.getChangesSince(generation); })) {
+    emit devicesSynced(changes);
+  }
+}
+
+void IPCWorker::allowDevice(quint32 id, bool permanent)
+{
+  call("allowDevice", [&]() { _ipc.allowDevice(id, permanent, 0); });
+}
+
+void IPCWorker::blockDevice(quint32 id, bool permanent)
+{
+  call("blockDevice", [&]() { _ipc.blockDevice(id, permanent, 0); });
+}
+
+void IPCWorker::rejectDevice(quint32 id, bool permanent)
+{
+  call("rejectDevice", [&]() { _ipc.rejectDevice(id, permanent, 0); });
+}
+
+void IPCWorker::applyDevicePolicy(const std::vector<usbguard::Interface::DeviceTarget>& targets, bool permanent)
+{
+  call("applyDevicePolicy", [&]() { _ipc.applyDevicePolicy(targets, permanent, 0); });
+}
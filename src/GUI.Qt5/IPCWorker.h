@@ -0,0 +1,61 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#ifndef IPCWORKER_H
+#define IPCWORKER_H
+
+#include <QObject>
+#include <QString>
+#include <IPCClient.hpp>
+
+/*
+ * Issues the blocking IPC requests of the applet. The worker is
+ * moved to its own thread, the requests are made by connecting
+ * signals to its slots and the results are delivered as queued
+ * signals to the GUI thread, so that a busy daemon doesn't freeze
+ * the user interface.
+ */
+class IPCWorker : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit IPCWorker(usbguard::IPCClient& ipc, QObject *parent = 0);
+
+public slots:
+  void loadDevices();
+  void syncDevices(quint64 generation);
+  void allowDevice(quint32 id, bool permanent);
+  void blockDevice(quint32 id, bool permanent);
+  void rejectDevice(quint32 id, bool permanent);
+  void applyDevicePolicy(const std::vector<usbguard::Interface::DeviceTarget>& targets, bool permanent);
+
+signals:
+  /* All the devices, as changes since generation 0 */
+  void devicesLoaded(const usbguard::Interface::StateChanges& changes);
+  void devicesSynced(const usbguard::Interface::StateChanges& changes);
+  void requestFailed(const QString& method, const QString& message);
+
+private:
+  template<typename Request>
+  bool call(const char *method, Request request);
+
+  usbguard::IPCClient& _ipc;
+};
+
+#endif // IPCWORKER_H
@@ -34,12 +34,41 @@
 #include <QCheckBox>
 #include <QTreeView>
 #include <QShortcut>
+#include <QStringList>
+
+/*
+ * Bounds of the IPC reconnection delay. The delay doubles with
+ * each failed attempt and a random jitter of up to a quarter of
+ * the delay is applied, so that the clients of a restarted
+ * daemon don't all reconnect at the same time.
+ */
+static const int G_ipc_retry_interval_min_ms = 1000;
+static const int G_ipc_retry_interval_max_ms = 30000;
+
+/*
+ * Events received within this window (e.g. when a hub or a docking
+ * station is connected) are shown in one device dialog and one tray
+ * notification.
+ */
+static const int G_aggregation_window_ms = 300;
+static const int G_notification_lines_max = 5;
+
+/*
+ * Number of device changes applied to the model in one pass of
+ * the event loop.
+ */
+static const int G_device_changes_batch = 64;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
+    _ipc_retry_interval(G_ipc_retry_interval_min_ms),
     _settings("USBGuard", "usbguard-applet-qt"),
-    _device_model(this)
+    _device_model(this),
+    _device_generation(0),
+    _ipc_worker(new IPCWorker(*this)),
+    _device_request_active(false),
+    _device_sync_queued(false)
 {
   /*
    * Seed the pseudo-random generator. We use it for
@@ -70,10 +99,53 @@ MainWindow::MainWindow(QWidget *parent) :
 
   qRegisterMetaType<std::map<std::string, std::string> >("std::map<std::string, std::string>");
   qRegisterMetaType<std::vector<usbguard::USBInterfaceType> >("std::vector<usbguard::USBInterfaceType>");
+  qRegisterMetaType<std::vector<usbguard::Interface::DeviceTarget> >("std::vector<usbguard::Interface::DeviceTarget>");
+  qRegisterMetaType<usbguard::Interface::StateChanges>("usbguard::Interface::StateChanges");
+
+  _ipc_worker->moveToThread(&_ipc_thread);
+  QObject::connect(&_ipc_thread, SIGNAL(finished()),
+                   _ipc_worker, SLOT(deleteLater()));
+
+  QObject::connect(this, SIGNAL(ipcLoadDevices()),
+                   _ipc_worker, SLOT(loadDevices()));
+  QObject::connect(this, SIGNAL(ipcSyncDevices(quint64)),
+                   _ipc_worker, SLOT(syncDevices(quint64)));
+  QObject::connect(this, SIGNAL(ipcAllowDevice(quint32, bool)),
+                   _ipc_worker, SLOT(allowDevice(quint32, bool)));
+  QObject::connect(this, SIGNAL(ipcBlockDevice(quint32, bool)),
+                   _ipc_worker, SLOT(blockDevice(quint32, bool)));
+  QObject::connect(this, SIGNAL(ipcRejectDevice(quint32, bool)),
+                   _ipc_worker, SLOT(rejectDevice(quint32, bool)));
+  QObject::connect(this, SIGNAL(ipcApplyDevicePolicy(const std::vector<usbguard::Interface::DeviceTarget>&, bool)),
+                   _ipc_worker, SLOT(applyDevicePolicy(const std::vector<usbguard::Interface::DeviceTarget>&, bool)));
+
+  QObject::connect(_ipc_worker, SIGNAL(devicesLoaded(const usbguard::Interface::StateChanges&)),
+                   this, SLOT(handleDevicesLoaded(const usbguard::Interface::StateChanges&)));
+  QObject::connect(_ipc_worker, SIGNAL(devicesSynced(const usbguard::Interface::StateChanges&)),
+                   this, SLOT(handleDevicesSynced(const usbguard::Interface::StateChanges&)));
+  QObject::connect(_ipc_worker, SIGNAL(requestFailed(const QString&, const QString&)),
+                   this, SLOT(handleRequestFailure(const QString&, const QString&)));
+
+  _ipc_thread.start();
+
+  _device_changes_timer.setSingleShot(true);
+  _device_changes_timer.setInterval(0);
+  QObject::connect(&_device_changes_timer, SIGNAL(timeout()),
+                   this, SLOT(applyPendingDeviceChanges()));
 
   QObject::connect(&_ipc_timer, SIGNAL(timeout()),
                    this, SLOT(ipcTryConnect()));
 
+  _dialog_timer.setSingleShot(true);
+  _dialog_timer.setInterval(G_aggregation_window_ms);
+  QObject::connect(&_dialog_timer, SIGNAL(timeout()),
+                   this, SLOT(showPendingDeviceDialog()));
+
+  _notification_timer.setSingleShot(true);
+  _notification_timer.setInterval(G_aggregation_window_ms);
+  QObject::connect(&_notification_timer, SIGNAL(timeout()),
+                   this, SLOT(showPendingNotifications()));
+
   QObject::connect(this, SIGNAL(uiDeviceInserted(quint32, const std::map<std::string, std::string>&, const std::vector<usbguard::USBInterfaceType>&, bool)),
                    this, SLOT(showDeviceDialog(quint32, const std::map<std::string, std::string>&, const std::vector<usbguard::USBInterfaceType>&, bool)));
   QObject::connect(this, SIGNAL(uiDeviceInserted(quint32, const std::map<std::string, std::string>&, const std::vector<usbguard::USBInterfaceType>&, bool)),
@@ -113,8 +185,8 @@ MainWindow::MainWindow(QWidget *parent) :
 
   loadSettings();
 
-  _ipc_timer.setInterval(1000);
-  _ipc_timer.start();
+  _ipc_timer.setSingleShot(true);
+  scheduleIPCReconnect();
   ui->statusBar->showMessage(tr("Inactive. No IPC connection."));
 
   new QShortcut(QKeySequence(Qt::Key_Escape, Qt::Key_Escape), this, SLOT(showMinimized()));
@@ -169,6 +241,9 @@ void MainWindow::switchVisibilityState(QSystemTrayIcon::ActivationReason reason)
 
 MainWindow::~MainWindow()
 {
+  /* Let the worker finish its current request first */
+  _ipc_thread.quit();
+  _ipc_thread.wait();
   IPCClient::disconnect();
   delete ui;
 }
@@ -179,6 +254,15 @@ void MainWindow::showDeviceDialog(quint32 id, const std::map<std::string, std::s
     return;
   }
 
+  const QString name = QString::fromStdString(attributes.at("name"));
+  const QString vendor_id = QString::fromStdString(attributes.at("vendor_id"));
+  const QString product_id = QString::fromStdString(attributes.at("product_id"));
+
+  if (!_pending_dialog.isNull()) {
+    _pending_dialog->addDevice(id, name, vendor_id, product_id);
+    return;
+  }
+
   auto dialog = new DeviceDialog(id);
 
   dialog->setRejectVisible(ui->show_reject_button_checkbox->isChecked());
@@ -186,10 +270,9 @@ void MainWindow::showDeviceDialog(quint32 id, const std::map<std::string, std::s
   dialog->setMaskSerialNumber(ui->mask_serial_checkbox->isChecked());
   dialog->setDecisionIsPermanent(ui->decision_permanent_checkbox->isChecked());
 
-  dialog->setName(QString::fromStdString(attributes.at("name")));
+  dialog->setName(name);
   dialog->setSerial(QString::fromStdString(attributes.at("serial")));
-  dialog->setDeviceID(QString::fromStdString(attributes.at("vendor_id")),
-                 QString::fromStdString(attributes.at("product_id")));
+  dialog->setDeviceID(vendor_id, product_id);
   dialog->setInterfaceTypes(interfaces);
 
   dialog->setModal(false);
@@ -202,9 +285,67 @@ void MainWindow::showDeviceDialog(quint32 id, const std::map<std::string, std::s
   QObject::connect(dialog, SIGNAL(blocked(quint32,bool)),
                    this, SLOT(blockDevice(quint32,bool)));
 
-  dialog->show();
-  dialog->raise();
-  dialog->activateWindow();
+  /* The dialog is shown once the aggregation window is over */
+  _pending_dialog = dialog;
+  _dialog_timer.start();
+
+  return;
+}
+
+void MainWindow::showPendingDeviceDialog()
+{
+  if (_pending_dialog.isNull()) {
+    return;
+  }
+
+  _pending_dialog->show();
+  _pending_dialog->raise();
+  _pending_dialog->activateWindow();
+  _pending_dialog.clear();
+
+  return;
+}
+
+void MainWindow::queueNotification(const QString& title, const QString& name, QSystemTrayIcon::MessageIcon icon)
+{
+  _pending_notifications.append({ title, name, icon });
+
+  if (!_notification_timer.isActive()) {
+    _notification_timer.start();
+  }
+  return;
+}
+
+void MainWindow::showPendingNotifications()
+{
+  if (_pending_notifications.isEmpty()) {
+    return;
+  }
+
+  if (_pending_notifications.size() == 1) {
+    const Notification& notification = _pending_notifications.first();
+    systray->showMessage(notification.title, QString(tr("Name: %1")).arg(notification.name), notification.icon);
+    _pending_notifications.clear();
+    return;
+  }
+
+  QSystemTrayIcon::MessageIcon icon = QSystemTrayIcon::NoIcon;
+  QStringList lines;
+
+  for (auto const& notification : _pending_notifications) {
+    /* Show the most severe icon of the events */
+    icon = qMax(icon, notification.icon);
+    if (lines.size() < G_notification_lines_max) {
+      lines.append(QString("%1: %2").arg(notification.title).arg(notification.name));
+    }
+  }
+
+  if (_pending_notifications.size() > G_notification_lines_max) {
+    lines.append(QString(tr("... and %1 more")).arg(_pending_notifications.size() - G_notification_lines_max));
+  }
+
+  systray->showMessage(QString(tr("%1 USB Device Events")).arg(_pending_notifications.size()), lines.join("\n"), icon);
+  _pending_notifications.clear();
 
   return;
 }
@@ -221,7 +362,7 @@ void MainWindow::notifyInserted(quint32 id, const std::map<std::string, std::str
 {
   if (ui->notify_inserted->isChecked()) {
     if (rule_matched) {
-      systray->showMessage(tr("USB Device Inserted"), QString(tr("Name: %1")).arg(QString::fromStdString(attributes.at("name"))), QSystemTrayIcon::Information);
+      queueNotification(tr("USB Device Inserted"), QString::fromStdString(attributes.at("name")), QSystemTrayIcon::Information);
     }
   }
   showMessage(QString(tr("<i>Inserted</i>: %1")).arg(QString::fromStdString(attributes.at("name"))));
@@ -231,7 +372,7 @@ void MainWindow::notifyInserted(quint32 id, const std::map<std::string, std::str
 void MainWindow::notifyPresent(quint32 id, const std::map<std::string, std::string>& attributes, const std::vector<usbguard::USBInterfaceType>& interfaces, usbguard::Rule::Target target)
 {
   if (ui->notify_present->isChecked()) {
-    systray->showMessage(tr("USB Device Present"), QString(tr("Name: %1")).arg(QString::fromStdString(attributes.at("name"))), QSystemTrayIcon::Information);
+    queueNotification(tr("USB Device Present"), QString::fromStdString(attributes.at("name")), QSystemTrayIcon::Information);
   }
   showMessage(QString(tr("<i>Present</i>: %1")).arg(QString::fromStdString(attributes.at("name"))));
   return;
@@ -240,7 +381,7 @@ void MainWindow::notifyPresent(quint32 id, const std::map<std::string, std::stri
 void MainWindow::notifyRemoved(quint32 id, const std::map<std::string, std::string>& attributes)
 {
   if (ui->notify_removed->isChecked()) {
-    systray->showMessage(tr("USB Device Removed"), QString(tr("Name: %1")).arg(QString::fromStdString(attributes.at("name"))), QSystemTrayIcon::Information);
+    queueNotification(tr("USB Device Removed"), QString::fromStdString(attributes.at("name")), QSystemTrayIcon::Information);
   }
   showMessage(QString(tr("<i>Removed</i>: %1")).arg(QString::fromStdString(attributes.at("name"))));
   return;
@@ -249,7 +390,7 @@ void MainWindow::notifyRemoved(quint32 id, const std::map<std::string, std::stri
 void MainWindow::notifyAllowed(quint32 id, const std::map<std::string, std::string>& attributes)
 {
   if (ui->notify_allowed->isChecked()) {
-    systray->showMessage(tr("USB Device Allowed"), QString(tr("Name: %1")).arg(QString::fromStdString(attributes.at("name"))), QSystemTrayIcon::Information);
+    queueNotification(tr("USB Device Allowed"), QString::fromStdString(attributes.at("name")), QSystemTrayIcon::Information);
   }
   showMessage(QString(tr("Allowed: %1")).arg(QString::fromStdString(attributes.at("name"))));
   return;
@@ -258,7 +399,7 @@ void MainWindow::notifyAllowed(quint32 id, const std::map<std::string, std::stri
 void MainWindow::notifyBlocked(quint32 id, const std::map<std::string, std::string>& attributes)
 {
   if (ui->notify_blocked->isChecked()) {
-    systray->showMessage(tr("USB Device Blocked"), QString(tr("Name: %1")).arg(QString::fromStdString(attributes.at("name"))), QSystemTrayIcon::Warning);
+    queueNotification(tr("USB Device Blocked"), QString::fromStdString(attributes.at("name")), QSystemTrayIcon::Warning);
   }
   showMessage(QString(tr("Blocked: %1")).arg(QString::fromStdString(attributes.at("name"))));
   return;
@@ -267,7 +408,7 @@ void MainWindow::notifyBlocked(quint32 id, const std::map<std::string, std::stri
 void MainWindow::notifyRejected(quint32 id, const std::map<std::string, std::string>& attributes)
 {
   if (ui->notify_rejected->isChecked()) {
-    systray->showMessage(tr("USB Device Rejected"), QString(tr("Name: %1")).arg(QString::fromStdString(attributes.at("name"))), QSystemTrayIcon::Critical);
+    queueNotification(tr("USB Device Rejected"), QString::fromStdString(attributes.at("name")), QSystemTrayIcon::Critical);
   }
   showMessage(QString(tr("Rejected: %1")).arg(QString::fromStdString(attributes.at("name"))), true);
   if (windowState() & Qt::WindowMinimized) {
@@ -344,95 +485,68 @@ void MainWindow::ipcTryConnect()
                 .arg(QString::fromStdString(ex.codeAsString()))
                 .arg(QString::fromStdString(ex.message())),
                 /*alert=*/true);
+    scheduleIPCReconnect();
   }
   catch(const std::exception& ex) {
     showMessage(QString("IPC connection failed: std::exception: %1")
                 .arg(QString::fromStdString(ex.what())),
                 /*alert=*/true);
+    scheduleIPCReconnect();
   }
 }
 
+void MainWindow::scheduleIPCReconnect()
+{
+  const int jitter = _ipc_retry_interval / 4;
+  _ipc_timer.start(_ipc_retry_interval - jitter + qrand() % (2 * jitter + 1));
+  _ipc_retry_interval = qMin(2 * _ipc_retry_interval, G_ipc_retry_interval_max_ms);
+}
+
 void MainWindow::allowDevice(quint32 id, bool permanent)
 {
-  try {
-    IPCClient::allowDevice(id, permanent, 0);
-  }
-  catch(const usbguard::IPCException& ex) {
-    showMessage(QString("IPC call failed: %1: %2: %3")
-                .arg("allowDevice")
-                .arg(QString::fromStdString(ex.codeAsString()))
-                .arg(QString::fromStdString(ex.message())),
-                /*alert=*/true);
-  }
-  catch(const std::exception& ex) {
-    showMessage(QString("IPC call failed: %1: std::exception: %2")
-                .arg("allowDevice")
-                .arg(QString::fromStdString(ex.what())),
-                /*alert=*/true);
-  }
+  emit ipcAllowDevice(id, permanent);
 }
 
 void MainWindow::blockDevice(quint32 id, bool permanent)
 {
-  try {
-    IPCClient::blockDevice(id, permanent, 0);
-  }
-  catch(const usbguard::IPCException& ex) {
-    showMessage(QString("IPC call failed: %1: %2: %3")
-                .arg("blockDevice")
-                .arg(QString::fromStdString(ex.codeAsString()))
-                .arg(QString::fromStdString(ex.message())),
-                /*alert=*/true);
-  }
-  catch(const std::exception& ex) {
-    showMessage(QString("IPC call failed: %1: std::exception: %2")
-                .arg("blockDevice")
-                .arg(QString::fromStdString(ex.what())),
-                /*alert=*/true);
-  }
+  emit ipcBlockDevice(id, permanent);
 }
 
 void MainWindow::rejectDevice(quint32 id, bool permanent)
 {
-  try {
-    IPCClient::rejectDevice(id, permanent, 0);
-  }
-  catch(const usbguard::IPCException& ex) {
-    showMessage(QString("IPC call failed: %1: %2: %3")
-                .arg("rejectDevice")
-                .arg(QString::fromStdString(ex.codeAsString()))
-                .arg(QString::fromStdString(ex.message())),
-                /*alert=*/true);
-  }
-  catch(const std::exception& ex) {
-    showMessage(QString("IPC call failed: %1: std::exception: %2")
-                .arg("rejectDevice")
-                .arg(QString::fromStdString(ex.what())),
-                /*alert=*/true);
-  }
+  emit ipcRejectDevice(id, permanent);
 }
 
 void MainWindow::handleIPCConnect()
 {
   _ipc_timer.stop();
+  _ipc_retry_interval = G_ipc_retry_interval_min_ms;
   notifyIPCConnected();
   systray->setIcon(QIcon(":/usbguard-icon.svg"));
   ui->device_view->setDisabled(false);
-  loadDeviceList();
+  /*
+   * The device list is kept while disconnected. If the daemon
+   * still has the changes since then, only those are applied.
+   */
+  if (_device_generation > 0) {
+    syncDeviceList();
+  }
+  else {
+    loadDeviceList();
+  }
 }
 
 void MainWindow::handleIPCDisconnect()
 {
-  _ipc_timer.start();
+  scheduleIPCReconnect();
   notifyIPCDisconnected();
   systray->setIcon(QIcon(":/usbguard-icon-inactive.svg"));
-  clearDeviceList();
   ui->device_view->setDisabled(true);
 }
 
 void MainWindow::handleDeviceInsert(quint32 id)
 {
-  loadDeviceList();
+  syncDeviceList();
 }
 
 void MainWindow::handleDeviceAllow(quint32 id)
@@ -450,9 +564,17 @@ void MainWindow::handleDeviceBlock(quint32 id)
 void MainWindow::handleDeviceRemove(quint32 id)
 {
   ui->device_view->selectionModel()->clearSelection();
-  ui->device_view->reset();
   _device_model.removeDevice(id);
-  ui->device_view->expandAll();
+
+  /* Don't insert the device again if it's still queued */
+  for (auto it = _pending_device_changes.begin(); it != _pending_device_changes.end();) {
+    if (it->id == id && !it->removed) {
+      it = _pending_device_changes.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
 }
 
 void MainWindow::loadSettings()
@@ -503,26 +625,96 @@ void MainWindow::saveSettings()
 
 void MainWindow::loadDeviceList()
 {
-  try {
-    for (auto device_rule : IPCClient::listDevices()) {
-      if (!_device_model.containsDevice(device_rule.getRuleID())) {
-        _device_model.insertDevice(device_rule);
-      }
+  _device_request_active = true;
+  emit ipcLoadDevices();
+}
+
+/*
+ * Apply only the device changes made since the last load or sync
+ * to the model, instead of listing all the devices again.
+ */
+void MainWindow::syncDeviceList()
+{
+  if (_device_request_active) {
+    _device_sync_queued = true;
+    return;
+  }
+
+  _device_request_active = true;
+  emit ipcSyncDevices(_device_generation);
+}
+
+void MainWindow::handleDevicesLoaded(const usbguard::Interface::StateChanges& changes)
+{
+  _device_request_active = false;
+  _device_generation = changes.generation;
+  queueDeviceChanges(changes.devices);
+
+  if (_device_sync_queued) {
+    _device_sync_queued = false;
+    syncDeviceList();
+  }
+}
+
+void MainWindow::handleDevicesSynced(const usbguard::Interface::StateChanges& changes)
+{
+  _device_request_active = false;
+
+  if (!changes.complete) {
+    _device_sync_queued = false;
+    resetDeviceList();
+    return;
+  }
+
+  _device_generation = changes.generation;
+  queueDeviceChanges(changes.devices);
+
+  if (_device_sync_queued) {
+    _device_sync_queued = false;
+    syncDeviceList();
+  }
+}
+
+void MainWindow::handleRequestFailure(const QString& method, const QString& message)
+{
+  /* The device list requests, see IPCWorker::loadDevices and syncDevices */
+  if (method == "listDevices" || method == "getChangesSince") {
+    _device_request_active = false;
+    _device_sync_queued = false;
+  }
+
+  showMessage(QString("IPC call failed: %1: %2").arg(method).arg(message), /*alert=*/true);
+}
+
+void MainWindow::queueDeviceChanges(const std::vector<usbguard::Interface::StateChanges::Change>& changes)
+{
+  for (auto const& change : changes) {
+    _pending_device_changes.append(change);
+  }
+
+  if (!_pending_device_changes.isEmpty() && !_device_changes_timer.isActive()) {
+    _device_changes_timer.start();
+  }
+}
+
+void MainWindow::applyPendingDeviceChanges()
+{
+  for (int i = 0; i < G_device_changes_batch && !_pending_device_changes.isEmpty(); ++i) {
+    const auto change = _pending_device_changes.takeFirst();
+
+    if (change.removed) {
+      _device_model.removeDevice(change.id);
+    }
+    else {
+      _device_model.insertDevice(change.rule);
     }
-    ui->device_view->expandAll();
   }
-  catch(const usbguard::IPCException& ex) {
-    showMessage(QString("IPC call failed: %1: %2: %3")
-                .arg("listDevices")
-                .arg(QString::fromStdString(ex.codeAsString()))
-                .arg(QString::fromStdString(ex.message())),
-                /*alert=*/true);
+
+  if (_pending_device_changes.isEmpty()) {
+    ui->device_view->expandAll();
   }
-  catch(const std::exception& ex) {
-    showMessage(QString("IPC call failed: %1: std::exception: %2")
-                .arg("listDevices")
-                .arg(QString::fromStdString(ex.what())),
-                /*alert=*/true);
+  else {
+    _device_changes_timer.start();
   }
 }
 
@@ -536,6 +728,7 @@ void MainWindow::commitDeviceListChanges()
   auto modified_map = _device_model.getModifiedDevices();
   auto modified_it = modified_map.begin();
   const bool permanent = ui->permanent_checkbox->isChecked();
+  std::vector<usbguard::Interface::DeviceTarget> targets;
 
   while (modified_it != modified_map.end()) {
     auto id = modified_it.key();
@@ -544,13 +737,9 @@ void MainWindow::commitDeviceListChanges()
     switch(target)
     {
       case usbguard::Rule::Target::Allow:
-        allowDevice(id, permanent);
-        break;
       case usbguard::Rule::Target::Block:
-        blockDevice(id, permanent);
-        break;
       case usbguard::Rule::Target::Reject:
-        rejectDevice(id, permanent);
+        targets.push_back({ id, target });
         break;
       default:
         break;
@@ -558,12 +747,20 @@ void MainWindow::commitDeviceListChanges()
 
     ++modified_it;
   }
+
+  if (targets.empty()) {
+    return;
+  }
+
+  /* All the changes are applied by the daemon in one request */
+  emit ipcApplyDevicePolicy(targets, permanent);
 }
 
 void MainWindow::clearDeviceList()
 {
   ui->device_view->clearSelection();
-  ui->device_view->reset();
+  _pending_device_changes.clear();
+  _device_changes_timer.stop();
   _device_model.clear();
 }
 
@@ -571,7 +768,6 @@ void MainWindow::resetDeviceList()
 {
   clearDeviceList();
   loadDeviceList();
-  ui->device_view->expandAll();
 }
 
 void MainWindow::changeEvent(QEvent* e)
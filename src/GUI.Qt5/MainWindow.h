@@ -20,17 +20,23 @@
 
 #include "DeviceModel.h"
 #include "TargetDelegate.h"
+#include "IPCWorker.h"
 
 #include <QSystemTrayIcon>
 #include <QMainWindow>
 #include <QTimer>
 #include <QSettings>
+#include <QPointer>
+#include <QList>
+#include <QThread>
 #include <IPCClient.hpp>
 
 namespace Ui {
 class MainWindow;
 }
 
+class DeviceDialog;
+
 class MainWindow : public QMainWindow, public usbguard::IPCClient
 {
   using IPCClient::allowDevice;
@@ -53,6 +59,14 @@ signals:
   void uiConnected();
   void uiDisconnected();
 
+  /* Requests handled by the IPC worker thread */
+  void ipcLoadDevices();
+  void ipcSyncDevices(quint64 generation);
+  void ipcAllowDevice(quint32 id, bool permanent);
+  void ipcBlockDevice(quint32 id, bool permanent);
+  void ipcRejectDevice(quint32 id, bool permanent);
+  void ipcApplyDevicePolicy(const std::vector<usbguard::Interface::DeviceTarget>& targets, bool permanent);
+
 protected slots:
   void switchVisibilityState(QSystemTrayIcon::ActivationReason reason);
   void flashStep();
@@ -60,6 +74,8 @@ protected slots:
 
   void showDeviceDialog(quint32 id, const std::map<std::string, std::string>& attributes, const std::vector<usbguard::USBInterfaceType>& interfaces, bool rule_match);
   void showMessage(const QString &message, bool alert = false);
+  void showPendingDeviceDialog();
+  void showPendingNotifications();
 
   void notifyInserted(quint32 id, const std::map<std::string, std::string>& attributes, const std::vector<usbguard::USBInterfaceType>& interfaces, bool rule_matched);
   void notifyPresent(quint32 id, const std::map<std::string, std::string>& attributes, const std::vector<usbguard::USBInterfaceType>& interfaces, usbguard::Rule::Target target);
@@ -78,6 +94,7 @@ protected slots:
 
   void handleIPCConnect();
   void handleIPCDisconnect();
+  void scheduleIPCReconnect();
 
   void handleDeviceInsert(quint32 id);
   void handleDeviceAllow(quint32 id);
@@ -88,6 +105,11 @@ protected slots:
   void saveSettings();
 
   void loadDeviceList();
+  void syncDeviceList();
+  void handleDevicesLoaded(const usbguard::Interface::StateChanges& changes);
+  void handleDevicesSynced(const usbguard::Interface::StateChanges& changes);
+  void handleRequestFailure(const QString& method, const QString& message);
+  void applyPendingDeviceChanges();
   void editDeviceListRow(const QModelIndex &index);
   void commitDeviceListChanges();
   void clearDeviceList();
@@ -99,6 +121,8 @@ protected:
   void setupSettingsWatcher();
   void startFlashing();
   void stopFlashing();
+  void queueNotification(const QString& title, const QString& name, QSystemTrayIcon::MessageIcon icon);
+  void queueDeviceChanges(const std::vector<usbguard::Interface::StateChanges::Change>& changes);
 
   void DeviceInserted(quint32 id, const std::map<std::string, std::string>& attributes, const std::vector<usbguard::USBInterfaceType>& interfaces, bool rule_match, quint32 rule_id) override;
   void DevicePresent(quint32 id, const std::map<std::string, std::string>& attributes, const std::vector<usbguard::USBInterfaceType>& interfaces, usbguard::Rule::Target target) override;
@@ -117,8 +141,40 @@ private:
   QTimer _flash_timer;
   bool _flash_state;
   QTimer _ipc_timer;
+  int _ipc_retry_interval;
   QSettings _settings;
   DeviceModel _device_model;
+  quint64 _device_generation;
   TargetDelegate _target_delegate;
+
+  /*
+   * Device dialog and tray notifications of the events received
+   * within the current aggregation window.
+   */
+  struct Notification
+  {
+    QString title;
+    QString name;
+    QSystemTrayIcon::MessageIcon icon;
+  };
+
+  QPointer<DeviceDialog> _pending_dialog;
+  QTimer _dialog_timer;
+  QList<Notification> _pending_notifications;
+  QTimer _notification_timer;
+
+  /*
+   * The blocking IPC requests are made by the worker on its own
+   * thread. The device changes it returns are applied to the model
+   * in batches, so that long device lists don't block the event
+   * loop either. Only one device list request is in flight; a sync
+   * requested meanwhile is made once the reply is received.
+   */
+  QThread _ipc_thread;
+  IPCWorker *_ipc_worker;
+  bool _device_request_active;
+  bool _device_sync_queued;
+  QList<usbguard::Interface::StateChanges::Change> _pending_device_changes;
+  QTimer _device_changes_timer;
 };
 
@@ -19,13 +19,15 @@ SOURCES +=\
     MainWindow.cpp \
     DeviceDialog.cpp \
     DeviceModel.cpp \
-    TargetDelegate.cpp
+    TargetDelegate.cpp \
+    IPCWorker.cpp
 
 HEADERS +=\
     MainWindow.h \
     DeviceDialog.h \
     DeviceModel.h \
-    TargetDelegate.h
+    TargetDelegate.h \
+    IPCWorker.h
 
 FORMS += MainWindow.ui \
     DeviceDialog.ui
@@ -17,7 +17,7 @@
 // Authors: Daniel Kopecek <dkopecek@redhat.com>
 //
 #include "AllowedMatchesCondition.hpp"
-#include "RuleParser.hpp"
+#include "RuleQueryCache.hpp"
 #include "LoggerPrivate.hpp"
 #include <Interface.hpp>
 
@@ -26,7 +26,8 @@ namespace usbguard
   AllowedMatchesCondition::AllowedMatchesCondition(const String& device_spec, bool negated)
     : RuleCondition("allowed-matches", device_spec, negated)
   {
-    _device_match_rule = parseRuleFromString(std::string("allow ") + device_spec);
+    /* The conditions with the same query share its parsed form */
+    _device_match_rule = RuleQueryCache::shared().get(std::string("allow ") + device_spec);
     _interface_ptr = nullptr;
   }
 
@@ -39,7 +40,7 @@ namespace usbguard
 
   void AllowedMatchesCondition::init(Interface * const interface_ptr)
   {
-    logger->debug("AllowedMatchesCondition::init setting interface ptr to {}", (void *)interface_ptr);
+    USBGUARD_LOG_DEBUG("AllowedMatchesCondition::init setting interface ptr to {}", (void *)interface_ptr);
     _interface_ptr = interface_ptr;
   }
 
@@ -47,14 +48,19 @@ namespace usbguard
   {
     (void)rule;
     if (_interface_ptr == nullptr) {
-      logger->debug("AllowedMatchesCondition::update interface ptr not set!");
+      USBGUARD_LOG_DEBUG("AllowedMatchesCondition::update interface ptr not set!");
       return false;
     }
-    auto devices = _interface_ptr->listDevices(_device_match_rule.toString());
-    logger->debug("AllowedMatches: {} devices matches query {}", devices.size(), _device_match_rule.toString());
+    auto devices = _interface_ptr->queryDevices(*_device_match_rule);
+    USBGUARD_LOG_DEBUG("AllowedMatches: {} devices matches query {}", devices.size(), parameter());
     return !devices.empty();
   }
 
+  bool AllowedMatchesCondition::isMemoizable() const
+  {
+    return true;
+  }
+
   RuleCondition * AllowedMatchesCondition::clone() const
   {
     return new AllowedMatchesCondition(*this);
@@ -30,9 +30,10 @@ namespace usbguard
     AllowedMatchesCondition(const AllowedMatchesCondition& rhs);
     void init(Interface * const interface_ptr);
     bool update(const Rule& rule);
+    bool isMemoizable() const;
     RuleCondition * clone() const;
   private:
-    Rule _device_match_rule;
+    Pointer<const Rule> _device_match_rule;
     Interface * _interface_ptr;
   };
 } /* namespace usbguard */
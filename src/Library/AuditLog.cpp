@@ -0,0 +1,347 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "AuditLog.hpp"
+#include "Base64.hpp"
+#include "Hash.hpp"
+#include "Common/Utility.hpp"
+
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+namespace usbguard {
+  const uint32_t AuditLog::Version = 1;
+
+  static const char audit_magic[8] = { 'U', 'S', 'B', 'G', 'A', 'U', 'D', 'T' };
+  static const size_t audit_header_size = 32;
+  static const size_t audit_count_offset = 24;
+  static const size_t audit_hash_size = Hash::max_size;
+  static const size_t audit_port_size = 32;
+  /* timestamp, latency, device id, rule id, event, target, sizes, reserved */
+  static const size_t audit_record_fixed_size = 32;
+  static const size_t audit_record_size = \
+    audit_record_fixed_size + audit_hash_size + audit_port_size;
+
+  static void storeU32(uint8_t *ptr, uint32_t value)
+  {
+    value = htole32(value);
+    std::memcpy(ptr, &value, sizeof value);
+  }
+
+  static void storeU64(uint8_t *ptr, uint64_t value)
+  {
+    value = htole64(value);
+    std::memcpy(ptr, &value, sizeof value);
+  }
+
+  static uint32_t loadU32(const uint8_t *ptr)
+  {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof value);
+    return le32toh(value);
+  }
+
+  static uint64_t loadU64(const uint8_t *ptr)
+  {
+    uint64_t value;
+    std::memcpy(&value, ptr, sizeof value);
+    return le64toh(value);
+  }
+
+  String AuditLog::eventToString(Event event)
+  {
+    switch(event) {
+      case Event::Insert:
+        return "insert";
+      case Event::Present:
+        return "present";
+      case Event::Policy:
+        return "policy";
+      case Event::Reevaluate:
+        return "reevaluate";
+    }
+    return "unknown";
+  }
+
+  AuditLog::AuditLog(const String& path, size_t capacity, size_t keep)
+    : _path(path),
+      _capacity(capacity),
+      _keep(keep),
+      _fd(-1),
+      _mapping(nullptr),
+      _size(0),
+      _count(0)
+  {
+    if (capacity == 0) {
+      throw std::runtime_error("Audit log: the capacity must be non-zero");
+    }
+    if (!resume()) {
+      rotate();
+    }
+  }
+
+  AuditLog::~AuditLog()
+  {
+    unmap();
+  }
+
+  const String& AuditLog::getPath() const
+  {
+    return _path;
+  }
+
+  void AuditLog::append(uint64_t latency_ns, uint32_t device_id, uint32_t rule_id,
+                        Event event, Rule::Target target,
+                        const String& hash, const String& port)
+  {
+    const uint64_t timestamp_us = \
+      std::chrono::duration_cast<std::chrono::microseconds>(\
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_count == _capacity) {
+      rotate();
+    }
+
+    uint8_t * const record = _mapping + audit_header_size + _count * audit_record_size;
+    size_t hash_size = 0;
+
+    try {
+      hash_size = base64Decode(hash, record + audit_record_fixed_size, audit_hash_size);
+    }
+    catch(...) {
+      hash_size = 0;
+    }
+
+    const size_t port_size = std::min(port.size(), audit_port_size);
+
+    storeU64(record + 0, timestamp_us);
+    storeU64(record + 8, latency_ns);
+    storeU32(record + 16, device_id);
+    storeU32(record + 20, rule_id);
+    record[24] = static_cast<uint8_t>(event);
+    record[25] = static_cast<uint8_t>(target);
+    record[26] = static_cast<uint8_t>(hash_size);
+    record[27] = static_cast<uint8_t>(port_size);
+    storeU32(record + 28, 0);
+    std::memcpy(record + audit_record_fixed_size + audit_hash_size, port.data(), port_size);
+
+    /* Publish the record only after it's complete */
+    ++_count;
+    storeU64(_mapping + audit_count_offset, _count);
+    return;
+  }
+
+  bool AuditLog::resume()
+  {
+    const int fd = ::open(_path.c_str(), O_RDWR|O_CLOEXEC);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    const size_t size = audit_header_size + _capacity * audit_record_size;
+    uint8_t header[audit_header_size];
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0 || size_t(st.st_size) != size ||
+        ::pread(fd, header, sizeof header, 0) != ssize_t(sizeof header) ||
+        std::memcmp(header, audit_magic, sizeof audit_magic) != 0 ||
+        loadU32(header + 8) != Version ||
+        loadU32(header + 12) != audit_record_size ||
+        loadU64(header + 16) != _capacity ||
+        loadU64(header + audit_count_offset) >= _capacity) {
+      ::close(fd);
+      return false;
+    }
+
+    void * const mapping = ::mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+
+    _fd = fd;
+    _mapping = reinterpret_cast<uint8_t *>(mapping);
+    _size = size;
+    _count = loadU64(header + audit_count_offset);
+    return true;
+  }
+
+  void AuditLog::create()
+  {
+    const int fd = ::open(_path.c_str(), O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+      throw std::runtime_error("Audit log: cannot create " + _path + ": " + strerror(errno));
+    }
+
+    const size_t size = audit_header_size + _capacity * audit_record_size;
+
+    if (::ftruncate(fd, size) != 0) {
+      const int saved_errno = errno;
+      ::close(fd);
+      throw std::runtime_error("Audit log: cannot allocate " + _path + ": " + strerror(saved_errno));
+    }
+
+    void * const mapping = ::mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED) {
+      const int saved_errno = errno;
+      ::close(fd);
+      throw std::runtime_error("Audit log: cannot map " + _path + ": " + strerror(saved_errno));
+    }
+
+    _fd = fd;
+    _mapping = reinterpret_cast<uint8_t *>(mapping);
+    _size = size;
+    _count = 0;
+
+    std::memcpy(_mapping, audit_magic, sizeof audit_magic);
+    storeU32(_mapping + 8, Version);
+    storeU32(_mapping + 12, audit_record_size);
+    storeU64(_mapping + 16, _capacity);
+    storeU64(_mapping + audit_count_offset, 0);
+    return;
+  }
+
+  void AuditLog::rotate()
+  {
+    unmap();
+
+    if (_keep > 0) {
+      for (size_t n = _keep; n > 1; --n) {
+        const String from = _path + "." + numberToString(n - 1);
+        const String to = _path + "." + numberToString(n);
+        ::rename(from.c_str(), to.c_str());
+      }
+      ::rename(_path.c_str(), (_path + ".1").c_str());
+    }
+
+    create();
+    return;
+  }
+
+  void AuditLog::unmap()
+  {
+    if (_mapping != nullptr) {
+      ::munmap(_mapping, _size);
+      _mapping = nullptr;
+    }
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+    return;
+  }
+
+  AuditLog::Reader::Reader(const String& path)
+    : _mapping(nullptr),
+      _size(0)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+      throw std::runtime_error("Audit log: cannot open " + path + ": " + strerror(errno));
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0) {
+      const int saved_errno = errno;
+      ::close(fd);
+      throw std::runtime_error("Audit log: cannot stat " + path + ": " + strerror(saved_errno));
+    }
+    if (size_t(st.st_size) < audit_header_size) {
+      ::close(fd);
+      throw std::runtime_error("Audit log: " + path + ": invalid header");
+    }
+
+    void * const mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+      throw std::runtime_error("Audit log: cannot map " + path + ": " + strerror(errno));
+    }
+
+    _mapping = mapping;
+    _size = st.st_size;
+
+    const uint8_t * const data = reinterpret_cast<const uint8_t *>(_mapping);
+
+    _record_size = loadU32(data + 12);
+
+    if (std::memcmp(data, audit_magic, sizeof audit_magic) != 0 ||
+        loadU32(data + 8) < 1 || _record_size < audit_record_size) {
+      ::munmap(_mapping, _size);
+      throw std::runtime_error("Audit log: " + path + ": invalid header");
+    }
+
+    /* A log that is being written to may be truncated by a crash */
+    _count = std::min(loadU64(data + audit_count_offset),
+                      uint64_t((_size - audit_header_size) / _record_size));
+  }
+
+  AuditLog::Reader::~Reader()
+  {
+    ::munmap(_mapping, _size);
+  }
+
+  size_t AuditLog::Reader::count() const
+  {
+    return _count;
+  }
+
+  AuditLog::Record AuditLog::Reader::record(size_t index) const
+  {
+    if (index >= _count) {
+      throw std::out_of_range("Audit log record index out of range");
+    }
+
+    const uint8_t * const record = reinterpret_cast<const uint8_t *>(_mapping) + \
+      audit_header_size + index * _record_size;
+
+    Record value;
+    value.timestamp_us = loadU64(record + 0);
+    value.latency_ns = loadU64(record + 8);
+    value.device_id = loadU32(record + 16);
+    value.rule_id = loadU32(record + 20);
+    value.event = static_cast<Event>(record[24]);
+    value.target = static_cast<Rule::Target>(record[25]);
+
+    const size_t hash_size = std::min(size_t(record[26]), audit_hash_size);
+    const size_t port_size = std::min(size_t(record[27]), audit_port_size);
+
+    value.hash.assign(reinterpret_cast<const char *>(record + audit_record_fixed_size), hash_size);
+    value.port.assign(reinterpret_cast<const char *>(record + audit_record_fixed_size + audit_hash_size), port_size);
+    return value;
+  }
+} /* namespace usbguard */
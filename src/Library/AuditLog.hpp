@@ -0,0 +1,133 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include <cstdint>
+#include <mutex>
+
+namespace usbguard {
+  /*
+   * Binary audit log of device authorization decisions. The log
+   * file is preallocated for a fixed number of fixed-size records
+   * and memory mapped, so appending a record is a copy into the
+   * mapping without any text formatting:
+   *
+   *   header   magic "USBGAUDT", u32 version, u32 record size,
+   *            u64 capacity (records), u64 record count
+   *   records  capacity * record size bytes
+   *
+   * A record holds the wall clock timestamp (microseconds since
+   * the epoch), the decision latency (nanoseconds), the device id,
+   * the id of the rule that decided, the event type, the target
+   * and the binary device hash and port of the device. All integers
+   * are stored in little-endian byte order. The record count is
+   * updated after the record is written, readers skip the record
+   * bytes they don't know.
+   *
+   * When the file is full, it's rotated: path.N-1 is renamed to
+   * path.N, ..., path to path.1 and a new file is started.
+   */
+  class DLL_PUBLIC AuditLog
+  {
+  public:
+    static const uint32_t Version;
+
+    enum class Event : uint8_t {
+      Insert = 1,  /**< A device was inserted and the policy applied */
+      Present = 2, /**< A present device was handled at startup */
+      Policy = 3,  /**< The target was set through the IPC interface */
+      Reevaluate = 4 /**< The target changed after a rule set change */
+    };
+
+    static String eventToString(Event event);
+
+    struct Record
+    {
+      uint64_t timestamp_us;
+      uint64_t latency_ns;
+      uint32_t device_id;
+      uint32_t rule_id;
+      Event event;
+      Rule::Target target;
+      String hash; /**< Binary hash value */
+      String port;
+    };
+
+    /*
+     * Open the log file at path for appending. A valid log file
+     * with the same capacity is continued, anything else is
+     * rotated away first. keep is the number of rotated files
+     * kept, zero means that a full file is overwritten from the
+     * start.
+     */
+    AuditLog(const String& path, size_t capacity, size_t keep);
+    ~AuditLog();
+
+    AuditLog(const AuditLog&) = delete;
+    const AuditLog& operator=(const AuditLog&) = delete;
+
+    /*
+     * Append a decision record. The hash is given in the base64
+     * form returned by Device::getHash(). Thread-safe.
+     */
+    void append(uint64_t latency_ns, uint32_t device_id, uint32_t rule_id,
+                Event event, Rule::Target target,
+                const String& hash, const String& port);
+
+    const String& getPath() const;
+
+    /*
+     * Read access to an audit log file.
+     */
+    class DLL_PUBLIC Reader
+    {
+    public:
+      Reader(const String& path);
+      ~Reader();
+
+      Reader(const Reader&) = delete;
+      const Reader& operator=(const Reader&) = delete;
+
+      size_t count() const;
+      Record record(size_t index) const;
+
+    private:
+      void *_mapping;
+      size_t _size;
+      uint32_t _record_size;
+      uint64_t _count;
+    };
+
+  private:
+    bool resume();
+    void create();
+    void rotate();
+    void unmap();
+
+    const String _path;
+    const uint64_t _capacity;
+    const size_t _keep;
+    std::mutex _mutex;
+    int _fd;
+    uint8_t *_mapping;
+    size_t _size;
+    uint64_t _count;
+  };
+} /* namespace usbguard */
@@ -18,6 +18,16 @@
 //
 #include "Base64.hpp"
 #include <cstdint>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <immintrin.h>
+# define USBGUARD_BASE64_AVX2 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define USBGUARD_BASE64_NEON 1
+#endif
 
 namespace usbguard
 {
@@ -180,17 +190,261 @@ namespace usbguard
   }
 #undef B
 
-  String base64Encode (const uint8_t * const data, const size_t size) {
-    if (size == 0 || data == nullptr) {
-      throw std::runtime_error("base64encode: invalid input");
+  /*
+   * Vectorized block codecs. They process the longest prefix of the
+   * input they can handle with full vector loads and stores and
+   * return the number of input bytes consumed. The rest, including
+   * the padding, is processed by the scalar code. The AVX2 variants
+   * are selected at runtime, NEON is always available on AArch64.
+   */
+  typedef size_t (*EncodeBlocksFn)(const uint8_t *, size_t, char *);
+  typedef size_t (*DecodeBlocksFn)(const char *, size_t, uint8_t *, size_t);
+
+  static size_t encodeBlocksScalar(const uint8_t *, size_t, char *)
+  {
+    return 0;
+  }
+
+  static size_t decodeBlocksScalar(const char *, size_t, uint8_t *, size_t)
+  {
+    return 0;
+  }
+
+#if defined(USBGUARD_BASE64_AVX2)
+  /*
+   * 24 input bytes per iteration, split into two lanes of 12 bytes.
+   * Each lane is loaded with a 16 byte load, so 4 more input bytes
+   * have to be readable after the last block.
+   */
+  __attribute__((target("avx2")))
+  static size_t encodeBlocksAVX2(const uint8_t *in, const size_t size, char *out)
+  {
+    const __m256i shuffle = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift_lut = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+
+    while (i + 28 <= size) {
+      const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 12));
+      __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+      /* Split each 3 byte group into four 6 bit indices */
+      v = _mm256_shuffle_epi8(v, shuffle);
+      const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+      const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+      const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+      const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+      const __m256i indices = _mm256_or_si256(t1, t3);
+
+      /* Map the indices to the alphabet ranges by adding a per range offset */
+      __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+      const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+      range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+      const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, range), indices);
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i / 3 * 4), chars);
+      i += 24;
     }
 
-    const size_t encoded_size = base64EncodedSize(size);
+    return i;
+  }
+
+  /*
+   * 32 input characters per iteration. The 24 decoded bytes are
+   * written with a 32 byte store, so there has to be room for 8
+   * more bytes in the output buffer. A block containing a character
+   * outside of the alphabet is left to the scalar code, which
+   * reports the error.
+   */
+  __attribute__((target("avx2")))
+  static size_t decodeBlocksAVX2(const char *in, const size_t size, uint8_t *out, const size_t buflen)
+  {
+    const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack_shuffle = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    const __m256i slash = _mm256_set1_epi8('/');
+    size_t i = 0;
+
+    while (i + 32 <= size && i / 4 * 3 + 32 <= buflen) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+
+      /* Validate: each nibble pair maps to class bits which must not overlap */
+      const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), nibble_mask);
+      const __m256i lo_nibbles = _mm256_and_si256(v, nibble_mask);
+      const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+      const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+
+      if (!_mm256_testz_si256(lo, hi)) {
+        break;
+      }
+
+      /* Translate the characters to 6 bit values */
+      const __m256i roll_index = _mm256_add_epi8(_mm256_cmpeq_epi8(v, slash), hi_nibbles);
+      v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut_roll, roll_index));
+
+      /* Pack four 6 bit values into three bytes */
+      const __m256i merged = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+      __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+      packed = _mm256_shuffle_epi8(packed, pack_shuffle);
+      packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i / 4 * 3), packed);
+      i += 32;
+    }
+
+    return i;
+  }
+#endif /* USBGUARD_BASE64_AVX2 */
+
+#if defined(USBGUARD_BASE64_NEON)
+  /* 48 input bytes per iteration, deinterleaved into 3 byte groups */
+  static size_t encodeBlocksNEON(const uint8_t *in, const size_t size, char *out)
+  {
+    const uint8_t * const map = reinterpret_cast<const uint8_t *>(encode_map);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+    uint8x16x4_t table;
+
+    table.val[0] = vld1q_u8(map);
+    table.val[1] = vld1q_u8(map + 16);
+    table.val[2] = vld1q_u8(map + 32);
+    table.val[3] = vld1q_u8(map + 48);
+
+    size_t i = 0;
+
+    while (i + 48 <= size) {
+      const uint8x16x3_t src = vld3q_u8(in + i);
+      uint8x16x4_t dst;
+
+      dst.val[0] = vshrq_n_u8(src.val[0], 2);
+      dst.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[0], 4), vshrq_n_u8(src.val[1], 4)), mask);
+      dst.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[1], 2), vshrq_n_u8(src.val[2], 6)), mask);
+      dst.val[3] = vandq_u8(src.val[2], mask);
+
+      for (size_t k = 0; k < 4; ++k) {
+        dst.val[k] = vqtbl4q_u8(table, dst.val[k]);
+      }
+
+      vst4q_u8(reinterpret_cast<uint8_t *>(out + i / 3 * 4), dst);
+      i += 48;
+    }
+
+    return i;
+  }
+
+  static inline uint8x16_t decodeCharsNEON(const uint8x16_t c, uint8x16_t& invalid)
+  {
+    const uint8x16_t upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')), vcleq_u8(c, vdupq_n_u8('Z')));
+    const uint8x16_t lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')), vcleq_u8(c, vdupq_n_u8('z')));
+    const uint8x16_t digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+    const uint8x16_t plus = vceqq_u8(c, vdupq_n_u8('+'));
+    const uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+
+    uint8x16_t value = vandq_u8(upper, vsubq_u8(c, vdupq_n_u8('A')));
+    value = vorrq_u8(value, vandq_u8(lower, vsubq_u8(c, vdupq_n_u8('a' - 26))));
+    value = vorrq_u8(value, vandq_u8(digit, vaddq_u8(c, vdupq_n_u8(52 - '0'))));
+    value = vorrq_u8(value, vandq_u8(plus, vdupq_n_u8(62)));
+    value = vorrq_u8(value, vandq_u8(slash, vdupq_n_u8(63)));
+
+    const uint8x16_t valid = vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, vorrq_u8(plus, slash)));
+    invalid = vorrq_u8(invalid, vmvnq_u8(valid));
+
+    return value;
+  }
+
+  /* 64 input characters per iteration, deinterleaved into 4 character groups */
+  static size_t decodeBlocksNEON(const char *in, const size_t size, uint8_t *out, const size_t buflen)
+  {
+    size_t i = 0;
+
+    while (i + 64 <= size && i / 4 * 3 + 48 <= buflen) {
+      const uint8x16x4_t src = vld4q_u8(reinterpret_cast<const uint8_t *>(in + i));
+      uint8x16_t invalid = vdupq_n_u8(0);
+      uint8x16x4_t values;
+
+      for (size_t k = 0; k < 4; ++k) {
+        values.val[k] = decodeCharsNEON(src.val[k], invalid);
+      }
+
+      if (vmaxvq_u8(invalid) != 0) {
+        break;
+      }
+
+      uint8x16x3_t dst;
+      dst.val[0] = vorrq_u8(vshlq_n_u8(values.val[0], 2), vshrq_n_u8(values.val[1], 4));
+      dst.val[1] = vorrq_u8(vshlq_n_u8(values.val[1], 4), vshrq_n_u8(values.val[2], 2));
+      dst.val[2] = vorrq_u8(vshlq_n_u8(values.val[2], 6), values.val[3]);
+
+      vst3q_u8(out + i / 4 * 3, dst);
+      i += 64;
+    }
+
+    return i;
+  }
+#endif /* USBGUARD_BASE64_NEON */
+
+  static EncodeBlocksFn selectEncodeBlocks()
+  {
+#if defined(USBGUARD_BASE64_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return encodeBlocksAVX2;
+    }
+#endif
+#if defined(USBGUARD_BASE64_NEON)
+    return encodeBlocksNEON;
+#endif
+    return encodeBlocksScalar;
+  }
+
+  static DecodeBlocksFn selectDecodeBlocks()
+  {
+#if defined(USBGUARD_BASE64_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return decodeBlocksAVX2;
+    }
+#endif
+#if defined(USBGUARD_BASE64_NEON)
+    return decodeBlocksNEON;
+#endif
+    return decodeBlocksScalar;
+  }
+
+  static size_t encodeBlocks(const uint8_t *in, const size_t size, char *out)
+  {
+    static const EncodeBlocksFn encode_blocks = selectEncodeBlocks();
+    return encode_blocks(in, size, out);
+  }
+
+  static size_t decodeBlocks(const char *in, const size_t size, uint8_t *out, const size_t buflen)
+  {
+    static const DecodeBlocksFn decode_blocks = selectDecodeBlocks();
+    return decode_blocks(in, size, out, buflen);
+  }
+
+  /*
+   * Encode the input which wasn't handled by the block codecs.
+   */
+  static void encodeScalar(const uint8_t * const data, const size_t size, char * const buffer)
+  {
     const uint8_t remainder = size % 3;
     const size_t enc3_count = (size - remainder) / 3;
-    
-    String result(encoded_size, 0);
-    char * const buffer = &result[0];
     size_t i = 0;
 
     for (; i < enc3_count; ++i) {
@@ -205,18 +459,50 @@ namespace usbguard
         __b64_enc1 (*(data + (i * 3)), buffer + (i * 4));
         break;
     }
+    return;
+  }
+
+  size_t base64Encode(const uint8_t * const data, const size_t size, char * const buffer, const size_t buflen)
+  {
+    if (size == 0 || data == nullptr) {
+      throw std::runtime_error("base64encode: invalid input");
+    }
+
+    const size_t encoded_size = base64EncodedSize(size);
+
+    if (buflen < encoded_size) {
+      throw std::runtime_error("base64encode: output buffer too small");
+    }
+
+    const size_t block_size = encodeBlocks(data, size, buffer);
+    encodeScalar(data + block_size, size - block_size, buffer + (block_size / 3 * 4));
+
+    return encoded_size;
+  }
+
+  String base64Encode (const uint8_t * const data, const size_t size) {
+    if (size == 0 || data == nullptr) {
+      throw std::runtime_error("base64encode: invalid input");
+    }
+
+    String result(base64EncodedSize(size), 0);
+    base64Encode(data, size, &result[0], result.size());
 
     return result;
   }
 
-  String base64Decode(const char * const data, const size_t size) {
+  /*
+   * Returns the exact decoded size of a valid base64 input
+   * and the number of unpadded 4 character groups in it.
+   */
+  static size_t decodedSize(const char * const data, const size_t size, size_t& dec4_count, uint8_t& padding)
+  {
     if (size == 0 || (size % 4) != 0) {
       throw std::runtime_error("base64Decode: invalid input");
     }
-   
-    const size_t decoded_size = base64DecodedSize(size);
-    size_t dec4_count = size / 4;
-    uint8_t padding = 0;
+
+    dec4_count = size / 4;
+    padding = 0;
 
     if (data[size - 1] == BASE64_PADDING_CHAR) {
       if (data[size - 2] == BASE64_PADDING_CHAR) {
@@ -227,9 +513,20 @@ namespace usbguard
       --dec4_count;
     }
 
-    String result(decoded_size, 0);
-    uint8_t * const buffer = reinterpret_cast<uint8_t *>(&result[0]);
-    size_t i = 0;
+    return dec4_count * 3 + (padding == 2 ? 1 : (padding == 1 ? 2 : 0));
+  }
+
+  static size_t base64DecodeInto(const char * const data, const size_t size, uint8_t * const buffer, const size_t buflen)
+  {
+    size_t dec4_count = 0;
+    uint8_t padding = 0;
+    const size_t decoded_size = decodedSize(data, size, dec4_count, padding);
+
+    if (buflen < decoded_size) {
+      throw std::runtime_error("base64Decode: output buffer too small");
+    }
+
+    size_t i = decodeBlocks(data, dec4_count * 4, buffer, buflen) / 4;
 
     for (; i < dec4_count; ++i) {
       __b64_dec4 (data + (i * 4), buffer + (i * 3));
@@ -238,19 +535,30 @@ namespace usbguard
     switch (padding) {
       case 2:
         __b64_dec2 (data + (i * 4), buffer + (i * 3));
-        result.resize(3 * i + 1);
         break;
       case 1:
         __b64_dec3 (data + (i * 4), buffer + (i * 3));
-        result.resize(3 * i + 2);
         break;
-      case 0:
-        result.resize(3 * i);
     }
 
+    return decoded_size;
+  }
+
+  String base64Decode(const char * const data, const size_t size) {
+    size_t dec4_count = 0;
+    uint8_t padding = 0;
+    String result(decodedSize(data, size, dec4_count, padding), 0);
+
+    base64DecodeInto(data, size, reinterpret_cast<uint8_t *>(&result[0]), result.size());
+
     return result;
   }
 
+  size_t base64Decode(const String& value, void * const buffer, const size_t buflen)
+  {
+    return base64DecodeInto(value.c_str(), value.size(), reinterpret_cast<uint8_t *>(buffer), buflen);
+  }
+
   size_t base64EncodedSize(const size_t decoded_size)
   {
     return (decoded_size / 3 * 4) + ((decoded_size % 3) == 0 ? 0 : 4); 
@@ -24,9 +24,21 @@ namespace usbguard
   size_t base64EncodedSize(size_t decoded_size);
   size_t base64DecodedSize(size_t encoded_size);
 
-  String base64Encode(const String& value);
+  DLL_PUBLIC String base64Encode(const String& value);
   String base64Encode(const uint8_t *buffer, size_t buflen);
+  /*
+   * Encode into a caller provided buffer of at least
+   * base64EncodedSize(size) characters. No terminating null
+   * character is written. Returns the number of characters
+   * written.
+   */
+  size_t base64Encode(const uint8_t *data, size_t size, char *buffer, size_t buflen);
 
-  String base64Decode(const String& value);
+  DLL_PUBLIC String base64Decode(const String& value);
+  /*
+   * Decode into a caller provided buffer. Throws if the buffer
+   * is too small for the decoded value. Returns the number of
+   * bytes written.
+   */
   size_t base64Decode(const String& value, void *buffer, size_t buflen);
 } /* namespace usbguard */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Daniel Kopecek <dkopecek@redhat.com>
+ */
+#ifndef USBGUARD_CONDITION_MODULE_H
+#define USBGUARD_CONDITION_MODULE_H
+
+/*
+ * ABI of the rule condition modules.
+ *
+ * A module is a shared object which exports the function named by
+ * USBGUARD_CONDITION_MODULE_SYMBOL. The function returns a pointer
+ * to a static descriptor of the condition the module implements.
+ * The condition is used in the rules by its identifier, the same
+ * way as the built-in ones, e.g. `if vpn-connected("corp")'.
+ *
+ * The daemon serializes the calls of one module, so the functions
+ * don't have to be thread-safe. They run in the daemon process, with
+ * its privileges and under its system call filter.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USBGUARD_CONDITION_MODULE_ABI 1
+#define USBGUARD_CONDITION_MODULE_SYMBOL "usbguard_condition_module"
+
+/*
+ * The result depends only on the parameter and on the state of the
+ * system, which doesn't change during one matching pass, and the
+ * evaluation has no side effects. The results of a pure condition
+ * are computed once per matching pass for all of its parameters
+ * used in the rules, with a single evaluate_many call.
+ */
+#define USBGUARD_CONDITION_PURE (1u << 0)
+
+/*
+ * Relative cost of an evaluation. The conditions of a rule are
+ * evaluated from the cheapest to the most costly.
+ */
+enum usbguard_condition_cost {
+  USBGUARD_CONDITION_COST_CONSTANT = 0, /* The result is fixed */
+  USBGUARD_CONDITION_COST_CHEAP = 1,    /* A computation without a system call */
+  USBGUARD_CONDITION_COST_CLOCK = 2,    /* Reads the clock */
+  USBGUARD_CONDITION_COST_QUERY = 3     /* Queries another subsystem */
+};
+
+struct usbguard_condition_module {
+  /* USBGUARD_CONDITION_MODULE_ABI */
+  uint32_t abi_version;
+  /* The condition identifier, which may not be one of the built-in ones */
+  const char *identifier;
+  /* USBGUARD_CONDITION_* flags */
+  uint32_t flags;
+  /* enum usbguard_condition_cost */
+  uint32_t cost;
+
+  /*
+   * Optional. Called once when the module is loaded. The state
+   * stored in *state is passed to the other functions. Returns
+   * zero on success.
+   */
+  int (*init)(void **state);
+
+  /* Optional. Called when the daemon exits. */
+  void (*fini)(void *state);
+
+  /*
+   * Optional. Called when a rule with the condition is parsed.
+   * Returns zero if the parameter (an empty string if there's
+   * none) is valid.
+   */
+  int (*check)(void *state, const char *parameter);
+
+  /*
+   * Evaluate the condition for `count' parameters and store the
+   * results (0 or 1) into `results'. Returns zero on success; on
+   * failure the conditions evaluate as false, before negation.
+   */
+  int (*evaluate_many)(void *state, const char * const *parameters, size_t count, uint8_t *results);
+};
+
+typedef const struct usbguard_condition_module *(*usbguard_condition_module_fn)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USBGUARD_CONDITION_MODULE_H */
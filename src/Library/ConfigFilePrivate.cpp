@@ -48,6 +48,9 @@ namespace usbguard
     if (!_stream.is_open()) {
       throw std::runtime_error("Can't open " + path);
     }
+    /* Forget the previous content if the file is reopened */
+    _lines.clear();
+    _settings.clear();
     _dirty = false;
     parse();
     return;
@@ -0,0 +1,249 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DescriptorCache.hpp"
+#include "Common/ByteOrder.hpp"
+#include "Common/Utility.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+namespace usbguard {
+  /*
+   * Purge the expired entries at least this often
+   */
+  static const size_t min_purge_size = 64;
+
+  /*
+   * The vendor and product IDs in the format used by sysfs.
+   */
+  static USBDeviceID deviceIDFromDescriptor(const USBDeviceDescriptor& descriptor)
+  {
+    return USBDeviceID(numberToString(busEndianToHost(descriptor.idVendor), "", 16, 4, '0'),
+                       numberToString(busEndianToHost(descriptor.idProduct), "", 16, 4, '0'));
+  }
+
+  /*
+   * Applies the same checks as the Device::load*Descriptor methods,
+   * but works with descriptor views and keeps the little state it
+   * needs in plain flags.
+   */
+  class DeviceDescriptorLoader
+  {
+  public:
+    DeviceDescriptorLoader(DescriptorCache::Entry& entry)
+      : _entry(entry)
+    {
+    }
+
+    void deviceDescriptor(const USBDescriptorView& descriptor)
+    {
+      if (_have_device) {
+        throw std::runtime_error("Invalid descriptor data: multiple device descriptors for one device");
+      }
+      _entry.device_id = deviceIDFromDescriptor(descriptor.as<USBDeviceDescriptor>());
+      _have_device = true;
+      return;
+    }
+
+    void configurationDescriptor(const USBDescriptorView&)
+    {
+      if (!_have_device) {
+        throw std::runtime_error("Invalid descriptor data: missing parent device descriptor while loading configuration");
+      }
+      _have_configuration = true;
+      _have_interface = false;
+      return;
+    }
+
+    void interfaceDescriptor(const USBDescriptorView& descriptor)
+    {
+      if (!_have_configuration) {
+        throw std::runtime_error("Invalid descriptor data: missing parent configuration descriptor while loading interface");
+      }
+      _entry.interface_types.emplace_back(descriptor.as<USBInterfaceDescriptor>());
+      _have_interface = true;
+      return;
+    }
+
+    void endpointDescriptor(const USBDescriptorView&)
+    {
+      if (!_have_interface) {
+        throw std::runtime_error("Invalid descriptor data: missing parent interface descriptor while loading endpoint");
+      }
+      return;
+    }
+
+  private:
+    DescriptorCache::Entry& _entry;
+    bool _have_device = false;
+    bool _have_configuration = false;
+    bool _have_interface = false;
+  };
+
+  DescriptorCache& DescriptorCache::instance()
+  {
+    static DescriptorCache cache;
+    return cache;
+  }
+
+  DescriptorCache::DescriptorCache()
+    : _purge_size(min_purge_size)
+  {
+  }
+
+  /*
+   * 64-bit FNV-1a
+   */
+  uint64_t DescriptorCache::digest(const uint8_t *data, const size_t size)
+  {
+    uint64_t value = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < size; ++i) {
+      value ^= data[i];
+      value *= 0x100000001b3ULL;
+    }
+
+    return value;
+  }
+
+  Pointer<const DescriptorCache::Entry> DescriptorCache::load(const uint8_t *data, const size_t size)
+  {
+    const uint64_t data_digest = digest(data, size);
+    Pointer<const Entry> entry = find(data_digest, data, size);
+
+    if (entry) {
+      return entry;
+    }
+
+    /*
+     * Parse without holding the lock. If another thread inserts the
+     * same data meanwhile, its entry is used.
+     */
+    auto parsed_entry = makePointer<Entry>();
+    DeviceDescriptorLoader loader(*parsed_entry);
+
+    USBParseDescriptorSpan(data, size, loader);
+    parsed_entry->data.assign(reinterpret_cast<const char *>(data), size);
+
+    return insert(data_digest, parsed_entry);
+  }
+
+  Pointer<const DescriptorCache::Entry> DescriptorCache::restore(const String& data,
+                                                                 const std::vector<USBInterfaceType>& interface_types)
+  {
+    const uint8_t * const bytes = reinterpret_cast<const uint8_t *>(data.data());
+    const uint64_t data_digest = digest(bytes, data.size());
+    Pointer<const Entry> entry = find(data_digest, bytes, data.size());
+
+    if (entry) {
+      return entry;
+    }
+
+    auto restored_entry = makePointer<Entry>();
+
+    restored_entry->data = data;
+    restored_entry->interface_types = interface_types;
+
+    if (data.size() >= sizeof(USBDeviceDescriptor)) {
+      restored_entry->device_id = deviceIDFromDescriptor(*reinterpret_cast<const USBDeviceDescriptor *>(bytes));
+    }
+
+    return insert(data_digest, restored_entry);
+  }
+
+  size_t DescriptorCache::size() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return std::count_if(_entries.begin(), _entries.end(),
+                         [](const decltype(_entries)::value_type& entry) { return !entry.second.expired(); });
+  }
+
+  /*
+   * The entries are allocated together with their reference count
+   * by makePointer. The map node holds the weak pointer.
+   */
+  size_t DescriptorCache::memoryUsage() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    size_t usage = _entries.bucket_count() * sizeof(void*);
+
+    for (auto const& cached : _entries) {
+      usage += sizeof cached + 2 * sizeof(void*);
+      if (const auto entry = cached.second.lock()) {
+        usage += memoryUsage(*entry) + 2 * sizeof(long);
+      }
+    }
+
+    return usage;
+  }
+
+  size_t DescriptorCache::memoryUsage(const Entry& entry)
+  {
+    return sizeof entry + stringHeapUsage(entry.data) +
+      stringHeapUsage(entry.device_id.getVendorID()) + stringHeapUsage(entry.device_id.getProductID()) +
+      entry.interface_types.capacity() * sizeof(USBInterfaceType);
+  }
+
+  Pointer<const DescriptorCache::Entry> DescriptorCache::find(const uint64_t data_digest,
+                                                              const uint8_t *data, const size_t size) const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto range = _entries.equal_range(data_digest);
+
+    for (auto it = range.first; it != range.second; ++it) {
+      Pointer<const Entry> entry = it->second.lock();
+
+      if (entry && entry->data.size() == size &&
+          ::memcmp(entry->data.data(), data, size) == 0) {
+        return entry;
+      }
+    }
+
+    return nullptr;
+  }
+
+  Pointer<const DescriptorCache::Entry> DescriptorCache::insert(const uint64_t data_digest, Pointer<const Entry> entry)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto range = _entries.equal_range(data_digest);
+
+    for (auto it = range.first; it != range.second; ++it) {
+      Pointer<const Entry> existing_entry = it->second.lock();
+
+      if (existing_entry && existing_entry->data == entry->data) {
+        return existing_entry;
+      }
+    }
+
+    if (_entries.size() >= _purge_size) {
+      for (auto it = _entries.begin(); it != _entries.end(); ) {
+        if (it->second.expired()) {
+          it = _entries.erase(it);
+        }
+        else {
+          ++it;
+        }
+      }
+      _purge_size = std::max(min_purge_size, 2 * _entries.size());
+    }
+
+    _entries.emplace(data_digest, entry);
+    return entry;
+  }
+} /* namespace usbguard */
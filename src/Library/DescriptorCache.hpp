@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "USB.hpp"
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+namespace usbguard {
+  /*
+   * Process-wide cache of parsed descriptor data. Devices of the same
+   * model have identical descriptor data, so the data is parsed once
+   * and the immutable result is shared by all the devices through a
+   * reference counted pointer.
+   *
+   * Entries are addressed by a digest of the descriptor data and
+   * compared byte by byte on a digest match. An entry is dropped
+   * when the last device referencing it is destroyed.
+   */
+  class DLL_PUBLIC DescriptorCache
+  {
+  public:
+    struct Entry
+    {
+      String data; /**< Raw descriptor data */
+      USBDeviceID device_id; /**< From the device descriptor */
+      std::vector<USBInterfaceType> interface_types;
+    };
+
+    static DescriptorCache& instance();
+
+    /*
+     * Return the parsed descriptor data. The data is parsed only if
+     * it isn't in the cache. Throws an exception if the data is invalid.
+     */
+    Pointer<const Entry> load(const uint8_t *data, size_t size);
+
+    /*
+     * Return the cache entry for descriptor data parsed earlier,
+     * e.g. stored in a checkpoint together with its interface types.
+     * The data isn't parsed.
+     */
+    Pointer<const Entry> restore(const String& data, const std::vector<USBInterfaceType>& interface_types);
+
+    /* Number of models in the cache */
+    size_t size() const;
+
+    /* Estimated memory used by the cached entries, in bytes */
+    size_t memoryUsage() const;
+    static size_t memoryUsage(const Entry& entry);
+
+  private:
+    DescriptorCache();
+
+    static uint64_t digest(const uint8_t *data, size_t size);
+    Pointer<const Entry> find(uint64_t data_digest, const uint8_t *data, size_t size) const;
+    Pointer<const Entry> insert(uint64_t data_digest, Pointer<const Entry> entry);
+
+    mutable std::mutex _mutex;
+    std::unordered_multimap<uint64_t, std::weak_ptr<const Entry>> _entries;
+    /* Expired entries are purged when the map grows to this size */
+    size_t _purge_size;
+  };
+} /* namespace usbguard */
@@ -54,9 +54,15 @@ namespace usbguard {
     return d_pointer->refDeviceMutex();
   }
 
-  Pointer<Rule> Device::getDeviceRule(const bool with_port, const bool with_parent_hash)
+  Pointer<Rule> Device::getDeviceRule(const bool with_port, const bool with_parent_hash, const bool with_hash)
   {
-    return d_pointer->getDeviceRule(with_port, with_parent_hash);
+    return d_pointer->getDeviceRule(with_port, with_parent_hash, with_hash);
+  }
+
+  Pointer<const Rule> Device::getCachedDeviceRule(const bool with_port, const bool with_parent_hash,
+                                                  const bool with_hash)
+  {
+    return d_pointer->getCachedDeviceRule(with_port, with_parent_hash, with_hash);
   }
 
   String Device::hashString(const String& value) const
@@ -69,6 +75,21 @@ namespace usbguard {
     d_pointer->updateHash(descriptor_stream, expected_size);
   }
 
+  void Device::updateHash(const uint8_t *descriptor_data, const size_t size)
+  {
+    d_pointer->updateHash(descriptor_data, size);
+  }
+
+  void Device::deferHash()
+  {
+    d_pointer->deferHash();
+  }
+
+  bool Device::isHashDeferred() const
+  {
+    return d_pointer->isHashDeferred();
+  }
+
   const String& Device::getHash() const
   {
     return d_pointer->getHash();
@@ -182,4 +203,26 @@ namespace usbguard {
     d_pointer->loadEndpointDescriptor(parser, descriptor);
     return;
   }
+  size_t Device::loadDescriptors(const uint8_t *data, const size_t size)
+  {
+    return d_pointer->loadDescriptors(data, size);
+  }
+
+  const String& Device::getDescriptorData() const
+  {
+    return d_pointer->getDescriptorData();
+  }
+
+  void Device::restoreDescriptors(const String& data, const std::vector<USBInterfaceType>& interface_types,
+                                  const String& hash)
+  {
+    d_pointer->restoreDescriptors(data, interface_types, hash);
+    return;
+  }
+
+  size_t Device::getMemoryUsage() const
+  {
+    return sizeof(Device) + d_pointer->memoryUsage();
+  }
+
 } /* namespace usbguard */
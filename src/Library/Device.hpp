@@ -37,9 +37,25 @@ namespace usbguard {
     DeviceManager& manager() const;
 
     std::mutex& refDeviceMutex();
-    Pointer<Rule> getDeviceRule(bool with_port = true, bool with_parent_hash = true);
+    /*
+     * If with_hash is false, the rule doesn't have the hash attribute
+     * and a deferred hash isn't computed for it.
+     */
+    Pointer<Rule> getDeviceRule(bool with_port = true, bool with_parent_hash = true, bool with_hash = true);
+    /*
+     * Same as getDeviceRule, but returns a shared, immutable rule which
+     * is generated once and reused until the device state changes.
+     */
+    Pointer<const Rule> getCachedDeviceRule(bool with_port = true, bool with_parent_hash = true, bool with_hash = true);
     String hashString(const String& value) const;
     void updateHash(std::istream& descriptor_stream, size_t expected_size);
+    void updateHash(const uint8_t *descriptor_data, size_t size);
+    /*
+     * Don't compute the hash now. It's computed from the loaded
+     * descriptor data by the first getHash() call.
+     */
+    void deferHash();
+    bool isHashDeferred() const;
     const String& getHash() const;
 
     void setParentHash(const String& hash);
@@ -70,11 +86,38 @@ namespace usbguard {
 
     virtual bool isController() const = 0;
 
+    /*
+     * Estimated memory used by the device, in bytes. The descriptor
+     * data shared with other devices and the interned strings aren't
+     * counted. Subclasses add their own data.
+     */
+    virtual size_t getMemoryUsage() const;
+
     void loadDeviceDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor);
     void loadConfigurationDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor);
     void loadInterfaceDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor);
     void loadEndpointDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor);
 
+    /*
+     * Parse the descriptor data and set the interface types and the
+     * vendor and product IDs. Returns the size of the parsed data.
+     * Devices with identical descriptor data share the parsed result.
+     */
+    size_t loadDescriptors(const uint8_t *data, size_t size);
+    /*
+     * Descriptor data passed to the last loadDescriptors call.
+     */
+    const String& getDescriptorData() const;
+    /*
+     * Set the descriptor data, the interface types and the hash
+     * computed by earlier loadDescriptors and updateHash calls for
+     * the same device, e.g. from a checkpoint, without parsing or
+     * hashing the data again. The vendor and product IDs are read
+     * from the device descriptor at the start of the data.
+     */
+    void restoreDescriptors(const String& data, const std::vector<USBInterfaceType>& interface_types,
+                            const String& hash);
+
   private:
     DevicePrivate *d_pointer;
   };
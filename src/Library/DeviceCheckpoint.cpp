@@ -0,0 +1,181 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DeviceCheckpoint.hpp"
+#include "Hash.hpp"
+#include "LoggerPrivate.hpp"
+#include "Common/Utility.hpp"
+#include "Common/ByteStream.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace usbguard {
+  static const char checkpoint_magic[8] = { 'U', 'S', 'B', 'G', 'C', 'K', 'P', 'T' };
+  static const uint32_t checkpoint_byte_order_mark = 0x01020304;
+
+  const uint32_t DeviceCheckpoint::Version = 1;
+
+  bool DeviceCheckpoint::Identity::operator==(const Identity& rhs) const
+  {
+    return syspath == rhs.syspath &&
+      devnum == rhs.devnum &&
+      descriptors_size == rhs.descriptors_size &&
+      descriptors_mtime_sec == rhs.descriptors_mtime_sec &&
+      descriptors_mtime_nsec == rhs.descriptors_mtime_nsec;
+  }
+
+  DeviceCheckpoint::Identity DeviceCheckpoint::getIdentity(const String& syspath, const uint64_t devnum)
+  {
+    const String descriptors_path = syspath + "/descriptors";
+    struct stat st;
+
+    if (::stat(descriptors_path.c_str(), &st) != 0) {
+      throw std::runtime_error("Cannot stat " + descriptors_path);
+    }
+
+    Identity identity;
+    identity.syspath = syspath;
+    identity.devnum = devnum;
+    identity.descriptors_size = st.st_size;
+    identity.descriptors_mtime_sec = st.st_mtim.tv_sec;
+    identity.descriptors_mtime_nsec = st.st_mtim.tv_nsec;
+
+    return identity;
+  }
+
+  String DeviceCheckpoint::currentContext()
+  {
+    std::ifstream boot_id_stream("/proc/sys/kernel/random/boot_id");
+    String boot_id;
+
+    std::getline(boot_id_stream, boot_id);
+
+    /*
+     * The hash of a fixed value changes with the default
+     * algorithm and key, and so would the device hashes.
+     */
+    Hash hash;
+    hash.update(String("usbguard-device-checkpoint"));
+
+    return boot_id + ":" + hash.getBase64();
+  }
+
+  static bool parseCheckpoint(const uint8_t *data, size_t size, const String& context,
+                              std::vector<DeviceCheckpoint::Entry>& entries)
+  {
+    ByteReader reader(data, size);
+    char magic[sizeof checkpoint_magic];
+
+    reader.bytes(magic, sizeof magic);
+    if (std::memcmp(magic, checkpoint_magic, sizeof magic) != 0 ||
+        reader.u32() != DeviceCheckpoint::Version ||
+        reader.u32() != checkpoint_byte_order_mark) {
+      USBGUARD_LOG_DEBUG("Device checkpoint: incompatible format");
+      return false;
+    }
+
+    if (reader.string() != context) {
+      USBGUARD_LOG_DEBUG("Device checkpoint: written in a different context");
+      return false;
+    }
+
+    const uint32_t count = reader.u32();
+    std::vector<DeviceCheckpoint::Entry> checkpoint_entries(count);
+
+    for (auto& entry : checkpoint_entries) {
+      entry.identity.syspath = reader.string();
+      entry.identity.devnum = reader.u64();
+      entry.identity.descriptors_size = reader.u64();
+      entry.identity.descriptors_mtime_sec = reader.u64();
+      entry.identity.descriptors_mtime_nsec = reader.u64();
+      entry.hash = reader.string();
+      entry.descriptors = reader.string();
+
+      const uint32_t interface_count = reader.u32();
+      for (uint32_t i = 0; i < interface_count; ++i) {
+        entry.interface_types.emplace_back(reader.string());
+      }
+    }
+
+    if (!reader.empty()) {
+      throw std::runtime_error("trailing data");
+    }
+
+    entries.swap(checkpoint_entries);
+    return true;
+  }
+
+  bool DeviceCheckpoint::load(const String& path, const String& context, std::vector<Entry>& entries)
+  {
+    std::ifstream stream(path, std::ios::binary);
+
+    if (!stream.is_open()) {
+      USBGUARD_LOG_DEBUG("Device checkpoint: cannot open {}", path);
+      return false;
+    }
+
+    const String data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    try {
+      return parseCheckpoint(reinterpret_cast<const uint8_t *>(data.data()), data.size(), context, entries);
+    }
+    catch(const std::exception& ex) {
+      logger->warn("Ignoring invalid device checkpoint {}: {}", path, ex.what());
+    }
+
+    return false;
+  }
+
+  void DeviceCheckpoint::save(const String& path, const String& context, const std::vector<Entry>& entries)
+  {
+    ByteWriter writer;
+
+    for (auto c : checkpoint_magic) {
+      writer.u8(c);
+    }
+    writer.u32(Version);
+    writer.u32(checkpoint_byte_order_mark);
+    writer.string(context);
+    writer.u32(entries.size());
+
+    for (auto const& entry : entries) {
+      writer.string(entry.identity.syspath);
+      writer.u64(entry.identity.devnum);
+      writer.u64(entry.identity.descriptors_size);
+      writer.u64(entry.identity.descriptors_mtime_sec);
+      writer.u64(entry.identity.descriptors_mtime_nsec);
+      writer.string(entry.hash);
+      writer.string(entry.descriptors);
+      writer.u32(entry.interface_types.size());
+      for (auto const& interface_type : entry.interface_types) {
+        writer.string(interface_type.typeString());
+      }
+    }
+
+    if (!writeFileAtomically(path, writer.data())) {
+      throw std::runtime_error("Cannot store the device checkpoint");
+    }
+    return;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,96 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "USB.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Checkpoint of the devices known to the device manager when it
+   * stopped. The next start uses it to skip reading, parsing and
+   * hashing the descriptors of the devices which weren't touched
+   * in the meantime:
+   *
+   *   header   magic "USBGCKPT", u32 version, u32 byte order mark,
+   *            context string, u32 entry count
+   *   entries  the device identity, the hash, the raw descriptor
+   *            data and the interface types of each device
+   *
+   * The context identifies the boot and the device hash settings
+   * the checkpoint was written with. A checkpoint from a different
+   * context is ignored as a whole. Like the rule cache, the file is
+   * meant to be read back by the same host.
+   */
+  class DLL_PUBLIC DeviceCheckpoint
+  {
+  public:
+    static const uint32_t Version;
+
+    /*
+     * Identifies a device instance in sysfs. A re-enumerated device
+     * gets a new device number and new sysfs inodes, so an equal
+     * identity means that the device wasn't touched.
+     */
+    struct Identity
+    {
+      String syspath;
+      uint64_t devnum;
+      uint64_t descriptors_size;
+      int64_t descriptors_mtime_sec;
+      int64_t descriptors_mtime_nsec;
+
+      bool operator==(const Identity& rhs) const;
+    };
+
+    struct Entry
+    {
+      Identity identity;
+      String hash;
+      String descriptors; /**< Raw descriptor data */
+      std::vector<USBInterfaceType> interface_types;
+    };
+
+    /*
+     * Identify the device at syspath with device number devnum.
+     * Throws an exception if the descriptors file cannot be stat'ed.
+     */
+    static Identity getIdentity(const String& syspath, uint64_t devnum);
+
+    /*
+     * The context of the running system: the boot id and the
+     * fingerprint of the default device hash algorithm and key.
+     */
+    static String currentContext();
+
+    /*
+     * Load the entries from the checkpoint file at path. Returns
+     * false if the file doesn't exist, is invalid or was written
+     * in a different context.
+     */
+    static bool load(const String& path, const String& context, std::vector<Entry>& entries);
+
+    /*
+     * Store the entries into the checkpoint file at path.
+     * Throws an exception on failure.
+     */
+    static void save(const String& path, const String& context, const std::vector<Entry>& entries);
+  };
+} /* namespace usbguard */
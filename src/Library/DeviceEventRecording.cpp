@@ -0,0 +1,185 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DeviceEventRecording.hpp"
+#include "Common/ByteStream.hpp"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace usbguard {
+  const uint32_t DeviceEventRecording::Version = 1;
+
+  static const char recording_magic[8] = { 'U', 'S', 'B', 'G', 'E', 'V', 'R', 'C' };
+  static const uint32_t recording_byte_order_mark = 0x01020304;
+  static const size_t header_size = sizeof recording_magic + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+  /*
+   * Records larger than this are treated as corrupted data.
+   */
+  static const uint32_t record_size_max = 16 * 1024 * 1024;
+
+  DeviceEventRecording::Event::Event()
+    : time_ns(0)
+  {
+  }
+
+  DeviceEventRecording::Writer::Writer(const String& path)
+    : _stream(path, std::ios::binary|std::ios::trunc),
+      _count(0)
+  {
+    if (!_stream) {
+      throw std::runtime_error("Cannot create the event recording " + path);
+    }
+
+    const uint64_t start_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    ByteWriter writer;
+
+    writer.bytes(recording_magic, sizeof recording_magic);
+    writer.u32(Version);
+    writer.u32(recording_byte_order_mark);
+    writer.u64(start_time_us);
+    _stream.write(writer.data().data(), writer.data().size());
+  }
+
+  void DeviceEventRecording::Writer::append(const Event& event)
+  {
+    ByteWriter writer;
+
+    writer.u64(event.time_ns);
+    writer.string(event.action);
+    writer.string(event.name);
+    writer.string(event.product);
+    writer.string(event.serial);
+    writer.string(event.authorized);
+
+    if (event.descriptors.empty()) {
+      writer.u32(0);
+    }
+    else {
+      auto it = _descriptors.find(event.descriptors);
+
+      if (it != _descriptors.end()) {
+        writer.u32(it->second);
+      }
+      else {
+        const uint32_t index = _descriptors.size() + 1;
+        _descriptors.emplace(event.descriptors, index);
+        writer.u32(index);
+        writer.string(event.descriptors);
+      }
+    }
+
+    const uint32_t record_size = writer.data().size();
+    _stream.write(reinterpret_cast<const char *>(&record_size), sizeof record_size);
+    _stream.write(writer.data().data(), writer.data().size());
+
+    if (!_stream) {
+      throw std::runtime_error("Cannot write the event recording");
+    }
+
+    ++_count;
+  }
+
+  void DeviceEventRecording::Writer::flush()
+  {
+    _stream.flush();
+  }
+
+  uint64_t DeviceEventRecording::Writer::count() const
+  {
+    return _count;
+  }
+
+  DeviceEventRecording::Reader::Reader(const String& path)
+    : _stream(path, std::ios::binary),
+      _start_time_us(0)
+  {
+    if (!_stream) {
+      throw std::runtime_error("Cannot open the event recording " + path);
+    }
+
+    uint8_t header[header_size];
+
+    if (!_stream.read(reinterpret_cast<char *>(header), sizeof header)) {
+      throw std::runtime_error("Invalid event recording: " + path);
+    }
+
+    ByteReader reader(header, sizeof header);
+    char magic[sizeof recording_magic];
+
+    reader.bytes(magic, sizeof magic);
+
+    if (std::memcmp(magic, recording_magic, sizeof magic) != 0 ||
+        reader.u32() != Version ||
+        reader.u32() != recording_byte_order_mark) {
+      throw std::runtime_error("Invalid or unsupported event recording: " + path);
+    }
+
+    _start_time_us = reader.u64();
+  }
+
+  uint64_t DeviceEventRecording::Reader::startTime() const
+  {
+    return _start_time_us;
+  }
+
+  bool DeviceEventRecording::Reader::next(Event& event)
+  {
+    uint32_t record_size = 0;
+
+    if (!_stream.read(reinterpret_cast<char *>(&record_size), sizeof record_size) ||
+        record_size > record_size_max) {
+      return false;
+    }
+
+    std::vector<uint8_t> record(record_size);
+
+    if (!_stream.read(reinterpret_cast<char *>(record.data()), record.size())) {
+      return false;
+    }
+
+    ByteReader reader(record.data(), record.size());
+
+    event.time_ns = reader.u64();
+    event.action = reader.string();
+    event.name = reader.string();
+    event.product = reader.string();
+    event.serial = reader.string();
+    event.authorized = reader.string();
+
+    const uint32_t index = reader.u32();
+
+    if (index == 0) {
+      event.descriptors.clear();
+    }
+    else if (index == _descriptors.size() + 1) {
+      _descriptors.push_back(reader.string());
+      event.descriptors = _descriptors.back();
+    }
+    else if (index <= _descriptors.size()) {
+      event.descriptors = _descriptors[index - 1];
+    }
+    else {
+      throw std::runtime_error("Invalid descriptor reference in the event recording");
+    }
+
+    return true;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include <cstdint>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Recording of the device events of a system, with the sysfs
+   * attributes of the devices, for replaying them into the virtual
+   * device manager backend (see VirtualDeviceManager):
+   *
+   *   header   magic "USBGEVRC", u32 version, u32 byte order mark,
+   *            u64 wall clock time of the start (UNIX microseconds)
+   *   records  u32 record size followed by the record
+   *
+   * A record holds the time of the event (nanoseconds since the
+   * start), the action, the device name and the product, serial
+   * and authorized attributes. The descriptor data is stored once
+   * per distinct value: the record refers to it by its index, and
+   * the first record which uses a value carries it. Readers skip
+   * the record bytes they don't know and stop at an incomplete
+   * last record, e.g. of an interrupted recording.
+   */
+  class DLL_PUBLIC DeviceEventRecording
+  {
+  public:
+    static const uint32_t Version;
+
+    struct Event
+    {
+      Event();
+
+      uint64_t time_ns; /**< Time since the start of the recording */
+      String action; /**< "present" for the devices found at the start, or the udev action */
+      String name; /**< Kernel name of the device, e.g. "1-1.2" */
+      String product;
+      String serial;
+      String authorized;
+      String descriptors; /**< Raw descriptor data */
+    };
+
+    class DLL_PUBLIC Writer
+    {
+    public:
+      Writer(const String& path);
+
+      Writer(const Writer&) = delete;
+      const Writer& operator=(const Writer&) = delete;
+
+      void append(const Event& event);
+      void flush();
+      uint64_t count() const;
+
+    private:
+      std::ofstream _stream;
+      std::unordered_map<String, uint32_t> _descriptors;
+      uint64_t _count;
+    };
+
+    class DLL_PUBLIC Reader
+    {
+    public:
+      Reader(const String& path);
+
+      Reader(const Reader&) = delete;
+      const Reader& operator=(const Reader&) = delete;
+
+      /*
+       * Wall clock time of the start of the recording.
+       */
+      uint64_t startTime() const;
+
+      /*
+       * Read the next event. Returns false at the end of the
+       * recording.
+       */
+      bool next(Event& event);
+
+    private:
+      std::ifstream _stream;
+      uint64_t _start_time_us;
+      std::vector<String> _descriptors;
+    };
+  };
+} /* namespace usbguard */
@@ -0,0 +1,236 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DeviceIndex.hpp"
+#include "LoggerPrivate.hpp"
+#include <stdexcept>
+
+namespace usbguard {
+  DeviceIndex::Entry::Entry(const Pointer<Device>& device_ptr)
+    : device(device_ptr)
+  {
+    /*
+     * Indexing needs the device rule with the hash. A deferred hash
+     * is left for the first query which needs the device.
+     */
+    if (device->isHashDeferred()) {
+      return;
+    }
+
+    try {
+      rule = device->getCachedDeviceRule();
+      program = RuleProgram::fromDeviceRule(*rule);
+    }
+    catch(const std::exception& ex) {
+      USBGUARD_LOG_DEBUG("DeviceIndex: cannot index device {}: {}", device->getID(), ex.what());
+      rule = nullptr;
+    }
+  }
+
+  DeviceIndex::DeviceIndex()
+  {
+  }
+
+  static bool isConcreteDeviceID(const USBDeviceID& device_id)
+  {
+    const String& vendor_id = device_id.getVendorID();
+    const String& product_id = device_id.getProductID();
+
+    return !(vendor_id.empty() || vendor_id == "*" ||
+             product_id.empty() || product_id == "*");
+  }
+
+  void DeviceIndex::insert(const Pointer<Device>& device)
+  {
+    const uint32_t id = device->getID();
+    auto entry = makePointer<const Entry>(device);
+
+    remove(id);
+    _entries[id] = entry;
+
+    if (!entry->rule) {
+      _unindexed.insert(id);
+      return;
+    }
+
+    const auto& device_id = entry->rule->attributeDeviceID();
+    if (device_id.count() == 1 && !isConcreteDeviceID(device_id.get())) {
+      _unindexed.insert(id);
+      return;
+    }
+
+    forEachKey(*entry, [this, id](RuleIndex::KeyType type, const String& key) {
+      buckets(type)[key].insert(id);
+    });
+
+    return;
+  }
+
+  void DeviceIndex::remove(uint32_t id)
+  {
+    auto it = _entries.find(id);
+
+    if (it == _entries.end()) {
+      return;
+    }
+
+    if (_unindexed.erase(id) == 0) {
+      forEachKey(*it->second, [this, id](RuleIndex::KeyType type, const String& key) {
+        auto& type_buckets = buckets(type);
+        auto bucket_it = type_buckets.find(key);
+        if (bucket_it != type_buckets.end()) {
+          bucket_it->second.erase(id);
+          if (bucket_it->second.empty()) {
+            type_buckets.erase(bucket_it);
+          }
+        }
+      });
+    }
+
+    _entries.erase(it);
+    return;
+  }
+
+  void DeviceIndex::clear()
+  {
+    _entries.clear();
+    _hash_buckets.clear();
+    _device_id_buckets.clear();
+    _serial_buckets.clear();
+    _parent_hash_buckets.clear();
+    _via_port_buckets.clear();
+    _vendor_buckets.clear();
+    _unindexed.clear();
+    return;
+  }
+
+  PointerVector<Device> DeviceIndex::find(const Rule& query) const
+  {
+    const RuleProgram query_program = RuleProgram::fromRule(query);
+    PointerVector<Device> devices;
+    String key;
+    const RuleIndex::KeyType type = RuleIndex::ruleKey(query, key);
+
+    if (type == RuleIndex::KeyType::None) {
+      for (auto const& map_entry : _entries) {
+        if (matches(*map_entry.second, query, query_program)) {
+          devices.push_back(map_entry.second->device);
+        }
+      }
+      return devices;
+    }
+
+    Bucket candidates(_unindexed);
+    const auto& type_buckets = buckets(type);
+    auto bucket_it = type_buckets.find(key);
+
+    if (bucket_it != type_buckets.end()) {
+      candidates.insert(bucket_it->second.begin(), bucket_it->second.end());
+    }
+
+    for (const uint32_t id : candidates) {
+      const Entry& entry = *_entries.at(id);
+      if (matches(entry, query, query_program)) {
+        devices.push_back(entry.device);
+      }
+    }
+
+    return devices;
+  }
+
+  size_t DeviceIndex::size() const
+  {
+    return _entries.size();
+  }
+
+  bool DeviceIndex::matches(const Entry& entry, const Rule& query, const RuleProgram& query_program) const
+  {
+    if (!entry.rule) {
+      return query.appliesTo(entry.device->getCachedDeviceRule());
+    }
+    if (query_program.isValid() && entry.program.isValid()) {
+      return query_program.appliesTo(entry.program);
+    }
+    return query.appliesTo(*entry.rule);
+  }
+
+  StringKeyMap<DeviceIndex::Bucket>& DeviceIndex::buckets(RuleIndex::KeyType type)
+  {
+    return const_cast<StringKeyMap<Bucket>&>(static_cast<const DeviceIndex*>(this)->buckets(type));
+  }
+
+  const StringKeyMap<DeviceIndex::Bucket>& DeviceIndex::buckets(RuleIndex::KeyType type) const
+  {
+    switch(type) {
+      case RuleIndex::KeyType::Hash:
+        return _hash_buckets;
+      case RuleIndex::KeyType::DeviceID:
+        return _device_id_buckets;
+      case RuleIndex::KeyType::Serial:
+        return _serial_buckets;
+      case RuleIndex::KeyType::ParentHash:
+        return _parent_hash_buckets;
+      case RuleIndex::KeyType::ViaPort:
+        return _via_port_buckets;
+      case RuleIndex::KeyType::Vendor:
+        return _vendor_buckets;
+      case RuleIndex::KeyType::None:
+        break;
+    }
+    throw std::runtime_error("BUG: DeviceIndex: invalid key type");
+  }
+
+  /*
+   * Call `callback' for each single valued attribute of an
+   * indexed device rule which can be used as a bucket key.
+   */
+  void DeviceIndex::forEachKey(const Entry& entry,
+    const std::function<void(RuleIndex::KeyType, const String&)>& callback) const
+  {
+    const Rule& rule = *entry.rule;
+
+    const auto& hash = rule.attributeHash();
+    if (hash.count() == 1) {
+      callback(RuleIndex::KeyType::Hash, hash.get());
+    }
+
+    const auto& device_id = rule.attributeDeviceID();
+    if (device_id.count() == 1) {
+      callback(RuleIndex::KeyType::DeviceID,
+               device_id.get().getVendorID() + ":" + device_id.get().getProductID());
+      callback(RuleIndex::KeyType::Vendor, device_id.get().getVendorID());
+    }
+
+    const auto& serial = rule.attributeSerial();
+    if (serial.count() == 1) {
+      callback(RuleIndex::KeyType::Serial, serial.get());
+    }
+
+    const auto& parent_hash = rule.attributeParentHash();
+    if (parent_hash.count() == 1) {
+      callback(RuleIndex::KeyType::ParentHash, parent_hash.get());
+    }
+
+    const auto& via_port = rule.attributeViaPort();
+    if (via_port.count() == 1) {
+      callback(RuleIndex::KeyType::ViaPort, via_port.get());
+    }
+
+    return;
+  }
+} /* namespace usbguard */
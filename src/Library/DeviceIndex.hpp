@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "RuleIndex.hpp"
+#include "RuleProgram.hpp"
+#include "Device.hpp"
+#include <map>
+#include <set>
+#include <functional>
+
+namespace usbguard {
+  /*
+   * Attribute index over the devices known to a device manager.
+   * Each device is stored together with its device rule and the
+   * compiled device rule program, so that a query doesn't have
+   * to regenerate the device rules. Devices are additionally
+   * bucketed by their hash, device id, serial number, parent
+   * hash, port and vendor id values, so that a query which can only match one particular value
+   * of these (see RuleIndex::ruleKey) visits only the devices
+   * with that value.
+   */
+  class DeviceIndex
+  {
+  public:
+    DeviceIndex();
+
+    /*
+     * Index a device. The device rule is generated here, so the
+     * device attributes must not be modified after this call.
+     * If the device rule cannot be generated, or the device hash
+     * is deferred, the device is evaluated using its cached device
+     * rule on each query.
+     */
+    void insert(const Pointer<Device>& device);
+    void remove(uint32_t id);
+    void clear();
+
+    /*
+     * Return the devices to which the query rule applies
+     * (ignoring the rule target and conditions), ordered
+     * by the device id.
+     */
+    PointerVector<Device> find(const Rule& query) const;
+
+    size_t size() const;
+
+  private:
+    struct Entry {
+      Entry(const Pointer<Device>& device_ptr);
+
+      Pointer<Device> device;
+      Pointer<const Rule> rule;
+      RuleProgram program;
+    };
+
+    typedef std::set<uint32_t> Bucket;
+
+    bool matches(const Entry& entry, const Rule& query, const RuleProgram& query_program) const;
+    StringKeyMap<Bucket>& buckets(RuleIndex::KeyType type);
+    const StringKeyMap<Bucket>& buckets(RuleIndex::KeyType type) const;
+    void forEachKey(const Entry& entry, const std::function<void(RuleIndex::KeyType, const String&)>& callback) const;
+
+    std::map<uint32_t, Pointer<const Entry>> _entries;
+    StringKeyMap<Bucket> _hash_buckets;
+    StringKeyMap<Bucket> _device_id_buckets;
+    StringKeyMap<Bucket> _serial_buckets;
+    StringKeyMap<Bucket> _parent_hash_buckets;
+    StringKeyMap<Bucket> _via_port_buckets;
+    StringKeyMap<Bucket> _vendor_buckets;
+    Bucket _unindexed;
+  };
+} /* namespace usbguard */
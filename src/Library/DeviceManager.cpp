@@ -48,6 +48,63 @@ namespace usbguard {
     return;
   }
 
+  void DeviceManager::setCheckpointFile(const String& path)
+  {
+    (void)path;
+    return;
+  }
+
+  void DeviceManager::setKernelEventSource(bool enabled)
+  {
+    (void)enabled;
+    return;
+  }
+
+  void DeviceManager::setEventBufferSize(size_t size)
+  {
+    (void)size;
+    return;
+  }
+
+  void DeviceManager::setSysfsRoot(const String& path)
+  {
+    (void)path;
+    return;
+  }
+
+  void DeviceManager::setEventStream(const String& path)
+  {
+    (void)path;
+    return;
+  }
+
+  void DeviceManager::setControllerAuthorizedDefault(const std::map<String, AuthorizedDefault>& controllers)
+  {
+    (void)controllers;
+    return;
+  }
+
+  DeviceManager::AuthorizedDefault DeviceManager::getAuthorizedDefault(const Device& device) const
+  {
+    (void)device;
+    return AuthorizedDefault::None;
+  }
+
+  void DeviceManager::setInterfaceAuthorization(bool enabled)
+  {
+    if (enabled) {
+      throw std::runtime_error("Interface authorization isn't supported by the device manager");
+    }
+    return;
+  }
+
+  Pointer<Device> DeviceManager::allowDeviceInterfaces(uint32_t id, const std::vector<USBInterfaceType>& interface_types)
+  {
+    (void)id;
+    (void)interface_types;
+    throw std::runtime_error("Interface authorization isn't supported by the device manager");
+  }
+
   void DeviceManager::insertDevice(Pointer<Device> device)
   {
     d_pointer->insertDevice(device);
@@ -59,35 +116,105 @@ namespace usbguard {
     return d_pointer->removeDevice(id);
   }
 
+  PointerVector<Device> DeviceManager::removeDevices(const std::vector<uint32_t>& ids)
+  {
+    return d_pointer->removeDevices(ids);
+  }
+
   PointerVector<Device> DeviceManager::getDeviceList()
   {
     return d_pointer->getDeviceList();
   }
 
+  void DeviceManager::forEachDevice(const std::function<void(const Pointer<Device>&)>& callback) const
+  {
+    d_pointer->forEachDevice(callback);
+    return;
+  }
+
   PointerVector<Device> DeviceManager::getDeviceList(const Rule& query)
   {
     PointerVector<Device> matching_devices;
 
-    for (auto const& device : getDeviceList()) {
-      if (query.appliesTo(device->getDeviceRule())) {
-        switch(query.getTarget()) {
+    for (auto const& device : d_pointer->getDeviceList(query)) {
+      switch(query.getTarget()) {
+        case Rule::Target::Allow:
+        case Rule::Target::Block:
+          if (device->getTarget() == query.getTarget()) {
+            matching_devices.push_back(device);
+          }
+          break;
+        case Rule::Target::Device:
+        case Rule::Target::Match:
+          matching_devices.push_back(device);
+          break;
+        default:
+          throw std::runtime_error("Invalid device query target");
+      }
+    }
+
+    return matching_devices;
+  }
+
+  PointerVector<Device> DeviceManager::getDeviceSubtree(uint32_t id)
+  {
+    return d_pointer->getDeviceSubtree(id);
+  }
+
+  PointerVector<Device> DeviceManager::getDeviceSubtree(uint32_t id, const Rule& query)
+  {
+    std::set<uint32_t> matching_ids;
+
+    for (auto const& device : getDeviceList(query)) {
+      matching_ids.insert(device->getID());
+    }
+
+    PointerVector<Device> subtree;
+
+    for (auto const& device : d_pointer->getDeviceSubtree(id)) {
+      if (matching_ids.count(device->getID()) > 0) {
+        subtree.push_back(device);
+      }
+    }
+
+    return subtree;
+  }
+
+  std::vector<DeviceManager::TargetResult> \
+  DeviceManager::applyDeviceTargets(const std::vector<std::pair<uint32_t, Rule::Target>>& targets)
+  {
+    std::vector<TargetResult> results;
+
+    for (auto const& id_target : targets) {
+      TargetResult result;
+
+      result.id = id_target.first;
+      result.target = id_target.second;
+
+      try {
+        switch(result.target) {
           case Rule::Target::Allow:
+            result.device = allowDevice(result.id);
+            break;
           case Rule::Target::Block:
-            if (device->getTarget() == query.getTarget()) {
-              matching_devices.push_back(device);
-            }
+            result.device = blockDevice(result.id);
             break;
-          case Rule::Target::Device:
-          case Rule::Target::Match:
-            matching_devices.push_back(device);
+          case Rule::Target::Reject:
+            result.device = rejectDevice(result.id);
             break;
           default:
-            throw std::runtime_error("Invalid device query target");
+            throw std::runtime_error("Unknown rule target in applyDeviceTargets");
         }
       }
+      catch(const std::exception& ex) {
+        result.device = nullptr;
+        result.error = ex.what();
+      }
+
+      results.push_back(std::move(result));
     }
 
-    return matching_devices;
+    return results;
   }
 
   Pointer<Device> DeviceManager::getDevice(uint32_t id)
@@ -107,12 +234,24 @@ namespace usbguard {
     return;
   }
 
+  void DeviceManager::DevicesPresent(const PointerVector<Device>& devices)
+  {
+    d_pointer->DevicesPresent(devices);
+    return;
+  }
+
   void DeviceManager::DeviceRemoved(Pointer<Device> device)
   {
     d_pointer->DeviceRemoved(device);
     return;
   }
 
+  void DeviceManager::DevicesRemoved(const PointerVector<Device>& devices)
+  {
+    d_pointer->DevicesRemoved(devices);
+    return;
+  }
+
   void DeviceManager::DeviceAllowed(Pointer<Device> device)
   {
     d_pointer->DeviceAllowed(device);
@@ -130,18 +269,48 @@ namespace usbguard {
     d_pointer->DeviceRejected(device);
     return;
   }
+
+  void DeviceManager::DeviceTargetApplied(uint32_t id, Rule::Target target, int error)
+  {
+    d_pointer->DeviceTargetApplied(id, target, error);
+    return;
+  }
+
+  bool DeviceManager::DeviceHashRequired()
+  {
+    return d_pointer->DeviceHashRequired();
+  }
+
+  void DeviceManager::ThreadStarted()
+  {
+    d_pointer->ThreadStarted();
+    return;
+  }
+
+  void DeviceManager::updateParentHash(uint32_t parent_id, const String& hash)
+  {
+    d_pointer->updateParentHash(parent_id, hash);
+    return;
+  }
 } /* namespace usbguard */
 
 #if defined(__linux__)
 # include "LinuxDeviceManager.hpp"
+# include "VirtualDeviceManager.hpp"
 #endif
 
-usbguard::Pointer<usbguard::DeviceManager> usbguard::DeviceManager::create(DeviceManagerHooks& hooks)
+usbguard::Pointer<usbguard::DeviceManager> usbguard::DeviceManager::create(DeviceManagerHooks& hooks, const String& backend)
 {
 #if defined(__linux__)
+  if (backend == "virtual") {
+    return usbguard::makePointer<usbguard::VirtualDeviceManager>(hooks);
+  }
+  if (backend != "linux") {
+    throw std::runtime_error("Unknown device manager backend: " + backend);
+  }
   auto dm = usbguard::makePointer<usbguard::LinuxDeviceManager>(hooks);
 #else
 # error "No DeviceManager implementation available"
 #endif
-  return std::move(dm);
+  return dm;
 }
@@ -21,6 +21,8 @@
 #include <RuleSet.hpp>
 #include <Device.hpp>
 #include <mutex>
+#include <functional>
+#include <map>
 
 namespace usbguard {
   class DeviceManagerHooks;
@@ -35,6 +37,63 @@ namespace usbguard {
     virtual ~DeviceManager();
 
     virtual void setDefaultBlockedState(bool state) = 0;
+    /*
+     * Write a checkpoint of the devices to the file at path when
+     * the manager stops and use it on the next start to skip the
+     * work for the devices which didn't change. Implementations
+     * which don't support checkpoints ignore this.
+     */
+    virtual void setCheckpointFile(const String& path);
+    /*
+     * Receive the device events directly from the kernel instead of
+     * after the device manager of the system (e.g. udevd) processed
+     * them, so that devices are authorized as soon as the kernel
+     * announces them. Has to be set before start(). Implementations
+     * with a single event source ignore this.
+     */
+    virtual void setKernelEventSource(bool enabled);
+    /*
+     * Size of the receive buffer of the device events, in bytes.
+     * If events are lost because the buffer overflowed anyway, the
+     * device list is resynchronized with the system. Has to be set
+     * before start(). Implementations without a buffer ignore this.
+     */
+    virtual void setEventBufferSize(size_t size);
+    /*
+     * Directory with the sysfs tree and path of the device event
+     * stream of an implementation which doesn't use the ones of the
+     * system (see VirtualDeviceManager). Have to be set before
+     * start(). Other implementations ignore these.
+     */
+    virtual void setSysfsRoot(const String& path);
+    virtual void setEventStream(const String& path);
+
+    /*
+     * Default authorization of the devices connected to a controller
+     * which the kernel applies before the daemon sees them: none,
+     * all the devices, or the internal (hardwired) devices only.
+     */
+    enum class AuthorizedDefault {
+      None,
+      All,
+      Internal
+    };
+
+    /*
+     * Default authorization of the devices behind the given USB
+     * controllers, named by their root hub (usbN) or their host
+     * controller device (e.g. the PCI address). The rest of the
+     * controllers block all new devices. Implementations which
+     * don't support this ignore it.
+     */
+    virtual void setControllerAuthorizedDefault(const std::map<String, AuthorizedDefault>& controllers);
+
+    /*
+     * The default authorization in effect for the controller of the
+     * device. A device allowed by the kernel this way doesn't need a
+     * policy decision.
+     */
+    virtual AuthorizedDefault getAuthorizedDefault(const Device& device) const;
     virtual void start() = 0;
     virtual void stop() = 0;
     virtual void scan() = 0;
@@ -42,25 +101,104 @@ namespace usbguard {
     virtual Pointer<Device> blockDevice(uint32_t id) = 0;
     virtual Pointer<Device> rejectDevice(uint32_t id) = 0;
 
+    /**
+     * Authorize devices per interface. When enabled, the interfaces
+     * of newly authorized devices are not authorized by default and
+     * allowing a device authorizes all of its interfaces explicitly.
+     * Implementations which don't support this throw an exception
+     * when it's enabled.
+     */
+    virtual void setInterfaceAuthorization(bool enabled);
+
+    /**
+     * Allow a device, but authorize only the interfaces of the given
+     * types. The rest of the interfaces stay unauthorized. Requires
+     * interface authorization to be enabled.
+     */
+    virtual Pointer<Device> allowDeviceInterfaces(uint32_t id, const std::vector<USBInterfaceType>& interface_types);
+
+    /**
+     * Result of applying a target to one device of a batch.
+     */
+    struct TargetResult
+    {
+      uint32_t id;
+      Rule::Target target;
+      Pointer<Device> device; /**< nullptr if the target wasn't applied */
+      String error; /**< Reason why the target wasn't applied */
+    };
+
+    /**
+     * Apply targets to several devices in one call. A failure for one
+     * device doesn't stop the rest of the batch, it is reported in
+     * the result of that device. Results are returned in the order
+     * of the requested targets.
+     */
+    virtual std::vector<TargetResult> applyDeviceTargets(const std::vector<std::pair<uint32_t, Rule::Target>>& targets);
+
     virtual void insertDevice(Pointer<Device> device);
     Pointer<Device> removeDevice(uint32_t id);
+    /*
+     * Remove the devices with the given ids and all the devices
+     * connected behind them in one batch. Unknown ids are ignored.
+     * The removed devices are returned with every device listed
+     * before its parent.
+     */
+    PointerVector<Device> removeDevices(const std::vector<uint32_t>& ids);
 
     /* Returns a copy of the list of active USB devices */
     PointerVector<Device> getDeviceList();
     PointerVector<Device> getDeviceList(const Rule& query);
+    /*
+     * Visit the active USB devices without copying the list.
+     * The visiting order is unspecified and the callback must
+     * not insert or remove devices.
+     */
+    void forEachDevice(const std::function<void(const Pointer<Device>&)>& callback) const;
 
     Pointer<Device> getDevice(uint32_t id);
+
+    /*
+     * Returns the device with the given id followed by all the
+     * devices connected behind it, in pre-order (every parent is
+     * listed before its children). The tree is maintained on
+     * insert/remove, so this costs O(subtree size). With
+     * Rule::RootID, all the devices are returned in tree order.
+     */
+    PointerVector<Device> getDeviceSubtree(uint32_t id);
+    /*
+     * Same as getDeviceSubtree, limited to the devices to which
+     * the query rule applies (see getDeviceList).
+     */
+    PointerVector<Device> getDeviceSubtree(uint32_t id, const Rule& query);
+
     std::mutex& refDeviceMapMutex();
 
     /* Call Daemon instance hooks */
     void DeviceInserted(Pointer<Device> device);
     void DevicePresent(Pointer<Device> device);
+    void DevicesPresent(const PointerVector<Device>& devices);
     void DeviceRemoved(Pointer<Device> device);
+    void DevicesRemoved(const PointerVector<Device>& devices);
     void DeviceAllowed(Pointer<Device> device);
     void DeviceBlocked(Pointer<Device> device);
     void DeviceRejected(Pointer<Device> device);
+    void DeviceTargetApplied(uint32_t id, Rule::Target target, int error);
+    bool DeviceHashRequired();
+    void ThreadStarted();
+
+    /*
+     * Set the parent hash of the devices whose parent is the device
+     * parent_id. Called when the hash of an inserted device changes.
+     */
+    void updateParentHash(uint32_t parent_id, const String& hash);
 
-    static Pointer<DeviceManager> create(DeviceManagerHooks& hooks);
+    /*
+     * Create a device manager of the backend: "linux" for the devices
+     * of the system, "virtual" for the devices of a synthetic sysfs
+     * tree.
+     */
+    static Pointer<DeviceManager> create(DeviceManagerHooks& hooks, const String& backend = "linux");
 
   private:
     DeviceManagerPrivate *d_pointer;
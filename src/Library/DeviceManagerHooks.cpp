@@ -32,12 +32,28 @@ namespace usbguard
     return;
   }
   
+  void DeviceManagerHooks::dmHookDevicesPresent(const PointerVector<Device>& devices)
+  {
+    for (auto const& device : devices) {
+      dmHookDevicePresent(device);
+    }
+    return;
+  }
+
   void DeviceManagerHooks::dmHookDeviceRemoved(Pointer<Device> device)
   {
     /* NOOP */
     return;
   }
   
+  void DeviceManagerHooks::dmHookDevicesRemoved(const PointerVector<Device>& devices)
+  {
+    for (auto const& device : devices) {
+      dmHookDeviceRemoved(device);
+    }
+    return;
+  }
+
   void DeviceManagerHooks::dmHookDeviceAllowed(Pointer<Device> device)
   {
     /* NOOP */
@@ -55,4 +71,21 @@ namespace usbguard
     /* NOOP */
     return;
   }
+
+  void DeviceManagerHooks::dmHookDeviceTargetApplied(uint32_t id, Rule::Target target, int error)
+  {
+    /* NOOP */
+    return;
+  }
+
+  bool DeviceManagerHooks::dmHookDeviceHashRequired()
+  {
+    return true;
+  }
+
+  void DeviceManagerHooks::dmHookThreadStarted()
+  {
+    /* NOOP */
+    return;
+  }
 } /* namespace usbguard */
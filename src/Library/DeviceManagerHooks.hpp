@@ -29,10 +29,43 @@ namespace usbguard
   public:
     virtual void dmHookDeviceInserted(Pointer<Device> device);
     virtual void dmHookDevicePresent(Pointer<Device> device);
+    /*
+     * Called once with all the devices found present when the
+     * devices are enumerated, parents before their children. It's
+     * called even if no device was found, so it also marks the end
+     * of the enumeration. The default calls dmHookDevicePresent for
+     * each device.
+     */
+    virtual void dmHookDevicesPresent(const PointerVector<Device>& devices);
     virtual void dmHookDeviceRemoved(Pointer<Device> device);
+    /*
+     * Called when a whole subtree of devices was removed at once,
+     * e.g. a hub with the devices behind it. The children are listed
+     * before their parents. The default calls dmHookDeviceRemoved
+     * for each device.
+     */
+    virtual void dmHookDevicesRemoved(const PointerVector<Device>& devices);
     virtual void dmHookDeviceAllowed(Pointer<Device> device);
     virtual void dmHookDeviceBlocked(Pointer<Device> device);
     virtual void dmHookDeviceRejected(Pointer<Device> device);
+    /*
+     * Called when the target of a device was written to the system,
+     * which may happen asynchronously and from another thread. The
+     * error is 0 or an errno value.
+     */
+    virtual void dmHookDeviceTargetApplied(uint32_t id, Rule::Target target, int error);
+    /*
+     * Called while a new device is loaded, possibly from several
+     * threads at once. If false is returned, the device hash isn't
+     * computed until it's accessed. The default returns true.
+     */
+    virtual bool dmHookDeviceHashRequired();
+    /*
+     * Called from each thread of the device manager which handles
+     * the device events or writes the device targets, when the
+     * thread starts. The default does nothing.
+     */
+    virtual void dmHookThreadStarted();
     virtual uint32_t dmHookAssignID() = 0;
   };
 } /* namespace usbguard */
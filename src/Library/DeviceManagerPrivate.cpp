@@ -18,6 +18,7 @@
 //
 #include "DeviceManagerPrivate.hpp"
 #include <DeviceManagerHooks.hpp>
+#include <algorithm>
 
 namespace usbguard {
   DeviceManagerPrivate::DeviceManagerPrivate(DeviceManager& p_instance, DeviceManagerHooks& hooks)
@@ -36,49 +37,253 @@ namespace usbguard {
   
   const DeviceManagerPrivate& DeviceManagerPrivate::operator=(const DeviceManagerPrivate& rhs)
   {
-    std::unique_lock<std::mutex> local_device_map_lock(_device_map_mutex);
-    std::unique_lock<std::mutex> remote_device_map_lock(rhs._device_map_mutex);
-    _device_map = rhs._device_map;
+    _device_registry = rhs._device_registry;
+    std::unique_lock<std::mutex> local_device_index_lock(_device_index_mutex);
+    std::unique_lock<std::mutex> remote_device_index_lock(rhs._device_index_mutex);
+    _device_index = rhs._device_index;
+    std::unique_lock<std::mutex> local_device_tree_lock(_device_tree_mutex);
+    std::unique_lock<std::mutex> remote_device_tree_lock(rhs._device_tree_mutex);
+    _device_children = rhs._device_children;
+    _removed_parent_ids = rhs._removed_parent_ids;
     return *this;
   }
 
   void DeviceManagerPrivate::insertDevice(Pointer<Device> device)
   {
-    std::unique_lock<std::mutex> device_map_lock(_device_map_mutex);
-    const uint32_t id = _hooks.dmHookAssignID();
-    device->setID(id);
-    _device_map[id] = device;
+    {
+      std::unique_lock<std::mutex> device_map_lock(_device_map_mutex);
+      const uint32_t id = _hooks.dmHookAssignID();
+      device->setID(id);
+    }
+    /*
+     * The parent is always inserted before its children. Copy its
+     * hash now, so that generating the device rule doesn't have to
+     * look up the parent. A deferred parent hash is looked up when
+     * it's needed (see DevicePrivate::generateDeviceRule).
+     */
+    const uint32_t parent_id = device->getParentID();
+
+    if (parent_id != Rule::RootID) {
+      Pointer<Device> parent = _device_registry.find(parent_id);
+
+      if (parent && !parent->isHashDeferred()) {
+        device->setParentHash(parent->getHash());
+      }
+    }
+    _device_registry.insert(device);
+    {
+      std::unique_lock<std::mutex> device_tree_lock(_device_tree_mutex);
+      _device_children[parent_id].insert(device->getID());
+    }
+    std::unique_lock<std::mutex> device_index_lock(_device_index_mutex);
+    _device_index.insert(device);
+    return;
+  }
+
+  void DeviceManagerPrivate::updateParentHash(const uint32_t parent_id, const String& hash)
+  {
+    std::vector<uint32_t> child_ids;
+    {
+      std::unique_lock<std::mutex> device_tree_lock(_device_tree_mutex);
+      auto it = _device_children.find(parent_id);
+
+      if (it != _device_children.end()) {
+        child_ids.assign(it->second.begin(), it->second.end());
+      }
+    }
+
+    for (const uint32_t child_id : child_ids) {
+      Pointer<Device> child = _device_registry.find(child_id);
+
+      if (child) {
+        child->setParentHash(hash);
+      }
+    }
+
     return;
   }
 
   Pointer<Device> DeviceManagerPrivate::removeDevice(uint32_t id)
   {
-    std::unique_lock<std::mutex> device_map_lock(_device_map_mutex);
-    auto it = _device_map.find(id);
-    if (it == _device_map.end()) {
+    Pointer<Device> device = _device_registry.remove(id);
+    if (!device) {
       throw std::runtime_error("Unknown device, cannot remove from device map");
     }
-    Pointer<Device> device = it->second;
-    _device_map.erase(it);
+    {
+      std::unique_lock<std::mutex> device_tree_lock(_device_tree_mutex);
+      unlinkDevice(id, device->getParentID());
+    }
+    std::unique_lock<std::mutex> device_index_lock(_device_index_mutex);
+    _device_index.remove(id);
     return device;
   }
 
-  PointerVector<Device> DeviceManagerPrivate::getDeviceList()
+  /*
+   * The devices of the batch are sorted by their depth within the
+   * batch, so every device is removed before its parent.
+   */
+  PointerVector<Device> DeviceManagerPrivate::removeDevices(const std::vector<uint32_t>& ids)
+  {
+    std::map<uint32_t, Pointer<Device>> batch;
+
+    for (const uint32_t id : ids) {
+      try {
+        for (auto const& device : getDeviceSubtree(id)) {
+          batch.emplace(device->getID(), device);
+        }
+      }
+      catch(...) {
+        /* Unknown device, e.g. already removed with its parent */
+      }
+    }
+
+    std::vector<std::pair<size_t, uint32_t>> removal_order;
+    removal_order.reserve(batch.size());
+
+    for (auto const& entry : batch) {
+      size_t depth = 0;
+      auto it = batch.find(entry.second->getParentID());
+
+      while (it != batch.end()) {
+        ++depth;
+        it = batch.find(it->second->getParentID());
+      }
+
+      removal_order.emplace_back(depth, entry.first);
+    }
+
+    std::sort(removal_order.begin(), removal_order.end(),
+              [](const std::pair<size_t, uint32_t>& a, const std::pair<size_t, uint32_t>& b) {
+      return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+
+    PointerVector<Device> removed_devices;
+    removed_devices.reserve(removal_order.size());
+
+    for (auto const& entry : removal_order) {
+      try {
+        removed_devices.push_back(removeDevice(entry.second));
+      }
+      catch(...) {
+        /* Removed concurrently */
+      }
+    }
+
+    return removed_devices;
+  }
+
+  /*
+   * A removed device stays linked to its parent while it has
+   * children, so that they're still reachable in the tree. Once its
+   * last child is gone, it's unlinked as well. Called with the tree
+   * lock held, after the device was removed from the registry.
+   */
+  void DeviceManagerPrivate::unlinkDevice(uint32_t id, uint32_t parent_id)
   {
-    std::unique_lock<std::mutex> device_map_lock(_device_map_mutex);
-    PointerVector<Device> devices;
+    while (true) {
+      auto it = _device_children.find(id);
+
+      if (it != _device_children.end()) {
+        if (!it->second.empty()) {
+          _removed_parent_ids[id] = parent_id;
+          return;
+        }
+        _device_children.erase(it);
+      }
+
+      it = _device_children.find(parent_id);
+
+      if (it == _device_children.end()) {
+        return;
+      }
 
-    for (auto& map_entry : _device_map) {
-      devices.push_back(map_entry.second);
+      it->second.erase(id);
+
+      auto removed_it = _removed_parent_ids.find(parent_id);
+
+      if (!it->second.empty() || removed_it == _removed_parent_ids.end()) {
+        return;
+      }
+
+      /* The parent was removed before its last child, unlink it too */
+      id = parent_id;
+      parent_id = removed_it->second;
+      _removed_parent_ids.erase(removed_it);
     }
+  }
+
+  PointerVector<Device> DeviceManagerPrivate::getDeviceList()
+  {
+    return _device_registry.list();
+  }
 
-    return devices;
+  PointerVector<Device> DeviceManagerPrivate::getDeviceList(const Rule& query)
+  {
+    std::unique_lock<std::mutex> device_index_lock(_device_index_mutex);
+    return _device_index.find(query);
   }
 
   Pointer<Device> DeviceManagerPrivate::getDevice(uint32_t id)
   {
-    std::unique_lock<std::mutex> device_map_lock(_device_map_mutex);
-    return _device_map.at(id);
+    return _device_registry.at(id);
+  }
+
+  /*
+   * Walks the topology tree in pre-order. The ids are collected
+   * under the tree lock, the devices are looked up afterwards, so
+   * a device removed meanwhile is left out.
+   */
+  PointerVector<Device> DeviceManagerPrivate::getDeviceSubtree(uint32_t id)
+  {
+    std::vector<uint32_t> subtree_ids;
+    {
+      std::unique_lock<std::mutex> device_tree_lock(_device_tree_mutex);
+      std::vector<uint32_t> stack;
+
+      if (id == Rule::RootID) {
+        auto it = _device_children.find(Rule::RootID);
+        if (it != _device_children.end()) {
+          stack.assign(it->second.rbegin(), it->second.rend());
+        }
+      }
+      else {
+        stack.push_back(id);
+      }
+
+      while (!stack.empty()) {
+        const uint32_t current_id = stack.back();
+        stack.pop_back();
+        subtree_ids.push_back(current_id);
+
+        auto it = _device_children.find(current_id);
+
+        if (it != _device_children.end()) {
+          stack.insert(stack.end(), it->second.rbegin(), it->second.rend());
+        }
+      }
+    }
+
+    PointerVector<Device> subtree;
+    subtree.reserve(subtree_ids.size());
+
+    for (const uint32_t subtree_id : subtree_ids) {
+      Pointer<Device> device = _device_registry.find(subtree_id);
+
+      if (device) {
+        subtree.push_back(device);
+      }
+      else if (subtree_id == id) {
+        throw std::runtime_error("Unknown device, cannot list its subtree");
+      }
+    }
+
+    return subtree;
+  }
+
+  void DeviceManagerPrivate::forEachDevice(const std::function<void(const Pointer<Device>&)>& callback) const
+  {
+    _device_registry.forEach(callback);
+    return;
   }
 
   void DeviceManagerPrivate::DeviceInserted(Pointer<Device> device)
@@ -93,12 +298,24 @@ namespace usbguard {
     return;
   }
 
+  void DeviceManagerPrivate::DevicesPresent(const PointerVector<Device>& devices)
+  {
+    _hooks.dmHookDevicesPresent(devices);
+    return;
+  }
+
   void DeviceManagerPrivate::DeviceRemoved(Pointer<Device> device)
   {
     _hooks.dmHookDeviceRemoved(device);
     return;
   }
 
+  void DeviceManagerPrivate::DevicesRemoved(const PointerVector<Device>& devices)
+  {
+    _hooks.dmHookDevicesRemoved(devices);
+    return;
+  }
+
   void DeviceManagerPrivate::DeviceAllowed(Pointer<Device> device)
   {
     _hooks.dmHookDeviceAllowed(device);
@@ -116,4 +333,21 @@ namespace usbguard {
     _hooks.dmHookDeviceRejected(device);
     return;
   }
+
+  void DeviceManagerPrivate::DeviceTargetApplied(uint32_t id, Rule::Target target, int error)
+  {
+    _hooks.dmHookDeviceTargetApplied(id, target, error);
+    return;
+  }
+
+  bool DeviceManagerPrivate::DeviceHashRequired()
+  {
+    return _hooks.dmHookDeviceHashRequired();
+  }
+
+  void DeviceManagerPrivate::ThreadStarted()
+  {
+    _hooks.dmHookThreadStarted();
+    return;
+  }
 } /* namespace usbguard */
@@ -21,7 +21,11 @@
 #include <Typedefs.hpp>
 #include <RuleSet.hpp>
 #include <Device.hpp>
+#include "DeviceIndex.hpp"
+#include "DeviceRegistry.hpp"
+#include <map>
 #include <mutex>
+#include <set>
 
 namespace usbguard {
   class DeviceManagerHooks;
@@ -33,26 +37,62 @@ namespace usbguard {
     const DeviceManagerPrivate& operator=(const DeviceManagerPrivate& rhs);
     
     void insertDevice(Pointer<Device> device);
+    void updateParentHash(uint32_t parent_id, const String& hash);
     Pointer<Device> removeDevice(uint32_t id);
+    PointerVector<Device> removeDevices(const std::vector<uint32_t>& ids);
 
     /* Returns a copy of the list of active USB devices */
     PointerVector<Device> getDeviceList();
+    /* Returns the active USB devices to which the query rule applies */
+    PointerVector<Device> getDeviceList(const Rule& query);
     Pointer<Device> getDevice(uint32_t id);
+    /* Returns the device and the devices behind it, parents first */
+    PointerVector<Device> getDeviceSubtree(uint32_t id);
+    /* Visit the active USB devices without copying the list */
+    void forEachDevice(const std::function<void(const Pointer<Device>&)>& callback) const;
     std::mutex& refDeviceMapMutex();
 
     /* Call Daemon instance hooks */
     void DeviceInserted(Pointer<Device> device);
     void DevicePresent(Pointer<Device> device);
+    void DevicesPresent(const PointerVector<Device>& devices);
     void DeviceRemoved(Pointer<Device> device);
+    void DevicesRemoved(const PointerVector<Device>& devices);
     void DeviceAllowed(Pointer<Device> device);
     void DeviceBlocked(Pointer<Device> device);
     void DeviceRejected(Pointer<Device> device);
+    void DeviceTargetApplied(uint32_t id, Rule::Target target, int error);
+    bool DeviceHashRequired();
+    void ThreadStarted();
 
   private:
     DeviceManager& _p_instance;
     DeviceManagerHooks& _hooks;
+    /*
+     * Serializes device id assignment. The registry itself
+     * is protected by its per-shard locks.
+     */
     mutable std::mutex _device_map_mutex;
-    PointerMap<uint32_t, Device> _device_map;
+    DeviceRegistry _device_registry;
+    /*
+     * Updated on insert/remove. It has its own mutex because
+     * generating a device rule for the index may need to look
+     * up the parent device in the device registry.
+     */
+    mutable std::mutex _device_index_mutex;
+    DeviceIndex _device_index;
+    /*
+     * Topology tree: the ids of the children of each device, with
+     * Rule::RootID for the devices connected to the root. Updated on
+     * insert/remove. A removed device stays in the tree until all of
+     * its children are removed too (see unlinkDevice).
+     */
+    mutable std::mutex _device_tree_mutex;
+    std::map<uint32_t, std::set<uint32_t>> _device_children;
+    /* Parents of the removed devices which still have children */
+    std::map<uint32_t, uint32_t> _removed_parent_ids;
+
+    void unlinkDevice(uint32_t id, uint32_t parent_id);
   };
 
 } /* namespace usbguard */
@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DeviceMirror.hpp"
+#include <stdexcept>
+
+namespace usbguard
+{
+  DeviceMirror::DeviceMirror()
+    : _valid(false),
+      _stale(false),
+      _generation(0)
+  {
+  }
+
+  void DeviceMirror::reset(uint64_t generation, const std::vector<Rule>& devices)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _devices.clear();
+
+    for (auto const& device : devices) {
+      _devices.emplace(device.getRuleID(), device);
+    }
+
+    _generation = generation;
+    _valid = true;
+  }
+
+  bool DeviceMirror::apply(const Interface::StateChanges& changes)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_valid || !changes.complete) {
+      return false;
+    }
+
+    for (auto const& change : changes.devices) {
+      if (change.removed) {
+        _devices.erase(change.id);
+      }
+      else {
+        _devices[change.id] = change.rule;
+      }
+    }
+
+    _generation = changes.generation;
+    return true;
+  }
+
+  void DeviceMirror::invalidate()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _devices.clear();
+    _valid = false;
+    _generation = 0;
+  }
+
+  void DeviceMirror::markStale()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stale = true;
+  }
+
+  void DeviceMirror::clearStale()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stale = false;
+  }
+
+  bool DeviceMirror::isValid() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _valid;
+  }
+
+  bool DeviceMirror::isStale() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _stale;
+  }
+
+  uint64_t DeviceMirror::generation() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _generation;
+  }
+
+  size_t DeviceMirror::size() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _devices.size();
+  }
+
+  std::vector<Rule> DeviceMirror::query(const Rule& query) const
+  {
+    const Rule::Target target = query.getTarget();
+
+    switch(target) {
+      case Rule::Target::Allow:
+      case Rule::Target::Block:
+      case Rule::Target::Device:
+      case Rule::Target::Match:
+        break;
+      default:
+        throw std::runtime_error("Invalid device query target");
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<Rule> devices;
+
+    for (auto const& entry : _devices) {
+      const Rule& device = entry.second;
+
+      if ((target == Rule::Target::Allow || target == Rule::Target::Block) &&
+          device.getTarget() != target) {
+        continue;
+      }
+      if (query.appliesTo(device)) {
+        devices.push_back(device);
+      }
+    }
+
+    return devices;
+  }
+} /* namespace usbguard */
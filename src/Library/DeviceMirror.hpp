@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "Interface.hpp"
+#include "Rule.hpp"
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace usbguard
+{
+  /*
+   * Local copy of the device rules of the daemon, as of a state
+   * generation (see Interface::getChangesSince). The copy is loaded
+   * from a full device list and kept up to date with the changes
+   * made after its generation. A device signal marks it stale, so
+   * that the changes are fetched before the next query.
+   */
+  class DLL_PUBLIC DeviceMirror
+  {
+  public:
+    DeviceMirror();
+
+    /* Replace the content with the devices listed at `generation' */
+    void reset(uint64_t generation, const std::vector<Rule>& devices);
+
+    /*
+     * Apply the changes made after the generation of the mirror.
+     * Returns false, and leaves the mirror unchanged, if the changes
+     * aren't complete; the mirror has to be reset then.
+     */
+    bool apply(const Interface::StateChanges& changes);
+
+    /* Drop the content, e.g. when the connection is lost */
+    void invalidate();
+
+    void markStale();
+
+    /*
+     * Clear the stale mark. Call before fetching the changes: a
+     * signal received meanwhile marks the mirror stale again.
+     */
+    void clearStale();
+
+    bool isValid() const;
+    bool isStale() const;
+    uint64_t generation() const;
+    size_t size() const;
+
+    /*
+     * The devices the query applies to, in the order of their ids.
+     * The query target selects the devices the same way as in the
+     * daemon: allow and block by the device target, match and device
+     * select all of them.
+     */
+    std::vector<Rule> query(const Rule& query) const;
+
+  private:
+    mutable std::mutex _mutex;
+    bool _valid;
+    bool _stale;
+    uint64_t _generation;
+    std::map<uint32_t, Rule> _devices;
+  };
+} /* namespace usbguard */
@@ -20,9 +20,27 @@
 #include "DeviceManager.hpp"
 #include "LoggerPrivate.hpp"
 #include "Hash.hpp"
+#include "Common/Utility.hpp"
 #include <mutex>
+#include <cstdint>
 
 namespace usbguard {
+  /*
+   * The hash computation and the rule cache of a device are guarded
+   * by mutexes shared by several devices, picked by the address of
+   * the device, instead of two mutexes in every device. Both of the
+   * critical sections are short or rare, so sharing the mutexes
+   * doesn't cause contention.
+   */
+  static const size_t device_mutex_stripes = 64;
+  static std::mutex hash_mutexes[device_mutex_stripes];
+  static std::mutex rule_cache_mutexes[device_mutex_stripes];
+
+  static size_t deviceMutexStripe(const DevicePrivate *device)
+  {
+    return (reinterpret_cast<uintptr_t>(device) >> 6) % device_mutex_stripes;
+  }
+
   DevicePrivate::DevicePrivate(Device& p_instance, DeviceManager& manager)
     : _p_instance(p_instance),
       _manager(manager)
@@ -30,12 +48,18 @@ namespace usbguard {
     _id = Rule::DefaultID;
     _parent_id = Rule::RootID;
     _target = Rule::Target::Unknown;
+    _rule_cache_generation = 0;
+    _rule_cache_variant[0] = _rule_cache_variant[1] = 0;
+    _owned_descriptors = nullptr;
+    _hash_deferred = false;
   }
 
   DevicePrivate::DevicePrivate(Device& p_instance, const DevicePrivate& rhs)
     : _p_instance(p_instance),
       _manager(rhs._manager)
   {
+    _rule_cache_generation = 0;
+    _rule_cache_variant[0] = _rule_cache_variant[1] = 0;
     *this = rhs;
   }
 
@@ -45,11 +69,13 @@ namespace usbguard {
     _parent_id = rhs._parent_id;
     _target = rhs._target;
     _name = rhs._name;
-    _device_id = rhs._device_id;
     _serial_number = rhs._serial_number;
     _port = rhs._port;
-    _interface_types = rhs._interface_types;
-    _hash_base64 = rhs._hash_base64;
+    _descriptors = rhs._descriptors;
+    _owned_descriptors = nullptr;
+    _hash = rhs._hash;
+    _hash_deferred = rhs._hash_deferred.load();
+    invalidateDeviceRules();
 
     return *this;
   }
@@ -64,17 +90,80 @@ namespace usbguard {
     return _mutex;
   }
 
-  Pointer<Rule> DevicePrivate::getDeviceRule(const bool with_port, const bool with_parent_hash)
+  std::mutex& DevicePrivate::hashMutex() const
+  {
+    return hash_mutexes[deviceMutexStripe(this)];
+  }
+
+  std::mutex& DevicePrivate::ruleCacheMutex() const
+  {
+    return rule_cache_mutexes[deviceMutexStripe(this)];
+  }
+
+  Pointer<Rule> DevicePrivate::getDeviceRule(const bool with_port, const bool with_parent_hash, const bool with_hash)
   {
+    return makePointer<Rule>(*getCachedDeviceRule(with_port, with_parent_hash, with_hash));
+  }
+
+  Pointer<const Rule> DevicePrivate::getCachedDeviceRule(const bool with_port, const bool with_parent_hash,
+                                                         const bool with_hash)
+  {
+    const uint8_t variant = (with_port ? 1 : 0) | (with_parent_hash ? 2 : 0) | (with_hash ? 0 : 4);
+    uint64_t generation = 0;
+
+    {
+      std::unique_lock<std::mutex> cache_lock(ruleCacheMutex());
+      if (_rule_cache[0] && _rule_cache_variant[0] == variant) {
+        return _rule_cache[0];
+      }
+      if (_rule_cache[1] && _rule_cache_variant[1] == variant) {
+        std::swap(_rule_cache[0], _rule_cache[1]);
+        std::swap(_rule_cache_variant[0], _rule_cache_variant[1]);
+        return _rule_cache[0];
+      }
+      generation = _rule_cache_generation;
+    }
+
+    Pointer<const Rule> device_rule = generateDeviceRule(with_port, with_parent_hash, with_hash);
+
+    std::unique_lock<std::mutex> cache_lock(ruleCacheMutex());
+    if (generation == _rule_cache_generation) {
+      _rule_cache[1] = std::move(_rule_cache[0]);
+      _rule_cache_variant[1] = _rule_cache_variant[0];
+      _rule_cache[0] = device_rule;
+      _rule_cache_variant[0] = variant;
+    }
+
+    return device_rule;
+  }
+
+  void DevicePrivate::invalidateDeviceRules()
+  {
+    std::unique_lock<std::mutex> cache_lock(ruleCacheMutex());
+    for (auto& device_rule : _rule_cache) {
+      device_rule.reset();
+    }
+    ++_rule_cache_generation;
+    return;
+  }
+
+  Pointer<Rule> DevicePrivate::generateDeviceRule(const bool with_port, const bool with_parent_hash,
+                                                  const bool with_hash)
+  {
+    if (with_hash) {
+      /* Compute a deferred hash before taking the device lock */
+      getHash();
+    }
+
     Pointer<Rule> device_rule = makePointer<Rule>();
     std::unique_lock<std::mutex> device_lock(refDeviceMutex());
 
-    logger->trace("Generating rule for device {}@{} (name={}); with_port={} with_parent_hash={}",
-		  _device_id.toString(), _port, _name, with_port, with_parent_hash);
+    USBGUARD_LOG_TRACE("Generating rule for device {}@{} (name={}); with_port={} with_parent_hash={} with_hash={}",
+		  getDeviceID().toString(), _port, _name.str(), with_port, with_parent_hash, with_hash);
 
     device_rule->setRuleID(_id);
     device_rule->setTarget(_target);
-    device_rule->setDeviceID(_device_id);
+    device_rule->setDeviceID(getDeviceID());
     device_rule->setSerial(_serial_number);
 
     if (with_port) {
@@ -82,22 +171,27 @@ namespace usbguard {
     }
 
     device_rule->attributeWithInterface().set(getInterfaceTypes(), Rule::SetOperator::Equals);
-    device_rule->setName(_name);
-    device_rule->setHash(getHash());
+    device_rule->attributeName().setStored(_name);
+
+    if (with_hash) {
+      device_rule->attributeHash().setStored(_hash);
+    }
 
     if (with_parent_hash) {
-      if (!_parent_hash.empty()) {
-        device_rule->setParentHash(_parent_hash);
-      }
-      else {
+      if (_parent_hash.empty()) {
+        /*
+         * The parent hash wasn't available when the device was
+         * inserted (e.g. it was deferred). Look it up once.
+         */
         if (_parent_id != Rule::RootID) {
           auto parent_device = manager().getDevice(_parent_id);
-          device_rule->setParentHash(parent_device->getHash());
+          _parent_hash = InternedString(parent_device->getHash());
         }
         else {
           throw std::runtime_error("Cannot generate device rule: parent hash value not available");
         }
       }
+      device_rule->attributeParentHash().setStored(_parent_hash);
     }
 
     return device_rule;
@@ -105,17 +199,21 @@ namespace usbguard {
 
   String DevicePrivate::hashString(const String& value) const
   {
-    Hash hash;
+    /*
+     * Parent syspaths are hashed for every device, so reuse
+     * one hash context per thread instead of setting up a new
+     * one on each call.
+     */
+    static thread_local Hash hash;
+    hash.reset();
     hash.update(value);
     return hash.getBase64();
   }
 
-  void DevicePrivate::updateHash(std::istream& descriptor_stream, const size_t expected_size)
+  void DevicePrivate::updateHashFields(Hash& hash) const
   {
-    Hash hash;
-
-    const String vendor_id = _device_id.getVendorID();
-    const String product_id = _device_id.getProductID();
+    const String vendor_id = getDeviceID().getVendorID();
+    const String product_id = getDeviceID().getProductID();
 
     if (vendor_id.empty() || product_id.empty()) {
       throw std::runtime_error("Cannot compute device hash: vendor and/or product id values not available");
@@ -124,9 +222,17 @@ namespace usbguard {
     /*
      * Hash name, device id and serial number fields.
      */
-    for (const String& field : { _name, vendor_id, product_id, _serial_number }) {
+    for (const String& field : { _name.str(), vendor_id, product_id, _serial_number }) {
       hash.update(field);
     }
+    return;
+  }
+
+  void DevicePrivate::updateHash(std::istream& descriptor_stream, const size_t expected_size)
+  {
+    Hash hash;
+
+    updateHashFields(hash);
     /*
      * Hash the device descriptor data.
      */
@@ -134,23 +240,87 @@ namespace usbguard {
       throw std::runtime_error("Cannot compute the device hash: descriptor stream returned less data than expected");
     }
 
-    _hash_base64 = hash.getBase64();
+    _hash = InternedString(hash.getBase64());
+    _hash_deferred = false;
+    invalidateDeviceRules();
+    updateChildrenParentHash();
     return;
   }
 
-  const String& DevicePrivate::getHash() const
+  void DevicePrivate::updateHash(const uint8_t *descriptor_data, const size_t size)
   {
-    return _hash_base64;
+    Hash hash;
+
+    updateHashFields(hash);
+    hash.update(descriptor_data, size);
+
+    _hash = InternedString(hash.getBase64());
+    _hash_deferred = false;
+    invalidateDeviceRules();
+    updateChildrenParentHash();
+    return;
+  }
+
+  /*
+   * Children copy the parent hash when they are inserted. A device
+   * which isn't in the device manager yet has no children.
+   */
+  void DevicePrivate::updateChildrenParentHash()
+  {
+    if (_id != Rule::DefaultID) {
+      manager().updateParentHash(_id, _hash.str());
+    }
+    return;
+  }
+
+  void DevicePrivate::deferHash()
+  {
+    std::unique_lock<std::mutex> hash_lock(hashMutex());
+    _hash = InternedString();
+    _hash_deferred = true;
+    invalidateDeviceRules();
+    return;
+  }
+
+  /*
+   * A deferred hash is computed from the loaded descriptor data
+   * once, by the first caller.
+   */
+  const String& DevicePrivate::getHash()
+  {
+    if (_hash_deferred) {
+      std::unique_lock<std::mutex> hash_lock(hashMutex());
+
+      if (_hash_deferred) {
+        const String& descriptor_data = getDescriptorData();
+        Hash hash;
+
+        updateHashFields(hash);
+        hash.update(reinterpret_cast<const uint8_t *>(descriptor_data.data()), descriptor_data.size());
+
+        _hash = InternedString(hash.getBase64());
+        _hash_deferred = false;
+        invalidateDeviceRules();
+      }
+    }
+    return _hash.str();
+  }
+
+  bool DevicePrivate::isHashDeferred() const
+  {
+    return _hash_deferred;
   }
 
   void DevicePrivate::setParentHash(const String& hash)
   {
-    _parent_hash = hash;
+    _parent_hash = InternedString(hash);
+    invalidateDeviceRules();
   }
 
   void DevicePrivate::setID(uint32_t id)
   {
     _id = id;
+    invalidateDeviceRules();
   }
 
   uint32_t DevicePrivate::getID() const
@@ -161,6 +331,7 @@ namespace usbguard {
   void DevicePrivate::setParentID(uint32_t id)
   {
     _parent_id = id;
+    invalidateDeviceRules();
   }
 
   uint32_t DevicePrivate::getParentID() const
@@ -171,6 +342,7 @@ namespace usbguard {
   void DevicePrivate::setTarget(Rule::Target target)
   {
     _target = target;
+    invalidateDeviceRules();
   }
 
   Rule::Target DevicePrivate::getTarget() const
@@ -183,22 +355,34 @@ namespace usbguard {
     if (name.size() > USB_GENERIC_STRING_MAX_LENGTH) {
       throw std::runtime_error("device name string size out-of-range");
     }
-    _name = name;
+    _name = InternedString(name);
+    invalidateDeviceRules();
   }
 
   const String& DevicePrivate::getName() const
   {
-    return _name;
+    return _name.str();
   }
 
   void DevicePrivate::setDeviceID(const USBDeviceID& device_id)
   {
-    _device_id = device_id;
+    const USBDeviceID& current = getDeviceID();
+
+    if (current.getVendorID() != device_id.getVendorID() ||
+        current.getProductID() != device_id.getProductID()) {
+      detachDescriptors().device_id = device_id;
+    }
+    invalidateDeviceRules();
   }
 
+  /*
+   * The device ID is kept with the descriptors, which normally
+   * contain the same ID, so that devices of the same model share it.
+   */
   const USBDeviceID& DevicePrivate::getDeviceID() const
   {
-    return _device_id;
+    static const USBDeviceID no_device_id;
+    return _descriptors ? _descriptors->device_id : no_device_id;
   }
 
   void DevicePrivate::setPort(const String& port)
@@ -207,6 +391,7 @@ namespace usbguard {
       throw std::runtime_error("device port string size out of range");
     }
     _port = port;
+    invalidateDeviceRules();
   }
 
   const String& DevicePrivate::getPort() const
@@ -220,6 +405,7 @@ namespace usbguard {
       throw std::runtime_error("device serial number string size out of range");
     }
     _serial_number = serial_number;
+    invalidateDeviceRules();
   }
 
   const String& DevicePrivate::getSerial() const
@@ -229,12 +415,29 @@ namespace usbguard {
 
   std::vector<USBInterfaceType>& DevicePrivate::refMutableInterfaceTypes()
   {
-    return _interface_types;
+    invalidateDeviceRules();
+    return detachDescriptors().interface_types;
   }
 
   const std::vector<USBInterfaceType>& DevicePrivate::getInterfaceTypes() const
   {
-    return _interface_types;
+    static const std::vector<USBInterfaceType> no_interface_types;
+    return _descriptors ? _descriptors->interface_types : no_interface_types;
+  }
+
+  /*
+   * The descriptors may be shared with other devices. Make a private
+   * copy before they are modified.
+   */
+  DescriptorCache::Entry& DevicePrivate::detachDescriptors()
+  {
+    if (_owned_descriptors == nullptr) {
+      auto descriptors = _descriptors ? \
+        makePointer<DescriptorCache::Entry>(*_descriptors) : makePointer<DescriptorCache::Entry>();
+      _owned_descriptors = descriptors.get();
+      _descriptors = descriptors;
+    }
+    return *_owned_descriptors;
   }
 
   void DevicePrivate::loadDeviceDescriptor(USBDescriptorParser* parser, const USBDescriptor* const descriptor)
@@ -242,7 +445,8 @@ namespace usbguard {
     if (parser->haveDescriptor(USB_DESCRIPTOR_TYPE_DEVICE)) {
       throw std::runtime_error("Invalid descriptor data: multiple device descriptors for one device");
     }
-    _interface_types.clear();
+    detachDescriptors().interface_types.clear();
+    invalidateDeviceRules();
     return;
   }
 
@@ -268,7 +472,8 @@ namespace usbguard {
     }
 
     const USBInterfaceType interface_type(*reinterpret_cast<const USBInterfaceDescriptor*>(descriptor));
-    _interface_types.push_back(interface_type);
+    detachDescriptors().interface_types.push_back(interface_type);
+    invalidateDeviceRules();
 
     return;
   }
@@ -283,4 +488,68 @@ namespace usbguard {
     }
     return;
   }
+
+  size_t DevicePrivate::loadDescriptors(const uint8_t *data, const size_t size)
+  {
+    setDescriptors(DescriptorCache::instance().load(data, size));
+    return size;
+  }
+
+  const String& DevicePrivate::getDescriptorData() const
+  {
+    static const String no_data;
+    return _descriptors ? _descriptors->data : no_data;
+  }
+
+  void DevicePrivate::restoreDescriptors(const String& data, const std::vector<USBInterfaceType>& interface_types,
+                                         const String& hash)
+  {
+    setDescriptors(DescriptorCache::instance().restore(data, interface_types));
+    _hash = InternedString(hash);
+    _hash_deferred = false;
+    return;
+  }
+
+  /*
+   * If the descriptor data has no device ID, the ID set earlier is
+   * kept in a private copy of the descriptors.
+   */
+  void DevicePrivate::setDescriptors(Pointer<const DescriptorCache::Entry> descriptors)
+  {
+    const USBDeviceID device_id = getDeviceID();
+
+    _descriptors = std::move(descriptors);
+    _owned_descriptors = nullptr;
+
+    if (_descriptors->device_id.getVendorID().empty() && !device_id.getVendorID().empty()) {
+      detachDescriptors().device_id = device_id;
+    }
+
+    invalidateDeviceRules();
+    return;
+  }
+
+  /*
+   * The descriptors shared with other devices and the interned
+   * strings are accounted by DescriptorCache and StringPool.
+   */
+  size_t DevicePrivate::memoryUsage() const
+  {
+    size_t usage = sizeof(DevicePrivate);
+
+    usage += stringHeapUsage(_serial_number) + stringHeapUsage(_port);
+
+    if (_owned_descriptors != nullptr) {
+      usage += DescriptorCache::memoryUsage(*_owned_descriptors);
+    }
+
+    std::unique_lock<std::mutex> cache_lock(ruleCacheMutex());
+    for (auto const& device_rule : _rule_cache) {
+      if (device_rule) {
+        usage += device_rule->getMemoryUsage();
+      }
+    }
+
+    return usage;
+  }
 } /* namespace usbguard */
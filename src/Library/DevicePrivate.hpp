@@ -22,10 +22,14 @@
 #include <Typedefs.hpp>
 #include <Rule.hpp>
 #include <USB.hpp>
+#include "DescriptorCache.hpp"
 #include <mutex>
+#include <atomic>
 #include <istream>
 
 namespace usbguard {
+  class Hash;
+
   class DevicePrivate
   {
   public:
@@ -36,10 +40,14 @@ namespace usbguard {
     DeviceManager& manager() const;
 
     std::mutex& refDeviceMutex();
-    Pointer<Rule> getDeviceRule(bool with_port = true, bool with_parent_hash = true);
+    Pointer<Rule> getDeviceRule(bool with_port = true, bool with_parent_hash = true, bool with_hash = true);
+    Pointer<const Rule> getCachedDeviceRule(bool with_port = true, bool with_parent_hash = true, bool with_hash = true);
     String hashString(const String& value) const;
     void updateHash(std::istream& descriptor_stream, size_t expected_size);
-    const String& getHash() const;
+    void updateHash(const uint8_t *descriptor_data, size_t size);
+    void deferHash();
+    const String& getHash();
+    bool isHashDeferred() const;
 
     void setParentHash(const String& hash);
 
@@ -72,19 +80,72 @@ namespace usbguard {
     void loadInterfaceDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor);
     void loadEndpointDescriptor(USBDescriptorParser*, const USBDescriptor* descriptor);
 
+    size_t loadDescriptors(const uint8_t *data, size_t size);
+    const String& getDescriptorData() const;
+    void restoreDescriptors(const String& data, const std::vector<USBInterfaceType>& interface_types,
+                            const String& hash);
+
+    /* See Device::getMemoryUsage() */
+    size_t memoryUsage() const;
+
   private:
+    void updateHashFields(Hash& hash) const;
+    Pointer<Rule> generateDeviceRule(bool with_port, bool with_parent_hash, bool with_hash);
+    void invalidateDeviceRules();
+    void setDescriptors(Pointer<const DescriptorCache::Entry> descriptors);
+    void updateChildrenParentHash();
+    DescriptorCache::Entry& detachDescriptors();
+
+    std::mutex& hashMutex() const;
+    std::mutex& ruleCacheMutex() const;
+
+    /*
+     * The members are ordered to avoid padding. A device is kept
+     * for every present device, so its size matters on hosts with
+     * many devices or a lot of device churn.
+     */
     Device& _p_instance;
     DeviceManager& _manager;
     std::mutex _mutex;
     uint32_t _id;
     uint32_t _parent_id;
-    String _parent_hash;
     Rule::Target _target;
-    String _name;
-    USBDeviceID _device_id;
+    /*
+     * Set by deferHash(). The hash is computed by the first
+     * getHash() call, serialized by the hash mutex.
+     */
+    std::atomic<bool> _hash_deferred;
+    /* Variants of the cached rules, see _rule_cache */
+    uint8_t _rule_cache_variant[2];
+    /*
+     * Interned, so that the device rules and the rules in the
+     * rule set share the stored value and compare by handle.
+     * The name is shared by the devices of the same model.
+     */
+    InternedString _parent_hash;
+    InternedString _hash;
+    InternedString _name;
     String _serial_number;
     String _port;
-    std::vector<USBInterfaceType> _interface_types;
-    String _hash_base64;
+    /*
+     * Descriptor data, the device ID and the interface types, shared
+     * with the other devices of the same model (see DescriptorCache).
+     * If the device modified them, _owned_descriptors points to its
+     * private copy.
+     */
+    Pointer<const DescriptorCache::Entry> _descriptors;
+    DescriptorCache::Entry *_owned_descriptors;
+    /*
+     * Device rules generated by getCachedDeviceRule. The callers use
+     * one or two of the (with_port, with_parent_hash, with_hash)
+     * combinations, so only the two most recently used ones are
+     * kept, the most recent first. Any change of the device state
+     * drops them and bumps the generation, so that a rule generated
+     * concurrently with the change isn't cached. The cache has its
+     * own mutex because the setters are called with and without the
+     * device mutex held.
+     */
+    Pointer<const Rule> _rule_cache[2];
+    uint64_t _rule_cache_generation;
   };
 } /* namespace usbguard */
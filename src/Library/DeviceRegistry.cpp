@@ -0,0 +1,182 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DeviceRegistry.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace usbguard {
+  DeviceRegistry::DeviceRegistry()
+  {
+  }
+
+  DeviceRegistry::DeviceRegistry(const DeviceRegistry& rhs)
+  {
+    *this = rhs;
+    return;
+  }
+
+  const DeviceRegistry& DeviceRegistry::operator=(const DeviceRegistry& rhs)
+  {
+    if (this == &rhs) {
+      return *this;
+    }
+    for (size_t i = 0; i < shard_count; ++i) {
+      std::unique_lock<std::mutex> local_lock(_shards[i].mutex);
+      std::unique_lock<std::mutex> remote_lock(rhs._shards[i].mutex);
+      _shards[i].slots = rhs._shards[i].slots;
+      _shards[i].free_slots = rhs._shards[i].free_slots;
+      _shards[i].slot_index = rhs._shards[i].slot_index;
+    }
+    return *this;
+  }
+
+  void DeviceRegistry::insert(const Pointer<Device>& device)
+  {
+    const uint32_t id = device->getID();
+    Shard& shard = shardOf(id);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto it = shard.slot_index.find(id);
+    if (it != shard.slot_index.end()) {
+      shard.slots[it->second] = device;
+      return;
+    }
+
+    size_t slot = 0;
+    if (!shard.free_slots.empty()) {
+      slot = shard.free_slots.back();
+      shard.free_slots.pop_back();
+      shard.slots[slot] = device;
+    }
+    else {
+      slot = shard.slots.size();
+      shard.slots.push_back(device);
+    }
+
+    shard.slot_index.emplace(id, slot);
+    return;
+  }
+
+  Pointer<Device> DeviceRegistry::remove(uint32_t id)
+  {
+    Shard& shard = shardOf(id);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto it = shard.slot_index.find(id);
+    if (it == shard.slot_index.end()) {
+      return nullptr;
+    }
+
+    const size_t slot = it->second;
+    Pointer<Device> device;
+    device.swap(shard.slots[slot]);
+    shard.slot_index.erase(it);
+
+    if (slot + 1 == shard.slots.size()) {
+      shard.slots.pop_back();
+    }
+    else {
+      shard.free_slots.push_back(slot);
+    }
+
+    return device;
+  }
+
+  Pointer<Device> DeviceRegistry::find(uint32_t id) const
+  {
+    const Shard& shard = shardOf(id);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto it = shard.slot_index.find(id);
+    if (it == shard.slot_index.end()) {
+      return nullptr;
+    }
+
+    return shard.slots[it->second];
+  }
+
+  Pointer<Device> DeviceRegistry::at(uint32_t id) const
+  {
+    Pointer<Device> device = find(id);
+    if (!device) {
+      throw std::out_of_range("Unknown device id");
+    }
+    return device;
+  }
+
+  void DeviceRegistry::forEach(const std::function<void(const Pointer<Device>&)>& callback) const
+  {
+    for (const Shard& shard : _shards) {
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      for (const Pointer<Device>& device : shard.slots) {
+        if (device) {
+          callback(device);
+        }
+      }
+    }
+    return;
+  }
+
+  PointerVector<Device> DeviceRegistry::list() const
+  {
+    PointerVector<Device> devices;
+
+    forEach([&devices](const Pointer<Device>& device) {
+      devices.push_back(device);
+    });
+
+    std::sort(devices.begin(), devices.end(),
+      [](const Pointer<Device>& a, const Pointer<Device>& b) {
+        return a->getID() < b->getID();
+      });
+
+    return devices;
+  }
+
+  size_t DeviceRegistry::size() const
+  {
+    size_t count = 0;
+    for (const Shard& shard : _shards) {
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      count += shard.slot_index.size();
+    }
+    return count;
+  }
+
+  void DeviceRegistry::clear()
+  {
+    for (Shard& shard : _shards) {
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      shard.slots.clear();
+      shard.free_slots.clear();
+      shard.slot_index.clear();
+    }
+    return;
+  }
+
+  DeviceRegistry::Shard& DeviceRegistry::shardOf(uint32_t id)
+  {
+    return _shards[id % shard_count];
+  }
+
+  const DeviceRegistry::Shard& DeviceRegistry::shardOf(uint32_t id) const
+  {
+    return _shards[id % shard_count];
+  }
+} /* namespace usbguard */
@@ -0,0 +1,84 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Device.hpp"
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+namespace usbguard {
+  /*
+   * Registry of the devices known to a device manager. Devices
+   * are spread over a fixed number of shards by their id and each
+   * shard keeps them in a dense slot array protected by its own
+   * mutex, so that lookups of different devices don't contend on
+   * a single lock and iteration walks contiguous memory. Removed
+   * slots are reused by later inserts.
+   */
+  class DeviceRegistry
+  {
+  public:
+    DeviceRegistry();
+    DeviceRegistry(const DeviceRegistry& rhs);
+    const DeviceRegistry& operator=(const DeviceRegistry& rhs);
+
+    /*
+     * Register a device under its current id. A device already
+     * registered under the same id is replaced.
+     */
+    void insert(const Pointer<Device>& device);
+    /* Unregister a device. Returns nullptr if the id is unknown. */
+    Pointer<Device> remove(uint32_t id);
+    /* Returns nullptr if the id is unknown */
+    Pointer<Device> find(uint32_t id) const;
+    /* Throws std::out_of_range if the id is unknown */
+    Pointer<Device> at(uint32_t id) const;
+
+    /*
+     * Call the callback for each registered device without
+     * copying the registry. Shards are visited one at a time
+     * with their lock held, so the callback must not modify
+     * the registry. The visiting order is unspecified.
+     */
+    void forEach(const std::function<void(const Pointer<Device>&)>& callback) const;
+    /* Returns a copy of the registered devices, ordered by the device id */
+    PointerVector<Device> list() const;
+
+    size_t size() const;
+    void clear();
+
+  private:
+    static const size_t shard_count = 16;
+
+    struct Shard {
+      mutable std::mutex mutex;
+      std::vector<Pointer<Device>> slots;
+      std::vector<size_t> free_slots;
+      std::unordered_map<uint32_t, size_t> slot_index;
+    };
+
+    Shard& shardOf(uint32_t id);
+    const Shard& shardOf(uint32_t id) const;
+
+    Shard _shards[shard_count];
+  };
+} /* namespace usbguard */
@@ -0,0 +1,305 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "DeviceSnapshot.hpp"
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace usbguard {
+  const uint32_t DeviceSnapshot::Version = 1;
+
+  static const char snapshot_magic[8] = { 'U', 'S', 'B', 'G', 'S', 'N', 'A', 'P' };
+  static const size_t snapshot_header_size = 32;
+  /* id, parent id, target, reserved */
+  static const size_t snapshot_record_fixed_size = 16;
+  /* vendor id, product id, name, serial, port, hash, parent hash, descriptors */
+  static const size_t snapshot_record_field_count = 8;
+  static const size_t snapshot_record_size = \
+    snapshot_record_fixed_size + snapshot_record_field_count * 8;
+
+  enum SnapshotField {
+    VendorIDField = 0,
+    ProductIDField,
+    NameField,
+    SerialField,
+    PortField,
+    HashField,
+    ParentHashField,
+    DescriptorsField
+  };
+
+  static void storeU32(uint8_t *ptr, uint32_t value)
+  {
+    value = htole32(value);
+    std::memcpy(ptr, &value, sizeof value);
+  }
+
+  static void storeU64(uint8_t *ptr, uint64_t value)
+  {
+    value = htole64(value);
+    std::memcpy(ptr, &value, sizeof value);
+  }
+
+  static uint32_t loadU32(const uint8_t *ptr)
+  {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof value);
+    return le32toh(value);
+  }
+
+  static uint64_t loadU64(const uint8_t *ptr)
+  {
+    uint64_t value;
+    std::memcpy(&value, ptr, sizeof value);
+    return le64toh(value);
+  }
+
+  String DeviceSnapshot::encode(const std::vector<Entry>& entries)
+  {
+    size_t data_size = 0;
+
+    for (const Entry& entry : entries) {
+      for (const String* value : { &entry.vendor_id, &entry.product_id, &entry.name, &entry.serial,
+                                   &entry.port, &entry.hash, &entry.parent_hash, &entry.descriptors }) {
+        data_size += value->size();
+      }
+    }
+
+    const size_t records_size = entries.size() * snapshot_record_size;
+
+    if (entries.size() > UINT32_MAX || data_size > UINT32_MAX) {
+      throw std::runtime_error("Device snapshot: too much data");
+    }
+
+    /*
+     * Everything is written into one preallocated buffer, the
+     * record field references point into the data area behind
+     * the records.
+     */
+    String buffer(snapshot_header_size + records_size + data_size, '\0');
+    uint8_t * const base = reinterpret_cast<uint8_t *>(&buffer[0]);
+
+    std::memcpy(base, snapshot_magic, sizeof snapshot_magic);
+    storeU32(base + 8, Version);
+    storeU32(base + 12, entries.size());
+    storeU32(base + 16, snapshot_record_size);
+    storeU32(base + 20, 0);
+    storeU64(base + 24, data_size);
+
+    uint8_t *record = base + snapshot_header_size;
+    uint8_t * const data = record + records_size;
+    uint32_t data_offset = 0;
+
+    for (const Entry& entry : entries) {
+      storeU32(record + 0, entry.id);
+      storeU32(record + 4, entry.parent_id);
+      storeU32(record + 8, static_cast<uint32_t>(entry.target));
+      storeU32(record + 12, 0);
+
+      uint8_t *field = record + snapshot_record_fixed_size;
+
+      for (const String* value : { &entry.vendor_id, &entry.product_id, &entry.name, &entry.serial,
+                                   &entry.port, &entry.hash, &entry.parent_hash, &entry.descriptors }) {
+        storeU32(field + 0, data_offset);
+        storeU32(field + 4, value->size());
+        std::memcpy(data + data_offset, value->data(), value->size());
+        data_offset += value->size();
+        field += 8;
+      }
+
+      record += snapshot_record_size;
+    }
+
+    return buffer;
+  }
+
+  bool DeviceSnapshot::isSnapshot(const void *data, size_t size)
+  {
+    return size >= sizeof snapshot_magic &&
+      std::memcmp(data, snapshot_magic, sizeof snapshot_magic) == 0;
+  }
+
+  DeviceSnapshot::DeviceSnapshot(const void *data, size_t size)
+    : _mapping(nullptr)
+  {
+    load(data, size);
+  }
+
+  DeviceSnapshot::DeviceSnapshot(const String& path)
+    : _size(0),
+      _mapping(nullptr)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+      throw std::runtime_error("Device snapshot: cannot open " + path + ": " + strerror(errno));
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0) {
+      const int saved_errno = errno;
+      ::close(fd);
+      throw std::runtime_error("Device snapshot: cannot stat " + path + ": " + strerror(saved_errno));
+    }
+    if (st.st_size == 0) {
+      ::close(fd);
+      throw std::runtime_error("Device snapshot: " + path + " is empty");
+    }
+
+    void * const mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+      throw std::runtime_error("Device snapshot: cannot map " + path + ": " + strerror(errno));
+    }
+
+    _mapping = mapping;
+    _size = st.st_size;
+
+    try {
+      load(mapping, st.st_size);
+    }
+    catch(...) {
+      ::munmap(_mapping, _size);
+      throw;
+    }
+  }
+
+  DeviceSnapshot::~DeviceSnapshot()
+  {
+    if (_mapping != nullptr) {
+      ::munmap(_mapping, _size);
+    }
+  }
+
+  void DeviceSnapshot::load(const void *data, size_t size)
+  {
+    _data = reinterpret_cast<const uint8_t *>(data);
+    _size = size;
+
+    if (size < snapshot_header_size || !isSnapshot(data, size)) {
+      throw std::runtime_error("Device snapshot: invalid header");
+    }
+
+    _version = loadU32(_data + 8);
+    _count = loadU32(_data + 12);
+    _record_size = loadU32(_data + 16);
+    _strings_size = loadU64(_data + 24);
+
+    if (_version < 1 || _record_size < snapshot_record_size) {
+      throw std::runtime_error("Device snapshot: unsupported version");
+    }
+
+    const uint64_t records_size = uint64_t(_count) * _record_size;
+
+    if (records_size > size - snapshot_header_size ||
+        _strings_size != size - snapshot_header_size - records_size) {
+      throw std::runtime_error("Device snapshot: invalid size");
+    }
+
+    _records = _data + snapshot_header_size;
+    _strings = _records + records_size;
+
+    /*
+     * Validate the field references once, so that the accessors
+     * don't have to.
+     */
+    for (size_t i = 0; i < _count; ++i) {
+      const uint8_t * const fields = record(i) + snapshot_record_fixed_size;
+      for (size_t f = 0; f < snapshot_record_field_count; ++f) {
+        const uint64_t offset = loadU32(fields + f * 8);
+        const uint64_t field_size = loadU32(fields + f * 8 + 4);
+        if (offset + field_size > _strings_size) {
+          throw std::runtime_error("Device snapshot: invalid field reference");
+        }
+      }
+      if (loadU32(record(i) + 8) > static_cast<uint32_t>(Rule::Target::Invalid)) {
+        throw std::runtime_error("Device snapshot: invalid target");
+      }
+    }
+
+    return;
+  }
+
+  uint32_t DeviceSnapshot::version() const
+  {
+    return _version;
+  }
+
+  size_t DeviceSnapshot::count() const
+  {
+    return _count;
+  }
+
+  const uint8_t *DeviceSnapshot::record(size_t index) const
+  {
+    if (index >= _count) {
+      throw std::out_of_range("Device snapshot: invalid device index");
+    }
+    return _records + index * _record_size;
+  }
+
+  const uint8_t *DeviceSnapshot::field(size_t index, size_t field, size_t& size) const
+  {
+    const uint8_t * const ref = record(index) + snapshot_record_fixed_size + field * 8;
+    size = loadU32(ref + 4);
+    return _strings + loadU32(ref);
+  }
+
+  String DeviceSnapshot::fieldString(size_t index, size_t field_index) const
+  {
+    size_t size = 0;
+    const uint8_t * const data = field(index, field_index, size);
+    return String(reinterpret_cast<const char *>(data), size);
+  }
+
+  DeviceSnapshot::Entry DeviceSnapshot::entry(size_t index) const
+  {
+    const uint8_t * const ptr = record(index);
+    Entry entry;
+
+    entry.id = loadU32(ptr + 0);
+    entry.parent_id = loadU32(ptr + 4);
+    entry.target = static_cast<Rule::Target>(loadU32(ptr + 8));
+    entry.vendor_id = fieldString(index, VendorIDField);
+    entry.product_id = fieldString(index, ProductIDField);
+    entry.name = fieldString(index, NameField);
+    entry.serial = fieldString(index, SerialField);
+    entry.port = fieldString(index, PortField);
+    entry.hash = fieldString(index, HashField);
+    entry.parent_hash = fieldString(index, ParentHashField);
+    entry.descriptors = fieldString(index, DescriptorsField);
+
+    return entry;
+  }
+
+  const uint8_t *DeviceSnapshot::descriptorData(size_t index, size_t& size) const
+  {
+    return field(index, DescriptorsField, size);
+  }
+} /* namespace usbguard */
@@ -0,0 +1,115 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Versioned binary snapshot of the devices known to a device
+   * manager. The snapshot is laid out so that it can be read in
+   * place, e.g. from a memory mapped file:
+   *
+   *   header   magic "USBGSNAP", u32 version, u32 device count,
+   *            u32 record size, u32 reserved, u64 data size
+   *   records  device count * record size bytes
+   *   data     the string values and descriptor data referenced
+   *            by the records
+   *
+   * All integers are stored in little-endian byte order. Each record
+   * holds the device id, the parent device id, the target and
+   * (offset, size) references into the data area for the vendor id,
+   * product id, name, serial number, port, hash, parent hash and the
+   * raw descriptor data of the device. Readers skip the record bytes
+   * they don't know, so newer versions may append fields to a record.
+   */
+  class DLL_PUBLIC DeviceSnapshot
+  {
+  public:
+    static const uint32_t Version;
+
+    struct Entry
+    {
+      uint32_t id;
+      uint32_t parent_id;
+      Rule::Target target;
+      String vendor_id;
+      String product_id;
+      String name;
+      String serial;
+      String port;
+      String hash;
+      String parent_hash;
+      String descriptors; /**< Raw descriptor data */
+    };
+
+    /*
+     * Serialize the entries into a snapshot.
+     */
+    static String encode(const std::vector<Entry>& entries);
+
+    /*
+     * Check whether the data starts with the snapshot magic value.
+     */
+    static bool isSnapshot(const void *data, size_t size);
+
+    /*
+     * Read a snapshot in place. The data is validated here and must
+     * stay valid for the lifetime of the instance.
+     */
+    DeviceSnapshot(const void *data, size_t size);
+
+    /*
+     * Memory map and read a snapshot file.
+     */
+    DeviceSnapshot(const String& path);
+
+    ~DeviceSnapshot();
+
+    DeviceSnapshot(const DeviceSnapshot&) = delete;
+    const DeviceSnapshot& operator=(const DeviceSnapshot&) = delete;
+
+    uint32_t version() const;
+    size_t count() const;
+    Entry entry(size_t index) const;
+
+    /*
+     * Access the descriptor data of a device without copying it.
+     */
+    const uint8_t *descriptorData(size_t index, size_t& size) const;
+
+  private:
+    void load(const void *data, size_t size);
+    const uint8_t *record(size_t index) const;
+    const uint8_t *field(size_t index, size_t field, size_t& size) const;
+    String fieldString(size_t index, size_t field) const;
+
+    const uint8_t *_data;
+    size_t _size;
+    void *_mapping;
+    uint32_t _version;
+    uint32_t _count;
+    uint32_t _record_size;
+    const uint8_t *_records;
+    const uint8_t *_strings;
+    uint64_t _strings_size;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,61 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "EvaluationClock.hpp"
+#include <time.h>
+
+namespace usbguard {
+  static thread_local bool tl_scope_active = false;
+  static thread_local EvaluationClock::TimePoint tl_scope_time;
+
+  EvaluationClock::TimePoint EvaluationClock::now()
+  {
+    if (tl_scope_active) {
+      return tl_scope_time;
+    }
+    return coarseNow();
+  }
+
+  EvaluationClock::TimePoint EvaluationClock::coarseNow()
+  {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0) {
+      return std::chrono::steady_clock::now();
+    }
+
+    const auto since_epoch = std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+    return TimePoint(std::chrono::duration_cast<std::chrono::steady_clock::duration>(since_epoch));
+  }
+
+  EvaluationClock::Scope::Scope()
+    : _outermost(!tl_scope_active)
+  {
+    if (_outermost) {
+      tl_scope_time = std::chrono::steady_clock::now();
+      tl_scope_active = true;
+    }
+  }
+
+  EvaluationClock::Scope::~Scope()
+  {
+    if (_outermost) {
+      tl_scope_active = false;
+    }
+  }
+} /* namespace usbguard */
@@ -0,0 +1,60 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include <chrono>
+
+namespace usbguard {
+  /*
+   * The clock used by the rule metadata and the time based rule
+   * conditions. Within a scope, e.g. the processing of one device
+   * event, all the readings of a thread return the time sampled
+   * when the outermost scope was entered, so that the timestamps
+   * of one decision are consistent. Outside of a scope, the
+   * coarse monotonic clock is read, which is cheaper than the
+   * regular one. Both have the epoch of std::chrono::steady_clock.
+   */
+  class DLL_PUBLIC EvaluationClock
+  {
+  public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    static TimePoint now();
+
+    /*
+     * Read CLOCK_MONOTONIC_COARSE. Its resolution is one
+     * scheduler tick.
+     */
+    static TimePoint coarseNow();
+
+    class DLL_PUBLIC Scope
+    {
+    public:
+      Scope();
+      ~Scope();
+
+    private:
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+      bool _outermost;
+    };
+  };
+} /* namespace usbguard */
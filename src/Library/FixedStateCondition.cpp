@@ -39,6 +39,16 @@ namespace usbguard
     return _state;
   }
 
+  bool FixedStateCondition::isMemoizable() const
+  {
+    return true;
+  }
+
+  RuleCondition::Cost FixedStateCondition::cost() const
+  {
+    return Cost::Constant;
+  }
+
   RuleCondition * FixedStateCondition::clone() const
   {
     return new FixedStateCondition(*this);
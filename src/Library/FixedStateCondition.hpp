@@ -29,6 +29,8 @@ namespace usbguard
     FixedStateCondition(bool state, bool negated = false);
     FixedStateCondition(const FixedStateCondition& rhs);
     bool update(const Rule& rule);
+    bool isMemoizable() const;
+    Cost cost() const;
     RuleCondition * clone() const;
   private:
     const bool _state;
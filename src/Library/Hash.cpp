@@ -18,35 +18,129 @@
 //
 #include "Hash.hpp"
 #include "Base64.hpp"
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 
 namespace usbguard
 {
+  static Hash::Algorithm G_default_algorithm = Hash::Algorithm::SHA256;
+  static String G_default_key;
+
+#if defined(USBGUARD_USE_LIBGCRYPT)
+  static int gcryptAlgorithm(Hash::Algorithm algorithm)
+  {
+    switch(algorithm) {
+      case Hash::Algorithm::SHA256:
+        return GCRY_MD_SHA256;
+      case Hash::Algorithm::SHA512:
+        return GCRY_MD_SHA512;
+      case Hash::Algorithm::BLAKE2b:
+        return GCRY_MD_BLAKE2B_256;
+    }
+    throw std::runtime_error("Unknown hash algorithm");
+  }
+#endif
+
   Hash::Hash()
+    : Hash(G_default_algorithm, G_default_key)
+  {
+  }
+
+  Hash::Hash(Algorithm algorithm, const String& key)
+    : _algorithm(algorithm),
+      _key(key)
   {
     /*
-     * Initialize the hash state.
-     *
-     * TODO: Use a hash salt from the configuration.
+     * Keyed BLAKE2b is limited to 64 byte keys by both
+     * crypto libraries.
      */
-#if defined(USBGUARD_USE_LIBSODIUM)
-    crypto_hash_sha256_init(&_state);
+    if (_algorithm == Algorithm::BLAKE2b && _key.size() > 64) {
+      throw std::runtime_error("Hash key too long for BLAKE2b");
+    }
+#if defined(USBGUARD_USE_LIBGCRYPT)
+    const int algo = gcryptAlgorithm(_algorithm);
+    const bool hmac = !_key.empty() && _algorithm != Algorithm::BLAKE2b;
+
+    if (gcry_md_open(&_state, algo, hmac ? GCRY_MD_FLAG_HMAC : 0) != 0) {
+      throw std::runtime_error("Cannot initialize the hash state");
+    }
+    if (hmac && gcry_md_setkey(_state, _key.c_str(), _key.size()) != 0) {
+      gcry_md_close(_state);
+      throw std::runtime_error("Cannot set the hash key");
+    }
 #endif
+    try {
+      init();
+    }
+    catch(...) {
 #if defined(USBGUARD_USE_LIBGCRYPT)
-    gcry_md_open(&_state, GCRY_MD_SHA256, 0);
+      gcry_md_close(_state);
 #endif
+      throw;
+    }
   }
 
-  size_t Hash::update(const String& value)
+  Hash::~Hash()
+  {
+#if defined(USBGUARD_USE_LIBGCRYPT)
+    gcry_md_close(_state);
+#endif
+  }
+
+  void Hash::init()
   {
 #if defined(USBGUARD_USE_LIBSODIUM)
-    crypto_hash_sha256_update(&_state,
-                              reinterpret_cast<const uint8_t *>(value.c_str()),
-                              value.size());
+    const uint8_t * const key = reinterpret_cast<const uint8_t *>(_key.c_str());
+
+    switch(_algorithm) {
+      case Algorithm::SHA256:
+        if (_key.empty()) {
+          crypto_hash_sha256_init(&_state.sha256);
+        }
+        else {
+          crypto_auth_hmacsha256_init(&_state.hmacsha256, key, _key.size());
+        }
+        break;
+      case Algorithm::SHA512:
+        if (_key.empty()) {
+          crypto_hash_sha512_init(&_state.sha512);
+        }
+        else {
+          crypto_auth_hmacsha512_init(&_state.hmacsha512, key, _key.size());
+        }
+        break;
+      case Algorithm::BLAKE2b:
+        crypto_generichash_init(&_state.blake2b,
+                                _key.empty() ? nullptr : key, _key.size(),
+                                crypto_generichash_BYTES);
+        break;
+    }
 #endif
 #if defined(USBGUARD_USE_LIBGCRYPT)
-    gcry_md_write(_state, value.c_str(), value.size());
+    /*
+     * The reset keeps the HMAC key, but not the key of a keyed
+     * BLAKE2b context, so that one has to be set again.
+     */
+    gcry_md_reset(_state);
+    if (_algorithm == Algorithm::BLAKE2b && !_key.empty() &&
+        gcry_md_setkey(_state, _key.c_str(), _key.size()) != 0) {
+      throw std::runtime_error("Cannot set the hash key");
+    }
 #endif
-    return value.size();
+    return;
+  }
+
+  void Hash::reset()
+  {
+    init();
+    return;
+  }
+
+  size_t Hash::update(const String& value)
+  {
+    return update(reinterpret_cast<const uint8_t *>(value.c_str()), value.size());
   }
 
   size_t Hash::update(std::istream& stream)
@@ -61,32 +155,169 @@ namespace usbguard
       buflen = stream.gcount();
 
       if (buflen > 0) {
+        size_hashed += update(buffer, buflen);
+      }
+    }
+    return size_hashed;
+  }
+
+  size_t Hash::update(const uint8_t *data, const size_t size)
+  {
 #if defined(USBGUARD_USE_LIBSODIUM)
-        crypto_hash_sha256_update(&_state, buffer, buflen);
+    switch(_algorithm) {
+      case Algorithm::SHA256:
+        if (_key.empty()) {
+          crypto_hash_sha256_update(&_state.sha256, data, size);
+        }
+        else {
+          crypto_auth_hmacsha256_update(&_state.hmacsha256, data, size);
+        }
+        break;
+      case Algorithm::SHA512:
+        if (_key.empty()) {
+          crypto_hash_sha512_update(&_state.sha512, data, size);
+        }
+        else {
+          crypto_auth_hmacsha512_update(&_state.hmacsha512, data, size);
+        }
+        break;
+      case Algorithm::BLAKE2b:
+        crypto_generichash_update(&_state.blake2b, data, size);
+        break;
+    }
 #endif
 #if defined(USBGUARD_USE_LIBGCRYPT)
-        gcry_md_write(_state, buffer, buflen);
+    gcry_md_write(_state, data, size);
 #endif
-        size_hashed += buflen;
-      }
-    }
-    return size_hashed;
+    return size;
   }
 
-  String Hash::getBase64()
+  size_t Hash::getBinary(uint8_t * const buffer, const size_t buflen)
   {
 #if defined(USBGUARD_USE_LIBSODIUM)
-    uint8_t hash_binary[crypto_hash_sha256_BYTES];
-    crypto_hash_sha256_final(&_state, hash_binary);
+    uint8_t hash_binary[crypto_hash_sha512_BYTES];
+    size_t hash_buflen = 0;
+
+    switch(_algorithm) {
+      case Algorithm::SHA256:
+        if (_key.empty()) {
+          crypto_hash_sha256_final(&_state.sha256, hash_binary);
+        }
+        else {
+          crypto_auth_hmacsha256_final(&_state.hmacsha256, hash_binary);
+        }
+        hash_buflen = crypto_hash_sha256_BYTES;
+        break;
+      case Algorithm::SHA512:
+        if (_key.empty()) {
+          crypto_hash_sha512_final(&_state.sha512, hash_binary);
+        }
+        else {
+          crypto_auth_hmacsha512_final(&_state.hmacsha512, hash_binary);
+        }
+        hash_buflen = crypto_hash_sha512_BYTES;
+        break;
+      case Algorithm::BLAKE2b:
+        crypto_generichash_final(&_state.blake2b, hash_binary, crypto_generichash_BYTES);
+        hash_buflen = crypto_generichash_BYTES;
+        break;
+    }
+
     const uint8_t * const hash_buffer = hash_binary;
-    const size_t hash_buflen = sizeof hash_binary;
 #endif
 #if defined(USBGUARD_USE_LIBGCRYPT)
+    const int algo = gcryptAlgorithm(_algorithm);
     gcry_md_final(_state);
-    const size_t hash_buflen = gcry_md_get_algo_dlen(GCRY_MD_SHA256);
-    const uint8_t * const hash_buffer = gcry_md_read(_state, GCRY_MD_SHA256);
+    const size_t hash_buflen = gcry_md_get_algo_dlen(algo);
+    const uint8_t * const hash_buffer = gcry_md_read(_state, algo);
 #endif
 
-    return base64Encode(hash_buffer, hash_buflen);
+    if (buflen < hash_buflen) {
+      throw std::runtime_error("Hash value buffer too small");
+    }
+
+    std::copy(hash_buffer, hash_buffer + hash_buflen, buffer);
+    return hash_buflen;
+  }
+
+  String Hash::getBase64()
+  {
+    uint8_t hash_binary[max_size];
+    const size_t hash_buflen = getBinary(hash_binary, sizeof hash_binary);
+
+    return base64Encode(hash_binary, hash_buflen);
+  }
+
+  Hash::Algorithm Hash::getAlgorithm() const
+  {
+    return _algorithm;
+  }
+
+  void Hash::setDefaultAlgorithm(Algorithm algorithm)
+  {
+    G_default_algorithm = algorithm;
+    return;
+  }
+
+  Hash::Algorithm Hash::getDefaultAlgorithm()
+  {
+    return G_default_algorithm;
+  }
+
+  void Hash::setDefaultKey(const String& key)
+  {
+    G_default_key = key;
+    return;
+  }
+
+  void Hash::setDefaultKeyFromFile(const String& path)
+  {
+    setDefaultKey(readKeyFile(path));
+    return;
+  }
+
+  String Hash::readKeyFile(const String& path)
+  {
+    std::ifstream stream(path, std::ios::binary);
+
+    if (!stream.is_open()) {
+      throw std::runtime_error("Cannot open the hash key file: " + path);
+    }
+
+    std::ostringstream key;
+    key << stream.rdbuf();
+
+    if (key.str().empty()) {
+      throw std::runtime_error("The hash key file is empty: " + path);
+    }
+
+    return key.str();
+  }
+
+  Hash::Algorithm Hash::algorithmFromString(const String& algorithm_string)
+  {
+    if (algorithm_string == "sha256") {
+      return Algorithm::SHA256;
+    }
+    if (algorithm_string == "sha512") {
+      return Algorithm::SHA512;
+    }
+    if (algorithm_string == "blake2b") {
+      return Algorithm::BLAKE2b;
+    }
+    throw std::runtime_error("Unknown hash algorithm: " + algorithm_string);
+  }
+
+  const String Hash::algorithmToString(Algorithm algorithm)
+  {
+    switch(algorithm) {
+      case Algorithm::SHA256:
+        return "sha256";
+      case Algorithm::SHA512:
+        return "sha512";
+      case Algorithm::BLAKE2b:
+        return "blake2b";
+    }
+    throw std::runtime_error("Unknown hash algorithm");
   }
 } /* namespace usbguard */
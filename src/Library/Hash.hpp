@@ -32,16 +32,94 @@
 
 namespace usbguard
 {
-  class Hash
+  /*
+   * Incremental hash computation used for the device and
+   * rule file hash values.
+   *
+   * The crypto library implementations use CPU specific
+   * code paths (e.g. SHA extensions or ARMv8 crypto
+   * instructions) when available, so there's no separate
+   * accelerated backend here.
+   */
+  class DLL_PUBLIC Hash
   {
     public:
+      /* Largest binary hash value size of the supported algorithms */
+      static const size_t max_size = 64;
+
+      enum class Algorithm {
+        SHA256,
+        SHA512,
+        BLAKE2b
+      };
+
+      /*
+       * Initialize the hash state using the default algorithm
+       * and key (see setDefaultAlgorithm and setDefaultKey).
+       */
       Hash();
+      /*
+       * Initialize the hash state using an explicit algorithm.
+       * A non-empty key selects the keyed mode: HMAC for the
+       * SHA-2 algorithms, keyed BLAKE2b otherwise.
+       */
+      Hash(Algorithm algorithm, const String& key = String());
+      ~Hash();
+
+      Hash(const Hash&) = delete;
+      Hash& operator=(const Hash&) = delete;
+
       size_t update(const String& value);
       size_t update(std::istream& stream);
+      size_t update(const uint8_t *data, size_t size);
+      /*
+       * Finalize the computation and return the Base64 encoded
+       * hash value. Call reset() before reusing the object.
+       */
       String getBase64();
+      /*
+       * Finalize the computation and store the binary hash value
+       * in the buffer. Returns the size of the value, which is at
+       * most max_size bytes. Call reset() before reusing the object.
+       */
+      size_t getBinary(uint8_t *buffer, size_t buflen);
+      /*
+       * Start a new computation with the same algorithm and key,
+       * without the cost of setting up a new hash context.
+       */
+      void reset();
+
+      Algorithm getAlgorithm() const;
+
+      /*
+       * Process-wide defaults used by the default constructor.
+       * They are meant to be set once at startup, before any
+       * device is hashed, and aren't synchronized.
+       */
+      static void setDefaultAlgorithm(Algorithm algorithm);
+      static Algorithm getDefaultAlgorithm();
+      static void setDefaultKey(const String& key);
+      /* Use the whole content of a file as the default key */
+      static void setDefaultKeyFromFile(const String& path);
+      /* Read a key file, throws an exception if it's missing or empty */
+      static String readKeyFile(const String& path);
+
+      static Algorithm algorithmFromString(const String& algorithm_string);
+      static const String algorithmToString(Algorithm algorithm);
+
     private:
+      void init();
+
+      Algorithm _algorithm;
+      String _key;
 #if defined(USBGUARD_USE_LIBSODIUM)
-      crypto_hash_sha256_state _state;
+      union {
+        crypto_hash_sha256_state sha256;
+        crypto_hash_sha512_state sha512;
+        crypto_auth_hmacsha256_state hmacsha256;
+        crypto_auth_hmacsha512_state hmacsha512;
+        crypto_generichash_state blake2b;
+      } _state;
 #endif
 #if defined(USBGUARD_USE_LIBGCRYPT)
       gcry_md_hd_t _state;
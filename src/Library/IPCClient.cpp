@@ -70,6 +70,41 @@ namespace usbguard
     return d_pointer->listRules();
   }
 
+  const std::vector<Rule> IPCClient::listRules(const RuleFilter& filter)
+  {
+    return d_pointer->listRules(filter);
+  }
+
+  const std::vector<uint32_t> IPCClient::applyRuleBatch(const std::vector<RuleSet::Operation>& operations)
+  {
+    return d_pointer->applyRuleBatch(operations);
+  }
+
+  const std::vector<Rule::Statistics> IPCClient::getRuleStatistics()
+  {
+    return d_pointer->getRuleStatistics();
+  }
+
+  const std::vector<LatencyStatistics> IPCClient::getLatencyStatistics()
+  {
+    return d_pointer->getLatencyStatistics();
+  }
+
+  const MetricsSnapshot IPCClient::getMetricsSnapshot(uint32_t top_rules)
+  {
+    return d_pointer->getMetricsSnapshot(top_rules);
+  }
+
+  const IPCClient::MemoryStats IPCClient::getMemoryStats()
+  {
+    return d_pointer->getMemoryStats();
+  }
+
+  const StartupProfile IPCClient::getStartupProfile()
+  {
+    return d_pointer->getStartupProfile();
+  }
+
   void IPCClient::allowDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
   {
     d_pointer->allowDevice(id, permanent, timeout_sec);
@@ -88,8 +123,143 @@ namespace usbguard
     return;
   }
 
+  std::future<uint32_t> IPCClient::appendRuleAsync(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec)
+  {
+    return d_pointer->appendRuleAsync(rule_spec, parent_id, timeout_sec);
+  }
+
+  std::future<void> IPCClient::removeRuleAsync(uint32_t id)
+  {
+    return d_pointer->removeRuleAsync(id);
+  }
+
+  std::future<void> IPCClient::allowDeviceAsync(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    return d_pointer->applyDeviceTargetAsync(Rule::Target::Allow, id, permanent, timeout_sec);
+  }
+
+  std::future<void> IPCClient::blockDeviceAsync(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    return d_pointer->applyDeviceTargetAsync(Rule::Target::Block, id, permanent, timeout_sec);
+  }
+
+  std::future<void> IPCClient::rejectDeviceAsync(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    return d_pointer->applyDeviceTargetAsync(Rule::Target::Reject, id, permanent, timeout_sec);
+  }
+
+  void IPCClient::allowDevices(const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec)
+  {
+    d_pointer->applyDeviceTarget(Rule::Target::Allow, ids, permanent, timeout_sec);
+    return;
+  }
+
+  void IPCClient::blockDevices(const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec)
+  {
+    d_pointer->applyDeviceTarget(Rule::Target::Block, ids, permanent, timeout_sec);
+    return;
+  }
+
+  void IPCClient::rejectDevices(const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec)
+  {
+    d_pointer->applyDeviceTarget(Rule::Target::Reject, ids, permanent, timeout_sec);
+    return;
+  }
+
+  void IPCClient::applyDevicePolicy(const std::vector<DeviceTarget>& targets, bool permanent, uint32_t timeout_sec)
+  {
+    d_pointer->applyDevicePolicy(targets, permanent, timeout_sec);
+    return;
+  }
+
+  void IPCClient::setSubscription(const std::vector<std::string>& signals, const std::string& device_match)
+  {
+    d_pointer->setSubscription(signals, device_match);
+    return;
+  }
+
+  void IPCClient::setDeviceMirror(bool enabled)
+  {
+    d_pointer->setDeviceMirror(enabled);
+    return;
+  }
+
+  uint64_t IPCClient::getDeviceMirrorGeneration()
+  {
+    return d_pointer->getDeviceMirrorGeneration();
+  }
+
+  bool IPCClient::waitForReady(uint32_t timeout_ms)
+  {
+    return d_pointer->waitForReady(timeout_ms);
+  }
+
   const std::vector<Rule> IPCClient::listDevices(const std::string& query)
   {
     return d_pointer->listDevices(query);
   }
+
+  const std::vector<Rule> IPCClient::listDeviceSubtree(uint32_t id, const std::string& query)
+  {
+    return d_pointer->listDeviceSubtree(id, query);
+  }
+
+  const std::vector<IPCClient::DeviceFields> IPCClient::listDeviceFields(uint32_t id, const std::string& query,
+                                                                        const std::vector<std::string>& fields)
+  {
+    return d_pointer->listDeviceFields(id, query, fields);
+  }
+
+  const Interface::StateChanges IPCClient::getChangesSince(uint64_t generation)
+  {
+    return d_pointer->getChangesSince(generation);
+  }
+
+  const std::string IPCClient::dumpDevices()
+  {
+    return d_pointer->dumpDevices();
+  }
+
+  void IPCClient::reloadConfiguration()
+  {
+    d_pointer->reloadConfiguration();
+    return;
+  }
+
+  uint32_t IPCClient::saveRuleSetSnapshot(const std::string& name)
+  {
+    return d_pointer->saveRuleSetSnapshot(name);
+  }
+
+  const std::vector<RuleSet::SnapshotInfo> IPCClient::listRuleSetSnapshots()
+  {
+    return d_pointer->listRuleSetSnapshots();
+  }
+
+  void IPCClient::rollbackRuleSet(uint32_t version)
+  {
+    d_pointer->rollbackRuleSet(version);
+    return;
+  }
+
+  void IPCClient::setRuleGroupEnabled(const std::string& group, bool enabled)
+  {
+    d_pointer->setRuleGroupEnabled(group, enabled);
+    return;
+  }
+
+  const std::vector<PolicySimulator::Decision> IPCClient::simulatePolicy(const std::string& rules)
+  {
+    return d_pointer->simulatePolicy(rules);
+  }
+
+  const std::vector<RuleSet::MatchTraceStep> IPCClient::explainDevice(uint32_t id)
+  {
+    return d_pointer->explainDevice(id);
+  }
+
+  const std::vector<IPCClient::RuleSuggestion> IPCClient::suggestRules(uint32_t id)
+  {
+    return d_pointer->suggestRules(id);
+  }
 } /* namespace usbguard */
@@ -19,6 +19,7 @@
 #pragma once
 #include <Typedefs.hpp>
 #include <IPC.hpp>
+#include <future>
 
 namespace usbguard
 {
@@ -37,15 +38,138 @@ namespace usbguard
     uint32_t appendRule(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec);
     void removeRule(uint32_t id);
     const RuleSet listRules();
+    const std::vector<Rule> listRules(const RuleFilter& filter);
+    const std::vector<uint32_t> applyRuleBatch(const std::vector<RuleSet::Operation>& operations);
+    const std::vector<Rule::Statistics> getRuleStatistics();
+    const std::vector<LatencyStatistics> getLatencyStatistics();
+    const MetricsSnapshot getMetricsSnapshot(uint32_t top_rules);
+    const MemoryStats getMemoryStats();
+    const StartupProfile getStartupProfile();
     void allowDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
     void blockDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
     void rejectDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
+
+    /*
+     * Asynchronous variants of the methods above. The request is
+     * sent right away and the future yields the result, or throws
+     * the IPCException, once the reply was received, so that many
+     * requests can be in flight at once. The futures have to be
+     * waited for before the client is destroyed.
+     */
+    std::future<uint32_t> appendRuleAsync(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec);
+    std::future<void> removeRuleAsync(uint32_t id);
+    std::future<void> allowDeviceAsync(uint32_t id, bool permanent, uint32_t timeout_sec);
+    std::future<void> blockDeviceAsync(uint32_t id, bool permanent, uint32_t timeout_sec);
+    std::future<void> rejectDeviceAsync(uint32_t id, bool permanent, uint32_t timeout_sec);
+
+    /*
+     * Apply the target to all the listed devices with pipelined
+     * requests. The first failure is thrown after all the replies
+     * were received.
+     */
+    void allowDevices(const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec);
+    void blockDevices(const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec);
+    void rejectDevices(const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec);
+
+    /*
+     * Apply the targets to all the listed devices in a single
+     * request. Unlike the methods above, the permanent rules are
+     * stored by the daemon with a single rule file write.
+     */
+    void applyDevicePolicy(const std::vector<DeviceTarget>& targets, bool permanent, uint32_t timeout_sec);
+
     const std::vector<Rule> listDevices(const std::string& query);
     const std::vector<Rule> listDevices() /* NOTE: left for compatibility */
     {
       return listDevices("match");
     }
 
+    const std::vector<Rule> listDeviceSubtree(uint32_t id, const std::string& query);
+    const std::vector<DeviceFields> listDeviceFields(uint32_t id, const std::string& query,
+                                                     const std::vector<std::string>& fields);
+
+    /*
+     * Receive only the named signals (all of them if the list is
+     * empty) about devices matching the `device_match' rule (any
+     * device if empty). The batched DevicesRemoved and DevicesPresent
+     * signals are sent only when named explicitly and they aren't
+     * filtered by the device match. Subscribe to them instead of
+     * DeviceRemoved and DevicePresent to receive one signal per batch
+     * of devices. The subscription is sent to the daemon
+     * right away if connected and again on each connect().
+     */
+    void setSubscription(const std::vector<std::string>& signals, const std::string& device_match = std::string());
+
+    /*
+     * Answer listDevices() from a local copy of the device list,
+     * loaded on the first call and updated with the changes since
+     * its state generation (see getChangesSince) when a device signal
+     * is received. If the subscription leaves out device signals,
+     * the changes are fetched before every call. The copy is dropped
+     * on disconnect. Disabled by default.
+     */
+    void setDeviceMirror(bool enabled);
+
+    /*
+     * State generation of the daemon the local device list is
+     * up to date with, or 0 if the copy isn't enabled.
+     */
+    uint64_t getDeviceMirrorGeneration();
+
+    /*
+     * Wait until the daemon has processed the devices present at
+     * its startup and applied the policy to them. Returns false if
+     * it didn't finish within `timeout_ms' milliseconds.
+     */
+    bool waitForReady(uint32_t timeout_ms);
+
+    /*
+     * Changes made after `generation'. Use the generation of the
+     * result in the next call. If the result isn't complete, list
+     * the devices and rules instead.
+     */
+    const StateChanges getChangesSince(uint64_t generation);
+
+    /*
+     * Snapshot of all the devices in the DeviceSnapshot format.
+     */
+    const std::string dumpDevices();
+
+    /*
+     * Make the daemon re-read its configuration and rule file.
+     */
+    void reloadConfiguration();
+
+    /*
+     * Save the current rule set of the daemon, list the saved rule
+     * sets and restore one of them, see RuleSet::saveSnapshot.
+     */
+    uint32_t saveRuleSetSnapshot(const std::string& name);
+    const std::vector<RuleSet::SnapshotInfo> listRuleSetSnapshots();
+    void rollbackRuleSet(uint32_t version);
+
+    /*
+     * Enable or disable the rules of a group in the daemon, see
+     * RuleSet::setGroupEnabled.
+     */
+    void setRuleGroupEnabled(const std::string& group, bool enabled);
+
+    /*
+     * Evaluate the rules against the devices of the daemon without
+     * applying them, see PolicySimulator.
+     */
+    const std::vector<PolicySimulator::Decision> simulatePolicy(const std::string& rules);
+
+    /*
+     * Trace the rule match of a device, see RuleSet::explainMatch().
+     */
+    const std::vector<RuleSet::MatchTraceStep> explainDevice(uint32_t id);
+
+    /*
+     * Candidate rules for a device, see Interface::suggestRules().
+     */
+    const std::vector<RuleSuggestion> suggestRules(uint32_t id);
+
     virtual void IPCConnected() {}
     virtual void IPCDisconnected(bool exception_initiated, const IPCException& exception) {}
 
@@ -78,6 +202,14 @@ namespace usbguard
                 bool rule_match,
                 uint32_t rule_id) {}
 
+    /*
+     * Sent only if "RuleChanged" is listed in the subscription.
+     */
+    virtual void RuleChanged(uint32_t id,
+                bool removed,
+                const std::string& rule_spec,
+                uint64_t generation) {}
+
   private:
     IPCClientPrivate* d_pointer;
   };
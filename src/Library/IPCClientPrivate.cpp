@@ -19,12 +19,31 @@
 #include "IPCClientPrivate.hpp"
 #include "IPCPrivate.hpp"
 #include "LoggerPrivate.hpp"
+#include "Base64.hpp"
+#include "RuleQueryCache.hpp"
 
 #include <sys/poll.h>
 #include <sys/eventfd.h>
 
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <limits>
+
 namespace usbguard
 {
+  /* Largest message the daemon sends, with the header */
+  static const size_t G_recv_buffer_size = 1 << 20;
+
+  /* Time to wait for the reply to a request, counted from sending it */
+  static const std::chrono::milliseconds G_reply_timeout(5 * 1000);
+
+  /*
+   * Number of requests a batch keeps in flight. The daemon
+   * rejects requests beyond its per-lane queue limit.
+   */
+  static const size_t G_pipeline_depth = 64;
+
   static int32_t qbPollEventFn(int32_t fd, int32_t revents, void *data)
   {
     return 0;
@@ -52,12 +71,20 @@ namespace usbguard
     }
   }
 
+  /*
+   * Called by the client thread only, so the receive buffer
+   * is allocated once and reused for all the messages.
+   */
   const json IPCClientPrivate::receiveOne()
   {
-    char *data = new char[1<<20];
+    if (_recv_buffer.size() != G_recv_buffer_size) {
+      _recv_buffer.resize(G_recv_buffer_size);
+    }
+
+    char *data = _recv_buffer.data();
     ssize_t recv_size;
 
-    if ((recv_size = qb_ipcc_event_recv(_qb_conn, data, 1<<20, 500)) < 0) {
+    if ((recv_size = qb_ipcc_event_recv(_qb_conn, data, _recv_buffer.size(), 500)) < 0) {
       disconnect();
       throw IPCException(IPCException::ProtocolError, "Receive error");
     }
@@ -75,11 +102,21 @@ namespace usbguard
       throw IPCException(IPCException::ProtocolError, "Invalid size in header");
     }
 
+    IPCPrivate::WireFormat format = IPCPrivate::WireFormat::JSON;
+
+    if (!IPCPrivate::wireFormatFromHeaderID(hdr->id, format)) {
+      disconnect();
+      throw IPCException(IPCException::ProtocolError, "Unknown wire format in header");
+    }
+
     const char *jdata = data + sizeof(struct qb_ipc_response_header);
     const size_t jsize = recv_size - sizeof(struct qb_ipc_response_header);
-    const std::string json_string(jdata, jsize);
-    const json jobj = json::parse(json_string);
-    delete [] data;
+    const json jobj = IPCPrivate::decodeMessage(jdata, jsize, format);
+
+    if (format != IPCPrivate::WireFormat::JSON) {
+      _wire_format = format;
+    }
+
     return jobj;
   }
 
@@ -113,8 +150,25 @@ namespace usbguard
       return;
     }
 
-    auto& promise = it->second;
-    promise.set_value(jobj);
+    auto const& handler_it = _rv_chunk_handlers.find(id);
+    const bool is_chunk = jobj.count("_c") > 0;
+
+    if (handler_it != _rv_chunk_handlers.end() && jobj.count("_e") == 0) {
+      handler_it->second(jobj);
+    }
+    if (is_chunk) {
+      return;
+    }
+
+    /*
+     * The slot is released here, so that a reply nobody waits
+     * for anymore doesn't keep it allocated.
+     */
+    it->second.set_value(jobj);
+    _rv_map.erase(it);
+    if (handler_it != _rv_chunk_handlers.end()) {
+      _rv_chunk_handlers.erase(handler_it);
+    }
 
     return;
   }
@@ -133,6 +187,11 @@ namespace usbguard
   {
     try {
       const std::string name = jobj["_s"];
+
+      if (name.compare(0, 6, "Device") == 0) {
+        _device_mirror.markStale();
+      }
+
       if (name == "DeviceInserted") {
 	const json attributes_json = jobj.at("attributes");
 	std::map<std::string,std::string> attributes;
@@ -189,6 +248,40 @@ namespace usbguard
 	_p_instance.DeviceRemoved(jobj["id"],
 				  attributes);
       }
+      else if (name == "DevicesPresent") {
+        std::vector<Interface::PresentDevice> devices;
+
+        for (auto const& device_json : jobj.at("devices")) {
+          Interface::PresentDevice device { device_json.at("id"), { }, { },
+                                            Rule::targetFromString(device_json.at("target")) };
+          const json& attributes_json = device_json.at("attributes");
+
+          for (auto it = attributes_json.begin(); it != attributes_json.end(); ++it) {
+            device.attributes[it.key()] = it.value().get<std::string>();
+          }
+          for (auto const& type_json : device_json.at("interfaces")) {
+            device.interfaces.push_back(USBInterfaceType(type_json.get<std::string>()));
+          }
+          devices.push_back(std::move(device));
+        }
+
+        _p_instance.DevicesPresent(devices);
+      }
+      else if (name == "DevicesRemoved") {
+        std::vector<Interface::RemovedDevice> devices;
+
+        for (auto const& device_json : jobj.at("devices")) {
+          Interface::RemovedDevice device { device_json.at("id"), { } };
+          const json& attributes_json = device_json.at("attributes");
+
+          for (auto it = attributes_json.begin(); it != attributes_json.end(); ++it) {
+            device.attributes[it.key()] = it.value().get<std::string>();
+          }
+          devices.push_back(std::move(device));
+        }
+
+        _p_instance.DevicesRemoved(devices);
+      }
       else if (name == "DeviceAllowed") {
 	const json attributes_json = jobj.at("attributes");
 	std::map<std::string,std::string> attributes;
@@ -234,8 +327,15 @@ namespace usbguard
 				   jobj["rule_match"],
 				   jobj["rule_id"]);
       }
+      else if (name == "RuleChanged") {
+	_p_instance.RuleChanged(jobj.at("id"),
+				jobj.at("removed"),
+				jobj.at("rule"),
+				jobj.at("generation"));
+      }
       else {
-	throw 0;
+	/* Newer daemons may send signals we don't know about */
+	USBGUARD_LOG_DEBUG("Ignoring unknown IPC signal: {}", name);
       }
     } catch(...) {
       disconnect();
@@ -273,6 +373,10 @@ namespace usbguard
   {
     _qb_conn = nullptr;
     _qb_conn_fd = -1;
+    _wire_format = IPCPrivate::WireFormat::JSON;
+    _wire_format_offered = false;
+    _subscription_set = false;
+    _device_mirror_enabled = false;
     _eventfd = eventfd(0, 0);
     _qb_loop = qb_loop_create();
     qb_loop_poll_add(_qb_loop, QB_LOOP_HIGH, _eventfd, POLLIN, NULL, qbPollEventFn);
@@ -307,6 +411,12 @@ namespace usbguard
 
   void IPCClientPrivate::connect()
   {
+    /*
+     * The transport (shared memory or sockets) is selected by the
+     * daemon, see IPCTransport in usbguard-daemon.conf(5). libqb
+     * sets up the client side accordingly; the connection fd is
+     * used for the event notifications in both cases.
+     */
     _qb_conn = qb_ipcc_connect("usbguard", 1<<20);
 
     if (_qb_conn == nullptr) {
@@ -322,7 +432,19 @@ namespace usbguard
       throw IPCException(IPCException::ConnectionError, "Bad file descriptor");
     }
 
+    _wire_format = IPCPrivate::WireFormat::JSON;
+    _wire_format_offered = false;
+
     qb_loop_poll_add(_qb_loop, QB_LOOP_HIGH, _qb_conn_fd, POLLIN, this, qbIPCMessageProcessFn);
+
+    try {
+      sendSubscription();
+    }
+    catch(...) {
+      disconnect();
+      throw;
+    }
+
     _p_instance.IPCConnected();
     return;
   }
@@ -334,7 +456,17 @@ namespace usbguard
       qb_ipcc_disconnect(_qb_conn);
       _qb_conn = nullptr;
       _qb_conn_fd = -1;
+      _device_mirror.invalidate();
       _p_instance.IPCDisconnected(/*exception_initiated=*/true, exception);
+
+      /* Fail the requests waiting for a reply */
+      std::unique_lock<std::mutex> lock(_rv_map_mutex);
+      for (auto& slot : _rv_map) {
+        const IPCException disconnected(IPCException::ConnectionError, "Disconnected", slot.first);
+        slot.second.set_value(IPCPrivate::IPCExceptionToJSON(disconnected));
+      }
+      _rv_map.clear();
+      _rv_chunk_handlers.clear();
     }
   }
 
@@ -355,6 +487,11 @@ namespace usbguard
   }
 
   uint32_t IPCClientPrivate::appendRule(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec)
+  {
+    return appendRuleAsync(rule_spec, parent_id, timeout_sec).get();
+  }
+
+  std::future<uint32_t> IPCClientPrivate::appendRuleAsync(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec)
   {
     const json jreq = {
       {          "_m", "appendRule" },
@@ -364,18 +501,25 @@ namespace usbguard
       {          "_i", IPC::uniqueID() }
     };
 
-    const json jrep = qbIPCSendRecvJSON(jreq);
-
-    try {
-      const uint32_t retval = jrep["retval"];
-      return retval;
-    } catch(...) {
-      throw IPCException(IPCException::ProtocolError,
-			 "Invalid or missing return value after calling appendRule");
-    }
+    return std::async(std::launch::deferred, [](std::future<json> reply) -> uint32_t {
+      const json jrep = reply.get();
+      try {
+        const uint32_t retval = jrep.at("retval");
+        return retval;
+      } catch(...) {
+        throw IPCException(IPCException::ProtocolError,
+                           "Invalid or missing return value after calling appendRule");
+      }
+    }, qbIPCCallAsyncJSON(jreq));
   }
 
   void IPCClientPrivate::removeRule(uint32_t id)
+  {
+    removeRuleAsync(id).get();
+    return;
+  }
+
+  std::future<void> IPCClientPrivate::removeRuleAsync(uint32_t id)
   {
     const json jreq = {
       {   "_m", "removeRule" },
@@ -383,72 +527,403 @@ namespace usbguard
       {   "_i", IPC::uniqueID() }
     };
 
-    qbIPCSendRecvJSON(jreq);
-    return;
+    return std::async(std::launch::deferred, [](std::future<json> reply) {
+      reply.get();
+    }, qbIPCCallAsyncJSON(jreq));
   }
 
   const RuleSet IPCClientPrivate::listRules()
   {
     const json jreq = {
       { "_m", "listRules" },
+      { "stream", true },
       { "_i", IPC::uniqueID() }
     };
 
-    const json jrep = qbIPCSendRecvJSON(jreq);
+    std::vector<RuleSet::Operation> operations;
+    bool invalid = false;
+
+    /* Parse the rules as the parts of the reply arrive */
+    qbIPCSendRecvJSON(jreq, [&operations, &invalid](const json& jrep) {
+      try {
+        const json& retval = jrep.at("retval");
+        for (auto it = retval.begin(); it != retval.end(); ++it) {
+          const json& rule_json = it.value();
+          const uint32_t rule_id = rule_json["id"];
+          const std::string rule_string = rule_json["rule"];
+          Rule rule = Rule::fromString(rule_string);
+          rule.setRuleID(rule_id);
+          operations.push_back(RuleSet::Operation::append(rule));
+        }
+      } catch(...) {
+        invalid = true;
+      }
+    });
+
+    if (invalid) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling listRules");
+    }
 
     try {
       RuleSet ruleset(&_p_instance);
+      ruleset.applyBatch(operations);
+      return ruleset;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling listRules");
+    }
+  }
 
-      for (auto it = jrep["retval"].begin(); it != jrep["retval"].end(); ++it) {
-        const json rule_json = it.value(); 
-        const uint32_t rule_id = rule_json["id"];
-        const std::string rule_string = rule_json["rule"];
-        Rule rule = Rule::fromString(rule_string);
-        rule.setRuleID(rule_id);
-        ruleset.appendRule(rule);
+  const std::vector<Rule> IPCClientPrivate::listRules(const IPCClient::RuleFilter& filter)
+  {
+    const json jreq = {
+      { "_m", "listRules" },
+      { "stream", true },
+      { "target", filter.target },
+      { "device", filter.device },
+      { "first_id", filter.first_id },
+      { "last_id", filter.last_id },
+      { "offset", filter.offset },
+      { "limit", filter.limit },
+      { "_i", IPC::uniqueID() }
+    };
+
+    std::vector<Rule> rules;
+    bool invalid = false;
+
+    qbIPCSendRecvJSON(jreq, [&rules, &invalid](const json& jrep) {
+      try {
+        for (auto const& rule_json : jrep.at("retval")) {
+          Rule rule = Rule::fromString(rule_json.at("rule"));
+          rule.setRuleID(rule_json.at("id"));
+          rules.push_back(std::move(rule));
+        }
+      } catch(...) {
+        invalid = true;
       }
+    });
 
-      return ruleset;
-    } catch(...) {
+    if (invalid) {
       throw IPCException(IPCException::ProtocolError,
                          "Invalid or missing return value after calling listRules");
     }
+
+    return rules;
   }
 
-  void IPCClientPrivate::allowDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  const std::vector<uint32_t> IPCClientPrivate::applyRuleBatch(const std::vector<RuleSet::Operation>& operations)
   {
+    json operations_json = json::array();
+
+    for (auto const& operation : operations) {
+      json operation_json;
+      switch(operation.type) {
+        case RuleSet::Operation::Type::Append:
+          operation_json = {
+            {      "type", "append" },
+            { "rule_spec", operation.rule.toString() },
+            { "parent_id", operation.parent_id }
+          };
+          break;
+        case RuleSet::Operation::Type::Remove:
+          operation_json = {
+            { "type", "remove" },
+            {   "id", operation.id }
+          };
+          break;
+        case RuleSet::Operation::Type::Upsert:
+          operation_json = {
+            {               "type", "upsert" },
+            {         "match_spec", operation.match_rule.toString() },
+            {          "rule_spec", operation.rule.toString() },
+            { "parent_insensitive", operation.parent_insensitive }
+          };
+          break;
+      }
+      operations_json.push_back(operation_json);
+    }
+
     const json jreq = {
-      {          "_m", "allowDevice" },
-      {        "id", id },
-      {      "permanent", permanent },
-      { "timeout_sec", timeout_sec },
-      {          "_i", IPC::uniqueID() }
+      {         "_m", "applyRuleBatch" },
+      { "operations", operations_json },
+      {         "_i", IPC::uniqueID() }
     };
 
-    qbIPCSendRecvJSON(jreq);
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      std::vector<uint32_t> ids;
+      for (auto const& id_json : jrep.at("retval")) {
+        ids.push_back(id_json.get<uint32_t>());
+      }
+      return ids;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling applyRuleBatch");
+    }
+  }
+
+  static std::vector<Rule::Statistics> ruleStatisticsFromJSON(const json& jarray)
+  {
+    std::vector<Rule::Statistics> statistics;
+    for (auto const& statistics_json : jarray) {
+      Rule::Statistics rule_statistics;
+      rule_statistics.rule_id = statistics_json.at("id");
+      rule_statistics.evaluated = statistics_json.at("evaluated");
+      rule_statistics.applied = statistics_json.at("applied");
+      rule_statistics.last_evaluated = statistics_json.at("last_evaluated");
+      rule_statistics.last_applied = statistics_json.at("last_applied");
+      rule_statistics.match_time_histogram = \
+        statistics_json.at("match_time_histogram").get<std::vector<uint64_t>>();
+      statistics.push_back(rule_statistics);
+    }
+    return statistics;
+  }
+
+  static std::vector<LatencyStatistics> latencyStatisticsFromJSON(const json& jarray)
+  {
+    std::vector<LatencyStatistics> statistics;
+    for (auto const& statistics_json : jarray) {
+      const uint32_t stage = statistics_json.at("stage");
+      if (stage >= LatencyStatistics::StageCount) {
+        /* Skip the stages added by a newer daemon */
+        continue;
+      }
+      LatencyStatistics stage_statistics;
+      stage_statistics.stage = static_cast<LatencyStatistics::Stage>(stage);
+      stage_statistics.count = statistics_json.at("count");
+      stage_statistics.total_ns = statistics_json.at("total_ns");
+      stage_statistics.max_ns = statistics_json.at("max_ns");
+      stage_statistics.histogram = \
+        statistics_json.at("histogram").get<std::vector<uint64_t>>();
+      /* Not sent by older daemons */
+      stage_statistics.allocations = statistics_json.value("allocations", uint64_t(0));
+      stage_statistics.allocated_bytes = statistics_json.value("allocated_bytes", uint64_t(0));
+      statistics.push_back(stage_statistics);
+    }
+    return statistics;
+  }
+
+  const std::vector<Rule::Statistics> IPCClientPrivate::getRuleStatistics()
+  {
+    const json jreq = {
+      { "_m", "getRuleStatistics" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      return ruleStatisticsFromJSON(jrep.at("retval"));
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling getRuleStatistics");
+    }
+  }
+
+  const std::vector<LatencyStatistics> IPCClientPrivate::getLatencyStatistics()
+  {
+    const json jreq = {
+      { "_m", "getLatencyStatistics" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      return latencyStatisticsFromJSON(jrep.at("retval"));
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling getLatencyStatistics");
+    }
+  }
+
+  const MetricsSnapshot IPCClientPrivate::getMetricsSnapshot(uint32_t top_rules)
+  {
+    const json jreq = {
+      { "_m", "getMetricsSnapshot" },
+      { "top_rules", top_rules },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      const json& snapshot_json = jrep.at("retval");
+      MetricsSnapshot snapshot;
+      snapshot.time_ms = snapshot_json.at("time_ms");
+      snapshot.counters = snapshot_json.at("counters").get<std::map<std::string, uint64_t>>();
+      snapshot.gauges = snapshot_json.at("gauges").get<std::map<std::string, uint64_t>>();
+      snapshot.ipc_requests = snapshot_json.at("ipc_requests").get<std::map<std::string, uint64_t>>();
+      snapshot.latency = latencyStatisticsFromJSON(snapshot_json.at("latency"));
+      snapshot.hottest_rules = ruleStatisticsFromJSON(snapshot_json.at("hottest_rules"));
+      return snapshot;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling getMetricsSnapshot");
+    }
+  }
+
+  const IPCClient::MemoryStats IPCClientPrivate::getMemoryStats()
+  {
+    const json jreq = {
+      { "_m", "getMemoryStats" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      const json& stats_json = jrep.at("retval");
+      IPCClient::MemoryStats stats;
+      stats.rss = stats_json.at("rss");
+      stats.bytes = stats_json.at("bytes").get<std::map<std::string, uint64_t>>();
+      return stats;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling getMemoryStats");
+    }
+  }
+
+  const StartupProfile IPCClientPrivate::getStartupProfile()
+  {
+    const json jreq = {
+      { "_m", "getStartupProfile" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      const json& profile_json = jrep.at("retval");
+      StartupProfile profile;
+      profile.ready_ns = profile_json.at("ready_ns");
+
+      for (auto const& phase_json : profile_json.at("phases")) {
+        StartupProfile::Phase phase;
+        phase.name = phase_json.at("name").get<std::string>();
+        phase.start_ns = phase_json.at("start_ns");
+        phase.duration_ns = phase_json.at("duration_ns");
+        profile.phases.push_back(std::move(phase));
+      }
+      for (auto const& device_json : profile_json.at("devices")) {
+        StartupProfile::Device device;
+        device.id = device_json.at("id");
+        device.load_ns = device_json.at("load_ns");
+        device.decision_ns = device_json.at("decision_ns");
+        profile.devices.push_back(device);
+      }
+      return profile;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling getStartupProfile");
+    }
+  }
+
+  void IPCClientPrivate::allowDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    applyDeviceTargetAsync(Rule::Target::Allow, id, permanent, timeout_sec).get();
     return;
   }
 
   void IPCClientPrivate::blockDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
   {
+    applyDeviceTargetAsync(Rule::Target::Block, id, permanent, timeout_sec).get();
+    return;
+  }
+
+  void IPCClientPrivate::rejectDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    applyDeviceTargetAsync(Rule::Target::Reject, id, permanent, timeout_sec).get();
+    return;
+  }
+
+  std::future<void> IPCClientPrivate::applyDeviceTargetAsync(Rule::Target target, uint32_t id, bool permanent, uint32_t timeout_sec)
+  {
+    std::string method;
+
+    switch(target) {
+      case Rule::Target::Allow:
+        method = "allowDevice";
+        break;
+      case Rule::Target::Block:
+        method = "blockDevice";
+        break;
+      case Rule::Target::Reject:
+        method = "rejectDevice";
+        break;
+      default:
+        throw std::runtime_error("applyDeviceTargetAsync: invalid device target");
+    }
+
     const json jreq = {
-      {          "_m", "blockDevice" },
+      {          "_m", method },
       {        "id", id },
       {      "permanent", permanent },
       { "timeout_sec", timeout_sec },
       {          "_i", IPC::uniqueID() }
     };
 
-    qbIPCSendRecvJSON(jreq);
+    return std::async(std::launch::deferred, [](std::future<json> reply) {
+      reply.get();
+    }, qbIPCCallAsyncJSON(jreq));
+  }
+
+  /*
+   * Keep up to G_pipeline_depth requests in flight. All the
+   * requests are sent even if some fail; the first failure
+   * is rethrown once all the replies were received.
+   */
+  void IPCClientPrivate::applyDeviceTarget(Rule::Target target, const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec)
+  {
+    std::deque<std::future<void> > in_flight;
+    std::exception_ptr first_error;
+
+    auto wait_oldest = [&in_flight, &first_error]() {
+      try {
+        in_flight.front().get();
+      }
+      catch(...) {
+        if (!first_error) {
+          first_error = std::current_exception();
+        }
+      }
+      in_flight.pop_front();
+    };
+
+    for (const uint32_t id : ids) {
+      if (in_flight.size() >= G_pipeline_depth) {
+        wait_oldest();
+      }
+      in_flight.push_back(applyDeviceTargetAsync(target, id, permanent, timeout_sec));
+    }
+
+    while (!in_flight.empty()) {
+      wait_oldest();
+    }
+
+    if (first_error) {
+      std::rethrow_exception(first_error);
+    }
     return;
   }
 
-  void IPCClientPrivate::rejectDevice(uint32_t id, bool permanent, uint32_t timeout_sec)
+  void IPCClientPrivate::applyDevicePolicy(const std::vector<Interface::DeviceTarget>& targets, bool permanent, uint32_t timeout_sec)
   {
+    json devices_json = json::array();
+
+    for (auto const& device_target : targets) {
+      devices_json.push_back({
+        {     "id", device_target.id },
+        { "target", Rule::targetToString(device_target.target) }
+      });
+    }
+
     const json jreq = {
-      {          "_m", "rejectDevice" },
-      {        "id", id },
-      {      "permanent", permanent },
+      {          "_m", "applyDevicePolicy" },
+      {     "devices", devices_json },
+      {   "permanent", permanent },
       { "timeout_sec", timeout_sec },
       {          "_i", IPC::uniqueID() }
     };
@@ -458,10 +933,67 @@ namespace usbguard
   }
 
   const std::vector<Rule> IPCClientPrivate::listDevices(const std::string& query)
+  {
+    if (!_device_mirror_enabled) {
+      return fetchDevices(query);
+    }
+
+    Pointer<const Rule> query_rule;
+
+    try {
+      query_rule = RuleQueryCache::shared().get(query);
+    }
+    catch(...) {
+      throw IPCException(IPCException::InvalidArgument, "Invalid device query: " + query);
+    }
+
+    syncDeviceMirror();
+    return _device_mirror.query(*query_rule);
+  }
+
+  const std::vector<Rule> IPCClientPrivate::fetchDevices(const std::string& query)
   {
     const json jreq = {
       { "_m", "listDevices" },
       { "query", query },
+      { "stream", true },
+      { "_i", IPC::uniqueID() }
+    };
+
+    std::vector<Rule> devices;
+    bool invalid = false;
+
+    /* Parse the devices as the parts of the reply arrive */
+    qbIPCSendRecvJSON(jreq, [&devices, &invalid](const json& jrep) {
+      try {
+        const json& retval = jrep.at("retval");
+        for (auto it = retval.begin(); it != retval.end(); ++it) {
+          const json& device_json = it.value();
+          const uint32_t device_id = device_json["id"];
+          const std::string device_string = device_json["device"];
+          Rule device_rule = Rule::fromString(device_string);
+          device_rule.setRuleID(device_id);
+          devices.push_back(device_rule);
+        }
+      } catch(...) {
+        invalid = true;
+      }
+    });
+
+    if (invalid) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling listDevices");
+    }
+
+    return devices;
+  }
+
+  const std::vector<Rule> IPCClientPrivate::listDeviceSubtree(uint32_t id, const std::string& query)
+  {
+    const json jreq = {
+      { "_m", "listDeviceSubtree" },
+      { "id", id },
+      { "query", query },
       { "_i", IPC::uniqueID() }
     };
 
@@ -470,22 +1002,407 @@ namespace usbguard
     try {
       std::vector<Rule> devices;
 
-      for (auto it = jrep["retval"].begin(); it != jrep["retval"].end(); ++it) {
-        const json device_json = it.value();
-        const uint32_t device_id = device_json["id"];
-        const std::string device_string = device_json["device"];
-        Rule device_rule = Rule::fromString(device_string);
-        device_rule.setRuleID(device_id);
+      for (auto const& device_json : jrep.at("retval")) {
+        Rule device_rule = Rule::fromString(device_json.at("device"));
+        device_rule.setRuleID(device_json.at("id"));
         devices.push_back(device_rule);
       }
 
       return devices;
     } catch(...) {
       throw IPCException(IPCException::ProtocolError,
-                         "Invalid or missing return value after calling listDevices");
+                         "Invalid or missing return value after calling listDeviceSubtree");
     }
   }
 
+  const std::vector<IPCClient::DeviceFields> IPCClientPrivate::listDeviceFields(uint32_t id, const std::string& query,
+                                                                                const std::vector<std::string>& fields)
+  {
+    const json jreq = {
+      { "_m", "listDeviceFields" },
+      { "id", id },
+      { "query", query },
+      { "fields", fields },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      std::vector<IPCClient::DeviceFields> devices;
+
+      for (auto const& device_json : jrep.at("retval")) {
+        IPCClient::DeviceFields device;
+        device.id = device_json.at("id");
+        device.parent_id = device_json.at("parent_id");
+        device.values = device_json.at("values").get<std::vector<std::string>>();
+        devices.push_back(std::move(device));
+      }
+
+      return devices;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling listDeviceFields");
+    }
+  }
+
+  const Interface::StateChanges IPCClientPrivate::getChangesSince(uint64_t generation)
+  {
+    const json jreq = {
+      { "_m", "getChangesSince" },
+      { "generation", generation },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      const json& retval = jrep.at("retval");
+      Interface::StateChanges changes;
+
+      changes.generation = retval.at("generation");
+      changes.complete = retval.at("complete");
+
+      for (auto const& change_json : retval.at("devices")) {
+        Interface::StateChanges::Change change { change_json.at("id"), change_json.at("removed"), Rule() };
+        if (!change.removed) {
+          change.rule = Rule::fromString(change_json.at("device"));
+          change.rule.setRuleID(change.id);
+        }
+        changes.devices.push_back(std::move(change));
+      }
+
+      for (auto const& change_json : retval.at("rules")) {
+        Interface::StateChanges::Change change { change_json.at("id"), change_json.at("removed"), Rule() };
+        if (!change.removed) {
+          change.rule = Rule::fromString(change_json.at("rule"));
+          change.rule.setRuleID(change.id);
+        }
+        changes.rules.push_back(std::move(change));
+      }
+
+      return changes;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling getChangesSince");
+    }
+  }
+
+  const std::string IPCClientPrivate::dumpDevices()
+  {
+    const json jreq = {
+      { "_m", "dumpDevices" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      return base64Decode(jrep.at("retval").get<std::string>());
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling dumpDevices");
+    }
+  }
+
+  void IPCClientPrivate::reloadConfiguration()
+  {
+    const json jreq = {
+      { "_m", "reloadConfiguration" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    qbIPCSendRecvJSON(jreq);
+    return;
+  }
+
+  uint32_t IPCClientPrivate::saveRuleSetSnapshot(const std::string& name)
+  {
+    const json jreq = {
+      { "_m", "saveRuleSetSnapshot" },
+      { "name", name },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      const uint32_t retval = jrep.at("retval");
+      return retval;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling saveRuleSetSnapshot");
+    }
+  }
+
+  const std::vector<RuleSet::SnapshotInfo> IPCClientPrivate::listRuleSetSnapshots()
+  {
+    const json jreq = {
+      { "_m", "listRuleSetSnapshots" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      std::vector<RuleSet::SnapshotInfo> snapshots;
+      for (auto const& snapshot_json : jrep.at("retval")) {
+        RuleSet::SnapshotInfo snapshot;
+        snapshot.version = snapshot_json.at("version");
+        snapshot.name = snapshot_json.at("name");
+        snapshot.time = snapshot_json.at("time");
+        snapshot.rule_count = snapshot_json.at("rule_count");
+        snapshots.push_back(snapshot);
+      }
+      return snapshots;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling listRuleSetSnapshots");
+    }
+  }
+
+  void IPCClientPrivate::rollbackRuleSet(uint32_t version)
+  {
+    const json jreq = {
+      { "_m", "rollbackRuleSet" },
+      { "version", version },
+      { "_i", IPC::uniqueID() }
+    };
+
+    qbIPCSendRecvJSON(jreq);
+    return;
+  }
+
+  void IPCClientPrivate::setRuleGroupEnabled(const std::string& group, bool enabled)
+  {
+    const json jreq = {
+      { "_m", "setRuleGroupEnabled" },
+      { "group", group },
+      { "enabled", enabled },
+      { "_i", IPC::uniqueID() }
+    };
+
+    qbIPCSendRecvJSON(jreq);
+    return;
+  }
+
+  const std::vector<PolicySimulator::Decision> IPCClientPrivate::simulatePolicy(const std::string& rules)
+  {
+    const json jreq = {
+      { "_m", "simulatePolicy" },
+      { "rules", rules },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      std::vector<PolicySimulator::Decision> decisions;
+      for (auto const& decision_json : jrep.at("retval")) {
+        PolicySimulator::Decision decision;
+        decision.id = decision_json.at("id");
+        decision.device_rule = makePointer<Rule>(Rule::fromString(decision_json.at("device")));
+        decision.current_target = Rule::targetFromString(decision_json.at("current_target"));
+        decision.current_rule_id = decision_json.at("current_rule_id");
+        decision.target = Rule::targetFromString(decision_json.at("target"));
+        decision.rule_id = decision_json.at("rule_id");
+        decisions.push_back(decision);
+      }
+      return decisions;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling simulatePolicy");
+    }
+  }
+
+  const std::vector<RuleSet::MatchTraceStep> IPCClientPrivate::explainDevice(uint32_t id)
+  {
+    const json jreq = {
+      { "_m", "explainDevice" },
+      { "id", id },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      std::vector<RuleSet::MatchTraceStep> steps;
+      for (auto const& step_json : jrep.at("retval")) {
+        RuleSet::MatchTraceStep step;
+        step.rule_id = step_json.at("rule_id");
+        step.target = Rule::targetFromString(step_json.at("target"));
+        step.rejected_by = step_json.at("rejected_by");
+        for (auto const& condition_json : step_json.at("conditions")) {
+          step.conditions.emplace_back(condition_json.at("condition"), condition_json.at("result"));
+        }
+        step.matched = step_json.at("matched");
+        step.time_ns = step_json.at("time_ns");
+        steps.push_back(std::move(step));
+      }
+      return steps;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling explainDevice");
+    }
+  }
+
+  const std::vector<IPCClient::RuleSuggestion> IPCClientPrivate::suggestRules(uint32_t id)
+  {
+    const json jreq = {
+      { "_m", "suggestRules" },
+      { "id", id },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const json jrep = qbIPCSendRecvJSON(jreq);
+
+    try {
+      std::vector<IPCClient::RuleSuggestion> suggestions;
+      for (auto const& suggestion_json : jrep.at("retval")) {
+        IPCClient::RuleSuggestion suggestion;
+        suggestion.granularity = suggestion_json.at("granularity");
+        suggestion.rule = suggestion_json.at("rule");
+        suggestion.matching_devices = suggestion_json.at("matching_devices");
+        suggestions.push_back(std::move(suggestion));
+      }
+      return suggestions;
+    } catch(...) {
+      throw IPCException(IPCException::ProtocolError,
+                         "Invalid or missing return value after calling suggestRules");
+    }
+  }
+
+  void IPCClientPrivate::setSubscription(const std::vector<std::string>& signals, const std::string& device_match)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_subscription_mutex);
+      _subscription_set = true;
+      _subscription_signals = signals;
+      _subscription_device_match = device_match;
+    }
+    if (isConnected()) {
+      sendSubscription();
+    }
+    return;
+  }
+
+  /*
+   * The daemon holds the reply until it's ready, so the wait
+   * has its own deadline instead of the usual reply timeout.
+   */
+  bool IPCClientPrivate::waitForReady(uint32_t timeout_ms)
+  {
+    const json jreq = {
+      { "_m", "waitForReady" },
+      { "_i", IPC::uniqueID() }
+    };
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::future<json> future = qbIPCSendRequestJSON(jreq);
+
+    try {
+      qbIPCWaitReplyJSON(jreq["_i"], future, deadline);
+    }
+    catch(const IPCException& ex) {
+      if (ex.code() != IPCException::TransientError) {
+        throw;
+      }
+      return false;
+    }
+    return true;
+  }
+
+  void IPCClientPrivate::setDeviceMirror(bool enabled)
+  {
+    std::unique_lock<std::mutex> lock(_device_mirror_sync_mutex);
+    _device_mirror_enabled = enabled;
+    _device_mirror.invalidate();
+  }
+
+  uint64_t IPCClientPrivate::getDeviceMirrorGeneration()
+  {
+    if (!_device_mirror_enabled) {
+      return 0;
+    }
+    syncDeviceMirror();
+    return _device_mirror.generation();
+  }
+
+  /*
+   * Whether the daemon sends a signal for every device change. The
+   * batched signals are sent only if subscribed explicitly, in place
+   * of the per-device ones.
+   */
+  bool IPCClientPrivate::subscriptionTracksDevices()
+  {
+    std::unique_lock<std::mutex> lock(_subscription_mutex);
+
+    if (!_subscription_set || _subscription_signals.empty()) {
+      return !_subscription_set || _subscription_device_match.empty();
+    }
+    if (!_subscription_device_match.empty()) {
+      return false;
+    }
+
+    auto subscribed = [this](const char *name) {
+      return std::find(_subscription_signals.cbegin(), _subscription_signals.cend(), name) != _subscription_signals.cend();
+    };
+
+    return subscribed("DeviceInserted") &&
+      (subscribed("DevicePresent") || subscribed("DevicesPresent")) &&
+      (subscribed("DeviceRemoved") || subscribed("DevicesRemoved")) &&
+      subscribed("DeviceAllowed") && subscribed("DeviceBlocked") && subscribed("DeviceRejected");
+  }
+
+  /*
+   * The mirror is loaded with the device list and the generation
+   * taken before it, then only the changes made after its generation
+   * are fetched, once a device signal marked it stale. The changes
+   * listed twice are applied twice, which is harmless as they hold
+   * the current device state. Without the device signals, the
+   * changes are fetched before every query.
+   */
+  void IPCClientPrivate::syncDeviceMirror()
+  {
+    std::unique_lock<std::mutex> lock(_device_mirror_sync_mutex);
+
+    if (_device_mirror.isValid() && !_device_mirror.isStale() && subscriptionTracksDevices()) {
+      return;
+    }
+
+    _device_mirror.clearStale();
+
+    if (_device_mirror.isValid() &&
+        _device_mirror.apply(getChangesSince(_device_mirror.generation()))) {
+      return;
+    }
+
+    /* A generation past the current one returns the current one */
+    const uint64_t generation = \
+      getChangesSince(std::numeric_limits<uint64_t>::max()).generation;
+
+    _device_mirror.reset(generation, fetchDevices("match"));
+  }
+
+  void IPCClientPrivate::sendSubscription()
+  {
+    json jreq;
+    {
+      std::unique_lock<std::mutex> lock(_subscription_mutex);
+      if (!_subscription_set) {
+        return;
+      }
+      jreq = {
+        { "_m", "setSubscription" },
+        { "signals", _subscription_signals },
+        { "device_match", _subscription_device_match },
+        { "_i", IPC::uniqueID() }
+      };
+    }
+    qbIPCSendRecvJSON(jreq);
+    return;
+  }
+
   void IPCClientPrivate::thread()
   {
     qb_loop_run(_qb_loop);
@@ -501,28 +1418,52 @@ namespace usbguard
     return;
   }
 
-  json IPCClientPrivate::qbIPCSendRecvJSON(const json& jval)
+  json IPCClientPrivate::qbIPCSendRecvJSON(const json& jval, const std::function<void(const json&)>& chunk_handler)
+  {
+    const auto deadline = std::chrono::steady_clock::now() + G_reply_timeout;
+    std::future<json> future = qbIPCSendRequestJSON(jval, chunk_handler);
+    return qbIPCWaitReplyJSON(jval["_i"], future, deadline);
+  }
+
+  /*
+   * The returned future is ready once the reply is received
+   * and holds the reply as is, exceptions included.
+   */
+  std::future<json> IPCClientPrivate::qbIPCSendRequestJSON(const json& jval, const std::function<void(const json&)>& chunk_handler)
   {
     if (!isConnected()) {
       throw IPCException(IPCException::ConnectionError, "Not connected");
     }
 
-    const std::string json_string = jval.dump();
+    const IPCPrivate::WireFormat format = _wire_format;
+    const uint64_t id = jval["_i"];
+
+    /*
+     * Lock the return value slot map. The lock also protects
+     * the send buffer, which is reused for all the requests.
+     */
+    std::unique_lock<std::mutex> rv_map_lock(_rv_map_mutex);
+    std::string& message = _send_buffer;
+
+    if (format == IPCPrivate::WireFormat::JSON && !_wire_format_offered.exchange(true)) {
+      json jval_offer = jval;
+      jval_offer[IPCPrivate::wire_format_key] = \
+        IPCPrivate::wireFormatToString(IPCPrivate::WireFormat::MessagePack);
+      IPCPrivate::encodeMessage(jval_offer, format, message);
+    }
+    else {
+      IPCPrivate::encodeMessage(jval, format, message);
+    }
 
     struct qb_ipc_request_header hdr;
-    hdr.id = 0;
-    hdr.size = sizeof hdr + json_string.size();
+    hdr.id = static_cast<int32_t>(format);
+    hdr.size = sizeof hdr + message.size();
 
     struct iovec iov[2];
     iov[0].iov_base = &hdr;
     iov[0].iov_len = sizeof hdr;
-    iov[1].iov_base = (void *)json_string.c_str();
-    iov[1].iov_len = json_string.size();
-
-    const uint64_t id = jval["_i"];
-
-    /* Lock the return value slot map */
-    std::unique_lock<std::mutex> rv_map_lock(_rv_map_mutex);
+    iov[1].iov_base = (void *)message.c_str();
+    iov[1].iov_len = message.size();
 
     /*
      * Create the promise and future objects.
@@ -533,46 +1474,60 @@ namespace usbguard
     auto& promise = _rv_map[id];
     auto future = promise.get_future();
 
-    qb_ipcc_sendv(_qb_conn, iov, 2);
-
-    /* 
-     * Unlock the return value map so that the message
-     * processing handler aren't blocked.
-     */
-    rv_map_lock.unlock();
-
-    /* Wait for some time for the reply to be received */
-    const std::chrono::milliseconds timeout_ms(5*1000);
-    const bool timed_out = \
-      future.wait_for(timeout_ms) == std::future_status::timeout;
+    if (chunk_handler) {
+      _rv_chunk_handlers[id] = chunk_handler;
+    }
 
-    json retval;
+    qb_ipcc_sendv(_qb_conn, iov, 2);
 
-    if (!timed_out) {
-      retval = future.get();
+    /* Don't keep the storage of oversized requests around */
+    if (message.capacity() > G_recv_buffer_size) {
+      std::string().swap(message);
     }
 
-    /* Remove the slot from the return value slot map */
-    rv_map_lock.lock();
-    _rv_map.erase(id);
-    rv_map_lock.unlock();
+    return future;
+  }
+
+  json IPCClientPrivate::qbIPCWaitReplyJSON(uint64_t id, std::future<json>& future, std::chrono::steady_clock::time_point deadline)
+  {
+    const bool timed_out = \
+      future.wait_until(deadline) == std::future_status::timeout;
 
     if (timed_out) {
+      /* Remove the slot from the return value slot map */
+      std::unique_lock<std::mutex> rv_map_lock(_rv_map_mutex);
+      _rv_map.erase(id);
+      _rv_chunk_handlers.erase(id);
+      rv_map_lock.unlock();
       throw IPCException(IPCException::TransientError, "Timed out while waiting for IPC reply");
     }
-    else {
-      /*
-       * We might have caused an exception. Check whether
-       * that's the case and if true, throw it here.
-       */
-      if (IPCPrivate::isExceptionJSON(retval)) {
-        throw IPCPrivate::jsonToIPCException(retval);
-      }
-      else {
-        return retval;
-      }
+
+    const json retval = future.get();
+
+    /*
+     * We might have caused an exception. Check whether
+     * that's the case and if true, throw it here.
+     */
+    if (IPCPrivate::isExceptionJSON(retval)) {
+      throw IPCPrivate::jsonToIPCException(retval);
     }
-    return json();
+
+    return retval;
+  }
+
+  /*
+   * Send the request now and wait for the reply when the result
+   * is requested from the returned future. The reply timeout
+   * counts from now.
+   */
+  std::future<json> IPCClientPrivate::qbIPCCallAsyncJSON(const json& jval)
+  {
+    const auto deadline = std::chrono::steady_clock::now() + G_reply_timeout;
+    const uint64_t id = jval["_i"];
+
+    return std::async(std::launch::deferred, [this, id, deadline](std::future<json> reply) {
+      return qbIPCWaitReplyJSON(id, reply, deadline);
+    }, qbIPCSendRequestJSON(jval));
   }
 
   bool IPCClientPrivate::isExceptionJSON(const json& jval) const
@@ -22,10 +22,15 @@
 #include "Common/Thread.hpp"
 #include "Typedefs.hpp"
 #include "Common/JSON.hpp"
+#include "IPCPrivate.hpp"
+#include "DeviceMirror.hpp"
 
 #include <map>
 #include <mutex>
 #include <future>
+#include <atomic>
+#include <functional>
+#include <chrono>
 
 #include <qb/qbipcc.h>
 #include <qb/qbloop.h>
@@ -47,18 +52,56 @@ namespace usbguard {
     uint32_t appendRule(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec);
     void removeRule(uint32_t id);
     const RuleSet listRules();
+    const std::vector<Rule> listRules(const IPCClient::RuleFilter& filter);
+    const std::vector<uint32_t> applyRuleBatch(const std::vector<RuleSet::Operation>& operations);
+    const std::vector<Rule::Statistics> getRuleStatistics();
+    const std::vector<LatencyStatistics> getLatencyStatistics();
+    const MetricsSnapshot getMetricsSnapshot(uint32_t top_rules);
+    const IPCClient::MemoryStats getMemoryStats();
+    const StartupProfile getStartupProfile();
 
     void allowDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
     void blockDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
     void rejectDevice(uint32_t id, bool permanent, uint32_t timeout_sec);
     const std::vector<Rule> listDevices(const std::string& query);
+    const std::vector<Rule> listDeviceSubtree(uint32_t id, const std::string& query);
+    const std::vector<IPCClient::DeviceFields> listDeviceFields(uint32_t id, const std::string& query,
+                                                                const std::vector<std::string>& fields);
+
+    std::future<uint32_t> appendRuleAsync(const std::string& rule_spec, uint32_t parent_id, uint32_t timeout_sec);
+    std::future<void> removeRuleAsync(uint32_t id);
+    std::future<void> applyDeviceTargetAsync(Rule::Target target, uint32_t id, bool permanent, uint32_t timeout_sec);
+    void applyDeviceTarget(Rule::Target target, const std::vector<uint32_t>& ids, bool permanent, uint32_t timeout_sec);
+    void applyDevicePolicy(const std::vector<Interface::DeviceTarget>& targets, bool permanent, uint32_t timeout_sec);
+
+    void setSubscription(const std::vector<std::string>& signals, const std::string& device_match);
+    void setDeviceMirror(bool enabled);
+    uint64_t getDeviceMirrorGeneration();
+    bool waitForReady(uint32_t timeout_ms);
+    const Interface::StateChanges getChangesSince(uint64_t generation);
+    const std::string dumpDevices();
+    void reloadConfiguration();
+    uint32_t saveRuleSetSnapshot(const std::string& name);
+    const std::vector<RuleSet::SnapshotInfo> listRuleSetSnapshots();
+    void rollbackRuleSet(uint32_t version);
+    void setRuleGroupEnabled(const std::string& group, bool enabled);
+    const std::vector<PolicySimulator::Decision> simulatePolicy(const std::string& rules);
+    const std::vector<RuleSet::MatchTraceStep> explainDevice(uint32_t id);
+    const std::vector<IPCClient::RuleSuggestion> suggestRules(uint32_t id);
 
   protected:
+    void sendSubscription();
+    bool subscriptionTracksDevices();
+    void syncDeviceMirror();
+    const std::vector<Rule> fetchDevices(const std::string& query);
     void destruct();
     void thread();
     void stop();
 
-    json qbIPCSendRecvJSON(const json& jval);
+    json qbIPCSendRecvJSON(const json& jval, const std::function<void(const json&)>& chunk_handler = nullptr);
+    std::future<json> qbIPCSendRequestJSON(const json& jval, const std::function<void(const json&)>& chunk_handler = nullptr);
+    json qbIPCWaitReplyJSON(uint64_t id, std::future<json>& future, std::chrono::steady_clock::time_point deadline);
+    std::future<json> qbIPCCallAsyncJSON(const json& jval);
     bool isExceptionJSON(const json& jval) const;
 
     const json receiveOne();
@@ -78,6 +121,37 @@ namespace usbguard {
     Thread<IPCClientPrivate> _thread;
     std::mutex _rv_map_mutex;
     std::map<uint64_t, std::promise<json> > _rv_map;
+
+    /*
+     * Receivers of the parts of streamed replies, called from
+     * the client thread for each part and for the final reply.
+     */
+    std::map<uint64_t, std::function<void(const json&)> > _rv_chunk_handlers;
+
+    std::vector<char> _recv_buffer;
+    std::string _send_buffer;
+
+    /*
+     * Format used for sending requests. The first request on
+     * a connection offers MessagePack; the daemon switches
+     * to it if it supports it, which is detected from the
+     * format of the received messages.
+     */
+    std::atomic<IPCPrivate::WireFormat> _wire_format;
+    std::atomic_bool _wire_format_offered;
+
+    std::mutex _subscription_mutex;
+    bool _subscription_set;
+    std::vector<std::string> _subscription_signals;
+    std::string _subscription_device_match;
+
+    /*
+     * Local copy of the device list, see IPCClient::setDeviceMirror.
+     * The sync mutex makes one thread at a time fetch the changes.
+     */
+    std::atomic_bool _device_mirror_enabled;
+    std::mutex _device_mirror_sync_mutex;
+    DeviceMirror _device_mirror;
   };
 
 } /* namespace usbguard */
@@ -17,9 +17,59 @@
 // Authors: Daniel Kopecek <dkopecek@redhat.com>
 //
 #include "IPCPrivate.hpp"
+#include "MessagePack.hpp"
+
+#include <istream>
+#include <ostream>
+#include <streambuf>
 
 namespace usbguard
 {
+  /*
+   * Stream buffer reading from memory owned by the caller,
+   * used to parse JSON without copying the received data.
+   */
+  class IPCMessageInputBuffer : public std::streambuf
+  {
+  public:
+    IPCMessageInputBuffer(const char *data, size_t size)
+    {
+      char *begin = const_cast<char *>(data);
+      setg(begin, begin, begin + size);
+    }
+  };
+
+  /*
+   * Stream buffer appending to a string, used to serialize
+   * JSON into a buffer which is reused between messages.
+   */
+  class IPCMessageOutputBuffer : public std::streambuf
+  {
+  public:
+    IPCMessageOutputBuffer(std::string& buffer)
+      : _buffer(buffer)
+    {
+    }
+
+  protected:
+    int_type overflow(int_type c)
+    {
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        _buffer.push_back(traits_type::to_char_type(c));
+      }
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n)
+    {
+      _buffer.append(s, n);
+      return n;
+    }
+
+  private:
+    std::string& _buffer;
+  };
+
   json IPCPrivate::IPCExceptionToJSON(const IPCException& ex)
   {
     json object = {
@@ -47,4 +97,82 @@ namespace usbguard
       return IPCException(code, "", object["_i"]);
     }
   }
+
+  const char * const IPCPrivate::wire_format_key = "_f";
+
+  bool IPCPrivate::wireFormatFromHeaderID(int32_t id, WireFormat& format)
+  {
+    switch(static_cast<WireFormat>(id)) {
+      case WireFormat::JSON:
+      case WireFormat::MessagePack:
+        format = static_cast<WireFormat>(id);
+        return true;
+    }
+    return false;
+  }
+
+  bool IPCPrivate::wireFormatFromString(const std::string& format_string, WireFormat& format)
+  {
+    if (format_string == "json") {
+      format = WireFormat::JSON;
+      return true;
+    }
+    if (format_string == "msgpack") {
+      format = WireFormat::MessagePack;
+      return true;
+    }
+    return false;
+  }
+
+  std::string IPCPrivate::wireFormatToString(WireFormat format)
+  {
+    switch(format) {
+      case WireFormat::JSON:
+        return "json";
+      case WireFormat::MessagePack:
+        return "msgpack";
+    }
+    throw std::runtime_error("BUG: Unknown wire format");
+  }
+
+  std::string IPCPrivate::encodeMessage(const json& object, WireFormat format)
+  {
+    std::string buffer;
+    encodeMessage(object, format, buffer);
+    return buffer;
+  }
+
+  void IPCPrivate::encodeMessage(const json& object, WireFormat format, std::string& buffer)
+  {
+    buffer.clear();
+
+    switch(format) {
+      case WireFormat::JSON:
+        {
+          IPCMessageOutputBuffer output_buffer(buffer);
+          std::ostream stream(&output_buffer);
+          stream << object;
+        }
+        return;
+      case WireFormat::MessagePack:
+        toMessagePack(object, buffer);
+        return;
+    }
+    throw std::runtime_error("BUG: Unknown wire format");
+  }
+
+  json IPCPrivate::decodeMessage(const char *data, size_t size, WireFormat format)
+  {
+    switch(format) {
+      case WireFormat::JSON:
+        {
+          IPCMessageInputBuffer input_buffer(data, size);
+          std::istream stream(&input_buffer);
+          return json::parse(stream);
+        }
+      case WireFormat::MessagePack:
+        return fromMessagePack(data, size);
+    }
+    throw std::runtime_error("BUG: Unknown wire format");
+  }
 } /* namespace usbguard */
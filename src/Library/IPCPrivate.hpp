@@ -30,5 +30,34 @@ namespace usbguard
     static bool isExceptionJSON(const json& object);
     static IPCException jsonToIPCException(const json& object);
     static json IPCExceptionToJSON(const IPCException& ex);
+
+    /*
+     * Encoding of the message payload. The format of each message
+     * is stored in the id field of the libqb header. A connection
+     * starts with JSON. A client which understands other formats
+     * lists the one it prefers in the "_f" field of its requests
+     * and the daemon switches the connection to that format,
+     * starting with the reply. Peers which don't know about the
+     * field ignore it and keep using JSON.
+     */
+    enum class WireFormat : int32_t {
+      JSON = 0,
+      MessagePack = 1
+    };
+
+    static const char * const wire_format_key;
+
+    static bool wireFormatFromHeaderID(int32_t id, WireFormat& format);
+    static bool wireFormatFromString(const std::string& format_string, WireFormat& format);
+    static std::string wireFormatToString(WireFormat format);
+
+    /*
+     * The buffer variant of encodeMessage replaces the content of
+     * the buffer, so that its storage can be reused. decodeMessage
+     * parses the data in place.
+     */
+    static std::string encodeMessage(const json& object, WireFormat format);
+    static void encodeMessage(const json& object, WireFormat format, std::string& buffer);
+    static json decodeMessage(const char *data, size_t size, WireFormat format);
   };
 } /* namespace usbguard */
@@ -22,6 +22,10 @@
 #include <USB.hpp>
 #include <Rule.hpp>
 #include <RuleSet.hpp>
+#include <PolicySimulator.hpp>
+#include <LatencyStatistics.hpp>
+#include <StartupProfile.hpp>
+#include <MetricsSnapshot.hpp>
 #include <string>
 #include <map>
 #include <vector>
@@ -32,6 +36,90 @@ namespace usbguard
   class DLL_PUBLIC Interface
   {
   public:
+    /*
+     * Changes of the device and rule sets made after a generation.
+     * Each changed device or rule is listed once, with its current
+     * state. If the requested generation isn't covered by the change
+     * log anymore (or was issued by another daemon instance), complete
+     * is false, no changes are listed and the caller has to list the
+     * full state again. The generation value identifies the state the
+     * changes bring the caller to.
+     */
+    struct StateChanges
+    {
+      struct Change
+      {
+        uint32_t id;
+        bool removed;
+        Rule rule;
+      };
+
+      uint64_t generation;
+      bool complete;
+      std::vector<Change> devices;
+      std::vector<Change> rules;
+    };
+
+    /*
+     * A device and the target to apply to it, for applyDevicePolicy.
+     */
+    struct DeviceTarget
+    {
+      uint32_t id;
+      Rule::Target target;
+    };
+
+    /*
+     * A candidate rule for a device, see suggestRules().
+     */
+    struct RuleSuggestion
+    {
+      std::string granularity; /* "port", "hash", "id-serial" or "id" */
+      std::string rule;
+      uint32_t matching_devices; /* other present devices matched by the rule */
+    };
+
+    /*
+     * Selects the rules listed by listRules(const RuleFilter&). The
+     * default filter selects all the rules.
+     */
+    struct RuleFilter
+    {
+      RuleFilter()
+        : first_id(0),
+          last_id(0),
+          offset(0),
+          limit(0)
+      {
+      }
+
+      std::string target; /* only the rules with this target, any if empty */
+      std::string device; /* only the rules which apply to this device rule, any if empty */
+      uint32_t first_id; /* only the rules with ids from first_id */
+      uint32_t last_id; /* up to last_id (unbounded if 0) */
+      uint32_t offset; /* skip this many of the selected rules */
+      uint32_t limit; /* list at most this many rules, all if 0 */
+    };
+
+    /*
+     * The selected fields of a device, see listDeviceFields().
+     */
+    struct DeviceFields
+    {
+      uint32_t id;
+      uint32_t parent_id;
+      std::vector<std::string> values; /* in the order of the requested fields */
+    };
+
+    /*
+     * Memory used by the daemon, see getMemoryStats().
+     */
+    struct MemoryStats
+    {
+      uint64_t rss; /* resident set size of the daemon process */
+      std::map<std::string, uint64_t> bytes; /* estimated usage by subsystem */
+    };
+
     /* Methods */
     virtual uint32_t appendRule(const std::string& rule_spec,
 				uint32_t parent_id,
@@ -41,6 +129,43 @@ namespace usbguard
 
     virtual const RuleSet listRules() = 0;
 
+    /*
+     * The rules selected by the filter, in rule set order. The
+     * rules which apply to a device are looked up in the match
+     * index of the rule set, ignoring the rule conditions.
+     */
+    virtual const std::vector<Rule> listRules(const RuleFilter& filter) = 0;
+
+    virtual const std::vector<uint32_t> applyRuleBatch(const std::vector<RuleSet::Operation>& operations) = 0;
+
+    virtual const std::vector<Rule::Statistics> getRuleStatistics() = 0;
+
+    /*
+     * Latency histograms of the stages of the device authorization path.
+     */
+    virtual const std::vector<LatencyStatistics> getLatencyStatistics() = 0;
+
+    /*
+     * The daemon counters, gauges and latency histograms, and the
+     * usage counters of the `top_rules' most applied rules, read in
+     * one call. See MetricsSnapshot.
+     */
+    virtual const MetricsSnapshot getMetricsSnapshot(uint32_t top_rules) = 0;
+
+    /*
+     * The resident set size of the daemon and the estimated memory
+     * used by the rules, devices, IPC buffers, log queue and the
+     * other subsystems. The estimates cover the data structures,
+     * not the allocator overhead.
+     */
+    virtual const MemoryStats getMemoryStats() = 0;
+
+    /*
+     * The timestamped startup phases of the daemon and the processing
+     * time of each device present at startup, see StartupProfile.
+     */
+    virtual const StartupProfile getStartupProfile() = 0;
+
     virtual void allowDevice(uint32_t id,
 			     bool permanent,
 			     uint32_t timeout_sec) = 0;
@@ -53,8 +178,99 @@ namespace usbguard
 			      bool permanent,
 			      uint32_t timeout_sec) = 0;
 
+    /*
+     * Apply the targets to all the listed devices in one call. The
+     * permanent device rules are stored as a single rule batch.
+     */
+    virtual void applyDevicePolicy(const std::vector<DeviceTarget>& targets,
+				   bool permanent,
+				   uint32_t timeout_sec) = 0;
+
     virtual const std::vector<Rule> listDevices(const std::string& query) = 0;
 
+    /*
+     * Same as listDevices, but takes an already parsed query.
+     * Implementations with direct access to the device manager
+     * should override this to skip the rule string round-trip.
+     */
+    virtual const std::vector<Rule> queryDevices(const Rule& query)
+    {
+      return listDevices(query.toString());
+    }
+
+    /*
+     * The device `id' and the devices connected behind it to which
+     * the query applies, every parent before its children. Use
+     * Rule::RootID to list all the devices in topology order.
+     */
+    virtual const std::vector<Rule> listDeviceSubtree(uint32_t id, const std::string& query) = 0;
+
+    /*
+     * Same as listDeviceSubtree, but only the requested `fields' of
+     * each device are returned, with the id of its parent device.
+     * The fields are the device rule attributes "id", "name", "serial",
+     * "hash", "parent-hash", "via-port" and "with-interface", in the
+     * rule language (e.g. `name "Hub"'), "target" and "rule", the whole
+     * device rule. Attributes the device doesn't have are empty.
+     */
+    virtual const std::vector<DeviceFields> listDeviceFields(uint32_t id,
+							     const std::string& query,
+							     const std::vector<std::string>& fields) = 0;
+
+    virtual const StateChanges getChangesSince(uint64_t generation) = 0;
+
+    /*
+     * Snapshot of all the devices in the DeviceSnapshot format.
+     */
+    virtual const std::string dumpDevices() = 0;
+
+    /*
+     * Re-read the daemon configuration and the rule file and apply
+     * what changed, keeping the state of the present devices.
+     */
+    virtual void reloadConfiguration() = 0;
+
+    /*
+     * Save the current rule set under `name', see RuleSet::saveSnapshot.
+     * Returns the version of the snapshot.
+     */
+    virtual uint32_t saveRuleSetSnapshot(const std::string& name) = 0;
+
+    virtual const std::vector<RuleSet::SnapshotInfo> listRuleSetSnapshots() = 0;
+
+    /*
+     * Restore the saved rule set `version'. Only the devices affected
+     * by the rules which differ between the versions are re-evaluated.
+     */
+    virtual void rollbackRuleSet(uint32_t version) = 0;
+
+    /*
+     * Enable or disable the rules of a group, see RuleSet::setGroupEnabled.
+     * The rule file isn't modified and the state isn't kept across restarts.
+     */
+    virtual void setRuleGroupEnabled(const std::string& group, bool enabled) = 0;
+
+    /*
+     * Evaluate the rules `rules' (in the rule file format) against
+     * the present devices without applying them. Returns the current
+     * and the simulated decision of each device.
+     */
+    virtual const std::vector<PolicySimulator::Decision> simulatePolicy(const std::string& rules) = 0;
+
+    /*
+     * Match the device with id `id' against the rules again and
+     * return each visited rule with the reason why it did or didn't
+     * match, see RuleSet::explainMatch(). Nothing is modified.
+     */
+    virtual const std::vector<RuleSet::MatchTraceStep> explainDevice(uint32_t id) = 0;
+
+    /*
+     * Candidate allow rules for the device with id `id', from the
+     * most to the least specific one, each with the number of the
+     * other present devices it would match too. Nothing is modified.
+     */
+    virtual const std::vector<RuleSuggestion> suggestRules(uint32_t id) = 0;
+
     /* Signals */
     virtual void DeviceInserted(uint32_t id,
 				const std::map<std::string,std::string>& attributes,
@@ -70,6 +286,44 @@ namespace usbguard
     virtual void DeviceRemoved(uint32_t id,
 			       const std::map<std::string,std::string>& attributes) = 0;
 
+    struct PresentDevice
+    {
+      uint32_t id;
+      std::map<std::string,std::string> attributes;
+      std::vector<USBInterfaceType> interfaces;
+      Rule::Target target;
+    };
+
+    /*
+     * All the devices found present when the daemon started, parents
+     * before their children. The default calls DevicePresent for
+     * each device.
+     */
+    virtual void DevicesPresent(const std::vector<PresentDevice>& devices)
+    {
+      for (auto const& device : devices) {
+        DevicePresent(device.id, device.attributes, device.interfaces, device.target);
+      }
+    }
+
+    struct RemovedDevice
+    {
+      uint32_t id;
+      std::map<std::string,std::string> attributes;
+    };
+
+    /*
+     * Devices removed in one batch, e.g. a hub and the devices behind
+     * it, every device listed before its parent. The default calls
+     * DeviceRemoved for each device.
+     */
+    virtual void DevicesRemoved(const std::vector<RemovedDevice>& devices)
+    {
+      for (auto const& device : devices) {
+        DeviceRemoved(device.id, device.attributes);
+      }
+    }
+
     virtual void DeviceAllowed(uint32_t id,
 			       const std::map<std::string,std::string>& attributes,
 			       bool rule_match,
@@ -84,5 +338,10 @@ namespace usbguard
 				const std::map<std::string,std::string>& attributes,
 				bool rule_match,
 				uint32_t rule_id) = 0;
+
+    virtual void RuleChanged(uint32_t id,
+			     bool removed,
+			     const std::string& rule_spec,
+			     uint64_t generation) = 0;
   };
 } /* namespace usbguard */
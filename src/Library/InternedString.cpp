@@ -0,0 +1,59 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "InternedString.hpp"
+#include "StringPool.hpp"
+#include "Rule.hpp"
+
+namespace usbguard {
+  static const StringPool::Entry& emptyEntry()
+  {
+    static const StringPool::Entry& entry = StringPool::instance().intern(String());
+    return entry;
+  }
+
+  InternedString::InternedString()
+  {
+    const StringPool::Entry& entry = emptyEntry();
+    _value = &entry.first;
+    _id = entry.second;
+  }
+
+  InternedString::InternedString(const String& value)
+  {
+    const StringPool::Entry& entry = StringPool::instance().intern(value);
+    _value = &entry.first;
+    _id = entry.second;
+  }
+
+  InternedString::InternedString(const char *value)
+    : InternedString(String(value))
+  {
+  }
+
+  String InternedString::toRuleString() const
+  {
+    return StringPool::instance().ruleString(_id, *_value);
+  }
+
+  void appendRuleString(String& rule_string, const InternedString& value)
+  {
+    rule_string.append(StringPool::instance().ruleString(value.id(), value.str()));
+    return;
+  }
+} /* namespace usbguard */
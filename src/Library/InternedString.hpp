@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include <cstdint>
+
+namespace usbguard {
+  /*
+   * Handle of a string value stored in the process-wide string
+   * pool. Copies of the handle share the stored value and equal
+   * strings have equal handles, so the comparison of two handles
+   * doesn't compare the string values.
+   */
+  class DLL_PUBLIC InternedString
+  {
+  public:
+    InternedString();
+    InternedString(const String& value);
+    InternedString(const char *value);
+
+    const String& str() const
+    {
+      return *_value;
+    }
+
+    operator const String&() const
+    {
+      return *_value;
+    }
+
+    /* Pool id of the value. Never zero. */
+    uint32_t id() const
+    {
+      return _id;
+    }
+
+    bool empty() const
+    {
+      return _value->empty();
+    }
+
+    bool operator==(const InternedString& rhs) const
+    {
+      return _value == rhs._value;
+    }
+
+    bool operator!=(const InternedString& rhs) const
+    {
+      return _value != rhs._value;
+    }
+
+    String toRuleString() const;
+
+  private:
+    const String *_value;
+    uint32_t _id;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,148 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace usbguard {
+  /*
+   * Counting Bloom filter over 64-bit key hashes. A negative
+   * answer of mayContain() is exact, a positive one may be
+   * wrong with a probability which depends on the number of
+   * keys per counter. Each key sets `probes' 8-bit counters;
+   * a counter which reached its maximum is never decremented
+   * again, so removing keys never causes false negatives.
+   */
+  class KeyFilter
+  {
+  public:
+    KeyFilter()
+      : _size(0)
+    {
+    }
+
+    /*
+     * Drop all the keys and size the filter for `capacity' keys.
+     */
+    void reset(size_t capacity)
+    {
+      size_t counters = min_counters;
+
+      while (counters < capacity * counters_per_key) {
+        counters <<= 1;
+      }
+
+      _counters.assign(counters, 0);
+      _size = 0;
+      return;
+    }
+
+    void clear()
+    {
+      _counters.clear();
+      _size = 0;
+      return;
+    }
+
+    void add(uint64_t key)
+    {
+      if (_counters.empty()) {
+        reset(0);
+      }
+      for (unsigned int i = 0; i < probes; ++i) {
+        uint8_t& counter = _counters[position(key, i)];
+        if (counter < UINT8_MAX) {
+          ++counter;
+        }
+      }
+      ++_size;
+      return;
+    }
+
+    void remove(uint64_t key)
+    {
+      if (_counters.empty()) {
+        return;
+      }
+      for (unsigned int i = 0; i < probes; ++i) {
+        uint8_t& counter = _counters[position(key, i)];
+        if (counter > 0 && counter < UINT8_MAX) {
+          --counter;
+        }
+      }
+      if (_size > 0) {
+        --_size;
+      }
+      return;
+    }
+
+    bool mayContain(uint64_t key) const
+    {
+      if (_size == 0) {
+        return false;
+      }
+      for (unsigned int i = 0; i < probes; ++i) {
+        if (_counters[position(key, i)] == 0) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /*
+     * Number of keys added and not removed since the last reset.
+     */
+    size_t size() const
+    {
+      return _size;
+    }
+
+    /*
+     * Return true if the filter holds more keys than it was sized
+     * for, i.e. the false positive rate is higher than expected.
+     */
+    bool overloaded() const
+    {
+      return _size * counters_per_key > _counters.size();
+    }
+
+  private:
+    static const unsigned int probes = 3;
+    static const size_t counters_per_key = 16;
+    static const size_t min_counters = 1024;
+
+    /*
+     * Double hashing: the probe positions are derived from
+     * the two halves of a mixed key hash.
+     */
+    size_t position(uint64_t key, unsigned int probe) const
+    {
+      key ^= key >> 33;
+      key *= UINT64_C(0xff51afd7ed558ccd);
+      key ^= key >> 33;
+      const uint32_t h1 = static_cast<uint32_t>(key);
+      const uint32_t h2 = static_cast<uint32_t>(key >> 32) | 1;
+      return (h1 + probe * h2) & (_counters.size() - 1);
+    }
+
+    std::vector<uint8_t> _counters;
+    size_t _size;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,298 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <build-config.h>
+#include "LatencyStatistics.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+namespace usbguard {
+  const size_t LatencyStatistics::StageCount;
+  const size_t LatencyStatistics::Buckets;
+
+  /*
+   * One cache line aligned block of counters per stage, so that
+   * recording durations of different stages from different threads
+   * doesn't contend on the same cache line.
+   */
+  struct alignas(64) StageCounters
+  {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> histogram[LatencyStatistics::Buckets];
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> allocated_bytes;
+  };
+
+  static StageCounters stage_counters[LatencyStatistics::StageCount];
+
+  /*
+   * The stage timed on this thread, or StageCount outside of the
+   * stages. Only constant initialized variables are used, so that
+   * the allocation hooks never allocate themselves.
+   */
+  static thread_local uint32_t thread_stage = LatencyStatistics::StageCount;
+  static thread_local uint64_t thread_allocations = 0;
+  static thread_local uint64_t thread_allocated_bytes = 0;
+
+#if defined(USBGUARD_ALLOCATION_STATS)
+  static void countAllocation(size_t size)
+  {
+    ++thread_allocations;
+    thread_allocated_bytes += size;
+
+    if (thread_stage < LatencyStatistics::StageCount) {
+      StageCounters& counters = stage_counters[thread_stage];
+      counters.allocations.fetch_add(1, std::memory_order_relaxed);
+      counters.allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+  }
+#endif
+
+  LatencyStatistics::LatencyStatistics()
+    : stage(Stage::UdevReceive),
+      count(0),
+      total_ns(0),
+      max_ns(0),
+      histogram(Buckets, 0),
+      allocations(0),
+      allocated_bytes(0)
+  {
+  }
+
+  uint64_t LatencyStatistics::percentileUpperBound(double percentile) const
+  {
+    if (count == 0) {
+      return 0;
+    }
+
+    const double threshold = count * percentile / 100.0;
+    uint64_t cumulative = 0;
+
+    for (size_t bucket = 0; bucket < histogram.size(); ++bucket) {
+      cumulative += histogram[bucket];
+      if (cumulative >= threshold) {
+        if (bucket + 1 == histogram.size()) {
+          return max_ns / 1000;
+        }
+        return uint64_t(1) << bucket;
+      }
+    }
+
+    return max_ns / 1000;
+  }
+
+  const String LatencyStatistics::stageToString(Stage stage)
+  {
+    switch(stage) {
+      case Stage::UdevReceive:
+        return "udev-receive";
+      case Stage::DeviceCreate:
+        return "device-create";
+      case Stage::DescriptorParse:
+        return "descriptor-parse";
+      case Stage::DeviceHash:
+        return "device-hash";
+      case Stage::RuleMatch:
+        return "rule-match";
+      case Stage::SysfsApply:
+        return "sysfs-apply";
+      case Stage::IPCBroadcast:
+        return "ipc-broadcast";
+      case Stage::Insertion:
+        return "insertion";
+      case Stage::EventQueue:
+        return "event-queue";
+      case Stage::EventProcess:
+        return "event-process";
+    }
+    throw std::runtime_error("Invalid latency statistics stage");
+  }
+
+  void LatencyStatistics::record(Stage stage, std::chrono::steady_clock::duration duration)
+  {
+    const size_t index = static_cast<size_t>(stage);
+
+    if (index >= StageCount) {
+      return;
+    }
+
+    StageCounters& counters = stage_counters[index];
+    const uint64_t nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    const uint64_t usec = nsec / 1000;
+    size_t bucket = 0;
+
+    while (bucket < Buckets - 1 && usec >= (uint64_t(1) << bucket)) {
+      ++bucket;
+    }
+
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.total_ns.fetch_add(nsec, std::memory_order_relaxed);
+    counters.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max_ns = counters.max_ns.load(std::memory_order_relaxed);
+    while (nsec > max_ns &&
+           !counters.max_ns.compare_exchange_weak(max_ns, nsec, std::memory_order_relaxed)) {
+      continue;
+    }
+    return;
+  }
+
+  std::vector<LatencyStatistics> LatencyStatistics::get()
+  {
+    std::vector<LatencyStatistics> statistics(StageCount);
+
+    for (size_t index = 0; index < StageCount; ++index) {
+      const StageCounters& counters = stage_counters[index];
+      LatencyStatistics& stage_statistics = statistics[index];
+
+      stage_statistics.stage = static_cast<Stage>(index);
+      stage_statistics.count = counters.count.load(std::memory_order_relaxed);
+      stage_statistics.total_ns = counters.total_ns.load(std::memory_order_relaxed);
+      stage_statistics.max_ns = counters.max_ns.load(std::memory_order_relaxed);
+      for (size_t bucket = 0; bucket < Buckets; ++bucket) {
+        stage_statistics.histogram[bucket] = counters.histogram[bucket].load(std::memory_order_relaxed);
+      }
+      stage_statistics.allocations = counters.allocations.load(std::memory_order_relaxed);
+      stage_statistics.allocated_bytes = counters.allocated_bytes.load(std::memory_order_relaxed);
+    }
+
+    return statistics;
+  }
+
+  bool LatencyStatistics::countsAllocations()
+  {
+#if defined(USBGUARD_ALLOCATION_STATS)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  uint64_t LatencyStatistics::threadAllocations()
+  {
+    return thread_allocations;
+  }
+
+  uint64_t LatencyStatistics::threadAllocatedBytes()
+  {
+    return thread_allocated_bytes;
+  }
+
+  static uint32_t enterStage(uint32_t stage)
+  {
+    const uint32_t previous_stage = thread_stage;
+    thread_stage = stage;
+    return previous_stage;
+  }
+
+  LatencyStatistics::Timer::Timer(Stage stage)
+    : _stage(stage),
+      _previous_stage(enterStage(static_cast<uint32_t>(stage))),
+      _started(std::chrono::steady_clock::now())
+  {
+  }
+
+  LatencyStatistics::Timer::~Timer()
+  {
+    record(_stage, std::chrono::steady_clock::now() - _started);
+    thread_stage = _previous_stage;
+  }
+} /* namespace usbguard */
+
+#if defined(USBGUARD_ALLOCATION_STATS)
+/*
+ * Replacements of the global allocation functions, which count the
+ * allocations of the whole process. The deallocation functions are
+ * replaced too, so that they stay paired with malloc().
+ */
+static void *countedAllocate(std::size_t size)
+{
+  usbguard::countAllocation(size);
+
+  if (size == 0) {
+    size = 1;
+  }
+
+  void *ptr = nullptr;
+
+  while ((ptr = std::malloc(size)) == nullptr) {
+    const std::new_handler handler = std::get_new_handler();
+
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+
+  return ptr;
+}
+
+void *operator new(std::size_t size)
+{
+  return countedAllocate(size);
+}
+
+void *operator new[](std::size_t size)
+{
+  return countedAllocate(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  try {
+    return countedAllocate(size);
+  }
+  catch(...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  try {
+    return countedAllocate(size);
+  }
+  catch(...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+#endif
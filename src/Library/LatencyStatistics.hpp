@@ -0,0 +1,122 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+namespace usbguard {
+  /**
+   * Point-in-time copy of the latency histogram of one stage of the
+   * device authorization path.
+   *
+   * The histograms are process-wide. Recording a duration is a few
+   * relaxed atomic increments and never takes a lock, so it can be
+   * used on the hot path, also from several threads at once.
+   */
+  struct DLL_PUBLIC LatencyStatistics
+  {
+    enum class Stage : uint32_t {
+      UdevReceive = 0, /**< Receiving a device event from udev */
+      DeviceCreate, /**< Constructing the device object, including the sysfs data */
+      DescriptorParse, /**< Parsing the USB descriptors */
+      DeviceHash, /**< Computing the device hash */
+      RuleMatch, /**< Searching the rule set for the first matching rule */
+      SysfsApply, /**< Writing the target to sysfs */
+      IPCBroadcast, /**< Broadcasting a signal to the IPC clients */
+      Insertion, /**< Processing a device event from udev, end to end */
+      EventQueue, /**< Waiting in the daemon's device event queue */
+      EventProcess /**< Processing a device event by the daemon */
+    };
+
+    static const size_t StageCount = 10;
+
+    /**
+     * Number of histogram buckets. Bucket `i' counts the durations
+     * shorter than 2^i microseconds; the last bucket counts all the
+     * longer ones.
+     */
+    static const size_t Buckets = 24;
+
+    LatencyStatistics();
+
+    Stage stage;
+    uint64_t count; /**< Number of recorded durations */
+    uint64_t total_ns; /**< Sum of the recorded durations (nanoseconds) */
+    uint64_t max_ns; /**< Longest recorded duration (nanoseconds) */
+    std::vector<uint64_t> histogram; /**< See Buckets */
+    uint64_t allocations; /**< Heap allocations made in the stage, see countsAllocations() */
+    uint64_t allocated_bytes; /**< Bytes requested by those allocations */
+
+    /**
+     * Upper bound of the bucket containing the given percentile
+     * (0-100) of the recorded durations, in microseconds.
+     */
+    uint64_t percentileUpperBound(double percentile) const;
+
+    static const String stageToString(Stage stage);
+
+    static void record(Stage stage, std::chrono::steady_clock::duration duration);
+
+    /**
+     * Read the histograms of all stages. The counters are read
+     * independently, so they may be from slightly different moments
+     * if durations are being recorded at the same time.
+     */
+    static std::vector<LatencyStatistics> get();
+
+    /**
+     * True if the library was built with --enable-allocation-stats.
+     * The heap allocations (operator new) of the process are counted
+     * then, and attributed to the innermost stage timed by a Timer on
+     * the allocating thread. Nested stages aren't included in the
+     * counts of the enclosing ones.
+     */
+    static bool countsAllocations();
+
+    /**
+     * Heap allocations made by the calling thread so far, in the
+     * stages and outside of them, and the bytes they requested.
+     * Zero if the allocations aren't counted.
+     */
+    static uint64_t threadAllocations();
+    static uint64_t threadAllocatedBytes();
+
+    /**
+     * Records the lifetime of the instance as a duration of a stage,
+     * and the heap allocations made meanwhile by the thread, see
+     * countsAllocations().
+     */
+    class DLL_PUBLIC Timer
+    {
+    public:
+      Timer(Stage stage);
+      ~Timer();
+
+      Timer(const Timer&) = delete;
+      const Timer& operator=(const Timer&) = delete;
+
+    private:
+      const Stage _stage;
+      const uint32_t _previous_stage;
+      const std::chrono::steady_clock::time_point _started;
+    };
+  };
+} /* namespace usbguard */
@@ -19,19 +19,129 @@
 #include "LinuxDeviceManager.hpp"
 #include "LinuxSysIO.hpp"
 #include "LoggerPrivate.hpp"
+#include "LatencyStatistics.hpp"
+#include "StartupProfile.hpp"
+#include "Common/ThreadPool.hpp"
+#include "Common/Utility.hpp"
+#include "Common/Tracepoints.hpp"
 #include <USB.hpp>
 #include <sys/eventfd.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/sysmacros.h>
 #include <stdexcept>
 #include <fstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <exception>
+#include <set>
 
 namespace usbguard {
 
-  LinuxDevice::LinuxDevice(LinuxDeviceManager& device_manager, struct udev_device* dev)
-    : Device(device_manager)
+  /*
+   * Size of the on-stack buffer used for reading the descriptor
+   * data. Larger descriptor data is read into a heap buffer.
+   */
+  static const size_t descriptor_buffer_size = 4096;
+
+  /*
+   * Read the whole content of the file name in the directory dirfd.
+   * The data is stored in buffer if it fits, otherwise it's stored in
+   * heap_buffer. Returns a pointer to the data and sets size to its size.
+   */
+  static const uint8_t *readDescriptorData(const int dirfd, const char *name, uint8_t *buffer, const size_t buflen,
+                                           std::vector<uint8_t>& heap_buffer, size_t& size)
+  {
+    const int fd = ::openat(dirfd, name, O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+      throw std::runtime_error("Cannot load USB descriptors: failed to open the descriptor data stream");
+    }
+
+    uint8_t *data = buffer;
+    size_t capacity = buflen;
+    size = 0;
+
+    for (;;) {
+      if (size == capacity) {
+        /*
+         * The buffer is full. Continue in a larger heap buffer.
+         */
+        heap_buffer.resize(capacity * 2);
+        if (data == buffer) {
+          memcpy(heap_buffer.data(), buffer, size);
+        }
+        data = heap_buffer.data();
+        capacity = heap_buffer.size();
+      }
+
+      const ssize_t read_size = ::read(fd, data + size, capacity - size);
+
+      if (read_size < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ::close(fd);
+        throw std::runtime_error("Cannot load USB descriptors: failed to read the descriptor data");
+      }
+      if (read_size == 0) {
+        break;
+      }
+
+      size += read_size;
+    }
+
+    ::close(fd);
+    return data;
+  }
+
+  /*
+   * Read the value of the sysfs attribute name in the directory dirfd,
+   * without the trailing newline. Returns false if the attribute
+   * doesn't exist or cannot be read.
+   */
+  static bool readSysfsAttribute(const int dirfd, const char *name, String& value)
+  {
+    const int fd = ::openat(dirfd, name, O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    char buffer[4096];
+    ssize_t read_size = 0;
+
+    do {
+      read_size = ::read(fd, buffer, sizeof buffer);
+    } while (read_size < 0 && errno == EINTR);
+
+    ::close(fd);
+
+    if (read_size < 0) {
+      return false;
+    }
+
+    while (read_size > 0 && buffer[read_size - 1] == '\n') {
+      --read_size;
+    }
+
+    value.assign(buffer, read_size);
+    return true;
+  }
+
+  LinuxDevice::LinuxDevice(LinuxDeviceManager& device_manager, struct udev_device* dev, bool load)
+    : Device(device_manager),
+      _syspath_fd(-1),
+      _devnum(0)
   {
-    logger->debug("Creating a new LinuxDevice instance");
+    USBGUARD_LOG_DEBUG("Creating a new LinuxDevice instance");
+    USBGUARD_PROBE1(device_create_begin, this);
 
     /*
      * Look for the parent USB device and set the parent id
@@ -52,7 +162,7 @@ namespace usbguard {
 
     const String parent_syspath(parent_syspath_cstr);
 
-    logger->debug("Parent device syspath: {}", parent_syspath_cstr);
+    USBGUARD_LOG_DEBUG("Parent device syspath: {}", parent_syspath_cstr);
 
     if (parent_devtype == nullptr ||
         strcmp(parent_devtype, "usb_device") != 0) {
@@ -61,32 +171,14 @@ namespace usbguard {
       setParentHash(hashString(parent_syspath));
     }
     else {
-      setParentID(device_manager.getIDFromSysPath(parent_syspath));
-    }
-
-    const char *name = udev_device_get_sysattr_value(dev, "product");
-    if (name) {
-      logger->debug("DeviceName={}", name);
-      setName(name);
-    }
-    
-    const char *id_vendor_cstr = udev_device_get_sysattr_value(dev, "idVendor");
-    const char *id_product_cstr = udev_device_get_sysattr_value(dev, "idProduct");
-
-    if (id_vendor_cstr && id_product_cstr) {
-      logger->debug("VendorID={}", id_vendor_cstr);
-      logger->debug("ProductID={}", id_product_cstr);
-      const String id_vendor = id_vendor_cstr;
-      const String id_product = id_product_cstr;
-      USBDeviceID device_id(id_vendor, id_product);
-      setDeviceID(device_id);
+      _parent_syspath = parent_syspath;
     }
 
-    const char *serial = udev_device_get_sysattr_value(dev, "serial");
-    if (serial) {
-      logger->debug("Serial={}", serial);
-      setSerial(serial);
-    }
+    /*
+     * The name, the serial number and the vendor and product IDs are
+     * set by loadSysfsData(). The IDs are taken from the device
+     * descriptor.
+     */
 
     /* FIXME: We should somehow lock the syspath before accessing the
      *        files inside to prevent creating invalid devices. It is
@@ -94,9 +186,11 @@ namespace usbguard {
      *        be the same when we start reading the descriptor data and
      *        the authorization state.
      */
+    _devnum = udev_device_get_devnum(dev);
+
     const char *syspath = udev_device_get_syspath(dev);
     if (syspath) {
-      logger->debug("Syspath={}", syspath);
+      USBGUARD_LOG_DEBUG("Syspath={}", syspath);
       _syspath = syspath;
     } else {
       throw std::runtime_error("device wihtout syspath");
@@ -104,20 +198,54 @@ namespace usbguard {
 
     const char *sysname = udev_device_get_sysname(dev);
     if (sysname) {
-      logger->debug("Sysname={}", sysname);
+      USBGUARD_LOG_DEBUG("Sysname={}", sysname);
       setPort(sysname);
     } else {
       throw std::runtime_error("device wihtout sysname");
     }
 
     setTarget(Rule::Target::Unknown);
-    std::ifstream authstate_stream(_syspath + "/authorized", std::ifstream::binary);
 
-    if (!authstate_stream.good()) {
+    if (load) {
+      resolveParentID();
+      loadSysfsData();
+    }
+    USBGUARD_PROBE2(device_create_end, this, _syspath.c_str());
+    return;
+  }
+
+  void LinuxDevice::resolveParentID()
+  {
+    if (!_parent_syspath.empty()) {
+      auto& device_manager = static_cast<LinuxDeviceManager&>(manager());
+      setParentID(device_manager.getIDFromSysPath(_parent_syspath));
+    }
+    return;
+  }
+
+  /*
+   * Everything done here works only with the sysfs files of
+   * this device, so devices can be loaded concurrently.
+   */
+  void LinuxDevice::loadSysfsData()
+  {
+    /*
+     * All the attributes are read relative to the syspath directory,
+     * so that the path is resolved only once.
+     */
+    openSysPath();
+
+    if (_syspath_fd < 0) {
+      throw std::runtime_error("cannot open the syspath directory");
+    }
+
+    String authstate;
+
+    if (!readSysfsAttribute(_syspath_fd, "authorized", authstate)) {
       throw std::runtime_error("cannot read authorization state");
     }
     else {
-      switch(authstate_stream.get()) {
+      switch(authstate.empty() ? '\0' : authstate[0]) {
         case '1':
           setTarget(Rule::Target::Allow);
           break;
@@ -128,68 +256,127 @@ namespace usbguard {
           /* Block the device if we get an unexpected value */
           setTarget(Rule::Target::Block);
       }
-      logger->debug("Authstate={}", Rule::targetToString(getTarget()));
+      USBGUARD_LOG_DEBUG("Authstate={}", Rule::targetToString(getTarget()));
     }
 
-    std::ifstream descriptor_stream(_syspath + "/descriptors", std::ifstream::binary);
+    String value;
 
-    /* Find out the descriptor data stream size */
-    size_t descriptor_expected_size = 0;
-
-    if (!descriptor_stream.good()) {
-      throw std::runtime_error("Cannot load USB descriptors: failed to open the descriptor data stream");
+    if (readSysfsAttribute(_syspath_fd, "product", value)) {
+      USBGUARD_LOG_DEBUG("DeviceName={}", value);
+      setName(value);
+    }
+    if (readSysfsAttribute(_syspath_fd, "serial", value)) {
+      USBGUARD_LOG_DEBUG("Serial={}", value);
+      setSerial(value);
     }
-    else {
-      using namespace std::placeholders;
-      USBDescriptorParser parser;
 
-      auto load_device_descriptor = std::bind(&LinuxDevice::loadDeviceDescriptor, this, _1, _2);
-      auto load_configuration_descriptor = std::bind(&LinuxDevice::loadConfigurationDescriptor, this, _1, _2);
-      auto load_interface_descriptor = std::bind(&LinuxDevice::loadInterfaceDescriptor, this, _1, _2);
-      auto load_endpoint_descriptor = std::bind(&LinuxDevice::loadEndpointDescriptor, this, _1, _2);
+    /*
+     * A device which wasn't touched since the checkpoint was
+     * written gets its descriptor data, interface types and hash
+     * from the checkpoint instead of reading, parsing and hashing
+     * the descriptors again.
+     */
+    auto& device_manager = static_cast<LinuxDeviceManager&>(manager());
+    _identity = DeviceCheckpoint::getIdentity(_syspath, _devnum);
 
-      parser.setHandler(USB_DESCRIPTOR_TYPE_DEVICE, sizeof (USBDeviceDescriptor),
-                        USBParseDeviceDescriptor, load_device_descriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_CONFIGURATION, sizeof (USBConfigurationDescriptor),
-                        USBParseConfigurationDescriptor, load_configuration_descriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_INTERFACE, sizeof (USBInterfaceDescriptor),
-                        USBParseInterfaceDescriptor, load_interface_descriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof (USBEndpointDescriptor),
-                        USBParseEndpointDescriptor, load_endpoint_descriptor);
-      parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof (USBAudioEndpointDescriptor),
-                        USBParseAudioEndpointDescriptor, load_endpoint_descriptor);
+    if (device_manager.checkpointEnabled()) {
+      const DeviceCheckpoint::Entry * const entry = device_manager.findCheckpointEntry(_identity);
 
-      if ((descriptor_expected_size = parser.parse(descriptor_stream)) < sizeof(USBDeviceDescriptor)) {
-        throw std::runtime_error("Descriptor data parsing failed: parser processed less data than the size of a USB device descriptor");
+      if (entry != nullptr) {
+        restoreDescriptors(entry->descriptors, entry->interface_types, entry->hash);
+        USBGUARD_LOG_DEBUG("Restored the device from the checkpoint: DeviceHash={}", getHash());
+        return;
       }
     }
 
-    logger->debug("Expected descriptor data size is {} byte(s)", descriptor_expected_size);
+    /*
+     * Read the descriptor data once. Both the descriptor parser and
+     * the device hash work with the same buffer.
+     */
+    uint8_t descriptor_buffer[descriptor_buffer_size];
+    std::vector<uint8_t> descriptor_heap_buffer;
+    size_t descriptor_size = 0;
+
+    const uint8_t * const descriptor_data = \
+      readDescriptorData(_syspath_fd, "descriptors", descriptor_buffer, sizeof descriptor_buffer,
+                         descriptor_heap_buffer, descriptor_size);
 
     /*
-     * Reset descriptor stream before before computing
-     * the device hash.
-     *
-     * Because the eofbit is set, clear() has to be called
-     * before seekg().
+     * Walk the descriptors in place. This doesn't copy the
+     * descriptor data or allocate anything per descriptor.
      */
-    descriptor_stream.clear();
-    descriptor_stream.seekg(0);
+    size_t descriptor_expected_size = 0;
+    {
+      LatencyStatistics::Timer timer(LatencyStatistics::Stage::DescriptorParse);
+      descriptor_expected_size = loadDescriptors(descriptor_data, descriptor_size);
+    }
+    USBGUARD_PROBE2(descriptor_parse, _syspath.c_str(), descriptor_expected_size);
+
+    if (descriptor_expected_size < sizeof(USBDeviceDescriptor)) {
+      throw std::runtime_error("Descriptor data parsing failed: parser processed less data than the size of a USB device descriptor");
+    }
+
+    USBGUARD_LOG_DEBUG("Expected descriptor data size is {} byte(s)", descriptor_expected_size);
 
     /*
-     * Compute and set the device hash.
+     * Compute and set the device hash, unless nothing needs it
+     * right now.
      */
-    updateHash(descriptor_stream, descriptor_expected_size);
+    if (device_manager.DeviceHashRequired()) {
+      LatencyStatistics::Timer timer(LatencyStatistics::Stage::DeviceHash);
+      updateHash(descriptor_data, descriptor_expected_size);
+      USBGUARD_PROBE1(device_hash, _syspath.c_str());
+      USBGUARD_LOG_DEBUG("DeviceHash={}", getHash());
+    }
+    else {
+      deferHash();
+      USBGUARD_LOG_DEBUG("DeviceHash deferred");
+    }
+    USBGUARD_LOG_DEBUG("VendorID={} ProductID={}", getDeviceID().getVendorID(), getDeviceID().getProductID());
+    return;
+  }
+
+  /*
+   * Keep a reference to the syspath directory, so that loading the
+   * attributes and applying a target later only needs an openat()
+   * and a read() or write().
+   */
+  void LinuxDevice::openSysPath()
+  {
+    if (_syspath_fd >= 0) {
+      return;
+    }
 
-    logger->debug("DeviceHash={}", getHash());
+    _syspath_fd = ::open(_syspath.c_str(), O_PATH|O_DIRECTORY|O_CLOEXEC);
+
+    if (_syspath_fd < 0) {
+      USBGUARD_LOG_DEBUG("Cannot open the syspath directory: errno={}", errno);
+    }
     return;
   }
 
+  LinuxDevice::~LinuxDevice()
+  {
+    if (_syspath_fd >= 0) {
+      ::close(_syspath_fd);
+    }
+  }
+
   const String& LinuxDevice::getSysPath() const
   {
     return _syspath;
   }
 
+  int LinuxDevice::getSysPathFD() const
+  {
+    return _syspath_fd;
+  }
+
+  const DeviceCheckpoint::Identity& LinuxDevice::getIdentity() const
+  {
+    return _identity;
+  }
+
   bool LinuxDevice::isController() const
   {
     if (getPort().substr(0, 3) != "usb" || getInterfaceTypes().size() != 1) {
@@ -201,45 +388,234 @@ namespace usbguard {
     return hub_interface.appliesTo(getInterfaceTypes()[0]);
   }
 
+  size_t LinuxDevice::getMemoryUsage() const
+  {
+    return Device::getMemoryUsage() + sizeof(LinuxDevice) - sizeof(Device) +
+      stringHeapUsage(_syspath) + stringHeapUsage(_parent_syspath) + stringHeapUsage(_identity.syspath);
+  }
+
+  uint64_t LinuxDevice::getDevNum() const
+  {
+    return _devnum;
+  }
+
   /*
    * Manager
    */
+
+  /*
+   * A plug storm of a few hundred devices, with their interfaces,
+   * fits into the default buffer.
+   */
+  static const size_t default_event_buffer_size = 8 * 1024 * 1024;
+
   LinuxDeviceManager::LinuxDeviceManager(DeviceManagerHooks& hooks)
     : DeviceManager(hooks),
-      _thread(this, &LinuxDeviceManager::thread)
+      _thread(this, &LinuxDeviceManager::thread),
+      _sysio([this](const SysIORequest& request, int error) { sysioCompleted(request, error); }),
+      _interface_authorization(false)
   {
+    StartupProfile::Scope phase("device-manager-setup");
     setDefaultBlockedState(/*state=*/true);
+    _sysio.setStartHandler([this]() { ThreadStarted(); });
 
     if ((_event_fd = eventfd(0, 0)) < 0) {
       throw std::runtime_error("eventfd init error");
     }
+
+    if ((_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+      close(_event_fd);
+      throw std::runtime_error("epoll init error");
+    }
     
     if ((_udev = udev_new()) == nullptr) {
       throw std::runtime_error("udev init error");
     }
 
-    if ((_umon = udev_monitor_new_from_netlink(_udev, "udev")) == nullptr) {
+    _umon = nullptr;
+    _umon_buffer_size = default_event_buffer_size;
+    _umon_overflow = false;
+
+    try {
+      udevCreateMonitor("udev");
+    }
+    catch(...) {
       udev_unref(_udev);
+      throw;
+    }
+    return;
+  }
+
+  /*
+   * Replace the udev monitor with one receiving the events of the
+   * source: "udev" for the events processed by udevd, "kernel" for the
+   * uevents sent by the kernel.
+   */
+  void LinuxDeviceManager::udevCreateMonitor(const char *source)
+  {
+    struct udev_monitor *umon = udev_monitor_new_from_netlink(_udev, source);
+
+    if (umon == nullptr) {
       throw std::runtime_error("udev_monitor init error");
     }
 
-    udev_monitor_filter_add_match_subsystem_devtype(_umon, "usb", "usb_device");
+    udev_monitor_filter_add_match_subsystem_devtype(umon, "usb", "usb_device");
+
+    if (_umon_buffer_size > 0 &&
+        udev_monitor_set_receive_buffer_size(umon, (int)_umon_buffer_size) < 0) {
+      logger->warn("Cannot set the device event buffer size to {} bytes", _umon_buffer_size);
+    }
+
+    if (_umon != nullptr) {
+      udev_monitor_unref(_umon);
+    }
+    _umon = umon;
     return;
   }
 
   LinuxDeviceManager::~LinuxDeviceManager()
   {
     setDefaultBlockedState(/*state=*/false); // FIXME: Set to previous state
+    if (_interface_authorization) {
+      sysioSetInterfaceAuthorizedDefault(/*state=*/true);
+    }
     stop();
     udev_monitor_unref(_umon);
     udev_unref(_udev);
+    close(_epoll_fd);
     close(_event_fd);
     return;
   }
 
   void LinuxDeviceManager::setDefaultBlockedState(bool state)
   {
-    sysioSetAuthorizedDefault(!state);
+    if (!state || _controller_authorized_default.empty()) {
+      sysioSetAuthorizedDefault(!state);
+      std::unique_lock<std::mutex> lock(_authorized_default_mutex);
+      _bus_authorized_default.clear();
+      return;
+    }
+
+    std::map<std::string, int> controller_values;
+
+    for (auto const& entry : _controller_authorized_default) {
+      controller_values[entry.first] =
+        (entry.second == AuthorizedDefault::All ? 1 : entry.second == AuthorizedDefault::Internal ? 2 : 0);
+    }
+
+    const auto results = sysioSetAuthorizedDefault(/*value=*/0, controller_values);
+    std::map<uint32_t, AuthorizedDefault> bus_authorized_default;
+    std::set<String> matched;
+
+    for (auto const& entry : results) {
+      const SysIOAuthorizedDefault& result = entry.second;
+
+      if (!result.controller.empty()) {
+        matched.insert(result.controller);
+      }
+      if (result.written != result.requested) {
+        logger->warn("Cannot set the default authorization of the USB controller usb{} to {}, blocking its new devices",
+                     entry.first, result.requested == 2 ? "internal" : "all");
+      }
+      switch(result.written) {
+        case 1:
+          bus_authorized_default[entry.first] = AuthorizedDefault::All;
+          break;
+        case 2:
+          bus_authorized_default[entry.first] = AuthorizedDefault::Internal;
+          break;
+        default:
+          break;
+      }
+    }
+
+    for (auto const& entry : _controller_authorized_default) {
+      if (matched.count(entry.first) == 0) {
+        logger->warn("No USB controller named {} found", entry.first);
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(_authorized_default_mutex);
+    _bus_authorized_default = std::move(bus_authorized_default);
+    return;
+  }
+
+  void LinuxDeviceManager::setControllerAuthorizedDefault(const std::map<String, AuthorizedDefault>& controllers)
+  {
+    _controller_authorized_default = controllers;
+    setDefaultBlockedState(/*state=*/true);
+    return;
+  }
+
+  /*
+   * The bus number is the part of the port name before the dash,
+   * e.g. 3 for 3-1.2. Controllers (usbN) are never authorized by
+   * default.
+   */
+  DeviceManager::AuthorizedDefault LinuxDeviceManager::getAuthorizedDefault(const Device& device) const
+  {
+    const String& port = device.getPort();
+    const size_t dash = port.find('-');
+
+    if (dash == String::npos || dash == 0) {
+      return AuthorizedDefault::None;
+    }
+
+    char *end = nullptr;
+    const unsigned long bus = strtoul(port.c_str(), &end, 10);
+
+    if (end != port.c_str() + dash) {
+      return AuthorizedDefault::None;
+    }
+
+    std::unique_lock<std::mutex> lock(_authorized_default_mutex);
+    auto it = _bus_authorized_default.find(static_cast<uint32_t>(bus));
+    return it != _bus_authorized_default.end() ? it->second : AuthorizedDefault::None;
+  }
+
+  void LinuxDeviceManager::setInterfaceAuthorization(bool enabled)
+  {
+    sysioSetInterfaceAuthorizedDefault(!enabled);
+    _interface_authorization = enabled;
+    return;
+  }
+
+  /*
+   * The kernel uevents don't wait for the udev rules, so a device is
+   * authorized without the udevd processing latency. The device data
+   * is read from sysfs either way, so nothing else depends on the
+   * source of the events.
+   */
+  void LinuxDeviceManager::setKernelEventSource(bool enabled)
+  {
+    if (_thread.running()) {
+      throw std::runtime_error("DeviceManager thread is running, cannot change the event source");
+    }
+
+    udevCreateMonitor(enabled ? "kernel" : "udev");
+    return;
+  }
+
+  void LinuxDeviceManager::setEventBufferSize(size_t size)
+  {
+    if (_thread.running()) {
+      throw std::runtime_error("DeviceManager thread is running, cannot change the event buffer size");
+    }
+    if (size > (size_t)std::numeric_limits<int>::max()) {
+      throw std::runtime_error("Device event buffer size is too large");
+    }
+
+    _umon_buffer_size = size;
+
+    if (udev_monitor_set_receive_buffer_size(_umon, (int)_umon_buffer_size) < 0) {
+      logger->warn("Cannot set the device event buffer size to {} bytes", _umon_buffer_size);
+    }
+    return;
+  }
+
+  void LinuxDeviceManager::setCheckpointFile(const String& path)
+  {
+    _checkpoint_path = path;
     return;
   }
 
@@ -248,12 +624,14 @@ namespace usbguard {
     // enumerate devices
     // broadcast present devices
     // start monitor thread
+    _sysio.start();
     _thread.start();
     return;
   }
 
   void LinuxDeviceManager::stop()
   {
+    const bool was_running = _thread.running();
     // stop monitor
     _thread.stop(/*do_wait=*/false);
     { /* Wakeup the device manager thread */
@@ -261,6 +639,78 @@ namespace usbguard {
       write(_event_fd, &one, sizeof one);
     }
     _thread.wait();
+    /* Targets applied from now on are written synchronously */
+    _sysio.stop();
+
+    if (was_running && checkpointEnabled()) {
+      saveCheckpoint();
+    }
+    return;
+  }
+
+  bool LinuxDeviceManager::checkpointEnabled() const
+  {
+    return !_checkpoint_path.empty();
+  }
+
+  const DeviceCheckpoint::Entry *LinuxDeviceManager::findCheckpointEntry(const DeviceCheckpoint::Identity& identity) const
+  {
+    auto it = _checkpoint.find(identity.syspath);
+
+    if (it == _checkpoint.end() || !(it->second.identity == identity)) {
+      return nullptr;
+    }
+
+    return &it->second;
+  }
+
+  void LinuxDeviceManager::loadCheckpoint()
+  {
+    std::vector<DeviceCheckpoint::Entry> entries;
+
+    if (!DeviceCheckpoint::load(_checkpoint_path, DeviceCheckpoint::currentContext(), entries)) {
+      return;
+    }
+
+    for (auto& entry : entries) {
+      const String syspath = entry.identity.syspath;
+      _checkpoint.emplace(syspath, std::move(entry));
+    }
+
+    USBGUARD_LOG_DEBUG("Loaded {} devices from the checkpoint {}", _checkpoint.size(), _checkpoint_path);
+    return;
+  }
+
+  /*
+   * Called after the device manager thread stopped, so the
+   * devices don't change while they are visited.
+   */
+  void LinuxDeviceManager::saveCheckpoint()
+  {
+    std::vector<DeviceCheckpoint::Entry> entries;
+
+    forEachDevice([&entries](const Pointer<Device>& device) {
+      const auto linux_device = std::static_pointer_cast<LinuxDevice>(device);
+
+      if (linux_device->getIdentity().syspath.empty()) {
+        return;
+      }
+
+      DeviceCheckpoint::Entry entry;
+      entry.identity = linux_device->getIdentity();
+      entry.hash = device->getHash();
+      entry.descriptors = device->getDescriptorData();
+      entry.interface_types = device->getInterfaceTypes();
+      entries.push_back(std::move(entry));
+    });
+
+    try {
+      DeviceCheckpoint::save(_checkpoint_path, DeviceCheckpoint::currentContext(), entries);
+      USBGUARD_LOG_DEBUG("Stored {} devices into the checkpoint {}", entries.size(), _checkpoint_path);
+    }
+    catch(const std::exception& ex) {
+      logger->warn("Cannot store the device checkpoint {}: {}", _checkpoint_path, ex.what());
+    }
     return;
   }
 
@@ -301,23 +751,111 @@ namespace usbguard {
     return device;
   }
 
+  Pointer<Device> LinuxDeviceManager::allowDeviceInterfaces(uint32_t id, const std::vector<USBInterfaceType>& interface_types)
+  {
+    if (!_interface_authorization) {
+      throw std::runtime_error("Interface authorization isn't enabled");
+    }
+
+    Pointer<LinuxDevice> device = std::static_pointer_cast<LinuxDevice>(getDevice(id));
+    {
+      std::unique_lock<std::mutex> device_lock(device->refDeviceMutex());
+      const int error = sysioApplyInterfaces(*device, &interface_types);
+
+      if (error != 0) {
+        throw std::runtime_error(std::string("Cannot apply the target: ") + strerror(error));
+      }
+
+      device->setTarget(Rule::Target::Allow);
+    }
+    DeviceAllowed(device);
+    return device;
+  }
+
+  std::vector<DeviceManager::TargetResult> \
+  LinuxDeviceManager::applyDeviceTargets(const std::vector<std::pair<uint32_t, Rule::Target>>& targets)
+  {
+    std::vector<TargetResult> results;
+    results.reserve(targets.size());
+
+    /* Let the queued writes complete first, they were applied earlier */
+    _sysio.flush();
+
+    for (auto const& id_target : targets) {
+      TargetResult result;
+
+      result.id = id_target.first;
+      result.target = id_target.second;
+
+      try {
+        Pointer<LinuxDevice> device = std::static_pointer_cast<LinuxDevice>(getDevice(result.id));
+        {
+          std::unique_lock<std::mutex> device_lock(device->refDeviceMutex());
+          const int error = \
+            (result.target == Rule::Target::Allow && _interface_authorization) ?
+              sysioApplyInterfaces(*device, nullptr) : sysioApplyTarget(*device, result.target);
+
+          if (error != 0) {
+            throw std::runtime_error(std::string("Cannot apply the target: ") + strerror(error));
+          }
+
+          device->setTarget(result.target);
+        }
+
+        switch(result.target) {
+          case Rule::Target::Allow:
+            DeviceAllowed(device);
+            break;
+          case Rule::Target::Block:
+            DeviceBlocked(device);
+            break;
+          default:
+            DeviceRejected(device);
+        }
+
+        result.device = device;
+      }
+      catch(const std::exception& ex) {
+        result.error = ex.what();
+      }
+
+      results.push_back(std::move(result));
+    }
+
+    return results;
+  }
+
   Pointer<Device> LinuxDeviceManager::applyDevicePolicy(uint32_t id, Rule::Target target)
   {
     //log->debug("Applying device policy {} to device {}", target, id);
     Pointer<LinuxDevice> device = std::static_pointer_cast<LinuxDevice>(getDevice(id));
     std::unique_lock<std::mutex> device_lock(device->refDeviceMutex());
 
-    sysioApplyTarget(device->getSysPath(), target);
+    if (target == Rule::Target::Allow && _interface_authorization) {
+      const int error = sysioApplyInterfaces(*device, nullptr);
+
+      if (error != 0) {
+        logger->warn("Cannot apply target {} to {}: {}", Rule::targetToString(target),
+                     device->getSysPath(), strerror(error));
+      }
+      DeviceTargetApplied(id, target, error);
+    }
+    else if (!sysioSubmitTarget(*device, target)) {
+      const int error = sysioApplyTarget(*device, target);
+
+      if (error != 0) {
+        logger->warn("Cannot apply target {} to {}: {}", Rule::targetToString(target),
+                     device->getSysPath(), strerror(error));
+      }
+      DeviceTargetApplied(id, target, error);
+    }
     device->setTarget(target);
 
-    return std::move(device);
+    return device;
   }
 
-  void LinuxDeviceManager::sysioApplyTarget(const String& sys_path, Rule::Target target)
+  static void sysioTargetFile(Rule::Target target, const char *& target_file, int& target_value)
   {
-    const char *target_file = nullptr;
-    int target_value = 0;
-
     switch (target)
       {
       case Rule::Target::Allow:
@@ -336,6 +874,15 @@ namespace usbguard {
 	//log->critical("BUG: unknown rule target");
 	throw std::runtime_error("Unknown rule target in applyDevicePolicy");
       }
+    return;
+  }
+
+  void LinuxDeviceManager::sysioApplyTarget(const String& sys_path, Rule::Target target)
+  {
+    const char *target_file = nullptr;
+    int target_value = 0;
+
+    sysioTargetFile(target, target_file, target_value);
 
     char sysio_path[SYSIO_PATH_MAX];
     snprintf(sysio_path, SYSIO_PATH_MAX, "%s/%s", sys_path.c_str(), target_file);
@@ -345,80 +892,592 @@ namespace usbguard {
     return;
   }
 
+  int LinuxDeviceManager::sysioApplyTarget(const LinuxDevice& device, Rule::Target target)
+  {
+    LatencyStatistics::Timer timer(LatencyStatistics::Stage::SysfsApply);
+    USBGUARD_PROBE2(sysfs_apply, device.getSysPath().c_str(), static_cast<int>(target));
+
+    if (device.getSysPathFD() < 0) {
+      sysioApplyTarget(device.getSysPath(), target);
+      return 0;
+    }
+
+    const char *target_file = nullptr;
+    int target_value = 0;
+
+    sysioTargetFile(target, target_file, target_value);
+
+    return sysioWriteValueAt(device.getSysPathFD(), target_file, target_value);
+  }
+
+  /*
+   * Queue the sysfs write of the target. Returns false if the write
+   * has to be done synchronously, because the worker isn't running.
+   */
+  bool LinuxDeviceManager::sysioSubmitTarget(const LinuxDevice& device, Rule::Target target)
+  {
+    const char *target_file = nullptr;
+    int target_value = 0;
+
+    sysioTargetFile(target, target_file, target_value);
+
+    const String path = device.getSysPath() + "/" + target_file;
+    return _sysio.submit(SYSIO_REQUEST_WRITE, path, target_value, device.getID()) != 0;
+  }
+
+  /*
+   * Read the type of the interface in the dirfp/relpath directory.
+   */
+  static bool sysioReadInterfaceType(DIR *dirfp, const String& relpath, USBInterfaceType& type)
+  {
+    const char * const files[] = { "/bInterfaceClass", "/bInterfaceSubClass", "/bInterfaceProtocol" };
+    uint8_t values[3];
+
+    for (size_t i = 0; i < 3; ++i) {
+      char buffer[3] = { 0, 0, 0 };
+
+      if (sysioReadFileAt(dirfp, relpath + files[i], buffer, 2) != 2) {
+        return false;
+      }
+
+      char *end = nullptr;
+      values[i] = (uint8_t)strtoul(buffer, &end, 16);
+
+      if (end != buffer + 2) {
+        return false;
+      }
+    }
+
+    type = USBInterfaceType(values[0], values[1], values[2]);
+    return true;
+  }
+
+  /*
+   * Authorize the device and then its interfaces: all of them if
+   * interface_types is nullptr, otherwise only the interfaces of the
+   * given types. An interface whose type can't be read stays
+   * unauthorized. The device is authorized synchronously, because
+   * the kernel creates the interfaces only when the device gets
+   * configured, and the interface writes are then queued as one
+   * batch. Returns 0 or the errno value of the device write.
+   */
+  int LinuxDeviceManager::sysioApplyInterfaces(const LinuxDevice& device, const std::vector<USBInterfaceType> *interface_types)
+  {
+    /* Don't let a queued write to the device overtake this one */
+    _sysio.flush();
+
+    const int error = sysioApplyTarget(device, Rule::Target::Allow);
+
+    if (error != 0) {
+      return error;
+    }
+
+    const String& syspath = device.getSysPath();
+    const String prefix = syspath.substr(syspath.rfind('/') + 1) + ":";
+    DIR *dirfp = opendir(syspath.c_str());
+
+    if (dirfp == nullptr) {
+      return errno;
+    }
+
+    std::vector<std::pair<String, int>> writes;
+
+    for (struct dirent *dent = readdir(dirfp); dent != nullptr; dent = readdir(dirfp)) {
+      const String name(dent->d_name);
+
+      if (name.compare(0, prefix.size(), prefix) != 0) {
+        continue;
+      }
+
+      int authorized = 1;
+
+      if (interface_types != nullptr) {
+        USBInterfaceType type;
+        authorized = 0;
+
+        if (sysioReadInterfaceType(dirfp, name, type)) {
+          for (auto const& interface_type : *interface_types) {
+            if (interface_type.appliesTo(type)) {
+              authorized = 1;
+              break;
+            }
+          }
+        }
+      }
+
+      writes.emplace_back(syspath + "/" + name + "/authorized", authorized);
+    }
+
+    closedir(dirfp);
+
+    for (auto const& write : writes) {
+      if (_sysio.submit(SYSIO_REQUEST_WRITE, write.first, write.second, device.getID()) == 0) {
+        sysioWrite(write.first.c_str(), write.second);
+      }
+    }
+
+    return 0;
+  }
+
+  /*
+   * Called from the sysfs I/O worker thread.
+   */
+  void LinuxDeviceManager::sysioCompleted(const SysIORequest& request, int error)
+  {
+    const char *file = strrchr(request.path, '/');
+    Rule::Target target = Rule::Target::Reject;
+
+    if (file != nullptr && strcmp(file + 1, "authorized") == 0) {
+      target = (request.value != 0 ? Rule::Target::Allow : Rule::Target::Block);
+    }
+    if (error != 0) {
+      logger->warn("Cannot apply target {} to {}: {}", Rule::targetToString(target),
+                   request.path, strerror(error));
+    }
+    DeviceTargetApplied(request.id, target, error);
+    return;
+  }
+
+  /*
+   * Maximum number of udev events processed in one wakeup of the
+   * device manager thread. Pending events that didn't fit are
+   * processed in the next iteration, after other event sources had
+   * a chance to run.
+   */
+  static const size_t udev_event_budget = 256;
+
+  /*
+   * How long to wait for more removal events after a removal
+   * event, so that the devices unplugged together with a hub
+   * are removed in one batch.
+   */
+  static const std::chrono::milliseconds udev_removal_window(20);
+
+  /*
+   * The number of the USB bus of a device, taken from its sysfs name:
+   * "usbN" for a root hub, "N-port[.port...]" for the other devices.
+   * Returns 0 for names of another form.
+   */
+  static uint32_t udevEventBus(const char *sysname)
+  {
+    if (sysname == nullptr) {
+      return 0;
+    }
+    if (strncmp(sysname, "usb", 3) == 0) {
+      sysname += 3;
+    }
+
+    uint32_t bus = 0;
+
+    for (; *sysname >= '0' && *sysname <= '9'; ++sysname) {
+      bus = bus * 10 + (*sysname - '0');
+    }
+
+    return bus;
+  }
+
+  void LinuxDeviceManager::addEventSource(int fd, std::function<void()> handler)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_event_sources_mutex);
+      _event_sources[fd] = std::move(handler);
+    }
+
+    struct epoll_event event = { };
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      std::unique_lock<std::mutex> lock(_event_sources_mutex);
+      _event_sources.erase(fd);
+      throw std::runtime_error("Cannot add an event source to the device manager event loop");
+    }
+    return;
+  }
+
+  void LinuxDeviceManager::removeEventSource(int fd)
+  {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    std::unique_lock<std::mutex> lock(_event_sources_mutex);
+    _event_sources.erase(fd);
+    return;
+  }
+
+  void LinuxDeviceManager::processEventSource(int fd)
+  {
+    std::function<void()> handler;
+    {
+      std::unique_lock<std::mutex> lock(_event_sources_mutex);
+      auto it = _event_sources.find(fd);
+      if (it == _event_sources.end()) {
+        return;
+      }
+      handler = it->second;
+    }
+
+    try {
+      handler();
+    }
+    catch(const std::exception& ex) {
+      logger->error("Exception caught in an event source handler: {}", ex.what());
+    }
+    return;
+  }
+
   void LinuxDeviceManager::thread()
   {
     //log->debug("Entering LinuxDeviceManager thread");
+    ThreadStarted();
 
     const int umon_fd = udev_monitor_get_fd(_umon);
-    const int max_fd = umon_fd > _event_fd ? umon_fd : _event_fd;
-    fd_set readset;
+
+    for (const int fd : { umon_fd, _event_fd }) {
+      struct epoll_event event = { };
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+
+      if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0 && errno != EEXIST) {
+        logger->error("Cannot initialize the device manager event loop: errno={}", errno);
+        return;
+      }
+    }
 
     udev_monitor_enable_receiving(_umon);
     udevEnumerateDevices(); /* scan() without thread state check */
 
     while (!_thread.stopRequested()) {
-      struct timeval tv_timeout = { 5, 0 };
-      
-      FD_ZERO(&readset);
-      FD_SET(umon_fd, &readset);
-      FD_SET(_event_fd, &readset);
-      
-      switch (select(max_fd + 1, &readset, NULL, NULL, &tv_timeout)) {
-      case 1: /* Device or event */
-      case 2: /* Device and event */
-	if (FD_ISSET(_event_fd, &readset)) {
-	  //log->debug("Wakeup event received");
-	  continue;
-	}
-	if (FD_ISSET(umon_fd, &readset)) {
-	  //log->debug("Handling UDev read event");
-	  udevReceiveDevice();
-	}
-	break;
-      case 0: /* Timeout */
-	continue;
-      case -1: /* Error */
-      default:
-	//log->debug("Select failure: {}", errno);
-	_thread.stop();
+      struct epoll_event events[16];
+      const int event_count = epoll_wait(_epoll_fd, events, 16, 5 * 1000);
+
+      if (event_count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        //log->debug("epoll_wait failure: {}", errno);
+        _thread.stop(/*do_wait=*/false);
+        break;
+      }
+
+      for (int i = 0; i < event_count; ++i) {
+        const int fd = events[i].data.fd;
+
+        if (fd == _event_fd) {
+          //log->debug("Wakeup event received");
+          uint64_t value = 0;
+          if (read(_event_fd, &value, sizeof value) < 0) {
+            /* Nothing to do, the wakeup only interrupts epoll_wait */
+          }
+        }
+        else if (fd == umon_fd) {
+          //log->debug("Handling UDev read event");
+          udevReceiveDevices(udev_event_budget);
+        }
+        else {
+          processEventSource(fd);
+        }
       }
     } /* Thread main loop */
+
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, umon_fd, nullptr);
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _event_fd, nullptr);
     //log->debug("Returning from LinuxDeviceManager thread");
     return;
   }
 
-  void LinuxDeviceManager::udevReceiveDevice()
+  void LinuxDeviceManager::udevReceiveDevices(const size_t budget)
   {
-    struct udev_device *dev = udev_monitor_receive_device(_umon);
+    /*
+     * Drain the pending events first. An "add" event followed by a
+     * "remove" event for the same syspath describes a device which is
+     * already gone, so both events are dropped without constructing
+     * the device.
+     */
+    std::vector<struct udev_device *> events;
+    std::unordered_map<std::string, size_t> pending_insertions;
+    bool removal_pending = false;
+    std::chrono::steady_clock::time_point removal_deadline;
+
+    while (events.size() < budget) {
+      const auto receive_started = std::chrono::steady_clock::now();
+      errno = 0;
+      struct udev_device *dev = udev_monitor_receive_device(_umon);
+
+      if (!dev) {
+        if (errno == ENOBUFS) {
+          _umon_overflow = true;
+          break;
+        }
+        /*
+         * The last event was a removal. Wait a moment for the
+         * removals of the devices behind it, e.g. the rest of an
+         * unplugged hub.
+         */
+        const auto remaining = removal_deadline - std::chrono::steady_clock::now();
+
+        if (!removal_pending || remaining <= std::chrono::steady_clock::duration::zero()) {
+          break;
+        }
 
-    if (!dev) {
-      return;
+        struct pollfd umon_pollfd = { udev_monitor_get_fd(_umon), POLLIN, 0 };
+        const int timeout_ms = \
+          std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+
+        if (poll(&umon_pollfd, 1, timeout_ms) <= 0) {
+          break;
+        }
+        continue;
+      }
+
+      LatencyStatistics::record(LatencyStatistics::Stage::UdevReceive,
+                                std::chrono::steady_clock::now() - receive_started);
+
+      const char *action_cstr = udev_device_get_action(dev);
+      const char *syspath_cstr = udev_device_get_syspath(dev);
+
+      if (!action_cstr || !syspath_cstr) {
+        //log->warn("BUG? Device event witout action value.");
+        udev_device_unref(dev);
+        continue;
+      }
+
+      USBGUARD_PROBE2(udev_receive, action_cstr, syspath_cstr);
+
+      const bool removal = strcmp(action_cstr, "remove") == 0;
+
+      if (removal && !removal_pending) {
+        removal_deadline = std::chrono::steady_clock::now() + udev_removal_window;
+      }
+      removal_pending = removal;
+
+      if (strcmp(action_cstr, "add") == 0) {
+        /*
+         * Don't coalesce anything for a syspath with repeated "add"
+         * events, let the insertion code deal with them.
+         */
+        if (!pending_insertions.emplace(syspath_cstr, events.size()).second) {
+          pending_insertions.erase(syspath_cstr);
+        }
+      }
+      else if (removal) {
+        auto it = pending_insertions.find(syspath_cstr);
+        if (it != pending_insertions.end()) {
+          USBGUARD_LOG_DEBUG("Ignoring a device added and removed in one batch: {}", syspath_cstr);
+          udev_device_unref(events[it->second]);
+          events[it->second] = nullptr;
+          pending_insertions.erase(it);
+          udev_device_unref(dev);
+          continue;
+        }
+      }
+
+      events.push_back(dev);
+    }
+
+    /*
+     * Events of independent USB buses don't have to be ordered
+     * relative to each other. Every bus gets its own partition in
+     * which the order of the events is kept, and the partitions are
+     * processed concurrently.
+     */
+    std::vector<std::vector<struct udev_device *>> partitions;
+    std::unordered_map<uint32_t, size_t> partition_index;
+
+    for (struct udev_device *dev : events) {
+      if (dev == nullptr) {
+        continue;
+      }
+
+      const uint32_t bus = udevEventBus(udev_device_get_sysname(dev));
+      auto it = partition_index.emplace(bus, partitions.size()).first;
+
+      if (it->second == partitions.size()) {
+        partitions.emplace_back();
+      }
+      partitions[it->second].push_back(dev);
+    }
+
+    if (partitions.size() == 1) {
+      processDeviceEvents(partitions.front());
+    }
+    else if (partitions.size() > 1) {
+      USBGUARD_LOG_DEBUG("Processing device events of {} USB buses concurrently", partitions.size());
+      ThreadPool::shared().parallelFor(partitions.size(), [this, &partitions](size_t i) {
+        processDeviceEvents(partitions[i]);
+      });
+    }
+
+    if (_umon_overflow) {
+      _umon_overflow = false;
+      udevResync();
     }
 
-    const char *action_cstr = udev_device_get_action(dev);
+    return;
+  }
+
+  /*
+   * Process the events of one partition (see udevReceiveDevices) in
+   * order and release them. May run concurrently with the processing
+   * of other partitions.
+   */
+  void LinuxDeviceManager::processDeviceEvents(const std::vector<struct udev_device *>& events)
+  {
+    /* Consecutive removals are processed as one batch */
+    std::vector<String> removed_syspaths;
+
+    for (struct udev_device *dev : events) {
+      const char *action_cstr = udev_device_get_action(dev);
+
+      if (strcmp(action_cstr, "remove") == 0) {
+        removed_syspaths.emplace_back(udev_device_get_syspath(dev));
+        udev_device_unref(dev);
+        continue;
+      }
+
+      if (!removed_syspaths.empty()) {
+        processDeviceRemovals(removed_syspaths);
+        removed_syspaths.clear();
+      }
+
+      if (strcmp(action_cstr, "add") == 0) {
+        processDeviceInsertion(dev);
+      }
+      else {
+        //log->warn("BUG? Unknown device action value \"{}\"", action_cstr);
+      }
 
-    if (!action_cstr) {
-      //log->warn("BUG? Device event witout action value.");
       udev_device_unref(dev);
+    }
+
+    if (!removed_syspaths.empty()) {
+      processDeviceRemovals(removed_syspaths);
+    }
+    return;
+  }
+
+  /*
+   * Read the device number from the `dev' attribute (MAJOR:MINOR).
+   */
+  static bool sysfsReadDevNum(const String& syspath, uint64_t& devnum)
+  {
+    std::ifstream stream(syspath + "/dev");
+    unsigned int major_number = 0;
+    unsigned int minor_number = 0;
+    char separator = 0;
+
+    if (!(stream >> major_number >> separator >> minor_number) || separator != ':') {
+      return false;
+    }
+
+    devnum = makedev(major_number, minor_number);
+    return true;
+  }
+
+  /*
+   * Bring the device map up to date after device events were lost.
+   * Only the differences between the map and the USB devices in sysfs
+   * are processed: devices which are gone or were replaced by another
+   * device at the same syspath (a different device number) are
+   * removed, devices which are new are inserted. The other devices
+   * aren't touched.
+   */
+  void LinuxDeviceManager::udevResync()
+  {
+    logger->warn("Device events were lost, the device event buffer overflowed. Resynchronizing with sysfs.");
+
+    std::unordered_map<String, uint64_t> known_devices;
+
+    forEachDevice([&known_devices](const Pointer<Device>& device) {
+      auto linux_device = std::static_pointer_cast<LinuxDevice>(device);
+      known_devices.emplace(linux_device->getSysPath(), linux_device->getDevNum());
+    });
+
+    const char * const dir = "/sys/bus/usb/devices/";
+    DIR *dirfp = opendir(dir);
+
+    if (dirfp == nullptr) {
+      logger->error("Cannot resynchronize the devices, cannot open {}: {}", dir, strerror(errno));
       return;
     }
 
-    if (strcmp(action_cstr, "add") == 0) {
-      processDeviceInsertion(dev);
+    std::vector<String> inserted_syspaths;
+
+    for (struct dirent *dent = readdir(dirfp); dent != nullptr; dent = readdir(dirfp)) {
+      /* Skip the interfaces and the dot entries */
+      if (dent->d_name[0] == '.' || strchr(dent->d_name, ':') != nullptr) {
+        continue;
+      }
+
+      char syspath_buffer[PATH_MAX];
+
+      if (realpath((String(dir) + dent->d_name).c_str(), syspath_buffer) == nullptr) {
+        continue;
+      }
+
+      const String syspath(syspath_buffer);
+      uint64_t devnum = 0;
+
+      if (!sysfsReadDevNum(syspath, devnum)) {
+        continue;
+      }
+
+      auto it = known_devices.find(syspath);
+
+      if (it != known_devices.end() && it->second == devnum) {
+        known_devices.erase(it);
+        continue;
+      }
+
+      inserted_syspaths.push_back(syspath);
     }
-    else if (strcmp(action_cstr, "remove") == 0) {
-      processDeviceRemoval(dev);
+
+    closedir(dirfp);
+
+    /* What's left wasn't found in sysfs or was replaced */
+    for (auto const& known_device : known_devices) {
+      try {
+        Pointer<Device> device = removeDevice(known_device.first);
+        DeviceRemoved(device);
+      }
+      catch(...) {
+        continue;
+      }
     }
-    else {
-      //log->warn("BUG? Unknown device action value \"{}\"", action_cstr);
+
+    /* Parents before their children, see udevEnumerateDevices() */
+    std::sort(inserted_syspaths.begin(), inserted_syspaths.end(),
+              [](const String& a, const String& b) { return a.size() < b.size(); });
+
+    for (auto const& syspath : inserted_syspaths) {
+      struct udev_device *dev = udev_device_new_from_syspath(_udev, syspath.c_str());
+
+      if (dev == nullptr) {
+        continue;
+      }
+
+      const char *devtype = udev_device_get_devtype(dev);
+
+      if (devtype != nullptr && strcmp(devtype, "usb_device") == 0) {
+        processDeviceInsertion(dev);
+      }
+
+      udev_device_unref(dev);
     }
 
-    udev_device_unref(dev);
+    USBGUARD_LOG_DEBUG("Resynchronized: {} devices removed, {} devices inserted",
+                       known_devices.size(), inserted_syspaths.size());
     return;
   }
 
+  /*
+   * Enumerations with fewer devices than this are loaded in the
+   * calling thread.
+   */
+  static const size_t parallel_load_min_devices = 8;
+
   void LinuxDeviceManager::udevEnumerateDevices()
   {
+    StartupProfile::Scope phase("enumerate-devices");
+    const auto enumeration_started = std::chrono::steady_clock::now();
     struct udev_enumerate *enumerate = udev_enumerate_new(_udev);
 
     if (enumerate == nullptr) {
@@ -432,6 +1491,13 @@ namespace usbguard {
     struct udev_list_entry *devices = udev_enumerate_get_list_entry(enumerate);
     struct udev_list_entry *dlentry = nullptr;
 
+    /*
+     * Stage one: collect the present devices and the attributes
+     * provided by udev. libudev objects are used only in this thread.
+     */
+    PointerVector<LinuxDevice> present_devices;
+    std::vector<std::chrono::steady_clock::duration> load_times;
+
     udev_list_entry_foreach(dlentry, devices) {
       const char *syspath = udev_list_entry_get_name(dlentry);
 
@@ -456,30 +1522,122 @@ namespace usbguard {
       }
 
       if (strcmp(devtype, "usb_device") == 0) {
-	processDevicePresence(device);
+        try {
+          const auto device_started = std::chrono::steady_clock::now();
+          present_devices.push_back(makePointer<LinuxDevice>(*this, device, /*load=*/false));
+          load_times.push_back(std::chrono::steady_clock::now() - device_started);
+        }
+        catch(const std::exception& ex) {
+          logger->error("Exception caught during device presence processing: {}: {}", syspath, ex.what());
+        }
+        catch(...) {
+          logger->error("Unknown exception while processing device: {}", syspath);
+        }
       }
 
       udev_device_unref(device);
     }
 
     udev_enumerate_unref(enumerate);
+    StartupProfile::recordPhase("udev-enumerate", enumeration_started, std::chrono::steady_clock::now());
+
+    if (checkpointEnabled()) {
+      loadCheckpoint();
+    }
+
+    /*
+     * Stage two: read the sysfs data, parse the descriptors and
+     * compute the hashes of the devices concurrently. Devices
+     * found in the checkpoint skip the descriptor processing.
+     */
+    std::vector<std::exception_ptr> load_errors(present_devices.size());
+
+    auto device_loader = [&present_devices, &load_errors, &load_times](size_t i) {
+      const auto load_started = std::chrono::steady_clock::now();
+      try {
+        present_devices[i]->loadSysfsData();
+      }
+      catch(...) {
+        load_errors[i] = std::current_exception();
+      }
+      load_times[i] += std::chrono::steady_clock::now() - load_started;
+    };
+    const auto loading_started = std::chrono::steady_clock::now();
+
+    if (present_devices.size() < parallel_load_min_devices) {
+      for (size_t i = 0; i < present_devices.size(); ++i) {
+        device_loader(i);
+      }
+    }
+    else {
+      ThreadPool::shared().parallelFor(present_devices.size(), device_loader);
+    }
+
+    _checkpoint.clear();
+    StartupProfile::recordPhase("load-devices", loading_started, std::chrono::steady_clock::now());
+
+    /*
+     * Stage three: insert the devices with parents before their
+     * children, so that the parent ids can be resolved. A parent
+     * syspath is always a prefix of the child syspath.
+     */
+    std::vector<size_t> insertion_order(present_devices.size());
+
+    for (size_t i = 0; i < insertion_order.size(); ++i) {
+      insertion_order[i] = i;
+    }
+
+    std::stable_sort(insertion_order.begin(), insertion_order.end(),
+                     [&present_devices](size_t a, size_t b) {
+                       return present_devices[a]->getSysPath().size() < present_devices[b]->getSysPath().size();
+                     });
+
+    PointerVector<Device> inserted_devices;
+    inserted_devices.reserve(present_devices.size());
+
+    for (const size_t i : insertion_order) {
+      if (load_errors[i]) {
+        try {
+          std::rethrow_exception(load_errors[i]);
+        }
+        catch(const std::exception& ex) {
+          logger->error("Exception caught during device presence processing: {}: {}",
+                        present_devices[i]->getSysPath(), ex.what());
+        }
+        catch(...) {
+          logger->error("Unknown exception while processing device: {}", present_devices[i]->getSysPath());
+        }
+        continue;
+      }
+      if (processDevicePresence(present_devices[i])) {
+        inserted_devices.push_back(present_devices[i]);
+        StartupProfile::recordDeviceLoad(present_devices[i]->getID(), load_times[i]);
+      }
+    }
+
+    /*
+     * Stage four: hand all the present devices over at once, so
+     * that the decisions can be made and applied as a batch. The
+     * call is made even if no device was found, because it also
+     * tells the hooks that the enumeration is complete.
+     */
+    DevicesPresent(inserted_devices);
+
     return;
   }
 
-  void LinuxDeviceManager::processDevicePresence(struct udev_device *dev)
+  bool LinuxDeviceManager::processDevicePresence(Pointer<LinuxDevice> device)
   {
-    const String sys_path(udev_device_get_syspath(dev));
     try {
-      Pointer<LinuxDevice> device = makePointer<LinuxDevice>(*this, dev);
+      device->resolveParentID();
       insertDevice(device);
-      DevicePresent(device);
-      return;
+      return true;
     }
     catch(const std::exception& ex) {
-      logger->error("Exception caught during device presence processing: {}: {}", sys_path, ex.what());
+      logger->error("Exception caught during device presence processing: {}: {}", device->getSysPath(), ex.what());
     }
     catch(...) {
-      logger->error("Unknown exception while processing device: {}", sys_path);
+      logger->error("Unknown exception while processing device: {}", device->getSysPath());
     }
     /*
      * We don't reject the device here (as is done in processDeviceInsertion)
@@ -487,14 +1645,23 @@ namespace usbguard {
      * started. Therefore, if the device is malicious, it already had a chance
      * to interact with the system.
      */
-    return;
+    return false;
   }
 
   void LinuxDeviceManager::processDeviceInsertion(struct udev_device *dev)
   {
+    LatencyStatistics::Timer insertion_timer(LatencyStatistics::Stage::Insertion);
     const String sys_path(udev_device_get_syspath(dev));
     try {
-      Pointer<LinuxDevice> device = makePointer<LinuxDevice>(*this, dev);
+      if (isDeviceUnchanged(dev, sys_path)) {
+        USBGUARD_LOG_DEBUG("Ignoring a re-announced device: {}", sys_path);
+        return;
+      }
+      Pointer<LinuxDevice> device;
+      {
+        LatencyStatistics::Timer timer(LatencyStatistics::Stage::DeviceCreate);
+        device = makePointer<LinuxDevice>(*this, dev);
+      }
       insertDevice(device);
       DeviceInserted(device);
       return;
@@ -518,48 +1685,177 @@ namespace usbguard {
     return;
   }
 
+  /*
+   * An "add" event for a syspath which is already in the device map
+   * is a re-announcement (e.g. `udevadm trigger') if the identity of
+   * the device didn't change: the same device number, which encodes
+   * the bus and device numbers, and the same descriptor data size and
+   * modification time. If the identity differs, the remove event of
+   * the previous device was lost; the previous device is removed and
+   * false is returned, so that the event is processed as an insertion.
+   */
+  bool LinuxDeviceManager::isDeviceUnchanged(struct udev_device *dev, const String& syspath)
+  {
+    Pointer<LinuxDevice> device;
+
+    try {
+      device = std::static_pointer_cast<LinuxDevice>(getDevice(getIDFromSysPath(syspath)));
+    }
+    catch(...) {
+      return false;
+    }
+
+    try {
+      if (DeviceCheckpoint::getIdentity(syspath, udev_device_get_devnum(dev)) == device->getIdentity()) {
+        return true;
+      }
+    }
+    catch(...) {
+      /* The descriptors cannot be stat'ed, the device is probably gone */
+    }
+
+    USBGUARD_LOG_DEBUG("A different device appeared at a known syspath: {}", syspath);
+
+    try {
+      DeviceRemoved(removeDevice(syspath));
+    }
+    catch(...) {
+      /* Ignore for now */
+    }
+    return false;
+  }
+
   void LinuxDeviceManager::insertDevice(Pointer<Device> device)
   {
     DeviceManager::insertDevice(device);
     std::unique_lock<std::mutex> device_lock(device->refDeviceMutex());
-    _syspath_map[std::static_pointer_cast<LinuxDevice>(device)->getSysPath()] = device->getID();
+    _syspath_map.insert(std::static_pointer_cast<LinuxDevice>(device)->getSysPath(), device->getID());
     return;
   }
 
-  void LinuxDeviceManager::processDeviceRemoval(struct udev_device *dev)
+  /*
+   * Remove the devices at the syspaths, and the devices still
+   * connected behind them, as one batch. Children are removed before
+   * their parents. Later removal events of the devices removed with
+   * their hub are ignored as removals of unknown devices.
+   */
+  void LinuxDeviceManager::processDeviceRemovals(const std::vector<String>& syspaths)
   {
-    //log->debug("Processing device removal");
-    const char *syspath_cstr = udev_device_get_syspath(dev);
-    if (!syspath_cstr) {
-      return;
+    std::vector<uint32_t> ids;
+    ids.reserve(syspaths.size());
+
+    for (auto const& syspath : syspaths) {
+      try {
+        ids.push_back(getIDFromSysPath(syspath));
+      } catch(...) {
+        /* Ignore for now */
+        //log->debug("Removal of an unknown device ignored.");
+      }
     }
-    const String syspath(syspath_cstr);
-    try {
-      Pointer<Device> device = removeDevice(syspath);
-      DeviceRemoved(device);
-    } catch(...) {
-      /* Ignore for now */
-      //log->debug("Removal of an unknown device ignored.");
+
+    if (ids.empty()) {
       return;
     }
+
+    const PointerVector<Device> removed_devices = removeDevices(ids);
+
+    for (auto const& device : removed_devices) {
+      uint32_t id = 0;
+      _syspath_map.remove(std::static_pointer_cast<LinuxDevice>(device)->getSysPath(), id);
+    }
+
+    if (removed_devices.size() == 1) {
+      DeviceRemoved(removed_devices.front());
+    }
+    else if (!removed_devices.empty()) {
+      USBGUARD_LOG_DEBUG("Removing {} devices in one batch", removed_devices.size());
+      DevicesRemoved(removed_devices);
+    }
     return;
   }
 
   Pointer<Device> LinuxDeviceManager::removeDevice(const String& syspath)
   {
-    /* FIXME: device map locking */
-    auto it = _syspath_map.find(syspath);
-    if (it == _syspath_map.end()) {
+    uint32_t id = 0;
+    if (!_syspath_map.remove(syspath, id)) {
       throw std::runtime_error("Unknown device, cannot remove from syspath map");
     }
-    const uint32_t id = it->second;
-    Pointer<Device> device = DeviceManager::removeDevice(id);
-    _syspath_map.erase(it);
-    return device;
+    return DeviceManager::removeDevice(id);
   }
 
   uint32_t LinuxDeviceManager::getIDFromSysPath(const String& syspath) const
   {
     return _syspath_map.at(syspath);
   }
+
+  size_t SysPathMap::hash(const String& syspath)
+  {
+    return std::hash<String>()(syspath);
+  }
+
+  /*
+   * The shard is selected by higher bits of the hash than the ones
+   * selecting the bucket inside the shard.
+   */
+  SysPathMap::Shard& SysPathMap::shard(const size_t syspath_hash)
+  {
+    return _shards[(syspath_hash >> 7) % shard_count];
+  }
+
+  const SysPathMap::Shard& SysPathMap::shard(const size_t syspath_hash) const
+  {
+    return _shards[(syspath_hash >> 7) % shard_count];
+  }
+
+  void SysPathMap::insert(const String& syspath, const uint32_t id)
+  {
+    const size_t syspath_hash = hash(syspath);
+    Shard& syspath_shard = shard(syspath_hash);
+    std::unique_lock<std::mutex> lock(syspath_shard.mutex);
+    auto range = syspath_shard.entries.equal_range(syspath_hash);
+
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.first == syspath) {
+        it->second.second = id;
+        return;
+      }
+    }
+
+    syspath_shard.entries.emplace(syspath_hash, std::make_pair(syspath, id));
+    return;
+  }
+
+  uint32_t SysPathMap::at(const String& syspath) const
+  {
+    const size_t syspath_hash = hash(syspath);
+    const Shard& syspath_shard = shard(syspath_hash);
+    std::unique_lock<std::mutex> lock(syspath_shard.mutex);
+    auto range = syspath_shard.entries.equal_range(syspath_hash);
+
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.first == syspath) {
+        return it->second.second;
+      }
+    }
+
+    throw std::out_of_range("Unknown syspath");
+  }
+
+  bool SysPathMap::remove(const String& syspath, uint32_t& id)
+  {
+    const size_t syspath_hash = hash(syspath);
+    Shard& syspath_shard = shard(syspath_hash);
+    std::unique_lock<std::mutex> lock(syspath_shard.mutex);
+    auto range = syspath_shard.entries.equal_range(syspath_hash);
+
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.first == syspath) {
+        id = it->second.second;
+        syspath_shard.entries.erase(it);
+        return true;
+      }
+    }
+
+    return false;
+  }
 } /* namespace usbguard */
@@ -23,28 +23,86 @@
 #include <Device.hpp>
 #include <Rule.hpp>
 #include "LinuxSysIO.hpp"
+#include "DeviceCheckpoint.hpp"
 #include "Common/Thread.hpp"
 #include <libudev.h>
 #include <istream>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
 
 namespace usbguard {
   class LinuxDeviceManager;
 
+  /*
+   * Thread-safe map of syspaths to device ids. Entries are keyed by
+   * the syspath hash, which selects one of several independently
+   * locked shards, so lookups of concurrently loaded devices don't
+   * contend on a single lock.
+   */
+  class SysPathMap
+  {
+  public:
+    void insert(const String& syspath, uint32_t id);
+    uint32_t at(const String& syspath) const;
+    bool remove(const String& syspath, uint32_t& id);
+
+  private:
+    struct Shard
+    {
+      mutable std::mutex mutex;
+      std::unordered_multimap<size_t, std::pair<String, uint32_t>> entries;
+    };
+
+    static size_t hash(const String& syspath);
+    Shard& shard(size_t syspath_hash);
+    const Shard& shard(size_t syspath_hash) const;
+
+    static const size_t shard_count = 16;
+    Shard _shards[shard_count];
+  };
+
   class LinuxDevice : public Device
   {
   public:
-    LinuxDevice(LinuxDeviceManager& device_manager, struct udev_device* dev);
+    /*
+     * Create a device from the udev device. If load is false, only the
+     * attributes provided by udev are set and resolveParentID() and
+     * loadSysfsData() have to be called before the device is used.
+     */
+    LinuxDevice(LinuxDeviceManager& device_manager, struct udev_device* dev, bool load = true);
+    LinuxDevice(const LinuxDevice& rhs) = delete;
+    const LinuxDevice& operator=(const LinuxDevice& rhs) = delete;
+    ~LinuxDevice();
+
     const String& getSysPath() const;
+    int getSysPathFD() const;
+    uint64_t getDevNum() const;
     bool isController() const;
+    size_t getMemoryUsage() const override;
+    /*
+     * Identity recorded by loadSysfsData() for the device checkpoint
+     * and for recognizing re-announced devices. The syspath is empty
+     * if the identity isn't known.
+     */
+    const DeviceCheckpoint::Identity& getIdentity() const;
+
+    void resolveParentID();
+    void loadSysfsData();
 
   protected:
     void readDescriptors(std::istream& stream);
     void readConfiguration(int c_num, std::istream& stream);
     void readInterfaceDescriptor(int c_num, int i_num, std::istream& stream);
     void readEndpointDescriptor(int c_num, int i_num, int e_num, std::istream& stream);
+    void openSysPath();
 
   private:
     String _syspath;
+    String _parent_syspath;
+    int _syspath_fd;
+    uint64_t _devnum;
+    DeviceCheckpoint::Identity _identity;
   };
 
   class LinuxDeviceManager : public DeviceManager
@@ -54,32 +112,87 @@ namespace usbguard {
     ~LinuxDeviceManager();
 
     void setDefaultBlockedState(bool state);
+    void setCheckpointFile(const String& path);
+    void setKernelEventSource(bool enabled);
+    void setEventBufferSize(size_t size);
+    void setControllerAuthorizedDefault(const std::map<String, AuthorizedDefault>& controllers);
+    AuthorizedDefault getAuthorizedDefault(const Device& device) const;
     void start();
     void stop();
     void scan();
     Pointer<Device> allowDevice(uint32_t id);
     Pointer<Device> blockDevice(uint32_t id);
     Pointer<Device> rejectDevice(uint32_t id);
+    void setInterfaceAuthorization(bool enabled);
+    Pointer<Device> allowDeviceInterfaces(uint32_t id, const std::vector<USBInterfaceType>& interface_types);
+    std::vector<TargetResult> applyDeviceTargets(const std::vector<std::pair<uint32_t, Rule::Target>>& targets);
     void insertDevice(Pointer<Device> device);
     Pointer<Device> removeDevice(const String& syspath);
     uint32_t getIDFromSysPath(const String& syspath) const;
 
+    /*
+     * Register an additional file descriptor with the device manager
+     * event loop. The handler is called from the device manager thread
+     * whenever the descriptor becomes readable (level triggered).
+     */
+    void addEventSource(int fd, std::function<void()> handler);
+    void removeEventSource(int fd);
+
+    /*
+     * Checkpoint entry of the device with the identity, or nullptr
+     * if there's none. Used only while the present devices are
+     * enumerated at startup.
+     */
+    const DeviceCheckpoint::Entry *findCheckpointEntry(const DeviceCheckpoint::Identity& identity) const;
+    bool checkpointEnabled() const;
+
   protected:
     Pointer<Device> applyDevicePolicy(uint32_t id, Rule::Target target);
     void sysioApplyTarget(const String& sys_path, Rule::Target target);
+    int sysioApplyTarget(const LinuxDevice& device, Rule::Target target);
+    bool sysioSubmitTarget(const LinuxDevice& device, Rule::Target target);
+    int sysioApplyInterfaces(const LinuxDevice& device, const std::vector<USBInterfaceType> *interface_types);
+    void sysioCompleted(const SysIORequest& request, int error);
     void thread();
-    void udevReceiveDevice();
+    void udevReceiveDevices(size_t budget);
+    void processDeviceEvents(const std::vector<struct udev_device *>& events);
+    void processEventSource(int fd);
     void udevEnumerateDevices();
-    void processDevicePresence(struct udev_device *dev);
+    bool processDevicePresence(Pointer<LinuxDevice> device);
     void processDeviceInsertion(struct udev_device *dev);
-    void processDeviceRemoval(struct udev_device *dev);
+    bool isDeviceUnchanged(struct udev_device *dev, const String& syspath);
+    void udevCreateMonitor(const char *source);
+    void udevResync();
+    void processDeviceRemovals(const std::vector<String>& syspaths);
+    void loadCheckpoint();
+    void saveCheckpoint();
 
   private:
     struct udev *_udev;
     struct udev_monitor *_umon;
+    size_t _umon_buffer_size;
+    /* Set when events were lost, see udevResync() */
+    bool _umon_overflow;
     int _event_fd;
+    int _epoll_fd;
+    std::mutex _event_sources_mutex;
+    std::unordered_map<int, std::function<void()>> _event_sources;
     Thread<LinuxDeviceManager> _thread;
-    StringKeyMap<uint32_t> _syspath_map;
+    SysPathMap _syspath_map;
+    /*
+     * Targets applied by the rule evaluation are written to sysfs
+     * by this worker. Targets applied on an explicit request are
+     * written synchronously, after the queued writes, so that their
+     * status can be reported.
+     */
+    SysIOWorker _sysio;
+    String _checkpoint_path;
+    std::unordered_map<String, DeviceCheckpoint::Entry> _checkpoint;
+    bool _interface_authorization;
+    std::map<String, AuthorizedDefault> _controller_authorized_default;
+    /* Default authorization in effect, by bus number */
+    mutable std::mutex _authorized_default_mutex;
+    std::map<uint32_t, AuthorizedDefault> _bus_authorized_default;
   };
 
 } /* namespace usbguard */
@@ -17,6 +17,7 @@
 // Authors: Daniel Kopecek <dkopecek@redhat.com>
 //
 #include "LinuxSysIO.hpp"
+#include "LatencyStatistics.hpp"
 #include <Logger.hpp>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -24,6 +25,9 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unordered_map>
 
 namespace usbguard
 {
@@ -57,6 +61,37 @@ namespace usbguard
     return;
   }
 
+  /*
+   * Write an integer value to a file relative to an open directory
+   * file descriptor (O_PATH descriptors work too). Returns 0 on
+   * success or an errno value.
+   */
+  int sysioWriteValueAt(int dirfd, const char *relpath, int value)
+  {
+    char value_buffer[16];
+    const int value_size = snprintf(value_buffer, sizeof value_buffer, "%d", value);
+
+    if (value_size < 1 || (size_t)value_size >= sizeof value_buffer) {
+      return EINVAL;
+    }
+
+    const int fd = openat(dirfd, relpath, O_WRONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+      return errno;
+    }
+
+    int error = 0;
+    errno = 0;
+
+    if (write(fd, value_buffer, (size_t)value_size) != (ssize_t)value_size) {
+      error = (errno != 0 ? errno : EIO);
+    }
+
+    close(fd);
+    return error;
+  }
+
   ssize_t sysioWriteFileAt(DIR* dirfp, const std::string& relpath, char *buffer, size_t buflen)
   {
     const int fd = openat(dirfd(dirfp), relpath.c_str(), O_WRONLY);
@@ -91,9 +126,12 @@ namespace usbguard
     return bytes_read;
   }
 
-  void sysioSetAuthorizedDefault(bool state)
+  /*
+   * Call `callback' with the name of each USB controller (root hub)
+   * in /sys/bus/usb/devices/.
+   */
+  static void sysioForEachController(const std::function<void(DIR*, const std::string&)>& callback)
   {
-    //log->debug("Setting default authorized flag values on all USB controllers to {}", state);
     const char * const dir = "/sys/bus/usb/devices/";
     DIR *dirfp = opendir(dir);
     struct dirent *dent;
@@ -130,16 +168,351 @@ namespace usbguard
 	continue;
       }
 
-      buffer[0] = state ? '1' : '0';
+      callback(dirfp, devpath);
+    }
+
+    closedir(dirfp);
+    return;
+  }
+
+  /*
+   * Write 0 or 1 to the attribute of all USB controllers (root hubs).
+   */
+  static void sysioSetControllerAttribute(const char *attribute, bool state)
+  {
+    sysioForEachController([attribute, state](DIR *dirfp, const std::string& devpath) {
+      char buffer[1] = { state ? '1' : '0' };
 
-      if (sysioWriteFileAt(dirfp, devpath + "/authorized_default",
+      if (sysioWriteFileAt(dirfp, devpath + "/" + attribute,
 			   buffer, 1) != 1) {
 	//log->debug("Cannot set default authorized state for device {}", devpath);
-	continue;
       }
+    });
+    return;
+  }
+
+  /*
+   * The name of the host controller device of a root hub, i.e. the
+   * parent directory of the root hub in the sysfs device tree.
+   */
+  static std::string sysioHostControllerName(DIR *dirfp, const std::string& devpath)
+  {
+    char link[PATH_MAX];
+    const ssize_t size = readlinkat(dirfd(dirfp), devpath.c_str(), link, sizeof link - 1);
+
+    if (size <= 0) {
+      return std::string();
     }
 
-    closedir(dirfp);
+    const std::string target(link, (size_t)size);
+    const size_t name_end = target.find_last_of('/');
+
+    if (name_end == std::string::npos || name_end == 0) {
+      return std::string();
+    }
+
+    const size_t name_start = target.find_last_of('/', name_end - 1);
+    return target.substr(name_start == std::string::npos ? 0 : name_start + 1,
+                         name_end - (name_start == std::string::npos ? 0 : name_start + 1));
+  }
+
+  std::map<uint32_t, SysIOAuthorizedDefault> sysioSetAuthorizedDefault(int value,
+                                                                      const std::map<std::string, int>& controller_values)
+  {
+    std::map<uint32_t, SysIOAuthorizedDefault> results;
+
+    sysioForEachController([value, &controller_values, &results](DIR *dirfp, const std::string& devpath) {
+      auto it = controller_values.find(devpath);
+
+      if (it == controller_values.end()) {
+        it = controller_values.find(sysioHostControllerName(dirfp, devpath));
+      }
+
+      SysIOAuthorizedDefault result;
+      result.controller = (it != controller_values.end() ? it->first : std::string());
+      result.requested = (it != controller_values.end() ? it->second : value);
+      result.written = result.requested;
+
+      char buffer[1] = { static_cast<char>('0' + result.requested) };
+
+      /* Kernels without the "internal devices only" mode refuse 2 */
+      if (sysioWriteFileAt(dirfp, devpath + "/authorized_default", buffer, 1) != 1) {
+        buffer[0] = '0';
+        result.written = (sysioWriteFileAt(dirfp, devpath + "/authorized_default", buffer, 1) == 1 ? 0 : -1);
+      }
+
+      results[static_cast<uint32_t>(strtoul(devpath.c_str() + 3, nullptr, 10))] = result;
+    });
+
+    return results;
+  }
+
+  void sysioSetAuthorizedDefault(bool state)
+  {
+    //log->debug("Setting default authorized flag values on all USB controllers to {}", state);
+    sysioSetControllerAttribute("authorized_default", state);
+    return;
+  }
+
+  /*
+   * Interfaces of newly authorized devices are authorized only if
+   * the interface_authorized_default attribute of their controller
+   * is set. Kernels without the attribute are silently skipped.
+   */
+  void sysioSetInterfaceAuthorizedDefault(bool state)
+  {
+    sysioSetControllerAttribute("interface_authorized_default", state);
+    return;
+  }
+
+  /*
+   * Read an integer value from a file. Returns 0 on success or an
+   * errno value.
+   */
+  static int sysioReadValue(const char *path, int& value)
+  {
+    const int fd = open(path, O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+      return errno;
+    }
+
+    char buffer[16] = { };
+    errno = 0;
+    const ssize_t size = read(fd, buffer, sizeof buffer - 1);
+    const int error = (size < 0 ? (errno != 0 ? errno : EIO) : 0);
+
+    close(fd);
+
+    if (error != 0) {
+      return error;
+    }
+
+    char *end = nullptr;
+    const long parsed = strtol(buffer, &end, 10);
+
+    if (end == buffer) {
+      return EINVAL;
+    }
+
+    value = static_cast<int>(parsed);
+    return 0;
+  }
+
+  SysIOWorker::SysIOWorker(CompletionHandler handler, uint32_t max_memory_MiB)
+    : _queue(max_memory_MiB),
+      _handler(std::move(handler))
+  {
+    _running = false;
+    _submitted = 0;
+    _completed = 0;
+    return;
+  }
+
+  SysIOWorker::~SysIOWorker()
+  {
+    stop();
+    return;
+  }
+
+  void SysIOWorker::setStartHandler(std::function<void()> handler)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _start_handler = std::move(handler);
+    return;
+  }
+
+  /*
+   * The running flag is modified with both of the mutexes locked, so
+   * that it can be read with either of them.
+   */
+  void SysIOWorker::start()
+  {
+    std::unique_lock<std::mutex> submit_lock(_submit_mutex);
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_running) {
+      return;
+    }
+
+    _running = true;
+    _queue.open();
+    _thread = std::thread(&SysIOWorker::thread, this);
+    return;
+  }
+
+  /*
+   * No request is queued once the flag is cleared, so the worker
+   * completes all of the submitted requests before it exits.
+   */
+  void SysIOWorker::stop()
+  {
+    {
+      std::unique_lock<std::mutex> submit_lock(_submit_mutex);
+      std::unique_lock<std::mutex> lock(_mutex);
+      _running = false;
+    }
+    _queue.close();
+
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+    return;
+  }
+
+  bool SysIOWorker::running() const
+  {
+    std::unique_lock<std::mutex> lock(const_cast<std::mutex&>(_mutex));
+    return _running;
+  }
+
+  uint64_t SysIOWorker::submit(int type, const String& path, int value, uint32_t id)
+  {
+    if (path.size() >= SYSIO_PATH_MAX) {
+      return 0;
+    }
+
+    uint64_t sequence = 0;
+    {
+      /*
+       * Producers are serialized, so that the sequence numbers
+       * follow the queue order. The worker never takes this lock.
+       */
+      std::unique_lock<std::mutex> lock(_submit_mutex);
+
+      if (!_running) {
+        return 0;
+      }
+
+      SysIORequest *request = nullptr;
+
+      while ((request = _queue.acquire()) == nullptr) {
+        std::this_thread::yield();
+      }
+
+      request->type = type;
+      request->value = value;
+      request->id = id;
+      request->sequence = sequence = ++_submitted;
+      memcpy(request->path, path.c_str(), path.size() + 1);
+
+      while (!_queue.enqueue(request)) {
+        std::this_thread::yield();
+      }
+    }
+    return sequence;
+  }
+
+  void SysIOWorker::wait(uint64_t sequence)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _completed_cv.wait(lock, [this, sequence]() {
+      return _completed >= sequence;
+    });
+    return;
+  }
+
+  void SysIOWorker::flush()
+  {
+    uint64_t sequence = 0;
+    {
+      std::unique_lock<std::mutex> lock(_submit_mutex);
+      sequence = _submitted;
+    }
+    wait(sequence);
+    return;
+  }
+
+  void SysIOWorker::thread()
+  {
+    std::vector<SysIORequest> batch;
+    const size_t batch_max = 64;
+    const SysIORequest *requests[batch_max];
+
+    if (_start_handler) {
+      _start_handler();
+    }
+
+    while (true) {
+      /* Sleeps until a request is queued. Returns nullptr once stopped and empty. */
+      const SysIORequest *request = _queue.dequeueWait();
+
+      if (request == nullptr) {
+        if (_queue.closed()) {
+          return;
+        }
+        continue;
+      }
+
+      batch.clear();
+      batch.push_back(*request);
+      _queue.release(request);
+
+      SysIOQueue::count_type count = 0;
+
+      while ((count = _queue.dequeue(requests, batch_max)) > 0) {
+        for (SysIOQueue::count_type i = 0; i < count; ++i) {
+          batch.push_back(*requests[i]);
+        }
+        _queue.release(requests[0], count);
+      }
+
+      processBatch(batch);
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _completed = batch.back().sequence;
+      }
+      _completed_cv.notify_all();
+    }
+    return;
+  }
+
+  void SysIOWorker::processBatch(std::vector<SysIORequest>& batch)
+  {
+    /* Index of the last write to each path */
+    std::unordered_map<std::string, size_t> last_write;
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (batch[i].type == SYSIO_REQUEST_WRITE) {
+        last_write[batch[i].path] = i;
+      }
+    }
+
+    std::vector<int> errors(batch.size(), 0);
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      SysIORequest& request = batch[i];
+
+      if (request.type == SYSIO_REQUEST_READ) {
+        errors[i] = sysioReadValue(request.path, request.value);
+      }
+      else if (request.type == SYSIO_REQUEST_WRITE) {
+        if (last_write[request.path] == i) {
+          LatencyStatistics::Timer timer(LatencyStatistics::Stage::SysfsApply);
+          errors[i] = sysioWriteValueAt(AT_FDCWD, request.path, request.value);
+        }
+      }
+      else {
+        errors[i] = EINVAL;
+      }
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const SysIORequest& request = batch[i];
+
+      if (request.type == SYSIO_REQUEST_WRITE) {
+        const size_t performed = last_write[request.path];
+        errors[i] = errors[performed];
+      }
+      if (_handler) {
+        try {
+          _handler(request, errors[i]);
+        }
+        catch(...) {
+          /* The handler must not stop the worker */
+        }
+      }
+    }
     return;
   }
 
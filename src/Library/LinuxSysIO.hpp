@@ -19,9 +19,17 @@
 #pragma once
 
 #include "Common/CCBQueue.hpp"
+#include <Typedefs.hpp>
 #include <limits.h>
 #include <dirent.h>
 #include <string>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
 
 namespace usbguard
 {
@@ -41,15 +49,104 @@ namespace usbguard
   struct SysIORequest
   {
     int type;
-    int value;
+    int value; /**< Value to write, or the value read */
+    uint32_t id; /**< Caller defined, e.g. the device id */
+    uint64_t sequence; /**< Assigned by SysIOWorker::submit */
     char path[SYSIO_PATH_MAX];
   };
 
   typedef CCBQueue<SysIORequest> SysIOQueue;
 
+  /*
+   * Performs sysfs reads and writes on a dedicated thread, so that a
+   * slow attribute doesn't stall the caller.
+   *
+   * The requests are processed in the order they were submitted. All
+   * of the requests queued when the worker wakes up are processed as
+   * one batch: of several writes to the same path only the last one is
+   * performed. The completion handler is called from the worker thread
+   * for every request, in order, with 0 or an errno value. A request
+   * whose write was superseded completes with the status of the write
+   * which superseded it.
+   */
+  class DLL_PUBLIC SysIOWorker
+  {
+  public:
+    typedef std::function<void(const SysIORequest& request, int error)> CompletionHandler;
+
+    SysIOWorker(CompletionHandler handler, uint32_t max_memory_MiB = 1);
+    ~SysIOWorker();
+
+    SysIOWorker(const SysIOWorker&) = delete;
+    const SysIOWorker& operator=(const SysIOWorker&) = delete;
+
+    /*
+     * Set a function called from the worker thread when it starts.
+     * Takes effect on the next start().
+     */
+    void setStartHandler(std::function<void()> handler);
+    void start();
+    /*
+     * Process the queued requests and stop the worker thread.
+     */
+    void stop();
+    bool running() const;
+
+    /*
+     * Queue a request. Waits for a free slot if the queue is full.
+     * Returns the sequence number of the request, or 0 if it wasn't
+     * queued because the worker isn't running or the path is too
+     * long. The caller should perform such a request by itself.
+     */
+    uint64_t submit(int type, const String& path, int value, uint32_t id);
+
+    /*
+     * Wait until the request with the sequence number and all of
+     * the requests submitted before it have completed.
+     */
+    void wait(uint64_t sequence);
+    void flush();
+
+  private:
+    void thread();
+    void processBatch(std::vector<SysIORequest>& batch);
+
+    SysIOQueue _queue;
+    CompletionHandler _handler;
+    std::function<void()> _start_handler;
+    std::thread _thread;
+    std::mutex _submit_mutex;
+    std::mutex _mutex;
+    std::condition_variable _completed_cv;
+    bool _running;
+    uint64_t _submitted;
+    uint64_t _completed;
+  };
+
   void sysioWrite(const char *path, int value);
+  int sysioWriteValueAt(int dirfd, const char *relpath, int value);
   ssize_t sysioWriteFileAt(DIR* dirfp, const std::string& relpath, char *buffer, size_t buflen);
   ssize_t sysioReadFileAt(DIR* dirfp, const std::string& relpath, char *buffer, size_t buflen);
   void sysioSetAuthorizedDefault(bool state);
 
+  struct SysIOAuthorizedDefault
+  {
+    std::string controller; /* Matched name, empty if the default value was used */
+    int requested;
+    int written; /* -1 if nothing could be written */
+  };
+
+  /*
+   * Write the authorized_default attribute of each USB controller:
+   * the value for the controller in `controller_values', keyed by
+   * the name of its root hub (usbN) or of its host controller device
+   * (e.g. the PCI address), or `value' for the rest. A value which
+   * the kernel refuses (2, "internal devices only", needs Linux 5.9)
+   * is replaced by 0. Returns the results by bus number.
+   */
+  std::map<uint32_t, SysIOAuthorizedDefault> sysioSetAuthorizedDefault(int value,
+                                                                      const std::map<std::string, int>& controller_values);
+
+  void sysioSetInterfaceAuthorizedDefault(bool state);
+
 } /* namespace usbguard */
@@ -18,10 +18,9 @@
 //
 #include "LocaltimeCondition.hpp"
 #include "RuleParser.hpp"
-#ifndef _XOPEN_SOURCE
-#define _XOPEN_SOURCE
+#include <atomic>
 #include <ctime>
-#endif
+#include <cctype>
 
 namespace usbguard
 {
@@ -40,28 +39,72 @@ namespace usbguard
       time_end = time_range.substr(dash_pos + 1);
     }
 
-    _tp_begin = stringToTimePoint(time_begin);
+    _daytime_begin = stringToDaytime(time_begin);
 
     if (!time_end.empty()) {
-      _tp_end = stringToTimePoint(time_end);
+      _daytime_end = stringToDaytime(time_end);
     }
     else {
-      _tp_end = _tp_begin;
+      _daytime_end = _daytime_begin;
     }
   }
 
   LocaltimeCondition::LocaltimeCondition(const LocaltimeCondition& rhs)
     : RuleCondition(rhs)
   {
-    _tp_begin = rhs._tp_begin;
-    _tp_end = rhs._tp_end;
+    _daytime_begin = rhs._daytime_begin;
+    _daytime_end = rhs._daytime_end;
   }
 
   bool LocaltimeCondition::update(const Rule& rule)
   {
     (void)rule;
-    const auto tp_now = std::chrono::system_clock::now();
-    return (tp_now >= _tp_begin && tp_now <= _tp_end);
+    const uint32_t daytime_now = currentDaytime();
+
+    if (_daytime_begin <= _daytime_end) {
+      return (daytime_now >= _daytime_begin && daytime_now <= _daytime_end);
+    }
+    else {
+      /* The range wraps around midnight */
+      return (daytime_now >= _daytime_begin || daytime_now <= _daytime_end);
+    }
+  }
+
+  bool LocaltimeCondition::isMemoizable() const
+  {
+    return true;
+  }
+
+  RuleCondition::Cost LocaltimeCondition::cost() const
+  {
+    return Cost::Clock;
+  }
+
+  /*
+   * The state changes at the beginning of the range and one second
+   * after its end. The local time of day has a one second resolution,
+   * so the returned time is up to a second late, never early. A change
+   * of the UTC offset moves the boundary; the caller is expected to
+   * ask again after the returned time has passed.
+   */
+  bool LocaltimeCondition::nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const
+  {
+    (void)rule;
+    const uint32_t seconds_per_day = 24 * 60 * 60;
+    const uint32_t daytime_now = currentDaytime();
+    const uint32_t boundaries[] = { _daytime_begin, (_daytime_end + 1) % seconds_per_day };
+    uint32_t delay = seconds_per_day;
+
+    for (const uint32_t boundary : boundaries) {
+      const uint32_t boundary_delay = (boundary + seconds_per_day - daytime_now) % seconds_per_day;
+
+      if (boundary_delay > 0 && boundary_delay < delay) {
+        delay = boundary_delay;
+      }
+    }
+
+    time_point = EvaluationClock::now() + std::chrono::seconds(delay);
+    return true;
   }
 
   RuleCondition * LocaltimeCondition::clone() const
@@ -69,17 +112,66 @@ namespace usbguard
     return new LocaltimeCondition(*this);
   }
 
-  std::chrono::system_clock::time_point LocaltimeCondition::stringToTimePoint(const String& string)
+  /*
+   * Parse a one or two digit time field, the same
+   * way strptime() parses %H, %M and %S.
+   */
+  static bool parseTimeField(const String& string, size_t& pos, uint32_t limit, uint32_t& value)
   {
-    struct ::tm tm = { 0 };
+    const size_t begin = pos;
+    value = 0;
 
-    if (::strptime(string.c_str(), "%H:%M:%s", &tm) == nullptr) {
-      if (::strptime(string.c_str(), "%H:%M", &tm) == nullptr) {
-        throw std::runtime_error("Invalid time string. Expecing either HH:MM or HH:MM:SS format.");
-      }
+    while (pos < string.size() && pos - begin < 2 && isdigit(string[pos])) {
+      value = value * 10 + (string[pos] - '0');
+      ++pos;
     }
 
-    return std::chrono::system_clock::from_time_t(::mktime(&tm)); 
+    return pos > begin && value < limit;
+  }
+
+  uint32_t LocaltimeCondition::stringToDaytime(const String& string)
+  {
+    uint32_t hours = 0;
+    uint32_t minutes = 0;
+    uint32_t seconds = 0;
+    size_t pos = 0;
+
+    if (!parseTimeField(string, pos, 24, hours) ||
+        pos >= string.size() || string[pos++] != ':' ||
+        !parseTimeField(string, pos, 60, minutes) ||
+        (pos < string.size() && (string[pos++] != ':' ||
+                                 !parseTimeField(string, pos, 60, seconds))) ||
+        pos != string.size()) {
+      throw std::runtime_error("Invalid time string. Expecing either HH:MM or HH:MM:SS format.");
+    }
+
+    return hours * 3600 + minutes * 60 + seconds;
   }
-} /* namespace usbguard */
 
+  /*
+   * The local time of day is cached together with the wall-clock
+   * second it was computed for, so that all the localtime conditions
+   * evaluated within the same second (typically all of those in one
+   * matching pass) share a single localtime_r call. Both values are
+   * packed into one atomic word: the time of day needs 17 bits.
+   */
+  static std::atomic<uint64_t> G_daytime_cache(UINT64_MAX);
+
+  uint32_t LocaltimeCondition::currentDaytime()
+  {
+    const time_t now = ::time(nullptr);
+    const uint64_t cached = G_daytime_cache.load(std::memory_order_relaxed);
+
+    if (cached != UINT64_MAX && (cached >> 17) == (uint64_t)now) {
+      return cached & ((1 << 17) - 1);
+    }
+
+    struct ::tm tm = { };
+    ::localtime_r(&now, &tm);
+
+    const uint32_t daytime = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+    G_daytime_cache.store(((uint64_t)now << 17) | daytime, std::memory_order_relaxed);
+
+    return daytime;
+  }
+} /* namespace usbguard */
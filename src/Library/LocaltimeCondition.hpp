@@ -20,7 +20,6 @@
 #include "Typedefs.hpp"
 #include "RuleCondition.hpp"
 #include "Rule.hpp"
-#include <chrono>
 
 namespace usbguard
 {
@@ -30,14 +29,20 @@ namespace usbguard
     LocaltimeCondition(const String& time_range, bool negated = false);
     LocaltimeCondition(const LocaltimeCondition& rhs);
     bool update(const Rule& rule);
+    bool isMemoizable() const;
+    Cost cost() const;
+    bool nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const;
     RuleCondition * clone() const;
 
   protected:
-    static std::chrono::system_clock::time_point stringToTimePoint(const String& string);
+    /* Convert HH:MM[:SS] to seconds since midnight */
+    static uint32_t stringToDaytime(const String& string);
+    /* Current local time as seconds since midnight */
+    static uint32_t currentDaytime();
 
   private:
-    std::chrono::system_clock::time_point _tp_begin;
-    std::chrono::system_clock::time_point _tp_end;
+    uint32_t _daytime_begin;
+    uint32_t _daytime_end;
   };
 } /* namespace usbguard */
 
@@ -18,6 +18,7 @@
 //
 #pragma once
 #include <Typedefs.hpp>
+#include <functional>
 
 namespace usbguard
 {
@@ -36,5 +37,30 @@ namespace usbguard
     static void setConsoleOutput(bool state);
     static void setSyslogOutput(bool state, const String& ident);
     static void setFileOutput(bool state, const String& path);
+
+    enum class OverflowPolicy {
+      Block,
+      Drop
+    };
+
+    /*
+     * Switch the logger to the asynchronous mode. Log messages
+     * are queued in a bounded queue of queue_size entries (a power
+     * of two) and written to the sinks by a background thread.
+     * The policy decides what happens when the queue is full:
+     * wait for a free slot (Block) or discard the message (Drop).
+     * If set, worker_start is called from the background thread
+     * when it starts.
+     */
+    static void setAsyncMode(bool state, size_t queue_size = 8192,
+                             OverflowPolicy policy = OverflowPolicy::Block,
+                             const std::function<void()>& worker_start = nullptr);
+    static OverflowPolicy overflowPolicyFromString(const String& policy_string);
+
+    /*
+     * Estimated memory preallocated for the asynchronous queue,
+     * in bytes. Zero if the logger isn't asynchronous.
+     */
+    static size_t getQueueMemoryUsage();
   };
 } /* namespace usbguard */
@@ -48,6 +48,7 @@ namespace usbguard
       break;
     }
 
+    logger_state.setLevel(spdlog_level);
     logger->set_level(spdlog_level);
     return;
   }
@@ -77,6 +78,33 @@ namespace usbguard
     return;
   }
 
+  void Logger::setAsyncMode(bool state, size_t queue_size, OverflowPolicy policy,
+                            const std::function<void()>& worker_start)
+  {
+    if (state && (queue_size == 0 || (queue_size & (queue_size - 1)) != 0)) {
+      throw std::runtime_error("Logger queue size must be a power of two");
+    }
+    logger_state.setAsyncMode(state, queue_size, policy, worker_start);
+    logger_state.create();
+    return;
+  }
+
+  size_t Logger::getQueueMemoryUsage()
+  {
+    return logger_state.queueMemoryUsage();
+  }
+
+  Logger::OverflowPolicy Logger::overflowPolicyFromString(const String& policy_string)
+  {
+    if (policy_string == "block") {
+      return OverflowPolicy::Block;
+    }
+    if (policy_string == "drop") {
+      return OverflowPolicy::Drop;
+    }
+    throw std::runtime_error("Invalid logger overflow policy: " + policy_string);
+  }
+
   LoggerPrivate::LoggerPrivate()
   {
     _console_enabled = false;
@@ -84,7 +112,10 @@ namespace usbguard
     _syslog_ident = "usbguard";
     _file_enabled = false;
     _file_path = "usbguard.log";
-    _level = spdlog::level::off;
+    _async_enabled = false;
+    _async_queue_size = 8192;
+    _async_overflow_policy = Logger::OverflowPolicy::Block;
+    _level = spdlog::level::info;
     _created = false;
 
     create();
@@ -119,8 +150,27 @@ namespace usbguard
       _created = false;
     }
 
-    logger = spdlog::create("usbguard", sinks.begin(), sinks.end());
+    if (_async_enabled) {
+      /*
+       * The callers only format the message and push it to the
+       * bounded queue, the sinks are written by the worker thread.
+       * Dropping the previous logger above flushes and joins its
+       * worker, so no queued message is lost on reconfiguration.
+       */
+      const auto overflow_policy =
+        _async_overflow_policy == Logger::OverflowPolicy::Drop ?
+        spdlog::async_overflow_policy::discard_log_msg :
+        spdlog::async_overflow_policy::block_retry;
+
+      logger = spdlog::create_async("usbguard", sinks.begin(), sinks.end(),
+                                    _async_queue_size, overflow_policy,
+                                    _async_worker_start);
+    }
+    else {
+      logger = spdlog::create("usbguard", sinks.begin(), sinks.end());
+    }
     logger->set_pattern("[%Y-%m-%d %T.%f] %l: %v");
+    logger->set_level(_level);
     _created = true;
 
     return;
@@ -145,4 +195,32 @@ namespace usbguard
     _file_path = path;
     return;
   }
+
+  void LoggerPrivate::setAsyncMode(bool state, size_t queue_size, Logger::OverflowPolicy policy,
+                                   const std::function<void()>& worker_start)
+  {
+    _async_enabled = state;
+    _async_queue_size = queue_size;
+    _async_overflow_policy = policy;
+    _async_worker_start = worker_start;
+    return;
+  }
+
+  /*
+   * Each slot of the spdlog queue holds an async_msg with the logger
+   * name and the formatted text plus the level, time and thread id.
+   */
+  size_t LoggerPrivate::queueMemoryUsage() const
+  {
+    if (!_async_enabled) {
+      return 0;
+    }
+    return _async_queue_size * (2 * sizeof(std::string) + 48);
+  }
+
+  void LoggerPrivate::setLevel(spdlog::level::level_enum level)
+  {
+    _level = level;
+    return;
+  }
 } /* namespace usbguard */
@@ -17,6 +17,7 @@
 // Authors: Daniel Kopecek <dkopecek@redhat.com>
 //
 #pragma once
+#include <build-config.h>
 
 #include "Typedefs.hpp"
 #include "Logger.hpp"
@@ -27,6 +28,30 @@
 #include <spdlog/sinks/syslog_sink.h>
 #include <spdlog/sinks/stdout_sinks.h>
 
+/*
+ * Messages below this level (0 = trace, 1 = debug, 2 = info)
+ * are compiled out. Set with ./configure --with-log-min-level.
+ */
+#if !defined(USBGUARD_LOGGER_MIN_LEVEL)
+# define USBGUARD_LOGGER_MIN_LEVEL 0
+#endif
+
+/*
+ * Check the level before the arguments are evaluated, so that
+ * a disabled message doesn't cost a dump() or toString() call.
+ */
+#define USBGUARD_LOG(spdlog_level, method, ...) \
+  do { \
+    if (static_cast<int>(spdlog::level::spdlog_level) >= USBGUARD_LOGGER_MIN_LEVEL && \
+        usbguard::logger->should_log(spdlog::level::spdlog_level)) { \
+      usbguard::logger->method(__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define USBGUARD_LOG_TRACE(...) USBGUARD_LOG(trace, trace, __VA_ARGS__)
+#define USBGUARD_LOG_DEBUG(...) USBGUARD_LOG(debug, debug, __VA_ARGS__)
+#define USBGUARD_LOG_INFO(...) USBGUARD_LOG(info, info, __VA_ARGS__)
+
 namespace usbguard
 {
   extern Pointer<spdlog::logger> logger;
@@ -41,6 +66,10 @@ namespace usbguard
     void setConsoleOutput(bool state);
     void setSyslogOutput(bool state, const String& ident);
     void setFileOutput(bool state, const String& path);
+    void setAsyncMode(bool state, size_t queue_size, Logger::OverflowPolicy policy,
+                      const std::function<void()>& worker_start);
+    void setLevel(spdlog::level::level_enum level);
+    size_t queueMemoryUsage() const;
 
   private:
     bool _console_enabled;
@@ -48,6 +77,10 @@ namespace usbguard
     String _syslog_ident;
     bool _file_enabled;
     String _file_path;
+    bool _async_enabled;
+    size_t _async_queue_size;
+    Logger::OverflowPolicy _async_overflow_policy;
+    std::function<void()> _async_worker_start;
     spdlog::level::level_enum _level;
     bool _created;
   };
@@ -0,0 +1,337 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "MessagePack.hpp"
+#include <stdexcept>
+#include <cstring>
+
+namespace usbguard
+{
+  /* Nesting limit for decoded arrays and maps */
+  static const unsigned G_msgpack_depth_max = 64;
+
+  static void appendBigEndian(std::string& buffer, uint64_t value, size_t size)
+  {
+    for (size_t i = size; i > 0; --i) {
+      buffer.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xff));
+    }
+    return;
+  }
+
+  static void appendHeader(std::string& buffer, size_t size,
+                           uint8_t fix_type, size_t fix_max,
+                           uint8_t type8, uint8_t type16, uint8_t type32)
+  {
+    if (size <= fix_max) {
+      buffer.push_back(static_cast<char>(fix_type | size));
+    }
+    else if (type8 != 0 && size <= UINT8_MAX) {
+      buffer.push_back(static_cast<char>(type8));
+      appendBigEndian(buffer, size, 1);
+    }
+    else if (size <= UINT16_MAX) {
+      buffer.push_back(static_cast<char>(type16));
+      appendBigEndian(buffer, size, 2);
+    }
+    else if (size <= UINT32_MAX) {
+      buffer.push_back(static_cast<char>(type32));
+      appendBigEndian(buffer, size, 4);
+    }
+    else {
+      throw std::runtime_error("MessagePack: value too large");
+    }
+    return;
+  }
+
+  static void appendString(std::string& buffer, const std::string& value)
+  {
+    appendHeader(buffer, value.size(), 0xa0, 31, 0xd9, 0xda, 0xdb);
+    buffer.append(value);
+    return;
+  }
+
+  static void appendUnsigned(std::string& buffer, uint64_t value)
+  {
+    if (value <= 0x7f) {
+      buffer.push_back(static_cast<char>(value));
+    }
+    else if (value <= UINT8_MAX) {
+      buffer.push_back(static_cast<char>(0xcc));
+      appendBigEndian(buffer, value, 1);
+    }
+    else if (value <= UINT16_MAX) {
+      buffer.push_back(static_cast<char>(0xcd));
+      appendBigEndian(buffer, value, 2);
+    }
+    else if (value <= UINT32_MAX) {
+      buffer.push_back(static_cast<char>(0xce));
+      appendBigEndian(buffer, value, 4);
+    }
+    else {
+      buffer.push_back(static_cast<char>(0xcf));
+      appendBigEndian(buffer, value, 8);
+    }
+    return;
+  }
+
+  static void appendSigned(std::string& buffer, int64_t value)
+  {
+    if (value >= 0) {
+      appendUnsigned(buffer, static_cast<uint64_t>(value));
+    }
+    else if (value >= -32) {
+      buffer.push_back(static_cast<char>(value));
+    }
+    else if (value >= INT8_MIN) {
+      buffer.push_back(static_cast<char>(0xd0));
+      appendBigEndian(buffer, static_cast<uint64_t>(value), 1);
+    }
+    else if (value >= INT16_MIN) {
+      buffer.push_back(static_cast<char>(0xd1));
+      appendBigEndian(buffer, static_cast<uint64_t>(value), 2);
+    }
+    else if (value >= INT32_MIN) {
+      buffer.push_back(static_cast<char>(0xd2));
+      appendBigEndian(buffer, static_cast<uint64_t>(value), 4);
+    }
+    else {
+      buffer.push_back(static_cast<char>(0xd3));
+      appendBigEndian(buffer, static_cast<uint64_t>(value), 8);
+    }
+    return;
+  }
+
+  void toMessagePack(const json& value, std::string& buffer)
+  {
+    switch(value.type()) {
+      case json::value_t::null:
+        buffer.push_back(static_cast<char>(0xc0));
+        break;
+      case json::value_t::boolean:
+        buffer.push_back(static_cast<char>(value.get<bool>() ? 0xc3 : 0xc2));
+        break;
+      case json::value_t::number_unsigned:
+        appendUnsigned(buffer, value.get<uint64_t>());
+        break;
+      case json::value_t::number_integer:
+        appendSigned(buffer, value.get<int64_t>());
+        break;
+      case json::value_t::number_float:
+        {
+          const double number = value.get<double>();
+          uint64_t bits = 0;
+          static_assert(sizeof bits == sizeof number, "Unexpected size of double");
+          memcpy(&bits, &number, sizeof bits);
+          buffer.push_back(static_cast<char>(0xcb));
+          appendBigEndian(buffer, bits, 8);
+        }
+        break;
+      case json::value_t::string:
+        appendString(buffer, value.get_ref<const json::string_t&>());
+        break;
+      case json::value_t::array:
+        appendHeader(buffer, value.size(), 0x90, 15, 0, 0xdc, 0xdd);
+        for (auto const& item : value) {
+          toMessagePack(item, buffer);
+        }
+        break;
+      case json::value_t::object:
+        appendHeader(buffer, value.size(), 0x80, 15, 0, 0xde, 0xdf);
+        for (auto it = value.cbegin(); it != value.cend(); ++it) {
+          appendString(buffer, it.key());
+          toMessagePack(it.value(), buffer);
+        }
+        break;
+      default:
+        throw std::runtime_error("MessagePack: cannot encode value");
+    }
+    return;
+  }
+
+  std::string toMessagePack(const json& value)
+  {
+    std::string buffer;
+    toMessagePack(value, buffer);
+    return buffer;
+  }
+
+  class MessagePackReader
+  {
+  public:
+    MessagePackReader(const uint8_t *data, size_t size)
+      : _data(data),
+        _size(size),
+        _pos(0)
+    {
+    }
+
+    bool atEnd() const
+    {
+      return _pos == _size;
+    }
+
+    uint64_t readBigEndian(size_t size)
+    {
+      require(size);
+      uint64_t value = 0;
+      for (size_t i = 0; i < size; ++i) {
+        value = (value << 8) | _data[_pos++];
+      }
+      return value;
+    }
+
+    std::string readString(size_t size)
+    {
+      require(size);
+      const std::string value(reinterpret_cast<const char *>(_data + _pos), size);
+      _pos += size;
+      return value;
+    }
+
+    json readValue(unsigned depth)
+    {
+      if (depth > G_msgpack_depth_max) {
+        throw std::runtime_error("MessagePack: nesting too deep");
+      }
+
+      const uint8_t type = static_cast<uint8_t>(readBigEndian(1));
+
+      if (type <= 0x7f) {
+        return json(static_cast<uint64_t>(type));
+      }
+      if (type >= 0xe0) {
+        return json(static_cast<int64_t>(static_cast<int8_t>(type)));
+      }
+      if ((type & 0xe0) == 0xa0) {
+        return json(readString(type & 0x1f));
+      }
+      if ((type & 0xf0) == 0x90) {
+        return readArray(type & 0x0f, depth);
+      }
+      if ((type & 0xf0) == 0x80) {
+        return readMap(type & 0x0f, depth);
+      }
+
+      switch(type) {
+        case 0xc0:
+          return json();
+        case 0xc2:
+          return json(false);
+        case 0xc3:
+          return json(true);
+        case 0xca:
+          {
+            const uint32_t bits = static_cast<uint32_t>(readBigEndian(4));
+            float number = 0;
+            memcpy(&number, &bits, sizeof number);
+            return json(static_cast<double>(number));
+          }
+        case 0xcb:
+          {
+            const uint64_t bits = readBigEndian(8);
+            double number = 0;
+            memcpy(&number, &bits, sizeof number);
+            return json(number);
+          }
+        case 0xcc:
+          return json(readBigEndian(1));
+        case 0xcd:
+          return json(readBigEndian(2));
+        case 0xce:
+          return json(readBigEndian(4));
+        case 0xcf:
+          return json(readBigEndian(8));
+        case 0xd0:
+          return json(static_cast<int64_t>(static_cast<int8_t>(readBigEndian(1))));
+        case 0xd1:
+          return json(static_cast<int64_t>(static_cast<int16_t>(readBigEndian(2))));
+        case 0xd2:
+          return json(static_cast<int64_t>(static_cast<int32_t>(readBigEndian(4))));
+        case 0xd3:
+          return json(static_cast<int64_t>(readBigEndian(8)));
+        case 0xd9:
+          return json(readString(readBigEndian(1)));
+        case 0xda:
+          return json(readString(readBigEndian(2)));
+        case 0xdb:
+          return json(readString(readBigEndian(4)));
+        case 0xdc:
+          return readArray(readBigEndian(2), depth);
+        case 0xdd:
+          return readArray(readBigEndian(4), depth);
+        case 0xde:
+          return readMap(readBigEndian(2), depth);
+        case 0xdf:
+          return readMap(readBigEndian(4), depth);
+        default:
+          throw std::runtime_error("MessagePack: unsupported type");
+      }
+    }
+
+  private:
+    void require(size_t size) const
+    {
+      if (size > _size - _pos) {
+        throw std::runtime_error("MessagePack: truncated input");
+      }
+    }
+
+    json readArray(size_t count, unsigned depth)
+    {
+      /* Each item takes at least one byte */
+      require(count);
+      json value = json::array();
+      for (size_t i = 0; i < count; ++i) {
+        value.push_back(readValue(depth + 1));
+      }
+      return value;
+    }
+
+    json readMap(size_t count, unsigned depth)
+    {
+      /* Each key and value takes at least one byte */
+      require(count);
+      require(count * 2);
+      json value = json::object();
+      for (size_t i = 0; i < count; ++i) {
+        const json key = readValue(depth + 1);
+        if (!key.is_string()) {
+          throw std::runtime_error("MessagePack: map key is not a string");
+        }
+        value[key.get<std::string>()] = readValue(depth + 1);
+      }
+      return value;
+    }
+
+    const uint8_t *_data;
+    const size_t _size;
+    size_t _pos;
+  };
+
+  json fromMessagePack(const void *data, size_t size)
+  {
+    MessagePackReader reader(static_cast<const uint8_t *>(data), size);
+    json value = reader.readValue(0);
+
+    if (!reader.atEnd()) {
+      throw std::runtime_error("MessagePack: trailing data");
+    }
+
+    return value;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,40 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include "Typedefs.hpp"
+#include "Common/JSON.hpp"
+#include <cstddef>
+
+namespace usbguard
+{
+  /*
+   * MessagePack encoding of JSON values. Integers keep their
+   * signedness, floating point numbers are encoded as 64-bit
+   * values and the binary and extension types are not used.
+   */
+  std::string toMessagePack(const json& value);
+  void toMessagePack(const json& value, std::string& buffer);
+
+  /*
+   * Decode a single MessagePack value occupying the whole
+   * buffer. Throws std::runtime_error on malformed input.
+   */
+  json fromMessagePack(const void *data, size_t size);
+} /* namespace usbguard */
@@ -0,0 +1,44 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "LatencyStatistics.hpp"
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace usbguard {
+  /**
+   * Compact point-in-time copy of the daemon metrics, returned by a
+   * single IPC call (see Interface::getMetricsSnapshot). The values
+   * are totals since the daemon started; rates are computed by the
+   * client from two snapshots.
+   */
+  struct MetricsSnapshot
+  {
+    uint64_t time_ms; /**< Monotonic time of the snapshot in the daemon (milliseconds) */
+    std::map<std::string, uint64_t> counters; /**< Daemon counters, by their metrics endpoint name */
+    std::map<std::string, uint64_t> gauges; /**< Current values: rules, devices, ipc_clients and queue depths */
+    std::map<std::string, uint64_t> ipc_requests; /**< Calls of each IPC method */
+    std::vector<LatencyStatistics> latency; /**< See LatencyStatistics::get() */
+    std::vector<Rule::Statistics> hottest_rules; /**< The most applied rules, the most applied one first */
+  };
+} /* namespace usbguard */
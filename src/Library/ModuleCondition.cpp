@@ -0,0 +1,257 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "ModuleCondition.hpp"
+#include "LoggerPrivate.hpp"
+#include <dlfcn.h>
+#include <stdexcept>
+
+namespace usbguard
+{
+  static std::mutex modules_mutex;
+  static std::map<String, Pointer<ConditionModule>> modules;
+
+  ConditionModule::ConditionModule(const String& path, void *handle, const usbguard_condition_module *descriptor,
+                                   void *state)
+    : _path(path),
+      _handle(handle),
+      _descriptor(descriptor),
+      _identifier(descriptor->identifier),
+      _state(state)
+  {
+  }
+
+  /*
+   * The module stays mapped: code of the module may still be
+   * referenced while the process exits.
+   */
+  ConditionModule::~ConditionModule()
+  {
+    if (_descriptor->fini != nullptr) {
+      _descriptor->fini(_state);
+    }
+  }
+
+  void ConditionModule::load(const String& path)
+  {
+    void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (handle == nullptr) {
+      throw std::runtime_error("Cannot load the rule condition module " + path + ": " + dlerror());
+    }
+
+    const auto entry = reinterpret_cast<usbguard_condition_module_fn>(\
+      dlsym(handle, USBGUARD_CONDITION_MODULE_SYMBOL));
+    const usbguard_condition_module *descriptor = entry != nullptr ? entry() : nullptr;
+
+    if (descriptor == nullptr || descriptor->abi_version != USBGUARD_CONDITION_MODULE_ABI) {
+      dlclose(handle);
+      throw std::runtime_error("Incompatible rule condition module " + path);
+    }
+    if (descriptor->identifier == nullptr || descriptor->identifier[0] == '\0' ||
+        descriptor->evaluate_many == nullptr || descriptor->cost > USBGUARD_CONDITION_COST_QUERY) {
+      dlclose(handle);
+      throw std::runtime_error("Invalid descriptor of the rule condition module " + path);
+    }
+
+    const String identifier(descriptor->identifier);
+    std::unique_lock<std::mutex> lock(modules_mutex);
+
+    if (RuleCondition::isBuiltin(identifier) || modules.count(identifier) > 0) {
+      dlclose(handle);
+      throw std::runtime_error("Rule condition module " + path + ": the condition " + identifier + " already exists");
+    }
+
+    void *state = nullptr;
+
+    if (descriptor->init != nullptr && descriptor->init(&state) != 0) {
+      dlclose(handle);
+      throw std::runtime_error("Rule condition module " + path + ": initialization failed");
+    }
+
+    modules.emplace(identifier, Pointer<ConditionModule>(new ConditionModule(path, handle, descriptor, state)));
+    logger->info("Loaded the rule condition module {} ({})", identifier, path);
+  }
+
+  Pointer<ConditionModule> ConditionModule::find(const String& identifier)
+  {
+    std::unique_lock<std::mutex> lock(modules_mutex);
+    auto it = modules.find(identifier);
+    return it != modules.end() ? it->second : nullptr;
+  }
+
+  StringVector ConditionModule::identifiers()
+  {
+    std::unique_lock<std::mutex> lock(modules_mutex);
+    StringVector result;
+
+    for (auto const& entry : modules) {
+      result.push_back(entry.first);
+    }
+    return result;
+  }
+
+  const String& ConditionModule::identifier() const
+  {
+    return _identifier;
+  }
+
+  bool ConditionModule::isPure() const
+  {
+    return (_descriptor->flags & USBGUARD_CONDITION_PURE) != 0;
+  }
+
+  RuleCondition::Cost ConditionModule::cost() const
+  {
+    return static_cast<RuleCondition::Cost>(_descriptor->cost);
+  }
+
+  bool ConditionModule::check(const String& parameter)
+  {
+    if (_descriptor->check == nullptr) {
+      return true;
+    }
+    std::unique_lock<std::mutex> lock(_call_mutex);
+    return _descriptor->check(_state, parameter.c_str()) == 0;
+  }
+
+  void ConditionModule::registerParameter(uint32_t key, const String& parameter)
+  {
+    std::unique_lock<std::mutex> lock(_parameters_mutex);
+    auto it = _parameters.find(key);
+
+    if (it == _parameters.end()) {
+      _parameters.emplace(key, Parameter { parameter, 1 });
+    }
+    else {
+      ++it->second.references;
+    }
+  }
+
+  void ConditionModule::unregisterParameter(uint32_t key)
+  {
+    std::unique_lock<std::mutex> lock(_parameters_mutex);
+    auto it = _parameters.find(key);
+
+    if (it != _parameters.end() && --it->second.references == 0) {
+      _parameters.erase(it);
+    }
+  }
+
+  void ConditionModule::evaluateMany(const std::vector<const char *>& parameters, std::vector<uint8_t>& results)
+  {
+    results.assign(parameters.size(), 0);
+    std::unique_lock<std::mutex> lock(_call_mutex);
+
+    if (_descriptor->evaluate_many(_state, parameters.data(), parameters.size(), results.data()) != 0) {
+      logger->error("Rule condition module {}: evaluation failed", _identifier);
+      results.assign(parameters.size(), 0);
+    }
+  }
+
+  bool ConditionModule::evaluate(const String& parameter)
+  {
+    std::vector<uint8_t> results;
+    evaluateMany({ parameter.c_str() }, results);
+    return results[0] != 0;
+  }
+
+  void ConditionModule::evaluateAll(RuleCondition::EvaluationMemo& memo)
+  {
+    std::vector<uint32_t> keys;
+    std::vector<String> values;
+    {
+      std::unique_lock<std::mutex> lock(_parameters_mutex);
+      for (auto const& entry : _parameters) {
+        if (memo.count(entry.first) == 0) {
+          keys.push_back(entry.first);
+          values.push_back(entry.second.value);
+        }
+      }
+    }
+
+    std::vector<const char *> parameters;
+    std::vector<uint8_t> results;
+
+    for (auto const& value : values) {
+      parameters.push_back(value.c_str());
+    }
+    evaluateMany(parameters, results);
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+      memo.emplace(keys[i], results[i] != 0);
+    }
+  }
+
+  ModuleCondition::ModuleCondition(const Pointer<ConditionModule>& module, const String& parameter, bool negated)
+    : RuleCondition(module->identifier(), parameter, negated),
+      _module(module)
+  {
+    if (!_module->check(parameter)) {
+      throw std::runtime_error("Invalid parameter of the rule condition " + _module->identifier());
+    }
+    _module->registerParameter(key(), parameter);
+  }
+
+  ModuleCondition::ModuleCondition(const ModuleCondition& rhs)
+    : RuleCondition(rhs),
+      _module(rhs._module)
+  {
+    _module->registerParameter(key(), parameter());
+  }
+
+  ModuleCondition::~ModuleCondition()
+  {
+    _module->unregisterParameter(key());
+  }
+
+  bool ModuleCondition::update(const Rule& rule)
+  {
+    (void)rule;
+    return _module->evaluate(parameter());
+  }
+
+  /*
+   * The first condition of the module evaluated in a matching pass
+   * evaluates the others as well.
+   */
+  void ModuleCondition::updateMany(const Rule& rule, EvaluationMemo& memo)
+  {
+    (void)rule;
+    _module->evaluateAll(memo);
+
+    if (memo.count(key()) == 0) {
+      memo.emplace(key(), _module->evaluate(parameter()));
+    }
+  }
+
+  bool ModuleCondition::isMemoizable() const
+  {
+    return _module->isPure();
+  }
+
+  RuleCondition::Cost ModuleCondition::cost() const
+  {
+    return _module->cost();
+  }
+
+  RuleCondition * ModuleCondition::clone() const
+  {
+    return new ModuleCondition(*this);
+  }
+} /* namespace usbguard */
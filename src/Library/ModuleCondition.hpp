@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "RuleCondition.hpp"
+#include "ConditionModule.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace usbguard
+{
+  /*
+   * A rule condition implemented by a loaded module, see
+   * ConditionModule.h. The parameters of the conditions in use are
+   * registered with the module, so that a pure module evaluates all
+   * of them with one call per matching pass.
+   */
+  class DLL_PUBLIC ConditionModule
+  {
+  public:
+    ~ConditionModule();
+
+    /*
+     * Load the module at `path' and register its condition.
+     * Throws if the module can't be loaded, has a different ABI
+     * version or its identifier is already in use.
+     */
+    static void load(const String& path);
+
+    /* The module implementing the condition, or nullptr */
+    static Pointer<ConditionModule> find(const String& identifier);
+
+    /* Identifiers of the loaded modules */
+    static StringVector identifiers();
+
+    const String& identifier() const;
+    bool isPure() const;
+    RuleCondition::Cost cost() const;
+    bool check(const String& parameter);
+
+    void registerParameter(uint32_t key, const String& parameter);
+    void unregisterParameter(uint32_t key);
+
+    /* Evaluate one parameter */
+    bool evaluate(const String& parameter);
+
+    /*
+     * Evaluate all the registered parameters which aren't in the
+     * memo yet and store the results into it.
+     */
+    void evaluateAll(RuleCondition::EvaluationMemo& memo);
+
+  private:
+    ConditionModule(const String& path, void *handle, const usbguard_condition_module *descriptor, void *state);
+    void evaluateMany(const std::vector<const char *>& parameters, std::vector<uint8_t>& results);
+
+    const String _path;
+    void * const _handle;
+    const usbguard_condition_module * const _descriptor;
+    const String _identifier;
+    void *_state;
+
+    /* Serializes the calls of the module functions */
+    std::mutex _call_mutex;
+
+    struct Parameter
+    {
+      String value;
+      size_t references;
+    };
+
+    std::mutex _parameters_mutex;
+    std::map<uint32_t, Parameter> _parameters;
+  };
+
+  class ModuleCondition : public RuleCondition
+  {
+  public:
+    ModuleCondition(const Pointer<ConditionModule>& module, const String& parameter, bool negated = false);
+    ModuleCondition(const ModuleCondition& rhs);
+    ~ModuleCondition();
+    bool update(const Rule& rule);
+    void updateMany(const Rule& rule, EvaluationMemo& memo);
+    bool isMemoizable() const;
+    Cost cost() const;
+    RuleCondition * clone() const;
+
+  private:
+    const Pointer<ConditionModule> _module;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,384 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "PolicyBundle.hpp"
+#include "RuleCache.hpp"
+#include "RuleSetDiff.hpp"
+#include "Hash.hpp"
+#include "Common/Utility.hpp"
+#include "Common/ByteStream.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace usbguard {
+  static const char bundle_magic[8] = { 'U', 'S', 'B', 'G', 'P', 'B', 'D', 'L' };
+  static const uint32_t bundle_version = 1;
+  static const uint32_t bundle_byte_order_mark = 0x01020304;
+
+  static String payloadHash(const uint8_t *data, size_t size)
+  {
+    Hash hash(Hash::Algorithm::SHA256);
+    hash.update(data, size);
+    return hash.getBase64();
+  }
+
+  static String rulesHash(const std::vector<Rule>& rules)
+  {
+    ByteWriter writer;
+
+    writer.u32(rules.size());
+    for (auto const& rule : rules) {
+      RuleCache::writeRule(writer, rule);
+    }
+
+    const String& payload = writer.data();
+    return payloadHash(reinterpret_cast<const uint8_t *>(payload.c_str()), payload.size());
+  }
+
+  static String signature(const uint8_t *data, size_t size, const String& key)
+  {
+    Hash hash(Hash::Algorithm::SHA256, key);
+    hash.update(data, size);
+    return hash.getBase64();
+  }
+
+  /*
+   * Compare the signatures in constant time, so that the time
+   * of a failed verification doesn't depend on the position of
+   * the first wrong byte.
+   */
+  static bool signaturesEqual(const String& a, const String& b)
+  {
+    if (a.size() != b.size()) {
+      return false;
+    }
+
+    uint8_t difference = 0;
+
+    for (size_t i = 0; i < a.size(); ++i) {
+      difference |= static_cast<uint8_t>(a[i] ^ b[i]);
+    }
+    return difference == 0;
+  }
+
+  PolicyBundle::PolicyBundle()
+    : _type(Type::Full),
+      _version(0),
+      _base_version(0)
+  {
+  }
+
+  PolicyBundle::PolicyBundle(uint64_t version, const std::vector<Rule>& rules)
+    : _type(Type::Full),
+      _version(version),
+      _base_version(0)
+  {
+    for (auto const& rule : rules) {
+      _rules.push_back(rule);
+      _rules.back().setRuleID(Rule::DefaultID);
+    }
+    _hash = rulesHash(_rules);
+  }
+
+  PolicyBundle::PolicyBundle(uint64_t version, const PolicyBundle& base, const std::vector<Rule>& rules)
+    : _type(Type::Delta),
+      _version(version),
+      _base_version(base._version),
+      _base_hash(base._hash)
+  {
+    if (base._type != Type::Full) {
+      throw std::runtime_error("Policy bundle: the base of a delta bundle has to be a full bundle");
+    }
+
+    /*
+     * The base rules get ids from 1, so the rule id of an operation
+     * is the base rule index plus one and the parent id of a new rule
+     * is the number of the base rules which precede it.
+     */
+    PointerVector<const Rule> base_rules;
+
+    for (size_t i = 0; i < base._rules.size(); ++i) {
+      Rule rule = base._rules[i];
+      rule.setRuleID(i + 1);
+      base_rules.push_back(makePointer<const Rule>(std::move(rule)));
+    }
+
+    const RuleSetDiff diff(base_rules, rules);
+
+    for (auto const& operation : diff.operations()) {
+      if (operation.type == RuleSet::Operation::Type::Remove) {
+        _removed.push_back(operation.id - 1);
+      }
+      else {
+        _rules.push_back(operation.rule);
+        _positions.push_back(operation.parent_id);
+      }
+    }
+
+    /* RuleSetDiff lists the new rules in the reverse order */
+    std::reverse(_rules.begin(), _rules.end());
+    std::reverse(_positions.begin(), _positions.end());
+
+    std::vector<Rule> target_rules(rules);
+
+    for (auto& rule : target_rules) {
+      rule.setRuleID(Rule::DefaultID);
+    }
+    _hash = rulesHash(target_rules);
+  }
+
+  static PolicyBundle::Type readType(ByteReader& reader)
+  {
+    const uint8_t type = reader.u8();
+
+    if (type > static_cast<uint8_t>(PolicyBundle::Type::Delta)) {
+      throw std::runtime_error("Policy bundle: invalid bundle type");
+    }
+    return static_cast<PolicyBundle::Type>(type);
+  }
+
+  PolicyBundle PolicyBundle::load(const String& path, const String& key)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+      throw std::runtime_error("Cannot open the policy bundle " + path + ": " + strerror(errno));
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot read the policy bundle " + path);
+    }
+
+    void * const mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+      throw std::runtime_error("Cannot map the policy bundle " + path + ": " + strerror(errno));
+    }
+
+    const uint8_t * const data = static_cast<const uint8_t *>(mapping);
+    const size_t size = st.st_size;
+    PolicyBundle bundle;
+
+    try {
+      ByteReader reader(data, size);
+      char magic[sizeof bundle_magic];
+
+      reader.bytes(magic, sizeof magic);
+      if (std::memcmp(magic, bundle_magic, sizeof magic) != 0) {
+        throw std::runtime_error("Policy bundle: not a policy bundle");
+      }
+      if (reader.u32() != bundle_version) {
+        throw std::runtime_error("Policy bundle: unsupported format version");
+      }
+      if (reader.u32() != bundle_byte_order_mark) {
+        throw std::runtime_error("Policy bundle: the bundle was created on a host with a different byte order");
+      }
+
+      bundle._type = readType(reader);
+      bundle._version = reader.u64();
+      bundle._hash = reader.string();
+      bundle._base_version = reader.u64();
+      bundle._base_hash = reader.string();
+
+      const size_t payload_offset = size - reader.remaining();
+
+      if (bundle._type == Type::Full) {
+        const uint32_t count = reader.u32();
+        for (uint32_t i = 0; i < count; ++i) {
+          bundle._rules.push_back(RuleCache::readRule(reader));
+        }
+      }
+      else {
+        const uint32_t removed_count = reader.u32();
+        for (uint32_t i = 0; i < removed_count; ++i) {
+          bundle._removed.push_back(reader.u32());
+        }
+        const uint32_t inserted_count = reader.u32();
+        for (uint32_t i = 0; i < inserted_count; ++i) {
+          bundle._positions.push_back(reader.u32());
+          bundle._rules.push_back(RuleCache::readRule(reader));
+        }
+      }
+
+      const size_t signed_size = size - reader.remaining();
+      const String bundle_signature = reader.string();
+
+      if (!reader.empty()) {
+        throw std::runtime_error("Policy bundle: trailing data");
+      }
+
+      if (!key.empty()) {
+        if (bundle_signature.empty()) {
+          throw std::runtime_error("Policy bundle: the bundle isn't signed");
+        }
+        if (!signaturesEqual(bundle_signature, signature(data, signed_size, key))) {
+          throw std::runtime_error("Policy bundle: invalid signature");
+        }
+      }
+
+      /*
+       * The payload of a full bundle is hashed as stored. A delta
+       * bundle is verified when it's applied to its base.
+       */
+      if (bundle._type == Type::Full &&
+          payloadHash(data + payload_offset, signed_size - payload_offset) != bundle._hash) {
+        throw std::runtime_error("Policy bundle: the rules don't match the policy hash");
+      }
+    }
+    catch(...) {
+      ::munmap(mapping, size);
+      throw;
+    }
+
+    ::munmap(mapping, size);
+    return bundle;
+  }
+
+  void PolicyBundle::save(const String& path, const String& key) const
+  {
+    ByteWriter writer;
+
+    for (auto c : bundle_magic) {
+      writer.u8(c);
+    }
+    writer.u32(bundle_version);
+    writer.u32(bundle_byte_order_mark);
+    writer.u8(static_cast<uint8_t>(_type));
+    writer.u64(_version);
+    writer.string(_hash);
+    writer.u64(_base_version);
+    writer.string(_base_hash);
+
+    if (_type == Type::Full) {
+      writer.u32(_rules.size());
+      for (auto const& rule : _rules) {
+        RuleCache::writeRule(writer, rule);
+      }
+    }
+    else {
+      writer.u32(_removed.size());
+      for (auto index : _removed) {
+        writer.u32(index);
+      }
+      writer.u32(_rules.size());
+      for (size_t i = 0; i < _rules.size(); ++i) {
+        writer.u32(_positions[i]);
+        RuleCache::writeRule(writer, _rules[i]);
+      }
+    }
+
+    if (key.empty()) {
+      writer.string(String());
+    }
+    else {
+      const String& data = writer.data();
+      writer.string(signature(reinterpret_cast<const uint8_t *>(data.c_str()), data.size(), key));
+    }
+
+    if (!writeFileAtomically(path, writer.data())) {
+      throw std::runtime_error("Cannot store the policy bundle " + path);
+    }
+    return;
+  }
+
+  PolicyBundle PolicyBundle::applyTo(const PolicyBundle& base) const
+  {
+    if (_type != Type::Delta || base._type != Type::Full) {
+      throw std::runtime_error("Policy bundle: a delta bundle applies only to a full bundle");
+    }
+    if (base._version != _base_version || base._hash != _base_hash) {
+      throw std::runtime_error("Policy bundle: the delta bundle of version " + std::to_string(_version) +
+                               " doesn't apply to version " + std::to_string(base._version));
+    }
+
+    const size_t base_count = base._rules.size();
+    std::vector<bool> removed(base_count, false);
+
+    for (auto index : _removed) {
+      if (index >= base_count) {
+        throw std::runtime_error("Policy bundle: invalid removed rule index");
+      }
+      removed[index] = true;
+    }
+
+    std::vector<Rule> rules;
+    size_t next = 0;
+
+    for (size_t position = 0; position <= base_count; ++position) {
+      while (next < _rules.size() && _positions[next] == position) {
+        rules.push_back(_rules[next++]);
+      }
+      if (position < base_count && !removed[position]) {
+        rules.push_back(base._rules[position]);
+      }
+    }
+
+    if (next != _rules.size()) {
+      throw std::runtime_error("Policy bundle: invalid inserted rule position");
+    }
+
+    PolicyBundle result(_version, rules);
+
+    if (result._hash != _hash) {
+      throw std::runtime_error("Policy bundle: the result of the delta bundle doesn't match the policy hash");
+    }
+    return result;
+  }
+
+  PolicyBundle::Type PolicyBundle::getType() const
+  {
+    return _type;
+  }
+
+  uint64_t PolicyBundle::getVersion() const
+  {
+    return _version;
+  }
+
+  const String& PolicyBundle::getHash() const
+  {
+    return _hash;
+  }
+
+  uint64_t PolicyBundle::getBaseVersion() const
+  {
+    return _base_version;
+  }
+
+  const String& PolicyBundle::getBaseHash() const
+  {
+    return _base_hash;
+  }
+
+  const std::vector<Rule>& PolicyBundle::getRules() const
+  {
+    return _rules;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Precompiled policy meant to be distributed to many hosts. The
+   * rules are stored in the binary form of the rule cache, so that
+   * loading a bundle doesn't invoke the rule parser:
+   *
+   *   header     magic "USBGPBDL", u32 format version, u32 byte order
+   *              mark, u8 type, u64 policy version, policy hash,
+   *              u64 base version, base hash
+   *   payload    full bundle: u32 rule count, rules
+   *              delta bundle: u32 removed count, the indexes of the
+   *              removed base rules, u32 inserted count, (u32 position,
+   *              rule) pairs
+   *   signature  HMAC-SHA256 of everything before it, empty if the
+   *              bundle isn't signed
+   *
+   * The policy hash is the SHA-256 hash of the payload of the full
+   * bundle of the policy version. A delta bundle applies only to the
+   * full bundle of its base version with the base hash, and the rules
+   * it results in are verified against its policy hash.
+   */
+  class DLL_PUBLIC PolicyBundle
+  {
+  public:
+    enum class Type : uint8_t {
+      Full = 0,
+      Delta = 1
+    };
+
+    /*
+     * Full bundle of the `rules'.
+     */
+    PolicyBundle(uint64_t version, const std::vector<Rule>& rules);
+
+    /*
+     * Delta bundle which turns the full bundle `base' into a full bundle
+     * of the `rules'. Only the rules which differ are stored, see
+     * RuleSetDiff.
+     */
+    PolicyBundle(uint64_t version, const PolicyBundle& base, const std::vector<Rule>& rules);
+
+    /*
+     * Read a bundle from a memory mapped file. If `key' isn't empty,
+     * the bundle has to be signed with it. Throws an exception if the
+     * bundle cannot be read or verified.
+     */
+    static PolicyBundle load(const String& path, const String& key = String());
+
+    /*
+     * Store the bundle, signed with `key' if it isn't empty.
+     * Throws an exception on failure.
+     */
+    void save(const String& path, const String& key = String()) const;
+
+    /*
+     * Apply a delta bundle to the full bundle of its base version.
+     * Throws an exception if `base' isn't the base of this bundle or
+     * if the result doesn't match the policy hash.
+     */
+    PolicyBundle applyTo(const PolicyBundle& base) const;
+
+    Type getType() const;
+    uint64_t getVersion() const;
+    const String& getHash() const;
+    uint64_t getBaseVersion() const;
+    const String& getBaseHash() const;
+
+    /*
+     * The rules of a full bundle, or the inserted rules of a delta
+     * bundle.
+     */
+    const std::vector<Rule>& getRules() const;
+
+  private:
+    PolicyBundle();
+
+    Type _type;
+    uint64_t _version;
+    String _hash;
+    uint64_t _base_version;
+    String _base_hash;
+    std::vector<Rule> _rules;
+    std::vector<uint32_t> _removed;
+    std::vector<uint32_t> _positions;
+  };
+} /* namespace usbguard */
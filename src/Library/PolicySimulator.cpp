@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "PolicySimulator.hpp"
+#include "Common/ThreadPool.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace usbguard {
+  /*
+   * Parsing the rules once more for a thread costs about as much as
+   * matching a few hundred devices, so smaller parts aren't worth it.
+   */
+  static const size_t devices_per_thread = 256;
+
+  PolicySimulator::PolicySimulator(const String& rules, Rule::Target default_target, Interface * const interface_ptr)
+    : _rules(rules),
+      _default_target(default_target),
+      _interface_ptr(interface_ptr)
+  {
+    _ruleset = parseRules();
+  }
+
+  Pointer<RuleSet> PolicySimulator::parseRules() const
+  {
+    auto ruleset = makePointer<RuleSet>(_interface_ptr);
+    std::istringstream stream(_rules);
+
+    ruleset->load(stream);
+    ruleset->setDefaultTarget(_default_target);
+
+    return ruleset;
+  }
+
+  std::vector<PolicySimulator::Decision> PolicySimulator::evaluate(const std::vector<Device>& devices) const
+  {
+    std::vector<Decision> decisions(devices.size());
+    const size_t thread_count = \
+      std::min(ThreadPool::defaultThreadCount(), (devices.size() + devices_per_thread - 1) / devices_per_thread);
+
+    if (thread_count <= 1) {
+      evaluateRange(*_ruleset, devices, 0, devices.size(), decisions);
+      return decisions;
+    }
+
+    const size_t range_size = (devices.size() + thread_count - 1) / thread_count;
+
+    ThreadPool::shared().parallelFor(thread_count, [&](size_t i) {
+      const size_t begin = i * range_size;
+      const size_t end = std::min(devices.size(), begin + range_size);
+      /* The first range reuses the rule set parsed by the constructor */
+      const Pointer<RuleSet> ruleset = (i == 0 ? _ruleset : parseRules());
+      evaluateRange(*ruleset, devices, begin, end, decisions);
+    }, thread_count);
+
+    return decisions;
+  }
+
+  void PolicySimulator::evaluateRange(const RuleSet& ruleset, const std::vector<Device>& devices,
+                                      size_t begin, size_t end, std::vector<Decision>& decisions) const
+  {
+    for (size_t i = begin; i < end; ++i) {
+      const Device& device = devices[i];
+      const Pointer<Rule> matched_rule = ruleset.getFirstMatchingRule(device.device_rule);
+      Decision& decision = decisions[i];
+
+      decision.id = device.device_rule->getRuleID();
+      decision.device_rule = device.device_rule;
+      decision.current_target = device.target;
+      decision.current_rule_id = device.rule_id;
+      decision.target = matched_rule->getTarget();
+      decision.rule_id = matched_rule->getRuleID();
+    }
+    return;
+  }
+
+  size_t PolicySimulator::ruleCount() const
+  {
+    return _ruleset->getRules().size();
+  }
+} /* namespace usbguard */
@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "RuleSet.hpp"
+#include <vector>
+
+namespace usbguard {
+  class Interface;
+
+  /*
+   * Evaluate a candidate rule set against a list of devices without
+   * applying anything. The devices are matched the same way as by
+   * the daemon (RuleSet::getFirstMatchingRule), so the decisions are
+   * those the daemon would make after loading the rules. The rules
+   * are evaluated in a private rule set, so the condition state of
+   * the running policy isn't touched.
+   *
+   * Large device lists are split between the threads of the shared
+   * pool. The matching is serialized within a rule set, so each
+   * thread evaluates its part with its own copy of the candidate
+   * rules.
+   */
+  class DLL_PUBLIC PolicySimulator
+  {
+  public:
+    /*
+     * A device with its current decision. rule_id is Rule::DefaultID
+     * if the rule which decided the target isn't known.
+     */
+    struct Device {
+      Pointer<const Rule> device_rule;
+      Rule::Target target;
+      uint32_t rule_id;
+    };
+
+    struct Decision {
+      uint32_t id;
+      Pointer<const Rule> device_rule;
+      Rule::Target current_target;
+      uint32_t current_rule_id;
+      Rule::Target target;
+      uint32_t rule_id; /* Rule::DefaultID if decided by the default target */
+
+      bool changed() const
+      {
+        return target != current_target;
+      }
+    };
+
+    /*
+     * Parse the candidate rules. Throws RuleParserError if they're
+     * not valid.
+     */
+    PolicySimulator(const String& rules, Rule::Target default_target, Interface * const interface_ptr = nullptr);
+
+    /*
+     * The decisions for all the devices, in the order of `devices'.
+     */
+    std::vector<Decision> evaluate(const std::vector<Device>& devices) const;
+
+    size_t ruleCount() const;
+
+  private:
+    Pointer<RuleSet> parseRules() const;
+    void evaluateRange(const RuleSet& ruleset, const std::vector<Device>& devices,
+                       size_t begin, size_t end, std::vector<Decision>& decisions) const;
+
+    String _rules;
+    Rule::Target _default_target;
+    Interface * const _interface_ptr;
+    Pointer<RuleSet> _ruleset;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,220 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include <map>
+#include <vector>
+#include <functional>
+
+namespace usbguard {
+  /*
+   * Map keyed by USB port names, e.g. "1-2.3.4", stored as a trie
+   * of the port path components ("1", "-2", ".3", ".4"). A lookup
+   * costs O(port length) and all the values stored under a port,
+   * i.e. for the port itself and the ports of the devices behind
+   * it, can be visited without a scan of the whole map. The nodes
+   * are kept in a vector, so that copies of the trie are plain
+   * copies. Nodes of removed values are reused when the same port
+   * is inserted again.
+   */
+  template<class T>
+  class PortTrie
+  {
+  public:
+    PortTrie()
+    {
+      clear();
+    }
+
+    void clear()
+    {
+      _nodes.assign(1, Node());
+      _size = 0;
+      return;
+    }
+
+    /*
+     * Return the value stored for the port. A default constructed
+     * value is inserted if there's none.
+     */
+    T& operator[](const String& port)
+    {
+      size_t node = 0;
+
+      forEachComponent(port, [this, &node](const String& component) {
+        auto it = _nodes[node].children.find(component);
+        if (it == _nodes[node].children.end()) {
+          _nodes.push_back(Node());
+          it = _nodes[node].children.emplace(component, _nodes.size() - 1).first;
+        }
+        node = it->second;
+        return true;
+      });
+
+      Node& target = _nodes[node];
+
+      if (!target.has_value) {
+        target.has_value = true;
+        target.value = T();
+        ++_size;
+      }
+
+      return target.value;
+    }
+
+    /*
+     * Return the value stored for the port or nullptr.
+     */
+    const T* find(const String& port) const
+    {
+      const size_t node = findNode(port);
+
+      if (node == npos || !_nodes[node].has_value) {
+        return nullptr;
+      }
+      return &_nodes[node].value;
+    }
+
+    T* find(const String& port)
+    {
+      return const_cast<T*>(static_cast<const PortTrie<T>*>(this)->find(port));
+    }
+
+    /*
+     * Remove the value stored for the port. Returns false if
+     * there was none.
+     */
+    bool erase(const String& port)
+    {
+      const size_t node = findNode(port);
+
+      if (node == npos || !_nodes[node].has_value) {
+        return false;
+      }
+
+      _nodes[node].has_value = false;
+      _nodes[node].value = T();
+      --_size;
+      return true;
+    }
+
+    /*
+     * Call `visitor' with the port name and the value of the port
+     * itself and of each port behind it, parents before children,
+     * until the visitor returns false. Ports behind "1-2" are e.g.
+     * "1-2.1" and "1-2.1.4", but not "1-20".
+     */
+    void visitSubtree(const String& port,
+      const std::function<bool(const String&, const T&)>& visitor) const
+    {
+      const size_t node = findNode(port);
+
+      if (node != npos) {
+        String path(port);
+        (void)visitNode(node, path, visitor);
+      }
+      return;
+    }
+
+    size_t size() const
+    {
+      return _size;
+    }
+
+    bool empty() const
+    {
+      return _size == 0;
+    }
+
+  private:
+    struct Node {
+      Node()
+        : has_value(false),
+          value()
+      {
+      }
+
+      std::map<String, size_t> children;
+      bool has_value;
+      T value;
+    };
+
+    static const size_t npos = static_cast<size_t>(-1);
+
+    /*
+     * Split a port name before each '-' and '.' separator.
+     */
+    static void forEachComponent(const String& port, const std::function<bool(const String&)>& callback)
+    {
+      size_t begin = 0;
+
+      while (begin < port.size()) {
+        size_t end = port.find_first_of("-.", begin + 1);
+
+        if (end == String::npos) {
+          end = port.size();
+        }
+        if (!callback(port.substr(begin, end - begin))) {
+          return;
+        }
+        begin = end;
+      }
+      return;
+    }
+
+    size_t findNode(const String& port) const
+    {
+      size_t node = 0;
+
+      forEachComponent(port, [this, &node](const String& component) {
+        auto it = _nodes[node].children.find(component);
+        if (it == _nodes[node].children.end()) {
+          node = npos;
+          return false;
+        }
+        node = it->second;
+        return true;
+      });
+
+      return node;
+    }
+
+    bool visitNode(size_t node, String& path,
+      const std::function<bool(const String&, const T&)>& visitor) const
+    {
+      if (_nodes[node].has_value && !visitor(path, _nodes[node].value)) {
+        return false;
+      }
+
+      for (auto const& child : _nodes[node].children) {
+        const size_t path_size = path.size();
+        path.append(child.first);
+
+        if (!visitNode(child.second, path, visitor)) {
+          return false;
+        }
+        path.resize(path_size);
+      }
+      return true;
+    }
+
+    std::vector<Node> _nodes;
+    size_t _size;
+  };
+} /* namespace usbguard */
@@ -44,6 +44,17 @@ namespace usbguard
     return _rng_dist(_rng_gen);
   }
 
+  RuleCondition::Cost RandomStateCondition::cost() const
+  {
+    return Cost::Cheap;
+  }
+
+  bool RandomStateCondition::hasSideEffects() const
+  {
+    /* Skipping an evaluation only leaves the generator state as is */
+    return false;
+  }
+
   RuleCondition * RandomStateCondition::clone() const
   {
     return new RandomStateCondition(*this);
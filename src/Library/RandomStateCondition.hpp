@@ -30,6 +30,8 @@ namespace usbguard
     RandomStateCondition(const String& true_probability, bool negated = false);
     RandomStateCondition(const RandomStateCondition& rhs);
     bool update(const Rule& rule);
+    Cost cost() const;
+    bool hasSideEffects() const;
     RuleCondition * clone() const;
   private:
     std::random_device _rng_device;
@@ -18,6 +18,8 @@
 //
 #include "RulePrivate.hpp"
 #include "Common/Utility.hpp"
+#include <atomic>
+#include <algorithm>
 
 namespace usbguard {
   template<>
@@ -30,33 +32,81 @@ namespace usbguard {
   const uint32_t Rule::DefaultID = std::numeric_limits<uint32_t>::max();
   const uint32_t Rule::LastID = std::numeric_limits<uint32_t>::max() - 1;
 
+  /*
+   * Shared by default constructed and moved-from rules so that
+   * neither allocates. It is never modified: detach() replaces it
+   * with a fresh instance (and a fresh creation time stamp) first.
+   */
+  static const Pointer<RulePrivate>& emptyRulePrivate()
+  {
+    static const Pointer<RulePrivate> empty = makePointer<RulePrivate>();
+    return empty;
+  }
+
   Rule::Rule()
+    : d_pointer(emptyRulePrivate())
+  {
+  }
+
+  Rule::Rule(const Pointer<RulePrivate>& data)
+    : d_pointer(data)
   {
-    d_pointer = new RulePrivate(*this);
   }
 
   Rule::~Rule()
   {
-    delete d_pointer;
-    d_pointer = nullptr;
   }
 
   Rule::Rule(const Rule& rhs)
+    : d_pointer(rhs.d_pointer)
   {
-    d_pointer = new RulePrivate(*this, *rhs.d_pointer);
   }
 
   const Rule& Rule::operator=(const Rule& rhs)
   {
-    RulePrivate* n_pointer = new RulePrivate(*this, *rhs.d_pointer);
-    delete d_pointer;
-    d_pointer = n_pointer;
+    d_pointer = rhs.d_pointer;
+    return *this;
+  }
+
+  Rule::Rule(Rule&& rhs) noexcept
+    : d_pointer(std::move(rhs.d_pointer))
+  {
+    rhs.d_pointer = emptyRulePrivate();
+  }
+
+  const Rule& Rule::operator=(Rule&& rhs) noexcept
+  {
+    if (this != &rhs) {
+      d_pointer = std::move(rhs.d_pointer);
+      rhs.d_pointer = emptyRulePrivate();
+    }
     return *this;
   }
 
+  RulePrivate* Rule::detach(bool if_shared)
+  {
+    if (d_pointer == emptyRulePrivate()) {
+      d_pointer = makePointer<RulePrivate>();
+    }
+    else if (if_shared) {
+      if (d_pointer.use_count() > 1) {
+        d_pointer = makePointer<RulePrivate>(*d_pointer);
+      }
+      else {
+        /*
+         * Pairs with the release of the last other reference so that
+         * its reads of the data happen before our modifications.
+         */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        d_pointer->setMutable();
+      }
+    }
+    return d_pointer.get();
+  }
+
   void Rule::setRuleID(uint32_t rule_id)
   {
-    d_pointer->setRuleID(rule_id);
+    detach()->setRuleID(rule_id);
   }
 
   uint32_t Rule::getRuleID() const
@@ -66,7 +116,7 @@ namespace usbguard {
  
   void Rule::setTarget(Rule::Target target)
   {
-    d_pointer->setTarget(target);
+    detach()->setTarget(target);
   }
  
   Rule::Target Rule::getTarget() const
@@ -76,7 +126,7 @@ namespace usbguard {
 
   void Rule::setDeviceID(const USBDeviceID& value)
   {
-    d_pointer->setDeviceID(value);
+    detach()->setDeviceID(value);
   }
 
   const USBDeviceID& Rule::getDeviceID() const
@@ -91,12 +141,12 @@ namespace usbguard {
 
   Rule::Attribute<USBDeviceID>& Rule::attributeDeviceID()
   {
-    return d_pointer->attributeDeviceID();
+    return detach()->attributeDeviceID();
   }
 
   void Rule::setSerial(const String& value)
   {
-    d_pointer->setSerial(value);
+    detach()->setSerial(value);
   }
 
   const String& Rule::getSerial() const
@@ -111,12 +161,12 @@ namespace usbguard {
 
   Rule::Attribute<String>& Rule::attributeSerial()
   {
-    return d_pointer->attributeSerial();
+    return detach()->attributeSerial();
   }
 
   void Rule::setName(const String& value)
   {
-    d_pointer->setName(value);
+    detach()->setName(value);
   }
 
   const String& Rule::getName() const
@@ -131,12 +181,12 @@ namespace usbguard {
 
   Rule::Attribute<String>& Rule::attributeName()
   {
-    return d_pointer->attributeName();
+    return detach()->attributeName();
   }
 
   void Rule::setHash(const String& value)
   {
-    d_pointer->setHash(value);
+    detach()->setHash(value);
   }
 
   const String& Rule::getHash() const
@@ -151,12 +201,12 @@ namespace usbguard {
 
   Rule::Attribute<String>& Rule::attributeHash()
   {
-    return d_pointer->attributeHash();
+    return detach()->attributeHash();
   }
 
   void Rule::setParentHash(const String& value)
   {
-    d_pointer->setParentHash(value);
+    detach()->setParentHash(value);
   }
 
   const String& Rule::getParentHash() const
@@ -171,12 +221,12 @@ namespace usbguard {
 
   Rule::Attribute<String>& Rule::attributeParentHash()
   {
-    return d_pointer->attributeParentHash();
+    return detach()->attributeParentHash();
   }
 
   void Rule::setViaPort(const String& value)
   {
-    d_pointer->setViaPort(value);
+    detach()->setViaPort(value);
   }
 
   const String& Rule::getViaPort() const
@@ -191,7 +241,7 @@ namespace usbguard {
 
   Rule::Attribute<String>& Rule::attributeViaPort()
   {
-    return d_pointer->attributeViaPort();
+    return detach()->attributeViaPort();
   }
 
   const Rule::Attribute<USBInterfaceType>& Rule::attributeWithInterface() const
@@ -201,7 +251,7 @@ namespace usbguard {
 
   Rule::Attribute<USBInterfaceType>& Rule::attributeWithInterface()
   {
-    return d_pointer->attributeWithInterface();
+    return detach()->attributeWithInterface();
   }
 
   const Rule::Attribute<RuleCondition*>& Rule::attributeConditions() const
@@ -211,12 +261,12 @@ namespace usbguard {
 
   Rule::Attribute<RuleCondition*>& Rule::attributeConditions()
   {
-    return d_pointer->attributeConditions();
+    return detach()->attributeConditions();
   }
 
   void Rule::setTimeoutSeconds(uint32_t timeout_seconds)
   {
-    d_pointer->setTimeoutSeconds(timeout_seconds);
+    detach()->setTimeoutSeconds(timeout_seconds);
   }
   
   uint32_t Rule::getTimeoutSeconds() const
@@ -224,6 +274,21 @@ namespace usbguard {
     return d_pointer->getTimeoutSeconds();
   }
 
+  void Rule::setGroup(const String& group)
+  {
+    detach()->setGroup(group);
+  }
+
+  const String& Rule::getGroup() const
+  {
+    return d_pointer->getGroup();
+  }
+
+  uint64_t Rule::groupBit(const String& group)
+  {
+    return RulePrivate::groupBit(group);
+  }
+
   bool Rule::appliesTo(Pointer<const Rule> rhs) const
   {
     return appliesTo(*rhs);
@@ -256,9 +321,97 @@ namespace usbguard {
     return d_pointer->toString(invalid);
   }
 
+  void Rule::appendToString(String& rule_string, bool invalid) const
+  {
+    d_pointer->appendToString(rule_string, invalid);
+  }
+
   void Rule::updateMetaDataCounters(bool applied, bool evaluated)
   {
-    d_pointer->updateMetaDataCounters(applied, evaluated);
+    detach(/*if_shared=*/false)->updateMetaDataCounters(applied, evaluated);
+  }
+
+  const size_t Rule::Statistics::MatchTimeBuckets;
+
+  Rule::Statistics::Statistics()
+    : rule_id(Rule::DefaultID),
+      evaluated(0),
+      applied(0),
+      last_evaluated(0),
+      last_applied(0),
+      match_time_histogram(MatchTimeBuckets, 0)
+  {
+  }
+
+  /*
+   * Convert a steady clock time point to wall-clock UNIX time
+   * using the current offset between the two clocks.
+   */
+  static uint64_t toWallClockSeconds(const std::chrono::steady_clock::time_point& tp)
+  {
+    if (tp.time_since_epoch().count() == 0) {
+      return 0;
+    }
+
+    const auto age = std::chrono::steady_clock::now() - tp;
+    const auto tp_wall = std::chrono::system_clock::now() - \
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(age);
+
+    return std::chrono::duration_cast<std::chrono::seconds>(tp_wall.time_since_epoch()).count();
+  }
+
+  Rule::Statistics Rule::getStatistics() const
+  {
+    const auto& metadata = d_pointer->metadata();
+    Statistics statistics;
+    statistics.rule_id = d_pointer->getRuleID();
+    statistics.evaluated = metadata.evaluatedCount();
+    statistics.applied = metadata.appliedCount();
+    statistics.last_evaluated = toWallClockSeconds(metadata.lastEvaluated());
+    statistics.last_applied = toWallClockSeconds(metadata.lastApplied());
+    for (size_t i = 0; i < Statistics::MatchTimeBuckets; ++i) {
+      statistics.match_time_histogram[i] = metadata.match_time_histogram[i].load(std::memory_order_relaxed);
+    }
+    return statistics;
+  }
+
+  size_t Rule::getMemoryUsage() const
+  {
+    return sizeof(Rule) + d_pointer->memoryUsage();
+  }
+
+  /*
+   * The inverse of toWallClockSeconds. A time before the start of
+   * the steady clock is kept as a negative value, zero is reserved
+   * for "never".
+   */
+  static int64_t fromWallClockSeconds(uint64_t seconds)
+  {
+    if (seconds == 0) {
+      return 0;
+    }
+
+    const auto tp_wall = std::chrono::system_clock::time_point(std::chrono::seconds(seconds));
+    const auto age = std::max(std::chrono::system_clock::now() - tp_wall, std::chrono::system_clock::duration::zero());
+    const auto tp = std::chrono::steady_clock::now() - \
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(age);
+    const int64_t ticks = tp.time_since_epoch().count();
+
+    return ticks != 0 ? ticks : -1;
+  }
+
+  void Rule::setStatistics(const Statistics& statistics)
+  {
+    auto& metadata = detach(/*if_shared=*/false)->metadata();
+    metadata.counter_evaluated.store(statistics.evaluated, std::memory_order_relaxed);
+    metadata.counter_applied.store(statistics.applied, std::memory_order_relaxed);
+    metadata.ticks_last_evaluated.store(fromWallClockSeconds(statistics.last_evaluated), std::memory_order_relaxed);
+    metadata.ticks_last_applied.store(fromWallClockSeconds(statistics.last_applied), std::memory_order_relaxed);
+    for (size_t i = 0; i < Statistics::MatchTimeBuckets; ++i) {
+      const uint64_t count = i < statistics.match_time_histogram.size() ? statistics.match_time_histogram[i] : 0;
+      metadata.match_time_histogram[i].store(count, std::memory_order_relaxed);
+    }
+    return;
   }
 
   Rule Rule::fromString(const String& rule_string)
@@ -266,14 +419,19 @@ namespace usbguard {
     return RulePrivate::fromString(rule_string);
   }
 
+  Rule Rule::fromString(const String& rule_string, RuleArena& arena)
+  {
+    return RulePrivate::fromString(rule_string, arena);
+  }
+
   RulePrivate* Rule::internal()
   {
-    return d_pointer;
+    return detach(/*if_shared=*/false);
   }
 
   const RulePrivate* Rule::internal() const
   {
-    return d_pointer;
+    return d_pointer.get();
   }
 
   static const std::vector<std::pair<String,Rule::Target> > target_ttable = {
@@ -20,6 +20,7 @@
 
 #include "Typedefs.hpp"
 #include "USB.hpp"
+#include "InternedString.hpp"
 #include "Predicates.hpp"
 #include "Utility.hpp"
 #include "RuleCondition.hpp"
@@ -42,7 +43,59 @@ namespace usbguard {
   template<>
   String DLL_PUBLIC toRuleString(const String& value);
 
+  /*
+   * Append the rule language form of a value to a string. The
+   * generic versions go through toRuleString(); the overloads for
+   * the common value types don't create a temporary string.
+   */
+  template<typename T>
+  void appendRuleString(String& rule_string, T* const value)
+  {
+    rule_string.append(value->toRuleString());
+  }
+
+  template<typename T>
+  void appendRuleString(String& rule_string, const T& value)
+  {
+    rule_string.append(toRuleString(value));
+  }
+
+  void DLL_PUBLIC appendRuleString(String& rule_string, const InternedString& value);
+  void DLL_PUBLIC appendRuleString(String& rule_string, const USBDeviceID& value);
+
+  /*
+   * Expected length of the rule language form of a value. Used to
+   * reserve the output buffer, so it doesn't have to be exact.
+   */
+  template<typename T>
+  size_t ruleStringSizeHint(const T&)
+  {
+    return 16;
+  }
+
+  inline size_t ruleStringSizeHint(const InternedString& value)
+  {
+    return value.str().size() + 2;
+  }
+
+  /*
+   * Type used to store attribute values. String values are
+   * interned, so that rule copies share them.
+   */
+  template<typename T>
+  struct AttributeStorage
+  {
+    typedef T type;
+  };
+
+  template<>
+  struct AttributeStorage<String>
+  {
+    typedef InternedString type;
+  };
+
   class RulePrivate;
+  class RuleArena;
   class DLL_PUBLIC Rule
   {
   public:
@@ -86,6 +139,8 @@ namespace usbguard {
     class Attribute
     {
       public:
+        typedef typename AttributeStorage<ValueType>::type StorageType;
+
         Attribute(const char * name)
         {
           _name = name;
@@ -111,7 +166,7 @@ namespace usbguard {
 
         void append(const ValueType& value)
         {
-          _values.push_back(value);
+          _values.push_back(StorageType(value));
         }
 
         size_t count() const
@@ -124,6 +179,16 @@ namespace usbguard {
           return count() == 0;
         }
 
+        /*
+         * Heap memory used by the stored values, in bytes. Storage
+         * shared with other values (e.g. interned strings) isn't
+         * counted.
+         */
+        size_t memoryUsage() const
+        {
+          return _values.capacity() * sizeof(StorageType);
+        }
+
         void clear()
         {
           _values.clear();
@@ -161,9 +226,28 @@ namespace usbguard {
           }
         }
 
-        void set(const std::vector<ValueType>& values, SetOperator op)
+        /*
+         * Same as set(), but takes the stored form of the value
+         * (e.g. an InternedString), so the value doesn't have to
+         * be looked up in the string pool again.
+         */
+        void setStored(const StorageType& value)
         {
-          _values = values;
+          if (count() > 1) {
+            throw std::runtime_error("BUG: Setting single value for a multivalued attribute");
+          }
+          if (count() == 0) {
+            _values.push_back(value);
+          }
+          else {
+            _values[0] = value;
+          }
+        }
+
+        template<typename T>
+        void set(const std::vector<T>& values, SetOperator op)
+        {
+          _values.assign(values.begin(), values.end());
           _set_operator = op;
         }
 
@@ -210,46 +294,58 @@ namespace usbguard {
         String toRuleString() const
         {
           String result;
+          result.reserve(ruleStringSizeHint());
+          appendRuleString(result);
+          return result;
+        }
 
-          result.append(_name);
-          result.append(" ");
+        /*
+         * Append the rule language form of the attribute to a
+         * string, without creating temporary strings.
+         */
+        void appendRuleString(String& rule_string) const
+        {
+          rule_string.append(_name);
 
           const bool nondefault_op = setOperator() != SetOperator::Equals;
           const bool multiset_form = count() > 1 || nondefault_op;
 
           if (multiset_form) {
+            rule_string.append(" ");
             if (nondefault_op) {
-              result.append(setOperatorToString(setOperator()));
-              result.append(" ");
+              rule_string.append(setOperatorToString(setOperator()));
+              rule_string.append(" ");
+            }
+            rule_string.append("{ ");
+            for(const auto& value : _values) {
+              usbguard::appendRuleString(rule_string, value);
+              rule_string.append(" ");
             }
-            result.append("{ ");
+            rule_string.append("}");
           }
-
-          for(const auto& value : _values) {
-            result.append(usbguard::toRuleString(value));
-            result.append(" ");
+          else if (!_values.empty()) {
+            rule_string.append(" ");
+            usbguard::appendRuleString(rule_string, _values[0]);
           }
 
-          if (multiset_form) {
-            result.append("}");
-          }
-          else {
-            /*
-             * Remove the trailing space in case of a single
-             * valued attribute.
-             */
-            result.erase(result.end() - 1);
-          }
+          return;
+        }
 
-          return result;
+        size_t ruleStringSizeHint() const
+        {
+          size_t hint = _name.size() + 16;
+          for(const auto& value : _values) {
+            hint += usbguard::ruleStringSizeHint(value) + 1;
+          }
+          return hint;
         }
 
-        const std::vector<ValueType>& values() const
+        const std::vector<StorageType>& values() const
         {
           return _values;
         }
 
-        std::vector<ValueType>& values()
+        std::vector<StorageType>& values()
         {
           return _values;
         }
@@ -258,7 +354,7 @@ namespace usbguard {
         /*
          * All of the items in source set must match an item in the target set
          */
-        bool setSolveAllOf(const std::vector<ValueType>& source_set, const std::vector<ValueType>& target_set) const
+        bool setSolveAllOf(const std::vector<StorageType>& source_set, const std::vector<StorageType>& target_set) const
         {
           for (auto const& source_item : source_set) {
             bool match = false;
@@ -278,7 +374,7 @@ namespace usbguard {
         /*
          * At least one of the items in the source set must match an item in the target set
          */
-        bool setSolveOneOf(const std::vector<ValueType>& source_set, const std::vector<ValueType>& target_set) const
+        bool setSolveOneOf(const std::vector<StorageType>& source_set, const std::vector<StorageType>& target_set) const
         {
           for (auto const& source_item : source_set) {
             for (auto const& target_item : target_set) {
@@ -294,7 +390,7 @@ namespace usbguard {
          * None of the the items in the rule set must match any item in the
          * applies_to set
          */
-        bool setSolveNoneOf(const std::vector<ValueType>& source_set, const std::vector<ValueType>& target_set) const
+        bool setSolveNoneOf(const std::vector<StorageType>& source_set, const std::vector<StorageType>& target_set) const
         {
           for (auto const& source_item : source_set) {
             for (auto const& target_item : target_set) {
@@ -311,7 +407,7 @@ namespace usbguard {
          * applies_to set and the sets have to have the same number
          * of items
          */
-        bool setSolveEquals(const std::vector<ValueType>& source_set, const std::vector<ValueType>& target_set) const
+        bool setSolveEquals(const std::vector<StorageType>& source_set, const std::vector<StorageType>& target_set) const
         {
           if (source_set.size() != target_set.size()) {
             return false;
@@ -337,7 +433,7 @@ namespace usbguard {
          * The sets are treated as arrays and they have to me equal
          * (same number of items at the same positions)
          */
-        bool setSolveEqualsOrdered(const std::vector<ValueType>& source_set, const std::vector<ValueType>& target_set) const
+        bool setSolveEqualsOrdered(const std::vector<StorageType>& source_set, const std::vector<StorageType>& target_set) const
         {
           if (source_set.size() != target_set.size()) {
             return false;
@@ -352,7 +448,7 @@ namespace usbguard {
 
         String _name;
         SetOperator _set_operator;
-        std::vector<ValueType> _values;
+        std::vector<StorageType> _values;
     };
 
     /**
@@ -362,8 +458,17 @@ namespace usbguard {
      */
     Rule();
     ~Rule();
+
+    /*
+     * Copies share the rule data until one of them is modified
+     * using a setter or a non-const attribute accessor. The usage
+     * counters and the condition state are runtime state and stay
+     * shared between the copies.
+     */
     Rule(const Rule& rhs);
     const Rule& operator=(const Rule& rhs);
+    Rule(Rule&& rhs) noexcept;
+    const Rule& operator=(Rule&& rhs) noexcept;
 
     void setRuleID(uint32_t rule_id);
     uint32_t getRuleID() const;
@@ -416,6 +521,24 @@ namespace usbguard {
     void setTimeoutSeconds(uint32_t timeout_seconds);
     uint32_t getTimeoutSeconds() const;
 
+    /*
+     * Name of the rule group, empty if the rule doesn't belong to
+     * any. The rules of a disabled group are skipped by the rule
+     * set matching, see RuleSet::setGroupEnabled. Throws if there
+     * would be more than MaxGroups distinct group names.
+     */
+    void setGroup(const String& group);
+    const String& getGroup() const;
+
+    static const size_t MaxGroups = 64;
+
+    /*
+     * The bit of the group in the group masks of the rule set,
+     * 0 for the empty name. Each group name gets its bit when
+     * it's used for the first time.
+     */
+    static uint64_t groupBit(const String& group);
+
     bool appliesTo(Pointer<const Rule> rhs) const;
     bool appliesTo(const Rule& rhs) const;
     bool appliesTo(const Rule& rhs);
@@ -425,15 +548,74 @@ namespace usbguard {
     operator bool() const;
     String toString(bool invalid = false) const;
 
+    /**
+     * Append the string form of the rule to the given string. The
+     * output is reserved up front, so the rule is written without
+     * creating temporary strings.
+     */
+    void appendToString(String& rule_string, bool invalid = false) const;
+
     void updateMetaDataCounters(bool applied = true, bool evaluated = false);
 
+    /**
+     * Point-in-time copy of the rule usage counters.
+     */
+    struct Statistics
+    {
+      Statistics();
+
+      /**
+       * Number of match time histogram buckets. Bucket `i' counts the
+       * matching passes which found this rule in less than 2^i
+       * microseconds; the last bucket counts all the slower ones.
+       */
+      static const size_t MatchTimeBuckets = 16;
+
+      uint32_t rule_id; /**< Rule which the counters belong to */
+      uint64_t evaluated; /**< How many times the rule was evaluated against a device */
+      uint64_t applied; /**< How many times the rule target was applied to a device */
+      uint64_t last_evaluated; /**< Wall-clock time (UNIX seconds) of the last evaluation, 0 if never */
+      uint64_t last_applied; /**< Wall-clock time (UNIX seconds) of the last application, 0 if never */
+      std::vector<uint64_t> match_time_histogram; /**< Cumulative match times, see MatchTimeBuckets */
+    };
+
+    /**
+     * Read the usage counters without blocking the matching. The
+     * counters are read independently, so the values may be from
+     * slightly different moments when the rule is being used.
+     */
+    Statistics getStatistics() const;
+
+    /**
+     * Set the usage counters, e.g. to the values saved by a previous
+     * run of the daemon. The rule id of `statistics' is ignored.
+     */
+    void setStatistics(const Statistics& statistics);
+
+    /**
+     * Estimated memory used by the rule, in bytes. The data shared
+     * by copies of the rule is counted by each copy, the interned
+     * string values aren't counted.
+     */
+    size_t getMemoryUsage() const;
+
     RulePrivate* internal();
     const RulePrivate* internal() const;
     
     /*** Static methods ***/
     static Rule fromString(const String& rule_string);
 
+    /**
+     * Parse a rule, allocating its data in the given arena.
+     */
+    static Rule fromString(const String& rule_string, RuleArena& arena);
+
   private:
-    RulePrivate* d_pointer;
+    friend class RuleArena;
+    explicit Rule(const Pointer<RulePrivate>& data);
+
+    RulePrivate* detach(bool if_shared = true);
+
+    Pointer<RulePrivate> d_pointer;
   };
 } /* namespace usbguard */
@@ -30,7 +30,7 @@ namespace usbguard
   RuleAppliedCondition::RuleAppliedCondition(const String& elapsed_time, bool negated)
     : RuleCondition("rule-applied", elapsed_time, negated)
   {
-    _elapsed_time = std::chrono::steady_clock::duration(stringToSeconds(elapsed_time));
+    _elapsed_time = std::chrono::seconds(stringToSeconds(elapsed_time));
   }
 
   RuleAppliedCondition::RuleAppliedCondition(const RuleAppliedCondition& rhs)
@@ -41,13 +41,13 @@ namespace usbguard
 
   bool RuleAppliedCondition::update(const Rule& rule)
   {
-    if (rule.internal()->metadata().counter_applied > 0) {
+    if (rule.internal()->metadata().appliedCount() > 0) {
       if (_elapsed_time == std::chrono::steady_clock::duration::zero()) {
         return true;
       }
       else {
-        const auto last_applied_duration = std::chrono::steady_clock::now() \
-                                            - rule.internal()->metadata().tp_last_applied;
+        const auto last_applied_duration = EvaluationClock::now() \
+                                            - rule.internal()->metadata().lastApplied();
 
         if (last_applied_duration <= _elapsed_time) {
           return true;
@@ -57,6 +57,37 @@ namespace usbguard
     return false;
   }
 
+  RuleCondition::Cost RuleAppliedCondition::cost() const
+  {
+    return Cost::Clock;
+  }
+
+  bool RuleAppliedCondition::hasSideEffects() const
+  {
+    return false;
+  }
+
+  /*
+   * The condition holds until the elapsed time is exceeded.
+   */
+  bool RuleAppliedCondition::nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const
+  {
+    if (rule.internal()->metadata().appliedCount() == 0 ||
+        _elapsed_time == std::chrono::steady_clock::duration::zero()) {
+      return false;
+    }
+
+    const auto change_time = rule.internal()->metadata().lastApplied() \
+                              + _elapsed_time + std::chrono::steady_clock::duration(1);
+
+    if (change_time <= EvaluationClock::now()) {
+      return false;
+    }
+
+    time_point = change_time;
+    return true;
+  }
+
   RuleCondition * RuleAppliedCondition::clone() const
   {
     return new RuleAppliedCondition(*this);
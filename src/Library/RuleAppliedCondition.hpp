@@ -30,6 +30,9 @@ namespace usbguard
     RuleAppliedCondition(const String& elapsed_time, bool negated = false);
     RuleAppliedCondition(const RuleAppliedCondition& rhs);
     bool update(const Rule& rule);
+    Cost cost() const;
+    bool hasSideEffects() const;
+    bool nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const;
     RuleCondition * clone() const;
   protected:
     static uint64_t stringToSeconds(const String& string);
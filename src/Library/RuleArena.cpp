@@ -0,0 +1,183 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleArena.hpp"
+#include "RulePrivate.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace usbguard {
+  class RuleArenaPrivate
+  {
+  public:
+    RuleArenaPrivate(size_t initial_size)
+      : _block_size(std::max(initial_size, min_block_size)),
+        _cursor(0),
+        _end(0),
+        _used(0),
+        _capacity(0)
+    {
+    }
+
+    void* allocate(size_t size, size_t alignment)
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      uintptr_t start = alignUp(_cursor, alignment);
+
+      if (start + size > _end) {
+        const size_t block_size = std::max(_block_size, size + alignment);
+        _blocks.emplace_back(new char[block_size]);
+        _cursor = reinterpret_cast<uintptr_t>(_blocks.back().get());
+        _end = _cursor + block_size;
+        _capacity += block_size;
+        start = alignUp(_cursor, alignment);
+      }
+
+      _cursor = start + size;
+      _used += size;
+      return reinterpret_cast<void*>(start);
+    }
+
+    size_t used() const
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      return _used;
+    }
+
+    size_t capacity() const
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      return _capacity;
+    }
+
+    size_t blockCount() const
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      return _blocks.size();
+    }
+
+    static const size_t min_block_size = 64 * 1024;
+
+  private:
+    static uintptr_t alignUp(uintptr_t address, size_t alignment)
+    {
+      return (address + alignment - 1) & ~(uintptr_t(alignment) - 1);
+    }
+
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<char[]>> _blocks;
+    const size_t _block_size;
+    uintptr_t _cursor;
+    uintptr_t _end;
+    size_t _used;
+    size_t _capacity;
+  };
+
+  const size_t RuleArenaPrivate::min_block_size;
+
+  /*
+   * Allocator handed to std::allocate_shared. The shared pointer
+   * control block keeps a copy of it, so every rule created in the
+   * arena keeps the arena's blocks alive. Deallocation is a no-op;
+   * the blocks are released with the last reference.
+   */
+  template<typename T>
+  class RuleArenaAllocator
+  {
+  public:
+    typedef T value_type;
+
+    RuleArenaAllocator(const Pointer<RuleArenaPrivate>& arena)
+      : _arena(arena)
+    {
+    }
+
+    template<typename U>
+    RuleArenaAllocator(const RuleArenaAllocator<U>& rhs)
+      : _arena(rhs._arena)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+      return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t)
+    {
+    }
+
+    template<typename U>
+    bool operator==(const RuleArenaAllocator<U>& rhs) const
+    {
+      return _arena == rhs._arena;
+    }
+
+    template<typename U>
+    bool operator!=(const RuleArenaAllocator<U>& rhs) const
+    {
+      return _arena != rhs._arena;
+    }
+
+  private:
+    template<typename U>
+    friend class RuleArenaAllocator;
+
+    Pointer<RuleArenaPrivate> _arena;
+  };
+
+  /*
+   * Estimated arena space taken by one rule: the rule data plus the
+   * shared pointer control block allocated with it.
+   */
+  static const size_t rule_arena_entry_size = sizeof(RulePrivate) + 64;
+
+  RuleArena::RuleArena(size_t rule_count_hint)
+    : d_pointer(makePointer<RuleArenaPrivate>(rule_count_hint * rule_arena_entry_size))
+  {
+  }
+
+  RuleArena::~RuleArena()
+  {
+  }
+
+  Rule RuleArena::newRule()
+  {
+    return Rule(std::allocate_shared<RulePrivate>(RuleArenaAllocator<RulePrivate>(d_pointer)));
+  }
+
+  size_t RuleArena::used() const
+  {
+    return d_pointer->used();
+  }
+
+  size_t RuleArena::capacity() const
+  {
+    return d_pointer->capacity();
+  }
+
+  size_t RuleArena::blockCount() const
+  {
+    return d_pointer->blockCount();
+  }
+} /* namespace usbguard */
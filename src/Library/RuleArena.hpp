@@ -0,0 +1,70 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include <cstddef>
+
+namespace usbguard {
+  class RuleArenaPrivate;
+
+  /**
+   * Monotonic buffer for the data of rules parsed in bulk.
+   *
+   * Rules created through an arena keep their data in large blocks
+   * owned by the arena instead of one heap allocation each. With a
+   * size hint matching the rule count, a whole rule file takes a
+   * single allocation. The memory is never reused: it is released when
+   * the arena and all the rules created through it are destroyed,
+   * so the rules may outlive the RuleArena object itself.
+   *
+   * A rule modified after it was shared with a copy is moved to the
+   * heap (see Rule). Allocation from an arena is thread-safe.
+   */
+  class DLL_PUBLIC RuleArena
+  {
+  public:
+    /**
+     * Construct an arena. The first block is sized to hold the
+     * given number of rules; more blocks are added when needed.
+     */
+    explicit RuleArena(size_t rule_count_hint = 0);
+    ~RuleArena();
+
+    /**
+     * Construct a default rule whose data is allocated in the arena.
+     */
+    Rule newRule();
+
+    /** Number of bytes allocated from the arena. */
+    size_t used() const;
+
+    /** Number of bytes reserved by the arena's blocks. */
+    size_t capacity() const;
+
+    /** Number of blocks allocated for the arena. */
+    size_t blockCount() const;
+
+  private:
+    RuleArena(const RuleArena&) = delete;
+    RuleArena& operator=(const RuleArena&) = delete;
+
+    Pointer<RuleArenaPrivate> d_pointer;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,272 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleCache.hpp"
+#include "RuleCondition.hpp"
+#include "Hash.hpp"
+#include "LoggerPrivate.hpp"
+#include "Common/Utility.hpp"
+#include "Common/ByteStream.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace usbguard {
+  static const char cache_magic[8] = { 'U', 'S', 'B', 'G', 'R', 'C', '\0', '\0' };
+  static const uint32_t cache_version = 2;
+  static const uint32_t cache_byte_order_mark = 0x01020304;
+
+  template<typename ValueType, typename WriteFn>
+  static void writeAttribute(ByteWriter& writer, const Rule::Attribute<ValueType>& attribute, WriteFn write_value)
+  {
+    writer.u8(static_cast<uint8_t>(attribute.setOperator()));
+    writer.u32(attribute.count());
+    for (auto const& value : attribute.values()) {
+      write_value(value);
+    }
+    return;
+  }
+
+  template<typename ValueType, typename ReadFn>
+  static void readAttribute(ByteReader& reader, Rule::Attribute<ValueType>& attribute, ReadFn read_value)
+  {
+    const uint8_t set_operator = reader.u8();
+    if (set_operator > static_cast<uint8_t>(Rule::SetOperator::Match)) {
+      throw std::runtime_error("Rule cache: invalid set operator");
+    }
+    const uint32_t count = reader.u32();
+    std::vector<ValueType> values;
+    for (uint32_t i = 0; i < count; ++i) {
+      values.push_back(read_value());
+    }
+    attribute.set(values, static_cast<Rule::SetOperator>(set_operator));
+    return;
+  }
+
+  void RuleCache::writeRule(ByteWriter& writer, const Rule& rule)
+  {
+    auto write_string = [&writer](const String& value) {
+      writer.string(value);
+    };
+
+    writer.u8(static_cast<uint8_t>(rule.getTarget()));
+    writer.u32(rule.getTimeoutSeconds());
+    writer.string(rule.getGroup());
+
+    writeAttribute(writer, rule.attributeDeviceID(), [&writer](const USBDeviceID& value) {
+      writer.string(value.getVendorID());
+      writer.string(value.getProductID());
+    });
+    writeAttribute(writer, rule.attributeSerial(), write_string);
+    writeAttribute(writer, rule.attributeName(), write_string);
+    writeAttribute(writer, rule.attributeHash(), write_string);
+    writeAttribute(writer, rule.attributeParentHash(), write_string);
+    writeAttribute(writer, rule.attributeViaPort(), write_string);
+    writeAttribute(writer, rule.attributeWithInterface(), [&writer](const USBInterfaceType& value) {
+      writer.string(value.typeString());
+    });
+    writeAttribute(writer, rule.attributeConditions(), [&writer](const RuleCondition * const value) {
+      writer.string(value->identifier());
+      writer.string(value->parameter());
+      writer.u8(value->isNegated());
+    });
+    return;
+  }
+
+  Rule RuleCache::readRule(ByteReader& reader)
+  {
+    Rule rule;
+    auto read_string = [&reader]() {
+      return reader.string();
+    };
+
+    const uint8_t target = reader.u8();
+    if (target > static_cast<uint8_t>(Rule::Target::Invalid)) {
+      throw std::runtime_error("Rule cache: invalid rule target");
+    }
+    rule.setTarget(static_cast<Rule::Target>(target));
+    rule.setTimeoutSeconds(reader.u32());
+    rule.setGroup(reader.string());
+
+    readAttribute(reader, rule.attributeDeviceID(), [&reader]() {
+      USBDeviceID device_id;
+      device_id.setVendorID(reader.string());
+      device_id.setProductID(reader.string());
+      return device_id;
+    });
+    readAttribute(reader, rule.attributeSerial(), read_string);
+    readAttribute(reader, rule.attributeName(), read_string);
+    readAttribute(reader, rule.attributeHash(), read_string);
+    readAttribute(reader, rule.attributeParentHash(), read_string);
+    readAttribute(reader, rule.attributeViaPort(), read_string);
+    readAttribute(reader, rule.attributeWithInterface(), [&reader]() {
+      return USBInterfaceType(reader.string());
+    });
+    readAttribute(reader, rule.attributeConditions(), [&reader]() {
+      const String identifier = reader.string();
+      const String parameter = reader.string();
+      const bool negated = reader.u8();
+      return RuleCondition::getImplementation(identifier, parameter, negated);
+    });
+
+    return rule;
+  }
+
+  bool RuleCache::Source::operator==(const Source& rhs) const
+  {
+    return size == rhs.size &&
+      mtime_sec == rhs.mtime_sec &&
+      mtime_nsec == rhs.mtime_nsec &&
+      hash == rhs.hash;
+  }
+
+  RuleCache::Source RuleCache::getSource(const String& rule_path)
+  {
+    std::ifstream stream(rule_path, std::ios::binary);
+    struct stat st;
+
+    if (!stream.is_open() || ::stat(rule_path.c_str(), &st) != 0) {
+      throw std::runtime_error("Cannot read the rule file");
+    }
+
+    /*
+     * The source hash only detects rule file changes, so it
+     * doesn't follow the configurable device hash settings.
+     */
+    Hash hash(Hash::Algorithm::SHA256);
+    hash.update(stream);
+
+    Source source;
+    source.size = st.st_size;
+    source.mtime_sec = st.st_mtim.tv_sec;
+    source.mtime_nsec = st.st_mtim.tv_nsec;
+    source.hash = hash.getBase64();
+
+    return source;
+  }
+
+  static bool parseCache(const uint8_t *data, size_t size, const RuleCache::Source& source, std::vector<Rule>& rules)
+  {
+    ByteReader reader(data, size);
+    char magic[sizeof cache_magic];
+
+    reader.bytes(magic, sizeof magic);
+    if (std::memcmp(magic, cache_magic, sizeof magic) != 0 ||
+        reader.u32() != cache_version ||
+        reader.u32() != cache_byte_order_mark) {
+      USBGUARD_LOG_DEBUG("Rule cache: incompatible cache format");
+      return false;
+    }
+
+    RuleCache::Source cached_source;
+    cached_source.size = reader.u64();
+    cached_source.mtime_sec = reader.u64();
+    cached_source.mtime_nsec = reader.u64();
+    cached_source.hash = reader.string();
+
+    if (!(cached_source == source)) {
+      USBGUARD_LOG_DEBUG("Rule cache: the rule file changed since the cache was created");
+      return false;
+    }
+
+    const uint32_t count = reader.u32();
+    std::vector<Rule> cached_rules;
+
+    cached_rules.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      cached_rules.push_back(RuleCache::readRule(reader));
+    }
+
+    if (!reader.empty()) {
+      throw std::runtime_error("Rule cache: trailing data");
+    }
+
+    rules.swap(cached_rules);
+    return true;
+  }
+
+  bool RuleCache::load(const String& cache_path, const Source& source, std::vector<Rule>& rules)
+  {
+    const int fd = ::open(cache_path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+      USBGUARD_LOG_DEBUG("Rule cache: cannot open {}: {}", cache_path, strerror(errno));
+      return false;
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+
+    void * const data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+      USBGUARD_LOG_DEBUG("Rule cache: cannot map {}: {}", cache_path, strerror(errno));
+      return false;
+    }
+
+    bool loaded = false;
+
+    try {
+      loaded = parseCache(static_cast<const uint8_t *>(data), st.st_size, source, rules);
+    }
+    catch(const std::exception& ex) {
+      logger->warn("Ignoring invalid rule cache {}: {}", cache_path, ex.what());
+      loaded = false;
+    }
+
+    ::munmap(data, st.st_size);
+    return loaded;
+  }
+
+  void RuleCache::save(const String& cache_path, const Source& source, const PointerVector<Rule>& rules)
+  {
+    ByteWriter writer;
+
+    for (auto c : cache_magic) {
+      writer.u8(c);
+    }
+    writer.u32(cache_version);
+    writer.u32(cache_byte_order_mark);
+    writer.u64(source.size);
+    writer.u64(source.mtime_sec);
+    writer.u64(source.mtime_nsec);
+    writer.string(source.hash);
+    writer.u32(rules.size());
+
+    for (auto const& rule : rules) {
+      RuleCache::writeRule(writer, *rule);
+    }
+
+    if (!writeFileAtomically(cache_path, writer.data())) {
+      throw std::runtime_error("Cannot store the rule cache");
+    }
+    return;
+  }
+} /* namespace usbguard */
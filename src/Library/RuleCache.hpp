@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include <vector>
+
+namespace usbguard {
+  class ByteWriter;
+  class ByteReader;
+
+  /*
+   * Binary cache of a parsed rule file. The cache stores the
+   * rules in a compact length-prefixed form which is read from
+   * a memory mapped file without invoking the rule parser. It
+   * also identifies the rule file it was created from (size,
+   * modification time and content hash) and is used only if
+   * the rule file didn't change since then.
+   */
+  class RuleCache
+  {
+  public:
+    struct Source {
+      uint64_t size;
+      int64_t mtime_sec;
+      int64_t mtime_nsec;
+      String hash;
+
+      bool operator==(const Source& rhs) const;
+    };
+
+    /*
+     * Identify the current state of the rule file at `rule_path'.
+     * Throws an exception if the file cannot be read.
+     */
+    static Source getSource(const String& rule_path);
+
+    /*
+     * Load the rules from the cache file at `cache_path'. Returns
+     * false if the cache doesn't exist, is corrupted or wasn't
+     * created from `source'.
+     */
+    static bool load(const String& cache_path, const Source& source, std::vector<Rule>& rules);
+
+    /*
+     * Store the rules into the cache file at `cache_path'.
+     * Throws an exception on failure.
+     */
+    static void save(const String& cache_path, const Source& source, const PointerVector<Rule>& rules);
+
+    /*
+     * The binary form of a single rule, also used by the policy
+     * bundles. readRule throws an exception on invalid data.
+     */
+    static void writeRule(ByteWriter& writer, const Rule& rule);
+    static Rule readRule(ByteReader& reader);
+  };
+} /* namespace usbguard */
@@ -19,29 +19,41 @@
 #include "RuleCondition.hpp"
 #include "Rule.hpp"
 #include "LoggerPrivate.hpp"
+#include "StringPool.hpp"
 
 #include <unordered_map>
 #include <functional>
 
 namespace usbguard
 {
+  static uint32_t conditionKey(const String& identifier, const String& parameter)
+  {
+    String key_string(identifier);
+    key_string.push_back('\0');
+    key_string.append(parameter);
+    return StringPool::instance().intern(key_string).second;
+  }
+
   RuleCondition::RuleCondition(const String& identifier, const String& parameter, bool negated)
     : _identifier(identifier),
       _parameter(parameter),
-      _negated(negated)
+      _negated(negated),
+      _key(conditionKey(identifier, parameter))
   {
   }
 
   RuleCondition::RuleCondition(const String& identifier, bool negated)
     : _identifier(identifier),
-      _negated(negated)
+      _negated(negated),
+      _key(conditionKey(identifier, String()))
   {
   }
 
   RuleCondition::RuleCondition(const RuleCondition& rhs)
     : _identifier(rhs._identifier),
       _parameter(rhs._parameter),
-      _negated(rhs._negated)
+      _negated(rhs._negated),
+      _key(rhs._key)
   {
   }
 
@@ -59,11 +71,63 @@ namespace usbguard
   {
   }
 
+  bool RuleCondition::isMemoizable() const
+  {
+    return false;
+  }
+
+  RuleCondition::Cost RuleCondition::cost() const
+  {
+    return Cost::Query;
+  }
+
+  bool RuleCondition::hasSideEffects() const
+  {
+    return !isMemoizable();
+  }
+
+  bool RuleCondition::nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const
+  {
+    (void)rule;
+    (void)time_point;
+    return false;
+  }
+
   bool RuleCondition::evaluate(const Rule& rule)
   {
     return isNegated() ? !update(rule) : update(rule);
   }
 
+  bool RuleCondition::evaluate(const Rule& rule, EvaluationMemo* memo)
+  {
+    if (memo == nullptr || !isMemoizable()) {
+      return evaluate(rule);
+    }
+
+    auto it = memo->find(_key);
+
+    if (it == memo->end()) {
+      updateMany(rule, *memo);
+      it = memo->find(_key);
+
+      if (it == memo->end()) {
+        it = memo->emplace(_key, update(rule)).first;
+      }
+    }
+
+    return isNegated() ? !it->second : it->second;
+  }
+
+  void RuleCondition::updateMany(const Rule& rule, EvaluationMemo& memo)
+  {
+    memo.emplace(_key, update(rule));
+  }
+
+  uint32_t RuleCondition::key() const
+  {
+    return _key;
+  }
+
   const String& RuleCondition::identifier() const
   {
     return _identifier;
@@ -115,6 +179,8 @@ namespace usbguard
 #include "RandomStateCondition.hpp"
 #include "RuleAppliedCondition.hpp"
 #include "RuleEvaluatedCondition.hpp"
+#include "TrafficRateCondition.hpp"
+#include "ModuleCondition.hpp"
 #include <iostream>
 
 namespace usbguard
@@ -185,7 +251,37 @@ namespace usbguard
     if (identifier == "rule-evaluated") {
       return new RuleEvaluatedCondition(parameter, negated);
     }
+    if (identifier == "usb-traffic-rate") {
+      return new TrafficRateCondition(parameter, negated);
+    }
+
+    const Pointer<ConditionModule> module = ConditionModule::find(identifier);
+
+    if (module) {
+      return new ModuleCondition(module, parameter, negated);
+    }
     throw std::runtime_error("Unknown rule condition");
   }
+
+  bool RuleCondition::isBuiltin(const String& identifier)
+  {
+    static const char * const builtin_identifiers[] = {
+      "allowed-matches",
+      "localtime",
+      "true",
+      "false",
+      "random",
+      "rule-applied",
+      "rule-evaluated",
+      "usb-traffic-rate"
+    };
+
+    for (const char *builtin : builtin_identifiers) {
+      if (identifier == builtin) {
+        return true;
+      }
+    }
+    return false;
+  }
 } /* namespace usbguard */
 
@@ -19,6 +19,8 @@
 #pragma once
 
 #include "Typedefs.hpp"
+#include "EvaluationClock.hpp"
+#include <unordered_map>
 
 namespace usbguard
 {
@@ -37,7 +39,67 @@ namespace usbguard
     virtual bool update(const Rule& rule) = 0;
     virtual RuleCondition* clone() const = 0;
 
+    /*
+     * Return true if the result of update() depends only on
+     * the condition identifier and parameter, and evaluating
+     * the condition has no side effects. Such results can be
+     * shared by all the equal conditions within one matching
+     * pass. The default is false.
+     */
+    virtual bool isMemoizable() const;
+
+    /*
+     * Relative cost of update(). The conditions of a rule are
+     * evaluated from the cheapest to the most costly.
+     */
+    enum class Cost : uint8_t {
+      Constant = 0, /**< The result is fixed */
+      Cheap,        /**< A computation without a system call */
+      Clock,        /**< Reads the clock */
+      Query         /**< Queries the devices or another subsystem */
+    };
+
+    /*
+     * The default is Query.
+     */
+    virtual Cost cost() const;
+
+    /*
+     * Return true if update() has side effects which have to
+     * happen even if the result of the whole condition set is
+     * already known. Such conditions are always evaluated. The
+     * default is the opposite of isMemoizable().
+     */
+    virtual bool hasSideEffects() const;
+
+    /*
+     * Find the next time the result of update() changes only
+     * because the time passes, e.g. when a time window opens
+     * or closes. Return false if there's no such time, which
+     * is the default. The time may be later than the actual
+     * change by less than a second, but it is never earlier.
+     */
+    virtual bool nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const;
+
+    /*
+     * Results of update() calls done during one matching pass,
+     * keyed by the condition key.
+     */
+    typedef std::unordered_map<uint32_t, bool> EvaluationMemo;
+
+    /*
+     * Store the result of update() into the memo. Called for a
+     * memoizable condition whose key isn't in the memo yet. A
+     * condition may store the results of other conditions too,
+     * e.g. to evaluate all of them with one query. The default
+     * stores only its own result.
+     */
+    virtual void updateMany(const Rule& rule, EvaluationMemo& memo);
+
     bool evaluate(const Rule& rule);
+    bool evaluate(const Rule& rule, EvaluationMemo* memo);
+    /* Interned identifier and parameter pair; the negation is not included */
+    uint32_t key() const;
     const String& identifier() const;
     const String& parameter() const;
     bool hasParameter() const;
@@ -48,10 +110,14 @@ namespace usbguard
     static RuleCondition* getImplementation(const String& condition_string);
     static RuleCondition* getImplementation(const String& identifier, const String& parameter, bool negated);
 
+    /* Return true if the identifier names a built-in condition */
+    static bool isBuiltin(const String& identifier);
+
   private:
     const String _identifier;
     const String _parameter;
     const bool _negated;
+    const uint32_t _key;
   };
 } /*namespace usbguard */
 
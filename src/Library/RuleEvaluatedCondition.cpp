@@ -30,7 +30,7 @@ namespace usbguard
   RuleEvaluatedCondition::RuleEvaluatedCondition(const String& elapsed_time, bool negated)
     : RuleCondition("rule-applied", elapsed_time, negated)
   {
-    _elapsed_time = std::chrono::steady_clock::duration(stringToSeconds(elapsed_time));
+    _elapsed_time = std::chrono::seconds(stringToSeconds(elapsed_time));
   }
 
   RuleEvaluatedCondition::RuleEvaluatedCondition(const RuleEvaluatedCondition& rhs)
@@ -41,13 +41,13 @@ namespace usbguard
 
   bool RuleEvaluatedCondition::update(const Rule& rule)
   {
-    if (rule.internal()->metadata().counter_evaluated > 0) {
+    if (rule.internal()->metadata().evaluatedCount() > 0) {
       if (_elapsed_time == std::chrono::steady_clock::duration::zero()) {
         return true;
       }
       else {
-        const auto last_evaluated_duration = std::chrono::steady_clock::now() \
-                                              - rule.internal()->metadata().tp_last_evaluated;
+        const auto last_evaluated_duration = EvaluationClock::now() \
+                                              - rule.internal()->metadata().lastEvaluated();
 
         if (last_evaluated_duration <= _elapsed_time) {
           return true;
@@ -57,6 +57,37 @@ namespace usbguard
     return false;
   }
 
+  RuleCondition::Cost RuleEvaluatedCondition::cost() const
+  {
+    return Cost::Clock;
+  }
+
+  bool RuleEvaluatedCondition::hasSideEffects() const
+  {
+    return false;
+  }
+
+  /*
+   * The condition holds until the elapsed time is exceeded.
+   */
+  bool RuleEvaluatedCondition::nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const
+  {
+    if (rule.internal()->metadata().evaluatedCount() == 0 ||
+        _elapsed_time == std::chrono::steady_clock::duration::zero()) {
+      return false;
+    }
+
+    const auto change_time = rule.internal()->metadata().lastEvaluated() \
+                              + _elapsed_time + std::chrono::steady_clock::duration(1);
+
+    if (change_time <= EvaluationClock::now()) {
+      return false;
+    }
+
+    time_point = change_time;
+    return true;
+  }
+
   RuleCondition * RuleEvaluatedCondition::clone() const
   {
     return new RuleEvaluatedCondition(*this);
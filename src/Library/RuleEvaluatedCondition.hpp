@@ -30,6 +30,9 @@ namespace usbguard
     RuleEvaluatedCondition(const String& elapsed_time, bool negated = false);
     RuleEvaluatedCondition(const RuleEvaluatedCondition& rhs);
     bool update(const Rule& rule);
+    Cost cost() const;
+    bool hasSideEffects() const;
+    bool nextStateChange(const Rule& rule, EvaluationClock::TimePoint& time_point) const;
     RuleCondition * clone() const;
   protected:
     static uint64_t stringToSeconds(const String& string);
@@ -0,0 +1,219 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleFolder.hpp"
+#include "RuleParser.hpp"
+#include "Common/Utility.hpp"
+
+#include <algorithm>
+#include <regex>
+#include <stdexcept>
+
+namespace usbguard {
+  namespace
+  {
+    struct PathCollector {
+      std::vector<String> paths;
+
+      void add(const String& path)
+      {
+        paths.push_back(path);
+      }
+    };
+  }
+
+  RuleFolder::RuleFolder(const String& folder_path, const String& rule_file, const String& cache_path)
+    : _folder_path(folder_path),
+      _rule_file(rule_file),
+      _cache_path(cache_path)
+  {
+  }
+
+  std::vector<String> RuleFolder::scan() const
+  {
+    PathCollector collector;
+
+    loadFiles(_folder_path, std::regex(".*\\.conf"), &PathCollector::add, &collector);
+    std::sort(collector.paths.begin(), collector.paths.end());
+
+    if (!_rule_file.empty()) {
+      collector.paths.push_back(_rule_file);
+    }
+
+    return collector.paths;
+  }
+
+  void RuleFolder::parse(const Fragment& fragment, std::vector<Rule>& rules) const
+  {
+    RuleSet parsed(nullptr);
+
+    if (fragment.cache_path.empty() || !parsed.loadCache(fragment.cache_path, fragment.path)) {
+      try {
+        parsed.load(fragment.path);
+      }
+      catch(RuleParserError& ex) {
+        ex.setFileInfo(fragment.path, ex.line(), ex.offset());
+        throw;
+      }
+      if (!fragment.cache_path.empty()) {
+        try {
+          parsed.saveCache(fragment.cache_path, fragment.path);
+        }
+        catch(...) {
+          /* The fragment is parsed again next time */
+        }
+      }
+    }
+
+    for (auto const& rule : parsed.getRules()) {
+      rules.push_back(*rule);
+    }
+    return;
+  }
+
+  RuleFolder::Contents RuleFolder::read(RuleSet& ruleset) const
+  {
+    Contents contents;
+    /* Rules of the unchanged fragments, by the current fragment index */
+    std::vector<std::vector<Rule>> current_rules;
+
+    for (auto const& path : scan()) {
+      Fragment fragment;
+      fragment.path = path;
+      fragment.cache_path = _cache_path.empty() ? String() : _cache_path + "." + filenameFromPath(path, /*include_extension=*/true);
+
+      try {
+        fragment.source = RuleCache::getSource(path);
+        fragment.present = true;
+      }
+      catch(...) {
+        if (path != _rule_file) {
+          throw std::runtime_error("Cannot read the rule fragment " + path);
+        }
+        /* The rule file is created by the first IPC modification */
+        fragment.source = RuleCache::Source { 0, 0, 0, String() };
+        fragment.present = false;
+      }
+
+      const auto previous = std::find_if(_fragments.cbegin(), _fragments.cend(), [&path](const Fragment& current) {
+          return current.path == path;
+        });
+      std::vector<Rule> rules;
+
+      if (previous != _fragments.cend() &&
+          previous->present == fragment.present &&
+          previous->source == fragment.source) {
+        if (current_rules.empty()) {
+          current_rules.resize(_fragments.size());
+          for (auto const& rule : ruleset.getRules()) {
+            auto it = _rule_fragment.find(rule->getRuleID());
+            if (it != _rule_fragment.end()) {
+              current_rules[it->second].push_back(*rule);
+            }
+          }
+        }
+        rules = std::move(current_rules[previous - _fragments.cbegin()]);
+      }
+      else if (fragment.present) {
+        parse(fragment, rules);
+      }
+
+      /*
+       * The ids of the fragment rules aren't kept: each fragment
+       * was parsed with its own ids and the rule set assigns new
+       * ones when the contents are loaded.
+       */
+      for (auto& rule : rules) {
+        rule.setRuleID(Rule::DefaultID);
+        contents.rules.push_back(std::move(rule));
+        contents.fragments.push_back(contents.fragment_list.size());
+      }
+      contents.fragment_list.push_back(std::move(fragment));
+    }
+
+    return contents;
+  }
+
+  void RuleFolder::assign(const std::vector<uint32_t>& ids, Contents&& contents)
+  {
+    if (ids.size() != contents.fragments.size()) {
+      throw std::runtime_error("BUG: RuleFolder: rule id count mismatch");
+    }
+
+    _fragments = std::move(contents.fragment_list);
+    _rule_fragment.clear();
+
+    for (size_t i = 0; i < ids.size(); ++i) {
+      _rule_fragment[ids[i]] = contents.fragments[i];
+    }
+    return;
+  }
+
+  void RuleFolder::store(RuleSet& ruleset, const std::set<uint32_t>& ids)
+  {
+    const size_t rule_file_index = \
+      !_rule_file.empty() && !_fragments.empty() ? _fragments.size() - 1 : _fragments.size();
+    std::set<size_t> modified;
+
+    for (const uint32_t id : ids) {
+      auto it = _rule_fragment.find(id);
+      if (it != _rule_fragment.end()) {
+        modified.insert(it->second);
+      }
+      else if (rule_file_index < _fragments.size()) {
+        _rule_fragment[id] = rule_file_index;
+        modified.insert(rule_file_index);
+      }
+    }
+
+    if (modified.empty()) {
+      return;
+    }
+
+    std::vector<String> fragment_data(_fragments.size());
+
+    for (auto const& rule : ruleset.getRules()) {
+      auto it = _rule_fragment.find(rule->getRuleID());
+      if (it != _rule_fragment.end() && modified.count(it->second) > 0) {
+        rule->appendToString(fragment_data[it->second]);
+        fragment_data[it->second].push_back('\n');
+      }
+    }
+
+    for (const size_t index : modified) {
+      Fragment& fragment = _fragments[index];
+
+      if (!writeFileAtomically(fragment.path, fragment_data[index])) {
+        throw std::runtime_error("Cannot store the rule fragment " + fragment.path);
+      }
+      /*
+       * The stored rules are the same as those in the rule set,
+       * so the fragment doesn't need to be parsed by read(). The
+       * rule cache is updated when the fragment is parsed next.
+       */
+      fragment.source = RuleCache::getSource(fragment.path);
+      fragment.present = true;
+    }
+    return;
+  }
+
+  const std::vector<RuleFolder::Fragment>& RuleFolder::fragments() const
+  {
+    return _fragments;
+  }
+} /* namespace usbguard */
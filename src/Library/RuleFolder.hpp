@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "RuleSet.hpp"
+#include "RuleCache.hpp"
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace usbguard {
+  /*
+   * A policy split into rule file fragments: the *.conf files
+   * of a directory in the lexical order of their names, followed
+   * by the rule file, which receives the rules added over IPC.
+   * Each fragment is parsed (or loaded from its rule cache) only
+   * if it changed since it was read the last time, and only the
+   * fragments with modified rules are rewritten.
+   *
+   * The fragment of each rule is tracked by the rule id. A rule
+   * keeps its fragment after it's removed from the rule set, so
+   * that a rollback restores it to the same fragment.
+   */
+  class DLL_PUBLIC RuleFolder
+  {
+  public:
+    struct Fragment {
+      String path;
+      String cache_path; /* empty if not cached */
+      bool present; /* false if the file doesn't exist (yet) */
+      RuleCache::Source source;
+    };
+
+    /*
+     * The rules of all the fragments in the load order and the
+     * index of the fragment of each rule.
+     */
+    struct Contents {
+      std::vector<Rule> rules;
+      std::vector<size_t> fragments;
+      std::vector<Fragment> fragment_list;
+    };
+
+    /*
+     * `rule_file' may be empty, then the rules which don't come
+     * from a fragment are not stored. If `cache_path' isn't empty,
+     * each fragment is cached in a file named `cache_path' followed
+     * by a dot and the name of the fragment.
+     */
+    RuleFolder(const String& folder_path, const String& rule_file, const String& cache_path);
+
+    /*
+     * Read the fragments. The rules of a fragment which didn't change
+     * since the last assign() are taken from `ruleset' instead of
+     * parsing the fragment again. Nothing is modified until the
+     * contents are passed to assign(). Throws an exception if a
+     * fragment cannot be read or parsed.
+     */
+    Contents read(RuleSet& ruleset) const;
+
+    /*
+     * Make the contents current after the rules were loaded into the
+     * rule set. `ids' are the ids of the rules of the contents.
+     */
+    void assign(const std::vector<uint32_t>& ids, Contents&& contents);
+
+    /*
+     * Rewrite the fragments of the rules with the ids `ids', which
+     * were added, modified or removed. New rules are assigned to the
+     * rule file.
+     */
+    void store(RuleSet& ruleset, const std::set<uint32_t>& ids);
+
+    const std::vector<Fragment>& fragments() const;
+
+  private:
+    std::vector<String> scan() const;
+    void parse(const Fragment& fragment, std::vector<Rule>& rules) const;
+
+    const String _folder_path;
+    const String _rule_file;
+    const String _cache_path;
+    std::vector<Fragment> _fragments;
+    std::unordered_map<uint32_t, size_t> _rule_fragment;
+  };
+} /* namespace usbguard */
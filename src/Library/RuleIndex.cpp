@@ -0,0 +1,877 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleIndex.hpp"
+#include "RulePrivate.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+namespace usbguard {
+  static bool isSingleEquals(Rule::SetOperator op, size_t count);
+  static bool numericDeviceID(const USBDeviceID& device_id,
+      uint16_t& vendor_id, uint16_t& product_id, bool& any_product);
+
+  template<typename T>
+  static bool isOptionalSingleEquals(const Rule::Attribute<T>& attribute)
+  {
+    return attribute.empty() || isSingleEquals(attribute.setOperator(), attribute.count());
+  }
+
+  RuleIndex::Entry::Entry(const Pointer<Rule>& rule_ptr)
+    : rule(rule_ptr),
+      program(RuleProgram::fromRule(*rule_ptr))
+  {
+    const Rule& r = *rule_ptr;
+    const auto& hash = r.attributeHash();
+
+    hash_only = isSingleEquals(hash.setOperator(), hash.count()) &&
+      r.attributeName().empty() &&
+      r.attributeSerial().empty() &&
+      r.attributeDeviceID().empty() &&
+      r.attributeWithInterface().empty() &&
+      isOptionalSingleEquals(r.attributeParentHash()) &&
+      isOptionalSingleEquals(r.attributeViaPort());
+
+    with_parent_hash = !r.attributeParentHash().empty();
+    with_via_port = !r.attributeViaPort().empty();
+    group_bit = r.internal()->getGroupBit();
+
+    if (with_parent_hash) {
+      parent_hash = r.attributeParentHash().values()[0];
+    }
+    if (with_via_port) {
+      via_port = r.attributeViaPort().values()[0];
+    }
+  }
+
+  /*
+   * Same result as Rule::appliesTo for a hash-only rule. The
+   * hash value itself is already known to be equal, because
+   * the entry was found in the bucket of the device hash.
+   */
+  bool RuleIndex::Entry::appliesHashOnly(const Rule& device_rule) const
+  {
+    if (with_parent_hash) {
+      const auto& device_parent_hash = device_rule.attributeParentHash();
+      if (device_parent_hash.count() != 1 || device_parent_hash.values()[0] != parent_hash) {
+        return false;
+      }
+    }
+    if (with_via_port) {
+      const auto& device_via_port = device_rule.attributeViaPort();
+      if (device_via_port.count() != 1 || device_via_port.values()[0] != via_port) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*
+   * Distance between the order keys of appended rules. The gaps
+   * allow to insert rules in the middle of the rule set without
+   * renumbering of the rules which are already indexed.
+   */
+  static const uint64_t order_step = 1 << 16;
+
+  /*
+   * Order key of the first rule. It's in the middle of the key
+   * range, so that rules can be prepended like they are appended.
+   */
+  static const uint64_t order_base = uint64_t(1) << 63;
+
+  RuleIndex::RuleIndex()
+  {
+    _order_next = order_base;
+    return;
+  }
+
+  void RuleIndex::rebuild(const PointerVector<Rule>& rules)
+  {
+    clear();
+    _key_filter.reset(rules.size());
+    for (auto const& rule : rules) {
+      append(rule);
+    }
+    return;
+  }
+
+  void RuleIndex::clear()
+  {
+    _order_next = order_base;
+    _hash_buckets.clear();
+    _parent_hash_buckets.clear();
+    _via_port_buckets.clear();
+    _vendor_buckets.clear();
+    _serial_buckets.clear();
+    _fallback.clear();
+    _all.clear();
+    _entries.clear();
+    _key_filter.clear();
+    return;
+  }
+
+  void RuleIndex::append(const Pointer<Rule>& rule)
+  {
+    insert(rule, _order_next);
+    return;
+  }
+
+  void RuleIndex::insertAt(const PointerVector<Rule>& rules, size_t position)
+  {
+    const Pointer<Rule>& rule = rules.at(position);
+
+    if (position + 1 == rules.size()) {
+      append(rule);
+      return;
+    }
+
+    const uint64_t order_upper = orderOf(*rules[position + 1]);
+
+    if (position == 0 && order_upper >= order_step) {
+      insert(rule, order_upper - order_step);
+      return;
+    }
+
+    const uint64_t order_lower = (position > 0 ? orderOf(*rules[position - 1]) + 1 : 0);
+
+    if (order_lower < order_upper) {
+      insert(rule, order_lower + (order_upper - order_lower) / 2);
+    }
+    else {
+      /* No gap left between the neighbours, renumber all rules */
+      rebuild(rules);
+    }
+    return;
+  }
+
+  void RuleIndex::insert(const Pointer<Rule>& rule, uint64_t order)
+  {
+    String key;
+    const KeyType type = ruleKey(*rule, key);
+    auto entry = makePointer<const Entry>(rule);
+
+    if (type == KeyType::None) {
+      _fallback.emplace(order, entry);
+    }
+    else if (type == KeyType::Hash || type == KeyType::ParentHash) {
+      idBuckets(type)[idKey(type, *rule)].emplace(order, entry);
+    }
+    else if (type == KeyType::ViaPort) {
+      _via_port_buckets[key].emplace(order, entry);
+    }
+    else if (type == KeyType::DeviceID || type == KeyType::Vendor) {
+      uint16_t vendor_id = 0;
+      uint16_t product_id = 0;
+      bool any_product = false;
+      (void)numericDeviceID(static_cast<const Rule&>(*rule).attributeDeviceID().get(),
+                            vendor_id, product_id, any_product);
+      VendorBuckets& vendor_buckets = _vendor_buckets[vendor_id];
+      (any_product ? vendor_buckets.any_product : vendor_buckets.products[product_id]).emplace(order, entry);
+    }
+    else {
+      buckets(type)[key].emplace(order, entry);
+    }
+
+    if (type != KeyType::None) {
+      addFilterKey(type, *rule);
+    }
+
+    _all.emplace(order, entry);
+    _entries[rule->getRuleID()] = std::make_pair(order, entry);
+    _order_next = std::max(_order_next, order + order_step);
+    return;
+  }
+
+  uint64_t RuleIndex::remove(const Pointer<Rule>& rule)
+  {
+    auto entry_it = _entries.find(rule->getRuleID());
+
+    if (entry_it == _entries.end()) {
+      throw std::runtime_error("BUG: RuleIndex: removing a rule which is not indexed");
+    }
+
+    const uint64_t order = entry_it->second.first;
+    String key;
+    const KeyType type = ruleKey(*rule, key);
+
+    if (type == KeyType::None) {
+      _fallback.erase(order);
+    }
+    else if (type == KeyType::Hash || type == KeyType::ParentHash) {
+      auto& type_buckets = idBuckets(type);
+      auto bucket_it = type_buckets.find(idKey(type, *rule));
+      if (bucket_it != type_buckets.end()) {
+        bucket_it->second.erase(order);
+        if (bucket_it->second.empty()) {
+          type_buckets.erase(bucket_it);
+        }
+      }
+    }
+    else if (type == KeyType::DeviceID || type == KeyType::Vendor) {
+      uint16_t vendor_id = 0;
+      uint16_t product_id = 0;
+      bool any_product = false;
+      (void)numericDeviceID(static_cast<const Rule&>(*rule).attributeDeviceID().get(),
+                            vendor_id, product_id, any_product);
+      auto vendor_it = _vendor_buckets.find(vendor_id);
+      if (vendor_it != _vendor_buckets.end()) {
+        VendorBuckets& vendor_buckets = vendor_it->second;
+        if (any_product) {
+          vendor_buckets.any_product.erase(order);
+        }
+        else {
+          auto product_it = vendor_buckets.products.find(product_id);
+          if (product_it != vendor_buckets.products.end()) {
+            product_it->second.erase(order);
+            if (product_it->second.empty()) {
+              vendor_buckets.products.erase(product_it);
+            }
+          }
+        }
+        if (vendor_buckets.any_product.empty() && vendor_buckets.products.empty()) {
+          _vendor_buckets.erase(vendor_it);
+        }
+      }
+    }
+    else if (type == KeyType::ViaPort) {
+      Bucket * const bucket = _via_port_buckets.find(key);
+      if (bucket != nullptr) {
+        bucket->erase(order);
+        if (bucket->empty()) {
+          _via_port_buckets.erase(key);
+        }
+      }
+    }
+    else {
+      StringKeyMap<Bucket>& type_buckets = buckets(type);
+      auto bucket_it = type_buckets.find(key);
+      if (bucket_it != type_buckets.end()) {
+        bucket_it->second.erase(order);
+        if (bucket_it->second.empty()) {
+          type_buckets.erase(bucket_it);
+        }
+      }
+    }
+
+    if (type != KeyType::None) {
+      _key_filter.remove(filterKey(type, *rule));
+    }
+
+    _all.erase(order);
+    _entries.erase(entry_it);
+
+    return order;
+  }
+
+  /*
+   * Fast path for the first candidate rule being a hash-only rule.
+   * It applies if no rule from the other candidate sources precedes
+   * it in the rule set, and then it can be matched without compiling
+   * the device rule. Returns true if the result is final. Otherwise
+   * `visited' is set to the entry passed to the visitor, if any, so
+   * that the generic path doesn't evaluate its conditions again.
+   */
+  bool RuleIndex::findFirstHashOnly(const Rule& device_rule,
+      const std::function<bool(const Pointer<Rule>&)>& visitor,
+      uint64_t disabled_groups, Pointer<Rule>& result, const Entry*& visited) const
+  {
+    const Bucket * const hash_bucket = findHashBucket(device_rule);
+
+    if (hash_bucket == nullptr) {
+      return false;
+    }
+
+    const uint64_t order = hash_bucket->cbegin()->first;
+    const Entry& entry = *hash_bucket->cbegin()->second;
+
+    if (!entry.hash_only || (entry.group_bit & disabled_groups) != 0) {
+      return false;
+    }
+
+    std::vector<const Bucket*> sources;
+
+    if (!deviceBuckets(device_rule, sources)) {
+      return false;
+    }
+
+    sources.push_back(&_fallback);
+
+    for (auto source : sources) {
+      if (source != hash_bucket && !source->empty() && source->cbegin()->first < order) {
+        return false;
+      }
+    }
+
+    if (!entry.appliesHashOnly(device_rule)) {
+      return false;
+    }
+
+    visited = &entry;
+
+    if (visitor(entry.rule)) {
+      result = entry.rule;
+      return true;
+    }
+
+    return false;
+  }
+
+  Pointer<Rule> RuleIndex::findFirst(const Rule& device_rule,
+      const std::function<bool(const Pointer<Rule>&)>& visitor,
+      uint64_t disabled_groups) const
+  {
+    if (rejects(device_rule)) {
+      return nullptr;
+    }
+
+    Pointer<Rule> hash_only_result;
+    const Entry *visited = nullptr;
+
+    if (findFirstHashOnly(device_rule, visitor, disabled_groups, hash_only_result, visited)) {
+      return hash_only_result;
+    }
+
+    /*
+     * The device rule is compiled once and each candidate rule
+     * with a valid program is evaluated without touching the
+     * rule attributes. Rules which couldn't be compiled are
+     * evaluated by Rule::appliesTo.
+     */
+    const RuleProgram device_program = RuleProgram::fromDeviceRule(device_rule);
+    Pointer<Rule> result;
+
+    visitCandidates(device_rule, [&](const Entry& entry) {
+        if (&entry == visited || (entry.group_bit & disabled_groups) != 0) {
+          return false;
+        }
+        if (applies(entry, device_rule, device_program) && visitor(entry.rule)) {
+          result = entry.rule;
+          return true;
+        }
+        return false;
+      });
+
+    return result;
+  }
+
+  PointerVector<Rule> RuleIndex::findFirstEach(const std::vector<Rule>& device_rules,
+      const std::function<bool(const Pointer<Rule>&, size_t)>& visitor,
+      uint64_t disabled_groups) const
+  {
+    PointerVector<Rule> results(device_rules.size());
+
+    if (device_rules.empty() || rejects(device_rules[0])) {
+      return results;
+    }
+
+    std::vector<RuleProgram> device_programs;
+    device_programs.reserve(device_rules.size());
+
+    for (const Rule& device_rule : device_rules) {
+      device_programs.push_back(RuleProgram::fromDeviceRule(device_rule));
+    }
+
+    /*
+     * The candidate sources depend only on the hash, device id
+     * and serial number values, which are the same for all of
+     * the device rules.
+     */
+    size_t unmatched = device_rules.size();
+
+    visitCandidates(device_rules[0], [&](const Entry& entry) {
+        if ((entry.group_bit & disabled_groups) != 0) {
+          return false;
+        }
+        for (size_t i = 0; i < device_rules.size(); ++i) {
+          if (results[i]) {
+            continue;
+          }
+          if (applies(entry, device_rules[i], device_programs[i]) && visitor(entry.rule, i)) {
+            results[i] = entry.rule;
+            --unmatched;
+          }
+        }
+        return unmatched == 0;
+      });
+
+    return results;
+  }
+
+  bool RuleIndex::applies(const Entry& entry, const Rule& device_rule, const RuleProgram& device_program)
+  {
+    if (entry.program.isValid() && device_program.isValid()) {
+      return entry.program.appliesTo(device_program);
+    }
+    return entry.rule->appliesTo(device_rule);
+  }
+
+  void RuleIndex::visitCandidates(const Rule& device_rule,
+      const std::function<bool(const Entry&)>& visitor) const
+  {
+    std::vector<const Bucket*> sources;
+
+    if (!deviceBuckets(device_rule, sources)) {
+      /*
+       * The device rule contains values which may match
+       * indexed rules from any bucket (e.g. a wildcard
+       * device id). Visit all the rules in order.
+       */
+      for (auto const& entry : _all) {
+        if (visitor(*entry.second)) {
+          return;
+        }
+      }
+      return;
+    }
+
+    sources.push_back(&_fallback);
+
+    /*
+     * Merge the candidate buckets by the order key so that
+     * the rules are visited in the same order as they appear
+     * in the rule set.
+     */
+    std::vector<Bucket::const_iterator> iterators;
+    for (auto source : sources) {
+      iterators.push_back(source->cbegin());
+    }
+
+    while (true) {
+      size_t next = sources.size();
+
+      for (size_t i = 0; i < sources.size(); ++i) {
+        if (iterators[i] == sources[i]->cend()) {
+          continue;
+        }
+        if (next == sources.size() || iterators[i]->first < iterators[next]->first) {
+          next = i;
+        }
+      }
+
+      if (next == sources.size()) {
+        break;
+      }
+
+      const Entry& entry = *iterators[next]->second;
+      ++iterators[next];
+
+      if (visitor(entry)) {
+        return;
+      }
+    }
+
+    return;
+  }
+
+  Pointer<Rule> RuleIndex::find(uint32_t rule_id) const
+  {
+    auto entry_it = _entries.find(rule_id);
+
+    if (entry_it == _entries.end()) {
+      return nullptr;
+    }
+
+    return entry_it->second.second->rule;
+  }
+
+  size_t RuleIndex::position(const PointerVector<Rule>& rules, uint32_t rule_id) const
+  {
+    auto entry_it = _entries.find(rule_id);
+
+    if (entry_it == _entries.end()) {
+      return rules.size();
+    }
+
+    /*
+     * The order keys grow with the position of the rules in
+     * the vector, so the position can be found by a binary
+     * search over the order keys.
+     */
+    const uint64_t order = entry_it->second.first;
+    auto it = std::lower_bound(rules.begin(), rules.end(), order,
+        [this](const Pointer<Rule>& rule, uint64_t order) {
+          return orderOf(*rule) < order;
+        });
+
+    if (it == rules.end() || (*it)->getRuleID() != rule_id) {
+      throw std::runtime_error("BUG: RuleIndex: rule order doesn't match the rule table");
+    }
+
+    return it - rules.begin();
+  }
+
+  uint64_t RuleIndex::orderOf(const Rule& rule) const
+  {
+    return _entries.at(rule.getRuleID()).first;
+  }
+
+  size_t RuleIndex::size() const
+  {
+    return _all.size();
+  }
+
+  static bool isSingleEquals(Rule::SetOperator op, size_t count)
+  {
+    return op == Rule::SetOperator::Equals && count == 1;
+  }
+
+  static bool isWildcardID(const String& value)
+  {
+    return value.empty() || value == "*";
+  }
+
+  static bool isConcreteDeviceID(const USBDeviceID& device_id)
+  {
+    return !(isWildcardID(device_id.getVendorID()) || isWildcardID(device_id.getProductID()));
+  }
+
+  /*
+   * Lower a device id with a concrete vendor id to the numeric
+   * ids. `any_product' is set for a wildcard product id. Returns
+   * false for a wildcard vendor id and for non-canonical ids.
+   */
+  static bool numericDeviceID(const USBDeviceID& device_id,
+      uint16_t& vendor_id, uint16_t& product_id, bool& any_product)
+  {
+    uint32_t value = 0;
+
+    if (isWildcardID(device_id.getVendorID()) ||
+        !RuleProgram::parseCanonicalID(device_id.getVendorID(), value)) {
+      return false;
+    }
+    vendor_id = static_cast<uint16_t>(value);
+    product_id = 0;
+    any_product = isWildcardID(device_id.getProductID());
+
+    if (!any_product) {
+      if (!RuleProgram::parseCanonicalID(device_id.getProductID(), value)) {
+        return false;
+      }
+      product_id = static_cast<uint16_t>(value);
+    }
+    return true;
+  }
+
+  RuleIndex::KeyType RuleIndex::ruleKey(const Rule& rule, String& key)
+  {
+    /*
+     * A single valued attribute with the default (equals)
+     * set operator matches only a device rule with exactly
+     * the same single value.
+     */
+    const auto& hash = rule.attributeHash();
+    if (isSingleEquals(hash.setOperator(), hash.count())) {
+      key = hash.get();
+      return KeyType::Hash;
+    }
+
+    const auto& device_id = rule.attributeDeviceID();
+    uint16_t vendor_id = 0;
+    uint16_t product_id = 0;
+    bool any_product = false;
+    const bool numeric_device_id = isSingleEquals(device_id.setOperator(), device_id.count()) &&
+      numericDeviceID(device_id.get(), vendor_id, product_id, any_product);
+
+    if (numeric_device_id && !any_product) {
+      key = device_id.get().getVendorID() + ":" + device_id.get().getProductID();
+      return KeyType::DeviceID;
+    }
+
+    const auto& serial = rule.attributeSerial();
+    if (isSingleEquals(serial.setOperator(), serial.count())) {
+      key = serial.get();
+      return KeyType::Serial;
+    }
+
+    const auto& parent_hash = rule.attributeParentHash();
+    if (isSingleEquals(parent_hash.setOperator(), parent_hash.count())) {
+      key = parent_hash.get();
+      return KeyType::ParentHash;
+    }
+
+    const auto& via_port = rule.attributeViaPort();
+    if (isSingleEquals(via_port.setOperator(), via_port.count())) {
+      key = via_port.get();
+      return KeyType::ViaPort;
+    }
+
+    if (numeric_device_id) {
+      key = device_id.get().getVendorID();
+      return KeyType::Vendor;
+    }
+
+    return KeyType::None;
+  }
+
+  /*
+   * The filter keys have to be computable from a device rule
+   * without building the bucket key strings. The device id
+   * keys are only defined for numeric device ids.
+   */
+  uint64_t RuleIndex::filterKey(KeyType type, const Rule& rule)
+  {
+    const std::hash<String> string_hash;
+    uint64_t value_hash = 0;
+    uint16_t vendor_id = 0;
+    uint16_t product_id = 0;
+    bool any_product = false;
+
+    switch(type) {
+      case KeyType::Hash:
+      case KeyType::ParentHash:
+        value_hash = idKey(type, rule);
+        break;
+      case KeyType::DeviceID:
+      case KeyType::Vendor:
+        (void)numericDeviceID(rule.attributeDeviceID().get(), vendor_id, product_id, any_product);
+        value_hash = type == KeyType::DeviceID ? (uint32_t(vendor_id) << 16) | product_id : vendor_id;
+        break;
+      case KeyType::Serial:
+        value_hash = string_hash(rule.attributeSerial().get());
+        break;
+      case KeyType::ViaPort:
+        value_hash = rule.attributeViaPort().values()[0].id();
+        break;
+      case KeyType::None:
+        throw std::runtime_error("BUG: RuleIndex: invalid key type");
+    }
+
+    return value_hash * 8 + static_cast<uint64_t>(type);
+  }
+
+  void RuleIndex::addFilterKey(KeyType type, const Rule& rule)
+  {
+    _key_filter.add(filterKey(type, rule));
+
+    if (_key_filter.overloaded()) {
+      rebuildKeyFilter();
+    }
+    return;
+  }
+
+  void RuleIndex::rebuildKeyFilter()
+  {
+    _key_filter.reset(_entries.size() * 2);
+
+    for (auto const& entry : _entries) {
+      const Rule& rule = *entry.second.second->rule;
+      String key;
+      const KeyType type = ruleKey(rule, key);
+
+      if (type != KeyType::None) {
+        _key_filter.add(filterKey(type, rule));
+      }
+    }
+    return;
+  }
+
+  /*
+   * Same candidate sources as deviceBuckets().
+   */
+  bool RuleIndex::deviceKeys(const Rule& device_rule, std::vector<uint64_t>& keys)
+  {
+    if (device_rule.attributeHash().count() == 1) {
+      keys.push_back(filterKey(KeyType::Hash, device_rule));
+    }
+
+    const auto& device_id = device_rule.attributeDeviceID();
+    if (device_id.count() == 1) {
+      uint16_t vendor_id = 0;
+      uint16_t product_id = 0;
+      bool any_product = false;
+
+      if (!isConcreteDeviceID(device_id.get())) {
+        return false;
+      }
+      if (numericDeviceID(device_id.get(), vendor_id, product_id, any_product)) {
+        keys.push_back(filterKey(KeyType::DeviceID, device_rule));
+      }
+    }
+
+    if (device_rule.attributeSerial().count() == 1) {
+      keys.push_back(filterKey(KeyType::Serial, device_rule));
+    }
+
+    if (device_rule.attributeParentHash().count() == 1) {
+      keys.push_back(filterKey(KeyType::ParentHash, device_rule));
+    }
+
+    if (device_rule.attributeViaPort().count() == 1) {
+      keys.push_back(filterKey(KeyType::ViaPort, device_rule));
+    }
+
+    return true;
+  }
+
+  /*
+   * The fallback rules may apply to any device rule, so nothing
+   * is rejected if there are some. Neither is a device rule whose
+   * key values may match rules from any bucket.
+   */
+  bool RuleIndex::rejects(const Rule& device_rule) const
+  {
+    if (!_fallback.empty()) {
+      return false;
+    }
+
+    std::vector<uint64_t> keys;
+
+    if (!deviceKeys(device_rule, keys)) {
+      return false;
+    }
+
+    for (const uint64_t key : keys) {
+      if (_key_filter.mayContain(key)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool RuleIndex::deviceBuckets(const Rule& device_rule, std::vector<const Bucket*>& sources) const
+  {
+    /*
+     * Rules from a bucket can only match a device rule with
+     * a single value in the keyed attribute. If the device
+     * rule has zero or multiple values there, the bucket is
+     * skipped entirely.
+     */
+    if (auto bucket = findHashBucket(device_rule)) {
+      sources.push_back(bucket);
+    }
+
+    const auto& device_id = device_rule.attributeDeviceID();
+    if (device_id.count() == 1) {
+      uint16_t vendor_id = 0;
+      uint16_t product_id = 0;
+      bool any_product = false;
+
+      if (!isConcreteDeviceID(device_id.get())) {
+        return false;
+      }
+      /*
+       * Device ids which aren't numeric are never equal to the
+       * ids of the rules in the device id buckets. The wildcards
+       * of USBDeviceID::isSubsetOf are those of the target side,
+       * so a vendor:* rule applies to a device rule only if the
+       * product id of the latter is a wildcard too. Such device
+       * rules visit all the rules; for a concrete device id the
+       * vendor:* rules are no candidates at all.
+       */
+      if (numericDeviceID(device_id.get(), vendor_id, product_id, any_product)) {
+        auto vendor_it = _vendor_buckets.find(vendor_id);
+        if (vendor_it != _vendor_buckets.end()) {
+          auto product_it = vendor_it->second.products.find(product_id);
+          if (product_it != vendor_it->second.products.end()) {
+            sources.push_back(&product_it->second);
+          }
+        }
+      }
+    }
+
+    const auto& serial = device_rule.attributeSerial();
+    if (serial.count() == 1) {
+      if (auto bucket = findBucket(_serial_buckets, serial.get())) {
+        sources.push_back(bucket);
+      }
+    }
+
+    if (auto bucket = findIDBucket(_parent_hash_buckets, device_rule.attributeParentHash())) {
+      sources.push_back(bucket);
+    }
+
+    const auto& via_port = device_rule.attributeViaPort();
+    if (via_port.count() == 1) {
+      if (auto bucket = _via_port_buckets.find(via_port.get())) {
+        sources.push_back(bucket);
+      }
+    }
+
+    return true;
+  }
+
+  StringKeyMap<RuleIndex::Bucket>& RuleIndex::buckets(KeyType type)
+  {
+    switch(type) {
+      case KeyType::Serial:
+        return _serial_buckets;
+      case KeyType::DeviceID:
+      case KeyType::Vendor:
+      case KeyType::Hash:
+      case KeyType::ParentHash:
+      case KeyType::ViaPort:
+      case KeyType::None:
+        break;
+    }
+    throw std::runtime_error("BUG: RuleIndex: invalid key type");
+  }
+
+  const RuleIndex::Bucket* RuleIndex::findBucket(const StringKeyMap<Bucket>& buckets, const String& key)
+  {
+    auto it = buckets.find(key);
+    if (it == buckets.end()) {
+      return nullptr;
+    }
+    return &it->second;
+  }
+
+  const RuleIndex::Bucket* RuleIndex::findHashBucket(const Rule& device_rule) const
+  {
+    return findIDBucket(_hash_buckets, device_rule.attributeHash());
+  }
+
+  const RuleIndex::Bucket* RuleIndex::findIDBucket(const std::unordered_map<uint32_t, Bucket>& buckets,
+      const Rule::Attribute<String>& attribute)
+  {
+    if (attribute.count() != 1) {
+      return nullptr;
+    }
+
+    auto it = buckets.find(attribute.values()[0].id());
+    if (it == buckets.end()) {
+      return nullptr;
+    }
+    return &it->second;
+  }
+
+  std::unordered_map<uint32_t, RuleIndex::Bucket>& RuleIndex::idBuckets(KeyType type)
+  {
+    switch(type) {
+      case KeyType::Hash:
+        return _hash_buckets;
+      case KeyType::ParentHash:
+        return _parent_hash_buckets;
+      case KeyType::DeviceID:
+      case KeyType::Serial:
+      case KeyType::ViaPort:
+      case KeyType::Vendor:
+      case KeyType::None:
+        break;
+    }
+    throw std::runtime_error("BUG: RuleIndex: invalid key type");
+  }
+
+  uint32_t RuleIndex::idKey(KeyType type, const Rule& rule)
+  {
+    if (type == KeyType::ParentHash) {
+      return rule.attributeParentHash().values()[0].id();
+    }
+    return rule.attributeHash().values()[0].id();
+  }
+} /* namespace usbguard */
@@ -0,0 +1,244 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "RuleProgram.hpp"
+#include "KeyFilter.hpp"
+#include "PortTrie.hpp"
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Match index over the rules of a rule set. Rules which can
+   * only match a device with one particular hash, device id,
+   * serial number, parent hash, port or vendor id value are
+   * stored in a bucket keyed by that value. All the other
+   * rules are kept in a fallback list. Each indexed rule has
+   * an order key which reflects its position in the rule set,
+   * so that the candidates for a device rule can be visited in
+   * the original first-match order. If the first candidate is
+   * a rule which constrains only hash values, it is matched
+   * without compiling the device rule. A Bloom filter over the
+   * bucket keys lets a device rule which matches no bucket
+   * fail without any lookup, as long as there are no fallback
+   * rules.
+   */
+  class RuleIndex
+  {
+  public:
+    RuleIndex();
+
+    /*
+     * Drop the current index content and index all the rules
+     * in the vector. The order of the rules is preserved.
+     */
+    void rebuild(const PointerVector<Rule>& rules);
+    void clear();
+
+    /*
+     * Append a rule after all the rules which are already
+     * indexed.
+     */
+    void append(const Pointer<Rule>& rule);
+
+    /*
+     * Index a rule which was inserted into the vector at the
+     * specified position. The rest of the vector must already
+     * be indexed.
+     */
+    void insertAt(const PointerVector<Rule>& rules, size_t position);
+
+    /*
+     * Remove a rule from the index. The rule attributes must
+     * not be modified between the insert and remove calls.
+     * Returns the order key of the removed rule.
+     */
+    uint64_t remove(const Pointer<Rule>& rule);
+
+    /*
+     * Re-insert a rule with an order key returned by remove().
+     */
+    void insert(const Pointer<Rule>& rule, uint64_t order);
+
+    /*
+     * Call `visitor' on each rule which applies to the device
+     * rule (ignoring the rule conditions) in rule set order
+     * until the visitor returns true. Returns the rule for which
+     * the visitor returned true or nullptr. The rules of the groups
+     * in the `disabled_groups' mask (see Rule::groupBit) are skipped.
+     */
+    Pointer<Rule> findFirst(const Rule& device_rule,
+        const std::function<bool(const Pointer<Rule>&)>& visitor,
+        uint64_t disabled_groups = 0) const;
+
+    /*
+     * Same as findFirst, but for several device rules which differ
+     * only in the with-interface attribute, e.g. the rules of the
+     * individual interfaces of one device. The candidate rules are
+     * visited once, in rule set order, and each of them is tried
+     * on the device rules which don't have a match yet. `visitor'
+     * also receives the index of the device rule. Returns the rule
+     * for which the visitor returned true, or nullptr, for each of
+     * the device rules.
+     */
+    PointerVector<Rule> findFirstEach(const std::vector<Rule>& device_rules,
+        const std::function<bool(const Pointer<Rule>&, size_t)>& visitor,
+        uint64_t disabled_groups = 0) const;
+
+    /*
+     * Lookup an indexed rule by its id. Returns nullptr if
+     * there's no such rule in the index.
+     */
+    Pointer<Rule> find(uint32_t rule_id) const;
+
+    /*
+     * Return the position of an indexed rule in a vector of
+     * rules which was used to build the index, or the size of
+     * the vector if the rule isn't indexed.
+     */
+    size_t position(const PointerVector<Rule>& rules, uint32_t rule_id) const;
+
+    size_t size() const;
+
+    enum class KeyType {
+      Hash,
+      DeviceID,
+      Serial,
+      ParentHash,
+      ViaPort,
+      Vendor,
+      None
+    };
+
+    /*
+     * Return the attribute whose single value `key' a device
+     * rule must have for the rule to apply to it, or None if
+     * there's no such attribute.
+     */
+    static KeyType ruleKey(const Rule& rule, String& key);
+
+    /*
+     * Return true if the key filter proves that no indexed
+     * rule applies to the device rule.
+     */
+    bool rejects(const Rule& device_rule) const;
+
+    /*
+     * 64-bit key of the `type' attribute value of a rule, see
+     * ruleKey(). Computed from the attribute value without
+     * building the key string; different values may share a key.
+     */
+    static uint64_t filterKey(KeyType type, const Rule& rule);
+
+    /*
+     * Append the keys (see filterKey()) of the buckets in which
+     * the rules applying to the device rule may be found. Returns
+     * false if rules from any bucket may apply to it.
+     */
+    static bool deviceKeys(const Rule& device_rule, std::vector<uint64_t>& keys);
+
+  private:
+
+    /*
+     * Indexed rules are stored together with their compiled
+     * match program. The entries are immutable and shared by
+     * all the buckets and copies of the index.
+     */
+    struct Entry {
+      Entry(const Pointer<Rule>& rule_ptr);
+
+      Pointer<Rule> rule;
+      RuleProgram program;
+
+      /*
+       * Set for rules which constrain only the hash value and
+       * optionally the parent hash and port values (each with
+       * a single value and the equals operator), like the rules
+       * generated with generate-policy --hash-only. Such rules
+       * are matched by comparing the interned values directly.
+       */
+      bool hash_only;
+      bool with_parent_hash;
+      bool with_via_port;
+      uint64_t group_bit;
+      InternedString parent_hash;
+      InternedString via_port;
+
+      bool appliesHashOnly(const Rule& device_rule) const;
+    };
+
+    typedef std::map<uint64_t, Pointer<const Entry>> Bucket;
+
+    uint64_t orderOf(const Rule& rule) const;
+    static const Bucket* findBucket(const StringKeyMap<Bucket>& buckets, const String& key);
+    const Bucket* findHashBucket(const Rule& device_rule) const;
+    static const Bucket* findIDBucket(const std::unordered_map<uint32_t, Bucket>& buckets,
+        const Rule::Attribute<String>& attribute);
+    bool deviceBuckets(const Rule& device_rule, std::vector<const Bucket*>& sources) const;
+    StringKeyMap<Bucket>& buckets(KeyType type);
+    /* Buckets keyed by the InternedString id of the value */
+    std::unordered_map<uint32_t, Bucket>& idBuckets(KeyType type);
+    static uint32_t idKey(KeyType type, const Rule& rule);
+    static bool applies(const Entry& entry, const Rule& device_rule, const RuleProgram& device_program);
+    /*
+     * Call `visitor' on the entries which may apply to the device
+     * rule, in rule set order, until it returns true.
+     */
+    void visitCandidates(const Rule& device_rule,
+        const std::function<bool(const Entry&)>& visitor) const;
+    void addFilterKey(KeyType type, const Rule& rule);
+    void rebuildKeyFilter();
+    bool findFirstHashOnly(const Rule& device_rule,
+        const std::function<bool(const Pointer<Rule>&)>& visitor,
+        uint64_t disabled_groups, Pointer<Rule>& result, const Entry*& visited) const;
+
+    uint64_t _order_next;
+    /* Keyed by the InternedString id of the hash value */
+    std::unordered_map<uint32_t, Bucket> _hash_buckets;
+    /*
+     * Device id buckets, keyed by the numeric vendor id and then
+     * by the product id. Each vendor also has the bucket of the
+     * rules with a vendor:* device id, so that all the device id
+     * candidates of a device are found with one vendor lookup.
+     * Rules with a *:* device id don't constrain it at all.
+     */
+    struct VendorBuckets {
+      Bucket any_product;
+      std::unordered_map<uint16_t, Bucket> products;
+    };
+    std::unordered_map<uint16_t, VendorBuckets> _vendor_buckets;
+    StringKeyMap<Bucket> _serial_buckets;
+    std::unordered_map<uint32_t, Bucket> _parent_hash_buckets;
+    /*
+     * Port-specific rules (DeviceRulesWithPort, generate-policy
+     * with port specific rules) often differ only in the port.
+     */
+    PortTrie<Bucket> _via_port_buckets;
+    Bucket _fallback;
+    Bucket _all;
+    std::unordered_map<uint32_t, std::pair<uint64_t, Pointer<const Entry>>> _entries;
+    /* Rule keys of all the bucket entries, see filterKey() */
+    KeyFilter _key_filter;
+  };
+} /* namespace usbguard */
@@ -36,12 +36,15 @@
 
 namespace usbguard
 {
-  Rule parseRuleFromString(const String& rule_spec, const String& file, size_t line, bool trace)
+  static void parseRule(Rule& rule, const String& rule_spec, const String& file, size_t line, bool trace)
   {
-    logger->debug("Trying to parse rule: \"{}\"", rule_spec);
+    USBGUARD_LOG_DEBUG("Trying to parse rule: \"{}\"", rule_spec);
+
+    if (!trace && parseCanonicalRuleFromString(rule_spec, rule)) {
+      return;
+    }
 
     try {
-      Rule rule;
 #if HAVE_PEGTL_LTE_1_3_1
       if (!trace) {
         pegtl::parse<RuleParser::rule_grammar, RuleParser::rule_parser_actions>(rule_spec, file, rule);
@@ -57,7 +60,6 @@ namespace usbguard
         pegtl::parse_string<RuleParser::rule_grammar, RuleParser::rule_parser_actions, pegtl::tracer>(rule_spec, file, rule);
       }
 #endif
-      return rule;
     }
     catch(const pegtl::parse_error& ex) {
       RuleParserError error(rule_spec);
@@ -70,14 +72,29 @@ namespace usbguard
 #endif
 
       if (!file.empty() || line != 0) {
-        error.setFileInfo(file, line);
+        error.setFileInfo(file, line, error.offset());
       }
 
       throw error;
     }
     catch(const std::exception& ex) {
-      logger->debug("std::exception: {}", ex.what());
+      USBGUARD_LOG_DEBUG("std::exception: {}", ex.what());
       throw;
     }
+    return;
+  }
+
+  Rule parseRuleFromString(const String& rule_spec, const String& file, size_t line, bool trace)
+  {
+    Rule rule;
+    parseRule(rule, rule_spec, file, line, trace);
+    return rule;
+  }
+
+  Rule parseRuleFromString(const String& rule_spec, RuleArena& arena, const String& file, size_t line, bool trace)
+  {
+    Rule rule = arena.newRule();
+    parseRule(rule, rule_spec, file, line, trace);
+    return rule;
   }
 } /* namespace usbguard */
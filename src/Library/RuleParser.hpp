@@ -19,6 +19,7 @@
 #pragma once
 #include "Typedefs.hpp"
 #include "Rule.hpp"
+#include "RuleArena.hpp"
 #include <stdexcept>
 
 namespace usbguard
@@ -102,4 +103,20 @@ namespace usbguard
   };
 
   DLL_PUBLIC Rule parseRuleFromString(const String& rule_spec, const String& file = String(), size_t line = 0, bool trace = false);
+
+  /*
+   * Same as above, but the rule data is allocated in the given arena.
+   * Used when parsing rule files and IPC rule batches.
+   */
+  DLL_PUBLIC Rule parseRuleFromString(const String& rule_spec, RuleArena& arena,
+                                      const String& file = String(), size_t line = 0, bool trace = false);
+
+  /*
+   * Parse a rule in the canonical form produced by Rule::toString()
+   * without going through the full grammar. Returns false and leaves
+   * the rule unmodified if the specification isn't in that form; the
+   * caller then has to fall back to the full parser, which also
+   * reports the errors. parseRuleFromString() does that on its own.
+   */
+  DLL_PUBLIC bool parseCanonicalRuleFromString(const String& rule_spec, Rule& rule);
 } /* namespace usbguard */
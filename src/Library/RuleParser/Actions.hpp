@@ -39,6 +39,7 @@ namespace usbguard
   struct str_via_port;
   struct str_with_interface;
   struct str_if;
+  struct str_group;
 
   template<typename Rule>
   struct rule_parser_actions : pegtl::nothing<Rule> {};
@@ -446,5 +447,40 @@ namespace usbguard
       }
     }
   };
+
+  template<typename Rule>
+  struct group_actions : pegtl::nothing<Rule> {};
+
+  template<>
+  struct group_actions<str_group>
+  {
+    template<typename Input>
+    static void apply(const Input& in, Rule& rule)
+    {
+      if (!rule.getGroup().empty()) {
+        throw pegtl::parse_error("group attribute already defined", in);
+      }
+    }
+  };
+
+  template<>
+  struct group_actions<string_value>
+  {
+    template<typename Input>
+    static void apply(const Input& in, Rule& rule)
+    {
+      const String group = stringValueFromRule(in.string());
+
+      if (group.empty()) {
+        throw pegtl::parse_error("empty group name", in);
+      }
+      try {
+        rule.setGroup(group);
+      }
+      catch(const std::exception& ex) {
+        throw pegtl::parse_error(ex.what(), in);
+      }
+    }
+  };
   } /* namespace RuleParser */
 } /* namespace usbguard */
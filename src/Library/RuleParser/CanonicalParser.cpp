@@ -0,0 +1,490 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleParser.hpp"
+#include "USB.hpp"
+
+#include <cstring>
+#include <vector>
+
+/*
+ * Single pass parser of the canonical rule form, as written by
+ * Rule::toString(). Policy files and IPC requests are generated by
+ * the same code, so they're nearly always in this form. Anything
+ * the parser doesn't recognise makes it give up without modifying
+ * the rule and the rule is parsed again using the full grammar,
+ * which also produces the error messages. The parser must never
+ * accept a rule that the grammar rejects.
+ */
+namespace usbguard
+{
+  struct CanonicalCursor
+  {
+    const char *pos;
+    const char *end;
+
+    bool atEnd() const
+    {
+      return pos == end;
+    }
+
+    bool isBlank() const
+    {
+      return pos < end && (*pos == ' ' || *pos == '\t');
+    }
+  };
+
+  template<typename ValueType>
+  struct CanonicalAttribute
+  {
+    CanonicalAttribute()
+      : present(false),
+        has_operator(false),
+        set_operator(Rule::SetOperator::Equals)
+    {
+    }
+
+    bool present;
+    bool has_operator;
+    Rule::SetOperator set_operator;
+    std::vector<ValueType> values;
+  };
+
+  /* Skip one or more blanks */
+  static bool canonicalSkipBlanks(CanonicalCursor& cursor)
+  {
+    if (!cursor.isBlank()) {
+      return false;
+    }
+    while (cursor.isBlank()) {
+      ++cursor.pos;
+    }
+    return true;
+  }
+
+  /* Read a keyword, i.e. everything up to the next blank */
+  static size_t canonicalReadWord(CanonicalCursor& cursor, const char*& word)
+  {
+    word = cursor.pos;
+    while (cursor.pos < cursor.end && !cursor.isBlank()) {
+      ++cursor.pos;
+    }
+    return cursor.pos - word;
+  }
+
+  static bool canonicalWordIs(const char *word, size_t size, const char *keyword)
+  {
+    return ::strlen(keyword) == size && ::memcmp(word, keyword, size) == 0;
+  }
+
+  static bool canonicalIsHex(char c)
+  {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+  }
+
+  static uint8_t canonicalHexValue(char c)
+  {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    return c - 'A' + 10;
+  }
+
+  static bool canonicalReadHex(CanonicalCursor& cursor, size_t digits)
+  {
+    if (static_cast<size_t>(cursor.end - cursor.pos) < digits) {
+      return false;
+    }
+    for (size_t i = 0; i < digits; ++i) {
+      if (!canonicalIsHex(cursor.pos[i])) {
+        return false;
+      }
+    }
+    cursor.pos += digits;
+    return true;
+  }
+
+  static bool canonicalParseValue(CanonicalCursor& cursor, String& value)
+  {
+    if (cursor.atEnd() || *cursor.pos != '"') {
+      return false;
+    }
+    ++cursor.pos;
+
+    const char *start = cursor.pos;
+    while (cursor.pos < cursor.end && *cursor.pos != '"' && *cursor.pos != '\\') {
+      if (*cursor.pos == '\r' || *cursor.pos == '\n') {
+        return false;
+      }
+      ++cursor.pos;
+    }
+    value.assign(start, cursor.pos);
+
+    /*
+     * Only the escape sequences produced by Utility::escapeString()
+     * are decoded here.
+     */
+    while (cursor.pos < cursor.end && *cursor.pos != '"') {
+      const char c = *cursor.pos++;
+
+      if (c == '\r' || c == '\n') {
+        return false;
+      }
+      if (c != '\\') {
+        value.push_back(c);
+        continue;
+      }
+      if (cursor.atEnd()) {
+        return false;
+      }
+
+      const char e = *cursor.pos++;
+
+      if (e == '"' || e == '\\') {
+        value.push_back(e);
+      }
+      else if (e == 'x' && canonicalReadHex(cursor, 2)) {
+        value.push_back(static_cast<char>(canonicalHexValue(cursor.pos[-2]) << 4 | canonicalHexValue(cursor.pos[-1])));
+      }
+      else {
+        return false;
+      }
+    }
+
+    if (cursor.atEnd()) {
+      return false;
+    }
+    ++cursor.pos;
+    return true;
+  }
+
+  static bool canonicalParseIDPart(CanonicalCursor& cursor)
+  {
+    if (!cursor.atEnd() && *cursor.pos == '*') {
+      ++cursor.pos;
+      return true;
+    }
+    return canonicalReadHex(cursor, 4);
+  }
+
+  static bool canonicalParseValue(CanonicalCursor& cursor, USBDeviceID& value)
+  {
+    const char *vid = cursor.pos;
+    if (!canonicalParseIDPart(cursor)) {
+      return false;
+    }
+    const char *vid_end = cursor.pos;
+
+    if (cursor.atEnd() || *cursor.pos != ':') {
+      return false;
+    }
+    ++cursor.pos;
+
+    const char *pid = cursor.pos;
+    if (!canonicalParseIDPart(cursor)) {
+      return false;
+    }
+
+    try {
+      value = USBDeviceID(String(vid, vid_end), String(pid, cursor.pos));
+    }
+    catch(...) {
+      return false;
+    }
+    return true;
+  }
+
+  /* Two hex digits or an asterisk; returns false for the asterisk */
+  static bool canonicalParseInterfacePart(CanonicalCursor& cursor, uint8_t& number, bool& ok)
+  {
+    if (!cursor.atEnd() && *cursor.pos == '*') {
+      ++cursor.pos;
+      ok = true;
+      return false;
+    }
+    ok = canonicalReadHex(cursor, 2);
+    if (ok) {
+      number = canonicalHexValue(cursor.pos[-2]) << 4 | canonicalHexValue(cursor.pos[-1]);
+    }
+    return ok;
+  }
+
+  static bool canonicalParseValue(CanonicalCursor& cursor, USBInterfaceType& value)
+  {
+    uint8_t bClass = 0;
+    uint8_t bSubClass = 0;
+    uint8_t bProtocol = 0;
+    bool ok = false;
+
+    if (!canonicalReadHex(cursor, 2)) {
+      return false;
+    }
+    bClass = canonicalHexValue(cursor.pos[-2]) << 4 | canonicalHexValue(cursor.pos[-1]);
+
+    if (cursor.atEnd() || *cursor.pos++ != ':') {
+      return false;
+    }
+    const bool with_subclass = canonicalParseInterfacePart(cursor, bSubClass, ok);
+    if (!ok || cursor.atEnd() || *cursor.pos++ != ':') {
+      return false;
+    }
+    const bool with_protocol = canonicalParseInterfacePart(cursor, bProtocol, ok);
+    if (!ok) {
+      return false;
+    }
+
+    /* A protocol without a subclass is rejected by USBInterfaceType */
+    if (with_protocol && !with_subclass) {
+      return false;
+    }
+
+    const uint8_t mask = USBInterfaceType::MatchClass | \
+      (with_subclass ? USBInterfaceType::MatchSubClass : 0) | \
+      (with_protocol ? USBInterfaceType::MatchProtocol : 0);
+
+    value = USBInterfaceType(bClass, bSubClass, bProtocol, mask);
+    return true;
+  }
+
+  static bool canonicalParseSetOperator(const char *word, size_t size, Rule::SetOperator& set_operator)
+  {
+    static const struct {
+      const char *name;
+      Rule::SetOperator set_operator;
+    } set_operators[] = {
+      { "all-of", Rule::SetOperator::AllOf },
+      { "one-of", Rule::SetOperator::OneOf },
+      { "none-of", Rule::SetOperator::NoneOf },
+      { "equals", Rule::SetOperator::Equals },
+      { "equals-ordered", Rule::SetOperator::EqualsOrdered }
+    };
+
+    for (auto const& entry : set_operators) {
+      if (canonicalWordIs(word, size, entry.name)) {
+        set_operator = entry.set_operator;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /*
+   * Parse the value part of an attribute: a single value or a
+   * "[operator] { value ... }" set.
+   */
+  template<typename ValueType>
+  static bool canonicalParseAttribute(CanonicalCursor& cursor, CanonicalAttribute<ValueType>& attribute)
+  {
+    if (attribute.present || !canonicalSkipBlanks(cursor) || cursor.atEnd()) {
+      return false;
+    }
+    attribute.present = true;
+
+    const char *value_start = cursor.pos;
+    const char *word = nullptr;
+    const size_t word_size = canonicalReadWord(cursor, word);
+
+    if (canonicalParseSetOperator(word, word_size, attribute.set_operator)) {
+      attribute.has_operator = true;
+      if (!canonicalSkipBlanks(cursor) || cursor.atEnd() || *cursor.pos != '{') {
+        return false;
+      }
+    }
+    else {
+      cursor.pos = value_start;
+    }
+
+    if (*cursor.pos != '{') {
+      ValueType value;
+      if (!canonicalParseValue(cursor, value)) {
+        return false;
+      }
+      attribute.values.push_back(std::move(value));
+      return true;
+    }
+
+    ++cursor.pos;
+    while (cursor.isBlank()) {
+      ++cursor.pos;
+    }
+
+    for (;;) {
+      ValueType value;
+      if (!canonicalParseValue(cursor, value)) {
+        return false;
+      }
+      attribute.values.push_back(std::move(value));
+
+      const bool blank = canonicalSkipBlanks(cursor);
+      if (cursor.atEnd()) {
+        return false;
+      }
+      if (*cursor.pos == '}') {
+        ++cursor.pos;
+        return true;
+      }
+      if (!blank) {
+        return false;
+      }
+    }
+  }
+
+  template<typename ValueType>
+  static void canonicalApplyAttribute(Rule::Attribute<ValueType>& target, const CanonicalAttribute<ValueType>& attribute)
+  {
+    for (auto const& value : attribute.values) {
+      target.append(value);
+    }
+    if (attribute.has_operator) {
+      target.setSetOperator(attribute.set_operator);
+    }
+    return;
+  }
+
+  bool parseCanonicalRuleFromString(const String& rule_spec, Rule& rule)
+  {
+    CanonicalCursor cursor = { rule_spec.data(), rule_spec.data() + rule_spec.size() };
+
+    const char *word = nullptr;
+    size_t word_size = canonicalReadWord(cursor, word);
+    Rule::Target target = Rule::Target::Invalid;
+
+    if (canonicalWordIs(word, word_size, "allow")) {
+      target = Rule::Target::Allow;
+    }
+    else if (canonicalWordIs(word, word_size, "block")) {
+      target = Rule::Target::Block;
+    }
+    else if (canonicalWordIs(word, word_size, "reject")) {
+      target = Rule::Target::Reject;
+    }
+    else if (canonicalWordIs(word, word_size, "match")) {
+      target = Rule::Target::Match;
+    }
+    else if (canonicalWordIs(word, word_size, "device")) {
+      target = Rule::Target::Device;
+    }
+    else {
+      return false;
+    }
+
+    CanonicalAttribute<USBDeviceID> device_id;
+    CanonicalAttribute<String> serial;
+    CanonicalAttribute<String> name;
+    CanonicalAttribute<String> hash;
+    CanonicalAttribute<String> parent_hash;
+    CanonicalAttribute<String> via_port;
+    CanonicalAttribute<USBInterfaceType> with_interface;
+    String group;
+    bool bare_device_id = false;
+
+    /* The device id may follow the target without the id keyword */
+    if (canonicalSkipBlanks(cursor)) {
+      if (cursor.atEnd()) {
+        return false;
+      }
+      const char *position = cursor.pos;
+      USBDeviceID value;
+      if (canonicalParseValue(cursor, value) && (cursor.atEnd() || cursor.isBlank())) {
+        device_id.present = true;
+        device_id.values.push_back(std::move(value));
+        bare_device_id = true;
+      }
+      else {
+        cursor.pos = position;
+      }
+    }
+    else if (!cursor.atEnd()) {
+      return false;
+    }
+
+    bool first = !bare_device_id;
+
+    while (!cursor.atEnd()) {
+      if (first) {
+        first = false;
+      }
+      else if (!canonicalSkipBlanks(cursor) || cursor.atEnd()) {
+        return false;
+      }
+
+      word_size = canonicalReadWord(cursor, word);
+      bool ok = false;
+
+      if (canonicalWordIs(word, word_size, "id")) {
+        ok = canonicalParseAttribute(cursor, device_id);
+      }
+      else if (canonicalWordIs(word, word_size, "serial")) {
+        ok = canonicalParseAttribute(cursor, serial);
+      }
+      else if (canonicalWordIs(word, word_size, "name")) {
+        ok = canonicalParseAttribute(cursor, name);
+      }
+      else if (canonicalWordIs(word, word_size, "hash")) {
+        ok = canonicalParseAttribute(cursor, hash);
+      }
+      else if (canonicalWordIs(word, word_size, "parent-hash")) {
+        ok = canonicalParseAttribute(cursor, parent_hash);
+      }
+      else if (canonicalWordIs(word, word_size, "via-port")) {
+        ok = canonicalParseAttribute(cursor, via_port);
+      }
+      else if (canonicalWordIs(word, word_size, "with-interface")) {
+        ok = canonicalParseAttribute(cursor, with_interface);
+      }
+      else if (canonicalWordIs(word, word_size, "group")) {
+        ok = group.empty() && canonicalSkipBlanks(cursor) &&
+          canonicalParseValue(cursor, group) && !group.empty();
+      }
+
+      /* Conditions and anything unknown go to the full parser */
+      if (!ok) {
+        return false;
+      }
+    }
+
+    /* The only step which may fail, so it goes first */
+    if (!group.empty()) {
+      try {
+        rule.setGroup(group);
+      }
+      catch(...) {
+        return false;
+      }
+    }
+
+    rule.setTarget(target);
+    if (bare_device_id) {
+      rule.setDeviceID(device_id.values[0]);
+    }
+    else {
+      canonicalApplyAttribute(rule.attributeDeviceID(), device_id);
+    }
+    canonicalApplyAttribute(rule.attributeSerial(), serial);
+    canonicalApplyAttribute(rule.attributeName(), name);
+    canonicalApplyAttribute(rule.attributeHash(), hash);
+    canonicalApplyAttribute(rule.attributeParentHash(), parent_hash);
+    canonicalApplyAttribute(rule.attributeViaPort(), via_port);
+    canonicalApplyAttribute(rule.attributeWithInterface(), with_interface);
+
+    return true;
+  }
+} /* namespace usbguard */
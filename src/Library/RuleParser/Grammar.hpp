@@ -43,6 +43,7 @@ namespace usbguard
   struct str_serial : pegtl_string_t("serial") {};
   struct str_if : pegtl_string_t("if") {};
   struct str_id : pegtl_string_t("id") {};
+  struct str_group : pegtl_string_t("group") {};
 
   struct str_all_of : pegtl_string_t("all-of") {};
   struct str_one_of : pegtl_string_t("one-of") {};
@@ -168,6 +169,12 @@ namespace usbguard
   struct condition_attribute
     : action<condition_actions, rule_attribute<str_if, condition>> {};
 
+  /*
+   * Rule group, a single name
+   */
+  struct group_attribute
+    : action<group_actions, seq<str_group, plus<ascii::blank>, string_value>> {};
+
   struct rule_attributes
     : sor<id_attribute,
           name_attribute,
@@ -176,7 +183,8 @@ namespace usbguard
           serial_attribute,
           via_port_attribute,
           with_interface_attribute,
-          condition_attribute> {}; 
+          condition_attribute,
+          group_attribute> {};
 
   /*
    * Rule target
@@ -21,34 +21,41 @@
 #include "LoggerPrivate.hpp"
 #include "Common/Utility.hpp"
 
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
 namespace usbguard {
-  RulePrivate::RulePrivate(Rule& p_instance)
-    : _p_instance(p_instance),
-      _device_id("id"),
+  RulePrivate::RulePrivate()
+    : _device_id("id"),
       _serial("serial"),
       _name("name"),
       _hash("hash"),
       _parent_hash("parent-hash"),
       _via_port("via-port"),
       _with_interface("with-interface"),
-      _conditions("if")
+      _conditions("if"),
+      _immutable(false),
+      _string_cache(nullptr)
   {
     _rule_id = Rule::DefaultID;
     _target = Rule::Target::Invalid;
     _conditions_state = 0;
     _timeout_seconds = 0;
+    _group_bit = 0;
   }
 
-  RulePrivate::RulePrivate(Rule& p_instance, const RulePrivate& rhs)
-    : _p_instance(p_instance),
-      _device_id("id"),
+  RulePrivate::RulePrivate(const RulePrivate& rhs)
+    : _device_id("id"),
       _serial("serial"),
       _name("name"),
       _hash("hash"),
       _parent_hash("parent-hash"),
       _via_port("via-port"),
       _with_interface("with-interface"),
-      _conditions("if")
+      _conditions("if"),
+      _immutable(false),
+      _string_cache(nullptr)
   {
     *this = rhs;
   }
@@ -70,6 +77,11 @@ namespace usbguard {
 
     _conditions_state = rhs._conditions_state;
     _timeout_seconds = rhs._timeout_seconds;
+    _group = rhs._group;
+    _group_bit = rhs._group_bit;
+
+    /* A copy is created to be modified */
+    setMutable();
 
     return *this;
 #if 0
@@ -89,6 +101,7 @@ namespace usbguard {
 
   RulePrivate::~RulePrivate()
   {
+    delete _string_cache.load();
   }
 
   bool RulePrivate::appliesTo(Pointer<const Rule> rhs, bool parent_insensitive) const
@@ -102,20 +115,21 @@ namespace usbguard {
      * This method checks whether the rule referenced by rhs belongs to
      * a set defined by this rule.
      */
-    logger->trace("Checking applicability of rule [{}] to rule [{}]",
+    USBGUARD_LOG_TRACE("Checking applicability of rule [{}] to rule [{}]",
         this->toString(/*invalid=*/true), rhs.toString(/*invalid=*/true));
 
+    /* Same order as in RuleProgram::compile */
     if (!_device_id.appliesTo(rhs.internal()->_device_id) ||
+        !_hash.appliesTo(rhs.internal()->_hash) ||
         !_serial.appliesTo(rhs.internal()->_serial) ||
         !_name.appliesTo(rhs.internal()->_name) ||
-        !_hash.appliesTo(rhs.internal()->_hash) ||
         !(parent_insensitive || _parent_hash.appliesTo(rhs.internal()->_parent_hash)) ||
         !(parent_insensitive || _via_port.appliesTo(rhs.internal()->_via_port)) ||
         !_with_interface.appliesTo(rhs.internal()->_with_interface)) {
       return false;
     }
 
-    logger->debug("Rule applies.");
+    USBGUARD_LOG_DEBUG("Rule applies.");
     return true;
   }
 
@@ -124,39 +138,97 @@ namespace usbguard {
     if (!appliesTo(rhs)) {
       return false;
     }
-    logger->debug("Evaluating whether rule {} meets conditions of rule {}", getRuleID(), rhs.getRuleID());
+    USBGUARD_LOG_DEBUG("Evaluating whether rule {} meets conditions of rule {}", getRuleID(), rhs.getRuleID());
     if (!meetsConditions(rhs, with_update)) {
-      logger->debug("Rule {} DOES NOT meet conditions of rule {}", rhs.getRuleID(), getRuleID());
+      USBGUARD_LOG_DEBUG("Rule {} DOES NOT meet conditions of rule {}", rhs.getRuleID(), getRuleID());
       return false;
     }
-    logger->debug("Rule {} meets conditions of rule {}", rhs.getRuleID(), getRuleID());
+    USBGUARD_LOG_DEBUG("Rule {} meets conditions of rule {}", rhs.getRuleID(), getRuleID());
     return true;
   }
 
-  bool RulePrivate::meetsConditions(const Rule& rhs, bool with_update)
+  bool RulePrivate::meetsConditions(const Rule& rhs, bool with_update,
+                                    RuleCondition::EvaluationMemo* memo)
   {
     if (with_update) {
-      (void)updateConditionsState(rhs);
+      (void)updateConditionsState(rhs, memo);
     }
+    return conditionsMet(conditionsState());
+  }
+
+  bool RulePrivate::conditionsMet(uint64_t state) const
+  {
     switch(_conditions.setOperator()) {
       case Rule::SetOperator::OneOf:
-	logger->debug("meetsCondition: OneOf: {}", conditionsState() > 0 ? "true" : "false");
-        return conditionsState() > 0;
+	USBGUARD_LOG_DEBUG("meetsCondition: OneOf: {}", state > 0 ? "true" : "false");
+        return state > 0;
       case Rule::SetOperator::NoneOf:
-	logger->debug("meetsCondition: NoneOf: {}", conditionsState() == 0 ? "true" : "false");
-        return conditionsState() == 0;
+	USBGUARD_LOG_DEBUG("meetsCondition: NoneOf: {}", state == 0 ? "true" : "false");
+        return state == 0;
       case Rule::SetOperator::AllOf:
       case Rule::SetOperator::Equals:
       case Rule::SetOperator::EqualsOrdered:
-	logger->debug("meetsCondition: AllOf, Equals, ...: {}",
-                      conditionsState() == ((((uint64_t)1) << _conditions.count()) - 1) ? "true" : "false");
-        return conditionsState() == ((((uint64_t)1) << _conditions.count()) - 1);
+	USBGUARD_LOG_DEBUG("meetsCondition: AllOf, Equals, ...: {}",
+                      state == ((((uint64_t)1) << _conditions.count()) - 1) ? "true" : "false");
+        return state == ((((uint64_t)1) << _conditions.count()) - 1);
       case Rule::SetOperator::Match:
         throw std::runtime_error("BUG: meetsConditions: invalid conditions set operator");
     }
     return false;
   }
 
+  const char *RulePrivate::rejectingAttribute(const Rule& rhs) const
+  {
+    /* Same order as in appliesTo */
+    if (!_device_id.appliesTo(rhs.internal()->_device_id)) {
+      return "id";
+    }
+    if (!_hash.appliesTo(rhs.internal()->_hash)) {
+      return "hash";
+    }
+    if (!_serial.appliesTo(rhs.internal()->_serial)) {
+      return "serial";
+    }
+    if (!_name.appliesTo(rhs.internal()->_name)) {
+      return "name";
+    }
+    if (!_parent_hash.appliesTo(rhs.internal()->_parent_hash)) {
+      return "parent-hash";
+    }
+    if (!_via_port.appliesTo(rhs.internal()->_via_port)) {
+      return "via-port";
+    }
+    if (!_with_interface.appliesTo(rhs.internal()->_with_interface)) {
+      return "with-interface";
+    }
+    return nullptr;
+  }
+
+  bool RulePrivate::traceConditions(const Rule& rhs, std::vector<std::pair<String, bool>>& results,
+                                    RuleCondition::EvaluationMemo* memo) const
+  {
+    const std::vector<RuleCondition*>& conditions = _conditions.values();
+    uint64_t state = conditionsState();
+
+    if (conditions.size() > (sizeof state * 8)) {
+      throw std::runtime_error("BUG: traceConditions: too many conditions");
+    }
+
+    for (size_t i = 0; i < conditions.size(); ++i) {
+      RuleCondition * const condition = conditions[i];
+      const uint64_t bit = uint64_t(1) << i;
+      bool result = (state & bit) != 0;
+
+      if (!condition->hasSideEffects()) {
+        result = condition->evaluate(rhs, memo);
+        state = result ? (state | bit) : (state & ~bit);
+      }
+      results.emplace_back(condition->toRuleString(), result);
+    }
+
+    return conditionsMet(state);
+  }
+
   void RulePrivate::initConditions(Interface * const interface)
   {
     for (auto condition : _conditions.values()) {
@@ -172,20 +244,60 @@ namespace usbguard {
     }
   }
 
-  bool RulePrivate::updateConditionsState(const Rule& rhs)
+  /*
+   * The conditions are evaluated from the cheapest one (see
+   * RuleCondition::cost()), keeping the written order within the
+   * same cost. Once a result decides the set operator, the rest
+   * of the conditions is skipped, except for the ones with side
+   * effects. The state bits of the skipped conditions keep their
+   * previous values, which doesn't change the result of
+   * meetsConditions().
+   */
+  bool RulePrivate::updateConditionsState(const Rule& rhs, RuleCondition::EvaluationMemo* memo)
   {
-    uint64_t updated_state = 0;
-    unsigned int i = 0;
+    const std::vector<RuleCondition*>& conditions = _conditions.values();
+    uint64_t updated_state = conditionsState();
 
-    for (auto condition : _conditions.values()) {
-      if (i >= (sizeof updated_state * 8)) {
-        throw std::runtime_error("BUG: updateConditionsState: too many conditions");
+    if (conditions.size() > (sizeof updated_state * 8)) {
+      throw std::runtime_error("BUG: updateConditionsState: too many conditions");
+    }
+
+    uint8_t order[sizeof updated_state * 8];
+    RuleCondition::Cost costs[sizeof updated_state * 8];
+
+    for (size_t i = 0; i < conditions.size(); ++i) {
+      costs[i] = conditions[i]->cost();
+      /* Stable insertion sort by cost */
+      size_t j = i;
+      while (j > 0 && costs[order[j - 1]] > costs[i]) {
+        order[j] = order[j - 1];
+        --j;
       }
-      updated_state |= uint64_t(condition->evaluate(rhs)) << i;
-      ++i;
+      order[j] = static_cast<uint8_t>(i);
     }
 
-    logger->debug("Condition state of rule {}: current={} updated={}",
+    /* The condition result which decides the set operator */
+    const bool decisive_result = \
+      (_conditions.setOperator() == Rule::SetOperator::OneOf ||
+       _conditions.setOperator() == Rule::SetOperator::NoneOf);
+    bool decided = false;
+
+    for (size_t n = 0; n < conditions.size(); ++n) {
+      const size_t i = order[n];
+      RuleCondition * const condition = conditions[i];
+
+      if (decided && !condition->hasSideEffects()) {
+        continue;
+      }
+
+      const bool result = condition->evaluate(rhs, memo);
+      const uint64_t bit = uint64_t(1) << i;
+
+      updated_state = result ? (updated_state | bit) : (updated_state & ~bit);
+      decided = decided || (result == decisive_result);
+    }
+
+    USBGUARD_LOG_DEBUG("Condition state of rule {}: current={} updated={}",
                   rhs.getRuleID(), conditionsState(), updated_state);
 
     if (updated_state != conditionsState()) {
@@ -376,6 +488,50 @@ namespace usbguard {
     _timeout_seconds = timeout_seconds;
   }
 
+  void RulePrivate::setGroup(const String& group)
+  {
+    _group_bit = groupBit(group);
+    _group = group;
+  }
+
+  const String& RulePrivate::getGroup() const
+  {
+    return _group;
+  }
+
+  uint64_t RulePrivate::getGroupBit() const
+  {
+    return _group_bit;
+  }
+
+  /*
+   * The group names are registered process-wide, so that the bits
+   * stay the same in all the copies of a rule set.
+   */
+  uint64_t RulePrivate::groupBit(const String& group)
+  {
+    static std::mutex groups_mutex;
+    static std::vector<String> groups;
+
+    if (group.empty()) {
+      return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(groups_mutex);
+
+    for (size_t i = 0; i < groups.size(); ++i) {
+      if (groups[i] == group) {
+        return ((uint64_t)1) << i;
+      }
+    }
+    if (groups.size() == Rule::MaxGroups) {
+      throw std::runtime_error("Too many rule groups");
+    }
+
+    groups.push_back(group);
+    return ((uint64_t)1) << (groups.size() - 1);
+  }
+
   template<class ValueType>
   static void toString_appendNonEmptyAttribute(String& rule_string, const Rule::Attribute<ValueType>& attribute)
   {
@@ -384,14 +540,41 @@ namespace usbguard {
     }
 
     rule_string.append(" ");
-    rule_string.append(attribute.toRuleString());
+    attribute.appendRuleString(rule_string);
 
     return;
   }
 
   String RulePrivate::toString(bool invalid) const
   {
+    const String* cached = _string_cache.load(std::memory_order_acquire);
+    if (cached != nullptr) {
+      return *cached;
+    }
+
     String rule_string;
+    appendToString(rule_string, invalid);
+
+    if (_immutable.load(std::memory_order_relaxed) && _target != Rule::Target::Invalid) {
+      const String* rendered = new String(rule_string);
+      if (!_string_cache.compare_exchange_strong(cached, rendered, std::memory_order_acq_rel)) {
+        /* Another thread cached it first */
+        delete rendered;
+      }
+    }
+
+    return rule_string;
+  }
+
+  void RulePrivate::appendToString(String& rule_string, bool invalid) const
+  {
+    const String* cached = _string_cache.load(std::memory_order_acquire);
+    if (cached != nullptr) {
+      rule_string.append(*cached);
+      return;
+    }
+
+    rule_string.reserve(rule_string.size() + stringSizeHint());
 
     try {
       rule_string.append(Rule::targetToString(_target));
@@ -413,7 +596,48 @@ namespace usbguard {
     toString_appendNonEmptyAttribute(rule_string, _with_interface);
     toString_appendNonEmptyAttribute(rule_string, _conditions);
 
-    return rule_string;
+    if (!_group.empty()) {
+      rule_string.append(" group ");
+      usbguard::appendRuleString(rule_string, _group);
+    }
+
+    return;
+  }
+
+  template<class ValueType>
+  static size_t toString_sizeHint(const Rule::Attribute<ValueType>& attribute)
+  {
+    return attribute.empty() ? 0 : attribute.ruleStringSizeHint() + 1;
+  }
+
+  size_t RulePrivate::stringSizeHint() const
+  {
+    return 16 + \
+      toString_sizeHint(_device_id) + \
+      toString_sizeHint(_serial) + \
+      toString_sizeHint(_name) + \
+      toString_sizeHint(_hash) + \
+      toString_sizeHint(_parent_hash) + \
+      toString_sizeHint(_via_port) + \
+      toString_sizeHint(_with_interface) + \
+      toString_sizeHint(_conditions) + \
+      (_group.empty() ? 0 : _group.size() + 9);
+  }
+
+  void RulePrivate::setImmutable()
+  {
+    _immutable.store(true, std::memory_order_relaxed);
+    return;
+  }
+
+  void RulePrivate::setMutable()
+  {
+    if (!_immutable.load(std::memory_order_relaxed)) {
+      return;
+    }
+    _immutable.store(false, std::memory_order_relaxed);
+    delete _string_cache.exchange(nullptr);
+    return;
   }
 
   RulePrivate::MetaData& RulePrivate::metadata()
@@ -431,16 +655,49 @@ namespace usbguard {
     return parseRuleFromString(rule_string);
   }
 
+  Rule RulePrivate::fromString(const String& rule_string, RuleArena& arena)
+  {
+    return parseRuleFromString(rule_string, arena);
+  }
+
   void RulePrivate::updateMetaDataCounters(bool applied, bool evaluated)
   {
+    if (!evaluated && !applied) {
+      return;
+    }
+
+    const int64_t now = MetaData::nowTicks();
+
     if (evaluated) {
-      ++_meta.counter_evaluated;
-      _meta.tp_last_evaluated = std::chrono::steady_clock::now();
+      _meta.counter_evaluated.fetch_add(1, std::memory_order_relaxed);
+      _meta.ticks_last_evaluated.store(now, std::memory_order_relaxed);
     }
     if (applied) {
-      ++_meta.counter_applied;
-      _meta.tp_last_applied = std::chrono::steady_clock::now();
+      _meta.counter_applied.fetch_add(1, std::memory_order_relaxed);
+      _meta.ticks_last_applied.store(now, std::memory_order_relaxed);
     }
     return;
   }
+
+  /*
+   * The conditions are counted by the size of their base class, the
+   * state of the derived classes is small.
+   */
+  size_t RulePrivate::memoryUsage() const
+  {
+    size_t usage = sizeof(RulePrivate);
+
+    usage += _device_id.memoryUsage() + _serial.memoryUsage() + _name.memoryUsage();
+    usage += _hash.memoryUsage() + _parent_hash.memoryUsage() + _via_port.memoryUsage();
+    usage += _with_interface.memoryUsage() + _conditions.memoryUsage();
+    usage += _conditions.count() * sizeof(RuleCondition);
+    usage += stringHeapUsage(_group);
+
+    const String* cached = _string_cache.load(std::memory_order_acquire);
+    if (cached != nullptr) {
+      usage += sizeof(String) + cached->capacity() + 1;
+    }
+
+    return usage;
+  }
 } /* namespace usbguard */
@@ -20,39 +20,106 @@
 #include <build-config.h>
 #include "Rule.hpp"
 #include "RuleCondition.hpp"
+#include "EvaluationClock.hpp"
 #include <chrono>
+#include <atomic>
 
 namespace usbguard {
   class Interface;
   class RulePrivate
   {
   public:
+    /*
+     * Rule usage counters. They are updated from the matching
+     * path and read concurrently (e.g. by statistics requests),
+     * so they are relaxed atomics. The padding keeps them off the
+     * cache lines holding the rule attributes read during matching.
+     * Time stamps are stored as steady clock ticks, zero meaning
+     * "never".
+     */
     struct MetaData {
       MetaData()
         : tp_created(std::chrono::steady_clock::now())
       {
         counter_evaluated = 0;
         counter_applied = 0;
+        ticks_last_evaluated = 0;
+        ticks_last_applied = 0;
+        for (auto& bucket : match_time_histogram) {
+          bucket = 0;
+        }
       }
 
       MetaData(const MetaData& rhs)
       {
-        counter_evaluated = rhs.counter_evaluated;
-        counter_applied = rhs.counter_applied;
+        *this = rhs;
+      }
+
+      MetaData& operator=(const MetaData& rhs)
+      {
+        counter_evaluated = rhs.counter_evaluated.load(std::memory_order_relaxed);
+        counter_applied = rhs.counter_applied.load(std::memory_order_relaxed);
+        ticks_last_evaluated = rhs.ticks_last_evaluated.load(std::memory_order_relaxed);
+        ticks_last_applied = rhs.ticks_last_applied.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < Rule::Statistics::MatchTimeBuckets; ++i) {
+          match_time_histogram[i] = rhs.match_time_histogram[i].load(std::memory_order_relaxed);
+        }
         tp_created = rhs.tp_created;
-        tp_last_evaluated = rhs.tp_last_evaluated;
-        tp_last_applied = rhs.tp_last_applied;
+        return *this;
+      }
+
+      void recordMatchTime(std::chrono::steady_clock::duration duration)
+      {
+        const uint64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        size_t bucket = 0;
+        while (bucket < Rule::Statistics::MatchTimeBuckets - 1 && usec >= (uint64_t(1) << bucket)) {
+          ++bucket;
+        }
+        match_time_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+      }
+
+      uint64_t evaluatedCount() const
+      {
+        return counter_evaluated.load(std::memory_order_relaxed);
       }
 
-      uint64_t counter_evaluated;
-      uint64_t counter_applied;
+      uint64_t appliedCount() const
+      {
+        return counter_applied.load(std::memory_order_relaxed);
+      }
+
+      std::chrono::steady_clock::time_point lastEvaluated() const
+      {
+        return fromTicks(ticks_last_evaluated.load(std::memory_order_relaxed));
+      }
+
+      std::chrono::steady_clock::time_point lastApplied() const
+      {
+        return fromTicks(ticks_last_applied.load(std::memory_order_relaxed));
+      }
+
+      static std::chrono::steady_clock::time_point fromTicks(int64_t ticks)
+      {
+        return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(ticks));
+      }
+
+      static int64_t nowTicks()
+      {
+        return EvaluationClock::now().time_since_epoch().count();
+      }
+
+      char padding_head[64];
+      std::atomic<uint64_t> counter_evaluated;
+      std::atomic<uint64_t> counter_applied;
+      std::atomic<int64_t> ticks_last_evaluated;
+      std::atomic<int64_t> ticks_last_applied;
+      std::atomic<uint64_t> match_time_histogram[Rule::Statistics::MatchTimeBuckets];
+      char padding_tail[64 - ((4 + Rule::Statistics::MatchTimeBuckets) * sizeof(uint64_t)) % 64];
       std::chrono::steady_clock::time_point tp_created;
-      std::chrono::steady_clock::time_point tp_last_evaluated;
-      std::chrono::steady_clock::time_point tp_last_applied;
     };
 
-    RulePrivate(Rule& p_instance);
-    RulePrivate(Rule& p_instance, const RulePrivate& rhs);
+    RulePrivate();
+    RulePrivate(const RulePrivate& rhs);
     const RulePrivate& operator=(const RulePrivate& rhs);
     ~RulePrivate();
 
@@ -60,12 +127,35 @@ namespace usbguard {
     bool appliesTo(const Rule& rhs, bool parent_insensitive = false) const;
     bool appliesToWithConditions(const Rule& rhs, bool with_update = false);
     
-    bool meetsConditions(const Rule& rhs, bool with_update = false);
+    /*
+     * The optional memo is shared by all the rules evaluated
+     * in one matching pass. See RuleCondition::isMemoizable().
+     */
+    bool meetsConditions(const Rule& rhs, bool with_update = false,
+                         RuleCondition::EvaluationMemo* memo = nullptr);
+
+    /*
+     * Name of the first attribute, in the matching order, which
+     * doesn't apply to rhs. Returns nullptr if all of them apply.
+     */
+    const char *rejectingAttribute(const Rule& rhs) const;
+
+    /*
+     * Evaluate the conditions against rhs without changing the
+     * condition state. A condition with side effects isn't
+     * evaluated, its last result is taken from the state. The
+     * result of each condition is appended to `results'.
+     * Returns true if the conditions are met.
+     */
+    bool traceConditions(const Rule& rhs, std::vector<std::pair<String, bool>>& results,
+                         RuleCondition::EvaluationMemo* memo = nullptr) const;
+
     void initConditions(Interface * const interface);
     void finiConditions();
-    bool updateConditionsState(const Rule& rhs);
+    bool updateConditionsState(const Rule& rhs, RuleCondition::EvaluationMemo* memo = nullptr);
     uint64_t conditionsState() const;
     void setConditionsState(uint64_t state);
+    bool conditionsMet(uint64_t state) const;
 
     void setRuleID(uint32_t rule_id);
     uint32_t getRuleID() const;
@@ -118,17 +208,35 @@ namespace usbguard {
     void setTimeoutSeconds(uint32_t timeout_seconds);
     uint32_t getTimeoutSeconds() const;
 
+    void setGroup(const String& group);
+    const String& getGroup() const;
+    uint64_t getGroupBit() const;
+
     String toString(bool invalid = false) const;
+    void appendToString(String& rule_string, bool invalid = false) const;
+    size_t stringSizeHint() const;
+
+    /*
+     * Immutable rules cache their string form. The rules stored in
+     * a rule set are marked immutable; Rule drops the mark (and the
+     * cached string) before any modification.
+     */
+    void setImmutable();
+    void setMutable();
 
     MetaData& metadata();
     const MetaData& metadata() const;
     void updateMetaDataCounters(bool applied = true, bool evaluated = false);
 
+    /* See Rule::getMemoryUsage() */
+    size_t memoryUsage() const;
+
     /*** Static methods ***/
     static Rule fromString(const String& rule_string);
+    static Rule fromString(const String& rule_string, RuleArena& arena);
+    static uint64_t groupBit(const String& group);
 
   private:
-    Rule& _p_instance;
     MetaData _meta;
     uint32_t _rule_id;
     Rule::Target _target;
@@ -142,5 +250,10 @@ namespace usbguard {
     Rule::Attribute<RuleCondition*> _conditions;
     uint64_t _conditions_state;
     uint32_t _timeout_seconds;
+    String _group;
+    uint64_t _group_bit;
+
+    std::atomic<bool> _immutable;
+    mutable std::atomic<const String*> _string_cache;
   };
 }
@@ -0,0 +1,597 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleProgram.hpp"
+#include <algorithm>
+
+namespace usbguard {
+  static const uint32_t device_id_vendor_concrete = 1 << 0;
+  static const uint32_t device_id_product_concrete = 1 << 1;
+  static const uint32_t no_offset = ~uint32_t(0);
+  static const size_t class_bitmap_words = 256 / 32;
+  static const uint32_t interface_class_wildcard = 1 << 0;
+
+  static uint32_t header(uint32_t attribute, Rule::SetOperator op, size_t count)
+  {
+    return (attribute << 24) | ((uint32_t)op << 16) | (uint32_t)count;
+  }
+
+  static uint32_t headerAttribute(uint32_t word)
+  {
+    return word >> 24;
+  }
+
+  static Rule::SetOperator headerOperator(uint32_t word)
+  {
+    return static_cast<Rule::SetOperator>((word >> 16) & 0xff);
+  }
+
+  static size_t headerCount(uint32_t word)
+  {
+    return word & 0xffff;
+  }
+
+  RuleProgram::RuleProgram()
+    : _valid(false),
+      _device(false)
+  {
+    for (auto& offset : _offsets) {
+      offset = no_offset;
+    }
+  }
+
+  RuleProgram RuleProgram::fromRule(const Rule& rule)
+  {
+    RuleProgram program;
+    program.compile(rule);
+    return program;
+  }
+
+  RuleProgram RuleProgram::fromDeviceRule(const Rule& device_rule)
+  {
+    RuleProgram program;
+    program._device = true;
+    program.compile(device_rule);
+    return program;
+  }
+
+  bool RuleProgram::isValid() const
+  {
+    return _valid;
+  }
+
+  size_t RuleProgram::size() const
+  {
+    return _code.size();
+  }
+
+  /*
+   * The attributes are emitted in the order they are evaluated by
+   * appliesTo: the most selective and cheapest first, so that most
+   * of the rules which don't apply are rejected by the first one.
+   * The device id is a single integer comparison, the hash and the
+   * serial identify a single device. The port and the interface
+   * types come last: the port is shared by all the devices plugged
+   * into it and the interface types are the most costly to match.
+   */
+  void RuleProgram::compile(const Rule& rule)
+  {
+    _valid = \
+      emitDeviceIDs(rule.attributeDeviceID()) &&
+      emitStrings(Hash, rule.attributeHash()) &&
+      emitStrings(Serial, rule.attributeSerial()) &&
+      emitStrings(Name, rule.attributeName()) &&
+      emitStrings(ParentHash, rule.attributeParentHash()) &&
+      emitStrings(ViaPort, rule.attributeViaPort()) &&
+      emitInterfaceTypes(rule.attributeWithInterface());
+
+    if (!_valid) {
+      _code.clear();
+    }
+    return;
+  }
+
+  /*
+   * Emit an attribute header. Empty attributes and the Match
+   * operator apply to anything, so they aren't emitted for rules.
+   * Device programs contain all the attributes, because they are
+   * only used as the match target.
+   */
+  bool RuleProgram::emit(Attribute attribute, Rule::SetOperator op, size_t count)
+  {
+    if (count > 0xffff) {
+      return false;
+    }
+    if (_device) {
+      _offsets[attribute] = _code.size();
+      _code.push_back(header(attribute, op, count));
+      return true;
+    }
+    if (count == 0 || op == Rule::SetOperator::Match) {
+      return true;
+    }
+    if (op == Rule::SetOperator::EqualsOrdered) {
+      /* Evaluated by Rule::appliesTo */
+      return false;
+    }
+    _code.push_back(header(attribute, op, count));
+    return true;
+  }
+
+  /*
+   * The result of the one-of and none-of operators doesn't depend on
+   * the order of the rule values. The values of these operators are
+   * stored sorted, so that a device value is looked up by a binary
+   * search, e.g. in the rules merged by generate-policy --compact.
+   */
+  static bool isExistential(Rule::SetOperator op)
+  {
+    return op == Rule::SetOperator::OneOf || op == Rule::SetOperator::NoneOf;
+  }
+
+  bool RuleProgram::emitStrings(Attribute attribute, const Rule::Attribute<String>& values)
+  {
+    const size_t code_size = _code.size();
+
+    if (!emit(attribute, values.setOperator(), values.count())) {
+      return false;
+    }
+    if (code_size == _code.size()) {
+      return true;
+    }
+
+    for (const InternedString& value : values.values()) {
+      _code.push_back(value.id());
+    }
+
+    if (!_device && isExistential(values.setOperator())) {
+      std::sort(_code.begin() + code_size + 1, _code.end());
+    }
+
+    return true;
+  }
+
+  bool RuleProgram::parseCanonicalID(const String& value, uint32_t& id)
+  {
+    if (value.size() != 4) {
+      return false;
+    }
+
+    id = 0;
+
+    for (const char c : value) {
+      id <<= 4;
+      if (c >= '0' && c <= '9') {
+        id |= c - '0';
+      }
+      else if (c >= 'a' && c <= 'f') {
+        id |= c - 'a' + 10;
+      }
+      else {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  static bool isWildcardID(const String& value)
+  {
+    return value.empty() || value == "*";
+  }
+
+  /* Sort the (id, flags) pairs of device ids */
+  static void sortDeviceIDs(uint32_t* ids, size_t count)
+  {
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+
+    for (size_t i = 0; i < count; ++i) {
+      pairs.emplace_back(ids[2 * i], ids[2 * i + 1]);
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    for (size_t i = 0; i < count; ++i) {
+      ids[2 * i] = pairs[i].first;
+      ids[2 * i + 1] = pairs[i].second;
+    }
+  }
+
+  bool RuleProgram::emitDeviceIDs(const Rule::Attribute<USBDeviceID>& values)
+  {
+    const size_t code_size = _code.size();
+
+    if (!emit(DeviceID, values.setOperator(), values.count())) {
+      return false;
+    }
+    if (code_size == _code.size()) {
+      return true;
+    }
+
+    for (const USBDeviceID& device_id : values.values()) {
+      uint32_t vendor_id = 0;
+      uint32_t product_id = 0;
+      uint32_t flags = 0;
+
+      if (!isWildcardID(device_id.getVendorID())) {
+        if (!parseCanonicalID(device_id.getVendorID(), vendor_id)) {
+          return false;
+        }
+        flags |= device_id_vendor_concrete;
+      }
+      if (!isWildcardID(device_id.getProductID())) {
+        if (!parseCanonicalID(device_id.getProductID(), product_id)) {
+          return false;
+        }
+        flags |= device_id_product_concrete;
+      }
+
+      _code.push_back((vendor_id << 16) | product_id);
+      _code.push_back(flags);
+    }
+
+    if (!_device && isExistential(values.setOperator())) {
+      sortDeviceIDs(&_code[code_size + 1], values.count());
+    }
+
+    return true;
+  }
+
+  static uint32_t interfaceFieldMask(uint32_t packed_type)
+  {
+    const uint32_t mask = packed_type >> 24;
+    uint32_t field_mask = 0;
+
+    if (mask & USBInterfaceType::MatchClass) {
+      field_mask |= 0xff0000;
+    }
+    if (mask & USBInterfaceType::MatchSubClass) {
+      field_mask |= 0x00ff00;
+    }
+    if (mask & USBInterfaceType::MatchProtocol) {
+      field_mask |= 0x0000ff;
+    }
+
+    return field_mask;
+  }
+
+  static void setClassBit(uint32_t* bitmap, uint32_t packed_type)
+  {
+    const uint32_t bClass = (packed_type >> 16) & 0xff;
+    bitmap[bClass / 32] |= uint32_t(1) << (bClass % 32);
+  }
+
+  /*
+   * Interface types are followed by a bitmap of their class codes.
+   * Rules store the types as they are, followed by the bitmap of
+   * the classes required by types with a class and a flags word.
+   * Devices store the types sorted (without the match mask), so
+   * that a rule type can be looked up by a binary search.
+   */
+  bool RuleProgram::emitInterfaceTypes(const Rule::Attribute<USBInterfaceType>& values)
+  {
+    const size_t code_size = _code.size();
+
+    if (!emit(WithInterface, values.setOperator(), values.count())) {
+      return false;
+    }
+    if (code_size == _code.size()) {
+      return true;
+    }
+
+    const size_t types_offset = _code.size();
+    uint32_t bitmap[class_bitmap_words] = { 0 };
+    uint32_t flags = 0;
+
+    for (const USBInterfaceType& type : values.values()) {
+      const uint32_t packed_type = type.packed();
+
+      if (_device) {
+        _code.push_back(packed_type & 0xffffff);
+        setClassBit(bitmap, packed_type);
+      }
+      else {
+        _code.push_back(packed_type);
+        if (interfaceFieldMask(packed_type) & 0xff0000) {
+          setClassBit(bitmap, packed_type);
+        }
+        else {
+          flags |= interface_class_wildcard;
+        }
+      }
+    }
+
+    if (_device) {
+      std::sort(_code.begin() + types_offset, _code.end());
+    }
+
+    _code.insert(_code.end(), bitmap, bitmap + class_bitmap_words);
+
+    if (!_device) {
+      _code.push_back(flags);
+    }
+
+    return true;
+  }
+
+  /*
+   * The set operator semantics are the same as in Rule::Attribute:
+   * `source' are the values of the rule attribute and `target' the
+   * values of the device rule attribute.
+   */
+  template<typename Exists>
+  static bool solve(Rule::SetOperator op, size_t source_count, size_t target_count, const Exists& exists)
+  {
+    if (op == Rule::SetOperator::Equals && source_count != target_count) {
+      return false;
+    }
+
+    for (size_t i = 0; i < source_count; ++i) {
+      const bool match = exists(i);
+
+      switch(op) {
+        case Rule::SetOperator::AllOf:
+        case Rule::SetOperator::Equals:
+          if (!match) {
+            return false;
+          }
+          break;
+        case Rule::SetOperator::OneOf:
+          if (match) {
+            return true;
+          }
+          break;
+        case Rule::SetOperator::NoneOf:
+          if (match) {
+            return false;
+          }
+          break;
+        default:
+          return false;
+      }
+    }
+
+    return op != Rule::SetOperator::OneOf;
+  }
+
+  /*
+   * Solve the set operator by testing each source value against
+   * all the target values.
+   */
+  template<typename Predicate>
+  static bool solveLinear(Rule::SetOperator op,
+                          const uint32_t* source, size_t source_count,
+                          const uint32_t* target, size_t target_count,
+                          size_t stride, const Predicate& predicate)
+  {
+    return solve(op, source_count, target_count, [&](size_t i) {
+      for (size_t j = 0; j < target_count; ++j) {
+        if (predicate(source + i * stride, target + j * stride)) {
+          return true;
+        }
+      }
+      return false;
+    });
+  }
+
+  /*
+   * Solve an existential operator over sorted rule values by looking
+   * up each device value.
+   */
+  static bool solveSorted(Rule::SetOperator op,
+                          const uint32_t* source, size_t source_count,
+                          const uint32_t* target, size_t target_count)
+  {
+    bool found = false;
+
+    for (size_t j = 0; j < target_count && !found; ++j) {
+      found = std::binary_search(source, source + source_count, target[j]);
+    }
+
+    return op == Rule::SetOperator::OneOf ? found : !found;
+  }
+
+  static bool stringEquals(const uint32_t* source, const uint32_t* target)
+  {
+    return source[0] == target[0];
+  }
+
+  /* Same as USBDeviceID::isSubsetOf */
+  static bool deviceIDSubsetOf(const uint32_t* source, const uint32_t* target)
+  {
+    if (!(target[1] & device_id_vendor_concrete)) {
+      return true;
+    }
+    if (!(source[1] & device_id_vendor_concrete) ||
+        (source[0] >> 16) != (target[0] >> 16)) {
+      return false;
+    }
+    if (!(target[1] & device_id_product_concrete)) {
+      return true;
+    }
+    if (!(source[1] & device_id_product_concrete) ||
+        (source[0] & 0xffff) != (target[0] & 0xffff)) {
+      return false;
+    }
+    return true;
+  }
+
+  /*
+   * Same as solveSorted for device ids. A concrete device id matches
+   * only a rule id with the same concrete vendor and product id, so
+   * it's looked up as such. Other device ids are solved linearly.
+   */
+  static bool solveSortedDeviceIDs(Rule::SetOperator op,
+                                   const uint32_t* source, size_t source_count,
+                                   const uint32_t* target, size_t target_count)
+  {
+    const uint32_t concrete = device_id_vendor_concrete | device_id_product_concrete;
+
+    if (target_count != 1 || target[1] != concrete) {
+      return solveLinear(op, source, source_count, target, target_count, 2, deviceIDSubsetOf);
+    }
+
+    bool found = false;
+    size_t lower = 0;
+    size_t upper = source_count;
+
+    while (lower < upper) {
+      const size_t middle = lower + (upper - lower) / 2;
+      const uint32_t* value = source + 2 * middle;
+
+      if (value[0] < target[0] || (value[0] == target[0] && value[1] < concrete)) {
+        lower = middle + 1;
+      }
+      else {
+        upper = middle;
+      }
+    }
+
+    if (lower < source_count) {
+      const uint32_t* value = source + 2 * lower;
+      found = value[0] == target[0] && value[1] == concrete;
+    }
+
+    return op == Rule::SetOperator::OneOf ? found : !found;
+  }
+
+  /*
+   * Return true if any of the sorted device types matches the rule
+   * type, i.e. USBInterfaceType::appliesTo returns true. The masks
+   * produced by the rule parser select a prefix of the class,
+   * subclass and protocol bytes, so the matching device types form
+   * a continuous range in the sorted array.
+   */
+  static bool interfaceTypeMatchesAny(uint32_t source, const uint32_t* target, size_t target_count)
+  {
+    const uint32_t field_mask = interfaceFieldMask(source);
+
+    switch(field_mask) {
+      case 0x000000:
+      case 0xff0000:
+      case 0xffff00:
+      case 0xffffff:
+        {
+          const uint32_t lower = source & field_mask;
+          const uint32_t upper = lower | (~field_mask & 0xffffff);
+          const uint32_t* it = std::lower_bound(target, target + target_count, lower);
+          return it != target + target_count && *it <= upper;
+        }
+      default:
+        for (size_t i = 0; i < target_count; ++i) {
+          if (((source ^ target[i]) & field_mask) == 0) {
+            return true;
+          }
+        }
+        return false;
+    }
+  }
+
+  static bool solveInterfaceTypes(Rule::SetOperator op,
+                                  const uint32_t* source, size_t source_count,
+                                  const uint32_t* target, size_t target_count)
+  {
+    const uint32_t* source_bitmap = source + source_count;
+    const uint32_t source_flags = source_bitmap[class_bitmap_words];
+    const uint32_t* target_bitmap = target + target_count;
+    bool intersects = false;
+    bool subset = true;
+
+    for (size_t i = 0; i < class_bitmap_words; ++i) {
+      intersects = intersects || (source_bitmap[i] & target_bitmap[i]) != 0;
+      subset = subset && (source_bitmap[i] & ~target_bitmap[i]) == 0;
+    }
+
+    /*
+     * Decide using the class bitmaps when possible. A rule type
+     * with a class can only match a device type of the same class.
+     */
+    const bool class_wildcard = source_flags & interface_class_wildcard;
+
+    switch(op) {
+      case Rule::SetOperator::OneOf:
+        if (!intersects && !class_wildcard) {
+          return false;
+        }
+        break;
+      case Rule::SetOperator::NoneOf:
+        if (!intersects && !class_wildcard) {
+          return true;
+        }
+        break;
+      case Rule::SetOperator::AllOf:
+      case Rule::SetOperator::Equals:
+        if (!subset) {
+          return false;
+        }
+        break;
+      default:
+        break;
+    }
+
+    return solve(op, source_count, target_count, [&](size_t i) {
+      return interfaceTypeMatchesAny(source[i], target, target_count);
+    });
+  }
+
+  bool RuleProgram::appliesTo(const RuleProgram& device) const
+  {
+    size_t pc = 0;
+
+    while (pc < _code.size()) {
+      const uint32_t rule_header = _code[pc];
+      const uint32_t attribute = headerAttribute(rule_header);
+      const Rule::SetOperator op = headerOperator(rule_header);
+      const size_t count = headerCount(rule_header);
+      const uint32_t device_offset = device._offsets[attribute];
+      const uint32_t* source = &_code[pc + 1];
+      const uint32_t* target = &device._code[device_offset + 1];
+      const size_t target_count = headerCount(device._code[device_offset]);
+      bool applies = false;
+
+      switch(attribute) {
+        case DeviceID:
+          if (isExistential(op)) {
+            applies = solveSortedDeviceIDs(op, source, count, target, target_count);
+          }
+          else {
+            applies = solveLinear(op, source, count, target, target_count, 2, deviceIDSubsetOf);
+          }
+          pc += 1 + 2 * count;
+          break;
+        case WithInterface:
+          applies = solveInterfaceTypes(op, source, count, target, target_count);
+          pc += 1 + count + class_bitmap_words + 1;
+          break;
+        default:
+          if (isExistential(op)) {
+            applies = solveSorted(op, source, count, target, target_count);
+          }
+          else {
+            applies = solveLinear(op, source, count, target, target_count, 1, stringEquals);
+          }
+          pc += 1 + count;
+      }
+
+      if (!applies) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include <vector>
+
+namespace usbguard {
+  /*
+   * A rule lowered into a compact match program. String values
+   * are replaced by their InternedString ids, device ids are packed into a
+   * 32-bit value and interface types into the value returned by
+   * USBInterfaceType::packed(), so that evaluating the program
+   * needs only integer comparisons.
+   *
+   * The program is a flat array of 32-bit words. Each attribute
+   * is encoded as a header word followed by its operands:
+   *
+   *   header: attribute (8 bits) | set operator (8 bits) | value count (16 bits)
+   *   string value: 1 word (InternedString id)
+   *   device id value: 2 words (vendor << 16 | product, concreteness flags)
+   *   interface type value: 1 word (packed type)
+   *
+   * Interface types are followed by a class bitmap (8 words) and,
+   * in rule programs, a flags word. See emitInterfaceTypes().
+   *
+   * Rules which can't be lowered (e.g. non-canonical device id
+   * strings) produce an invalid program and have to be evaluated
+   * using Rule::appliesTo instead.
+   */
+  class RuleProgram
+  {
+  public:
+    RuleProgram();
+
+    /*
+     * Compile the attributes of a rule set rule.
+     */
+    static RuleProgram fromRule(const Rule& rule);
+
+    /*
+     * Compile the attributes of a device rule, i.e. the target of
+     * the match.
+     */
+    static RuleProgram fromDeviceRule(const Rule& device_rule);
+
+    bool isValid() const;
+
+    /*
+     * Evaluate this (rule) program against a device rule program.
+     * Both programs have to be valid. The result is the same as
+     * the result of Rule::appliesTo on the source rules.
+     */
+    bool appliesTo(const RuleProgram& device) const;
+
+    size_t size() const;
+
+    /*
+     * Parse a canonical (four lower-case hex digits) vendor or
+     * product id string. Non-canonical strings are compared as
+     * strings by USBDeviceID, so they can't be lowered.
+     */
+    static bool parseCanonicalID(const String& value, uint32_t& id);
+
+  private:
+    enum Attribute {
+      Name = 0,
+      Serial,
+      Hash,
+      ParentHash,
+      ViaPort,
+      DeviceID,
+      WithInterface,
+      AttributeCount
+    };
+
+    void compile(const Rule& rule);
+    bool emit(Attribute attribute, Rule::SetOperator op, size_t count);
+    bool emitStrings(Attribute attribute, const Rule::Attribute<String>& values);
+    bool emitDeviceIDs(const Rule::Attribute<USBDeviceID>& values);
+    bool emitInterfaceTypes(const Rule::Attribute<USBInterfaceType>& values);
+
+    std::vector<uint32_t> _code;
+    uint32_t _offsets[AttributeCount]; /* header positions, device programs only */
+    bool _valid;
+    bool _device;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,96 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleQueryCache.hpp"
+#include "RulePrivate.hpp"
+
+namespace usbguard {
+  /* Number of distinct queries kept by the shared cache */
+  static const size_t G_shared_query_cache_size = 64;
+
+  RuleQueryCache::RuleQueryCache(size_t capacity)
+    : _capacity(capacity)
+  {
+    if (_capacity == 0) {
+      throw std::runtime_error("RuleQueryCache: the capacity must not be zero");
+    }
+  }
+
+  Pointer<const Rule> RuleQueryCache::get(const String& query)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      auto const it = _index.find(query);
+      if (it != _index.end()) {
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return it->second->second;
+      }
+    }
+
+    /*
+     * Parse without holding the lock. If another thread parsed
+     * the same query meanwhile, its result is kept.
+     */
+    auto rule = makePointer<Rule>(Rule::fromString(query));
+    rule->internal()->setImmutable();
+    Pointer<const Rule> parsed = rule;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto const it = _index.find(query);
+
+    if (it != _index.end()) {
+      _entries.splice(_entries.begin(), _entries, it->second);
+      return it->second->second;
+    }
+
+    _entries.emplace_front(query, parsed);
+    _index[query] = _entries.begin();
+
+    if (_entries.size() > _capacity) {
+      _index.erase(_entries.back().first);
+      _entries.pop_back();
+    }
+
+    return parsed;
+  }
+
+  void RuleQueryCache::clear()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _index.clear();
+    _entries.clear();
+    return;
+  }
+
+  size_t RuleQueryCache::size() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _entries.size();
+  }
+
+  size_t RuleQueryCache::capacity() const
+  {
+    return _capacity;
+  }
+
+  RuleQueryCache& RuleQueryCache::shared()
+  {
+    static RuleQueryCache cache(G_shared_query_cache_size);
+    return cache;
+  }
+} /* namespace usbguard */
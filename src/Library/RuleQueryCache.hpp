@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace usbguard {
+  /*
+   * Least recently used cache of parsed device queries (rule
+   * strings), keyed by the query text. The cached rules are
+   * immutable and may be used by several threads at once.
+   */
+  class DLL_PUBLIC RuleQueryCache
+  {
+  public:
+    explicit RuleQueryCache(size_t capacity);
+
+    /*
+     * The parsed form of `query'. The query is parsed only if
+     * it isn't cached. Throws the rule parser exceptions.
+     */
+    Pointer<const Rule> get(const String& query);
+
+    void clear();
+    size_t size() const;
+    size_t capacity() const;
+
+    /*
+     * The cache shared by the IPC, D-Bus and rule condition
+     * queries of the process.
+     */
+    static RuleQueryCache& shared();
+
+  private:
+    typedef std::list<std::pair<String, Pointer<const Rule>>> Entries;
+
+    const size_t _capacity;
+    Entries _entries;
+    std::unordered_map<String, Entries::iterator> _index;
+    mutable std::mutex _mutex;
+  };
+} /* namespace usbguard */
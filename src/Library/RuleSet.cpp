@@ -20,6 +20,39 @@
 #include "RuleSetPrivate.hpp"
 
 namespace usbguard {
+  RuleSet::Operation RuleSet::Operation::append(const Rule& rule, uint32_t parent_id)
+  {
+    Operation operation;
+    operation.type = Type::Append;
+    operation.rule = rule;
+    operation.id = Rule::DefaultID;
+    operation.parent_id = parent_id;
+    operation.parent_insensitive = false;
+    return operation;
+  }
+
+  RuleSet::Operation RuleSet::Operation::remove(uint32_t id)
+  {
+    Operation operation;
+    operation.type = Type::Remove;
+    operation.id = id;
+    operation.parent_id = Rule::LastID;
+    operation.parent_insensitive = false;
+    return operation;
+  }
+
+  RuleSet::Operation RuleSet::Operation::upsert(const Rule& match_rule, const Rule& rule, bool parent_insensitive)
+  {
+    Operation operation;
+    operation.type = Type::Upsert;
+    operation.rule = rule;
+    operation.match_rule = match_rule;
+    operation.id = Rule::DefaultID;
+    operation.parent_id = Rule::LastID;
+    operation.parent_insensitive = parent_insensitive;
+    return operation;
+  }
+
   RuleSet::RuleSet(Interface * const interface_ptr)
   {
     d_pointer = new RuleSetPrivate(*this, interface_ptr);
@@ -68,6 +101,17 @@ namespace usbguard {
     return;
   }
   
+  bool RuleSet::loadCache(const String& cache_path, const String& rule_path)
+  {
+    return d_pointer->loadCache(cache_path, rule_path);
+  }
+
+  void RuleSet::saveCache(const String& cache_path, const String& rule_path) const
+  {
+    d_pointer->saveCache(cache_path, rule_path);
+    return;
+  }
+
   void RuleSet::setDefaultTarget(Rule::Target target)
   {
     d_pointer->setDefaultTarget(target);
@@ -90,6 +134,11 @@ namespace usbguard {
     return d_pointer->upsertRule(match_rule, new_rule, parent_insensitive);
   }
 
+  std::vector<uint32_t> RuleSet::applyBatch(const std::vector<Operation>& operations)
+  {
+    return d_pointer->applyBatch(operations);
+  }
+
   Pointer<const Rule> RuleSet::getRule(uint32_t id)
   {
     return d_pointer->getRule(id);
@@ -105,11 +154,78 @@ namespace usbguard {
     return d_pointer->getFirstMatchingRule(device_rule, from_id);
   }
 
+  PointerVector<Rule> RuleSet::getFirstMatchingInterfaceRules(Pointer<const Rule> device_rule) const
+  {
+    return d_pointer->getFirstMatchingInterfaceRules(device_rule);
+  }
+
+  std::vector<RuleSet::MatchTraceStep> RuleSet::explainMatch(Pointer<const Rule> device_rule) const
+  {
+    return d_pointer->explainMatch(device_rule);
+  }
+
+  PointerVector<const Rule> RuleSet::getApplyingRules(const Rule& device_rule) const
+  {
+    return d_pointer->getApplyingRules(device_rule);
+  }
+
   PointerVector<const Rule> RuleSet::getRules()
   {
     return d_pointer->getRules();
   }
 
+  bool RuleSet::setRuleStatistics(uint32_t id, const Rule::Statistics& statistics)
+  {
+    return d_pointer->setRuleStatistics(id, statistics);
+  }
+
+  bool RuleSet::usesDeviceHash() const
+  {
+    return d_pointer->usesDeviceHash();
+  }
+
+  void RuleSet::setSealed(bool sealed)
+  {
+    d_pointer->setSealed(sealed);
+    return;
+  }
+
+  bool RuleSet::isSealed() const
+  {
+    return d_pointer->isSealed();
+  }
+
+  bool RuleSet::setGroupEnabled(const std::string& group, bool enabled)
+  {
+    return d_pointer->setGroupEnabled(group, enabled);
+  }
+
+  bool RuleSet::isGroupEnabled(const std::string& group) const
+  {
+    return d_pointer->isGroupEnabled(group);
+  }
+
+  uint32_t RuleSet::saveSnapshot(const std::string& name)
+  {
+    return d_pointer->saveSnapshot(name);
+  }
+
+  std::vector<RuleSet::SnapshotInfo> RuleSet::listSnapshots() const
+  {
+    return d_pointer->listSnapshots();
+  }
+
+  bool RuleSet::rollback(uint32_t version, Changes& changes, const std::string& save_as)
+  {
+    return d_pointer->rollback(version, changes, save_as);
+  }
+
+  void RuleSet::setSnapshotLimit(size_t limit)
+  {
+    d_pointer->setSnapshotLimit(limit);
+    return;
+  }
+
   Pointer<Rule> RuleSet::getTimedOutRule()
   {
     return d_pointer->getTimedOutRule();
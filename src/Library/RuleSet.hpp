@@ -21,6 +21,8 @@
 #include <Rule.hpp>
 #include <istream>
 #include <ostream>
+#include <vector>
+#include <utility>
 
 namespace usbguard {
   class RuleSetPrivate;
@@ -28,6 +30,62 @@ namespace usbguard {
   class DLL_PUBLIC RuleSet
   {
   public:
+    /**
+     * A single modification of the ruleset. See applyBatch().
+     */
+    struct Operation
+    {
+      enum class Type {
+        Append, /**< Append `rule' after the rule with id `parent_id' */
+        Remove, /**< Remove the rule with id `id' */
+        Upsert  /**< Update the rule matching `match_rule' with `rule' */
+      };
+
+      static Operation append(const Rule& rule, uint32_t parent_id = Rule::LastID);
+      static Operation remove(uint32_t id);
+      static Operation upsert(const Rule& match_rule, const Rule& rule, bool parent_insensitive = false);
+
+      Type type;
+      Rule rule;
+      Rule match_rule;
+      uint32_t id;
+      uint32_t parent_id;
+      bool parent_insensitive;
+    };
+
+    /**
+     * A saved version of the ruleset. See saveSnapshot().
+     */
+    struct SnapshotInfo
+    {
+      uint32_t version; /**< Unique number, increasing with each snapshot */
+      std::string name;
+      uint64_t time; /**< Creation time in seconds since the epoch */
+      size_t rule_count;
+    };
+
+    /**
+     * The difference between two versions of the ruleset. See rollback().
+     */
+    struct Changes
+    {
+      std::vector<Rule> rules; /**< Rules which are new or were modified */
+      std::vector<uint32_t> removed_ids; /**< Ids of the rules which were removed or modified */
+    };
+
+    /**
+     * A rule visited by explainMatch().
+     */
+    struct MatchTraceStep
+    {
+      uint32_t rule_id;
+      Rule::Target target;
+      std::string rejected_by; /**< First attribute which doesn't apply, empty if all do */
+      std::vector<std::pair<std::string, bool>> conditions; /**< Each condition and its result */
+      bool matched;
+      uint64_t time_ns; /**< Time spent evaluating the rule */
+    };
+
     /**
      * Construct an empty ruleset.
      */
@@ -63,6 +121,22 @@ namespace usbguard {
      */
     void save(std::ostream& stream) const;
 
+    /**
+     * Load a ruleset from a binary cache file at `cache_path' created by saveCache().
+     * The cache is used only if it was created from the current content of the rule
+     * file at `rule_path'. Returns true if the rules were loaded from the cache and
+     * false if the cache is missing, stale or invalid. The ruleset isn't modified
+     * in the latter case.
+     */
+    bool loadCache(const String& cache_path, const String& rule_path);
+
+    /**
+     * Store the ruleset into a binary cache file at `cache_path'. The cache will be
+     * valid only for the current content of the rule file at `rule_path', which is
+     * expected to contain the same rules.
+     */
+    void saveCache(const String& cache_path, const String& rule_path) const;
+
     /**
      * Set an implicit default target which will be used if there's no match for a device
      * rule.
@@ -91,6 +165,15 @@ namespace usbguard {
      */
     uint32_t upsertRule(const Rule& match_rule, const Rule& new_rule, bool parent_insensitive = false);
 
+    /**
+     * Apply a list of operations to the ruleset as a single transaction.
+     * Either all of the operations are applied or, if any of them fails,
+     * the ruleset is left unchanged and the exception is rethrown.
+     *
+     * Returns the id of the affected rule for each operation.
+     */
+    std::vector<uint32_t> applyBatch(const std::vector<Operation>& operations);
+
     /**
      * Get a rule pointer to a rule with the specified sequence number.
      * Returns nullptr if no such rule exists.
@@ -110,11 +193,112 @@ namespace usbguard {
      */
     Pointer<Rule> getFirstMatchingRule(Pointer<const Rule> device_rule, uint32_t from_id = 1) const;
 
+    /**
+     * Match the interfaces of a device individually. For each value of the
+     * with-interface attribute of `device_rule', find the first rule which matches
+     * the device rule with only that interface type in the attribute. All of the
+     * interfaces are matched in a single pass over the ruleset. The result holds
+     * one rule for each interface type, in the attribute order. If there's no
+     * match for an interface, an implicit rule with the default target is used.
+     * The match results aren't cached.
+     */
+    PointerVector<Rule> getFirstMatchingInterfaceRules(Pointer<const Rule> device_rule) const;
+
+    /**
+     * Match the device rule the same way as getFirstMatchingRule(), but visit
+     * the rules one by one and record why each of them did or didn't match.
+     * The visit stops at the first matching rule. Neither the match cache nor
+     * the condition state and the usage counters of the rules are modified;
+     * conditions with side effects aren't evaluated and report their last
+     * result instead.
+     */
+    std::vector<MatchTraceStep> explainMatch(Pointer<const Rule> device_rule) const;
+
+    /**
+     * Get all the rules which apply to the device rule, ignoring the rule conditions,
+     * in rule set order. Only the candidates from the match index are visited, so this
+     * is much cheaper than matching each rule of a large ruleset. Neither the match
+     * cache nor the usage counters of the rules are modified.
+     */
+    PointerVector<const Rule> getApplyingRules(const Rule& device_rule) const;
+
     /**
      * Get all rules from the set.
      */
     PointerVector<const Rule> getRules();
 
+    /**
+     * Set the usage counters of the rule with the specified sequence number,
+     * see Rule::setStatistics(). Returns false if no such rule exists.
+     */
+    bool setRuleStatistics(uint32_t id, const Rule::Statistics& statistics);
+
+    /**
+     * Returns true if any rule in the ruleset has a hash or parent-hash attribute.
+     * The result is computed once per modification of the ruleset.
+     */
+    bool usesDeviceHash() const;
+
+    /**
+     * Seal or unseal the ruleset. A sealed ruleset is matched using a read-only
+     * index built with a minimal perfect hash over the rule keys, which is rebuilt
+     * on each modification of the ruleset. Sealing is meant for rulesets which
+     * are rarely or never modified after they have been loaded.
+     */
+    void setSealed(bool sealed);
+
+    /**
+     * Returns true if the ruleset is sealed, see setSealed().
+     */
+    bool isSealed() const;
+
+    /**
+     * Enable or disable the rules of a group (see Rule::setGroup). The rules
+     * of a disabled group stay in the ruleset, but the matching skips them.
+     * This only flips a bit of the group mask of the ruleset, the rules aren't
+     * re-indexed. Groups are enabled by default. Returns true if the state of
+     * the group changed.
+     */
+    bool setGroupEnabled(const std::string& group, bool enabled);
+
+    /**
+     * Returns false if the group was disabled, see setGroupEnabled().
+     */
+    bool isGroupEnabled(const std::string& group) const;
+
+    /**
+     * Save the current version of the ruleset under `name'. Saving is cheap:
+     * the snapshot shares the rules and the match index with the ruleset until
+     * the ruleset is modified. Only the most recent snapshots are kept, see
+     * setSnapshotLimit(). Snapshots aren't copied with the ruleset.
+     *
+     * Returns the version number of the snapshot.
+     */
+    uint32_t saveSnapshot(const std::string& name);
+
+    /**
+     * Get the saved snapshots, oldest first.
+     */
+    std::vector<SnapshotInfo> listSnapshots() const;
+
+    /**
+     * Replace the ruleset with the saved snapshot `version'. The snapshot is
+     * made current as it is, without copying or re-indexing the rules. The rule
+     * ids aren't reused after a rollback. `changes' is set to the difference
+     * between the replaced and the restored version. If `save_as' isn't empty,
+     * the replaced version is saved under that name first, even if that drops
+     * the restored snapshot because of the limit.
+     *
+     * Returns false if there's no such snapshot.
+     */
+    bool rollback(uint32_t version, Changes& changes, const std::string& save_as = std::string());
+
+    /**
+     * Set the number of snapshots to keep. The oldest ones are dropped when
+     * the limit is exceeded. The default is 16.
+     */
+    void setSnapshotLimit(size_t limit);
+
     /**
      * Get the oldest rule that timed out and should be removed from the ruleset.
      * Returns nullptr if there are not timed out rules.
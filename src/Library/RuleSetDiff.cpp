@@ -0,0 +1,238 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleSetDiff.hpp"
+
+#include <unordered_map>
+
+namespace usbguard {
+  namespace
+  {
+    /*
+     * Marks the elements of the longest common subsequence of `a'
+     * and `b' in `a_kept' and `b_kept'. The rules are compared by
+     * their symbols, so each comparison is an integer comparison.
+     */
+    class SequenceDiff
+    {
+    public:
+      SequenceDiff(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+        : _a(a),
+          _b(b),
+          a_kept(a.size(), false),
+          b_kept(b.size(), false)
+      {
+        const size_t max_d = (a.size() + b.size() + 1) / 2 + 1;
+        _forward.resize(2 * max_d + 2);
+        _backward.resize(2 * max_d + 2);
+        compare(0, a.size(), 0, b.size());
+      }
+
+    private:
+      const std::vector<uint32_t>& _a;
+      const std::vector<uint32_t>& _b;
+      std::vector<long> _forward;
+      std::vector<long> _backward;
+
+    public:
+      std::vector<bool> a_kept;
+      std::vector<bool> b_kept;
+
+    private:
+      void keep(size_t a_index, size_t b_index)
+      {
+        a_kept[a_index] = true;
+        b_kept[b_index] = true;
+        return;
+      }
+
+      /*
+       * Find the middle snake of the shortest edit script between
+       * a[a_begin, a_end) and b[b_begin, b_end): the diagonal run
+       * (x, y) -> (u, v) crossed by the script halfway through.
+       * Both ranges are non-empty.
+       */
+      void middleSnake(size_t a_begin, size_t a_end, size_t b_begin, size_t b_end,
+                       size_t& x_out, size_t& y_out, size_t& u_out, size_t& v_out)
+      {
+        const long n = static_cast<long>(a_end - a_begin);
+        const long m = static_cast<long>(b_end - b_begin);
+        const long delta = n - m;
+        const bool odd = (delta % 2) != 0;
+        const long max_d = (n + m + 1) / 2;
+        const long offset = max_d + 1;
+
+        _forward[offset + 1] = 0;
+        _backward[offset + 1] = 0;
+
+        for (long d = 0; d <= max_d; ++d) {
+          for (long k = -d; k <= d; k += 2) {
+            long x = (k == -d || (k != d && _forward[offset + k - 1] < _forward[offset + k + 1])) ? \
+              _forward[offset + k + 1] : _forward[offset + k - 1] + 1;
+            long y = x - k;
+            const long x_start = x;
+            const long y_start = y;
+
+            while (x < n && y < m && _a[a_begin + x] == _b[b_begin + y]) {
+              ++x;
+              ++y;
+            }
+            _forward[offset + k] = x;
+
+            const long c = delta - k;
+            if (odd && c >= -(d - 1) && c <= d - 1 && x + _backward[offset + c] >= n) {
+              x_out = a_begin + x_start;
+              y_out = b_begin + y_start;
+              u_out = a_begin + x;
+              v_out = b_begin + y;
+              return;
+            }
+          }
+
+          for (long c = -d; c <= d; c += 2) {
+            long x = (c == -d || (c != d && _backward[offset + c - 1] < _backward[offset + c + 1])) ? \
+              _backward[offset + c + 1] : _backward[offset + c - 1] + 1;
+            long y = x - c;
+            const long x_start = x;
+            const long y_start = y;
+
+            while (x < n && y < m && _a[a_end - 1 - x] == _b[b_end - 1 - y]) {
+              ++x;
+              ++y;
+            }
+            _backward[offset + c] = x;
+
+            const long k = delta - c;
+            if (!odd && k >= -d && k <= d && x + _forward[offset + k] >= n) {
+              x_out = a_end - x;
+              y_out = b_end - y;
+              u_out = a_end - x_start;
+              v_out = b_end - y_start;
+              return;
+            }
+          }
+        }
+
+        throw std::runtime_error("BUG: RuleSetDiff: no middle snake found");
+      }
+
+      void compare(size_t a_begin, size_t a_end, size_t b_begin, size_t b_end)
+      {
+        while (a_begin < a_end && b_begin < b_end && _a[a_begin] == _b[b_begin]) {
+          keep(a_begin++, b_begin++);
+        }
+        while (a_begin < a_end && b_begin < b_end && _a[a_end - 1] == _b[b_end - 1]) {
+          keep(--a_end, --b_end);
+        }
+        if (a_begin == a_end || b_begin == b_end) {
+          return;
+        }
+
+        size_t x = 0, y = 0, u = 0, v = 0;
+        middleSnake(a_begin, a_end, b_begin, b_end, x, y, u, v);
+
+        /*
+         * Both ranges differ at their ends, so the middle snake
+         * splits them into two strictly smaller problems.
+         */
+        compare(a_begin, x, b_begin, y);
+        for (size_t i = 0; i < u - x; ++i) {
+          keep(x + i, y + i);
+        }
+        compare(u, a_end, v, b_end);
+        return;
+      }
+    };
+  } /* namespace */
+
+  RuleSetDiff::RuleSetDiff(const PointerVector<const Rule>& current_rules, const std::vector<Rule>& target_rules)
+    : _kept_count(0),
+      _removed_count(0),
+      _inserted_count(0)
+  {
+    std::unordered_map<String, uint32_t> symbols;
+    std::vector<uint32_t> current_symbols;
+    std::vector<uint32_t> target_symbols;
+
+    for (auto const& rule : current_rules) {
+      current_symbols.push_back(symbols.emplace(rule->toString(), symbols.size()).first->second);
+    }
+    for (auto const& rule : target_rules) {
+      target_symbols.push_back(symbols.emplace(rule.toString(), symbols.size()).first->second);
+    }
+
+    const SequenceDiff diff(current_symbols, target_symbols);
+
+    for (size_t i = 0; i < current_rules.size(); ++i) {
+      if (diff.a_kept[i]) {
+        ++_kept_count;
+      }
+      else {
+        _operations.push_back(RuleSet::Operation::remove(current_rules[i]->getRuleID()));
+        ++_removed_count;
+      }
+    }
+
+    /*
+     * The new rules of a run are inserted after the same kept rule
+     * in reverse order, which leaves them in the target order.
+     */
+    std::vector<uint32_t> parent_ids(target_rules.size(), Rule::RootID);
+    uint32_t parent_id = Rule::RootID;
+
+    for (size_t a = 0, b = 0; b < target_rules.size(); ++b) {
+      if (diff.b_kept[b]) {
+        while (!diff.a_kept[a]) {
+          ++a;
+        }
+        parent_id = current_rules[a++]->getRuleID();
+      }
+      parent_ids[b] = parent_id;
+    }
+
+    for (size_t b = target_rules.size(); b > 0; --b) {
+      if (diff.b_kept[b - 1]) {
+        continue;
+      }
+      Rule rule = target_rules[b - 1];
+      rule.setRuleID(Rule::DefaultID);
+      _operations.push_back(RuleSet::Operation::append(rule, parent_ids[b - 1]));
+      ++_inserted_count;
+    }
+  }
+
+  const std::vector<RuleSet::Operation>& RuleSetDiff::operations() const
+  {
+    return _operations;
+  }
+
+  size_t RuleSetDiff::keptCount() const
+  {
+    return _kept_count;
+  }
+
+  size_t RuleSetDiff::removedCount() const
+  {
+    return _removed_count;
+  }
+
+  size_t RuleSetDiff::insertedCount() const
+  {
+    return _inserted_count;
+  }
+} /* namespace usbguard */
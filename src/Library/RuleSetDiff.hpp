@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "RuleSet.hpp"
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Minimal edit script between two versions of a rule set. The
+   * rules are compared by their string form and the longest common
+   * subsequence of the two rule lists is kept, so the ids (and the
+   * statistics) of all the rules which appear in both versions in
+   * the same relative order stay the same.
+   *
+   * The subsequence is found with the linear space variant of the
+   * Myers O(ND) difference algorithm, so the cost depends on the
+   * number of the changed rules rather than on the size of the
+   * rule set.
+   */
+  class DLL_PUBLIC RuleSetDiff
+  {
+  public:
+    RuleSetDiff(const PointerVector<const Rule>& current_rules, const std::vector<Rule>& target_rules);
+
+    /*
+     * Operations which turn the current rules into the target rules
+     * when applied as one batch: the removals first, then the new
+     * rules, each inserted after the kept rule which precedes it in
+     * the target rules.
+     */
+    const std::vector<RuleSet::Operation>& operations() const;
+
+    size_t keptCount() const;
+    size_t removedCount() const;
+    size_t insertedCount() const;
+
+  private:
+    std::vector<RuleSet::Operation> _operations;
+    size_t _kept_count;
+    size_t _removed_count;
+    size_t _inserted_count;
+  };
+} /* namespace usbguard */
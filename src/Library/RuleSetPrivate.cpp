@@ -20,25 +20,65 @@
 #include "RuleSetPrivate.hpp"
 #include "RulePrivate.hpp"
 #include "RuleParser.hpp"
+#include "RuleArena.hpp"
+#include "RuleCache.hpp"
+#include "EvaluationClock.hpp"
+#include "Common/Utility.hpp"
+#include "Common/ThreadPool.hpp"
+#include "Common/Tracepoints.hpp"
+#include "LatencyStatistics.hpp"
 #include <stdexcept>
 #include <fstream>
+#include <sstream>
+#include <atomic>
+#include <exception>
+#include <algorithm>
 
 namespace usbguard {
-  
+
+  static std::atomic<uint64_t> G_snapshot_generation_next(0);
+
+  RuleSetPrivate::Snapshot::Snapshot()
+    : generation(++G_snapshot_generation_next),
+      uses_device_hash(-1)
+  {
+  }
+
+  RuleSetPrivate::Snapshot::Snapshot(const Snapshot& rhs)
+    : rules(rhs.rules),
+      rules_index(rhs.rules_index),
+      generation(++G_snapshot_generation_next),
+      uses_device_hash(-1)
+  {
+  }
+
   RuleSetPrivate::RuleSetPrivate(RuleSet& p_instance, Interface * const interface_ptr)
     : _p_instance(p_instance),
-      _interface_ptr(interface_ptr)
+      _interface_ptr(interface_ptr),
+      _match_cache_generation(0),
+      _disabled_groups(0),
+      _match_cache_disabled_groups(0),
+      _sealed(false),
+      _snapshot_version_next(1),
+      _snapshot_limit(16)
   {
     (void)_p_instance;
     _default_target = Rule::Target::Block;
     _default_action = String();
     _id_next = Rule::RootID + 1;
+    _snapshot = makePointer<const Snapshot>();
     return;
   }
 
   RuleSetPrivate::RuleSetPrivate(RuleSet& p_instance, const RuleSetPrivate& rhs)
     : _p_instance(p_instance),
-      _interface_ptr(rhs._interface_ptr)
+      _interface_ptr(rhs._interface_ptr),
+      _match_cache_generation(0),
+      _disabled_groups(0),
+      _match_cache_disabled_groups(0),
+      _sealed(false),
+      _snapshot_version_next(1),
+      _snapshot_limit(16)
   {
     *this = rhs;
     return;
@@ -46,10 +86,17 @@ namespace usbguard {
 
   const RuleSetPrivate& RuleSetPrivate::operator=(const RuleSetPrivate& rhs)
   {
-    _default_target = rhs._default_target;
+    std::unique_lock<std::mutex> rhs_lock(rhs._op_mutex);
+    _default_target = rhs._default_target.load();
     _default_action = rhs._default_action;
     _id_next = rhs._id_next.load();
-    _rules = rhs._rules;
+    _sealed = rhs._sealed.load();
+    _disabled_groups = rhs._disabled_groups.load();
+    /*
+     * Snapshots are immutable, so the copy can share the
+     * current one with the source rule set.
+     */
+    publish(rhs.snapshot());
     _rules_timed = rhs._rules_timed;
     return *this;
   }
@@ -68,49 +115,145 @@ namespace usbguard {
     return;
   }
   
+  /*
+   * Rule files with fewer lines than this are parsed in the
+   * calling thread. Starting the worker threads would cost more
+   * than the parsing itself.
+   */
+  static const size_t parallel_load_min_lines = 512;
+
+  static void parseRuleLines(const StringVector& lines, size_t line_offset,
+                             size_t line_count, RuleArena& arena, std::vector<Rule>& rules)
+  {
+    for (size_t i = line_offset; i < line_offset + line_count; ++i) {
+      const size_t line_number = i + 1;
+      Rule rule = parseRuleFromString(lines[i], arena, "", line_number);
+      if (rule) {
+        rules.push_back(std::move(rule));
+      }
+    }
+    return;
+  }
+
   void RuleSetPrivate::load(std::istream& stream)
   {
     std::unique_lock<std::mutex> lock(_io_mutex);
+    StringVector lines;
     std::string line_string;
-    size_t line_number = 0;
 
     do {
-      ++line_number;
       std::getline(stream, line_string);
-      const Rule rule = parseRuleFromString(line_string, "", line_number);
-      if (rule) {
-	appendRule(rule);
-      }
+      lines.push_back(line_string);
     } while(stream.good());
 
+    /*
+     * Split the lines into continuous ranges which are parsed
+     * concurrently. The parsed rules are appended in the original
+     * order afterwards, so the resulting ruleset (including the
+     * assigned rule ids) is the same as if the lines were parsed
+     * one by one.
+     */
+    const size_t range_count = \
+      (lines.size() < parallel_load_min_lines ? 1 : ThreadPool::defaultThreadCount());
+    const size_t range_size = (lines.size() + range_count - 1) / range_count;
+
+    std::vector<std::vector<Rule>> range_rules(range_count);
+
+    /*
+     * The data of all the loaded rules is allocated in one arena,
+     * sized for the whole file. It's released as a whole when the
+     * rules are gone, e.g. after the next reload.
+     */
+    RuleArena arena(lines.size());
+
+    auto range_parser = [&lines, &range_rules, &arena, range_size](size_t i) {
+      const size_t line_offset = std::min(i * range_size, lines.size());
+      const size_t line_count = std::min(range_size, lines.size() - line_offset);
+      parseRuleLines(lines, line_offset, line_count, arena, range_rules[i]);
+    };
+
+    /*
+     * The error from the first failing range is reported. That
+     * is the error on the lowest line number.
+     */
+    if (range_count == 1) {
+      range_parser(0);
+    }
+    else {
+      ThreadPool::shared().parallelFor(range_count, range_parser);
+    }
+
+    std::unique_lock<std::mutex> op_lock(_op_mutex);
+    auto next = makePointer<Snapshot>(*snapshot());
+
+    for (auto& rules : range_rules) {
+      for (auto& rule : rules) {
+	appendRule(*next, std::move(rule), Rule::LastID);
+      }
+    }
+
+    publish(next);
     return;
   }
   
   void RuleSetPrivate::save(const String& path) const
   {
-    std::ofstream stream(path, std::fstream::trunc);
-    if (!stream.is_open()) {
+    std::ostringstream stream;
+    save(stream);
+    /*
+     * Replace the file atomically so that a crash or a full
+     * disk cannot leave a truncated policy behind.
+     */
+    if (!writeFileAtomically(path, stream.str())) {
       throw std::runtime_error("Cannot store ruleset to file");
     }
-    save(stream);
     return;
   }
   
   void RuleSetPrivate::save(std::ostream& stream) const
   {
     std::unique_lock<std::mutex> io_lock(_io_mutex);
+    auto current = snapshot();
+    String rule_string;
+
+    for (auto const& rule : current->rules) {
+      rule_string.clear();
+      rule->appendToString(rule_string);
+      rule_string.push_back('\n');
+      stream << rule_string;
+    }
+    return;
+  }
+  
+  bool RuleSetPrivate::loadCache(const String& cache_path, const String& rule_path)
+  {
+    std::unique_lock<std::mutex> io_lock(_io_mutex);
+    std::vector<Rule> rules;
+
+    if (!RuleCache::load(cache_path, RuleCache::getSource(rule_path), rules)) {
+      return false;
+    }
+
     std::unique_lock<std::mutex> op_lock(_op_mutex);
+    auto next = makePointer<Snapshot>(*snapshot());
 
-    for (auto const& rule : _rules) {
-      const std::string rule_string = rule->toString();
-      stream << rule_string << std::endl;
+    for (auto const& rule : rules) {
+      appendRule(*next, rule, Rule::LastID);
     }
+
+    publish(next);
+    return true;
+  }
+
+  void RuleSetPrivate::saveCache(const String& cache_path, const String& rule_path) const
+  {
+    std::unique_lock<std::mutex> io_lock(_io_mutex);
+    RuleCache::save(cache_path, RuleCache::getSource(rule_path), snapshot()->rules);
     return;
   }
-  
+
   void RuleSetPrivate::setDefaultTarget(Rule::Target target)
   {
-    std::unique_lock<std::mutex> op_lock(_op_mutex);
     _default_target = target;
     return;
   }
@@ -130,7 +273,17 @@ namespace usbguard {
       op_lock.lock();
     }
 
-    auto rule_ptr = makePointer<Rule>(rule);
+    auto next = makePointer<Snapshot>(*snapshot());
+    const uint32_t id = appendRule(*next, rule, parent_id);
+    publish(next);
+
+    return id;
+  }
+
+  uint32_t RuleSetPrivate::appendRule(Snapshot& snapshot, Rule rule, uint32_t parent_id)
+  {
+    auto rule_ptr = makePointer<Rule>(std::move(rule));
+    auto& rules = snapshot.rules;
 
     /*
      * If the rule doesn't already have a sequence number
@@ -147,32 +300,30 @@ namespace usbguard {
 
     /* Initialize conditions */
     rule_ptr->internal()->initConditions(_interface_ptr);
+    /* From now on it's only read, so its string form can be cached */
+    rule_ptr->internal()->setImmutable();
 
     /* Append the rule to the main rule table */
     if (parent_id == Rule::LastID) {
-      _rules.push_back(rule_ptr);
+      rules.push_back(rule_ptr);
+      snapshot.rules_index.append(rule_ptr);
     }
     else if (parent_id == 0) {
-      _rules.insert(_rules.begin(), rule_ptr);
+      rules.insert(rules.begin(), rule_ptr);
+      snapshot.rules_index.insertAt(rules, 0);
     }
     else {
-      bool parent_found = false;
-      for (auto it = _rules.begin(); it != _rules.end(); ++it) {
-	const Rule& rule = **it;
-	if (rule.getRuleID() == parent_id) {
-	  _rules.insert(it+1, rule_ptr);
-	  parent_found = true;
-	  break;
-	}
-      }
-      if (!parent_found) {
+      const size_t parent_position = snapshot.rules_index.position(rules, parent_id);
+      if (parent_position == rules.size()) {
 	throw std::runtime_error("Invalid parent_id");
       }
+      rules.insert(rules.begin() + parent_position + 1, rule_ptr);
+      snapshot.rules_index.insertAt(rules, parent_position + 1);
     }
 
-    /* If the rule is timed, put it into the priority queue */
+    /* If the rule is timed, put it into the expiration queue */
     if (rule_ptr->getTimeoutSeconds() > 0) {
-      _rules_timed.push(rule_ptr);
+      _rules_timed.insert(timedRuleKey(*rule_ptr));
     }
 
     return rule_ptr->getRuleID();
@@ -181,12 +332,21 @@ namespace usbguard {
   uint32_t RuleSetPrivate::upsertRule(const Rule& match_rule, const Rule& new_rule, const bool parent_insensitive)
   {
     std::unique_lock<std::mutex> op_lock(_op_mutex);
-    Pointer<Rule> matching_rule;
+    auto next = makePointer<Snapshot>(*snapshot());
+    const uint32_t id = upsertRule(*next, match_rule, new_rule, parent_insensitive);
+    publish(next);
+    return id;
+  }
 
-    for (auto& rule_ptr : _rules) {
-      if (rule_ptr->internal()->appliesTo(match_rule, parent_insensitive)) {
-        if (!matching_rule) {
-          matching_rule = rule_ptr;
+  uint32_t RuleSetPrivate::upsertRule(Snapshot& snapshot, const Rule& match_rule, const Rule& new_rule, const bool parent_insensitive)
+  {
+    auto& rules = snapshot.rules;
+    auto matching_rule = rules.end();
+
+    for (auto it = rules.begin(); it != rules.end(); ++it) {
+      if ((*it)->internal()->appliesTo(match_rule, parent_insensitive)) {
+        if (matching_rule == rules.end()) {
+          matching_rule = it;
         }
         else {
           throw std::runtime_error("Upsert failed: multiple matching rules");
@@ -194,91 +354,542 @@ namespace usbguard {
       }
     }
 
-    if (matching_rule) {
-      const uint32_t id = matching_rule->getRuleID();
-      *matching_rule = new_rule;
-      matching_rule->setRuleID(id);
-      return id;
+    if (matching_rule == rules.end()) {
+      return appendRule(snapshot, new_rule, Rule::LastID);
     }
-    else {
-      return appendRule(new_rule, Rule::LastID, /*lock=*/false);
+
+    /*
+     * Rules referenced by a published snapshot must not be
+     * modified. Replace the matching rule with an updated
+     * copy at the same position instead.
+     */
+    const uint32_t id = (*matching_rule)->getRuleID();
+    auto rule_ptr = makePointer<Rule>(new_rule);
+    rule_ptr->setRuleID(id);
+    rule_ptr->internal()->initConditions(_interface_ptr);
+    rule_ptr->internal()->setImmutable();
+    const uint64_t order = snapshot.rules_index.remove(*matching_rule);
+    _rules_timed.erase(timedRuleKey(**matching_rule));
+    if (rule_ptr->getTimeoutSeconds() > 0) {
+      _rules_timed.insert(timedRuleKey(*rule_ptr));
     }
+    *matching_rule = rule_ptr;
+    snapshot.rules_index.insert(rule_ptr, order);
+
+    return id;
   }
 
-  Pointer<const Rule> RuleSetPrivate::getRule(uint32_t id)
+  std::vector<uint32_t> RuleSetPrivate::applyBatch(const std::vector<RuleSet::Operation>& operations)
   {
     std::unique_lock<std::mutex> op_lock(_op_mutex);
-    for (auto const& rule : _rules) {
-      if (rule->getRuleID() == id) {
-	return rule;
+    auto next = makePointer<Snapshot>(*snapshot());
+    std::vector<uint32_t> ids;
+
+    /*
+     * The operations are applied to a private copy of the
+     * current snapshot which is published only if all of them
+     * succeed. The state kept outside of the snapshot is
+     * restored on failure.
+     */
+    const uint32_t id_next = _id_next;
+    const std::set<TimedRuleKey> rules_timed = _rules_timed;
+
+    try {
+      for (auto const& operation : operations) {
+        switch(operation.type) {
+          case RuleSet::Operation::Type::Append:
+            ids.push_back(appendRule(*next, operation.rule, operation.parent_id));
+            break;
+          case RuleSet::Operation::Type::Remove:
+            removeRule(*next, operation.id);
+            ids.push_back(operation.id);
+            break;
+          case RuleSet::Operation::Type::Upsert:
+            ids.push_back(upsertRule(*next, operation.match_rule, operation.rule, operation.parent_insensitive));
+            break;
+        }
       }
     }
-    throw std::out_of_range("Rule not found");
+    catch(...) {
+      _id_next = id_next;
+      _rules_timed = rules_timed;
+      throw;
+    }
+
+    publish(next);
+    return ids;
+  }
+
+  Pointer<const Rule> RuleSetPrivate::getRule(uint32_t id)
+  {
+    auto current = snapshot();
+    auto rule = current->rules_index.find(id);
+    if (!rule) {
+      throw std::out_of_range("Rule not found");
+    }
+    return rule;
   }
 
   bool RuleSetPrivate::removeRule(uint32_t id)
   {
     std::unique_lock<std::mutex> op_lock(_op_mutex);
-    for (auto it = _rules.begin(); it != _rules.end(); ++it) {
-      auto const& rule_ptr = *it;
-      if (rule_ptr->getRuleID() == id) {
-        _rules.erase(it);
-        return true;
-      }
+    auto next = makePointer<Snapshot>(*snapshot());
+    removeRule(*next, id);
+    publish(next);
+    return true;
+  }
+
+  void RuleSetPrivate::removeRule(Snapshot& snapshot, uint32_t id)
+  {
+    auto& rules = snapshot.rules;
+    const size_t position = snapshot.rules_index.position(rules, id);
+
+    if (position == rules.size()) {
+      throw std::out_of_range("Rule not found");
     }
-    /* FIXME: Remove the rule from the priority queue too */
-    throw std::out_of_range("Rule not found");
+
+    auto rule_ptr = rules[position];
+
+    snapshot.rules_index.remove(rule_ptr);
+    rules.erase(rules.begin() + position);
+    _rules_timed.erase(timedRuleKey(*rule_ptr));
+
+    return;
   }
 
   Pointer<Rule> RuleSetPrivate::getFirstMatchingRule(Pointer<const Rule> device_rule, uint32_t from_id) const
   {
-    std::unique_lock<std::mutex> op_lock(_op_mutex);
+    LatencyStatistics::Timer timer(LatencyStatistics::Stage::RuleMatch);
+    const EvaluationClock::Scope clock_scope;
+    const auto tp_begin = std::chrono::steady_clock::now();
+    auto current = snapshot();
+
+    /*
+     * Rule set modifications don't block the matching. The lock
+     * only serializes the condition state updates done during
+     * the evaluation of the (shared) rule objects.
+     */
+    std::unique_lock<std::mutex> match_lock(_match_mutex);
+    const uint64_t disabled_groups = _disabled_groups.load();
 
-    for (auto& rule_ptr : _rules) {
-      if (rule_ptr->internal()->appliesToWithConditions(*device_rule, /*with_update*/true)) {
-	return rule_ptr;
+    /*
+     * A reader holding an older snapshot than the one the cache
+     * was filled with neither uses nor updates the cache.
+     */
+    const String cache_key = matchCacheKey(*device_rule);
+    const uint64_t generation = current->generation;
+    const bool use_cache = !cache_key.empty() && \
+      generation >= _match_cache_generation;
+
+    if (use_cache) {
+      if (generation != _match_cache_generation ||
+          disabled_groups != _match_cache_disabled_groups) {
+        _match_cache.clear();
+        _match_cache_generation = generation;
+        _match_cache_disabled_groups = disabled_groups;
+      }
+      auto it = _match_cache.find(cache_key);
+      if (it != _match_cache.end()) {
+        if (it->second != Rule::DefaultID) {
+          Pointer<Rule> cached_rule = current->rules_index.find(it->second);
+          if (cached_rule) {
+            cached_rule->internal()->metadata().recordMatchTime(std::chrono::steady_clock::now() - tp_begin);
+            USBGUARD_PROBE3(rule_match, cached_rule->getRuleID(), 0, 1);
+            return cached_rule;
+          }
+        }
+        else {
+          Pointer<Rule> default_rule = makePointer<Rule>();
+          default_rule->setRuleID(Rule::DefaultID);
+          default_rule->setTarget(_default_target);
+          USBGUARD_PROBE3(rule_match, Rule::DefaultID, 0, 1);
+          return default_rule;
+        }
       }
     }
 
+    /*
+     * Only the rules which apply to the device rule are visited,
+     * so just the conditions are left to be evaluated here. The
+     * index preserves the rule set order, so the first matching
+     * rule is the same as with a linear scan.
+     */
+    bool cacheable = use_cache;
+    size_t rules_scanned = 0;
+    RuleCondition::EvaluationMemo memo;
+    const std::function<bool(const Pointer<Rule>&)> visitor = \
+      [&device_rule, &cacheable, &memo, &rules_scanned](const Pointer<Rule>& rule_ptr) {
+        RulePrivate * const rule = rule_ptr->internal();
+        ++rules_scanned;
+        if (rule->attributeConditions().count() == 0) {
+          return true;
+        }
+        cacheable = false;
+        return rule->meetsConditions(*device_rule, /*with_update*/true, &memo);
+      };
+    Pointer<Rule> matching_rule = current->sealed_index ? \
+      current->sealed_index->findFirst(*device_rule, visitor, disabled_groups) : \
+      current->rules_index.findFirst(*device_rule, visitor, disabled_groups);
+
+    if (cacheable) {
+      _match_cache[cache_key] = matching_rule ? matching_rule->getRuleID() : Rule::DefaultID;
+    }
+
+    if (matching_rule) {
+      matching_rule->internal()->metadata().recordMatchTime(std::chrono::steady_clock::now() - tp_begin);
+      USBGUARD_PROBE3(rule_match, matching_rule->getRuleID(), rules_scanned, 0);
+      return matching_rule;
+    }
+
     Pointer<Rule> default_rule = makePointer<Rule>();
 
     default_rule->setRuleID(Rule::DefaultID);
     default_rule->setTarget(_default_target);
+    USBGUARD_PROBE3(rule_match, Rule::DefaultID, rules_scanned, 0);
 
     return default_rule;
   }
 
+  PointerVector<Rule> RuleSetPrivate::getFirstMatchingInterfaceRules(Pointer<const Rule> device_rule) const
+  {
+    LatencyStatistics::Timer timer(LatencyStatistics::Stage::RuleMatch);
+    const EvaluationClock::Scope clock_scope;
+    auto current = snapshot();
+    std::unique_lock<std::mutex> match_lock(_match_mutex);
+
+    /*
+     * A copy of the device rule for each interface type, with
+     * just the one type in the with-interface attribute.
+     */
+    const auto& interface_types = device_rule->attributeWithInterface().values();
+    std::vector<Rule> interface_rules;
+    std::vector<RuleCondition::EvaluationMemo> memos(interface_types.size());
+
+    interface_rules.reserve(interface_types.size());
+
+    for (auto const& interface_type : interface_types) {
+      Rule interface_rule(*device_rule);
+      interface_rule.attributeWithInterface().clear();
+      interface_rule.attributeWithInterface().append(interface_type);
+      interface_rules.push_back(std::move(interface_rule));
+    }
+
+    const std::function<bool(const Pointer<Rule>&, size_t)> visitor = \
+      [&interface_rules, &memos](const Pointer<Rule>& rule_ptr, size_t i) {
+        RulePrivate * const rule = rule_ptr->internal();
+        if (rule->attributeConditions().count() == 0) {
+          return true;
+        }
+        return rule->meetsConditions(interface_rules[i], /*with_update*/true, &memos[i]);
+      };
+    const uint64_t disabled_groups = _disabled_groups.load();
+    PointerVector<Rule> matching_rules = current->sealed_index ? \
+      current->sealed_index->findFirstEach(interface_rules, visitor, disabled_groups) : \
+      current->rules_index.findFirstEach(interface_rules, visitor, disabled_groups);
+
+    for (auto& matching_rule : matching_rules) {
+      if (!matching_rule) {
+        matching_rule = makePointer<Rule>();
+        matching_rule->setRuleID(Rule::DefaultID);
+        matching_rule->setTarget(_default_target);
+      }
+    }
+
+    return matching_rules;
+  }
+
+  /*
+   * A linear scan instead of the index, so that every rule before
+   * the matching one shows up in the trace. The match lock is held
+   * because the conditions are evaluated on the shared rule objects.
+   */
+  std::vector<RuleSet::MatchTraceStep> RuleSetPrivate::explainMatch(Pointer<const Rule> device_rule) const
+  {
+    const EvaluationClock::Scope clock_scope;
+    auto current = snapshot();
+    std::unique_lock<std::mutex> match_lock(_match_mutex);
+    RuleCondition::EvaluationMemo memo;
+    std::vector<RuleSet::MatchTraceStep> steps;
+    const uint64_t disabled_groups = _disabled_groups.load();
+
+    for (auto const& rule_ptr : current->rules) {
+      const auto tp_begin = std::chrono::steady_clock::now();
+      const RulePrivate * const rule = rule_ptr->internal();
+      RuleSet::MatchTraceStep step;
+      const char * const rejected_by = (rule->getGroupBit() & disabled_groups) != 0 ?
+        "group" : rule->rejectingAttribute(*device_rule);
+
+      step.rule_id = rule->getRuleID();
+      step.target = rule->getTarget();
+      step.matched = false;
+
+      if (rejected_by != nullptr) {
+        step.rejected_by = rejected_by;
+      }
+      else {
+        step.matched = rule->attributeConditions().count() == 0 ||
+          rule->traceConditions(*device_rule, step.conditions, &memo);
+      }
+
+      step.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - tp_begin).count();
+      steps.push_back(std::move(step));
+
+      if (steps.back().matched) {
+        break;
+      }
+    }
+
+    return steps;
+  }
+
+  /*
+   * The visitor never accepts a rule, so the index visits all
+   * the candidates which apply to the device rule.
+   */
+  PointerVector<const Rule> RuleSetPrivate::getApplyingRules(const Rule& device_rule) const
+  {
+    auto current = snapshot();
+    PointerVector<const Rule> rules;
+    const std::function<bool(const Pointer<Rule>&)> visitor = \
+      [&rules](const Pointer<Rule>& rule_ptr) {
+        rules.push_back(rule_ptr);
+        return false;
+      };
+
+    if (current->sealed_index) {
+      current->sealed_index->findFirst(device_rule, visitor);
+    }
+    else {
+      current->rules_index.findFirst(device_rule, visitor);
+    }
+
+    return rules;
+  }
+
   PointerVector<const Rule> RuleSetPrivate::getRules()
   {
+    auto current = snapshot();
     PointerVector<const Rule> rules;
 
-    for (auto const& rule : _rules) {
+    for (auto const& rule : current->rules) {
       rules.push_back(rule);
     }
 
     return rules;
   }
 
-  Pointer<Rule> RuleSetPrivate::getTimedOutRule()
+  /*
+   * The counters are atomic and the snapshots share the rules,
+   * so they are set in place, without a new snapshot.
+   */
+  bool RuleSetPrivate::setRuleStatistics(uint32_t id, const Rule::Statistics& statistics)
+  {
+    auto current = snapshot();
+    auto rule = current->rules_index.find(id);
+
+    if (!rule) {
+      return false;
+    }
+
+    rule->setStatistics(statistics);
+    return true;
+  }
+
+  bool RuleSetPrivate::usesDeviceHash() const
+  {
+    auto current = snapshot();
+    int uses_device_hash = current->uses_device_hash.load(std::memory_order_relaxed);
+
+    /*
+     * Readers of the same snapshot may compute the flag at the same
+     * time. They store the same value, and it doesn't order any other
+     * data, so relaxed atomics are enough.
+     */
+    if (uses_device_hash < 0) {
+      uses_device_hash = 0;
+      for (auto const& rule : current->rules) {
+        if (!rule->attributeHash().empty() || !rule->attributeParentHash().empty()) {
+          uses_device_hash = 1;
+          break;
+        }
+      }
+      current->uses_device_hash.store(uses_device_hash, std::memory_order_relaxed);
+    }
+
+    return uses_device_hash > 0;
+  }
+
+  void RuleSetPrivate::setSealed(bool sealed)
   {
     std::unique_lock<std::mutex> op_lock(_op_mutex);
+    _sealed = sealed;
+    /*
+     * publish() builds the sealed index for the new snapshot,
+     * or drops it if the rule set isn't sealed anymore.
+     */
+    auto next = makePointer<Snapshot>(*snapshot());
+    publish(next);
+    return;
+  }
 
-    if (_rules_timed.size() < 1) {
-      return nullptr;
+  bool RuleSetPrivate::isSealed() const
+  {
+    return _sealed;
+  }
+
+  bool RuleSetPrivate::setGroupEnabled(const String& group, bool enabled)
+  {
+    const uint64_t bit = Rule::groupBit(group);
+
+    if (bit == 0) {
+      throw std::runtime_error("Invalid rule group name");
     }
 
-    Pointer<Rule> oldest_rule = _rules_timed.top();
-    std::chrono::steady_clock::time_point tp_current =	\
-      std::chrono::steady_clock::now();
+    const uint64_t previous = enabled ? \
+      _disabled_groups.fetch_and(~bit) : _disabled_groups.fetch_or(bit);
+
+    return ((previous & bit) == 0) != enabled;
+  }
+
+  bool RuleSetPrivate::isGroupEnabled(const String& group) const
+  {
+    return (_disabled_groups.load() & Rule::groupBit(group)) == 0;
+  }
+
+  uint32_t RuleSetPrivate::saveSnapshot(const String& name)
+  {
+    std::unique_lock<std::mutex> op_lock(_op_mutex);
+    return saveCurrentSnapshot(name);
+  }
 
-    if ((tp_current - oldest_rule->internal()->metadata().tp_created) \
-	< std::chrono::seconds(oldest_rule->getTimeoutSeconds())) {
-      return nullptr;
-    } else {
-      _rules_timed.pop();
+  uint32_t RuleSetPrivate::saveCurrentSnapshot(const String& name)
+  {
+    SavedSnapshot saved;
+
+    saved.snapshot = snapshot();
+    saved.rules_timed = _rules_timed;
+    saved.info.version = _snapshot_version_next++;
+    saved.info.name = name;
+    saved.info.time = std::chrono::duration_cast<std::chrono::seconds>(\
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    saved.info.rule_count = saved.snapshot->rules.size();
+
+    _saved_snapshots.push_back(std::move(saved));
+
+    while (_saved_snapshots.size() > _snapshot_limit) {
+      _saved_snapshots.pop_front();
+    }
+
+    return _saved_snapshots.empty() ? 0 : _saved_snapshots.back().info.version;
+  }
+
+  std::vector<RuleSet::SnapshotInfo> RuleSetPrivate::listSnapshots() const
+  {
+    std::unique_lock<std::mutex> op_lock(_op_mutex);
+    std::vector<RuleSet::SnapshotInfo> snapshots;
+
+    for (auto const& saved : _saved_snapshots) {
+      snapshots.push_back(saved.info);
     }
 
-    return oldest_rule;
+    return snapshots;
+  }
+
+  bool RuleSetPrivate::rollback(uint32_t version, RuleSet::Changes& changes, const String& save_as)
+  {
+    std::unique_lock<std::mutex> op_lock(_op_mutex);
+    auto saved_it = std::find_if(_saved_snapshots.cbegin(), _saved_snapshots.cend(),
+      [version](const SavedSnapshot& saved) {
+        return saved.info.version == version;
+      });
+
+    if (saved_it == _saved_snapshots.cend()) {
+      return false;
+    }
+
+    /*
+     * Rules are never modified once they are published, so the
+     * rules which are in both versions are the same objects.
+     */
+    const auto current = snapshot();
+    const auto target = saved_it->snapshot;
+    const auto rules_timed = saved_it->rules_timed;
+    std::set<const Rule*> current_rules;
+    std::set<const Rule*> target_rules;
+
+    for (auto const& rule : current->rules) {
+      current_rules.insert(rule.get());
+    }
+    for (auto const& rule : target->rules) {
+      target_rules.insert(rule.get());
+      if (current_rules.count(rule.get()) == 0) {
+        changes.rules.push_back(*rule);
+      }
+    }
+    for (auto const& rule : current->rules) {
+      if (target_rules.count(rule.get()) == 0) {
+        changes.removed_ids.push_back(rule->getRuleID());
+      }
+    }
+
+    if (!save_as.empty()) {
+      saveCurrentSnapshot(save_as);
+    }
+
+    _rules_timed = rules_timed;
+
+    /*
+     * The saved snapshot may still be used by readers, so a copy
+     * with a new generation is published instead.
+     */
+    auto next = makePointer<Snapshot>(*target);
+
+    if (bool(target->sealed_index) != _sealed) {
+      /* Sealed or unsealed since the snapshot was saved */
+      publish(next);
+    }
+    else {
+      next->sealed_index = target->sealed_index;
+      publish(Pointer<const Snapshot>(next));
+    }
+
+    return true;
+  }
+
+  void RuleSetPrivate::setSnapshotLimit(size_t limit)
+  {
+    std::unique_lock<std::mutex> op_lock(_op_mutex);
+    _snapshot_limit = limit;
+
+    while (_saved_snapshots.size() > _snapshot_limit) {
+      _saved_snapshots.pop_front();
+    }
+    return;
+  }
+
+  Pointer<Rule> RuleSetPrivate::getTimedOutRule()
+  {
+    std::unique_lock<std::mutex> op_lock(_op_mutex);
+    const std::chrono::steady_clock::time_point tp_current = EvaluationClock::now();
+
+    while (!_rules_timed.empty()) {
+      auto oldest_it = _rules_timed.begin();
+
+      if (oldest_it->first > tp_current) {
+        return nullptr;
+      }
+
+      const uint32_t id = oldest_it->second;
+      _rules_timed.erase(oldest_it);
+
+      auto oldest_rule = snapshot()->rules_index.find(id);
+      if (oldest_rule) {
+        return oldest_rule;
+      }
+    }
+
+    return nullptr;
   }
 
   uint32_t RuleSetPrivate::assignID(Pointer<Rule> rule)
@@ -292,4 +903,55 @@ namespace usbguard {
     return _id_next++;
   }
 
+  RuleSetPrivate::TimedRuleKey RuleSetPrivate::timedRuleKey(const Rule& rule)
+  {
+    const auto tp_expiration = rule.internal()->metadata().tp_created + \
+      std::chrono::seconds(rule.getTimeoutSeconds());
+    return TimedRuleKey(tp_expiration, rule.getRuleID());
+  }
+
+  String RuleSetPrivate::matchCacheKey(const Rule& device_rule)
+  {
+    const auto& hash = device_rule.attributeHash();
+
+    if (hash.count() != 1 || hash.get().empty()) {
+      return String();
+    }
+    /*
+     * The device hash covers the name, device id, serial number
+     * and the descriptors, i.e. also the interface types.
+     */
+    String key = hash.get();
+
+    for (const auto& attribute : { &device_rule.attributeParentHash(), &device_rule.attributeViaPort() }) {
+      key.append("\n");
+      for (const String& value : attribute->values()) {
+        key.append(value);
+        key.append(" ");
+      }
+    }
+
+    return key;
+  }
+
+  Pointer<const RuleSetPrivate::Snapshot> RuleSetPrivate::snapshot() const
+  {
+    return std::atomic_load(&_snapshot);
+  }
+
+  void RuleSetPrivate::publish(const Pointer<const Snapshot>& snapshot)
+  {
+    std::atomic_store(&_snapshot, snapshot);
+    return;
+  }
+
+  void RuleSetPrivate::publish(const Pointer<Snapshot>& snapshot)
+  {
+    if (_sealed) {
+      snapshot->sealed_index = makePointer<const SealedRuleIndex>(snapshot->rules);
+    }
+    publish(Pointer<const Snapshot>(snapshot));
+    return;
+  }
+
 } /* namespace usbguard */
@@ -20,9 +20,16 @@
 #include <build-config.h>
 #include "Typedefs.hpp"
 #include "RuleSet.hpp"
+#include "RuleIndex.hpp"
+#include "SealedRuleIndex.hpp"
 #include <istream>
 #include <ostream>
 #include <mutex>
+#include <atomic>
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
 
 namespace usbguard {
   class RuleSetPrivate
@@ -37,27 +44,121 @@ namespace usbguard {
     void load(std::istream& stream);
     void save(const String& path) const;
     void save(std::ostream& stream) const;
+    bool loadCache(const String& cache_path, const String& rule_path);
+    void saveCache(const String& cache_path, const String& rule_path) const;
     void setDefaultTarget(Rule::Target target);
     void setDefaultAction(const String& action);
     uint32_t appendRule(const Rule& rule, uint32_t parent_id = Rule::LastID, bool lock = true);
     uint32_t upsertRule(const Rule& match_rule, const Rule& new_rule, bool parent_insensitive = false);
+    std::vector<uint32_t> applyBatch(const std::vector<RuleSet::Operation>& operations);
     Pointer<const Rule> getRule(uint32_t id);
     bool removeRule(uint32_t id);
     Pointer<Rule> getFirstMatchingRule(Pointer<const Rule> device_rule, uint32_t from_id = 1) const;
+    PointerVector<Rule> getFirstMatchingInterfaceRules(Pointer<const Rule> device_rule) const;
+    std::vector<RuleSet::MatchTraceStep> explainMatch(Pointer<const Rule> device_rule) const;
+    PointerVector<const Rule> getApplyingRules(const Rule& device_rule) const;
     PointerVector<const Rule> getRules();
+    bool setRuleStatistics(uint32_t id, const Rule::Statistics& statistics);
+    bool usesDeviceHash() const;
+    void setSealed(bool sealed);
+    bool isSealed() const;
+    bool setGroupEnabled(const String& group, bool enabled);
+    bool isGroupEnabled(const String& group) const;
+    uint32_t saveSnapshot(const String& name);
+    std::vector<RuleSet::SnapshotInfo> listSnapshots() const;
+    bool rollback(uint32_t version, RuleSet::Changes& changes, const String& save_as);
+    void setSnapshotLimit(size_t limit);
     Pointer<Rule> getTimedOutRule();
     uint32_t assignID(Pointer<Rule> rule);
     uint32_t assignID();
 
   private:
+    /*
+     * An immutable view of the rule table. Writers create
+     * a modified copy of the current snapshot and publish it
+     * atomically. Readers keep a reference to the snapshot
+     * they started with, so they never wait for a writer.
+     */
+    struct Snapshot {
+      Snapshot();
+      Snapshot(const Snapshot& rhs);
+
+      PointerVector<Rule> rules;
+      RuleIndex rules_index; /* match index over rules */
+      /*
+       * Read-only match index used instead of rules_index if the
+       * rule set is sealed. It's not copied with the snapshot;
+       * publish() builds a new one for the modified rules.
+       */
+      Pointer<const SealedRuleIndex> sealed_index;
+      /*
+       * Unique for each published snapshot. A rollback publishes
+       * a copy of a saved snapshot, so that the match cache of a
+       * newer snapshot isn't used with it.
+       */
+      const uint64_t generation;
+      /*
+       * Result of usesDeviceHash: -1 until computed, 0 or 1. The only
+       * field written after the snapshot is published, see there.
+       */
+      mutable std::atomic<int> uses_device_hash;
+    };
+
+    /*
+     * Results of getFirstMatchingRule are cached per device
+     * (hash, parent hash and port) for the snapshot generation
+     * they were computed with. Matches which depended on the
+     * evaluation of rule conditions are never cached.
+     */
+    static String matchCacheKey(const Rule& device_rule);
+
+    /*
+     * Timed rules are ordered by their expiration time. The
+     * rule id makes the key unique and allows to remove a rule
+     * without searching for it.
+     */
+    typedef std::pair<std::chrono::steady_clock::time_point, uint32_t> TimedRuleKey;
+    static TimedRuleKey timedRuleKey(const Rule& rule);
+
+    /*
+     * A snapshot saved by saveSnapshot() together with the
+     * timed rule set, which isn't part of the snapshot.
+     */
+    struct SavedSnapshot {
+      RuleSet::SnapshotInfo info;
+      Pointer<const Snapshot> snapshot;
+      std::set<TimedRuleKey> rules_timed;
+    };
+
+    Pointer<const Snapshot> snapshot() const;
+    void publish(const Pointer<const Snapshot>& snapshot);
+    void publish(const Pointer<Snapshot>& snapshot);
+    uint32_t appendRule(Snapshot& snapshot, Rule rule, uint32_t parent_id);
+    uint32_t upsertRule(Snapshot& snapshot, const Rule& match_rule, const Rule& new_rule, bool parent_insensitive);
+    void removeRule(Snapshot& snapshot, uint32_t id);
+    uint32_t saveCurrentSnapshot(const String& name);
+
     mutable std::mutex _io_mutex; /* mutex for load/save */
-    mutable std::mutex _op_mutex; /* mutex for operations on the rule set */
+    mutable std::mutex _op_mutex; /* mutex for modifications of the rule set */
+    mutable std::mutex _match_mutex; /* mutex for rule condition state updates */
     RuleSet& _p_instance;
     Interface * const _interface_ptr;
-    Rule::Target _default_target;
+    Atomic<Rule::Target> _default_target;
     String _default_action;
     Atomic<uint32_t> _id_next;
-    PointerVector<Rule> _rules;
-    PointerPQueue<Rule> _rules_timed;
+    Pointer<const Snapshot> _snapshot;
+    std::set<TimedRuleKey> _rules_timed;
+    mutable std::unordered_map<String,uint32_t> _match_cache; /* guarded by _match_mutex */
+    mutable uint64_t _match_cache_generation;
+    /*
+     * Bits of the disabled rule groups. It's not part of the
+     * snapshots, so switching a group doesn't copy the rules.
+     */
+    std::atomic<uint64_t> _disabled_groups;
+    mutable uint64_t _match_cache_disabled_groups; /* guarded by _match_mutex */
+    std::atomic<bool> _sealed;
+    std::deque<SavedSnapshot> _saved_snapshots; /* guarded by _op_mutex */
+    uint32_t _snapshot_version_next;
+    size_t _snapshot_limit;
   };
 }
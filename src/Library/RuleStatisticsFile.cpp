@@ -0,0 +1,322 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "RuleStatisticsFile.hpp"
+#include "Hash.hpp"
+#include "LoggerPrivate.hpp"
+#include "Common/Utility.hpp"
+#include "Common/ByteStream.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace usbguard {
+  const uint32_t RuleStatisticsFile::Version = 1;
+
+  static const char statistics_magic[8] = { 'U', 'S', 'B', 'G', 'R', 'S', 'T', 'S' };
+  static const uint32_t statistics_byte_order_mark = 0x01020304;
+  static const size_t key_size = 32;
+  static const size_t record_size = key_size + (4 + Rule::Statistics::MatchTimeBuckets) * sizeof(uint64_t);
+
+  static bool sameCounters(const Rule::Statistics& a, const Rule::Statistics& b)
+  {
+    return a.evaluated == b.evaluated &&
+      a.applied == b.applied &&
+      a.last_evaluated == b.last_evaluated &&
+      a.last_applied == b.last_applied &&
+      a.match_time_histogram == b.match_time_histogram;
+  }
+
+  static void writeHeader(ByteWriter& writer)
+  {
+    writer.bytes(statistics_magic, sizeof statistics_magic);
+    writer.u32(RuleStatisticsFile::Version);
+    writer.u32(statistics_byte_order_mark);
+    return;
+  }
+
+  static void writeRecord(ByteWriter& writer, const String& key, const Rule::Statistics& statistics)
+  {
+    writer.bytes(key.data(), key_size);
+    writer.u64(statistics.evaluated);
+    writer.u64(statistics.applied);
+    writer.u64(statistics.last_evaluated);
+    writer.u64(statistics.last_applied);
+    for (size_t i = 0; i < Rule::Statistics::MatchTimeBuckets; ++i) {
+      writer.u64(statistics.match_time_histogram[i]);
+    }
+    return;
+  }
+
+  static Rule::Statistics readRecord(ByteReader& reader, String& key)
+  {
+    Rule::Statistics statistics;
+    char key_buffer[key_size];
+
+    reader.bytes(key_buffer, sizeof key_buffer);
+    key.assign(key_buffer, sizeof key_buffer);
+    statistics.evaluated = reader.u64();
+    statistics.applied = reader.u64();
+    statistics.last_evaluated = reader.u64();
+    statistics.last_applied = reader.u64();
+    for (size_t i = 0; i < Rule::Statistics::MatchTimeBuckets; ++i) {
+      statistics.match_time_histogram[i] = reader.u64();
+    }
+    return statistics;
+  }
+
+  RuleStatisticsFile::RuleStatisticsFile(const String& path)
+    : _path(path),
+      _running(false),
+      _pending(false),
+      _record_count(0),
+      _rewrite(true)
+  {
+  }
+
+  RuleStatisticsFile::~RuleStatisticsFile()
+  {
+    stop();
+  }
+
+  size_t RuleStatisticsFile::restore(RuleSet& ruleset)
+  {
+    std::unique_lock<std::mutex> write_lock(_write_mutex);
+    std::ifstream stream(_path, std::ios::binary);
+
+    if (!stream.is_open()) {
+      USBGUARD_LOG_DEBUG("Rule statistics: cannot open {}", _path);
+      return 0;
+    }
+
+    std::ostringstream buffer;
+    buffer << stream.rdbuf();
+
+    const String data = buffer.str();
+    ByteReader reader(reinterpret_cast<const uint8_t *>(data.c_str()), data.size());
+    std::map<String, Rule::Statistics> saved;
+    size_t record_count = 0;
+
+    try {
+      char magic[sizeof statistics_magic];
+
+      reader.bytes(magic, sizeof magic);
+      if (std::memcmp(magic, statistics_magic, sizeof magic) != 0 ||
+          reader.u32() != Version ||
+          reader.u32() != statistics_byte_order_mark) {
+        USBGUARD_LOG_DEBUG("Rule statistics: incompatible file format");
+        return 0;
+      }
+
+      while (reader.remaining() >= record_size) {
+        String key;
+        const Rule::Statistics statistics = readRecord(reader, key);
+        saved[key] = statistics;
+        ++record_count;
+      }
+    }
+    catch(const std::exception& ex) {
+      logger->warn("Ignoring invalid rule statistics file {}: {}", _path, ex.what());
+      return 0;
+    }
+
+    /*
+     * An incomplete record would misalign the records appended
+     * after it, so such a file is rewritten by the next checkpoint.
+     */
+    _rewrite = !reader.empty();
+    _record_count = record_count;
+    _written = saved;
+
+    size_t restored = 0;
+
+    for (auto const& rule : ruleset.getRules()) {
+      auto it = saved.find(ruleKey(rule));
+      if (it != saved.end() && ruleset.setRuleStatistics(rule->getRuleID(), it->second)) {
+        ++restored;
+      }
+    }
+
+    return restored;
+  }
+
+  void RuleStatisticsFile::start()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_running) {
+      return;
+    }
+
+    _running = true;
+    _thread = std::thread(&RuleStatisticsFile::thread, this);
+    return;
+  }
+
+  void RuleStatisticsFile::stop()
+  {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _running = false;
+    }
+    _cv.notify_all();
+
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+    return;
+  }
+
+  void RuleStatisticsFile::checkpoint(const PointerVector<const Rule>& rules)
+  {
+    Checkpoint checkpoint;
+
+    checkpoint.reserve(rules.size());
+    for (auto const& rule : rules) {
+      checkpoint.emplace_back(rule, rule->getStatistics());
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_running) {
+        _checkpoint.swap(checkpoint);
+        _pending = true;
+        lock.unlock();
+        _cv.notify_one();
+        return;
+      }
+    }
+
+    write(checkpoint);
+    return;
+  }
+
+  void RuleStatisticsFile::thread()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+      _cv.wait(lock, [this]() { return _pending || !_running; });
+
+      if (!_pending) {
+        break;
+      }
+
+      Checkpoint checkpoint;
+      checkpoint.swap(_checkpoint);
+      _pending = false;
+      lock.unlock();
+      write(checkpoint);
+      lock.lock();
+    }
+    return;
+  }
+
+  /*
+   * The key of a rule is computed once. A modified rule gets new
+   * rule data, so the cached key is reused only for the same data.
+   */
+  String RuleStatisticsFile::ruleKey(const Pointer<const Rule>& rule) const
+  {
+    auto it = _keys.find(rule->getRuleID());
+
+    if (it != _keys.end() && it->second.first->internal() == rule->internal()) {
+      return it->second.second;
+    }
+
+    Hash hash(Hash::Algorithm::SHA256);
+    uint8_t key[Hash::max_size];
+
+    hash.update(rule->toString());
+    hash.getBinary(key, sizeof key);
+
+    return String(reinterpret_cast<const char *>(key), key_size);
+  }
+
+  void RuleStatisticsFile::write(const Checkpoint& checkpoint)
+  {
+    std::unique_lock<std::mutex> write_lock(_write_mutex);
+    std::map<uint32_t, std::pair<Pointer<const Rule>, String>> keys;
+    std::map<String, Rule::Statistics> current;
+    ByteWriter changed;
+    size_t changed_count = 0;
+
+    for (auto const& entry : checkpoint) {
+      const String key = ruleKey(entry.first);
+      auto it = _written.find(key);
+
+      if (it == _written.end() || !sameCounters(it->second, entry.second)) {
+        writeRecord(changed, key, entry.second);
+        ++changed_count;
+      }
+      keys[entry.first->getRuleID()] = std::make_pair(entry.first, key);
+      current[key] = entry.second;
+    }
+
+    /* Don't keep the removed rules alive */
+    _keys.swap(keys);
+
+    if (changed_count == 0 && !_rewrite) {
+      return;
+    }
+
+    if (_rewrite || _record_count + changed_count > 2 * current.size() + 64) {
+      ByteWriter writer;
+
+      writeHeader(writer);
+      for (auto const& record : current) {
+        writeRecord(writer, record.first, record.second);
+      }
+      if (!writeFileAtomically(_path, writer.data())) {
+        logger->warn("Cannot store the rule statistics to {}", _path);
+        _rewrite = true;
+        return;
+      }
+      _record_count = current.size();
+      _written.swap(current);
+      _rewrite = false;
+      return;
+    }
+
+    const int fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    const String& data = changed.data();
+    bool written = false;
+
+    if (fd >= 0) {
+      written = (::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+      written = (::close(fd) == 0) && written;
+    }
+
+    if (!written) {
+      logger->warn("Cannot append the rule statistics to {}: {}", _path, strerror(errno));
+      _rewrite = true;
+      return;
+    }
+
+    _record_count += changed_count;
+    for (auto const& record : current) {
+      _written[record.first] = record.second;
+    }
+    return;
+  }
+} /* namespace usbguard */
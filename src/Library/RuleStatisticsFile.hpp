@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "RuleSet.hpp"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Keeps the rule usage counters (see Rule::Statistics) across
+   * restarts of the daemon. The counters are keyed by the SHA-256
+   * hash of the rule text, so they follow a rule which was moved
+   * or got a different id:
+   *
+   *   header   magic "USBGRSTS", u32 version, u32 byte order mark
+   *   records  the rule key and the counters, a fixed size each
+   *
+   * A checkpoint appends the records of the rules whose counters
+   * changed since the previous one, so the last record of a key is
+   * the current one. An incomplete last record, e.g. after a crash,
+   * is ignored. The file is rewritten with only the current records
+   * when most of its records are outdated. Like the rule cache, the
+   * file is meant to be read back by the same host.
+   */
+  class DLL_PUBLIC RuleStatisticsFile
+  {
+  public:
+    static const uint32_t Version;
+
+    RuleStatisticsFile(const String& path);
+    ~RuleStatisticsFile();
+
+    RuleStatisticsFile(const RuleStatisticsFile&) = delete;
+    RuleStatisticsFile& operator=(const RuleStatisticsFile&) = delete;
+
+    /*
+     * Read the file and set the saved counters of the rules of
+     * `ruleset'. A missing or invalid file is ignored. Returns the
+     * number of rules whose counters were restored.
+     */
+    size_t restore(RuleSet& ruleset);
+
+    /*
+     * Start the thread which writes the checkpoints.
+     */
+    void start();
+
+    /*
+     * Write the queued checkpoint and stop the thread.
+     */
+    void stop();
+
+    /*
+     * Queue a checkpoint of the counters of `rules'. Only the
+     * counters are read here; the rules are hashed and the file
+     * is written by the writer thread. A checkpoint which wasn't
+     * written yet is replaced by the new one.
+     */
+    void checkpoint(const PointerVector<const Rule>& rules);
+
+  private:
+    typedef std::vector<std::pair<Pointer<const Rule>, Rule::Statistics>> Checkpoint;
+
+    void thread();
+    void write(const Checkpoint& checkpoint);
+    String ruleKey(const Pointer<const Rule>& rule) const;
+
+    const String _path;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::mutex _write_mutex;
+    std::condition_variable _cv;
+    bool _running;
+    bool _pending;
+    Checkpoint _checkpoint;
+
+    /* Protected by _write_mutex */
+    std::map<String, Rule::Statistics> _written;
+    std::map<uint32_t, std::pair<Pointer<const Rule>, String>> _keys;
+    size_t _record_count;
+    bool _rewrite;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,324 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "SealedRuleIndex.hpp"
+#include "RuleIndex.hpp"
+#include "RulePrivate.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+namespace usbguard {
+  SealedRuleIndex::SealedRuleIndex(const PointerVector<Rule>& rules)
+    : _rules(rules)
+  {
+    std::vector<std::pair<uint64_t, uint32_t>> keyed;
+
+    _programs.reserve(rules.size());
+    _group_bits.reserve(rules.size());
+
+    for (size_t position = 0; position < rules.size(); ++position) {
+      const Rule& rule = *rules[position];
+      String key;
+      const RuleIndex::KeyType type = RuleIndex::ruleKey(rule, key);
+
+      _programs.push_back(RuleProgram::fromRule(rule));
+      _group_bits.push_back(rule.internal()->getGroupBit());
+
+      if (type == RuleIndex::KeyType::None) {
+        _residual.push_back(position);
+      }
+      else {
+        keyed.emplace_back(RuleIndex::filterKey(type, rule), position);
+      }
+    }
+
+    /*
+     * Rules whose keys are equal (including different values
+     * which share a key) end up in one group, sorted by the
+     * position. The candidates are checked by appliesTo anyway.
+     */
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<Slot> slots;
+    _positions.reserve(keyed.size());
+
+    for (auto const& entry : keyed) {
+      if (slots.empty() || slots.back().key != entry.first) {
+        const uint32_t begin = _positions.size();
+        slots.push_back(Slot { entry.first, begin, begin });
+      }
+      _positions.push_back(entry.second);
+      ++slots.back().end;
+    }
+
+    /*
+     * About two keys per bucket make the displacement search
+     * fast. If it fails, which is very unlikely, more buckets
+     * are used.
+     */
+    size_t bucket_count = std::max<size_t>(1, slots.size() / 2);
+
+    while (!build(slots, bucket_count)) {
+      if (bucket_count >= slots.size()) {
+        throw std::runtime_error("SealedRuleIndex: cannot build the perfect hash");
+      }
+      bucket_count = std::min(bucket_count * 2, slots.size());
+    }
+  }
+
+  uint64_t SealedRuleIndex::mix(uint64_t value)
+  {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+  }
+
+  size_t SealedRuleIndex::bucketOf(uint64_t key) const
+  {
+    return mix(key) % _seeds.size();
+  }
+
+  size_t SealedRuleIndex::slotOf(uint64_t key, uint32_t seed, size_t slot_count)
+  {
+    return mix(key ^ ((uint64_t(seed) + 1) * 0x9e3779b97f4a7c15ULL)) % slot_count;
+  }
+
+  /*
+   * Hash and displace: the keys are distributed into buckets,
+   * and for each bucket, largest first, a seed is searched for
+   * which maps all of its keys to free slots.
+   */
+  bool SealedRuleIndex::build(const std::vector<Slot>& slots, size_t bucket_count)
+  {
+    const size_t slot_count = slots.size();
+
+    _seeds.assign(bucket_count, 0);
+    _slots.assign(slot_count, Slot { 0, 0, 0 });
+
+    if (slot_count == 0) {
+      return true;
+    }
+
+    std::vector<std::vector<uint32_t>> buckets(bucket_count);
+
+    for (size_t i = 0; i < slot_count; ++i) {
+      buckets[bucketOf(slots[i].key)].push_back(i);
+    }
+
+    std::vector<uint32_t> bucket_order(bucket_count);
+    for (size_t i = 0; i < bucket_count; ++i) {
+      bucket_order[i] = i;
+    }
+
+    std::stable_sort(bucket_order.begin(), bucket_order.end(), [&](uint32_t a, uint32_t b) {
+        return buckets[a].size() > buckets[b].size();
+      });
+
+    std::vector<bool> occupied(slot_count, false);
+    std::vector<size_t> targets;
+    const uint32_t max_seed = 64 * slot_count + 1024;
+
+    for (const uint32_t bucket : bucket_order) {
+      const auto& members = buckets[bucket];
+
+      if (members.empty()) {
+        break;
+      }
+
+      bool placed = false;
+
+      for (uint32_t seed = 0; seed < max_seed && !placed; ++seed) {
+        targets.clear();
+        placed = true;
+
+        for (const uint32_t member : members) {
+          const size_t target = slotOf(slots[member].key, seed, slot_count);
+
+          if (occupied[target] ||
+              std::find(targets.begin(), targets.end(), target) != targets.end()) {
+            placed = false;
+            break;
+          }
+          targets.push_back(target);
+        }
+
+        if (placed) {
+          _seeds[bucket] = seed;
+        }
+      }
+
+      if (!placed) {
+        return false;
+      }
+
+      for (size_t i = 0; i < members.size(); ++i) {
+        occupied[targets[i]] = true;
+        _slots[targets[i]] = slots[members[i]];
+      }
+    }
+
+    return true;
+  }
+
+  const SealedRuleIndex::Slot* SealedRuleIndex::findSlot(uint64_t key) const
+  {
+    if (_slots.empty()) {
+      return nullptr;
+    }
+
+    const Slot& slot = _slots[slotOf(key, _seeds[bucketOf(key)], _slots.size())];
+
+    return slot.key == key ? &slot : nullptr;
+  }
+
+  bool SealedRuleIndex::applies(uint32_t position, const Rule& device_rule, const RuleProgram& device_program) const
+  {
+    const RuleProgram& program = _programs[position];
+
+    if (program.isValid() && device_program.isValid()) {
+      return program.appliesTo(device_program);
+    }
+    return _rules[position]->appliesTo(device_rule);
+  }
+
+  void SealedRuleIndex::visitCandidates(const Rule& device_rule,
+      const std::function<bool(uint32_t)>& visitor) const
+  {
+    std::vector<uint64_t> keys;
+
+    if (!RuleIndex::deviceKeys(device_rule, keys)) {
+      for (uint32_t position = 0; position < _rules.size(); ++position) {
+        if (visitor(position)) {
+          return;
+        }
+      }
+      return;
+    }
+
+    std::vector<std::pair<const uint32_t*, const uint32_t*>> ranges;
+
+    for (const uint64_t key : keys) {
+      if (const Slot* slot = findSlot(key)) {
+        ranges.emplace_back(_positions.data() + slot->begin, _positions.data() + slot->end);
+      }
+    }
+
+    if (!_residual.empty()) {
+      ranges.emplace_back(_residual.data(), _residual.data() + _residual.size());
+    }
+
+    /*
+     * Each rule has a single key, so the ranges are disjoint and
+     * merging them by the position yields the rule set order.
+     */
+    while (true) {
+      size_t next = ranges.size();
+
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        if (ranges[i].first != ranges[i].second &&
+            (next == ranges.size() || *ranges[i].first < *ranges[next].first)) {
+          next = i;
+        }
+      }
+
+      if (next == ranges.size()) {
+        return;
+      }
+      if (visitor(*ranges[next].first++)) {
+        return;
+      }
+    }
+  }
+
+  Pointer<Rule> SealedRuleIndex::findFirst(const Rule& device_rule,
+      const std::function<bool(const Pointer<Rule>&)>& visitor,
+      uint64_t disabled_groups) const
+  {
+    const RuleProgram device_program = RuleProgram::fromDeviceRule(device_rule);
+    Pointer<Rule> result;
+
+    visitCandidates(device_rule, [&](uint32_t position) {
+        if ((_group_bits[position] & disabled_groups) != 0) {
+          return false;
+        }
+        if (applies(position, device_rule, device_program) && visitor(_rules[position])) {
+          result = _rules[position];
+          return true;
+        }
+        return false;
+      });
+
+    return result;
+  }
+
+  PointerVector<Rule> SealedRuleIndex::findFirstEach(const std::vector<Rule>& device_rules,
+      const std::function<bool(const Pointer<Rule>&, size_t)>& visitor,
+      uint64_t disabled_groups) const
+  {
+    PointerVector<Rule> results(device_rules.size());
+
+    if (device_rules.empty()) {
+      return results;
+    }
+
+    std::vector<RuleProgram> device_programs;
+    device_programs.reserve(device_rules.size());
+
+    for (const Rule& device_rule : device_rules) {
+      device_programs.push_back(RuleProgram::fromDeviceRule(device_rule));
+    }
+
+    size_t unmatched = device_rules.size();
+
+    visitCandidates(device_rules[0], [&](uint32_t position) {
+        if ((_group_bits[position] & disabled_groups) != 0) {
+          return false;
+        }
+        for (size_t i = 0; i < device_rules.size(); ++i) {
+          if (results[i]) {
+            continue;
+          }
+          if (applies(position, device_rules[i], device_programs[i]) && visitor(_rules[position], i)) {
+            results[i] = _rules[position];
+            --unmatched;
+          }
+        }
+        return unmatched == 0;
+      });
+
+    return results;
+  }
+
+  size_t SealedRuleIndex::size() const
+  {
+    return _rules.size();
+  }
+
+  size_t SealedRuleIndex::keyCount() const
+  {
+    return _slots.size();
+  }
+
+  size_t SealedRuleIndex::residualCount() const
+  {
+    return _residual.size();
+  }
+} /* namespace usbguard */
@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include "Rule.hpp"
+#include "RuleProgram.hpp"
+#include <functional>
+#include <vector>
+
+namespace usbguard {
+  /*
+   * Read-only match index over the rules of a sealed rule set
+   * (see RuleSet::setSealed). The rules with a bucket key (see
+   * RuleIndex::ruleKey) are grouped by the key in one flat array
+   * of rule positions and the group of a key is found with a
+   * minimal perfect hash over the keys, i.e. with two array
+   * reads and one key comparison. All the other rules are kept
+   * in a residual list. Nothing is allocated per rule besides
+   * the compiled match program, and the index can't be modified
+   * after it has been built.
+   */
+  class SealedRuleIndex
+  {
+  public:
+    explicit SealedRuleIndex(const PointerVector<Rule>& rules);
+
+    /*
+     * Same as RuleIndex::findFirst.
+     */
+    Pointer<Rule> findFirst(const Rule& device_rule,
+        const std::function<bool(const Pointer<Rule>&)>& visitor,
+        uint64_t disabled_groups = 0) const;
+
+    /*
+     * Same as RuleIndex::findFirstEach.
+     */
+    PointerVector<Rule> findFirstEach(const std::vector<Rule>& device_rules,
+        const std::function<bool(const Pointer<Rule>&, size_t)>& visitor,
+        uint64_t disabled_groups = 0) const;
+
+    size_t size() const;
+    size_t keyCount() const;
+    size_t residualCount() const;
+
+  private:
+    struct Slot {
+      uint64_t key;
+      uint32_t begin;
+      uint32_t end;
+    };
+
+    static uint64_t mix(uint64_t value);
+    size_t bucketOf(uint64_t key) const;
+    static size_t slotOf(uint64_t key, uint32_t seed, size_t slot_count);
+    bool build(const std::vector<Slot>& slots, size_t bucket_count);
+    const Slot* findSlot(uint64_t key) const;
+    bool applies(uint32_t position, const Rule& device_rule, const RuleProgram& device_program) const;
+    /*
+     * Call `visitor' on the positions of the rules which may apply
+     * to the device rule, in rule set order, until it returns true.
+     */
+    void visitCandidates(const Rule& device_rule,
+        const std::function<bool(uint32_t)>& visitor) const;
+
+    PointerVector<Rule> _rules;
+    std::vector<RuleProgram> _programs;
+    /* Group bit of each rule, see Rule::groupBit */
+    std::vector<uint64_t> _group_bits;
+    /* Rule positions grouped by the key, see Slot */
+    std::vector<uint32_t> _positions;
+    std::vector<uint32_t> _residual;
+    /* Displacement seed of each hash bucket */
+    std::vector<uint32_t> _seeds;
+    std::vector<Slot> _slots;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,165 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "StartupProfile.hpp"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace usbguard {
+  /*
+   * The startup is recorded only a few dozen times per device,
+   * so a mutex is good enough here.
+   */
+  static std::mutex profile_mutex;
+  static bool profile_running = false;
+  static std::chrono::steady_clock::time_point profile_started;
+  static StartupProfile profile;
+  static std::map<uint32_t, StartupProfile::Device> profile_devices;
+
+  static uint64_t toNanoseconds(std::chrono::steady_clock::duration duration)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  }
+
+  StartupProfile::StartupProfile()
+    : ready_ns(0)
+  {
+  }
+
+  void StartupProfile::start()
+  {
+    std::unique_lock<std::mutex> lock(profile_mutex);
+    profile = StartupProfile();
+    profile_devices.clear();
+    profile_started = std::chrono::steady_clock::now();
+    profile_running = true;
+  }
+
+  bool StartupProfile::finish()
+  {
+    std::unique_lock<std::mutex> lock(profile_mutex);
+
+    if (!profile_running) {
+      return false;
+    }
+
+    profile.ready_ns = toNanoseconds(std::chrono::steady_clock::now() - profile_started);
+    profile_running = false;
+    return true;
+  }
+
+  void StartupProfile::recordPhase(const char *name,
+                                   std::chrono::steady_clock::time_point started,
+                                   std::chrono::steady_clock::time_point ended)
+  {
+    std::unique_lock<std::mutex> lock(profile_mutex);
+
+    if (!profile_running) {
+      return;
+    }
+
+    Phase phase;
+    phase.name = name;
+    phase.start_ns = started > profile_started ? toNanoseconds(started - profile_started) : 0;
+    phase.duration_ns = ended > started ? toNanoseconds(ended - started) : 0;
+    profile.phases.push_back(std::move(phase));
+  }
+
+  static StartupProfile::Device& deviceEntry(uint32_t id)
+  {
+    auto it = profile_devices.find(id);
+
+    if (it == profile_devices.end()) {
+      it = profile_devices.emplace(id, StartupProfile::Device { id, 0, 0 }).first;
+    }
+
+    return it->second;
+  }
+
+  void StartupProfile::recordDeviceLoad(uint32_t id, std::chrono::steady_clock::duration duration)
+  {
+    std::unique_lock<std::mutex> lock(profile_mutex);
+
+    if (profile_running) {
+      deviceEntry(id).load_ns += toNanoseconds(duration);
+    }
+  }
+
+  void StartupProfile::recordDeviceDecision(uint32_t id, std::chrono::steady_clock::duration duration)
+  {
+    std::unique_lock<std::mutex> lock(profile_mutex);
+
+    if (profile_running) {
+      deviceEntry(id).decision_ns += toNanoseconds(duration);
+    }
+  }
+
+  StartupProfile StartupProfile::get()
+  {
+    std::unique_lock<std::mutex> lock(profile_mutex);
+    StartupProfile result = profile;
+
+    for (auto const& entry : profile_devices) {
+      result.devices.push_back(entry.second);
+    }
+
+    return result;
+  }
+
+  String StartupProfile::toString(size_t device_limit) const
+  {
+    std::ostringstream stream;
+
+    stream << "ready at " << ready_ns / 1000 << "us";
+
+    for (auto const& phase : phases) {
+      stream << "; " << phase.name << " +" << phase.start_ns / 1000
+             << "us " << phase.duration_ns / 1000 << "us";
+    }
+
+    std::vector<Device> slowest(devices);
+    std::sort(slowest.begin(), slowest.end(), [](const Device& a, const Device& b) {
+      return a.load_ns + a.decision_ns > b.load_ns + b.decision_ns;
+    });
+    if (slowest.size() > device_limit) {
+      slowest.resize(device_limit);
+    }
+
+    stream << "; " << devices.size() << " devices";
+
+    for (auto const& device : slowest) {
+      stream << "; device " << device.id << " load " << device.load_ns / 1000
+             << "us decision " << device.decision_ns / 1000 << "us";
+    }
+
+    return stream.str();
+  }
+
+  StartupProfile::Scope::Scope(const char *name)
+    : _name(name),
+      _started(std::chrono::steady_clock::now())
+  {
+  }
+
+  StartupProfile::Scope::~Scope()
+  {
+    recordPhase(_name, _started, std::chrono::steady_clock::now());
+  }
+} /* namespace usbguard */
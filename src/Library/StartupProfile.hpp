@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+namespace usbguard {
+  /**
+   * Timestamped breakdown of the daemon startup, from start() until
+   * the devices present at startup were processed (finish()).
+   *
+   * The profile is process-wide. Phases are recorded when they end,
+   * so nested phases are listed before the phases enclosing them;
+   * their offsets tell where each of them lies. Nothing is recorded
+   * before start() or after finish(), e.g. by a later configuration
+   * reload or device rescan.
+   */
+  struct DLL_PUBLIC StartupProfile
+  {
+    struct DLL_PUBLIC Phase
+    {
+      String name;
+      uint64_t start_ns; /**< Offset from start() (nanoseconds) */
+      uint64_t duration_ns;
+    };
+
+    /**
+     * Processing time of one device present at startup. The load
+     * time covers the construction of the device object, including
+     * the sysfs data, descriptors and hash. The decision time covers
+     * the device rule generation and the rule matching; the targets
+     * are applied as a batch, see the apply-present-targets phase.
+     */
+    struct DLL_PUBLIC Device
+    {
+      uint32_t id;
+      uint64_t load_ns;
+      uint64_t decision_ns;
+    };
+
+    StartupProfile();
+
+    uint64_t ready_ns; /**< Offset of finish(), 0 if not finished yet */
+    std::vector<Phase> phases; /**< In the order they ended */
+    std::vector<Device> devices; /**< In the order of their ids */
+
+    static void start();
+
+    /**
+     * End the profile. Returns true if this call ended it, i.e. the
+     * first call after start().
+     */
+    static bool finish();
+
+    static void recordPhase(const char *name,
+                            std::chrono::steady_clock::time_point started,
+                            std::chrono::steady_clock::time_point ended);
+    static void recordDeviceLoad(uint32_t id, std::chrono::steady_clock::duration duration);
+    static void recordDeviceDecision(uint32_t id, std::chrono::steady_clock::duration duration);
+
+    /**
+     * Copy of the profile recorded so far.
+     */
+    static StartupProfile get();
+
+    /**
+     * One line summary of the profile for the log: the phases
+     * followed by the `device_limit' slowest devices.
+     */
+    String toString(size_t device_limit = 5) const;
+
+    /**
+     * Records the lifetime of the instance as a startup phase.
+     */
+    class DLL_PUBLIC Scope
+    {
+    public:
+      Scope(const char *name);
+      ~Scope();
+
+      Scope(const Scope&) = delete;
+      const Scope& operator=(const Scope&) = delete;
+
+    private:
+      const char * const _name;
+      const std::chrono::steady_clock::time_point _started;
+    };
+  };
+} /* namespace usbguard */
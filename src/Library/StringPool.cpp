@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "StringPool.hpp"
+#include "Utility.hpp"
+#include "Common/Utility.hpp"
+#include <stdexcept>
+#include <limits>
+
+namespace usbguard {
+  StringPool& StringPool::instance()
+  {
+    static StringPool pool;
+    return pool;
+  }
+
+  StringPool::StringPool()
+  {
+  }
+
+  const StringPool::Entry& StringPool::intern(const String& value)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _entries.find(value);
+
+    if (it != _entries.end()) {
+      return *it;
+    }
+
+    if (_entries.size() >= std::numeric_limits<ID>::max()) {
+      throw std::runtime_error("StringPool: out of string ids");
+    }
+
+    const ID id = static_cast<ID>(_entries.size() + 1);
+    /* Elements of an unordered_map have stable addresses */
+    return *_entries.emplace(value, id).first;
+  }
+
+  StringPool::ID StringPool::lookup(const String& value) const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _entries.find(value);
+    return it != _entries.end() ? it->second : NoID;
+  }
+
+  const String& StringPool::ruleString(ID id, const String& value)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _rule_strings.find(id);
+
+    if (it == _rule_strings.end()) {
+      it = _rule_strings.emplace(id, Utility::quoteEscapeString(value)).first;
+    }
+
+    return it->second;
+  }
+
+  size_t StringPool::size() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _entries.size();
+  }
+
+  /*
+   * A node of an unordered_map holds the element, the pointer to the
+   * next node and the cached hash value.
+   */
+  size_t StringPool::memoryUsage() const
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    const size_t node_overhead = 2 * sizeof(void*);
+    size_t usage = (_entries.bucket_count() + _rule_strings.bucket_count()) * sizeof(void*);
+
+    for (auto const& entry : _entries) {
+      usage += sizeof entry + node_overhead + stringHeapUsage(entry.first);
+    }
+    for (auto const& rule_string : _rule_strings) {
+      usage += sizeof rule_string + node_overhead + stringHeapUsage(rule_string.second);
+    }
+
+    return usage;
+  }
+} /* namespace usbguard */
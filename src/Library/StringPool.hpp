@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include <build-config.h>
+#include "Typedefs.hpp"
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+namespace usbguard {
+  /*
+   * Process-wide pool of interned strings. Each distinct string
+   * value is stored once and identified by a small integer id, so
+   * two interned strings are equal iff their ids (or addresses)
+   * are equal. The id 0 is never assigned.
+   *
+   * Interned strings are never released. See InternedString for
+   * the handle type used by rule attributes.
+   */
+  class DLL_PUBLIC StringPool
+  {
+  public:
+    typedef uint32_t ID;
+    typedef std::unordered_map<String, ID>::value_type Entry;
+    static const ID NoID = 0;
+
+    static StringPool& instance();
+
+    /*
+     * Return the pool entry of the string, interning it if
+     * needed. The entries have stable addresses.
+     */
+    const Entry& intern(const String& value);
+
+    /* Return the id of an already interned string or NoID */
+    ID lookup(const String& value) const;
+
+    /*
+     * Return the quoted and escaped rule language form of an
+     * interned string. It's computed once per string value.
+     */
+    const String& ruleString(ID id, const String& value);
+
+    size_t size() const;
+
+    /* Estimated memory used by the pool, in bytes */
+    size_t memoryUsage() const;
+
+  private:
+    StringPool();
+
+    mutable std::mutex _mutex;
+    std::unordered_map<String, ID> _entries;
+    std::unordered_map<ID, String> _rule_strings;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,79 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "TrafficRateCondition.hpp"
+#include "USBTrafficMonitor.hpp"
+#include <stdexcept>
+
+namespace usbguard
+{
+  TrafficRateCondition::TrafficRateCondition(const String& rate, bool negated)
+    : RuleCondition("usb-traffic-rate", rate, negated)
+  {
+    size_t pos = 0;
+
+    try {
+      _rate = std::stoull(rate, &pos);
+    }
+    catch(...) {
+      pos = 0;
+    }
+
+    if (rate.empty() || pos != rate.size() || rate[0] == '-') {
+      throw std::runtime_error("usb-traffic-rate: Invalid transfer rate: " + rate);
+    }
+  }
+
+  TrafficRateCondition::TrafficRateCondition(const TrafficRateCondition& rhs)
+    : RuleCondition(rhs),
+      _rate(rhs._rate)
+  {
+  }
+
+  bool TrafficRateCondition::update(const Rule& rule)
+  {
+    const USBTrafficMonitor& monitor = USBTrafficMonitor::instance();
+
+    if (!monitor.running() || rule.attributeViaPort().empty()) {
+      return false;
+    }
+
+    USBTrafficMonitor::Counters counters;
+
+    if (!monitor.getCounters(rule.getViaPort(), counters)) {
+      return false;
+    }
+
+    return counters.peak_rate > _rate;
+  }
+
+  bool TrafficRateCondition::isMemoizable() const
+  {
+    return true;
+  }
+
+  RuleCondition::Cost TrafficRateCondition::cost() const
+  {
+    return Cost::Cheap;
+  }
+
+  RuleCondition * TrafficRateCondition::clone() const
+  {
+    return new TrafficRateCondition(*this);
+  }
+} /* namespace usbguard */
@@ -0,0 +1,45 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include "RuleCondition.hpp"
+#include "Rule.hpp"
+
+namespace usbguard
+{
+  /*
+   * usb-traffic-rate(<transfers>): true if the device completed more
+   * than the given number of transfers in one second since it was
+   * connected, as seen by the USB traffic monitor. False if the
+   * monitor isn't running or the device rule has no via-port.
+   */
+  class TrafficRateCondition : public RuleCondition
+  {
+  public:
+    TrafficRateCondition(const String& rate, bool negated = false);
+    TrafficRateCondition(const TrafficRateCondition& rhs);
+    bool update(const Rule& rule);
+    bool isMemoizable() const;
+    Cost cost() const;
+    RuleCondition * clone() const;
+
+  private:
+    uint64_t _rate;
+  };
+} /* namespace usbguard */
@@ -85,6 +85,14 @@ namespace usbguard {
     return _vendor_id + ":" + _product_id;
   }
 
+  void appendRuleString(String& rule_string, const USBDeviceID& value)
+  {
+    rule_string.append(value.getVendorID());
+    rule_string.append(":");
+    rule_string.append(value.getProductID());
+    return;
+  }
+
   String USBDeviceID::toString() const
   {
     return toRuleString();
@@ -222,6 +230,12 @@ namespace usbguard {
     return true;
   }
 
+  uint32_t USBInterfaceType::packed() const
+  {
+    return ((uint32_t)_mask << 24) | ((uint32_t)_bClass << 16) | \
+      ((uint32_t)_bSubClass << 8) | (uint32_t)_bProtocol;
+  }
+
   template<>
   bool Predicates::isSubsetOf(const USBInterfaceType& source, const USBInterfaceType& target)
   {
@@ -330,6 +344,34 @@ namespace usbguard {
     return;
   }
 
+  void USBCheckDescriptorLength(const USBDescriptorView& descriptor)
+  {
+    bool valid = true;
+
+    switch(descriptor.bDescriptorType()) {
+      case USB_DESCRIPTOR_TYPE_DEVICE:
+        valid = descriptor.bLength() == sizeof(USBDeviceDescriptor);
+        break;
+      case USB_DESCRIPTOR_TYPE_CONFIGURATION:
+        valid = descriptor.bLength() == sizeof(USBConfigurationDescriptor);
+        break;
+      case USB_DESCRIPTOR_TYPE_INTERFACE:
+        valid = descriptor.bLength() == sizeof(USBInterfaceDescriptor);
+        break;
+      case USB_DESCRIPTOR_TYPE_ENDPOINT:
+        valid = descriptor.bLength() == sizeof(USBEndpointDescriptor) ||
+          descriptor.bLength() == sizeof(USBAudioEndpointDescriptor);
+        break;
+      default:
+        break;
+    }
+
+    if (!valid) {
+      throw std::runtime_error("Invalid descriptor data: invalid combination of bDescriptorType and bLength values");
+    }
+    return;
+  }
+
   const std::vector<USBDescriptorParser::Handler>* USBDescriptorParser::getDescriptorTypeHandler(uint8_t bDescriptorType) const
   {
     const auto it = _handler_map.find(bDescriptorType);
@@ -425,57 +467,98 @@ namespace usbguard {
         throw std::runtime_error("Invalid descriptor data: bLength value larger than the amount of available data");
       }
 
-      /*
-       * Find handler for the descriptor type & length.
-       */
-      const Handler *handler = nullptr;
+      processDescriptor(descriptor);
+      size_processed += header.bLength;
+    }
 
-      if (getDescriptorTypeHandler(header, handler)) {
-        if (handler == nullptr) {
-          throw std::runtime_error("Invalid descriptor data: invalid combination of bDescriptorType and bLength values");
-        }
-      }
-      else {
-        const USBDescriptorHeader header_unknown = {
-          .bLength = header.bLength,
-          .bDescriptorType = USB_DESCRIPTOR_TYPE_UNKNOWN
-        };
+    return size_processed;
+  }
 
-        (void)getDescriptorTypeHandler(header_unknown, handler);
-        /*
-         * If there's not even an unknown descriptor type handler, just
-         * ignore it and count in the length. Until we implement
-         * support for all descriptor types as defined by all used USB
-         * specifications, we cannot do anything else here...
-         */
-        if (handler == nullptr) {
-          size_processed += header.bLength;
-          continue;
-        }
-      }
+  size_t USBDescriptorParser::parse(const uint8_t *data, const size_t size)
+  {
+    size_t size_processed = 0;
 
-      if (handler == nullptr) {
-        throw std::runtime_error("BUG: No descriptor type handler selected in USBDescriptorParser::parse");
+    while (size_processed < size) {
+      const size_t size_available = size - size_processed;
+
+      if (size_available < sizeof(USBDescriptorHeader)) {
+        throw std::runtime_error("Cannot parse descriptor data: partial read while reading header data");
       }
 
-      USBDescriptor descriptor_parsed;
-      descriptor_parsed.bHeader = header;
-      memset(&descriptor_parsed.bDescriptorData, 0, sizeof descriptor_parsed.bDescriptorData);
+      USBDescriptor descriptor;
+      memcpy(&descriptor.bHeader, data + size_processed, sizeof(USBDescriptorHeader));
 
-      if (handler->parser) {
-        handler->parser(this, &descriptor, &descriptor_parsed);
+      const USBDescriptorHeader& header = descriptor.bHeader;
+
+      if (header.bLength < sizeof(USBDescriptorHeader)) {
+        throw std::runtime_error("Invalid descriptor data: bLength is less than the size of the header");
       }
-      if (handler->callback) {
-        handler->callback(this, &descriptor_parsed);
+      if (header.bLength > size_available) {
+        throw std::runtime_error("Invalid descriptor data: bLength value larger than the amount of available data");
       }
 
-      setDescriptor(header.bDescriptorType, descriptor_parsed);
+      memset(&descriptor.bDescriptorData, 0, sizeof descriptor.bDescriptorData);
+      memcpy(&descriptor.bDescriptorData, data + size_processed + sizeof(USBDescriptorHeader),
+             header.bLength - sizeof(USBDescriptorHeader));
+
+      processDescriptor(descriptor);
       size_processed += header.bLength;
     }
 
     return size_processed;
   }
 
+  void USBDescriptorParser::processDescriptor(const USBDescriptor& descriptor)
+  {
+    const USBDescriptorHeader& header = descriptor.bHeader;
+
+    /*
+     * Find handler for the descriptor type & length.
+     */
+    const Handler *handler = nullptr;
+
+    if (getDescriptorTypeHandler(header, handler)) {
+      if (handler == nullptr) {
+        throw std::runtime_error("Invalid descriptor data: invalid combination of bDescriptorType and bLength values");
+      }
+    }
+    else {
+      const USBDescriptorHeader header_unknown = {
+        .bLength = header.bLength,
+        .bDescriptorType = USB_DESCRIPTOR_TYPE_UNKNOWN
+      };
+
+      (void)getDescriptorTypeHandler(header_unknown, handler);
+      /*
+       * If there's not even an unknown descriptor type handler, just
+       * ignore it and count in the length. Until we implement
+       * support for all descriptor types as defined by all used USB
+       * specifications, we cannot do anything else here...
+       */
+      if (handler == nullptr) {
+        return;
+      }
+    }
+
+    if (handler == nullptr) {
+      throw std::runtime_error("BUG: No descriptor type handler selected in USBDescriptorParser::processDescriptor");
+    }
+
+    USBDescriptor descriptor_parsed;
+    descriptor_parsed.bHeader = header;
+    memset(&descriptor_parsed.bDescriptorData, 0, sizeof descriptor_parsed.bDescriptorData);
+
+    if (handler->parser) {
+      handler->parser(this, &descriptor, &descriptor_parsed);
+    }
+    if (handler->callback) {
+      handler->callback(this, &descriptor_parsed);
+    }
+
+    setDescriptor(header.bDescriptorType, descriptor_parsed);
+    return;
+  }
+
   void USBDescriptorParser::setHandler(uint8_t bDescriptorType, uint8_t bLengthExpected, ParserFunction parser, CallbackFunction callback)
   {
     auto& handlers = _handler_map[bDescriptorType];
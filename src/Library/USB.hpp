@@ -24,6 +24,7 @@
 #include <climits>
 #include <unordered_map>
 #include <functional>
+#include <stdexcept>
 
 namespace usbguard {
   /*
@@ -186,6 +187,13 @@ namespace usbguard {
     bool operator==(const USBInterfaceType& rhs) const;
     bool appliesTo(const USBInterfaceType& rhs) const;
 
+    /*
+     * Return the type packed into 32 bits: the match mask in the
+     * most significant byte followed by the class, subclass and
+     * protocol bytes.
+     */
+    uint32_t packed() const;
+
     const String typeString() const;
     const String toRuleString() const;
     static const String typeString(uint8_t bClass, uint8_t bSubClass, uint8_t bProtocol, uint8_t mask = MatchAll);
@@ -219,6 +227,15 @@ namespace usbguard {
      */
     size_t parse(std::istream& stream);
 
+    /**
+     * Parse USB descriptors from a memory buffer holding size
+     * bytes of descriptor data.
+     *
+     * Returns number of bytes succesfully parsed/processed from
+     * the buffer.
+     */
+    size_t parse(const uint8_t *data, size_t size);
+
     /**
      * Sets handler functions (parser and callback) for specific USB descriptor types
      *
@@ -265,6 +282,7 @@ namespace usbguard {
 
     const std::vector<Handler>* getDescriptorTypeHandler(uint8_t bDescriptorType) const;
     bool getDescriptorTypeHandler(const USBDescriptorHeader& header, const Handler*& handler) const;
+    void processDescriptor(const USBDescriptor& descriptor);
 
     std::unordered_map<uint8_t, std::vector<USBDescriptor>> _dstate_map; /**< Descriptor State Map */
     std::unordered_map<uint8_t, std::vector<Handler>> _handler_map;
@@ -277,4 +295,113 @@ namespace usbguard {
  void DLL_PUBLIC USBParseEndpointDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor_raw, USBDescriptor* descriptor_out);
  void DLL_PUBLIC USBParseAudioEndpointDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor_raw, USBDescriptor* descriptor_out);
 
+  /**
+   * A view of a single USB descriptor stored in a descriptor data
+   * buffer. The view doesn't own the data. Multibyte fields of the
+   * viewed descriptor are in bus (little-endian) byte order.
+   */
+  class DLL_PUBLIC USBDescriptorView
+  {
+  public:
+    USBDescriptorView(const uint8_t *data)
+      : _data(data)
+    {
+    }
+
+    uint8_t bLength() const
+    {
+      return _data[0];
+    }
+
+    uint8_t bDescriptorType() const
+    {
+      return _data[1];
+    }
+
+    const uint8_t *data() const
+    {
+      return _data;
+    }
+
+    /**
+     * Access the viewed data as a descriptor structure. The
+     * descriptor length has to be checked by the caller.
+     */
+    template<class DescriptorType>
+    const DescriptorType& as() const
+    {
+      return *reinterpret_cast<const DescriptorType *>(_data);
+    }
+
+  private:
+    const uint8_t *_data;
+  };
+
+  /**
+   * Throws an exception if the bLength value of a descriptor of a
+   * known type doesn't match the size of that descriptor type.
+   */
+  void DLL_PUBLIC USBCheckDescriptorLength(const USBDescriptorView& descriptor);
+
+  /**
+   * Walk the USB descriptors stored in a buffer in place, without
+   * copying them. For each descriptor of a known type, the matching
+   * method of the handler is called with a view of the descriptor:
+   *
+   *   handler.deviceDescriptor(view)
+   *   handler.configurationDescriptor(view)
+   *   handler.interfaceDescriptor(view)
+   *   handler.endpointDescriptor(view)
+   *
+   * Descriptors of other types are skipped. The endpoint handler may
+   * receive descriptors of two sizes (endpoint, audio endpoint).
+   *
+   * Returns number of bytes succesfully processed from the buffer.
+   */
+  template<class Handler>
+  size_t USBParseDescriptorSpan(const uint8_t *data, const size_t size, Handler& handler)
+  {
+    size_t size_processed = 0;
+
+    while (size_processed < size) {
+      const size_t size_available = size - size_processed;
+
+      if (size_available < sizeof(USBDescriptorHeader)) {
+        throw std::runtime_error("Cannot parse descriptor data: partial read while reading header data");
+      }
+
+      const USBDescriptorView descriptor(data + size_processed);
+
+      if (descriptor.bLength() < sizeof(USBDescriptorHeader)) {
+        throw std::runtime_error("Invalid descriptor data: bLength is less than the size of the header");
+      }
+      if (descriptor.bLength() > size_available) {
+        throw std::runtime_error("Invalid descriptor data: bLength value larger than the amount of available data");
+      }
+
+      USBCheckDescriptorLength(descriptor);
+
+      switch(descriptor.bDescriptorType()) {
+        case USB_DESCRIPTOR_TYPE_DEVICE:
+          handler.deviceDescriptor(descriptor);
+          break;
+        case USB_DESCRIPTOR_TYPE_CONFIGURATION:
+          handler.configurationDescriptor(descriptor);
+          break;
+        case USB_DESCRIPTOR_TYPE_INTERFACE:
+          handler.interfaceDescriptor(descriptor);
+          break;
+        case USB_DESCRIPTOR_TYPE_ENDPOINT:
+          handler.endpointDescriptor(descriptor);
+          break;
+        default:
+          break;
+      }
+
+      size_processed += descriptor.bLength();
+    }
+
+    return size_processed;
+  }
+
 } /* namespace usbguard */
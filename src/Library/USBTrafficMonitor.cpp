@@ -0,0 +1,380 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "USBTrafficMonitor.hpp"
+#include "LoggerPrivate.hpp"
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace usbguard {
+  static_assert(sizeof(USBMonHeader) == 64, "USBMonHeader doesn't match the kernel mon_bin_hdr");
+
+  /*
+   * The largest ring the kernel allows. At USB 3 event rates even
+   * this holds only a fraction of a second of events, so the ring
+   * is drained in batches of up to usbmon_fetch_max offsets.
+   */
+  static const int usbmon_ring_size = 1200 * 1024;
+  static const size_t usbmon_fetch_max = 1024;
+
+  USBTrafficMonitor& USBTrafficMonitor::instance()
+  {
+    static USBTrafficMonitor monitor;
+    return monitor;
+  }
+
+  USBTrafficMonitor::USBTrafficMonitor()
+    : _events(0),
+      _dropped(0),
+      _running(false),
+      _fd(-1),
+      _wakeup_fd(-1),
+      _ring(nullptr),
+      _ring_size(0)
+  {
+    for (auto& bus : _buses) {
+      bus.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  USBTrafficMonitor::~USBTrafficMonitor()
+  {
+    stop();
+    for (auto& bus : _buses) {
+      delete bus.exchange(nullptr);
+    }
+  }
+
+  void USBTrafficMonitor::start(const String& usbmon_path)
+  {
+    if (running()) {
+      throw std::runtime_error("USB traffic monitor is already running");
+    }
+
+    const int fd = open(usbmon_path.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+
+    if (fd < 0) {
+      throw std::runtime_error("Cannot open " + usbmon_path + ": " + strerror(errno));
+    }
+    if (ioctl(fd, USBMON_IOCT_RING_SIZE, usbmon_ring_size) < 0) {
+      logger->warn("Cannot resize the usbmon ring buffer: {}", strerror(errno));
+    }
+
+    const int ring_size = ioctl(fd, USBMON_IOCQ_RING_SIZE);
+
+    if (ring_size <= 0) {
+      const int error = errno;
+      close(fd);
+      throw std::runtime_error(std::string("Cannot query the usbmon ring buffer size: ") + strerror(error));
+    }
+
+    void * const ring = mmap(nullptr, (size_t)ring_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (ring == MAP_FAILED) {
+      const int error = errno;
+      close(fd);
+      throw std::runtime_error(std::string("Cannot map the usbmon ring buffer: ") + strerror(error));
+    }
+
+    const int wakeup_fd = eventfd(0, 0);
+
+    if (wakeup_fd < 0) {
+      munmap(ring, (size_t)ring_size);
+      close(fd);
+      throw std::runtime_error("eventfd init error");
+    }
+
+    _fd = fd;
+    _wakeup_fd = wakeup_fd;
+    _ring = static_cast<uint8_t*>(ring);
+    _ring_size = (size_t)ring_size;
+    _running = true;
+    _thread = std::thread(&USBTrafficMonitor::thread, this);
+    return;
+  }
+
+  void USBTrafficMonitor::stop()
+  {
+    if (!_thread.joinable()) {
+      return;
+    }
+
+    _running = false;
+    { /* Wakeup the reader thread */
+      const uint64_t one = 1;
+      if (write(_wakeup_fd, &one, sizeof one) != sizeof one) {
+        logger->warn("Cannot wake up the USB traffic monitor thread: {}", strerror(errno));
+      }
+    }
+    _thread.join();
+
+    munmap(_ring, _ring_size);
+    close(_fd);
+    close(_wakeup_fd);
+    _ring = nullptr;
+    _ring_size = 0;
+    _fd = -1;
+    _wakeup_fd = -1;
+    return;
+  }
+
+  bool USBTrafficMonitor::running() const
+  {
+    return _running;
+  }
+
+  void USBTrafficMonitor::thread()
+  {
+    std::vector<uint32_t> offsets(usbmon_fetch_max);
+    uint32_t flush_count = 0;
+    struct pollfd fds[2] = {
+      { _fd, POLLIN, 0 },
+      { _wakeup_fd, POLLIN, 0 }
+    };
+
+    while (_running) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        logger->error("USB traffic monitor: poll failed: {}", strerror(errno));
+        break;
+      }
+      if (fds[1].revents != 0) {
+        break;
+      }
+
+      /*
+       * Release the events processed in the previous iteration and
+       * fetch the offsets of the next batch in the same call.
+       */
+      USBMonFetch fetch;
+      fetch.offvec = offsets.data();
+      fetch.nfetch = (uint32_t)offsets.size();
+      fetch.nflush = flush_count;
+
+      if (ioctl(_fd, USBMON_IOCX_MFETCH, &fetch) < 0) {
+        /* The flush is done before the fetch fails */
+        flush_count = 0;
+        if (errno == EAGAIN || errno == EINTR) {
+          continue;
+        }
+        logger->error("USB traffic monitor: cannot fetch usbmon events: {}", strerror(errno));
+        break;
+      }
+
+      for (uint32_t i = 0; i < fetch.nfetch; ++i) {
+        if (offsets[i] + sizeof(USBMonHeader) > _ring_size) {
+          continue;
+        }
+
+        const USBMonHeader *header = reinterpret_cast<const USBMonHeader*>(_ring + offsets[i]);
+
+        if (header->type != '@') {
+          processEvent(*header);
+        }
+      }
+
+      flush_count = fetch.nfetch;
+
+      USBMonStats stats;
+
+      if (ioctl(_fd, USBMON_IOCG_STATS, &stats) == 0 && stats.dropped > 0) {
+        _dropped.fetch_add(stats.dropped, std::memory_order_relaxed);
+      }
+    }
+
+    if (flush_count > 0) {
+      ioctl(_fd, USBMON_IOCH_MFLUSH, flush_count);
+    }
+
+    _running = false;
+    return;
+  }
+
+  USBTrafficMonitor::DeviceSlot *USBTrafficMonitor::slot(uint16_t busnum, uint8_t devnum, bool create)
+  {
+    if (busnum >= bus_max || devnum >= devnum_max) {
+      return nullptr;
+    }
+
+    Bus *bus = _buses[busnum].load(std::memory_order_acquire);
+
+    if (bus == nullptr) {
+      if (!create) {
+        return nullptr;
+      }
+      bus = new Bus();
+      for (auto& device : bus->devices) {
+        resetSlot(device);
+      }
+      _buses[busnum].store(bus, std::memory_order_release);
+    }
+
+    return &bus->devices[devnum];
+  }
+
+  const USBTrafficMonitor::DeviceSlot *USBTrafficMonitor::slot(uint16_t busnum, uint8_t devnum) const
+  {
+    if (busnum >= bus_max || devnum >= devnum_max) {
+      return nullptr;
+    }
+
+    const Bus *bus = _buses[busnum].load(std::memory_order_acquire);
+    return bus ? &bus->devices[devnum] : nullptr;
+  }
+
+  void USBTrafficMonitor::resetSlot(DeviceSlot& device)
+  {
+    device.transfers.store(0, std::memory_order_relaxed);
+    device.bytes.store(0, std::memory_order_relaxed);
+    device.peak_rate.store(0, std::memory_order_relaxed);
+    device.current_rate.store(0, std::memory_order_relaxed);
+    device.current_second.store(0, std::memory_order_relaxed);
+    return;
+  }
+
+  void USBTrafficMonitor::processEvent(const USBMonHeader& header)
+  {
+    _events.fetch_add(1, std::memory_order_relaxed);
+
+    /*
+     * SET_ADDRESS sent to the default address: the device number
+     * in wValue is being assigned to a newly connected device.
+     */
+    if (header.type == 'S' && header.xfer_type == 2 && header.devnum == 0 &&
+        header.flag_setup == 0 && header.setup[0] == 0x00 && header.setup[1] == 0x05) {
+      DeviceSlot * const device = slot(header.busnum, header.setup[2], /*create=*/true);
+
+      if (device != nullptr) {
+        resetSlot(*device);
+      }
+      return;
+    }
+
+    if (header.type != 'C') {
+      return;
+    }
+
+    DeviceSlot * const device = slot(header.busnum, header.devnum, /*create=*/true);
+
+    if (device == nullptr) {
+      return;
+    }
+
+    /*
+     * Only this thread updates the counters, so plain loads and
+     * stores are enough. They're atomic just for the readers.
+     */
+    device->transfers.store(device->transfers.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    device->bytes.store(device->bytes.load(std::memory_order_relaxed) + header.len_urb, std::memory_order_relaxed);
+
+    uint64_t rate = 1;
+
+    if (device->current_second.load(std::memory_order_relaxed) == header.ts_sec) {
+      rate += device->current_rate.load(std::memory_order_relaxed);
+    }
+    else {
+      device->current_second.store(header.ts_sec, std::memory_order_relaxed);
+    }
+
+    device->current_rate.store(rate, std::memory_order_relaxed);
+
+    if (rate > device->peak_rate.load(std::memory_order_relaxed)) {
+      device->peak_rate.store(rate, std::memory_order_relaxed);
+    }
+    return;
+  }
+
+  void USBTrafficMonitor::reset()
+  {
+    for (auto& bus_ptr : _buses) {
+      Bus * const bus = bus_ptr.load(std::memory_order_acquire);
+      if (bus != nullptr) {
+        for (auto& device : bus->devices) {
+          resetSlot(device);
+        }
+      }
+    }
+    _events = 0;
+    _dropped = 0;
+    return;
+  }
+
+  USBTrafficMonitor::Counters USBTrafficMonitor::getCounters(uint16_t busnum, uint8_t devnum) const
+  {
+    Counters counters = { 0, 0, 0, 0 };
+    const DeviceSlot * const device = slot(busnum, devnum);
+
+    if (device != nullptr) {
+      counters.transfers = device->transfers.load(std::memory_order_relaxed);
+      counters.bytes = device->bytes.load(std::memory_order_relaxed);
+      counters.peak_rate = device->peak_rate.load(std::memory_order_relaxed);
+      counters.current_rate = device->current_rate.load(std::memory_order_relaxed);
+    }
+
+    return counters;
+  }
+
+  static bool readSysfsNumber(const String& path, unsigned long& value)
+  {
+    std::ifstream stream(path);
+
+    if (!(stream >> value)) {
+      return false;
+    }
+
+    return true;
+  }
+
+  bool USBTrafficMonitor::getCounters(const String& port, Counters& counters) const
+  {
+    if (port.empty() || port.find('/') != String::npos || port[0] == '.') {
+      return false;
+    }
+
+    const String devpath = "/sys/bus/usb/devices/" + port;
+    unsigned long busnum = 0;
+    unsigned long devnum = 0;
+
+    if (!readSysfsNumber(devpath + "/busnum", busnum) ||
+        !readSysfsNumber(devpath + "/devnum", devnum) ||
+        busnum >= bus_max || devnum >= devnum_max) {
+      return false;
+    }
+
+    counters = getCounters((uint16_t)busnum, (uint8_t)devnum);
+    return true;
+  }
+
+  USBTrafficMonitor::Statistics USBTrafficMonitor::getStatistics() const
+  {
+    Statistics statistics;
+    statistics.events = _events.load(std::memory_order_relaxed);
+    statistics.dropped = _dropped.load(std::memory_order_relaxed);
+    return statistics;
+  }
+} /* namespace usbguard */
@@ -0,0 +1,178 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+#include "Typedefs.hpp"
+#include <sys/ioctl.h>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+/*
+ * The binary usbmon interface, see Documentation/usb/usbmon.txt
+ * in the kernel sources. There's no userspace header for it.
+ */
+#define USBMON_IOC_MAGIC 0x92
+#define USBMON_IOCG_STATS _IOR(USBMON_IOC_MAGIC, 3, struct usbguard::USBMonStats)
+#define USBMON_IOCT_RING_SIZE _IO(USBMON_IOC_MAGIC, 4)
+#define USBMON_IOCQ_RING_SIZE _IO(USBMON_IOC_MAGIC, 5)
+#define USBMON_IOCX_MFETCH _IOWR(USBMON_IOC_MAGIC, 7, struct usbguard::USBMonFetch)
+#define USBMON_IOCH_MFLUSH _IO(USBMON_IOC_MAGIC, 8)
+
+namespace usbguard {
+  /*
+   * Header of an event in the usbmon ring buffer. The event data,
+   * if any was captured, follows the header.
+   */
+  struct USBMonHeader
+  {
+    uint64_t id;
+    uint8_t type; /**< 'S'ubmission, 'C'allback, 'E'rror or '@' for a filler */
+    uint8_t xfer_type; /**< 0 isochronous, 1 interrupt, 2 control, 3 bulk */
+    uint8_t epnum; /**< Endpoint number, bit 7 set for the IN direction */
+    uint8_t devnum;
+    uint16_t busnum;
+    char flag_setup;
+    char flag_data;
+    int64_t ts_sec;
+    int32_t ts_usec;
+    int32_t status;
+    uint32_t len_urb; /**< Requested length (submission) or transferred length (callback) */
+    uint32_t len_cap;
+    uint8_t setup[8];
+    int32_t interval;
+    int32_t start_frame;
+    uint32_t xfer_flags;
+    uint32_t ndesc;
+  };
+
+  struct USBMonStats
+  {
+    uint32_t queued;
+    uint32_t dropped;
+  };
+
+  struct USBMonFetch
+  {
+    uint32_t *offvec;
+    uint32_t nfetch;
+    uint32_t nflush;
+  };
+
+  /*
+   * Per-device USB traffic counters collected from the usbmon
+   * event stream of all buses.
+   *
+   * The events are read from the memory mapped usbmon ring by a
+   * dedicated thread, in batches of offsets fetched with a single
+   * ioctl, so no event data is copied. The counters are updated by
+   * that thread only and read without locks by anyone else, e.g. by
+   * the usb-traffic-rate rule condition. A reader may see counters of
+   * one device from slightly different moments.
+   *
+   * Devices are identified by their bus and device number. The
+   * counters of a device number are reset when the host assigns it
+   * to a new device (SET_ADDRESS), so they cover the lifetime of the
+   * connected device.
+   */
+  class DLL_PUBLIC USBTrafficMonitor
+  {
+  public:
+    struct Counters
+    {
+      uint64_t transfers; /**< Completed transfers */
+      uint64_t bytes; /**< Transferred bytes */
+      uint64_t peak_rate; /**< Most completed transfers in one second */
+      uint64_t current_rate; /**< Completed transfers in the current second */
+    };
+
+    struct Statistics
+    {
+      uint64_t events; /**< Processed events */
+      uint64_t dropped; /**< Events dropped by the kernel, the ring was full */
+    };
+
+    static USBTrafficMonitor& instance();
+
+    /*
+     * Open the usbmon device (e.g. /dev/usbmon0 for all buses),
+     * map its ring buffer and start the reader thread.
+     */
+    void start(const String& usbmon_path);
+    void stop();
+    bool running() const;
+
+    /*
+     * Counters of the device, all zero if there was no traffic.
+     */
+    Counters getCounters(uint16_t busnum, uint8_t devnum) const;
+    /*
+     * Counters of the device at the sysfs port (e.g. 1-1.2), found
+     * by its bus and device number. Returns false if they're unknown.
+     */
+    bool getCounters(const String& port, Counters& counters) const;
+    Statistics getStatistics() const;
+
+    /*
+     * Account one usbmon event. Called by the reader thread, only
+     * one thread may call it at a time.
+     */
+    void processEvent(const USBMonHeader& header);
+    void reset();
+
+    ~USBTrafficMonitor();
+
+  private:
+    USBTrafficMonitor();
+    USBTrafficMonitor(const USBTrafficMonitor&) = delete;
+    const USBTrafficMonitor& operator=(const USBTrafficMonitor&) = delete;
+
+    struct DeviceSlot
+    {
+      std::atomic<uint64_t> transfers;
+      std::atomic<uint64_t> bytes;
+      std::atomic<uint64_t> peak_rate;
+      std::atomic<uint64_t> current_rate;
+      std::atomic<int64_t> current_second;
+    };
+
+    static const size_t bus_max = 256;
+    static const size_t devnum_max = 128;
+
+    struct Bus
+    {
+      DeviceSlot devices[devnum_max];
+    };
+
+    DeviceSlot *slot(uint16_t busnum, uint8_t devnum, bool create);
+    const DeviceSlot *slot(uint16_t busnum, uint8_t devnum) const;
+    void resetSlot(DeviceSlot& device);
+    void thread();
+
+    /* Allocated by the reader thread on the first event of the bus */
+    std::atomic<Bus*> _buses[bus_max];
+    std::atomic<uint64_t> _events;
+    std::atomic<uint64_t> _dropped;
+    std::atomic<bool> _running;
+    std::thread _thread;
+    int _fd;
+    int _wakeup_fd;
+    uint8_t *_ring;
+    size_t _ring_size;
+  };
+} /* namespace usbguard */
@@ -0,0 +1,889 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include "VirtualDeviceManager.hpp"
+#include "LoggerPrivate.hpp"
+#include "LatencyStatistics.hpp"
+#include "Common/Utility.hpp"
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_set>
+
+namespace usbguard {
+
+  /*
+   * Read the whole content of the file at path. Returns false if
+   * the file doesn't exist or cannot be read.
+   */
+  static bool readFile(const String& path, String& data)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    char buffer[4096];
+    data.clear();
+
+    for (;;) {
+      const ssize_t read_size = ::read(fd, buffer, sizeof buffer);
+
+      if (read_size < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ::close(fd);
+        return false;
+      }
+      if (read_size == 0) {
+        break;
+      }
+
+      data.append(buffer, read_size);
+    }
+
+    ::close(fd);
+    return true;
+  }
+
+  /*
+   * Read a sysfs attribute, without the trailing newline.
+   */
+  static bool readAttribute(const String& path, String& value)
+  {
+    if (!readFile(path, value)) {
+      return false;
+    }
+    while (!value.empty() && value.back() == '\n') {
+      value.pop_back();
+    }
+    return true;
+  }
+
+  /*
+   * Write an existing sysfs attribute. Returns 0 or an errno value.
+   */
+  static int writeAttribute(const String& path, const String& value)
+  {
+    const int fd = ::open(path.c_str(), O_WRONLY|O_TRUNC|O_CLOEXEC);
+
+    if (fd < 0) {
+      return errno;
+    }
+
+    int error = 0;
+
+    if (::write(fd, value.c_str(), value.size()) != (ssize_t)value.size()) {
+      error = errno != 0 ? errno : EIO;
+    }
+
+    ::close(fd);
+    return error;
+  }
+
+  VirtualDevice::VirtualDevice(VirtualDeviceManager& device_manager, const String& name)
+    : Device(device_manager)
+  {
+    USBGUARD_LOG_DEBUG("Creating a new VirtualDevice instance: {}", name);
+
+    _syspath = device_manager.getSysfsRoot() + "/devices/" + name;
+    setPort(name);
+
+    const String parent_name = VirtualDeviceManager::parentName(name);
+
+    if (parent_name.empty()) {
+      setParentID(Rule::RootID);
+      setParentHash(hashString(device_manager.getSysfsRoot() + "/devices"));
+    }
+    else {
+      setParentID(device_manager.getIDFromName(parent_name));
+    }
+
+    String value;
+
+    if (!readAttribute(_syspath + "/authorized", value)) {
+      throw std::runtime_error("cannot read authorization state");
+    }
+
+    setTarget(!value.empty() && value[0] == '1' ? Rule::Target::Allow : Rule::Target::Block);
+
+    if (readAttribute(_syspath + "/product", value)) {
+      setName(value);
+    }
+    if (readAttribute(_syspath + "/serial", value)) {
+      setSerial(value);
+    }
+
+    String descriptors;
+
+    if (!readFile(_syspath + "/descriptors", descriptors)) {
+      throw std::runtime_error("Cannot load USB descriptors: failed to read the descriptor data");
+    }
+
+    const uint8_t * const descriptor_data = reinterpret_cast<const uint8_t *>(descriptors.data());
+    size_t descriptor_expected_size = 0;
+    {
+      LatencyStatistics::Timer timer(LatencyStatistics::Stage::DescriptorParse);
+      descriptor_expected_size = loadDescriptors(descriptor_data, descriptors.size());
+    }
+
+    if (descriptor_expected_size < sizeof(USBDeviceDescriptor)) {
+      throw std::runtime_error("Descriptor data parsing failed: parser processed less data than the size of a USB device descriptor");
+    }
+
+    if (device_manager.DeviceHashRequired()) {
+      LatencyStatistics::Timer timer(LatencyStatistics::Stage::DeviceHash);
+      updateHash(descriptor_data, descriptor_expected_size);
+    }
+    else {
+      deferHash();
+    }
+    return;
+  }
+
+  const String& VirtualDevice::getSysPath() const
+  {
+    return _syspath;
+  }
+
+  bool VirtualDevice::isController() const
+  {
+    if (getPort().substr(0, 3) != "usb" || getInterfaceTypes().size() != 1) {
+      return false;
+    }
+
+    const USBInterfaceType hub_interface("09:00:*");
+
+    return hub_interface.appliesTo(getInterfaceTypes()[0]);
+  }
+
+  size_t VirtualDevice::getMemoryUsage() const
+  {
+    return Device::getMemoryUsage() + sizeof(VirtualDevice) - sizeof(Device) + stringHeapUsage(_syspath);
+  }
+
+  /*
+   * Manager
+   */
+
+  VirtualDeviceManager::VirtualDeviceManager(DeviceManagerHooks& hooks)
+    : DeviceManager(hooks),
+      _event_stream_fd(-1),
+      _thread(this, &VirtualDeviceManager::thread)
+  {
+    /*
+     * The flags are set by fcntl, the seccomp whitelist of the
+     * daemon allows only eventfd(0, 0).
+     */
+    if ((_wakeup_fd = eventfd(0, 0)) < 0) {
+      throw std::runtime_error("eventfd init error");
+    }
+    if (fcntl(_wakeup_fd, F_SETFD, FD_CLOEXEC) != 0 ||
+        fcntl(_wakeup_fd, F_SETFL, fcntl(_wakeup_fd, F_GETFL) | O_NONBLOCK) != 0) {
+      ::close(_wakeup_fd);
+      throw std::runtime_error("eventfd init error");
+    }
+    return;
+  }
+
+  VirtualDeviceManager::~VirtualDeviceManager()
+  {
+    stop();
+    ::close(_wakeup_fd);
+    return;
+  }
+
+  /*
+   * The synthetic devices get their initial authorization state
+   * from the tree, there's no authorized_default to write.
+   */
+  void VirtualDeviceManager::setDefaultBlockedState(bool state)
+  {
+    (void)state;
+    return;
+  }
+
+  void VirtualDeviceManager::setSysfsRoot(const String& path)
+  {
+    if (_thread.running()) {
+      throw std::runtime_error("DeviceManager thread is running, cannot change the sysfs root");
+    }
+    _root = path;
+    return;
+  }
+
+  void VirtualDeviceManager::setEventStream(const String& path)
+  {
+    if (_thread.running()) {
+      throw std::runtime_error("DeviceManager thread is running, cannot change the event stream");
+    }
+    _event_stream_path = path;
+    return;
+  }
+
+  const String& VirtualDeviceManager::getSysfsRoot() const
+  {
+    return _root;
+  }
+
+  void VirtualDeviceManager::start()
+  {
+    if (_root.empty()) {
+      throw std::runtime_error("The sysfs root of the virtual device manager isn't set");
+    }
+
+    if (!_event_stream_path.empty()) {
+      /*
+       * Opened for writing too, so that the stream doesn't hit EOF
+       * whenever the writer closes it.
+       */
+      _event_stream_fd = ::open(_event_stream_path.c_str(), O_RDWR|O_NONBLOCK|O_CLOEXEC);
+
+      if (_event_stream_fd < 0) {
+        throw std::runtime_error("Cannot open the device event stream " + _event_stream_path + ": " + strerror(errno));
+      }
+
+      struct stat st;
+
+      if (fstat(_event_stream_fd, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+        ::close(_event_stream_fd);
+        _event_stream_fd = -1;
+        throw std::runtime_error("The device event stream has to be a FIFO: " + _event_stream_path);
+      }
+    }
+
+    _thread.start();
+    return;
+  }
+
+  void VirtualDeviceManager::stop()
+  {
+    _thread.stop(/*do_wait=*/false);
+    { /* Wakeup the device manager thread */
+      const uint64_t one = 1;
+      if (write(_wakeup_fd, &one, sizeof one) < 0) {
+        /* The counter is already set */
+      }
+    }
+    _thread.wait();
+
+    if (_event_stream_fd >= 0) {
+      ::close(_event_stream_fd);
+      _event_stream_fd = -1;
+      _event_stream_buffer.clear();
+    }
+    return;
+  }
+
+  void VirtualDeviceManager::scan()
+  {
+    if (!_thread.running()) {
+      enumerateDevices();
+    } else {
+      throw std::runtime_error("DeviceManager thread is running, cannot perform a scan");
+    }
+    return;
+  }
+
+  Pointer<Device> VirtualDeviceManager::allowDevice(uint32_t id)
+  {
+    Pointer<Device> device = applyDevicePolicy(id, Rule::Target::Allow);
+    DeviceAllowed(device);
+    return device;
+  }
+
+  Pointer<Device> VirtualDeviceManager::blockDevice(uint32_t id)
+  {
+    Pointer<Device> device = applyDevicePolicy(id, Rule::Target::Block);
+    DeviceBlocked(device);
+    return device;
+  }
+
+  Pointer<Device> VirtualDeviceManager::rejectDevice(uint32_t id)
+  {
+    Pointer<Device> device = applyDevicePolicy(id, Rule::Target::Reject);
+    DeviceRejected(device);
+    return device;
+  }
+
+  Pointer<Device> VirtualDeviceManager::applyDevicePolicy(uint32_t id, Rule::Target target)
+  {
+    Pointer<VirtualDevice> device = std::static_pointer_cast<VirtualDevice>(getDevice(id));
+    std::unique_lock<std::mutex> device_lock(device->refDeviceMutex());
+    int error = 0;
+    {
+      LatencyStatistics::Timer timer(LatencyStatistics::Stage::SysfsApply);
+
+      switch (target) {
+        case Rule::Target::Allow:
+          error = writeAttribute(device->getSysPath() + "/authorized", "1");
+          break;
+        case Rule::Target::Block:
+          error = writeAttribute(device->getSysPath() + "/authorized", "0");
+          break;
+        case Rule::Target::Reject:
+          error = writeAttribute(device->getSysPath() + "/remove", "1");
+          break;
+        default:
+          throw std::runtime_error("Unknown rule target in applyDevicePolicy");
+      }
+    }
+
+    if (error != 0) {
+      logger->warn("Cannot apply target {} to {}: {}", Rule::targetToString(target),
+                   device->getSysPath(), strerror(error));
+    }
+    else if (target == Rule::Target::Reject) {
+      /* The kernel would remove the device and announce it */
+      injectEvent("remove", device->getPort());
+    }
+
+    DeviceTargetApplied(id, target, error);
+    device->setTarget(target);
+
+    return device;
+  }
+
+  void VirtualDeviceManager::insertDevice(Pointer<Device> device)
+  {
+    DeviceManager::insertDevice(device);
+    std::unique_lock<std::mutex> lock(_names_mutex);
+    _names[device->getPort()] = device->getID();
+    return;
+  }
+
+  uint32_t VirtualDeviceManager::getIDFromName(const String& name) const
+  {
+    std::unique_lock<std::mutex> lock(_names_mutex);
+    auto it = _names.find(name);
+
+    if (it == _names.end()) {
+      throw std::out_of_range("Unknown device name");
+    }
+
+    return it->second;
+  }
+
+  String VirtualDeviceManager::parentName(const String& name)
+  {
+    if (name.compare(0, 3, "usb") == 0) {
+      return String();
+    }
+
+    const size_t dot = name.rfind('.');
+
+    if (dot != String::npos) {
+      return name.substr(0, dot);
+    }
+
+    const size_t dash = name.find('-');
+
+    if (dash == String::npos || dash == 0) {
+      throw std::runtime_error("Invalid virtual device name: " + name);
+    }
+
+    return "usb" + name.substr(0, dash);
+  }
+
+  /*
+   * Root hubs first, then by length: the name of a device
+   * behind a hub is longer than the name of the hub.
+   */
+  void VirtualDeviceManager::sortParentsFirst(StringVector& names)
+  {
+    std::sort(names.begin(), names.end(), [](const String& a, const String& b) {
+      const bool a_root = a.compare(0, 3, "usb") == 0;
+      const bool b_root = b.compare(0, 3, "usb") == 0;
+      if (a_root != b_root) {
+        return a_root;
+      }
+      if (a.size() != b.size()) {
+        return a.size() < b.size();
+      }
+      return a < b;
+    });
+    return;
+  }
+
+  void VirtualDeviceManager::injectEvent(const String& action, const String& name)
+  {
+    Event event;
+
+    if (action == "add") {
+      event.removal = false;
+    }
+    else if (action == "remove") {
+      event.removal = true;
+    }
+    else {
+      throw std::runtime_error("Unknown device event action: " + action);
+    }
+
+    event.name = name;
+    {
+      std::unique_lock<std::mutex> lock(_injected_mutex);
+      _injected.push_back(std::move(event));
+    }
+
+    const uint64_t one = 1;
+    if (write(_wakeup_fd, &one, sizeof one) < 0) {
+      /* The counter is already set */
+    }
+    return;
+  }
+
+  /*
+   * Split the data into lines, appending the complete ones to the
+   * events. An incomplete line is kept in the buffer.
+   */
+  void VirtualDeviceManager::parseEvents(String& buffer, const char *data, size_t size, std::vector<Event>& events)
+  {
+    buffer.append(data, size);
+
+    size_t line_start = 0;
+
+    for (size_t line_end = buffer.find('\n'); line_end != String::npos;
+         line_start = line_end + 1, line_end = buffer.find('\n', line_start)) {
+      const String line = buffer.substr(line_start, line_end - line_start);
+      const size_t space = line.find(' ');
+
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+
+      const String action = line.substr(0, space);
+      const String name = space != String::npos ? line.substr(space + 1) : String();
+
+      if (name.empty() || (action != "add" && action != "remove")) {
+        logger->warn("Ignoring an invalid device event: {}", line);
+        continue;
+      }
+
+      events.push_back(Event { action == "remove", name });
+    }
+
+    buffer.erase(0, line_start);
+    return;
+  }
+
+  /*
+   * Maximum amount of the event stream read in one wakeup of the
+   * device manager thread, so that a fast writer doesn't delay the
+   * stop request.
+   */
+  static const size_t event_stream_budget = 64 * 1024;
+
+  /*
+   * Read the pending data of the event stream. Returns false if
+   * the stream cannot be read anymore.
+   */
+  bool VirtualDeviceManager::readEventStream(std::vector<Event>& events)
+  {
+    char buffer[4096];
+    size_t total_size = 0;
+
+    while (total_size < event_stream_budget) {
+      const ssize_t read_size = ::read(_event_stream_fd, buffer, sizeof buffer);
+
+      if (read_size < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      if (read_size == 0) {
+        return false;
+      }
+
+      parseEvents(_event_stream_buffer, buffer, read_size, events);
+      total_size += read_size;
+    }
+
+    return true;
+  }
+
+  void VirtualDeviceManager::thread()
+  {
+    ThreadStarted();
+
+    try {
+      enumerateDevices();
+    }
+    catch(const std::exception& ex) {
+      logger->error("Cannot enumerate the virtual devices: {}", ex.what());
+    }
+
+    while (!_thread.stopRequested()) {
+      struct pollfd pollfds[2] = {
+        { _wakeup_fd, POLLIN, 0 },
+        { _event_stream_fd, POLLIN, 0 }
+      };
+      const nfds_t pollfd_count = _event_stream_fd >= 0 ? 2 : 1;
+
+      if (poll(pollfds, pollfd_count, 5 * 1000) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        logger->error("Cannot wait for the virtual device events: errno={}", errno);
+        break;
+      }
+
+      std::vector<Event> events;
+
+      if (pollfds[0].revents & POLLIN) {
+        uint64_t value = 0;
+        if (read(_wakeup_fd, &value, sizeof value) < 0) {
+          /* Nothing to do, the wakeup only interrupts poll */
+        }
+        std::unique_lock<std::mutex> lock(_injected_mutex);
+        events.swap(_injected);
+      }
+
+      if (pollfd_count > 1 && pollfds[1].revents != 0) {
+        if (!readEventStream(events)) {
+          logger->error("Cannot read the device event stream {}", _event_stream_path);
+          ::close(_event_stream_fd);
+          _event_stream_fd = -1;
+        }
+      }
+
+      processEvents(events);
+    }
+    return;
+  }
+
+  void VirtualDeviceManager::processEvents(const std::vector<Event>& events)
+  {
+    /* Consecutive removals are processed as one batch */
+    StringVector removed_names;
+
+    for (auto const& event : events) {
+      if (event.removal) {
+        removed_names.push_back(event.name);
+        continue;
+      }
+
+      if (!removed_names.empty()) {
+        processDeviceRemovals(removed_names);
+        removed_names.clear();
+      }
+
+      processDeviceInsertion(event.name);
+    }
+
+    if (!removed_names.empty()) {
+      processDeviceRemovals(removed_names);
+    }
+    return;
+  }
+
+  void VirtualDeviceManager::processDeviceInsertion(const String& name)
+  {
+    LatencyStatistics::Timer insertion_timer(LatencyStatistics::Stage::Insertion);
+
+    try {
+      getIDFromName(name);
+      USBGUARD_LOG_DEBUG("Ignoring a re-announced device: {}", name);
+      return;
+    }
+    catch(const std::out_of_range&) {
+      /* Not known yet */
+    }
+
+    try {
+      Pointer<VirtualDevice> device;
+      {
+        LatencyStatistics::Timer timer(LatencyStatistics::Stage::DeviceCreate);
+        device = makePointer<VirtualDevice>(*this, name);
+      }
+      insertDevice(device);
+      DeviceInserted(device);
+      return;
+    }
+    catch(const std::exception& ex) {
+      logger->error("Exception caught during device insertion processing: {}: {}", name, ex.what());
+    }
+
+    /* Reject the device, see LinuxDeviceManager::processDeviceInsertion */
+    writeAttribute(_root + "/devices/" + name + "/remove", "1");
+    return;
+  }
+
+  void VirtualDeviceManager::processDeviceRemovals(const StringVector& names)
+  {
+    std::vector<uint32_t> ids;
+    ids.reserve(names.size());
+
+    for (auto const& name : names) {
+      try {
+        ids.push_back(getIDFromName(name));
+      }
+      catch(const std::out_of_range&) {
+        /* Already removed with its parent */
+      }
+    }
+
+    if (ids.empty()) {
+      return;
+    }
+
+    const PointerVector<Device> removed_devices = removeDevices(ids);
+    {
+      std::unique_lock<std::mutex> lock(_names_mutex);
+      for (auto const& device : removed_devices) {
+        _names.erase(device->getPort());
+      }
+    }
+
+    if (removed_devices.size() == 1) {
+      DeviceRemoved(removed_devices.front());
+    }
+    else if (!removed_devices.empty()) {
+      DevicesRemoved(removed_devices);
+    }
+    return;
+  }
+
+  void VirtualDeviceManager::enumerateDevices()
+  {
+    const String dir = _root + "/bus/usb/devices";
+    DIR *dirfp = opendir(dir.c_str());
+
+    if (dirfp == nullptr) {
+      throw std::runtime_error("Cannot open " + dir + ": " + strerror(errno));
+    }
+
+    StringVector names;
+
+    for (struct dirent *dent = readdir(dirfp); dent != nullptr; dent = readdir(dirfp)) {
+      /* Skip the interfaces and the dot entries */
+      if (dent->d_name[0] == '.' || strchr(dent->d_name, ':') != nullptr) {
+        continue;
+      }
+      names.emplace_back(dent->d_name);
+    }
+
+    closedir(dirfp);
+
+    sortParentsFirst(names);
+
+    PointerVector<Device> present_devices;
+    present_devices.reserve(names.size());
+
+    for (auto const& name : names) {
+      try {
+        auto device = makePointer<VirtualDevice>(*this, name);
+        insertDevice(device);
+        present_devices.push_back(device);
+      }
+      catch(const std::exception& ex) {
+        logger->error("Exception caught during device presence processing: {}: {}", name, ex.what());
+      }
+    }
+
+    DevicesPresent(present_devices);
+    return;
+  }
+
+  /*
+   * Generator
+   */
+
+  VirtualDeviceManager::Layout::Layout()
+    : buses(1),
+      hub_ports(4),
+      devices(0),
+      vendor_id(0x1209),
+      product_id(0x0001),
+      product_ids(1),
+      interface_types({ USBInterfaceType(0x08, 0x06, 0x50) }),
+      authorized(false),
+      present(true)
+  {
+  }
+
+  static void appendWord(String& data, uint16_t value)
+  {
+    data.push_back(static_cast<char>(value & 0xff));
+    data.push_back(static_cast<char>(value >> 8));
+  }
+
+  /*
+   * Descriptor data as found in the descriptors attribute: the
+   * device descriptor followed by one configuration with the
+   * interfaces, each with one interrupt IN endpoint.
+   */
+  static String generateDescriptors(uint8_t device_class, uint16_t vendor_id, uint16_t product_id,
+                                    const std::vector<USBInterfaceType>& interface_types)
+  {
+    String data;
+
+    data += { 18, USB_DESCRIPTOR_TYPE_DEVICE };
+    appendWord(data, 0x0200); /* bcdUSB */
+    data += { static_cast<char>(device_class), 0, 0, 64 };
+    appendWord(data, vendor_id);
+    appendWord(data, product_id);
+    appendWord(data, 0x0100); /* bcdDevice */
+    data += { 1, 2, 3, 1 }; /* string indexes, bNumConfigurations */
+
+    data += { 9, USB_DESCRIPTOR_TYPE_CONFIGURATION };
+    appendWord(data, static_cast<uint16_t>(9 + interface_types.size() * (9 + 7)));
+    data += { static_cast<char>(interface_types.size()), 1, 0, static_cast<char>(0x80), 50 };
+
+    for (size_t i = 0; i < interface_types.size(); ++i) {
+      const uint32_t type = interface_types[i].packed();
+
+      data += { 9, USB_DESCRIPTOR_TYPE_INTERFACE, static_cast<char>(i), 0, 1,
+                static_cast<char>(type >> 16), static_cast<char>(type >> 8), static_cast<char>(type), 0 };
+      data += { 7, USB_DESCRIPTOR_TYPE_ENDPOINT, static_cast<char>(0x81 + i), 3 };
+      appendWord(data, 8); /* wMaxPacketSize */
+      data.push_back(10); /* bInterval */
+    }
+
+    return data;
+  }
+
+  static void makeDirectory(const String& path)
+  {
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+      throw std::runtime_error("Cannot create " + path + ": " + strerror(errno));
+    }
+  }
+
+  static void writeFile(const String& path, const String& data)
+  {
+    const int fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+      throw std::runtime_error("Cannot create " + path + ": " + strerror(errno));
+    }
+
+    const ssize_t written = ::write(fd, data.data(), data.size());
+    ::close(fd);
+
+    if (written != (ssize_t)data.size()) {
+      throw std::runtime_error("Cannot write " + path);
+    }
+  }
+
+  void VirtualDeviceManager::createTree(const String& root)
+  {
+    for (const char *dir : { "", "/devices", "/bus", "/bus/usb", "/bus/usb/devices" }) {
+      makeDirectory(root + dir);
+    }
+  }
+
+  void VirtualDeviceManager::writeDevice(const String& root, const String& name, const String& descriptors,
+                                         const String& product, const String& serial, bool authorized, bool present)
+  {
+    const String syspath = root + "/devices/" + name;
+
+    makeDirectory(syspath);
+    writeFile(syspath + "/descriptors", descriptors);
+    writeFile(syspath + "/authorized", authorized ? "1\n" : "0\n");
+    writeFile(syspath + "/remove", "");
+    writeFile(syspath + "/product", product + "\n");
+    writeFile(syspath + "/serial", serial + "\n");
+
+    if (present) {
+      const String link = root + "/bus/usb/devices/" + name;
+
+      if (symlink(("../../../devices/" + name).c_str(), link.c_str()) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create " + link + ": " + strerror(errno));
+      }
+    }
+  }
+
+  /* Linux Foundation 2.0 root hub */
+  static const uint16_t hub_vendor_id = 0x1d6b;
+  static const uint16_t hub_product_id = 0x0002;
+
+  StringVector VirtualDeviceManager::generate(const String& root, const Layout& layout)
+  {
+    if (layout.buses == 0 || layout.hub_ports == 0 || layout.hub_ports > 255 || layout.product_ids == 0) {
+      throw std::runtime_error("Invalid virtual sysfs layout");
+    }
+
+    createTree(root);
+
+    const String hub_descriptors = \
+      generateDescriptors(0x09, hub_vendor_id, hub_product_id, { USBInterfaceType(0x09, 0x00, 0x00) });
+    StringVector names;
+    uint32_t device_index = 0;
+
+    for (uint32_t bus = 1; bus <= layout.buses; ++bus) {
+      const uint32_t bus_devices = layout.devices / layout.buses +
+        (bus == layout.buses ? layout.devices % layout.buses : 0);
+      const String bus_name = std::to_string(bus);
+
+      names.push_back("usb" + bus_name);
+      writeDevice(root, names.back(), hub_descriptors, "Virtual Root Hub", "virtual-usb" + bus_name,
+                  layout.authorized, layout.present);
+
+      /* Levels of the tree needed to connect all the devices */
+      uint32_t depth = 1;
+      for (uint64_t capacity = layout.hub_ports; capacity < bus_devices; capacity *= layout.hub_ports) {
+        ++depth;
+      }
+
+      std::unordered_set<String> hubs;
+      std::vector<uint32_t> ports(depth);
+
+      for (uint32_t i = 0; i < bus_devices; ++i, ++device_index) {
+        uint32_t rest = i;
+
+        for (uint32_t level = depth; level-- > 0; ) {
+          ports[level] = rest % layout.hub_ports + 1;
+          rest /= layout.hub_ports;
+        }
+
+        String name;
+
+        for (uint32_t level = 0; level < depth; ++level) {
+          name += (level == 0 ? bus_name + "-" : ".") + std::to_string(ports[level]);
+
+          if (level + 1 < depth && hubs.insert(name).second) {
+            names.push_back(name);
+            writeDevice(root, name, hub_descriptors, "Virtual Hub", "virtual-" + name,
+                        layout.authorized, layout.present);
+          }
+        }
+
+        const uint16_t product_id = static_cast<uint16_t>(layout.product_id + device_index % layout.product_ids);
+        char serial[16];
+        snprintf(serial, sizeof serial, "%08u", device_index);
+
+        names.push_back(name);
+        writeDevice(root, name, generateDescriptors(0x00, layout.vendor_id, product_id, layout.interface_types),
+                    "Virtual Device", serial, layout.authorized, layout.present);
+      }
+    }
+
+    return names;
+  }
+} /* namespace usbguard */
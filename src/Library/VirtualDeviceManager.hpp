@@ -0,0 +1,184 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#pragma once
+
+#include "DeviceManager.hpp"
+#include <Typedefs.hpp>
+#include <Device.hpp>
+#include <Rule.hpp>
+#include <USB.hpp>
+#include "Common/Thread.hpp"
+#include <mutex>
+#include <unordered_map>
+
+namespace usbguard {
+  class VirtualDeviceManager;
+
+  /*
+   * A device read from the synthetic sysfs tree. The attributes
+   * are the same as the ones LinuxDevice reads from sysfs.
+   */
+  class VirtualDevice : public Device
+  {
+  public:
+    VirtualDevice(VirtualDeviceManager& device_manager, const String& name);
+    VirtualDevice(const VirtualDevice& rhs) = delete;
+    const VirtualDevice& operator=(const VirtualDevice& rhs) = delete;
+
+    const String& getSysPath() const;
+    bool isController() const;
+    size_t getMemoryUsage() const override;
+
+  private:
+    String _syspath;
+  };
+
+  /*
+   * Device manager which reads the devices from a synthetic sysfs tree
+   * instead of the one of the system and receives the device events
+   * from a stream instead of udev. It allows to run the whole daemon,
+   * e.g. for benchmarks and load tests, without any USB hardware.
+   *
+   * The tree mirrors the parts of sysfs used by LinuxDeviceManager:
+   *
+   *   <root>/devices/<name>/       descriptors, authorized, remove,
+   *                                product and serial attributes
+   *   <root>/bus/usb/devices/<name> -> ../../../devices/<name>
+   *
+   * The names follow the kernel naming of USB devices: "usbB" is the
+   * root hub of the bus B and "B-P[.P...]" is the device at the port
+   * path P of the bus. The parent of a device is derived from its
+   * name. The devices linked in bus/usb/devices are present when the
+   * device manager starts.
+   *
+   * The event stream is a FIFO with one event per line: "add <name>"
+   * or "remove <name>". Events can also be injected by injectEvent().
+   * Writing "1" to the remove attribute of a device (rejecting it)
+   * generates its "remove" event, as the kernel would.
+   */
+  class DLL_PUBLIC VirtualDeviceManager : public DeviceManager
+  {
+  public:
+    VirtualDeviceManager(DeviceManagerHooks& hooks);
+    ~VirtualDeviceManager();
+
+    void setDefaultBlockedState(bool state);
+    void setSysfsRoot(const String& path);
+    void setEventStream(const String& path);
+    void start();
+    void stop();
+    void scan();
+    Pointer<Device> allowDevice(uint32_t id);
+    Pointer<Device> blockDevice(uint32_t id);
+    Pointer<Device> rejectDevice(uint32_t id);
+    void insertDevice(Pointer<Device> device);
+
+    /*
+     * Queue an event as if it was read from the event stream.
+     * The action is "add" or "remove".
+     */
+    void injectEvent(const String& action, const String& name);
+
+    const String& getSysfsRoot() const;
+    uint32_t getIDFromName(const String& name) const;
+
+    /*
+     * Name of the parent device of the device with the name, or
+     * an empty string for a root hub.
+     */
+    static String parentName(const String& name);
+
+    /*
+     * Sort device names so that every hub is listed before the
+     * devices connected to it.
+     */
+    static void sortParentsFirst(StringVector& names);
+
+    /*
+     * Parameters of a synthetic sysfs tree, see generate().
+     */
+    struct Layout
+    {
+      Layout();
+
+      uint32_t buses; /**< Number of USB buses (root hubs) */
+      uint32_t hub_ports; /**< Number of ports of each hub */
+      uint32_t devices; /**< Number of devices, spread over the buses */
+      uint16_t vendor_id; /**< Vendor ID of the devices */
+      uint16_t product_id; /**< Product ID of the first device */
+      uint32_t product_ids; /**< Number of product IDs used by the devices */
+      std::vector<USBInterfaceType> interface_types; /**< Interfaces of each device */
+      bool authorized; /**< Initial value of the authorized attributes */
+      bool present; /**< Link the devices in bus/usb/devices */
+    };
+
+    /*
+     * Create a synthetic sysfs tree in the directory root. Each bus
+     * gets the same number of devices, the last one the remainder.
+     * The devices are connected to the ports of the root hub of their
+     * bus and, if there are more devices than ports, behind as many
+     * levels of hubs as needed. Returns the names of all the created
+     * devices, including the hubs, with every hub listed before the
+     * devices connected to it.
+     */
+    static StringVector generate(const String& root, const Layout& layout);
+
+    /*
+     * Create the directories of an empty tree in root.
+     */
+    static void createTree(const String& root);
+
+    /*
+     * Create the device with the name in the tree, or overwrite
+     * its attributes. If present is true, the device is linked in
+     * bus/usb/devices.
+     */
+    static void writeDevice(const String& root, const String& name, const String& descriptors,
+                            const String& product, const String& serial, bool authorized, bool present);
+
+  protected:
+    struct Event
+    {
+      bool removal;
+      String name;
+    };
+
+    static void parseEvents(String& buffer, const char *data, size_t size, std::vector<Event>& events);
+    void thread();
+    bool readEventStream(std::vector<Event>& events);
+    void processEvents(const std::vector<Event>& events);
+    void processDeviceInsertion(const String& name);
+    void processDeviceRemovals(const StringVector& names);
+    void enumerateDevices();
+    Pointer<Device> applyDevicePolicy(uint32_t id, Rule::Target target);
+
+  private:
+    String _root;
+    String _event_stream_path;
+    int _event_stream_fd;
+    String _event_stream_buffer; /* incomplete line read from the stream */
+    int _wakeup_fd;
+    std::mutex _injected_mutex;
+    std::vector<Event> _injected;
+    Thread<VirtualDeviceManager> _thread;
+    mutable std::mutex _names_mutex;
+    std::unordered_map<String, uint32_t> _names;
+  };
+
+} /* namespace usbguard */
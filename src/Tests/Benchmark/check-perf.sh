@@ -0,0 +1,169 @@
+#!/bin/sh
+#
+# Copyright (C) 2016 Red Hat, Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Authors: Daniel Kopecek <dkopecek@redhat.com>
+#
+# Usage: check-perf.sh <benchmark-binary-dir>
+#
+# Runs the benchmarks PERF_RUNS times and compares the median time
+# of each benchmark with the baseline. A benchmark regressed if all
+# the runs were slower than the baseline by more than PERF_THRESHOLD
+# percent. With 5 runs, the chance of that happening by noise alone
+# is below 5% (sign test). The results are written as tab separated
+# values to PERF_RESULTS.
+#
+# Environment:
+#   PERF_RUNS             number of runs (default: 5)
+#   PERF_THRESHOLD        allowed slowdown in percent (default: 10)
+#   PERF_BASELINE         baseline file (default: $srcdir/src/Tests/Benchmark/perf-baseline.tsv)
+#   PERF_RESULTS          results file (default: perf-results.tsv)
+#   PERF_UPDATE_BASELINE  if 1, store the medians as the new baseline
+#   PERF_IPC              if 1, measure the IPC round-trips too; this
+#                         requires a running daemon
+#   BENCH_FLAGS           additional options of usbguard-bench
+#
+# Baselines are specific to the machine they were recorded on. If the
+# baseline file doesn't exist, it's created from the results.
+#
+
+BENCHDIR="${1:-.}"
+RUNS="${PERF_RUNS:-5}"
+THRESHOLD="${PERF_THRESHOLD:-10}"
+BASELINE="${PERF_BASELINE:-$srcdir/src/Tests/Benchmark/perf-baseline.tsv}"
+RESULTS="${PERF_RESULTS:-perf-results.tsv}"
+
+SAMPLES="$(mktemp --tmpdir usbguard-check-perf.XXXXXX)"
+OUTPUT="$(mktemp --tmpdir usbguard-check-perf.XXXXXX)"
+trap 'rm -f "$SAMPLES" "$OUTPUT"' EXIT
+
+#
+# Samples are stored as <benchmark> TAB <workload> TAB <ns>
+#
+run=0
+while [ $run -lt $RUNS ]; do
+  echo "Run $((run + 1))/$RUNS"
+
+  if ! srcdir="$srcdir" "$BENCHDIR/usbguard-bench" $BENCH_FLAGS > "$OUTPUT"; then
+    echo "FAILED: usbguard-bench"
+    exit 1
+  fi
+  awk -F '\t' '$3 ~ / ns\/op$/ { sub(/ ns\/op$/, "", $3); print $1 "\t" $2 "\t" $3 }' "$OUTPUT" >> "$SAMPLES"
+
+  if [ "$PERF_IPC" = "1" ]; then
+    for method in listDevices listRules; do
+      if ! "$BENCHDIR/usbguard-ipc-bench" --clients 1 --subscribers 0 --mix "$method" --duration 2 > "$OUTPUT"; then
+        echo "FAILED: usbguard-ipc-bench"
+        exit 1
+      fi
+      awk -F '\t' -v method="$method" '$1 == method {
+        for (i = 2; i <= NF; ++i) {
+          if ($i ~ /^p(50|99) /) {
+            split($i, field, " ")
+            print "IPC " method " " field[1] "\t1 client\t" field[2] * 1000
+          }
+        }
+      }' "$OUTPUT" >> "$SAMPLES"
+    done
+  fi
+
+  run=$((run + 1))
+done
+
+if [ "$PERF_UPDATE_BASELINE" = "1" -o ! -f "$BASELINE" ]; then
+  echo "Storing the baseline in $BASELINE"
+  UPDATE=1
+  BASELINE_IN=/dev/null
+else
+  UPDATE=0
+  BASELINE_IN="$BASELINE"
+fi
+
+awk -F '\t' -v threshold="$THRESHOLD" -v update="$UPDATE" -v baseline_out="$BASELINE" '
+  FILENAME == ARGV[1] {
+    baseline[$1 "\t" $2] = $3
+    next
+  }
+  {
+    key = $1 "\t" $2
+    if (!(key in count)) {
+      order[++keys] = key
+    }
+    samples[key, ++count[key]] = $3 + 0
+  }
+  END {
+    print "benchmark\tworkload\tbaseline_ns\tmedian_ns\tmin_ns\tmax_ns\tchange_pct\tstatus"
+    failed = 0
+
+    for (k = 1; k <= keys; ++k) {
+      key = order[k]
+      n = count[key]
+
+      for (i = 1; i <= n; ++i) {
+        sorted[i] = samples[key, i]
+      }
+      for (i = 2; i <= n; ++i) {
+        value = sorted[i]
+        for (j = i - 1; j >= 1 && sorted[j] > value; --j) {
+          sorted[j + 1] = sorted[j]
+        }
+        sorted[j + 1] = value
+      }
+
+      median = n % 2 ? sorted[(n + 1) / 2] : (sorted[n / 2] + sorted[n / 2 + 1]) / 2
+      min = sorted[1]
+      max = sorted[n]
+
+      if (update) {
+        printf("%s\t%.1f\n", key, median) > baseline_out
+        status = "baseline"
+        base = median
+      }
+      else if (!(key in baseline)) {
+        status = "new"
+        base = median
+      }
+      else {
+        base = baseline[key]
+        if (min > base * (1 + threshold / 100)) {
+          status = "regression"
+          failed = 1
+        }
+        else if (max < base * (1 - threshold / 100)) {
+          status = "improvement"
+        }
+        else {
+          status = "ok"
+        }
+      }
+
+      change = base > 0 ? (median - base) / base * 100 : 0
+      printf("%s\t%.1f\t%.1f\t%.1f\t%.1f\t%+.1f\t%s\n", key, base, median, min, max, change, status)
+    }
+
+    exit failed
+  }
+' "$BASELINE_IN" "$SAMPLES" > "$RESULTS"
+RETVAL=$?
+
+if [ "$UPDATE" = "1" ]; then
+  RETVAL=0
+fi
+
+awk -F '\t' 'NR > 1 && $8 != "ok" && $8 != "baseline" { print toupper($8) ": " $1 " (" $2 "): " $3 " -> " $4 " ns (" $7 "%)" }' "$RESULTS"
+echo "Results written to $RESULTS"
+
+exit $RETVAL
@@ -0,0 +1,634 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+#include <getopt.h>
+#include <dirent.h>
+
+#include "RuleSet.hpp"
+#include "RuleParser.hpp"
+#include "Device.hpp"
+#include "DeviceManager.hpp"
+#include "DeviceManagerHooks.hpp"
+#include "USB.hpp"
+#include "DeviceSnapshot.hpp"
+#include "Hash.hpp"
+#include "LatencyStatistics.hpp"
+#include "Common/CCBQueue.hpp"
+
+using namespace usbguard;
+
+static const char *options_short = "hs:t:";
+
+static const struct ::option options_long[] = {
+  { "help", no_argument, nullptr, 'h' },
+  { "sizes", required_argument, nullptr, 's' },
+  { "time", required_argument, nullptr, 't' },
+  { nullptr, 0, nullptr, 0 }
+};
+
+static void showHelp(std::ostream& stream, const char *usbguard_arg0)
+{
+  stream << " Usage: " << ::basename(usbguard_arg0) << " [OPTIONS] [<descriptor-data-dir>|<device-snapshot>]" << std::endl;
+  stream << std::endl;
+  stream << " Options:" << std::endl;
+  stream << "  -s, --sizes <list>  Comma separated list of rule set sizes (default: 10,100,1000,10000,100000)." << std::endl;
+  stream << "  -t, --time <ms>     Minimal measurement time of each benchmark (default: 200)." << std::endl;
+  stream << "  -h, --help          Show this help." << std::endl;
+  stream << std::endl;
+}
+
+/*
+ * The benchmarks don't talk to a real device manager. These stubs
+ * only allow to create Device instances the same way LinuxDevice
+ * does, i.e. from descriptor data.
+ */
+class BenchDeviceManagerHooks : public DeviceManagerHooks
+{
+public:
+  uint32_t dmHookAssignID()
+  {
+    return ++_id;
+  }
+
+private:
+  uint32_t _id = 0;
+};
+
+class BenchDeviceManager : public DeviceManager
+{
+public:
+  BenchDeviceManager(DeviceManagerHooks& hooks)
+    : DeviceManager(hooks)
+  {
+  }
+
+  void setDefaultBlockedState(bool state) { (void)state; }
+  void start() {}
+  void stop() {}
+  void scan() {}
+  Pointer<Device> allowDevice(uint32_t id) { (void)id; return nullptr; }
+  Pointer<Device> blockDevice(uint32_t id) { (void)id; return nullptr; }
+  Pointer<Device> rejectDevice(uint32_t id) { (void)id; return nullptr; }
+};
+
+/*
+ * Mirrors the construction of LinuxDevice without the udev and sysfs
+ * parts: the descriptor data is parsed, the interface types are loaded
+ * and the device hash is computed.
+ */
+class BenchDevice : public Device
+{
+public:
+  BenchDevice(DeviceManager& manager, const String& descriptor_data, const String& port)
+    : Device(manager)
+  {
+    using namespace std::placeholders;
+
+    setParentID(Rule::RootID);
+    setParentHash(hashString("/sys/devices/bench"));
+    setName("Bench Device");
+    setSerial("0123456789");
+    setPort(port);
+    setTarget(Rule::Target::Block);
+
+    std::istringstream descriptor_stream(descriptor_data);
+    USBDescriptorParser parser;
+
+    auto load_device_descriptor = std::bind(&BenchDevice::loadBenchDeviceDescriptor, this, _1, _2);
+    auto load_configuration_descriptor = std::bind(&BenchDevice::loadConfigurationDescriptor, this, _1, _2);
+    auto load_interface_descriptor = std::bind(&BenchDevice::loadInterfaceDescriptor, this, _1, _2);
+    auto load_endpoint_descriptor = std::bind(&BenchDevice::loadEndpointDescriptor, this, _1, _2);
+
+    parser.setHandler(USB_DESCRIPTOR_TYPE_DEVICE, sizeof (USBDeviceDescriptor),
+                      USBParseDeviceDescriptor, load_device_descriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_CONFIGURATION, sizeof (USBConfigurationDescriptor),
+                      USBParseConfigurationDescriptor, load_configuration_descriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_INTERFACE, sizeof (USBInterfaceDescriptor),
+                      USBParseInterfaceDescriptor, load_interface_descriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof (USBEndpointDescriptor),
+                      USBParseEndpointDescriptor, load_endpoint_descriptor);
+    parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof (USBAudioEndpointDescriptor),
+                      USBParseAudioEndpointDescriptor, load_endpoint_descriptor);
+
+    const size_t descriptor_expected_size = parser.parse(descriptor_stream);
+
+    if (descriptor_expected_size < sizeof(USBDeviceDescriptor)) {
+      throw std::runtime_error("Descriptor data parsing failed");
+    }
+
+    descriptor_stream.clear();
+    descriptor_stream.seekg(0);
+    updateHash(descriptor_stream, descriptor_expected_size);
+  }
+
+  bool isController() const
+  {
+    return false;
+  }
+
+private:
+  void loadBenchDeviceDescriptor(USBDescriptorParser* parser, const USBDescriptor* descriptor)
+  {
+    loadDeviceDescriptor(parser, descriptor);
+
+    const USBDeviceDescriptor* device_descriptor = \
+      reinterpret_cast<const USBDeviceDescriptor*>(descriptor);
+    char vendor_id[5];
+    char product_id[5];
+
+    snprintf(vendor_id, sizeof vendor_id, "%04x", device_descriptor->idVendor);
+    snprintf(product_id, sizeof product_id, "%04x", device_descriptor->idProduct);
+    setDeviceID(USBDeviceID(vendor_id, product_id));
+  }
+};
+
+/*
+ * Average cost of one call of a measured function. The allocations
+ * are counted only if the library was built with
+ * --enable-allocation-stats, see LatencyStatistics.
+ */
+struct Measurement
+{
+  double ns_per_op;
+  double allocations_per_op;
+  double bytes_per_op;
+};
+
+/*
+ * Runs `fn' repeatedly until at least `min_time' elapsed and
+ * returns the average duration and allocations of one call.
+ */
+static Measurement measure(const std::function<void()>& fn, const std::chrono::milliseconds min_time)
+{
+  using clock = std::chrono::steady_clock;
+  size_t iterations = 1;
+
+  while (true) {
+    const uint64_t allocations_start = LatencyStatistics::threadAllocations();
+    const uint64_t bytes_start = LatencyStatistics::threadAllocatedBytes();
+    const auto tp_start = clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      fn();
+    }
+    const auto elapsed = clock::now() - tp_start;
+
+    if (elapsed >= min_time || iterations >= (size_t(1) << 30)) {
+      const auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      return {
+        double(elapsed_ns) / double(iterations),
+        double(LatencyStatistics::threadAllocations() - allocations_start) / double(iterations),
+        double(LatencyStatistics::threadAllocatedBytes() - bytes_start) / double(iterations)
+      };
+    }
+
+    iterations *= 2;
+  }
+}
+
+static void report(const String& name, const String& workload, double ns_per_op)
+{
+  std::cout << name << "\t" << workload << "\t";
+  std::cout << std::fixed;
+  std::cout.precision(1);
+  std::cout << ns_per_op << " ns/op" << std::endl;
+}
+
+static void report(const String& name, const String& workload, const Measurement& measurement)
+{
+  if (!LatencyStatistics::countsAllocations()) {
+    report(name, workload, measurement.ns_per_op);
+    return;
+  }
+
+  std::cout << name << "\t" << workload << "\t";
+  std::cout << std::fixed;
+  std::cout.precision(1);
+  std::cout << measurement.ns_per_op << " ns/op\t";
+  std::cout << measurement.allocations_per_op << " allocs/op\t";
+  std::cout << measurement.bytes_per_op << " B/op" << std::endl;
+}
+
+/*
+ * Passes `items' items from `producers' producer threads to one
+ * consumer thread, which sleeps in dequeueWait() when the queue is
+ * empty or dequeues whole batches, and returns the average time per
+ * item in nanoseconds.
+ */
+static double measureQueue(size_t producers, size_t items, bool batch)
+{
+  typedef CCBQueue<uint64_t> Queue;
+  Queue queue(/*max_memory_MiB=*/1);
+  std::vector<std::thread> threads;
+  uint64_t sum = 0;
+
+  const auto tp_start = std::chrono::steady_clock::now();
+
+  std::thread consumer([&]() {
+    const uint64_t *values[256];
+    size_t received = 0;
+
+    while (received < items) {
+      if (batch) {
+        const Queue::count_type count = queue.dequeue(values, 256);
+        if (count == 0) {
+          std::this_thread::yield();
+          continue;
+        }
+        for (Queue::count_type i = 0; i < count; ++i) {
+          sum += *values[i];
+        }
+        queue.release(values[0], count);
+        received += count;
+      }
+      else {
+        const uint64_t *value = queue.dequeueWait();
+        sum += *value;
+        queue.release(value);
+        ++received;
+      }
+    }
+  });
+
+  for (size_t p = 0; p < producers; ++p) {
+    threads.emplace_back([&queue, producers, items]() {
+      for (size_t i = 0; i < items / producers; ++i) {
+        uint64_t *value = queue.acquireWait();
+        *value = i;
+        while (!queue.enqueue(value)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  consumer.join();
+
+  const auto elapsed = std::chrono::steady_clock::now() - tp_start;
+  const auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+  if (sum == 0) {
+    throw std::runtime_error("CCBQueue benchmark: no items received");
+  }
+  return double(elapsed_ns) / double(items);
+}
+
+static String hexID(uint32_t value)
+{
+  char buffer[5];
+  snprintf(buffer, sizeof buffer, "%04x", value & 0xffff);
+  return buffer;
+}
+
+/*
+ * Generates a synthetic rule. The mix resembles generated policies
+ * with some hand-written rules: device rules using single valued
+ * (Equals) attributes, hash-only rules, and rules using the OneOf and
+ * AllOf set operators.
+ */
+static String syntheticRule(std::mt19937& generator, size_t n)
+{
+  std::uniform_int_distribution<uint32_t> id_distribution(0, 0xffff);
+  const String vid = hexID(id_distribution(generator));
+  const String pid = hexID(id_distribution(generator));
+  std::ostringstream rule;
+
+  switch(n % 10) {
+  case 0:
+  case 1:
+  case 2:
+  case 3:
+    rule << "allow id " << vid << ":" << pid;
+    rule << " serial \"" << n << "\"";
+    rule << " with-interface equals { 03:01:01 03:00:00 }";
+    break;
+  case 4:
+  case 5:
+    rule << "allow hash \"" << vid << pid << n << "\"";
+    break;
+  case 6:
+  case 7:
+    rule << "block id one-of { " << vid << ":" << pid << " " << pid << ":" << vid << " }";
+    break;
+  case 8:
+    rule << "allow id " << vid << ":*";
+    rule << " with-interface all-of { 08:06:50 08:06:62 }";
+    break;
+  case 9:
+    rule << "reject name \"Synthetic " << n << "\" with-interface one-of { e0:*:* ef:*:* }";
+    break;
+  }
+
+  return rule.str();
+}
+
+/*
+ * Load the descriptor samples from the *.bin files of a directory
+ * or from a device snapshot written by usbguard dump-devices.
+ */
+static std::vector<String> loadDescriptorData(const String& data_dir)
+{
+  std::vector<String> data;
+  DIR* dirobj = opendir(data_dir.c_str());
+
+  if (dirobj == nullptr && errno == ENOTDIR) {
+    const DeviceSnapshot snapshot(data_dir);
+    for (size_t i = 0; i < snapshot.count(); ++i) {
+      size_t size = 0;
+      const uint8_t * const descriptor_data = snapshot.descriptorData(i, size);
+      data.push_back(String(reinterpret_cast<const char *>(descriptor_data), size));
+    }
+    if (data.empty()) {
+      throw std::runtime_error("No devices found in " + data_dir);
+    }
+    return data;
+  }
+  if (dirobj == nullptr) {
+    throw std::runtime_error("Cannot open the descriptor data directory " + data_dir);
+  }
+
+  struct dirent *entry = nullptr;
+  std::vector<String> paths;
+
+  while ((entry = readdir(dirobj)) != nullptr) {
+    const String name(entry->d_name);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0) {
+      paths.push_back(data_dir + "/" + name);
+    }
+  }
+
+  closedir(dirobj);
+  std::sort(paths.begin(), paths.end());
+
+  for (const String& path : paths) {
+    std::ifstream stream(path, std::ifstream::binary);
+    std::ostringstream buffer;
+    buffer << stream.rdbuf();
+    data.push_back(buffer.str());
+  }
+
+  if (data.empty()) {
+    throw std::runtime_error("No descriptor data (*.bin) found in " + data_dir);
+  }
+
+  return data;
+}
+
+static std::vector<size_t> parseSizes(const String& value)
+{
+  std::vector<size_t> sizes;
+  std::istringstream stream(value);
+  String token;
+
+  while (std::getline(stream, token, ',')) {
+    sizes.push_back(std::stoul(token));
+  }
+
+  return sizes;
+}
+
+int main(int argc, char **argv)
+{
+  const char *usbguard_arg0 = argv[0];
+  std::vector<size_t> sizes = { 10, 100, 1000, 10000, 100000 };
+  std::chrono::milliseconds min_time(200);
+  int opt = 0;
+
+  while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+    switch(opt) {
+      case 'h':
+        showHelp(std::cout, usbguard_arg0);
+        return EXIT_SUCCESS;
+      case 's':
+        sizes = parseSizes(optarg);
+        break;
+      case 't':
+        min_time = std::chrono::milliseconds(std::stoul(optarg));
+        break;
+      case '?':
+        showHelp(std::cerr, usbguard_arg0);
+      default:
+        return EXIT_FAILURE;
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+
+  String data_dir;
+
+  if (argc == 1) {
+    data_dir = argv[0];
+  }
+  else if (argc == 0) {
+    const char *srcdir = getenv("srcdir");
+    data_dir = String(srcdir ? srcdir : ".") + "/src/Tests/USB/data";
+  }
+  else {
+    showHelp(std::cerr, usbguard_arg0);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const std::vector<String> descriptor_data = loadDescriptorData(data_dir);
+    BenchDeviceManagerHooks hooks;
+    BenchDeviceManager manager(hooks);
+
+    /*
+     * Device construction
+     */
+    size_t device_n = 0;
+    report("Device construction", std::to_string(descriptor_data.size()) + " samples",
+      measure([&]() {
+        BenchDevice device(manager, descriptor_data[device_n++ % descriptor_data.size()], "1-1");
+      }, min_time));
+
+    /*
+     * Descriptor parsing throughput, with the stream parser used by
+     * read-descriptor and with the in place parser used by LinuxDevice.
+     */
+    size_t descriptor_bytes = 0;
+    for (const String& data : descriptor_data) {
+      descriptor_bytes += data.size();
+    }
+    const String descriptor_workload = std::to_string(descriptor_data.size()) + " samples, " + \
+      std::to_string(descriptor_bytes / descriptor_data.size()) + " bytes avg";
+
+    size_t parser_n = 0;
+    report("USBDescriptorParser::parse", descriptor_workload,
+      measure([&]() {
+        const String& data = descriptor_data[parser_n++ % descriptor_data.size()];
+        USBDescriptorParser parser;
+        parser.setHandler(USB_DESCRIPTOR_TYPE_DEVICE, sizeof (USBDeviceDescriptor),
+                          USBParseDeviceDescriptor, nullptr);
+        parser.setHandler(USB_DESCRIPTOR_TYPE_CONFIGURATION, sizeof (USBConfigurationDescriptor),
+                          USBParseConfigurationDescriptor, nullptr);
+        parser.setHandler(USB_DESCRIPTOR_TYPE_INTERFACE, sizeof (USBInterfaceDescriptor),
+                          USBParseInterfaceDescriptor, nullptr);
+        parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof (USBEndpointDescriptor),
+                          USBParseEndpointDescriptor, nullptr);
+        parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof (USBAudioEndpointDescriptor),
+                          USBParseAudioEndpointDescriptor, nullptr);
+        (void)parser.parse(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+      }, min_time));
+
+    /*
+     * Hashing of the descriptor data, as done for the device hash
+     */
+    for (const Hash::Algorithm algorithm : { Hash::Algorithm::SHA256, Hash::Algorithm::SHA512, Hash::Algorithm::BLAKE2b }) {
+      size_t hash_n = 0;
+      report("Hash " + Hash::algorithmToString(algorithm), descriptor_workload,
+        measure([&]() {
+          const String& data = descriptor_data[hash_n++ % descriptor_data.size()];
+          Hash hash(algorithm);
+          hash.update(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+          (void)hash.getBase64();
+        }, min_time));
+    }
+
+    BenchDevice load_device(manager, descriptor_data[0], "1-1");
+    size_t load_n = 0;
+    report("Device::loadDescriptors", descriptor_workload,
+      measure([&]() {
+        const String& data = descriptor_data[load_n++ % descriptor_data.size()];
+        (void)load_device.loadDescriptors(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+      }, min_time));
+
+    /*
+     * Matches of device rules with a hash are cached by the rule set.
+     * The copies without the hash attribute are always evaluated.
+     */
+    std::vector<Pointer<const Rule>> device_rules;
+    std::vector<Pointer<const Rule>> device_rules_unhashed;
+
+    for (size_t i = 0; i < descriptor_data.size(); ++i) {
+      BenchDevice device(manager, descriptor_data[i], "1-" + std::to_string(i + 1));
+      Pointer<Rule> device_rule = device.getDeviceRule(/*include_port=*/true);
+      Pointer<Rule> device_rule_unhashed = makePointer<Rule>(*device_rule);
+      device_rule_unhashed->attributeHash().clear();
+      device_rules.push_back(device_rule);
+      device_rules_unhashed.push_back(device_rule_unhashed);
+    }
+
+    /*
+     * Rule parsing and serialization
+     */
+    std::mt19937 generator(42);
+    std::vector<String> rule_specs;
+
+    for (size_t n = 0; n < 1000; ++n) {
+      rule_specs.push_back(syntheticRule(generator, n));
+    }
+    for (auto const& device_rule : device_rules) {
+      rule_specs.push_back(device_rule->toString());
+    }
+
+    std::vector<Rule> rules;
+    for (const String& rule_spec : rule_specs) {
+      rules.push_back(parseRuleFromString(rule_spec));
+    }
+
+    size_t parse_n = 0;
+    report("parseRuleFromString", std::to_string(rule_specs.size()) + " rules",
+      measure([&]() {
+        (void)parseRuleFromString(rule_specs[parse_n++ % rule_specs.size()]);
+      }, min_time));
+
+    size_t canonical_n = 0;
+    report("parseCanonicalRuleFromString", std::to_string(rule_specs.size()) + " rules",
+      measure([&]() {
+        Rule rule;
+        (void)parseCanonicalRuleFromString(rule_specs[canonical_n++ % rule_specs.size()], rule);
+      }, min_time));
+
+    size_t string_n = 0;
+    report("Rule::toString", std::to_string(rules.size()) + " rules",
+      measure([&]() {
+        (void)rules[string_n++ % rules.size()].toString();
+      }, min_time));
+
+    /*
+     * Rule matching. The device rules are inserted into the middle
+     * of the synthetic rule set, so that both the rules before and
+     * after them are relevant.
+     */
+    for (size_t size : sizes) {
+      RuleSet ruleset(nullptr);
+      std::mt19937 ruleset_generator(42);
+      std::stringstream ruleset_stream;
+
+      for (size_t n = 0; n < size; ++n) {
+        if (n == size / 2) {
+          for (auto const& device_rule : device_rules_unhashed) {
+            Rule rule = *device_rule;
+            rule.setTarget(Rule::Target::Allow);
+            ruleset_stream << rule.toString() << "\n";
+          }
+        }
+        ruleset_stream << syntheticRule(ruleset_generator, n) << "\n";
+      }
+
+      ruleset.load(ruleset_stream);
+
+      size_t match_n = 0;
+      report("getFirstMatchingRule", std::to_string(size) + " rules",
+        measure([&]() {
+          (void)ruleset.getFirstMatchingRule(device_rules_unhashed[match_n++ % device_rules_unhashed.size()]);
+        }, min_time));
+
+      size_t cached_n = 0;
+      report("getFirstMatchingRule (cached)", std::to_string(size) + " rules",
+        measure([&]() {
+          (void)ruleset.getFirstMatchingRule(device_rules[cached_n++ % device_rules.size()]);
+        }, min_time));
+    }
+
+    /*
+     * Inter-thread queue throughput
+     */
+    const size_t queue_items = 1 << 20;
+
+    for (size_t producers : { 1, 2, 4 }) {
+      const String workload = std::to_string(producers) + " producer(s)";
+      report("CCBQueue dequeueWait", workload, measureQueue(producers, queue_items / producers * producers, false));
+      report("CCBQueue batch dequeue", workload, measureQueue(producers, queue_items / producers * producers, true));
+    }
+  }
+  catch(const std::exception& ex) {
+    std::cerr << "ERROR: " << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
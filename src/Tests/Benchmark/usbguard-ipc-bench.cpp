@@ -0,0 +1,487 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <getopt.h>
+
+#include <qb/qbipcc.h>
+
+#include "IPCClient.hpp"
+
+using namespace usbguard;
+
+/*
+ * Load generator for the IPC interface of a running daemon. Worker
+ * clients issue a weighted mix of requests, subscribers receive the
+ * signals caused by them and slow subscribers connect without ever
+ * reading, so that the fan-out of the daemon has to cope with them.
+ */
+static const char *options_short = "hc:m:d:s:S:";
+
+static const struct ::option options_long[] = {
+  { "help", no_argument, nullptr, 'h' },
+  { "clients", required_argument, nullptr, 'c' },
+  { "mix", required_argument, nullptr, 'm' },
+  { "duration", required_argument, nullptr, 'd' },
+  { "subscribers", required_argument, nullptr, 's' },
+  { "slow-subscribers", required_argument, nullptr, 'S' },
+  { nullptr, 0, nullptr, 0 }
+};
+
+static void showHelp(std::ostream& stream, const char *usbguard_arg0)
+{
+  stream << " Usage: " << ::basename(usbguard_arg0) << " [OPTIONS]" << std::endl;
+  stream << std::endl;
+  stream << " Options:" << std::endl;
+  stream << "  -c, --clients <count>           Number of concurrent clients issuing requests (default: 4)." << std::endl;
+  stream << "  -m, --mix <list>                Comma separated <method>=<weight> list of the requests, the methods" << std::endl;
+  stream << "                                  are listDevices, listRules, appendRule and allowDevice" << std::endl;
+  stream << "                                  (default: listDevices=4,listRules=4,appendRule=1,allowDevice=1)." << std::endl;
+  stream << "  -d, --duration <seconds>        Duration of the measurement (default: 10)." << std::endl;
+  stream << "  -s, --subscribers <count>       Number of clients only receiving signals (default: 1)." << std::endl;
+  stream << "  -S, --slow-subscribers <count>  Number of connections which never read their signals (default: 0)." << std::endl;
+  stream << "  -h, --help                      Show this help." << std::endl;
+  stream << std::endl;
+  stream << " The rules appended by the benchmark are removed at the end. allowDevice is issued only" << std::endl;
+  stream << " for devices which are already allowed, so the device policy doesn't change." << std::endl;
+  stream << std::endl;
+}
+
+enum class Method {
+  ListDevices,
+  ListRules,
+  AppendRule,
+  AllowDevice
+};
+
+static const char * const method_names[] = {
+  "listDevices",
+  "listRules",
+  "appendRule",
+  "allowDevice"
+};
+
+static const size_t method_count = sizeof method_names / sizeof method_names[0];
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t elapsedNanoseconds(const Clock::time_point& since)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+/*
+ * Latency samples in nanoseconds. Each thread fills its own
+ * instance; they are merged for the report.
+ */
+class Samples
+{
+public:
+  void add(uint64_t ns)
+  {
+    _values.push_back(ns);
+  }
+
+  void merge(const Samples& rhs)
+  {
+    _values.insert(_values.end(), rhs._values.begin(), rhs._values.end());
+  }
+
+  size_t count() const
+  {
+    return _values.size();
+  }
+
+  /* Nearest-rank percentile; sorts the samples */
+  uint64_t percentile(double p)
+  {
+    if (_values.empty()) {
+      return 0;
+    }
+    std::sort(_values.begin(), _values.end());
+    const size_t rank = static_cast<size_t>(p / 100.0 * (_values.size() - 1) + 0.5);
+    return _values[std::min(rank, _values.size() - 1)];
+  }
+
+private:
+  std::vector<uint64_t> _values;
+};
+
+/*
+ * Broadcast lag is the time from sending the request which caused
+ * a signal to the reception of the signal by a subscriber. Appended
+ * rules carry a unique serial number, so their RuleChanged signals
+ * are matched exactly. DeviceAllowed signals are matched with the
+ * last allowDevice request for the device.
+ */
+class LagTracker
+{
+public:
+  static String ruleKey(const String& rule_spec)
+  {
+    static const String marker("usbguard-ipc-bench-");
+    const size_t pos = rule_spec.find(marker);
+    if (pos == String::npos) {
+      return String();
+    }
+    const size_t end = rule_spec.find('"', pos);
+    return "rule:" + rule_spec.substr(pos, end == String::npos ? String::npos : end - pos);
+  }
+
+  static String deviceKey(uint32_t id)
+  {
+    return "device:" + std::to_string(id);
+  }
+
+  void issued(const String& key)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _issued[key] = Clock::now();
+  }
+
+  void received(const String& key)
+  {
+    const Clock::time_point now = Clock::now();
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto const it = _issued.find(key);
+    if (it == _issued.end()) {
+      return;
+    }
+    _samples.add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - it->second).count());
+  }
+
+  void merge(Samples& samples)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    samples.merge(_samples);
+  }
+
+private:
+  std::mutex _mutex;
+  std::unordered_map<String,Clock::time_point> _issued;
+  Samples _samples;
+};
+
+class Subscriber : public IPCClient
+{
+public:
+  Subscriber(LagTracker& lag)
+    : _lag(lag),
+      _signals(0)
+  {
+    setSubscription({ "RuleChanged", "DeviceAllowed" });
+    connect();
+  }
+
+  void DeviceAllowed(uint32_t id,
+                     const std::map<std::string,std::string>& attributes,
+                     bool rule_match,
+                     uint32_t rule_id) override
+  {
+    (void)attributes;
+    (void)rule_match;
+    (void)rule_id;
+    ++_signals;
+    _lag.received(LagTracker::deviceKey(id));
+  }
+
+  void RuleChanged(uint32_t id,
+                   bool removed,
+                   const std::string& rule_spec,
+                   uint64_t generation) override
+  {
+    (void)id;
+    (void)generation;
+    ++_signals;
+    if (!removed) {
+      _lag.received(LagTracker::ruleKey(rule_spec));
+    }
+  }
+
+  uint64_t signals() const
+  {
+    return _signals;
+  }
+
+private:
+  LagTracker& _lag;
+  std::atomic<uint64_t> _signals;
+};
+
+struct WorkerResult {
+  Samples latency[method_count];
+  std::vector<uint32_t> appended_rules;
+  uint64_t errors = 0;
+};
+
+static std::atomic<uint64_t> G_rule_serial(0);
+
+static void runWorker(const std::vector<Method>& mix, const std::vector<uint32_t>& allowed_devices,
+                      const Clock::time_point& deadline, LagTracker& lag, WorkerResult& result, unsigned seed)
+{
+  IPCClient client(/*connected=*/true);
+  std::mt19937 generator(seed);
+  std::uniform_int_distribution<size_t> mix_distribution(0, mix.size() - 1);
+  std::uniform_int_distribution<size_t> device_distribution(0, allowed_devices.empty() ? 0 : allowed_devices.size() - 1);
+
+  while (Clock::now() < deadline) {
+    const Method method = mix[mix_distribution(generator)];
+    const Clock::time_point started = Clock::now();
+
+    try {
+      switch(method) {
+        case Method::ListDevices:
+          client.listDevices("match");
+          break;
+        case Method::ListRules:
+          client.listRules();
+          break;
+        case Method::AppendRule:
+          {
+            const String rule_spec = "block id ffff:ffff serial \"usbguard-ipc-bench-" +
+              std::to_string(++G_rule_serial) + "\"";
+            lag.issued(LagTracker::ruleKey(rule_spec));
+            result.appended_rules.push_back(client.appendRule(rule_spec, Rule::LastID, 0));
+          }
+          break;
+        case Method::AllowDevice:
+          {
+            const uint32_t id = allowed_devices[device_distribution(generator)];
+            lag.issued(LagTracker::deviceKey(id));
+            client.allowDevice(id, /*permanent=*/false, 0);
+          }
+          break;
+      }
+      result.latency[static_cast<size_t>(method)].add(elapsedNanoseconds(started));
+    }
+    catch(const IPCException&) {
+      ++result.errors;
+    }
+  }
+
+  client.disconnect();
+}
+
+static std::vector<Method> parseMix(const String& value)
+{
+  std::vector<Method> mix;
+  std::istringstream stream(value);
+  String token;
+
+  while (std::getline(stream, token, ',')) {
+    const size_t eq_pos = token.find('=');
+    const String name = token.substr(0, eq_pos);
+    const unsigned long weight = eq_pos == String::npos ? 1 : std::stoul(token.substr(eq_pos + 1));
+    size_t i = 0;
+
+    for (; i < method_count; ++i) {
+      if (name == method_names[i]) {
+        break;
+      }
+    }
+    if (i == method_count) {
+      throw std::runtime_error("Unknown method in the mix: " + name);
+    }
+
+    mix.insert(mix.end(), weight, static_cast<Method>(i));
+  }
+
+  if (mix.empty()) {
+    throw std::runtime_error("The request mix is empty");
+  }
+
+  return mix;
+}
+
+static void reportLatency(const String& name, Samples& samples, double seconds)
+{
+  std::cout << name << "\t" << samples.count() << " ops\t";
+  std::cout << std::fixed;
+  std::cout.precision(1);
+  std::cout << (seconds > 0 ? samples.count() / seconds : 0.0) << " ops/s\t";
+  std::cout << "p50 " << samples.percentile(50) / 1000.0 << " us\t";
+  std::cout << "p99 " << samples.percentile(99) / 1000.0 << " us\t";
+  std::cout << "p999 " << samples.percentile(99.9) / 1000.0 << " us" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  const char *usbguard_arg0 = argv[0];
+  std::vector<Method> mix = parseMix("listDevices=4,listRules=4,appendRule=1,allowDevice=1");
+  size_t clients = 4;
+  size_t subscribers = 1;
+  size_t slow_subscribers = 0;
+  std::chrono::seconds duration(10);
+  int opt = 0;
+
+  try {
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout, usbguard_arg0);
+          return EXIT_SUCCESS;
+        case 'c':
+          clients = std::stoul(optarg);
+          break;
+        case 'm':
+          mix = parseMix(optarg);
+          break;
+        case 'd':
+          duration = std::chrono::seconds(std::stoul(optarg));
+          break;
+        case 's':
+          subscribers = std::stoul(optarg);
+          break;
+        case 'S':
+          slow_subscribers = std::stoul(optarg);
+          break;
+        case '?':
+          showHelp(std::cerr, usbguard_arg0);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    std::vector<uint32_t> allowed_devices;
+    {
+      IPCClient client(/*connected=*/true);
+      for (const Rule& device_rule : client.listDevices("allow")) {
+        allowed_devices.push_back(device_rule.getRuleID());
+      }
+      client.disconnect();
+    }
+
+    if (allowed_devices.empty() &&
+        std::find(mix.begin(), mix.end(), Method::AllowDevice) != mix.end()) {
+      std::cerr << "WARNING: No allowed devices, allowDevice is left out of the mix." << std::endl;
+      mix.erase(std::remove(mix.begin(), mix.end(), Method::AllowDevice), mix.end());
+      if (mix.empty()) {
+        throw std::runtime_error("The request mix is empty");
+      }
+    }
+
+    /*
+     * The slow subscribers are plain libqb connections. Nobody
+     * reads their event queues, so the broadcasts to them pile up
+     * on the daemon side.
+     */
+    std::vector<qb_ipcc_connection_t *> slow_connections;
+    for (size_t i = 0; i < slow_subscribers; ++i) {
+      qb_ipcc_connection_t * const qb_conn = qb_ipcc_connect("usbguard", 1<<20);
+      if (qb_conn == nullptr) {
+        throw std::runtime_error("Cannot connect a slow subscriber");
+      }
+      slow_connections.push_back(qb_conn);
+    }
+
+    LagTracker lag;
+    std::vector<std::unique_ptr<Subscriber>> subscriber_clients;
+    for (size_t i = 0; i < subscribers; ++i) {
+      subscriber_clients.emplace_back(new Subscriber(lag));
+    }
+
+    std::vector<WorkerResult> results(clients);
+    std::vector<std::thread> workers;
+    const Clock::time_point started = Clock::now();
+    const Clock::time_point deadline = started + duration;
+
+    for (size_t i = 0; i < clients; ++i) {
+      workers.emplace_back(runWorker, std::cref(mix), std::cref(allowed_devices),
+                           std::cref(deadline), std::ref(lag), std::ref(results[i]), unsigned(i + 1));
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    const double seconds = elapsedNanoseconds(started) / 1e9;
+
+    /* Give the subscribers a moment to receive the last signals */
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    Samples total;
+    uint64_t errors = 0;
+
+    for (size_t m = 0; m < method_count; ++m) {
+      Samples method_samples;
+      for (WorkerResult& result : results) {
+        method_samples.merge(result.latency[m]);
+      }
+      if (method_samples.count() > 0) {
+        total.merge(method_samples);
+        reportLatency(method_names[m], method_samples, seconds);
+      }
+    }
+    for (const WorkerResult& result : results) {
+      errors += result.errors;
+    }
+
+    reportLatency("total", total, seconds);
+
+    if (errors > 0) {
+      std::cout << "errors\t" << errors << std::endl;
+    }
+
+    if (subscribers > 0) {
+      Samples broadcast_lag;
+      uint64_t signals = 0;
+
+      lag.merge(broadcast_lag);
+      for (const auto& subscriber : subscriber_clients) {
+        signals += subscriber->signals();
+      }
+
+      std::cout << "broadcast\t" << signals << " signals\t";
+      std::cout << "p50 " << broadcast_lag.percentile(50) / 1000.0 << " us\t";
+      std::cout << "p99 " << broadcast_lag.percentile(99) / 1000.0 << " us\t";
+      std::cout << "p999 " << broadcast_lag.percentile(99.9) / 1000.0 << " us" << std::endl;
+    }
+
+    for (auto& subscriber : subscriber_clients) {
+      subscriber->disconnect();
+    }
+    for (qb_ipcc_connection_t * const qb_conn : slow_connections) {
+      qb_ipcc_disconnect(qb_conn);
+    }
+
+    /* Remove the rules appended by the benchmark */
+    IPCClient client(/*connected=*/true);
+    for (const WorkerResult& result : results) {
+      for (const uint32_t id : result.appended_rules) {
+        client.removeRule(id);
+      }
+    }
+    client.disconnect();
+  }
+  catch(const std::exception& ex) {
+    std::cerr << "ERROR: " << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
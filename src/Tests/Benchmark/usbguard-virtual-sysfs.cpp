@@ -0,0 +1,321 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <getopt.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "VirtualDeviceManager.hpp"
+#include "USB.hpp"
+
+using namespace usbguard;
+
+/*
+ * Creates synthetic sysfs trees for the virtual device manager
+ * backend and plays device events into its event stream, so that
+ * the daemon can be load tested without USB hardware.
+ */
+static const char *options_short = "hb:p:i:d:P:aDr:c:k";
+
+static const struct ::option options_long[] = {
+  { "help", no_argument, nullptr, 'h' },
+  { "buses", required_argument, nullptr, 'b' },
+  { "ports", required_argument, nullptr, 'p' },
+  { "interfaces", required_argument, nullptr, 'i' },
+  { "id", required_argument, nullptr, 'd' },
+  { "products", required_argument, nullptr, 'P' },
+  { "authorized", no_argument, nullptr, 'a' },
+  { "detached", no_argument, nullptr, 'D' },
+  { "rate", required_argument, nullptr, 'r' },
+  { "cycles", required_argument, nullptr, 'c' },
+  { "keep", no_argument, nullptr, 'k' },
+  { nullptr, 0, nullptr, 0 }
+};
+
+static void showHelp(std::ostream& stream, const char *usbguard_arg0)
+{
+  stream << " Usage: " << ::basename(usbguard_arg0) << " [OPTIONS] generate <root> <count>" << std::endl;
+  stream << "        " << ::basename(usbguard_arg0) << " [OPTIONS] plug <root> <event-stream>" << std::endl;
+  stream << std::endl;
+  stream << " Options of generate:" << std::endl;
+  stream << "  -b, --buses <count>         Number of USB buses (default: 1)." << std::endl;
+  stream << "  -p, --ports <count>         Number of ports of each hub (default: 4)." << std::endl;
+  stream << "  -i, --interfaces <list>     Comma separated interface types of the devices (default: 08:06:50)." << std::endl;
+  stream << "  -d, --id <vid:pid>          Vendor and first product ID of the devices (default: 1209:0001)." << std::endl;
+  stream << "  -P, --products <count>      Number of product IDs used by the devices (default: 1)." << std::endl;
+  stream << "  -a, --authorized            Create the devices authorized." << std::endl;
+  stream << "  -D, --detached              Don't make the devices present." << std::endl;
+  stream << std::endl;
+  stream << " Options of plug:" << std::endl;
+  stream << "  -r, --rate <events/s>       Maximal event rate, 0 for no limit (default: 0)." << std::endl;
+  stream << "  -c, --cycles <count>        Number of plug and unplug cycles (default: 1)." << std::endl;
+  stream << "  -k, --keep                  Don't unplug the devices at the end of the last cycle." << std::endl;
+  stream << std::endl;
+  stream << "  -h, --help                  Show this help." << std::endl;
+  stream << std::endl;
+}
+
+static std::vector<USBInterfaceType> parseInterfaceTypes(const String& list)
+{
+  std::vector<USBInterfaceType> types;
+  std::istringstream stream(list);
+  String type;
+
+  while (std::getline(stream, type, ',')) {
+    types.emplace_back(type);
+  }
+
+  return types;
+}
+
+static void parseDeviceID(const String& id, VirtualDeviceManager::Layout& layout)
+{
+  const size_t colon = id.find(':');
+
+  if (colon == String::npos) {
+    throw std::runtime_error("Invalid device ID: " + id);
+  }
+
+  layout.vendor_id = static_cast<uint16_t>(std::stoul(id.substr(0, colon), nullptr, 16));
+  layout.product_id = static_cast<uint16_t>(std::stoul(id.substr(colon + 1), nullptr, 16));
+}
+
+static StringVector listDevices(const String& root)
+{
+  const String dir = root + "/devices";
+  DIR *dirfp = opendir(dir.c_str());
+
+  if (dirfp == nullptr) {
+    throw std::runtime_error("Cannot open " + dir + ": " + strerror(errno));
+  }
+
+  StringVector names;
+
+  for (struct dirent *dent = readdir(dirfp); dent != nullptr; dent = readdir(dirfp)) {
+    if (dent->d_name[0] != '.') {
+      names.emplace_back(dent->d_name);
+    }
+  }
+
+  closedir(dirfp);
+  VirtualDeviceManager::sortParentsFirst(names);
+  return names;
+}
+
+/*
+ * Writes the events into the stream, no faster than the rate.
+ */
+class EventWriter
+{
+public:
+  EventWriter(const String& path, uint64_t rate)
+    : _rate(rate),
+      _written(0),
+      _started(std::chrono::steady_clock::now())
+  {
+    _fd = ::open(path.c_str(), O_WRONLY|O_CLOEXEC);
+
+    if (_fd < 0) {
+      throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+    }
+  }
+
+  ~EventWriter()
+  {
+    ::close(_fd);
+  }
+
+  void write(const String& action, const String& name)
+  {
+    if (_rate > 0) {
+      const auto due = _started + std::chrono::microseconds(_written * 1000000 / _rate);
+
+      if (due > std::chrono::steady_clock::now()) {
+        flush();
+        std::this_thread::sleep_until(due);
+      }
+    }
+
+    _buffer += action + " " + name + "\n";
+    ++_written;
+
+    if (_buffer.size() >= 4096) {
+      flush();
+    }
+  }
+
+  void flush()
+  {
+    size_t offset = 0;
+
+    while (offset < _buffer.size()) {
+      const ssize_t size = ::write(_fd, _buffer.data() + offset, _buffer.size() - offset);
+
+      if (size < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(String("Cannot write the event stream: ") + strerror(errno));
+      }
+
+      offset += size;
+    }
+
+    _buffer.clear();
+  }
+
+  uint64_t written() const
+  {
+    return _written;
+  }
+
+  double elapsedSeconds() const
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - _started).count();
+  }
+
+private:
+  int _fd;
+  const uint64_t _rate;
+  uint64_t _written;
+  const std::chrono::steady_clock::time_point _started;
+  String _buffer;
+};
+
+/*
+ * Plug the devices in, parents first, and unplug them by unplugging
+ * the root hubs. The bus/usb/devices links are kept in sync, so that
+ * a restarted daemon finds the devices which are plugged in.
+ */
+static void plug(const String& root, const String& stream_path, uint64_t rate, uint64_t cycles, bool keep)
+{
+  const StringVector names = listDevices(root);
+  EventWriter writer(stream_path, rate);
+
+  for (uint64_t cycle = 0; cycle < cycles; ++cycle) {
+    for (auto const& name : names) {
+      const String link = root + "/bus/usb/devices/" + name;
+
+      if (symlink(("../../../devices/" + name).c_str(), link.c_str()) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create " + link + ": " + strerror(errno));
+      }
+      writer.write("add", name);
+    }
+
+    if (keep && cycle + 1 == cycles) {
+      break;
+    }
+
+    for (auto const& name : names) {
+      if (VirtualDeviceManager::parentName(name).empty()) {
+        writer.write("remove", name);
+      }
+      ::unlink((root + "/bus/usb/devices/" + name).c_str());
+    }
+  }
+
+  writer.flush();
+
+  const double seconds = writer.elapsedSeconds();
+  std::cout << writer.written() << " events in " << seconds << " s ("
+            << (seconds > 0 ? writer.written() / seconds : 0.0) << " events/s)" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  const char *usbguard_arg0 = argv[0];
+  VirtualDeviceManager::Layout layout;
+  uint64_t rate = 0;
+  uint64_t cycles = 1;
+  bool keep = false;
+  int opt = 0;
+
+  try {
+    while ((opt = getopt_long(argc, argv, options_short, options_long, nullptr)) != -1) {
+      switch(opt) {
+        case 'h':
+          showHelp(std::cout, usbguard_arg0);
+          return EXIT_SUCCESS;
+        case 'b':
+          layout.buses = std::stoul(optarg);
+          break;
+        case 'p':
+          layout.hub_ports = std::stoul(optarg);
+          break;
+        case 'i':
+          layout.interface_types = parseInterfaceTypes(optarg);
+          break;
+        case 'd':
+          parseDeviceID(optarg, layout);
+          break;
+        case 'P':
+          layout.product_ids = std::stoul(optarg);
+          break;
+        case 'a':
+          layout.authorized = true;
+          break;
+        case 'D':
+          layout.present = false;
+          break;
+        case 'r':
+          rate = std::stoull(optarg);
+          break;
+        case 'c':
+          cycles = std::stoull(optarg);
+          break;
+        case 'k':
+          keep = true;
+          break;
+        case '?':
+          showHelp(std::cerr, usbguard_arg0);
+        default:
+          return EXIT_FAILURE;
+      }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc == 3 && strcmp(argv[0], "generate") == 0) {
+      layout.devices = std::stoul(argv[2]);
+      const StringVector names = VirtualDeviceManager::generate(argv[1], layout);
+      std::cout << names.size() << " devices created in " << argv[1] << std::endl;
+    }
+    else if (argc == 3 && strcmp(argv[0], "plug") == 0) {
+      plug(argv[1], argv[2], rate, cycles, keep);
+    }
+    else {
+      showHelp(std::cerr, usbguard_arg0);
+      return EXIT_FAILURE;
+    }
+  }
+  catch(const std::exception& ex) {
+    std::cerr << "ERROR: " << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
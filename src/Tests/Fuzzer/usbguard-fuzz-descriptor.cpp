@@ -0,0 +1,234 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
+
+#include "Device.hpp"
+#include "DeviceManager.hpp"
+#include "DeviceManagerHooks.hpp"
+#include "Rule.hpp"
+#include "USB.hpp"
+
+using namespace usbguard;
+
+/*
+ * Fuzzing harness for the USB descriptor parsers. The descriptor data
+ * comes from the devices, so both the USBDescriptorParser and the in
+ * place parser used by LinuxDevice (Device::loadDescriptors) have to
+ * cope with arbitrary input.
+ *
+ * When built with -fsanitize=fuzzer and USBGUARD_FUZZER_LIBFUZZER
+ * defined, libFuzzer provides the main function. Otherwise the inputs
+ * are read from the files given on the command line (or from the *.bin
+ * files of the given directories), which is what AFL and the test
+ * suite run.
+ */
+class FuzzDeviceManagerHooks : public DeviceManagerHooks
+{
+public:
+  uint32_t dmHookAssignID()
+  {
+    return ++_id;
+  }
+
+private:
+  uint32_t _id = 0;
+};
+
+class FuzzDeviceManager : public DeviceManager
+{
+public:
+  FuzzDeviceManager(DeviceManagerHooks& hooks)
+    : DeviceManager(hooks)
+  {
+  }
+
+  void setDefaultBlockedState(bool state) { (void)state; }
+  void start() {}
+  void stop() {}
+  void scan() {}
+  Pointer<Device> allowDevice(uint32_t id) { (void)id; return nullptr; }
+  Pointer<Device> blockDevice(uint32_t id) { (void)id; return nullptr; }
+  Pointer<Device> rejectDevice(uint32_t id) { (void)id; return nullptr; }
+};
+
+/*
+ * Follows the descriptor part of the LinuxDevice construction.
+ */
+class FuzzDevice : public Device
+{
+public:
+  FuzzDevice(DeviceManager& manager, const uint8_t *data, size_t size)
+    : Device(manager)
+  {
+    setParentID(Rule::RootID);
+    setParentHash(hashString("/sys/devices/fuzz"));
+    setName("Fuzz Device");
+    setSerial("0123456789");
+    setPort("1-1");
+    setTarget(Rule::Target::Block);
+
+    const size_t descriptor_expected_size = loadDescriptors(data, size);
+
+    if (descriptor_expected_size > size) {
+      abort();
+    }
+    if (descriptor_expected_size < sizeof(USBDeviceDescriptor)) {
+      throw std::runtime_error("Descriptor data parsing failed");
+    }
+
+    updateHash(data, descriptor_expected_size);
+  }
+
+  bool isController() const
+  {
+    return false;
+  }
+};
+
+static void fuzzDescriptorParser(const uint8_t *data, size_t size)
+{
+  USBDescriptorParser parser;
+
+  parser.setHandler(USB_DESCRIPTOR_TYPE_DEVICE, sizeof(USBDeviceDescriptor),
+                    USBParseDeviceDescriptor, nullptr);
+  parser.setHandler(USB_DESCRIPTOR_TYPE_CONFIGURATION, sizeof(USBConfigurationDescriptor),
+                    USBParseConfigurationDescriptor, nullptr);
+  parser.setHandler(USB_DESCRIPTOR_TYPE_INTERFACE, sizeof(USBInterfaceDescriptor),
+                    USBParseInterfaceDescriptor, nullptr);
+  parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof(USBEndpointDescriptor),
+                    USBParseEndpointDescriptor, nullptr);
+  parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof(USBAudioEndpointDescriptor),
+                    USBParseAudioEndpointDescriptor, nullptr);
+
+  try {
+    if (parser.parse(data, size) > size) {
+      abort();
+    }
+  }
+  catch(const std::exception&) {
+    /* Invalid descriptor data is expected to be rejected */
+  }
+  return;
+}
+
+static void fuzzDevice(const uint8_t *data, size_t size)
+{
+  static FuzzDeviceManagerHooks hooks;
+  static FuzzDeviceManager manager(hooks);
+  String rule_string;
+
+  try {
+    FuzzDevice device(manager, data, size);
+    rule_string = device.getDeviceRule()->toString();
+  }
+  catch(const std::exception&) {
+    return;
+  }
+
+  /*
+   * Whatever the device sends, the generated rule has to be valid
+   * and read back to the same rule.
+   */
+  if (Rule::fromString(rule_string).toString() != rule_string) {
+    abort();
+  }
+  return;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  fuzzDescriptorParser(data, size);
+  fuzzDevice(data, size);
+  return 0;
+}
+
+#if !defined(USBGUARD_FUZZER_LIBFUZZER)
+static void collectInputs(const std::string& path, std::vector<std::string>& inputs)
+{
+  DIR* dirobj = opendir(path.c_str());
+
+  if (dirobj == nullptr) {
+    if (errno != ENOTDIR) {
+      throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+    }
+    inputs.push_back(path);
+    return;
+  }
+
+  struct dirent *entry = nullptr;
+  std::vector<std::string> paths;
+
+  while ((entry = readdir(dirobj)) != nullptr) {
+    const std::string name(entry->d_name);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0) {
+      paths.push_back(path + "/" + name);
+    }
+  }
+
+  closedir(dirobj);
+  std::sort(paths.begin(), paths.end());
+  inputs.insert(inputs.end(), paths.begin(), paths.end());
+  return;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<std::string> inputs;
+
+  try {
+    if (argc > 1) {
+      for (int i = 1; i < argc; ++i) {
+        collectInputs(argv[i], inputs);
+      }
+    }
+    else {
+      const char *srcdir = getenv("srcdir");
+      collectInputs(std::string(srcdir ? srcdir : ".") + "/src/Tests/USB/data", inputs);
+    }
+  }
+  catch(const std::exception& ex) {
+    std::cerr << "ERROR: " << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  for (const std::string& input : inputs) {
+    std::ifstream stream(input, std::ifstream::binary);
+    std::ostringstream buffer;
+
+    if (!stream) {
+      std::cerr << "ERROR: Cannot read " << input << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    buffer << stream.rdbuf();
+    const std::string data = buffer.str();
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+  }
+
+  std::cout << "Processed " << inputs.size() << " inputs" << std::endl;
+  return EXIT_SUCCESS;
+}
+#endif
@@ -49,6 +49,18 @@ done <<EOF
 $(cat $DATADIR/test-rules.good)
 EOF
 
+echo
+echo "Parsing GOOD rules file:"
+echo "########################"
+echo
+$PARSER -f "$DATADIR/test-rules.good"
+if [ $? -ne 0 ]; then
+  echo "============="
+  echo "FAILED: $DATADIR/test-rules.good"
+  echo "^^^^^^^^^^^^^"
+  RETVAL=1
+fi
+
 echo
 echo "Parsing BAD rules:"
 echo "##################"
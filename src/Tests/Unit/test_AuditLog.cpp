@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <AuditLog.hpp>
+#include <Base64.hpp>
+#include <unistd.h>
+#include <stdlib.h>
+
+using namespace usbguard;
+
+TEST_CASE("Audit log", "[AuditLog]") {
+  char path_template[] = "/tmp/usbguard-audit.XXXXXX";
+  const int fd = mkstemp(path_template);
+  REQUIRE(fd >= 0);
+  close(fd);
+  const std::string path = path_template;
+  const std::string hash = base64Encode(std::string(32, '\x5a'));
+
+  SECTION("records are read back") {
+    {
+      AuditLog log(path, 16, 0);
+      log.append(1500, 3, 7, AuditLog::Event::Insert, Rule::Target::Allow, hash, "1-2");
+      log.append(2500, 4, Rule::DefaultID, AuditLog::Event::Present, Rule::Target::Block, hash, "1-2.3");
+    }
+    AuditLog::Reader reader(path);
+    REQUIRE(reader.count() == 2);
+
+    const AuditLog::Record first = reader.record(0);
+    REQUIRE(first.latency_ns == 1500);
+    REQUIRE(first.device_id == 3);
+    REQUIRE(first.rule_id == 7);
+    REQUIRE(first.event == AuditLog::Event::Insert);
+    REQUIRE(first.target == Rule::Target::Allow);
+    REQUIRE(first.hash == std::string(32, '\x5a'));
+    REQUIRE(first.port == "1-2");
+    REQUIRE(first.timestamp_us > 0);
+
+    const AuditLog::Record second = reader.record(1);
+    REQUIRE(second.rule_id == Rule::DefaultID);
+    REQUIRE(second.target == Rule::Target::Block);
+    REQUIRE(second.port == "1-2.3");
+    REQUIRE_THROWS_AS(reader.record(2), std::out_of_range);
+  }
+
+  SECTION("an existing log is continued") {
+    {
+      AuditLog log(path, 16, 0);
+      log.append(1, 1, 1, AuditLog::Event::Insert, Rule::Target::Allow, hash, "1-1");
+    }
+    {
+      AuditLog log(path, 16, 0);
+      log.append(2, 2, 2, AuditLog::Event::Policy, Rule::Target::Reject, hash, "1-2");
+    }
+    AuditLog::Reader reader(path);
+    REQUIRE(reader.count() == 2);
+    REQUIRE(reader.record(1).event == AuditLog::Event::Policy);
+  }
+
+  SECTION("a full log is rotated") {
+    {
+      AuditLog log(path, 2, 1);
+      for (uint32_t id = 1; id <= 3; ++id) {
+        log.append(id, id, id, AuditLog::Event::Insert, Rule::Target::Allow, hash, "1-1");
+      }
+    }
+    AuditLog::Reader rotated(path + ".1");
+    REQUIRE(rotated.count() == 2);
+    REQUIRE(rotated.record(1).device_id == 2);
+
+    AuditLog::Reader current(path);
+    REQUIRE(current.count() == 1);
+    REQUIRE(current.record(0).device_id == 3);
+    unlink((path + ".1").c_str());
+  }
+
+  unlink(path.c_str());
+}
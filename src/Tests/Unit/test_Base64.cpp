@@ -18,6 +18,7 @@
 //
 #include <catch.hpp>
 #include <Base64.cpp>
+#include <random>
 
 using namespace usbguard;
 
@@ -133,5 +134,44 @@ TEST_CASE("Base64", "[Utility]") {
       REQUIRE_THROWS(base64Decode(test_input));
     }
   }
-}
 
+  SECTION("vectorized and scalar codecs agree") {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    for (size_t size = 1; size < 300; ++size) {
+      std::string value(size, 0);
+      for (auto& c : value) {
+        c = static_cast<char>(byte(generator));
+      }
+      const uint8_t * const data = reinterpret_cast<const uint8_t *>(value.c_str());
+
+      std::string expected(base64EncodedSize(size), 0);
+      encodeScalar(data, size, &expected[0]);
+
+      const std::string encoded = base64Encode(value);
+      INFO("Input size: " << size);
+      REQUIRE(encoded == expected);
+      REQUIRE(base64Decode(encoded) == value);
+
+      /* A character outside of the alphabet anywhere in the input */
+      std::string invalid = encoded;
+      invalid[byte(generator) % invalid.size()] = '*';
+      REQUIRE_THROWS(base64Decode(invalid));
+    }
+  }
+
+  SECTION("encoding and decoding with caller provided buffers") {
+    const uint8_t data[32] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef };
+    char encoded[44];
+    uint8_t decoded[32];
+
+    REQUIRE(base64Encode(data, sizeof data, encoded, sizeof encoded) == sizeof encoded);
+    REQUIRE(std::string(encoded, sizeof encoded) == base64Encode(data, sizeof data));
+    REQUIRE_THROWS(base64Encode(data, sizeof data, encoded, sizeof encoded - 1));
+
+    REQUIRE(base64Decode(std::string(encoded, sizeof encoded), decoded, sizeof decoded) == sizeof decoded);
+    REQUIRE(std::equal(data, data + sizeof data, decoded));
+    REQUIRE_THROWS(base64Decode(std::string(encoded, sizeof encoded), decoded, sizeof decoded - 1));
+  }
+}
@@ -0,0 +1,196 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include "Common/CCBQueue.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <poll.h>
+
+struct Item
+{
+  uint32_t producer;
+  uint32_t value;
+};
+
+typedef CCBQueue<Item> Queue;
+
+static void produce(Queue& queue, uint32_t producer, uint32_t count)
+{
+  for (uint32_t value = 0; value < count; ++value) {
+    Item *item = queue.acquireWait();
+    item->producer = producer;
+    item->value = value;
+    while (!queue.enqueue(item)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+TEST_CASE("Concurrent circular buffer queue", "[CCBQueue]") {
+  SECTION("items are passed in order") {
+    Queue queue(1);
+    REQUIRE(queue.capacity() > 0);
+    REQUIRE(queue.dequeue() == nullptr);
+
+    for (uint32_t value = 0; value < 3; ++value) {
+      Item *item = queue.acquire();
+      REQUIRE(item != nullptr);
+      item->value = value;
+      REQUIRE(queue.enqueue(item));
+    }
+    REQUIRE(queue.count() == 3);
+
+    for (uint32_t value = 0; value < 3; ++value) {
+      const Item *item = queue.dequeue();
+      REQUIRE(item != nullptr);
+      REQUIRE(item->value == value);
+      REQUIRE(queue.release(item));
+    }
+    REQUIRE(queue.count() == 0);
+  }
+
+  SECTION("slots are enqueued and released in order") {
+    Queue queue(1);
+    Item *first = queue.acquire();
+    Item *second = queue.acquire();
+    REQUIRE_FALSE(queue.enqueue(second));
+    REQUIRE(queue.enqueue(first));
+    REQUIRE(queue.enqueue(second));
+
+    const Item *first_read = queue.dequeue();
+    const Item *second_read = queue.dequeue();
+    REQUIRE_FALSE(queue.release(second_read));
+    REQUIRE(queue.release(first_read));
+    REQUIRE(queue.release(second_read));
+  }
+
+  SECTION("batches wrap around the end of the buffer") {
+    Queue queue(1);
+    const Queue::count_type capacity = queue.capacity();
+    std::vector<Item*> slots(capacity);
+    std::vector<const Item*> items(capacity);
+
+    for (size_t round = 0; round < 4; ++round) {
+      const Queue::count_type acquired = queue.acquire(slots.data(), capacity / 3 * 2);
+      REQUIRE(acquired == capacity / 3 * 2);
+      REQUIRE(queue.acquire(slots.data() + acquired, capacity) == capacity - acquired);
+      REQUIRE(queue.acquire() == nullptr);
+
+      for (Queue::count_type i = 0; i < capacity; ++i) {
+        slots[i]->value = i;
+      }
+      REQUIRE(queue.enqueue(slots[0], capacity));
+      REQUIRE(queue.count() == capacity);
+
+      REQUIRE(queue.dequeue(items.data(), capacity) == capacity);
+      Queue::count_type in_order = 0;
+      for (Queue::count_type i = 0; i < capacity; ++i) {
+        in_order += (items[i]->value == i ? 1 : 0);
+      }
+      REQUIRE(in_order == capacity);
+      REQUIRE(queue.release(items[0], capacity));
+      /* Move the beginning of the buffer */
+      Item *item = queue.acquire();
+      REQUIRE(queue.enqueue(item));
+      REQUIRE(queue.release(queue.dequeue()));
+    }
+  }
+
+  SECTION("waits time out and end when the queue is closed") {
+    Queue queue(1);
+    REQUIRE(queue.dequeueWait(0) == nullptr);
+    REQUIRE(queue.dequeueWait(10) == nullptr);
+
+    const Item *waited = reinterpret_cast<const Item*>(&queue);
+    std::thread consumer([&queue, &waited]() {
+      waited = queue.dequeueWait();
+    });
+    queue.close();
+    consumer.join();
+    REQUIRE(waited == nullptr);
+    REQUIRE(queue.closed());
+
+    Item *item = queue.acquire();
+    REQUIRE(queue.enqueue(item));
+    REQUIRE(queue.dequeueWait() == item);
+    REQUIRE(queue.release(item));
+    queue.open();
+    REQUIRE_FALSE(queue.closed());
+  }
+
+  SECTION("the eventfd is signaled when the queue becomes non-empty") {
+    Queue queue(1, /*event_fd=*/true);
+    struct pollfd pfd = { queue.eventFD(), POLLIN, 0 };
+    REQUIRE(pfd.fd >= 0);
+    REQUIRE(poll(&pfd, 1, 0) == 0);
+
+    Item *item = queue.acquire();
+    REQUIRE(queue.enqueue(item));
+    REQUIRE(poll(&pfd, 1, 0) == 1);
+
+    queue.clearEvent();
+    REQUIRE(poll(&pfd, 1, 0) == 0);
+    REQUIRE(queue.release(queue.dequeue()));
+  }
+
+  SECTION("multiple producers and consumers") {
+    Queue queue(1);
+    const uint32_t producer_count = 4;
+    const uint32_t consumer_count = 3;
+    const uint32_t item_count = 20000;
+    std::vector<std::vector<uint32_t>> received(producer_count, std::vector<uint32_t>(item_count, 0));
+    std::vector<std::thread> producers;
+    std::vector<std::thread> consumers;
+    std::atomic<uint64_t> total(0);
+
+    for (uint32_t c = 0; c < consumer_count; ++c) {
+      consumers.emplace_back([&]() {
+        const Item *item = nullptr;
+        while ((item = queue.dequeueWait()) != nullptr) {
+          ++received[item->producer][item->value];
+          ++total;
+          while (!queue.release(item)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (uint32_t p = 0; p < producer_count; ++p) {
+      producers.emplace_back(produce, std::ref(queue), p, item_count);
+    }
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    queue.close();
+    for (auto& consumer : consumers) {
+      consumer.join();
+    }
+
+    REQUIRE(total == producer_count * item_count);
+    REQUIRE(queue.count() == 0);
+    size_t received_once = 0;
+    for (uint32_t p = 0; p < producer_count; ++p) {
+      for (uint32_t value = 0; value < item_count; ++value) {
+        received_once += (received[p][value] == 1 ? 1 : 0);
+      }
+    }
+    REQUIRE(received_once == producer_count * item_count);
+  }
+}
@@ -0,0 +1,73 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <DescriptorCache.hpp>
+
+using namespace usbguard;
+
+static const uint8_t descriptor_data[] = {
+  /* Device */
+  0x12, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40, 0x34, 0x12,
+  0x78, 0x56, 0x00, 0x01, 0x01, 0x02, 0x03, 0x01,
+  /* Configuration */
+  0x09, 0x02, 0x19, 0x00, 0x01, 0x01, 0x00, 0x80, 0x32,
+  /* Interface */
+  0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01, 0x00,
+  /* Endpoint */
+  0x07, 0x05, 0x81, 0x03, 0x08, 0x00, 0x0a
+};
+
+TEST_CASE("Descriptor cache", "[DescriptorCache]") {
+  DescriptorCache& cache = DescriptorCache::instance();
+  const size_t initial_size = cache.size();
+
+  auto entry = cache.load(descriptor_data, sizeof descriptor_data);
+
+  REQUIRE(entry->data.size() == sizeof descriptor_data);
+  REQUIRE(entry->device_id.getVendorID() == "1234");
+  REQUIRE(entry->device_id.getProductID() == "5678");
+  REQUIRE(entry->interface_types.size() == 1);
+  REQUIRE(entry->interface_types[0].typeString() == "03:01:01");
+  REQUIRE(cache.size() == initial_size + 1);
+
+  SECTION("identical data is shared") {
+    const std::vector<uint8_t> copy(descriptor_data, descriptor_data + sizeof descriptor_data);
+    REQUIRE(cache.load(copy.data(), copy.size()) == entry);
+    REQUIRE(cache.restore(entry->data, std::vector<USBInterfaceType>()) == entry);
+    REQUIRE(cache.size() == initial_size + 1);
+  }
+
+  SECTION("different data isn't shared") {
+    std::vector<uint8_t> other(descriptor_data, descriptor_data + sizeof descriptor_data);
+    other[10] = 0x79;
+    auto other_entry = cache.load(other.data(), other.size());
+    REQUIRE(other_entry != entry);
+    REQUIRE(other_entry->device_id.getProductID() == "5679");
+    REQUIRE(cache.size() == initial_size + 2);
+  }
+
+  SECTION("unused entries are dropped") {
+    entry.reset();
+    REQUIRE(cache.size() == initial_size);
+  }
+
+  SECTION("invalid data") {
+    REQUIRE_THROWS(cache.load(descriptor_data + 1, sizeof descriptor_data - 1));
+  }
+}
@@ -0,0 +1,96 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <DeviceCheckpoint.hpp>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+using namespace usbguard;
+
+TEST_CASE("Device checkpoint", "[DeviceCheckpoint]") {
+  char dir_template[] = "/tmp/usbguard-checkpoint.XXXXXX";
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string dir = dir_template;
+  const std::string path = dir + "/devices.checkpoint";
+  const std::string syspath = dir + "/1-2";
+
+  REQUIRE(mkdir(syspath.c_str(), 0700) == 0);
+  {
+    std::ofstream descriptors(syspath + "/descriptors", std::ios::binary);
+    descriptors << std::string(18, '\x12');
+  }
+
+  DeviceCheckpoint::Entry entry;
+  entry.identity = DeviceCheckpoint::getIdentity(syspath, 189);
+  entry.hash = "hash-value";
+  entry.descriptors = std::string(18, '\x12');
+  entry.interface_types.emplace_back("08:06:50");
+  entry.interface_types.emplace_back("03:01:01");
+
+  SECTION("the identity is taken from the descriptors file") {
+    REQUIRE(entry.identity.syspath == syspath);
+    REQUIRE(entry.identity.devnum == 189);
+    REQUIRE(entry.identity.descriptors_size == 18);
+    REQUIRE(DeviceCheckpoint::getIdentity(syspath, 189) == entry.identity);
+    REQUIRE_FALSE(DeviceCheckpoint::getIdentity(syspath, 190) == entry.identity);
+    REQUIRE_THROWS(DeviceCheckpoint::getIdentity(dir + "/1-3", 189));
+  }
+
+  SECTION("entries are read back") {
+    DeviceCheckpoint::save(path, "context", { entry });
+    std::vector<DeviceCheckpoint::Entry> entries;
+    REQUIRE(DeviceCheckpoint::load(path, "context", entries));
+    REQUIRE(entries.size() == 1);
+    REQUIRE(entries[0].identity == entry.identity);
+    REQUIRE(entries[0].hash == entry.hash);
+    REQUIRE(entries[0].descriptors == entry.descriptors);
+    REQUIRE(entries[0].interface_types.size() == 2);
+    REQUIRE(entries[0].interface_types[0] == USBInterfaceType(0x08, 0x06, 0x50));
+    REQUIRE(entries[0].interface_types[1] == USBInterfaceType(0x03, 0x01, 0x01));
+  }
+
+  SECTION("a checkpoint from a different context is ignored") {
+    DeviceCheckpoint::save(path, "context", { entry });
+    std::vector<DeviceCheckpoint::Entry> entries;
+    REQUIRE_FALSE(DeviceCheckpoint::load(path, "other context", entries));
+    REQUIRE(entries.empty());
+  }
+
+  SECTION("missing and invalid checkpoints are ignored") {
+    std::vector<DeviceCheckpoint::Entry> entries;
+    REQUIRE_FALSE(DeviceCheckpoint::load(path, "context", entries));
+    DeviceCheckpoint::save(path, "context", { entry });
+    {
+      std::ifstream stream(path, std::ios::binary);
+      const std::string data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+      std::ofstream truncated(path, std::ios::binary|std::ios::trunc);
+      truncated << data.substr(0, data.size() - 4);
+    }
+    REQUIRE_FALSE(DeviceCheckpoint::load(path, "context", entries));
+    REQUIRE(entries.empty());
+  }
+
+  unlink(path.c_str());
+  unlink((syspath + "/descriptors").c_str());
+  rmdir(syspath.c_str());
+  rmdir(dir.c_str());
+}
@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <DeviceEventRecording.hpp>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+
+using namespace usbguard;
+
+TEST_CASE("Device event recording", "[DeviceEventRecording]") {
+  char path_template[] = "/tmp/usbguard-events.XXXXXX";
+  const int fd = mkstemp(path_template);
+  REQUIRE(fd >= 0);
+  close(fd);
+  const String path(path_template);
+
+  DeviceEventRecording::Event present;
+  present.time_ns = 10;
+  present.action = "present";
+  present.name = "usb1";
+  present.authorized = "1";
+  present.descriptors = String("\x12\x01\x00\x02\x09\x00\x00\x40", 8);
+
+  DeviceEventRecording::Event add = present;
+  add.time_ns = 2000;
+  add.action = "add";
+  add.name = "1-1";
+  add.product = "Hub";
+  add.serial = "0001";
+  add.authorized = "0";
+
+  DeviceEventRecording::Event remove;
+  remove.time_ns = 3000;
+  remove.action = "remove";
+  remove.name = "1-1";
+
+  {
+    DeviceEventRecording::Writer writer(path);
+    writer.append(present);
+    writer.append(add);
+    writer.append(remove);
+    REQUIRE(writer.count() == 3);
+  }
+
+  SECTION("read the events back") {
+    DeviceEventRecording::Reader reader(path);
+    DeviceEventRecording::Event event;
+
+    REQUIRE(reader.startTime() > 0);
+    REQUIRE(reader.next(event));
+    REQUIRE(event.action == "present");
+    REQUIRE(event.descriptors == present.descriptors);
+    REQUIRE(reader.next(event));
+    REQUIRE(event.time_ns == 2000);
+    REQUIRE(event.name == "1-1");
+    REQUIRE(event.product == "Hub");
+    REQUIRE(event.serial == "0001");
+    REQUIRE(event.authorized == "0");
+    REQUIRE(event.descriptors == present.descriptors);
+    REQUIRE(reader.next(event));
+    REQUIRE(event.action == "remove");
+    REQUIRE(event.descriptors.empty());
+    REQUIRE_FALSE(reader.next(event));
+  }
+
+  SECTION("store identical descriptor data once") {
+    std::ifstream stream(path, std::ios::binary);
+    const String content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    const size_t first = content.find(present.descriptors);
+    REQUIRE(first != String::npos);
+    REQUIRE(content.find(present.descriptors, first + 1) == String::npos);
+  }
+
+  SECTION("stop at an incomplete record") {
+    REQUIRE(truncate(path.c_str(), 24 + 4 + 10) == 0);
+    DeviceEventRecording::Reader reader(path);
+    DeviceEventRecording::Event event;
+    REQUIRE_FALSE(reader.next(event));
+  }
+
+  SECTION("reject other files") {
+    std::ofstream(path, std::ios::trunc) << "not a recording";
+    REQUIRE_THROWS(DeviceEventRecording::Reader(path));
+  }
+
+  unlink(path.c_str());
+}
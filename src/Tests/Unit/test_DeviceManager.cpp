@@ -0,0 +1,488 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <DeviceManager.hpp>
+#include <DeviceManagerHooks.hpp>
+#include <Device.hpp>
+#include <Rule.hpp>
+
+using namespace usbguard;
+
+namespace
+{
+  class TestDeviceManagerHooks : public DeviceManagerHooks
+  {
+  public:
+    uint32_t dmHookAssignID()
+    {
+      return ++_id;
+    }
+  private:
+    uint32_t _id = 0;
+  };
+
+  class TestDevice : public Device
+  {
+  public:
+    TestDevice(DeviceManager& manager, const String& vendor_id, const String& product_id,
+               const String& serial, const String& port)
+      : Device(manager)
+    {
+      setName("test");
+      setDeviceID(USBDeviceID(vendor_id, product_id));
+      setSerial(serial);
+      setPort(port);
+      setParentHash("parent");
+      refMutableInterfaceTypes().push_back(USBInterfaceType(8, 6, 80));
+      setTarget(Rule::Target::Block);
+    }
+
+    bool isController() const
+    {
+      return false;
+    }
+  };
+
+  class TestDeviceManager : public DeviceManager
+  {
+  public:
+    TestDeviceManager(DeviceManagerHooks& hooks)
+      : DeviceManager(hooks)
+    {
+    }
+
+    void setDefaultBlockedState(bool state) { (void)state; }
+    void start() {}
+    void stop() {}
+    void scan() {}
+    Pointer<Device> allowDevice(uint32_t id) { return getDevice(id); }
+    Pointer<Device> blockDevice(uint32_t id) { return getDevice(id); }
+    Pointer<Device> rejectDevice(uint32_t id) { return getDevice(id); }
+  };
+
+  std::vector<uint32_t> queryIDs(DeviceManager& manager, const String& query)
+  {
+    std::vector<uint32_t> ids;
+    for (auto const& device : manager.getDeviceList(Rule::fromString(query))) {
+      ids.push_back(device->getID());
+    }
+    return ids;
+  }
+}
+
+TEST_CASE("Device list queries", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+
+  auto first = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1");
+  auto second = makePointer<TestDevice>(manager, "1234", "5678", "0002", "1-2");
+  auto third = makePointer<TestDevice>(manager, "abcd", "0001", "0001", "2-1");
+
+  manager.insertDevice(first);
+  manager.insertDevice(second);
+  manager.insertDevice(third);
+
+  SECTION("match devices by attribute values") {
+    REQUIRE(queryIDs(manager, "match") == std::vector<uint32_t>({ 1, 2, 3 }));
+    REQUIRE(queryIDs(manager, "match id 1234:5678") == std::vector<uint32_t>({ 1, 2 }));
+    REQUIRE(queryIDs(manager, "match serial \"0001\"") == std::vector<uint32_t>({ 1, 3 }));
+    REQUIRE(queryIDs(manager, "match id 1234:5678 via-port \"1-2\"") == std::vector<uint32_t>({ 2 }));
+    REQUIRE(queryIDs(manager, "match id 1111:2222").empty());
+    REQUIRE(queryIDs(manager, "match with-interface 08:06:*") == std::vector<uint32_t>({ 1, 2, 3 }));
+  }
+
+  SECTION("filter devices by target") {
+    first->setTarget(Rule::Target::Allow);
+    REQUIRE(queryIDs(manager, "allow id 1234:5678") == std::vector<uint32_t>({ 1 }));
+    REQUIRE(queryIDs(manager, "block id 1234:5678") == std::vector<uint32_t>({ 2 }));
+  }
+
+  SECTION("reflect device removal") {
+    REQUIRE(manager.removeDevice(2) == second);
+    REQUIRE(queryIDs(manager, "match id 1234:5678") == std::vector<uint32_t>({ 1 }));
+    REQUIRE(queryIDs(manager, "match serial \"0002\"").empty());
+  }
+}
+
+TEST_CASE("Batched target application", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+
+  auto first = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1");
+  auto second = makePointer<TestDevice>(manager, "1234", "5678", "0002", "1-2");
+
+  manager.insertDevice(first);
+  manager.insertDevice(second);
+
+  const auto results = manager.applyDeviceTargets({
+    { 2, Rule::Target::Allow },
+    { 99, Rule::Target::Block },
+    { 1, Rule::Target::Reject }
+  });
+
+  REQUIRE(results.size() == 3);
+  REQUIRE(results[0].id == 2);
+  REQUIRE(results[0].device == second);
+  REQUIRE(results[0].error.empty());
+  REQUIRE(results[1].id == 99);
+  REQUIRE(results[1].device == nullptr);
+  REQUIRE_FALSE(results[1].error.empty());
+  REQUIRE(results[2].id == 1);
+  REQUIRE(results[2].target == Rule::Target::Reject);
+  REQUIRE(results[2].device == first);
+}
+
+TEST_CASE("Device registry", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+  PointerVector<Device> devices;
+
+  for (unsigned int i = 0; i < 40; ++i) {
+    auto device = makePointer<TestDevice>(manager, "1234", "5678", std::to_string(i), "1-1");
+    manager.insertDevice(device);
+    devices.push_back(device);
+  }
+
+  SECTION("look up devices by id") {
+    REQUIRE(manager.getDevice(1) == devices[0]);
+    REQUIRE(manager.getDevice(40) == devices[39]);
+    REQUIRE_THROWS_AS(manager.getDevice(41), std::out_of_range);
+  }
+
+  SECTION("list devices ordered by id after removals and reinserts") {
+    REQUIRE(manager.removeDevice(17) == devices[16]);
+    REQUIRE(manager.removeDevice(33) == devices[32]);
+    REQUIRE_THROWS(manager.removeDevice(17));
+    REQUIRE_THROWS_AS(manager.getDevice(17), std::out_of_range);
+
+    auto device = makePointer<TestDevice>(manager, "1234", "5678", "new", "1-1");
+    manager.insertDevice(device);
+    REQUIRE(device->getID() == 41);
+    REQUIRE(manager.getDevice(41) == device);
+
+    const auto list = manager.getDeviceList();
+    REQUIRE(list.size() == 39);
+    for (size_t i = 1; i < list.size(); ++i) {
+      REQUIRE(list[i - 1]->getID() < list[i]->getID());
+    }
+  }
+
+  SECTION("visit devices without copying") {
+    size_t count = 0;
+    uint64_t id_sum = 0;
+    manager.forEachDevice([&](const Pointer<Device>& device) {
+      ++count;
+      id_sum += device->getID();
+    });
+    REQUIRE(count == 40);
+    REQUIRE(id_sum == 40 * 41 / 2);
+  }
+}
+
+TEST_CASE("Cached device rules", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+
+  auto device = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1");
+  manager.insertDevice(device);
+
+  const auto cached = device->getCachedDeviceRule();
+  REQUIRE(cached == device->getCachedDeviceRule());
+  REQUIRE(cached->getViaPort() == "1-1");
+  REQUIRE(device->getCachedDeviceRule(false, true) != cached);
+  REQUIRE(device->getCachedDeviceRule(false, true)->attributeViaPort().empty());
+
+  SECTION("mutable copies don't touch the cached rule") {
+    auto copy = device->getDeviceRule();
+    REQUIRE(copy.get() != cached.get());
+    copy->setTarget(Rule::Target::Allow);
+    REQUIRE(device->getCachedDeviceRule()->getTarget() == Rule::Target::Block);
+  }
+
+  SECTION("device state changes invalidate the cached rule") {
+    device->setTarget(Rule::Target::Allow);
+    const auto updated = device->getCachedDeviceRule();
+    REQUIRE(updated != cached);
+    REQUIRE(updated->getTarget() == Rule::Target::Allow);
+    REQUIRE(cached->getTarget() == Rule::Target::Block);
+
+    device->setSerial("0002");
+    REQUIRE(device->getCachedDeviceRule()->getSerial() == "0002");
+  }
+
+  SECTION("two variants stay cached") {
+    const auto without_port = device->getCachedDeviceRule(false, true);
+    REQUIRE(device->getCachedDeviceRule() == cached);
+    REQUIRE(device->getCachedDeviceRule(false, true) == without_port);
+    REQUIRE(device->getCachedDeviceRule(true, false) != cached);
+    REQUIRE(device->getCachedDeviceRule(true, false)->attributeParentHash().empty());
+    REQUIRE(device->getCachedDeviceRule(true, false)->getViaPort() == "1-1");
+  }
+
+  SECTION("the memory usage includes the cached rules") {
+    const size_t usage = device->getMemoryUsage();
+    REQUIRE(usage >= sizeof(Device) + cached->getMemoryUsage());
+    device->setTarget(Rule::Target::Allow);
+    REQUIRE(device->getMemoryUsage() < usage);
+  }
+}
+
+TEST_CASE("Device ID from the device descriptor", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+  TestDevice device(manager, "ffff", "ffff", "0001", "1-1");
+
+  const uint8_t descriptor_data[] = {
+    /* Device: idVendor=0x1d6b, idProduct=0x0002 */
+    0x12, 0x01, 0x00, 0x02, 0x09, 0x00, 0x01, 0x40, 0x6b, 0x1d,
+    0x02, 0x00, 0x10, 0x04, 0x03, 0x02, 0x01, 0x01
+  };
+
+  SECTION("loaded descriptors") {
+    REQUIRE(device.loadDescriptors(descriptor_data, sizeof descriptor_data) == sizeof descriptor_data);
+    REQUIRE(device.getDeviceID().getVendorID() == "1d6b");
+    REQUIRE(device.getDeviceID().getProductID() == "0002");
+  }
+
+  SECTION("restored descriptors") {
+    device.restoreDescriptors(String(reinterpret_cast<const char *>(descriptor_data), sizeof descriptor_data),
+                              std::vector<USBInterfaceType>(), "hash");
+    REQUIRE(device.getDeviceID().getVendorID() == "1d6b");
+    REQUIRE(device.getDeviceID().getProductID() == "0002");
+  }
+}
+
+TEST_CASE("Deferred device hash", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+  TestDevice device(manager, "1234", "5678", "0001", "1-1");
+  TestDevice reference(manager, "1234", "5678", "0001", "1-1");
+
+  const uint8_t descriptor_data[] = {
+    0x12, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40, 0x34, 0x12,
+    0x78, 0x56, 0x00, 0x01, 0x01, 0x02, 0x03, 0x01
+  };
+
+  REQUIRE(hooks.dmHookDeviceHashRequired());
+
+  reference.loadDescriptors(descriptor_data, sizeof descriptor_data);
+  reference.updateHash(descriptor_data, sizeof descriptor_data);
+  device.loadDescriptors(descriptor_data, sizeof descriptor_data);
+  device.deferHash();
+  REQUIRE(device.isHashDeferred());
+
+  SECTION("rules without the hash don't compute it") {
+    const auto device_rule = device.getCachedDeviceRule(true, false, false);
+    REQUIRE(device_rule->attributeHash().empty());
+    REQUIRE(device.isHashDeferred());
+  }
+
+  SECTION("the hash is computed on first access") {
+    REQUIRE(device.getCachedDeviceRule()->getHash() == reference.getHash());
+    REQUIRE_FALSE(device.isHashDeferred());
+    REQUIRE(device.getHash() == reference.getHash());
+  }
+}
+
+TEST_CASE("Queries on devices with a deferred hash", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+  auto device = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1");
+
+  const uint8_t descriptor_data[] = {
+    0x12, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40, 0x34, 0x12,
+    0x78, 0x56, 0x00, 0x01, 0x01, 0x02, 0x03, 0x01
+  };
+
+  device->loadDescriptors(descriptor_data, sizeof descriptor_data);
+  device->deferHash();
+  manager.insertDevice(device);
+  REQUIRE(device->isHashDeferred());
+
+  REQUIRE(queryIDs(manager, "match id 1234:5678") == std::vector<uint32_t>({ device->getID() }));
+  REQUIRE(queryIDs(manager, "match hash \"" + device->getHash() + "\"") == std::vector<uint32_t>({ device->getID() }));
+}
+
+TEST_CASE("Parent hash resolution", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+  auto parent = makePointer<TestDevice>(manager, "1d6b", "0002", "", "usb1");
+  auto child = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1");
+
+  const uint8_t descriptor_data[] = {
+    0x12, 0x01, 0x00, 0x02, 0x09, 0x00, 0x01, 0x40, 0x6b, 0x1d,
+    0x02, 0x00, 0x10, 0x04, 0x03, 0x02, 0x01, 0x01
+  };
+
+  parent->updateHash(descriptor_data, sizeof descriptor_data);
+  manager.insertDevice(parent);
+
+  child->setParentHash(String());
+  child->setParentID(parent->getID());
+  manager.insertDevice(child);
+
+  REQUIRE(child->getCachedDeviceRule()->getParentHash() == parent->getHash());
+
+  SECTION("the parent isn't looked up") {
+    manager.removeDevice(parent->getID());
+    REQUIRE(child->getCachedDeviceRule(false)->getParentHash() == parent->getHash());
+  }
+
+  SECTION("a re-hashed parent updates its children") {
+    parent->updateHash(descriptor_data, sizeof descriptor_data - 1);
+    REQUIRE(child->getCachedDeviceRule()->getParentHash() == parent->getHash());
+  }
+}
+
+TEST_CASE("Device topology subtrees", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+
+  auto subtreeIDs = [&manager](uint32_t id) {
+    std::vector<uint32_t> ids;
+    for (auto const& device : manager.getDeviceSubtree(id)) {
+      ids.push_back(device->getID());
+    }
+    return ids;
+  };
+
+  /* 1 <- 2 <- (3, 4 <- 5), 6 */
+  auto root_hub = makePointer<TestDevice>(manager, "1d6b", "0002", "", "usb1");
+  auto hub = makePointer<TestDevice>(manager, "05e3", "0608", "", "1-1");
+  auto first = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1.1");
+  auto inner_hub = makePointer<TestDevice>(manager, "05e3", "0608", "", "1-1.2");
+  auto second = makePointer<TestDevice>(manager, "1234", "5678", "0002", "1-1.2.1");
+  auto other_root_hub = makePointer<TestDevice>(manager, "1d6b", "0003", "", "usb2");
+
+  manager.insertDevice(root_hub);
+  hub->setParentID(root_hub->getID());
+  manager.insertDevice(hub);
+  first->setParentID(hub->getID());
+  manager.insertDevice(first);
+  inner_hub->setParentID(hub->getID());
+  manager.insertDevice(inner_hub);
+  second->setParentID(inner_hub->getID());
+  manager.insertDevice(second);
+  manager.insertDevice(other_root_hub);
+
+  SECTION("parents are listed before their children") {
+    REQUIRE(subtreeIDs(2) == std::vector<uint32_t>({ 2, 3, 4, 5 }));
+    REQUIRE(subtreeIDs(4) == std::vector<uint32_t>({ 4, 5 }));
+    REQUIRE(subtreeIDs(5) == std::vector<uint32_t>({ 5 }));
+    REQUIRE(subtreeIDs(Rule::RootID) == std::vector<uint32_t>({ 1, 2, 3, 4, 5, 6 }));
+    REQUIRE_THROWS(manager.getDeviceSubtree(42));
+  }
+
+  SECTION("queries are applied to the subtree") {
+    std::vector<uint32_t> ids;
+    for (auto const& device : manager.getDeviceSubtree(2, Rule::fromString("match id 1234:5678"))) {
+      ids.push_back(device->getID());
+    }
+    REQUIRE(ids == std::vector<uint32_t>({ 3, 5 }));
+  }
+
+  SECTION("removed devices leave the tree") {
+    manager.removeDevice(3);
+    REQUIRE(subtreeIDs(2) == std::vector<uint32_t>({ 2, 4, 5 }));
+    /* The children of a removed hub are still reachable from the root */
+    manager.removeDevice(4);
+    REQUIRE(subtreeIDs(Rule::RootID) == std::vector<uint32_t>({ 1, 2, 5, 6 }));
+    manager.removeDevice(5);
+    REQUIRE(subtreeIDs(Rule::RootID) == std::vector<uint32_t>({ 1, 2, 6 }));
+  }
+}
+
+TEST_CASE("Batched device removal", "[DeviceManager]") {
+  TestDeviceManagerHooks hooks;
+  TestDeviceManager manager(hooks);
+
+  /* 1 <- 2 <- (3, 4 <- 5), 6 */
+  auto root_hub = makePointer<TestDevice>(manager, "1d6b", "0002", "", "usb1");
+  auto hub = makePointer<TestDevice>(manager, "05e3", "0608", "", "1-1");
+  auto first = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1.1");
+  auto inner_hub = makePointer<TestDevice>(manager, "05e3", "0608", "", "1-1.2");
+  auto second = makePointer<TestDevice>(manager, "1234", "5678", "0002", "1-1.2.1");
+  auto other_root_hub = makePointer<TestDevice>(manager, "1d6b", "0003", "", "usb2");
+
+  manager.insertDevice(root_hub);
+  hub->setParentID(root_hub->getID());
+  manager.insertDevice(hub);
+  first->setParentID(hub->getID());
+  manager.insertDevice(first);
+  inner_hub->setParentID(hub->getID());
+  manager.insertDevice(inner_hub);
+  second->setParentID(inner_hub->getID());
+  manager.insertDevice(second);
+  manager.insertDevice(other_root_hub);
+
+  auto removedIDs = [&manager](const std::vector<uint32_t>& ids) {
+    std::vector<uint32_t> removed_ids;
+    for (auto const& device : manager.removeDevices(ids)) {
+      removed_ids.push_back(device->getID());
+    }
+    return removed_ids;
+  };
+
+  SECTION("children are removed before their parents") {
+    REQUIRE(removedIDs({ 3, 5, 2, 4 }) == std::vector<uint32_t>({ 5, 3, 4, 2 }));
+    REQUIRE(manager.getDeviceList().size() == 2);
+  }
+
+  SECTION("a hub is removed with the devices behind it") {
+    REQUIRE(removedIDs({ 2 }) == std::vector<uint32_t>({ 5, 3, 4, 2 }));
+    REQUIRE(manager.getDeviceSubtree(Rule::RootID).size() == 2);
+  }
+
+  SECTION("unknown devices are ignored") {
+    REQUIRE(removedIDs({ 42, 6 }) == std::vector<uint32_t>({ 6 }));
+    REQUIRE(removedIDs({ 6 }).empty());
+  }
+}
+
+TEST_CASE("Batched device hooks", "[DeviceManager]") {
+  class RecordingHooks : public TestDeviceManagerHooks
+  {
+  public:
+    void dmHookDevicePresent(Pointer<Device> device)
+    {
+      present.push_back(device->getID());
+    }
+    void dmHookDeviceRemoved(Pointer<Device> device)
+    {
+      removed.push_back(device->getID());
+    }
+    std::vector<uint32_t> present;
+    std::vector<uint32_t> removed;
+  };
+
+  RecordingHooks hooks;
+  TestDeviceManager manager(hooks);
+  auto first = makePointer<TestDevice>(manager, "1234", "5678", "0001", "1-1");
+  auto second = makePointer<TestDevice>(manager, "1234", "5678", "0002", "1-2");
+
+  manager.insertDevice(first);
+  manager.insertDevice(second);
+
+  SECTION("the default hooks forward every device of a batch") {
+    manager.DevicesPresent({ first, second });
+    REQUIRE(hooks.present == std::vector<uint32_t>({ 1, 2 }));
+    manager.DevicesRemoved(manager.removeDevices({ 2, 1 }));
+    REQUIRE(hooks.removed == std::vector<uint32_t>({ 1, 2 }));
+  }
+}
@@ -0,0 +1,99 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <DeviceMirror.hpp>
+#include <USB.hpp>
+
+using namespace usbguard;
+
+static Rule makeDeviceRule(uint32_t id, Rule::Target target, const String& vendor_id)
+{
+  Rule rule;
+  rule.setRuleID(id);
+  rule.setTarget(target);
+  rule.attributeDeviceID().append(USBDeviceID(vendor_id, "0001"));
+  return rule;
+}
+
+static Rule makeQuery(Rule::Target target)
+{
+  Rule rule;
+  rule.setTarget(target);
+  return rule;
+}
+
+TEST_CASE("Device mirror", "[DeviceMirror]") {
+  DeviceMirror mirror;
+
+  REQUIRE_FALSE(mirror.isValid());
+  mirror.reset(10, {
+    makeDeviceRule(1, Rule::Target::Allow, "1111"),
+    makeDeviceRule(2, Rule::Target::Block, "2222"),
+    makeDeviceRule(3, Rule::Target::Allow, "2222")
+  });
+  REQUIRE(mirror.isValid());
+  REQUIRE(mirror.generation() == 10);
+
+  SECTION("queries select by the target and the attributes") {
+    REQUIRE(mirror.query(makeQuery(Rule::Target::Match)).size() == 3);
+    REQUIRE(mirror.query(makeQuery(Rule::Target::Allow)).size() == 2);
+
+    Rule query = makeQuery(Rule::Target::Block);
+    query.attributeDeviceID().append(USBDeviceID("2222", "0001"));
+    const std::vector<Rule> devices = mirror.query(query);
+
+    REQUIRE(devices.size() == 1);
+    REQUIRE(devices[0].getRuleID() == 2);
+    REQUIRE_THROWS(mirror.query(makeQuery(Rule::Target::Reject)));
+  }
+
+  SECTION("complete changes are applied") {
+    Interface::StateChanges changes { 12, true, { }, { } };
+    changes.devices.push_back({ 1, true, Rule() });
+    changes.devices.push_back({ 2, false, makeDeviceRule(2, Rule::Target::Allow, "2222") });
+    changes.devices.push_back({ 4, false, makeDeviceRule(4, Rule::Target::Block, "4444") });
+
+    REQUIRE(mirror.apply(changes));
+    REQUIRE(mirror.generation() == 12);
+    REQUIRE(mirror.size() == 3);
+    REQUIRE(mirror.query(makeQuery(Rule::Target::Allow)).size() == 2);
+    REQUIRE(mirror.query(makeQuery(Rule::Target::Block))[0].getRuleID() == 4);
+  }
+
+  SECTION("incomplete changes leave the mirror unchanged") {
+    const Interface::StateChanges changes { 20, false, { }, { } };
+
+    REQUIRE_FALSE(mirror.apply(changes));
+    REQUIRE(mirror.generation() == 10);
+    REQUIRE(mirror.size() == 3);
+  }
+
+  SECTION("the stale mark and invalidation") {
+    REQUIRE_FALSE(mirror.isStale());
+    mirror.markStale();
+    REQUIRE(mirror.isStale());
+    mirror.clearStale();
+    REQUIRE_FALSE(mirror.isStale());
+
+    mirror.invalidate();
+    REQUIRE_FALSE(mirror.isValid());
+    REQUIRE(mirror.size() == 0);
+    REQUIRE_FALSE(mirror.apply({ 11, true, { }, { } }));
+  }
+}
@@ -0,0 +1,92 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <DeviceSnapshot.hpp>
+#include <cstring>
+
+using namespace usbguard;
+
+TEST_CASE("Device snapshot", "[DeviceSnapshot]") {
+  std::vector<DeviceSnapshot::Entry> entries(2);
+
+  entries[0].id = 1;
+  entries[0].parent_id = Rule::RootID;
+  entries[0].target = Rule::Target::Allow;
+  entries[0].vendor_id = "1d6b";
+  entries[0].product_id = "0002";
+  entries[0].name = "xHCI Host Controller";
+  entries[0].serial = "0000:00:14.0";
+  entries[0].port = "usb1";
+  entries[0].hash = "hash1";
+  entries[0].parent_hash = "parent1";
+  entries[0].descriptors = std::string("\x12\x01\x00\x02", 4);
+
+  entries[1].id = 7;
+  entries[1].parent_id = 1;
+  entries[1].target = Rule::Target::Block;
+  entries[1].vendor_id = "046d";
+  entries[1].product_id = "c31c";
+  entries[1].port = "1-2";
+  entries[1].hash = "hash7";
+
+  const std::string data = DeviceSnapshot::encode(entries);
+
+  SECTION("read the entries back") {
+    REQUIRE(DeviceSnapshot::isSnapshot(data.data(), data.size()));
+
+    const DeviceSnapshot snapshot(data.data(), data.size());
+    REQUIRE(snapshot.version() == DeviceSnapshot::Version);
+    REQUIRE(snapshot.count() == 2);
+
+    const DeviceSnapshot::Entry first = snapshot.entry(0);
+    REQUIRE(first.id == 1);
+    REQUIRE(first.parent_id == Rule::RootID);
+    REQUIRE(first.target == Rule::Target::Allow);
+    REQUIRE(first.name == "xHCI Host Controller");
+    REQUIRE(first.serial == "0000:00:14.0");
+    REQUIRE(first.parent_hash == "parent1");
+    REQUIRE(first.descriptors == entries[0].descriptors);
+
+    const DeviceSnapshot::Entry second = snapshot.entry(1);
+    REQUIRE(second.id == 7);
+    REQUIRE(second.parent_id == 1);
+    REQUIRE(second.target == Rule::Target::Block);
+    REQUIRE(second.vendor_id == "046d");
+    REQUIRE(second.product_id == "c31c");
+    REQUIRE(second.serial.empty());
+    REQUIRE(second.descriptors.empty());
+
+    size_t size = 0;
+    const uint8_t *descriptor_data = snapshot.descriptorData(0, size);
+    REQUIRE(size == 4);
+    REQUIRE(std::memcmp(descriptor_data, entries[0].descriptors.data(), size) == 0);
+
+    REQUIRE_THROWS_AS(snapshot.entry(2), std::out_of_range);
+  }
+
+  SECTION("reject invalid data") {
+    REQUIRE_THROWS(DeviceSnapshot(data.data(), data.size() - 1));
+    REQUIRE_THROWS(DeviceSnapshot(data.data(), 16));
+
+    std::string invalid_magic = data;
+    invalid_magic[0] = 'X';
+    REQUIRE_FALSE(DeviceSnapshot::isSnapshot(invalid_magic.data(), invalid_magic.size()));
+    REQUIRE_THROWS(DeviceSnapshot(invalid_magic.data(), invalid_magic.size()));
+  }
+}
@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <EvaluationClock.hpp>
+#include <thread>
+
+using namespace usbguard;
+
+TEST_CASE("Evaluation clock", "[EvaluationClock]") {
+  SECTION("the time is fixed within a scope") {
+    const EvaluationClock::Scope scope;
+    const auto first = EvaluationClock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE(EvaluationClock::now() == first);
+
+    {
+      const EvaluationClock::Scope nested;
+      REQUIRE(EvaluationClock::now() == first);
+    }
+    REQUIRE(EvaluationClock::now() == first);
+  }
+
+  SECTION("the time advances outside of a scope") {
+    const auto first = EvaluationClock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(EvaluationClock::now() > first);
+  }
+
+  SECTION("the scope is per thread") {
+    const EvaluationClock::Scope scope;
+    const auto first = EvaluationClock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EvaluationClock::TimePoint other;
+    std::thread thread([&other]() {
+      other = EvaluationClock::now();
+    });
+    thread.join();
+    REQUIRE(other > first);
+  }
+
+  SECTION("the coarse clock has the epoch of the steady clock") {
+    const auto coarse = EvaluationClock::coarseNow();
+    const auto precise = std::chrono::steady_clock::now();
+    const auto difference = precise > coarse ? precise - coarse : coarse - precise;
+    REQUIRE(difference < std::chrono::seconds(1));
+  }
+}
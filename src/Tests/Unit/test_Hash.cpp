@@ -0,0 +1,86 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <Hash.hpp>
+
+using namespace usbguard;
+
+TEST_CASE("Hash", "[Utility]") {
+  SECTION("SHA-256 is the default algorithm") {
+    Hash hash;
+    REQUIRE(hash.getAlgorithm() == Hash::Algorithm::SHA256);
+    hash.update(String("abc"));
+    REQUIRE(hash.getBase64() == "ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=");
+  }
+
+  SECTION("reset starts a new computation") {
+    Hash hash(Hash::Algorithm::SHA256);
+    hash.update(String("something else"));
+    hash.getBase64();
+    hash.reset();
+    hash.update(String("abc"));
+    REQUIRE(hash.getBase64() == "ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=");
+  }
+
+  SECTION("keyed SHA-256 is HMAC") {
+    Hash hash(Hash::Algorithm::SHA256, "Jefe");
+    hash.update(String("what do ya want for nothing?"));
+    REQUIRE(hash.getBase64() == "W9zBRr9gdU5qBCQmCJV1x1oAPwidJzmDnexYuWTsOEM=");
+    hash.reset();
+    hash.update(String("what do ya want for nothing?"));
+    REQUIRE(hash.getBase64() == "W9zBRr9gdU5qBCQmCJV1x1oAPwidJzmDnexYuWTsOEM=");
+  }
+
+  SECTION("BLAKE2b with and without a key") {
+    Hash hash(Hash::Algorithm::BLAKE2b);
+    hash.update(String("abc"));
+    REQUIRE(hash.getBase64() == "vd2BPGNCOXIxce8/7phXm5SWTjuxyz5CcmLIwGjVIxk=");
+
+    Hash keyed_hash(Hash::Algorithm::BLAKE2b, "key");
+    keyed_hash.update(String("abc"));
+    REQUIRE(keyed_hash.getBase64() == "AzBTHQlzVaP3LoDVXBJFzPefFwRDHG44h5ODIEQsI8A=");
+    keyed_hash.reset();
+    keyed_hash.update(String("abc"));
+    REQUIRE(keyed_hash.getBase64() == "AzBTHQlzVaP3LoDVXBJFzPefFwRDHG44h5ODIEQsI8A=");
+
+    REQUIRE_THROWS(Hash(Hash::Algorithm::BLAKE2b, String(65, 'k')));
+  }
+
+  SECTION("binary hash values") {
+    Hash hash(Hash::Algorithm::SHA256);
+    uint8_t value[Hash::max_size];
+    hash.update(String("abc"));
+    REQUIRE(hash.getBinary(value, sizeof value) == 32);
+    REQUIRE(value[0] == 0xba);
+    REQUIRE(value[31] == 0xad);
+
+    Hash sha512(Hash::Algorithm::SHA512);
+    sha512.update(String("abc"));
+    REQUIRE(sha512.getBinary(value, sizeof value) == 64);
+
+    Hash small(Hash::Algorithm::SHA256);
+    REQUIRE_THROWS(small.getBinary(value, 16));
+  }
+
+  SECTION("algorithm names") {
+    REQUIRE(Hash::algorithmFromString("blake2b") == Hash::Algorithm::BLAKE2b);
+    REQUIRE(Hash::algorithmToString(Hash::Algorithm::SHA512) == "sha512");
+    REQUIRE_THROWS(Hash::algorithmFromString("md5"));
+  }
+}
@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <IPCPrivate.hpp>
+
+using namespace usbguard;
+
+TEST_CASE("IPC wire format", "[IPC]") {
+  const json message = {
+    { "_m", "listDevices" },
+    { "_i", 18446744073709551615ULL },
+    { "query", "match" },
+    { "negative", { -1, -32, -33, -128, -129, -32768, -32769, -2147483648LL, -2147483649LL } },
+    { "unsigned", { 0, 127, 128, 255, 256, 65535, 65536, 4294967295ULL, 4294967296ULL } },
+    { "float", 0.5 },
+    { "flags", { true, false, nullptr } },
+    { "long_string", std::string(70000, 'x') },
+    { "attributes", { { "name", "Mass Storage" }, { "vendor_id", "1234" } } }
+  };
+
+  SECTION("messages survive an encode/decode round trip") {
+    for (auto format : { IPCPrivate::WireFormat::JSON, IPCPrivate::WireFormat::MessagePack }) {
+      const std::string encoded = IPCPrivate::encodeMessage(message, format);
+      REQUIRE(IPCPrivate::decodeMessage(encoded.data(), encoded.size(), format) == message);
+    }
+  }
+
+  SECTION("large arrays and maps use the wide headers") {
+    json big = json::object();
+    for (int i = 0; i < 70000; ++i) {
+      big[std::to_string(i)] = json::array({ i });
+    }
+    const std::string encoded = IPCPrivate::encodeMessage(big, IPCPrivate::WireFormat::MessagePack);
+    REQUIRE(IPCPrivate::decodeMessage(encoded.data(), encoded.size(), IPCPrivate::WireFormat::MessagePack) == big);
+  }
+
+  SECTION("malformed MessagePack input is rejected") {
+    const std::string encoded = IPCPrivate::encodeMessage(message, IPCPrivate::WireFormat::MessagePack);
+
+    for (size_t size = 0; size < encoded.size(); size += 97) {
+      REQUIRE_THROWS(IPCPrivate::decodeMessage(encoded.data(), size, IPCPrivate::WireFormat::MessagePack));
+    }
+
+    const std::string trailing = encoded + '\xc0';
+    REQUIRE_THROWS(IPCPrivate::decodeMessage(trailing.data(), trailing.size(), IPCPrivate::WireFormat::MessagePack));
+
+    const std::string deep(100, '\x91');
+    REQUIRE_THROWS(IPCPrivate::decodeMessage(deep.data(), deep.size(), IPCPrivate::WireFormat::MessagePack));
+
+    const std::string huge_map("\xdf\xff\xff\xff\xff", 5);
+    REQUIRE_THROWS(IPCPrivate::decodeMessage(huge_map.data(), huge_map.size(), IPCPrivate::WireFormat::MessagePack));
+  }
+
+  SECTION("formats are identified by the header id and name") {
+    IPCPrivate::WireFormat format = IPCPrivate::WireFormat::JSON;
+    REQUIRE(IPCPrivate::wireFormatFromHeaderID(1, format));
+    REQUIRE(format == IPCPrivate::WireFormat::MessagePack);
+    REQUIRE_FALSE(IPCPrivate::wireFormatFromHeaderID(2, format));
+    REQUIRE(IPCPrivate::wireFormatFromString("json", format));
+    REQUIRE(format == IPCPrivate::WireFormat::JSON);
+    REQUIRE_FALSE(IPCPrivate::wireFormatFromString("cbor", format));
+    REQUIRE(IPCPrivate::wireFormatToString(IPCPrivate::WireFormat::MessagePack) == "msgpack");
+  }
+}
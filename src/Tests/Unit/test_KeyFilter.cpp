@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <KeyFilter.hpp>
+
+using namespace usbguard;
+
+TEST_CASE("Key filter", "[KeyFilter]") {
+  KeyFilter filter;
+
+  SECTION("an empty filter contains nothing") {
+    REQUIRE_FALSE(filter.mayContain(0));
+    REQUIRE_FALSE(filter.mayContain(42));
+    REQUIRE(filter.size() == 0);
+  }
+
+  SECTION("added keys are always found") {
+    filter.reset(1000);
+    for (uint64_t key = 0; key < 1000; ++key) {
+      filter.add(key * 7919);
+    }
+    for (uint64_t key = 0; key < 1000; ++key) {
+      REQUIRE(filter.mayContain(key * 7919));
+    }
+    REQUIRE(filter.size() == 1000);
+    REQUIRE_FALSE(filter.overloaded());
+  }
+
+  SECTION("most other keys are rejected") {
+    filter.reset(1000);
+    for (uint64_t key = 0; key < 1000; ++key) {
+      filter.add(key);
+    }
+    unsigned int false_positives = 0;
+    for (uint64_t key = 1000; key < 11000; ++key) {
+      if (filter.mayContain(key)) {
+        ++false_positives;
+      }
+    }
+    REQUIRE(false_positives < 200);
+  }
+
+  SECTION("removed keys are forgotten") {
+    filter.add(1);
+    filter.add(2);
+    filter.remove(1);
+    REQUIRE(filter.mayContain(2));
+    REQUIRE(filter.size() == 1);
+    filter.remove(2);
+    REQUIRE_FALSE(filter.mayContain(2));
+  }
+
+  SECTION("a filter with too many keys is overloaded") {
+    filter.reset(0);
+    for (uint64_t key = 0; key < 1000; ++key) {
+      filter.add(key);
+    }
+    REQUIRE(filter.overloaded());
+  }
+}
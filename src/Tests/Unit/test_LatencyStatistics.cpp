@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <LatencyStatistics.hpp>
+#include <memory>
+
+using namespace usbguard;
+
+TEST_CASE("Latency statistics", "[LatencyStatistics]") {
+  const auto stage = LatencyStatistics::Stage::SysfsApply;
+  const LatencyStatistics before = LatencyStatistics::get().at(static_cast<size_t>(stage));
+
+  LatencyStatistics::record(stage, std::chrono::microseconds(3));
+  LatencyStatistics::record(stage, std::chrono::microseconds(100));
+  LatencyStatistics::record(stage, std::chrono::hours(1));
+
+  const std::vector<LatencyStatistics> statistics = LatencyStatistics::get();
+  REQUIRE(statistics.size() == LatencyStatistics::StageCount);
+
+  const LatencyStatistics& after = statistics.at(static_cast<size_t>(stage));
+  REQUIRE(after.stage == stage);
+  REQUIRE(after.count == before.count + 3);
+  REQUIRE(after.max_ns == 3600000000000ULL);
+  REQUIRE(after.histogram.size() == LatencyStatistics::Buckets);
+
+  SECTION("durations are counted in power of two buckets") {
+    REQUIRE(after.histogram[2] == before.histogram[2] + 1);
+    REQUIRE(after.histogram[7] == before.histogram[7] + 1);
+    REQUIRE(after.histogram.back() == before.histogram.back() + 1);
+  }
+
+  SECTION("percentiles are bucket upper bounds") {
+    LatencyStatistics sample;
+    sample.count = 100;
+    sample.max_ns = 5000000;
+    sample.histogram[3] = 50;
+    sample.histogram[5] = 49;
+    sample.histogram.back() = 1;
+    REQUIRE(sample.percentileUpperBound(50) == 8);
+    REQUIRE(sample.percentileUpperBound(99) == 32);
+    REQUIRE(sample.percentileUpperBound(100) == 5000);
+  }
+
+  SECTION("every stage has a name") {
+    for (const auto& stage_statistics : statistics) {
+      REQUIRE_FALSE(LatencyStatistics::stageToString(stage_statistics.stage).empty());
+    }
+  }
+}
+
+TEST_CASE("Allocations per stage", "[LatencyStatistics]") {
+  const auto outer_stage = LatencyStatistics::Stage::EventProcess;
+  const auto inner_stage = LatencyStatistics::Stage::RuleMatch;
+  const auto before = LatencyStatistics::get();
+  const uint64_t thread_before = LatencyStatistics::threadAllocations();
+
+  {
+    LatencyStatistics::Timer outer_timer(outer_stage);
+    std::unique_ptr<uint64_t> outer_value(new uint64_t(1));
+    {
+      LatencyStatistics::Timer inner_timer(inner_stage);
+      std::unique_ptr<uint64_t[]> inner_values(new uint64_t[4]);
+    }
+  }
+
+  const auto after = LatencyStatistics::get();
+  const LatencyStatistics& outer_before = before.at(static_cast<size_t>(outer_stage));
+  const LatencyStatistics& outer_after = after.at(static_cast<size_t>(outer_stage));
+  const LatencyStatistics& inner_before = before.at(static_cast<size_t>(inner_stage));
+  const LatencyStatistics& inner_after = after.at(static_cast<size_t>(inner_stage));
+
+  if (LatencyStatistics::countsAllocations()) {
+    /* The nested stage isn't included in the enclosing one */
+    REQUIRE(outer_after.allocations - outer_before.allocations == 1);
+    REQUIRE(outer_after.allocated_bytes - outer_before.allocated_bytes == sizeof(uint64_t));
+    REQUIRE(inner_after.allocations - inner_before.allocations == 1);
+    REQUIRE(inner_after.allocated_bytes - inner_before.allocated_bytes == 4 * sizeof(uint64_t));
+    REQUIRE(LatencyStatistics::threadAllocations() - thread_before >= 2);
+  }
+  else {
+    REQUIRE(outer_after.allocations == 0);
+    REQUIRE(inner_after.allocations == 0);
+    REQUIRE(LatencyStatistics::threadAllocations() == 0);
+  }
+}
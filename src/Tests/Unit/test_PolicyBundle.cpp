@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <PolicyBundle.hpp>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+#include <stdlib.h>
+
+using namespace usbguard;
+
+static std::vector<Rule> symbolRules(const std::vector<unsigned int>& symbols)
+{
+  std::vector<Rule> rules;
+
+  for (const unsigned int symbol : symbols) {
+    char rule_spec[32];
+    snprintf(rule_spec, sizeof rule_spec, "allow id 1234:%04x", symbol);
+    rules.push_back(Rule::fromString(rule_spec));
+  }
+  return rules;
+}
+
+static std::vector<std::string> ruleStrings(const std::vector<Rule>& rules)
+{
+  std::vector<std::string> strings;
+
+  for (auto const& rule : rules) {
+    strings.push_back(rule.toString());
+  }
+  return strings;
+}
+
+/* Replace the product id of the last rule, keeping the bundle valid */
+static void modifyLastRule(const std::string& path)
+{
+  std::fstream stream(path, std::ios::in | std::ios::out | std::ios::binary);
+  std::stringstream data;
+  data << stream.rdbuf();
+
+  std::string bytes = data.str();
+  bytes.replace(bytes.rfind("0004"), 4, "0005");
+  stream.seekp(0);
+  stream.write(bytes.data(), bytes.size());
+}
+
+TEST_CASE("Policy bundle", "[PolicyBundle]") {
+  char directory_template[] = "/tmp/usbguard-bundle.XXXXXX";
+  const std::string directory = mkdtemp(directory_template);
+  const std::string path = directory + "/policy.bundle";
+
+  const std::vector<Rule> rules_v1 = symbolRules({ 1, 2, 3, 4 });
+  const std::vector<Rule> rules_v2 = symbolRules({ 0, 1, 3, 5, 4, 6 });
+  const PolicyBundle full_v1(1, rules_v1);
+
+  SECTION("a full bundle is read back with its rules") {
+    full_v1.save(path);
+    const PolicyBundle bundle = PolicyBundle::load(path);
+    REQUIRE(bundle.getType() == PolicyBundle::Type::Full);
+    REQUIRE(bundle.getVersion() == 1);
+    REQUIRE(bundle.getHash() == full_v1.getHash());
+    REQUIRE(ruleStrings(bundle.getRules()) == ruleStrings(rules_v1));
+  }
+
+  SECTION("a signed bundle is verified with the key") {
+    full_v1.save(path, "secret");
+    REQUIRE_NOTHROW(PolicyBundle::load(path, "secret"));
+    REQUIRE_NOTHROW(PolicyBundle::load(path));
+    REQUIRE_THROWS(PolicyBundle::load(path, "other secret"));
+
+    full_v1.save(path);
+    REQUIRE_THROWS(PolicyBundle::load(path, "secret"));
+  }
+
+  SECTION("modified rules don't match the policy hash") {
+    full_v1.save(path);
+    modifyLastRule(path);
+    REQUIRE_THROWS(PolicyBundle::load(path));
+  }
+
+  SECTION("a delta bundle turns its base into the new version") {
+    const PolicyBundle delta(2, full_v1, rules_v2);
+    REQUIRE(delta.getType() == PolicyBundle::Type::Delta);
+    REQUIRE(delta.getBaseVersion() == 1);
+    REQUIRE(delta.getHash() == PolicyBundle(2, rules_v2).getHash());
+    /* Only the new rules are stored */
+    REQUIRE(delta.getRules().size() == 3);
+
+    delta.save(path, "secret");
+    const PolicyBundle loaded = PolicyBundle::load(path, "secret");
+    const PolicyBundle full_v2 = loaded.applyTo(full_v1);
+    REQUIRE(full_v2.getType() == PolicyBundle::Type::Full);
+    REQUIRE(full_v2.getVersion() == 2);
+    REQUIRE(ruleStrings(full_v2.getRules()) == ruleStrings(rules_v2));
+  }
+
+  SECTION("a delta bundle applies only to its base") {
+    const PolicyBundle delta(2, full_v1, rules_v2);
+    REQUIRE_THROWS(delta.applyTo(PolicyBundle(1, rules_v2)));
+    REQUIRE_THROWS(delta.applyTo(PolicyBundle(3, rules_v1)));
+    REQUIRE_THROWS(PolicyBundle(3, delta, rules_v1));
+  }
+
+  unlink(path.c_str());
+  rmdir(directory.c_str());
+}
@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <PolicySimulator.hpp>
+#include <vector>
+
+using namespace usbguard;
+
+static PolicySimulator::Device simulatedDevice(uint32_t id, const String& device_spec,
+                                               Rule::Target target, uint32_t rule_id)
+{
+  auto device_rule = makePointer<Rule>(Rule::fromString(device_spec));
+  device_rule->setRuleID(id);
+  return PolicySimulator::Device { device_rule, target, rule_id };
+}
+
+TEST_CASE("Policy simulation", "[PolicySimulator]") {
+  const String rules = \
+    "allow id 1234:5678\n"
+    "reject id 1234:0001\n";
+
+  SECTION("the decisions are those of the candidate rules") {
+    const PolicySimulator simulator(rules, Rule::Target::Block);
+    const std::vector<PolicySimulator::Device> devices = {
+      simulatedDevice(1, "allow id 1234:5678", Rule::Target::Allow, 7),
+      simulatedDevice(2, "allow id 1234:0001 serial \"A\"", Rule::Target::Allow, 8),
+      simulatedDevice(3, "allow id abcd:0001", Rule::Target::Allow, 9)
+    };
+
+    REQUIRE(simulator.ruleCount() == 2);
+    const auto decisions = simulator.evaluate(devices);
+    REQUIRE(decisions.size() == 3);
+
+    REQUIRE(decisions[0].id == 1);
+    REQUIRE(decisions[0].target == Rule::Target::Allow);
+    REQUIRE(decisions[0].rule_id == 1);
+    REQUIRE(decisions[0].current_rule_id == 7);
+    REQUIRE_FALSE(decisions[0].changed());
+
+    REQUIRE(decisions[1].target == Rule::Target::Reject);
+    REQUIRE(decisions[1].rule_id == 2);
+    REQUIRE(decisions[1].changed());
+
+    /* No rule applies, the default target decides */
+    REQUIRE(decisions[2].target == Rule::Target::Block);
+    REQUIRE(decisions[2].rule_id == Rule::DefaultID);
+    REQUIRE(decisions[2].device_rule == devices[2].device_rule);
+  }
+
+  SECTION("large device lists give the same decisions") {
+    const PolicySimulator simulator(rules, Rule::Target::Block);
+    std::vector<PolicySimulator::Device> devices;
+
+    for (uint32_t id = 1; id <= 2000; ++id) {
+      const char * const device_spec = \
+        id % 3 == 0 ? "block id 1234:5678" : (id % 3 == 1 ? "block id 1234:0001" : "block id abcd:0001");
+      devices.push_back(simulatedDevice(id, device_spec, Rule::Target::Block, Rule::DefaultID));
+    }
+
+    const auto decisions = simulator.evaluate(devices);
+    REQUIRE(decisions.size() == devices.size());
+
+    for (size_t i = 0; i < decisions.size(); ++i) {
+      const uint32_t id = static_cast<uint32_t>(i + 1);
+      const Rule::Target expected = \
+        id % 3 == 0 ? Rule::Target::Allow : (id % 3 == 1 ? Rule::Target::Reject : Rule::Target::Block);
+      REQUIRE(decisions[i].id == id);
+      REQUIRE(decisions[i].target == expected);
+    }
+  }
+
+  SECTION("invalid rules are rejected") {
+    REQUIRE_THROWS(PolicySimulator("allow id\n", Rule::Target::Block));
+  }
+}
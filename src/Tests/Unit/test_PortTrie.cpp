@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <PortTrie.hpp>
+
+using namespace usbguard;
+
+TEST_CASE("Port trie", "[PortTrie]") {
+  PortTrie<int> trie;
+
+  trie["1-2"] = 1;
+  trie["1-2.3"] = 2;
+  trie["1-2.3.4"] = 3;
+  trie["1-20"] = 4;
+  trie["usb1"] = 5;
+
+  SECTION("finds the exact port") {
+    REQUIRE(trie.size() == 5);
+    REQUIRE(*trie.find("1-2") == 1);
+    REQUIRE(*trie.find("1-2.3.4") == 3);
+    REQUIRE(*trie.find("usb1") == 5);
+    REQUIRE(trie.find("1") == nullptr);
+    REQUIRE(trie.find("1-2.4") == nullptr);
+    REQUIRE(trie.find("1-2.3.4.5") == nullptr);
+  }
+
+  SECTION("visits the ports behind a port") {
+    std::vector<String> ports;
+    trie.visitSubtree("1-2", [&ports](const String& port, const int& value) {
+      (void)value;
+      ports.push_back(port);
+      return true;
+    });
+    REQUIRE(ports == std::vector<String>({ "1-2", "1-2.3", "1-2.3.4" }));
+  }
+
+  SECTION("stops the visit when asked") {
+    unsigned int visited = 0;
+    trie.visitSubtree("1", [&visited](const String& port, const int& value) {
+      (void)port;
+      (void)value;
+      return ++visited < 2;
+    });
+    REQUIRE(visited == 2);
+  }
+
+  SECTION("erases values") {
+    REQUIRE(trie.erase("1-2.3"));
+    REQUIRE_FALSE(trie.erase("1-2.3"));
+    REQUIRE(trie.find("1-2.3") == nullptr);
+    REQUIRE(*trie.find("1-2.3.4") == 3);
+    REQUIRE(trie.size() == 4);
+
+    trie["1-2.3"] = 6;
+    REQUIRE(*trie.find("1-2.3") == 6);
+  }
+
+  SECTION("copies are independent") {
+    PortTrie<int> copy(trie);
+    copy["1-2"] = 7;
+    REQUIRE(*trie.find("1-2") == 1);
+    REQUIRE(*copy.find("1-2") == 7);
+  }
+}
@@ -18,6 +18,7 @@
 //
 #include <catch.hpp>
 #include <Rule.hpp>
+#include <RuleSet.hpp>
 
 using namespace usbguard;
 
@@ -77,3 +78,130 @@ TEST_CASE("Target-only rule", "[RuleParser]") {
     REQUIRE_NOTHROW(rule.toString() == "reject");
   }
 }
+
+TEST_CASE("Interned attribute values", "[Rule]") {
+  Rule rule;
+  Rule other;
+
+  rule.setName("Example Device");
+  rule.setSerial("0001");
+  other.setName("Example Device");
+  other.setSerial("0002");
+
+  SECTION("are shared by equal values") {
+    REQUIRE(&rule.getName() == &other.getName());
+    REQUIRE(rule.attributeName().values()[0].id() == other.attributeName().values()[0].id());
+  }
+
+  SECTION("differ for different values") {
+    REQUIRE(rule.getSerial() != other.getSerial());
+    REQUIRE(rule.attributeSerial().values()[0] != other.attributeSerial().values()[0]);
+  }
+
+  SECTION("are shared by rule copies") {
+    const Rule copy = rule;
+    REQUIRE(&copy.getName() == &rule.getName());
+  }
+}
+
+TEST_CASE("Rule usage statistics", "[Rule]") {
+  Rule rule;
+  Rule device_rule;
+
+  rule.setRuleID(42);
+  rule.setTarget(Rule::Target::Allow);
+  device_rule.setTarget(Rule::Target::Device);
+
+  SECTION("start at zero") {
+    const Rule::Statistics statistics = rule.getStatistics();
+    REQUIRE(statistics.rule_id == 42);
+    REQUIRE(statistics.evaluated == 0);
+    REQUIRE(statistics.applied == 0);
+  }
+
+  SECTION("count evaluations and applications") {
+    REQUIRE(rule.appliesTo(device_rule));
+    REQUIRE(rule.appliesTo(device_rule));
+    rule.updateMetaDataCounters(/*applied=*/true);
+    const Rule::Statistics statistics = rule.getStatistics();
+    REQUIRE(statistics.evaluated == 2);
+    REQUIRE(statistics.applied == 1);
+  }
+
+  SECTION("are copied with the rule") {
+    rule.updateMetaDataCounters(/*applied=*/true, /*evaluated=*/true);
+    const Rule copy = rule;
+    REQUIRE(copy.getStatistics().evaluated == 1);
+    REQUIRE(copy.getStatistics().applied == 1);
+  }
+}
+
+TEST_CASE("Rule copies", "[Rule]") {
+  Rule rule;
+  rule.setRuleID(7);
+  rule.setTarget(Rule::Target::Allow);
+  rule.setName("foo");
+
+  SECTION("share the data until modified") {
+    const Rule copy = rule;
+    REQUIRE(copy.internal() == rule.internal());
+    rule.setName("bar");
+    REQUIRE(copy.internal() != rule.internal());
+    REQUIRE(copy.getName() == "foo");
+    REQUIRE(rule.getName() == "bar");
+  }
+
+  SECTION("are not modified through the original attributes") {
+    Rule copy;
+    copy = rule;
+    rule.attributeName().clear();
+    REQUIRE(rule.attributeName().empty());
+    REQUIRE(copy.getName() == "foo");
+  }
+
+  SECTION("can be moved from") {
+    Rule moved = std::move(rule);
+    REQUIRE(moved.getRuleID() == 7);
+    REQUIRE(moved.getName() == "foo");
+    REQUIRE(rule.isImplicit());
+    REQUIRE(rule.getTarget() == Rule::Target::Invalid);
+    rule.setRuleID(8);
+    REQUIRE(rule.getRuleID() == 8);
+    REQUIRE(moved.getRuleID() == 7);
+  }
+}
+
+TEST_CASE("Rule string form", "[Rule]") {
+  Rule rule;
+  rule.setTarget(Rule::Target::Allow);
+  rule.setDeviceID(USBDeviceID("1234", "5678"));
+  rule.attributeName().append("a");
+  rule.attributeName().append("b \"c\"");
+
+  const String expected = "allow id 1234:5678 name { \"a\" \"b \\\"c\\\"\" }";
+
+  SECTION("can be appended to a buffer") {
+    String buffer = "> ";
+    rule.appendToString(buffer);
+    REQUIRE(rule.toString() == expected);
+    REQUIRE(buffer == "> " + expected);
+  }
+
+  SECTION("includes a non-default set operator") {
+    rule.attributeName().setSetOperator(Rule::SetOperator::OneOf);
+    REQUIRE(rule.toString() == "allow id 1234:5678 name one-of { \"a\" \"b \\\"c\\\"\" }");
+  }
+
+  SECTION("stays correct for modified copies of stored rules") {
+    RuleSet ruleset(nullptr);
+    const uint32_t id = ruleset.appendRule(rule);
+
+    Rule stored = *ruleset.getRule(id);
+    REQUIRE(stored.toString() == expected);
+    REQUIRE(stored.toString() == expected);
+
+    stored.setTarget(Rule::Target::Block);
+    REQUIRE(stored.toString() == "block id 1234:5678 name { \"a\" \"b \\\"c\\\"\" }");
+    REQUIRE(ruleset.getRule(id)->toString() == expected);
+  }
+}
@@ -0,0 +1,115 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <RuleArena.hpp>
+#include "RulePrivate.hpp"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace usbguard;
+
+TEST_CASE("Rule arena", "[RuleArena]") {
+  SECTION("a sized arena holds all the rules in one block") {
+    RuleArena arena(100);
+    std::vector<Rule> rules;
+
+    for (uint32_t i = 0; i < 100; ++i) {
+      Rule rule = arena.newRule();
+      rule.setRuleID(i + 1);
+      rule.setTarget(Rule::Target::Allow);
+      rules.push_back(std::move(rule));
+    }
+
+    REQUIRE(arena.blockCount() == 1);
+    REQUIRE(arena.used() <= arena.capacity());
+    REQUIRE(arena.used() >= 100 * sizeof(RulePrivate));
+  }
+
+  SECTION("rules outlive the arena") {
+    std::vector<Rule> rules;
+    {
+      RuleArena arena;
+      for (uint32_t i = 0; i < 10000; ++i) {
+        Rule rule = arena.newRule();
+        rule.setRuleID(i + 1);
+        rule.setName("rule");
+        rules.push_back(std::move(rule));
+      }
+      REQUIRE(arena.blockCount() > 1);
+    }
+
+    bool all_intact = true;
+    for (uint32_t i = 0; i < 10000; ++i) {
+      all_intact = all_intact && rules[i].getRuleID() == i + 1 && rules[i].getName() == "rule";
+    }
+    REQUIRE(all_intact);
+  }
+
+  SECTION("modified copies of arena rules are separate") {
+    RuleArena arena;
+    Rule rule = arena.newRule();
+    rule.setRuleID(1);
+    const size_t used = arena.used();
+
+    Rule copy = rule;
+    copy.setRuleID(2);
+
+    REQUIRE(rule.getRuleID() == 1);
+    REQUIRE(copy.getRuleID() == 2);
+    REQUIRE(arena.used() == used);
+  }
+
+  SECTION("can be used from several threads") {
+    RuleArena arena;
+    std::vector<std::vector<Rule>> rules(4);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < rules.size(); ++t) {
+      threads.emplace_back([&arena, &rules, t]() {
+        for (uint32_t i = 0; i < 1000; ++i) {
+          Rule rule = arena.newRule();
+          rule.setRuleID(i + 1);
+          rules[t].push_back(std::move(rule));
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    std::vector<const RulePrivate*> data;
+    for (auto const& thread_rules : rules) {
+      for (auto const& rule : thread_rules) {
+        data.push_back(rule.internal());
+      }
+    }
+    std::sort(data.begin(), data.end());
+    REQUIRE(std::unique(data.begin(), data.end()) == data.end());
+    REQUIRE(data.size() == 4000);
+  }
+
+  SECTION("parsed rules are allocated in the arena") {
+    RuleArena arena;
+    const Rule rule = Rule::fromString("allow name \"foo\"", arena);
+    REQUIRE(arena.used() > 0);
+    REQUIRE(rule.getTarget() == Rule::Target::Allow);
+    REQUIRE(rule.getName() == "foo");
+  }
+}
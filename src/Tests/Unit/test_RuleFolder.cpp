@@ -0,0 +1,154 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <RuleFolder.hpp>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+using namespace usbguard;
+
+static void writeFile(const std::string& path, const std::string& data)
+{
+  std::ofstream stream(path);
+  stream << data;
+}
+
+static std::string readFile(const std::string& path)
+{
+  std::ifstream stream(path);
+  std::stringstream data;
+  data << stream.rdbuf();
+  return data.str();
+}
+
+/* Load the contents into an empty or matching rule set */
+static void loadContents(RuleFolder& folder, RuleSet& ruleset)
+{
+  RuleFolder::Contents contents = folder.read(ruleset);
+  std::vector<RuleSet::Operation> operations;
+
+  for (auto const& rule : ruleset.getRules()) {
+    operations.push_back(RuleSet::Operation::remove(rule->getRuleID()));
+  }
+  const size_t removed_count = operations.size();
+  for (auto const& rule : contents.rules) {
+    operations.push_back(RuleSet::Operation::append(rule));
+  }
+
+  const std::vector<uint32_t> ids = ruleset.applyBatch(operations);
+  folder.assign(std::vector<uint32_t>(ids.begin() + removed_count, ids.end()), std::move(contents));
+}
+
+TEST_CASE("Rule folder", "[RuleFolder]") {
+  char dir_template[] = "/tmp/usbguard-rules.XXXXXX";
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string dir = dir_template;
+  const std::string folder_path = dir + "/rules.d";
+  const std::string rule_file = dir + "/rules.conf";
+
+  REQUIRE(mkdir(folder_path.c_str(), 0700) == 0);
+  writeFile(folder_path + "/20-storage.conf", "block with-interface 08:*:*\n");
+  writeFile(folder_path + "/10-base.conf", "allow id 1234:5678\nallow id 1234:5679\n");
+  writeFile(folder_path + "/README", "not a fragment\n");
+
+  RuleFolder folder(folder_path, rule_file, dir + "/rules.cache");
+  RuleSet ruleset(nullptr);
+  loadContents(folder, ruleset);
+
+  SECTION("fragments are loaded in lexical order, then the rule file") {
+    REQUIRE(folder.fragments().size() == 3);
+    REQUIRE(folder.fragments()[0].path == folder_path + "/10-base.conf");
+    REQUIRE(folder.fragments()[1].path == folder_path + "/20-storage.conf");
+    REQUIRE(folder.fragments()[2].path == rule_file);
+    REQUIRE_FALSE(folder.fragments()[2].present);
+
+    const auto rules = ruleset.getRules();
+    REQUIRE(rules.size() == 3);
+    REQUIRE(rules[0]->toString() == "allow id 1234:5678");
+    REQUIRE(rules[2]->toString() == "block with-interface 08:*:*");
+  }
+
+  SECTION("only the changed fragments are parsed again") {
+    /*
+     * The rule set differs from the unchanged 10-base.conf file,
+     * so the rules found for it show it wasn't parsed again.
+     */
+    REQUIRE(ruleset.removeRule(ruleset.getRules()[1]->getRuleID()));
+    writeFile(folder_path + "/20-storage.conf", "reject with-interface 08:*:*\n");
+
+    const RuleFolder::Contents contents = folder.read(ruleset);
+    REQUIRE(contents.rules.size() == 2);
+    REQUIRE(contents.rules[0].toString() == "allow id 1234:5678");
+    REQUIRE(contents.rules[1].toString() == "reject with-interface 08:*:*");
+    REQUIRE(contents.fragments == std::vector<size_t>({ 0, 1 }));
+  }
+
+  SECTION("new rules are stored in the rule file") {
+    const uint32_t id = ruleset.appendRule(Rule::fromString("allow id abcd:0001"));
+    const std::string base = readFile(folder_path + "/10-base.conf");
+    folder.store(ruleset, { id });
+    REQUIRE(readFile(rule_file) == "allow id abcd:0001\n");
+    REQUIRE(readFile(folder_path + "/10-base.conf") == base);
+    REQUIRE(folder.fragments()[2].present);
+
+    /* The stored fragment isn't parsed again */
+    const RuleFolder::Contents contents = folder.read(ruleset);
+    REQUIRE(contents.rules.size() == 4);
+    REQUIRE(contents.fragments.back() == 2);
+  }
+
+  SECTION("only the fragment of a removed rule is rewritten") {
+    const uint32_t id = ruleset.getRules()[1]->getRuleID();
+    const std::string storage = readFile(folder_path + "/20-storage.conf");
+    REQUIRE(ruleset.removeRule(id));
+    folder.store(ruleset, { id });
+    REQUIRE(readFile(folder_path + "/10-base.conf") == "allow id 1234:5678\n");
+    REQUIRE(readFile(folder_path + "/20-storage.conf") == storage);
+  }
+
+  SECTION("new and removed fragments are picked up") {
+    REQUIRE(unlink((folder_path + "/20-storage.conf").c_str()) == 0);
+    writeFile(folder_path + "/15-hid.conf", "allow with-interface 03:*:*\n");
+    loadContents(folder, ruleset);
+
+    const auto rules = ruleset.getRules();
+    REQUIRE(rules.size() == 3);
+    REQUIRE(rules[2]->toString() == "allow with-interface 03:*:*");
+    REQUIRE(folder.fragments()[1].path == folder_path + "/15-hid.conf");
+  }
+
+  SECTION("syntax errors name the fragment") {
+    writeFile(folder_path + "/30-bad.conf", "allow nonsense\n");
+    REQUIRE_THROWS(folder.read(ruleset));
+    REQUIRE(folder.fragments().size() == 3);
+  }
+
+  for (auto const& name : { "10-base", "15-hid", "20-storage", "30-bad" }) {
+    unlink((folder_path + "/" + name + ".conf").c_str());
+    unlink((dir + "/rules.cache." + name + ".conf").c_str());
+  }
+  unlink((folder_path + "/README").c_str());
+  unlink((dir + "/rules.cache.rules.conf").c_str());
+  unlink(rule_file.c_str());
+  rmdir(folder_path.c_str());
+  rmdir(dir.c_str());
+}
@@ -0,0 +1,64 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <RuleIndex.hpp>
+
+using namespace usbguard;
+
+static Pointer<Rule> makeRule(uint32_t id, const String& spec)
+{
+  auto rule = makePointer<Rule>(Rule::fromString(spec));
+  rule->setRuleID(id);
+  return rule;
+}
+
+TEST_CASE("Rule index", "[RuleIndex]") {
+  PointerVector<Rule> rules;
+  RuleIndex index;
+
+  rules.push_back(makeRule(1, "allow id 1234:5678"));
+  rules.push_back(makeRule(2, "block serial \"0001\""));
+  rules.push_back(makeRule(3, "reject"));
+  index.rebuild(rules);
+
+  SECTION("repeated prepends keep the existing order keys") {
+    std::vector<uint64_t> orders;
+
+    for (auto const& rule : rules) {
+      orders.push_back(index.remove(rule));
+      index.insert(rule, orders.back());
+    }
+
+    for (uint32_t id = 4; id < 1000; ++id) {
+      rules.insert(rules.begin(), makeRule(id, "allow hash \"abcd\""));
+      index.insertAt(rules, 0);
+    }
+
+    for (size_t i = 0; i < orders.size(); ++i) {
+      const auto& rule = rules[rules.size() - orders.size() + i];
+      REQUIRE(index.remove(rule) == orders[i]);
+      index.insert(rule, orders[i]);
+    }
+
+    REQUIRE(index.size() == rules.size());
+    for (size_t i = 0; i < rules.size(); ++i) {
+      REQUIRE(index.position(rules, rules[i]->getRuleID()) == i);
+    }
+  }
+}
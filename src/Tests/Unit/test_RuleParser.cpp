@@ -18,6 +18,7 @@
 //
 #include <catch.hpp>
 #include <Rule.hpp>
+#include <RuleParser.hpp>
 
 using namespace usbguard;
 
@@ -182,3 +183,91 @@ TEST_CASE("Double quote and backslash characters in a rule string", "[RuleParser
     REQUIRE(rule_from.getTarget() == Rule::Target::Allow);
   }
 }
+
+TEST_CASE("Canonical rule parser", "[RuleParser]") {
+  SECTION("canonical rules are parsed in a single pass") {
+    const std::vector<std::pair<std::string, std::string>> canonical_rules = {
+      { "allow", "allow" },
+      { "block id 1234:5678", "block id 1234:5678" },
+      { "reject 1d6b:*", "reject id 1d6b:*" },
+      { "match id *:*", "match id *:*" },
+      { "device id 8564:1000 serial \"000000000000000005B4\" name \"Mass Storage Device\" hash \"3Lk=\" parent-hash \"Gr6=\" via-port \"2-2\" with-interface 08:06:50",
+        "device id 8564:1000 serial \"000000000000000005B4\" name \"Mass Storage Device\" hash \"3Lk=\" parent-hash \"Gr6=\" via-port \"2-2\" with-interface 08:06:50" },
+      { "allow name \"a \\\"quoted\\\" \\\\ name\\x01\"", "allow name \"a \\\"quoted\\\" \\\\ name\\x01\"" },
+      { "allow id one-of { 1234:5678 abcd:* } with-interface all-of {03:*:*  09:00:* ff:ff:ff }",
+        "allow id one-of { 1234:5678 abcd:* } with-interface all-of { 03:*:* 09:00:* ff:ff:ff }" },
+      { "allow via-port equals-ordered { \"1-1\" \"1-2\" } serial none-of { \"\" }",
+        "allow serial none-of { \"\" } via-port equals-ordered { \"1-1\" \"1-2\" }" },
+      { "allow with-interface { 03:01:01 }", "allow with-interface 03:01:01" },
+      { "allow group \"office\" id 1234:5678", "allow id 1234:5678 group \"office\"" }
+    };
+
+    for (auto const& rule_strings : canonical_rules) {
+      Rule rule;
+      INFO(rule_strings.first);
+      REQUIRE(parseCanonicalRuleFromString(rule_strings.first, rule));
+      REQUIRE(rule.toString() == rule_strings.second);
+    }
+  }
+
+  SECTION("the result matches the rule it was written from") {
+    Rule rule, rule_from;
+    const std::vector<String> ports = { "1-1", "1-2" };
+
+    rule.setTarget(Rule::Target::Block);
+    rule.setDeviceID(USBDeviceID("1234", "*"));
+    rule.setName(String("\"\\\x7f", 3));
+    rule.attributeViaPort().set(ports, Rule::SetOperator::EqualsOrdered);
+    rule.attributeWithInterface().append(USBInterfaceType("0e:*:*"));
+
+    const std::string rule_string = rule.toString();
+    REQUIRE(parseCanonicalRuleFromString(rule_string, rule_from));
+    REQUIRE(rule_from.toString() == rule_string);
+    REQUIRE(rule_from.getTarget() == Rule::Target::Block);
+    REQUIRE(rule_from.getName() == rule.getName());
+    REQUIRE(rule_from.attributeViaPort().setOperator() == Rule::SetOperator::EqualsOrdered);
+  }
+
+  SECTION("other rules are left to the full parser") {
+    const std::vector<std::string> other_rules = {
+      /* valid, but not what Rule::toString() writes */
+      "allow if true",
+      "allow id 1234:5678 if !rule-applied",
+      "allow name \"\\101\"",
+      "allow name \"\\t\"",
+      /* from test-rules.bad */
+      "",
+      "alloww",
+      "allow allow",
+      "match allow",
+      "allow { }",
+      "allow id 1234:123",
+      "allow 1234:1234 id 1234:1234",
+      "allow id asdf:*",
+      "allow *:1234",
+      "allow name",
+      "allow name \"",
+      "allow name \"a",
+      "allow name \"\\\"",
+      "allow name one-of {",
+      "allow name { a }",
+      "allow name {  }",
+      "allow name \"a\" ",
+      "allow with-interface 12:*:34",
+      "allow with-interface *:*:*",
+      "allow with-interface one-of { * }",
+      "allow with-interface some { 12:12:12 }",
+      "allow unknown-attribute \"s\"",
+      "allow name \"asdf\" name \"foo\"",
+      "allow with-interface 12:34:56 with-interface 12:34:56"
+    };
+
+    for (auto const& rule_string : other_rules) {
+      Rule rule;
+      INFO(rule_string);
+      REQUIRE_FALSE(parseCanonicalRuleFromString(rule_string, rule));
+      REQUIRE(rule.getTarget() == Rule::Target::Invalid);
+      REQUIRE(rule.attributeName().empty());
+    }
+  }
+}
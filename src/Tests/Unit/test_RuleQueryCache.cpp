@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <RuleQueryCache.hpp>
+#include <thread>
+#include <vector>
+
+using namespace usbguard;
+
+TEST_CASE("Rule query cache", "[RuleQueryCache]") {
+  SECTION("a query is parsed once") {
+    RuleQueryCache cache(4);
+    const Pointer<const Rule> first = cache.get("allow id 1234:5678");
+    const Pointer<const Rule> second = cache.get("allow id 1234:5678");
+
+    REQUIRE(first == second);
+    REQUIRE(first->getTarget() == Rule::Target::Allow);
+    REQUIRE(first->toString() == "allow id 1234:5678");
+    REQUIRE(cache.size() == 1);
+  }
+
+  SECTION("the least recently used query is evicted") {
+    RuleQueryCache cache(2);
+    const auto a = cache.get("match id 1111:1111");
+    cache.get("match id 2222:2222");
+    /* Touch the first query, so that the second one is the oldest */
+    REQUIRE(cache.get("match id 1111:1111") == a);
+    cache.get("match id 3333:3333");
+
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.get("match id 1111:1111") == a);
+    REQUIRE(cache.size() == 2);
+  }
+
+  SECTION("invalid queries aren't cached") {
+    RuleQueryCache cache(2);
+    REQUIRE_THROWS(cache.get("allow id"));
+    REQUIRE(cache.size() == 0);
+  }
+
+  SECTION("cached queries are shared by threads") {
+    RuleQueryCache cache(8);
+    std::vector<std::thread> threads;
+    std::vector<Pointer<const Rule>> results(4);
+
+    for (size_t i = 0; i < results.size(); ++i) {
+      threads.emplace_back([&cache, &results, i]() {
+        for (int n = 0; n < 100; ++n) {
+          results[i] = cache.get("block with-interface 08:*:*");
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(cache.size() == 1);
+    for (auto const& rule : results) {
+      REQUIRE(rule == cache.get("block with-interface 08:*:*"));
+    }
+  }
+}
@@ -0,0 +1,966 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <RuleSet.hpp>
+#include <RuleParser.hpp>
+#include <RuleCondition.hpp>
+#include <RulePrivate.hpp>
+#include <LocaltimeCondition.hpp>
+#include <RuleAppliedCondition.hpp>
+#include <ModuleCondition.hpp>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace usbguard;
+
+TEST_CASE("First matching rule", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\" with-interface 03:00:00"));
+  auto other_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:0000 serial \"0002\" hash \"efgh\" with-interface 08:06:50"));
+
+  const uint32_t id_block_wildcard = ruleset.appendRule(Rule::fromString("block with-interface 08:*:*"));
+  const uint32_t id_allow_serial = ruleset.appendRule(Rule::fromString("allow serial \"0001\""));
+  const uint32_t id_allow_hash = ruleset.appendRule(Rule::fromString("allow hash \"abcd\""));
+  const uint32_t id_reject_id = ruleset.appendRule(Rule::fromString("reject id 1234:5678"));
+
+  SECTION("is found in rule set order") {
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_serial);
+    REQUIRE(ruleset.getFirstMatchingRule(other_rule)->getRuleID() == id_block_wildcard);
+  }
+
+  SECTION("is updated after removal") {
+    REQUIRE(ruleset.removeRule(id_allow_serial));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_hash);
+    REQUIRE(ruleset.removeRule(id_allow_hash));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_reject_id);
+    REQUIRE(ruleset.removeRule(id_reject_id));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == Rule::DefaultID);
+  }
+
+  SECTION("respects the parent id on insertion") {
+    const uint32_t id_first = ruleset.appendRule(Rule::fromString("block id 1234:5678"), 0);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_first);
+    REQUIRE(ruleset.removeRule(id_first));
+    const uint32_t id_after = ruleset.appendRule(Rule::fromString("block hash \"abcd\""), id_block_wildcard);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_after);
+  }
+
+  SECTION("is updated after upsert") {
+    const Rule match_rule = Rule::fromString("allow serial \"0001\"");
+    REQUIRE(ruleset.upsertRule(match_rule, Rule::fromString("allow serial \"0003\"")) == id_allow_serial);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_hash);
+  }
+
+  SECTION("is found for a wildcard device rule") {
+    auto wildcard_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:* serial \"0001\""));
+    REQUIRE(ruleset.getFirstMatchingRule(wildcard_rule)->getRuleID() == id_reject_id);
+  }
+}
+
+TEST_CASE("Allow-list without wildcard rules", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto known_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\""));
+  auto unknown_rule = makePointer<const Rule>(Rule::fromString("allow id 4321:8765 serial \"9999\" hash \"dcba\""));
+  std::vector<uint32_t> ids;
+
+  for (unsigned int i = 0; i < 2000; ++i) {
+    ids.push_back(ruleset.appendRule(Rule::fromString("allow serial \"S" + std::to_string(i) + "\"")));
+  }
+  const uint32_t id_allow_hash = ruleset.appendRule(Rule::fromString("allow hash \"abcd\""));
+
+  SECTION("unknown devices get the default target") {
+    REQUIRE(ruleset.getFirstMatchingRule(unknown_rule)->getRuleID() == Rule::DefaultID);
+    REQUIRE(ruleset.getFirstMatchingRule(known_rule)->getRuleID() == id_allow_hash);
+  }
+
+  SECTION("removed rules don't match") {
+    REQUIRE(ruleset.removeRule(id_allow_hash));
+    REQUIRE(ruleset.getFirstMatchingRule(known_rule)->getRuleID() == Rule::DefaultID);
+  }
+
+  SECTION("a wildcard rule disables the shortcut") {
+    const uint32_t id_block = ruleset.appendRule(Rule::fromString("block"));
+    REQUIRE(ruleset.getFirstMatchingRule(unknown_rule)->getRuleID() == id_block);
+  }
+
+  SECTION("all keyed rules are found") {
+    for (unsigned int i = 0; i < 2000; i += 97) {
+      auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"S" + std::to_string(i) + "\""));
+      REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == ids[i]);
+    }
+  }
+}
+
+TEST_CASE("Port specific rules", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  std::vector<uint32_t> ids;
+
+  for (unsigned int i = 1; i <= 8; ++i) {
+    ids.push_back(ruleset.appendRule(Rule::fromString("allow via-port \"1-" + std::to_string(i) + "\"")));
+  }
+  const uint32_t id_parent = ruleset.appendRule(Rule::fromString("block parent-hash \"abcd\""));
+
+  SECTION("match the device port") {
+    auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 via-port \"1-3\""));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == ids[2]);
+  }
+
+  SECTION("don't match the ports behind the port") {
+    auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 via-port \"1-3.1\""));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == Rule::DefaultID);
+  }
+
+  SECTION("match the parent hash") {
+    auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 parent-hash \"abcd\" via-port \"2-1\""));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_parent);
+  }
+
+  SECTION("are removed from the index") {
+    REQUIRE(ruleset.removeRule(ids[2]));
+    auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 via-port \"1-3\""));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == Rule::DefaultID);
+  }
+}
+
+TEST_CASE("Vendor wildcard rules", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  const std::vector<String> rule_strings = {
+    "block id 046d:c52b",
+    "allow id 046d:*",
+    "reject id 1234:*",
+    "block id 1234:5678",
+    "allow id *:*",
+    "allow id 046d:c52c"
+  };
+  const std::vector<String> device_strings = {
+    "allow id 046d:c52b serial \"0001\"",
+    "allow id 046d:c52c serial \"0001\"",
+    "allow id 046d:*",
+    "allow id 1234:5678",
+    "allow id 1234:*",
+    "allow id 5678:1234"
+  };
+  std::vector<Rule> rules;
+
+  for (auto const& rule_string : rule_strings) {
+    rules.push_back(Rule::fromString(rule_string));
+    rules.back().setRuleID(ruleset.appendRule(rules.back()));
+  }
+
+  SECTION("match like a linear scan of the rules") {
+    for (size_t skip = 0; skip <= rules.size(); ++skip) {
+      if (skip < rules.size()) {
+        REQUIRE(ruleset.removeRule(rules[skip].getRuleID()));
+      }
+      for (auto const& device_string : device_strings) {
+        auto device_rule = makePointer<const Rule>(Rule::fromString(device_string));
+        uint32_t expected_id = Rule::DefaultID;
+
+        for (size_t i = 0; i < rules.size(); ++i) {
+          if (i != skip && rules[i].appliesTo(*device_rule)) {
+            expected_id = rules[i].getRuleID();
+            break;
+          }
+        }
+        CAPTURE(device_string);
+        CAPTURE(skip);
+        REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == expected_id);
+      }
+      if (skip < rules.size()) {
+        rules[skip].setRuleID(ruleset.appendRule(rules[skip], skip > 0 ? rules[skip - 1].getRuleID() : 0));
+      }
+    }
+  }
+}
+
+TEST_CASE("Sealed rule sets", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  const std::vector<String> rule_strings = {
+    "block with-interface 08:*:*",
+    "allow hash \"abcd\"",
+    "block id 046d:c52b",
+    "allow id 046d:*",
+    "allow serial \"0001\"",
+    "reject parent-hash \"efgh\"",
+    "allow via-port \"1-2\"",
+    "block id 1234:5678 serial \"0002\"",
+    "allow with-interface one-of { 03:00:00 08:06:50 }",
+    "allow id *:*"
+  };
+  const std::vector<String> device_strings = {
+    "allow id 1234:5678 serial \"0002\" hash \"abcd\" with-interface 08:06:50",
+    "allow id 1234:5678 serial \"0002\" hash \"xyz\" with-interface 03:00:00",
+    "allow id 046d:c52b serial \"0001\" with-interface 03:01:02",
+    "allow id 046d:c52c parent-hash \"efgh\" via-port \"1-2\" with-interface 03:01:02",
+    "allow id 5678:1234 via-port \"1-2\" with-interface 09:00:00",
+    "allow id 046d:* with-interface 03:00:00",
+    "allow id 1111:2222 with-interface { 03:00:00 08:06:50 09:00:00 }"
+  };
+
+  for (unsigned int i = 0; i < 100; ++i) {
+    ruleset.appendRule(Rule::fromString("allow serial \"S" + std::to_string(i) + "\""));
+  }
+  for (auto const& rule_string : rule_strings) {
+    ruleset.appendRule(Rule::fromString(rule_string));
+  }
+
+  RuleSet unsealed(ruleset);
+  ruleset.setSealed(true);
+  REQUIRE(ruleset.isSealed());
+  REQUIRE_FALSE(unsealed.isSealed());
+
+  auto require_same_matches = [&]() {
+    for (auto const& device_string : device_strings) {
+      auto device_rule = makePointer<const Rule>(Rule::fromString(device_string));
+      CAPTURE(device_string);
+      REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == \
+        unsealed.getFirstMatchingRule(device_rule)->getRuleID());
+
+      auto sealed_rules = ruleset.getFirstMatchingInterfaceRules(device_rule);
+      auto unsealed_rules = unsealed.getFirstMatchingInterfaceRules(device_rule);
+      REQUIRE(sealed_rules.size() == unsealed_rules.size());
+      for (size_t i = 0; i < sealed_rules.size(); ++i) {
+        REQUIRE(sealed_rules[i]->getRuleID() == unsealed_rules[i]->getRuleID());
+      }
+    }
+    for (unsigned int i = 0; i < 100; i += 7) {
+      auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:0000 serial \"S" + std::to_string(i) + "\""));
+      REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == \
+        unsealed.getFirstMatchingRule(device_rule)->getRuleID());
+    }
+  };
+
+  SECTION("match like unsealed rule sets") {
+    require_same_matches();
+  }
+
+  SECTION("are rebuilt on modifications") {
+    const uint32_t id = ruleset.appendRule(Rule::fromString("block hash \"xyz\""), 0);
+    REQUIRE(unsealed.appendRule(Rule::fromString("block hash \"xyz\""), 0) == id);
+    REQUIRE(ruleset.removeRule(id - 2));
+    REQUIRE(unsealed.removeRule(id - 2));
+    require_same_matches();
+  }
+
+  SECTION("can be unsealed") {
+    ruleset.setSealed(false);
+    REQUIRE_FALSE(ruleset.isSealed());
+    require_same_matches();
+  }
+}
+
+TEST_CASE("Rule set snapshots", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 hash \"abcd\""));
+
+  const uint32_t id_allow = ruleset.appendRule(Rule::fromString("allow hash \"abcd\""));
+  const uint32_t id_block = ruleset.appendRule(Rule::fromString("block id 1234:5678"));
+  const uint32_t version = ruleset.saveSnapshot("initial");
+
+  REQUIRE(ruleset.listSnapshots().size() == 1);
+  REQUIRE(ruleset.listSnapshots()[0].version == version);
+  REQUIRE(ruleset.listSnapshots()[0].name == "initial");
+  REQUIRE(ruleset.listSnapshots()[0].rule_count == 2);
+  REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow);
+
+  REQUIRE(ruleset.removeRule(id_allow));
+  const uint32_t id_reject = ruleset.appendRule(Rule::fromString("reject hash \"abcd\""), 0);
+  REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_reject);
+
+  SECTION("restore the saved rules") {
+    RuleSet::Changes changes;
+    REQUIRE(ruleset.rollback(version, changes));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow);
+    REQUIRE(ruleset.getRules().size() == 2);
+    REQUIRE(ruleset.getRule(id_block));
+
+    REQUIRE(changes.rules.size() == 1);
+    REQUIRE(changes.rules[0].getRuleID() == id_allow);
+    REQUIRE(changes.removed_ids == std::vector<uint32_t>({ id_reject }));
+  }
+
+  SECTION("don't reuse rule ids") {
+    RuleSet::Changes changes;
+    REQUIRE(ruleset.rollback(version, changes));
+    const uint32_t id_next = ruleset.appendRule(Rule::fromString("block"));
+    REQUIRE(id_next > id_reject);
+  }
+
+  SECTION("can be rolled back repeatedly") {
+    RuleSet::Changes changes;
+    const uint32_t current_version = ruleset.saveSnapshot("current");
+    REQUIRE(ruleset.rollback(version, changes));
+    REQUIRE(ruleset.rollback(current_version, changes));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_reject);
+    REQUIRE(ruleset.rollback(version, changes));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow);
+  }
+
+  SECTION("fail for unknown versions") {
+    RuleSet::Changes changes;
+    REQUIRE_FALSE(ruleset.rollback(version + 1, changes));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_reject);
+  }
+
+  SECTION("are limited in number") {
+    ruleset.setSnapshotLimit(2);
+    ruleset.saveSnapshot("second");
+    const uint32_t last_version = ruleset.saveSnapshot("third");
+    REQUIRE(ruleset.listSnapshots().size() == 2);
+    REQUIRE(ruleset.listSnapshots()[1].version == last_version);
+    RuleSet::Changes changes;
+    REQUIRE_FALSE(ruleset.rollback(version, changes));
+  }
+}
+
+TEST_CASE("Cached rule matches", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 hash \"abcd\" via-port \"1-1\""));
+  auto moved_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 hash \"abcd\" via-port \"1-2\""));
+
+  const uint32_t id_allow_port = ruleset.appendRule(Rule::fromString("allow hash \"abcd\" via-port \"1-1\""));
+
+  SECTION("are the same on repeated lookups") {
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_port);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_port);
+  }
+
+  SECTION("depend on the port") {
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_port);
+    REQUIRE(ruleset.getFirstMatchingRule(moved_rule)->getRuleID() == Rule::DefaultID);
+  }
+
+  SECTION("are invalidated by rule set modifications") {
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_port);
+    const uint32_t id_block = ruleset.appendRule(Rule::fromString("block id 1234:5678"), 0);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_block);
+    REQUIRE(ruleset.getFirstMatchingRule(moved_rule)->getRuleID() == id_block);
+  }
+
+  SECTION("of the default rule use the current default target") {
+    REQUIRE(ruleset.getFirstMatchingRule(moved_rule)->getTarget() == Rule::Target::Block);
+    ruleset.setDefaultTarget(Rule::Target::Allow);
+    REQUIRE(ruleset.getFirstMatchingRule(moved_rule)->getTarget() == Rule::Target::Allow);
+  }
+}
+
+TEST_CASE("Hash-only rule matches", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 name \"good\" hash \"abcd\" parent-hash \"p1\""));
+  auto other_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 name \"evil\" hash \"efgh\" parent-hash \"p1\""));
+  auto moved_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 name \"good\" hash \"ijkl\" parent-hash \"p2\""));
+
+  const uint32_t id_block_name = ruleset.appendRule(Rule::fromString("block name \"evil\""));
+  const uint32_t id_allow_abcd = ruleset.appendRule(Rule::fromString("allow hash \"abcd\""));
+  const uint32_t id_allow_efgh = ruleset.appendRule(Rule::fromString("allow hash \"efgh\""));
+  const uint32_t id_reject_parent = ruleset.appendRule(Rule::fromString("reject hash \"ijkl\" parent-hash \"p1\""));
+  const uint32_t id_allow_ijkl = ruleset.appendRule(Rule::fromString("allow hash \"ijkl\""));
+
+  REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow_abcd);
+  REQUIRE(ruleset.getFirstMatchingRule(other_rule)->getRuleID() == id_block_name);
+  REQUIRE(ruleset.getFirstMatchingRule(moved_rule)->getRuleID() == id_allow_ijkl);
+  REQUIRE(ruleset.removeRule(id_block_name));
+  REQUIRE(ruleset.getFirstMatchingRule(other_rule)->getRuleID() == id_allow_efgh);
+  REQUIRE(ruleset.removeRule(id_allow_ijkl));
+  REQUIRE(ruleset.getFirstMatchingRule(moved_rule)->getRuleID() == Rule::DefaultID);
+  REQUIRE(id_reject_parent != Rule::DefaultID);
+}
+
+TEST_CASE("Rule set hash usage", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+
+  REQUIRE_FALSE(ruleset.usesDeviceHash());
+  ruleset.appendRule(Rule::fromString("allow id 1234:5678 via-port \"1-1\""));
+  REQUIRE_FALSE(ruleset.usesDeviceHash());
+
+  const uint32_t id_parent_hash = ruleset.appendRule(Rule::fromString("block parent-hash \"p1\""));
+  REQUIRE(ruleset.usesDeviceHash());
+  REQUIRE(ruleset.removeRule(id_parent_hash));
+  REQUIRE_FALSE(ruleset.usesDeviceHash());
+
+  ruleset.appendRule(Rule::fromString("allow hash \"abcd\""));
+  REQUIRE(ruleset.usesDeviceHash());
+}
+
+TEST_CASE("Interface rule matches", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" with-interface { 03:01:01 08:06:50 ff:00:00 }"));
+
+  const uint32_t id_block_storage = ruleset.appendRule(Rule::fromString("block with-interface 08:*:*"));
+  const uint32_t id_allow_hid = ruleset.appendRule(Rule::fromString("allow id 1234:5678 with-interface 03:*:*"));
+  const uint32_t id_reject_serial = ruleset.appendRule(Rule::fromString("reject serial \"0002\""));
+
+  SECTION("are found for each interface") {
+    const auto rules = ruleset.getFirstMatchingInterfaceRules(device_rule);
+    REQUIRE(rules.size() == 3);
+    REQUIRE(rules[0]->getRuleID() == id_allow_hid);
+    REQUIRE(rules[1]->getRuleID() == id_block_storage);
+    REQUIRE(rules[2]->getRuleID() == Rule::DefaultID);
+    REQUIRE(rules[2]->getTarget() == Rule::Target::Block);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == Rule::DefaultID);
+  }
+
+  SECTION("use the current default target") {
+    ruleset.setDefaultTarget(Rule::Target::Allow);
+    const auto rules = ruleset.getFirstMatchingInterfaceRules(device_rule);
+    REQUIRE(rules[2]->getRuleID() == Rule::DefaultID);
+    REQUIRE(rules[2]->getTarget() == Rule::Target::Allow);
+  }
+
+  SECTION("are found in rule set order") {
+    const uint32_t id_reject_first = ruleset.appendRule(Rule::fromString("reject serial \"0001\""), 0);
+    for (auto const& rule : ruleset.getFirstMatchingInterfaceRules(device_rule)) {
+      REQUIRE(rule->getRuleID() == id_reject_first);
+    }
+    REQUIRE(id_reject_serial != id_reject_first);
+  }
+
+  SECTION("respect rule conditions") {
+    const uint32_t id_never = ruleset.appendRule(Rule::fromString("reject with-interface 03:01:01 if false"), 0);
+    const uint32_t id_always = ruleset.appendRule(Rule::fromString("reject with-interface ff:00:00 if true"), 0);
+    const auto rules = ruleset.getFirstMatchingInterfaceRules(device_rule);
+    REQUIRE(rules[0]->getRuleID() == id_allow_hid);
+    REQUIRE(rules[2]->getRuleID() == id_always);
+    REQUIRE(id_never != id_always);
+  }
+}
+
+TEST_CASE("Applying rules", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  const Rule device_rule = Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\" with-interface 03:00:00");
+
+  const uint32_t id_block_storage = ruleset.appendRule(Rule::fromString("block with-interface 08:*:*"));
+  const uint32_t id_allow_serial = ruleset.appendRule(Rule::fromString("allow serial \"0001\""));
+  const uint32_t id_allow_other = ruleset.appendRule(Rule::fromString("allow hash \"efgh\""));
+  const uint32_t id_reject_id = ruleset.appendRule(Rule::fromString("reject id 1234:5678 if false"));
+  const uint32_t id_allow_hid = ruleset.appendRule(Rule::fromString("allow with-interface 03:*:*"));
+
+  auto ruleIDs = [&ruleset, &device_rule]() {
+    std::vector<uint32_t> ids;
+    for (auto const& rule : ruleset.getApplyingRules(device_rule)) {
+      ids.push_back(rule->getRuleID());
+    }
+    return ids;
+  };
+
+  SECTION("are found in rule set order, ignoring the conditions") {
+    REQUIRE(ruleIDs() == std::vector<uint32_t>({ id_allow_serial, id_reject_id, id_allow_hid }));
+    REQUIRE(id_block_storage != id_allow_other);
+  }
+
+  SECTION("are found in sealed rule sets") {
+    ruleset.setSealed(true);
+    REQUIRE(ruleIDs() == std::vector<uint32_t>({ id_allow_serial, id_reject_id, id_allow_hid }));
+  }
+
+  SECTION("don't affect the rule statistics") {
+    ruleIDs();
+    for (auto const& rule : ruleset.getRules()) {
+      REQUIRE(rule->getStatistics().evaluated == 0);
+    }
+  }
+}
+
+TEST_CASE("Rule set copies", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  const uint32_t id = ruleset.appendRule(Rule::fromString("allow serial \"0001\""));
+
+  SECTION("are not affected by later modifications") {
+    RuleSet copy = ruleset;
+    auto rules = ruleset.getRules();
+    REQUIRE(ruleset.upsertRule(Rule::fromString("allow serial \"0001\""), Rule::fromString("block serial \"0001\"")) == id);
+    REQUIRE(rules.size() == 1);
+    REQUIRE(rules[0]->getTarget() == Rule::Target::Allow);
+    REQUIRE(ruleset.getRule(id)->getTarget() == Rule::Target::Block);
+    REQUIRE(copy.getRule(id)->getTarget() == Rule::Target::Allow);
+    REQUIRE(ruleset.appendRule(Rule::fromString("reject")) != id);
+    REQUIRE(copy.getRules().size() == 1);
+  }
+}
+
+TEST_CASE("Rule lookup by id", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  const uint32_t id_a = ruleset.appendRule(Rule::fromString("allow serial \"0001\""));
+  const uint32_t id_b = ruleset.appendRule(Rule::fromString("block serial \"0002\""));
+  const uint32_t id_c = ruleset.appendRule(Rule::fromString("reject serial \"0003\""), id_a);
+
+  SECTION("returns the rule with the id") {
+    REQUIRE(ruleset.getRule(id_b)->getTarget() == Rule::Target::Block);
+    REQUIRE(ruleset.getRule(id_c)->getTarget() == Rule::Target::Reject);
+    REQUIRE_THROWS(ruleset.getRule(id_c + 1));
+  }
+
+  SECTION("preserves the order after removal") {
+    REQUIRE(ruleset.removeRule(id_c));
+    REQUIRE_THROWS(ruleset.getRule(id_c));
+    REQUIRE_THROWS(ruleset.removeRule(id_c));
+    auto rules = ruleset.getRules();
+    REQUIRE(rules.size() == 2);
+    REQUIRE(rules[0]->getRuleID() == id_a);
+    REQUIRE(rules[1]->getRuleID() == id_b);
+  }
+}
+
+TEST_CASE("Rule set batch", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  const uint32_t id_a = ruleset.appendRule(Rule::fromString("allow serial \"0001\""));
+
+  SECTION("applies all operations") {
+    std::vector<RuleSet::Operation> operations = {
+      RuleSet::Operation::append(Rule::fromString("block serial \"0002\"")),
+      RuleSet::Operation::append(Rule::fromString("reject serial \"0003\""), 0),
+      RuleSet::Operation::upsert(Rule::fromString("allow serial \"0001\""), Rule::fromString("block serial \"0001\"")),
+      RuleSet::Operation::remove(id_a)
+    };
+    const std::vector<uint32_t> ids = ruleset.applyBatch(operations);
+    REQUIRE(ids.size() == 4);
+    REQUIRE(ids[2] == id_a);
+    REQUIRE(ids[3] == id_a);
+    auto rules = ruleset.getRules();
+    REQUIRE(rules.size() == 2);
+    REQUIRE(rules[0]->getRuleID() == ids[1]);
+    REQUIRE(rules[1]->getRuleID() == ids[0]);
+  }
+
+  SECTION("leaves the rule set unchanged on failure") {
+    std::vector<RuleSet::Operation> operations = {
+      RuleSet::Operation::append(Rule::fromString("block serial \"0002\"")),
+      RuleSet::Operation::remove(id_a + 100)
+    };
+    REQUIRE_THROWS(ruleset.applyBatch(operations));
+    auto rules = ruleset.getRules();
+    REQUIRE(rules.size() == 1);
+    REQUIRE(rules[0]->getRuleID() == id_a);
+  }
+}
+
+TEST_CASE("Large rule set loading", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  std::stringstream stream;
+  const size_t rule_count = 4096;
+
+  for (size_t i = 0; i < rule_count; ++i) {
+    stream << (i % 2 ? "allow" : "block") << " serial \"" << i << "\"" << std::endl;
+    if (i % 7 == 0) {
+      stream << std::endl;
+    }
+  }
+
+  SECTION("preserves the rule order") {
+    REQUIRE_NOTHROW(ruleset.load(stream));
+    auto rules = ruleset.getRules();
+    REQUIRE(rules.size() == rule_count);
+    for (size_t i = 0; i < rule_count; ++i) {
+      REQUIRE(rules[i]->getRuleID() == i + 1);
+      REQUIRE(rules[i]->getSerial() == std::to_string(i));
+    }
+  }
+
+  SECTION("reports the first invalid line") {
+    stream << "allow serial" << std::endl;
+    stream << "allow foo" << std::endl;
+    try {
+      ruleset.load(stream);
+      FAIL("loading an invalid rule set didn't fail");
+    }
+    catch(const RuleParserError& ex) {
+      REQUIRE(ex.line() == rule_count + (rule_count + 6) / 7 + 1);
+    }
+    REQUIRE(ruleset.getRules().size() == 0);
+  }
+}
+
+static std::string createTemporaryFile()
+{
+  char path[] = "/tmp/usbguard-test.XXXXXX";
+  const int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  return path;
+}
+
+TEST_CASE("Rule set cache", "[RuleSet]") {
+  const std::string rule_path = createTemporaryFile();
+  const std::string cache_path = createTemporaryFile();
+  {
+    std::ofstream stream(rule_path);
+    stream << "allow id 1234:5678 serial \"0001\" with-interface { 03:00:00 08:*:* } if !rule-applied" << std::endl;
+    stream << "block name one-of { \"a\" \"b\" } via-port \"1-2\"" << std::endl;
+  }
+  RuleSet ruleset(nullptr);
+  ruleset.load(rule_path);
+
+  SECTION("contains the same rules") {
+    RuleSet cached(nullptr);
+    REQUIRE_NOTHROW(ruleset.saveCache(cache_path, rule_path));
+    REQUIRE(cached.loadCache(cache_path, rule_path));
+    auto rules = ruleset.getRules();
+    auto cached_rules = cached.getRules();
+    REQUIRE(cached_rules.size() == rules.size());
+    for (size_t i = 0; i < rules.size(); ++i) {
+      REQUIRE(cached_rules[i]->getRuleID() == rules[i]->getRuleID());
+      REQUIRE(cached_rules[i]->toString() == rules[i]->toString());
+    }
+  }
+
+  SECTION("is not used when the rule file changes") {
+    RuleSet cached(nullptr);
+    REQUIRE_NOTHROW(ruleset.saveCache(cache_path, rule_path));
+    {
+      std::ofstream stream(rule_path, std::ios::app);
+      stream << "reject" << std::endl;
+    }
+    REQUIRE_FALSE(cached.loadCache(cache_path, rule_path));
+    REQUIRE(cached.getRules().size() == 0);
+  }
+
+  SECTION("is not used when invalid") {
+    RuleSet cached(nullptr);
+    {
+      std::ofstream stream(cache_path);
+      stream << "garbage" << std::endl;
+    }
+    REQUIRE_FALSE(cached.loadCache(cache_path, rule_path));
+  }
+
+  unlink(rule_path.c_str());
+  unlink(cache_path.c_str());
+}
+
+TEST_CASE("Localtime condition", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\" with-interface 03:00:00"));
+
+  SECTION("full day range") {
+    const uint32_t id_never = ruleset.appendRule(Rule::fromString("block if !localtime(00:00-23:59:59)"));
+    const uint32_t id_always = ruleset.appendRule(Rule::fromString("allow if localtime(00:00:00-23:59:59)"));
+    REQUIRE(id_never != id_always);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_always);
+  }
+
+  SECTION("range wrapping around midnight") {
+    const uint32_t id_always = ruleset.appendRule(Rule::fromString("allow if localtime(12:00-11:59:59)"));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_always);
+  }
+
+  SECTION("invalid time") {
+    REQUIRE_THROWS(Rule::fromString("allow if localtime(24:00)"));
+    REQUIRE_THROWS(Rule::fromString("allow if localtime(12:00-12:60)"));
+  }
+}
+
+TEST_CASE("Condition state change times", "[RuleSet]") {
+  Rule rule = Rule::fromString("allow id 1234:5678");
+  EvaluationClock::TimePoint change_time;
+
+  SECTION("a localtime range changes within a day") {
+    const LocaltimeCondition condition("00:00-00:00:01");
+    const auto now = EvaluationClock::now();
+
+    REQUIRE(condition.nextStateChange(rule, change_time));
+    REQUIRE(change_time > now);
+    REQUIRE(change_time <= now + std::chrono::hours(24) + std::chrono::seconds(1));
+  }
+
+  SECTION("rule-applied changes when the duration elapses") {
+    const RuleAppliedCondition condition("10");
+    const RuleAppliedCondition condition_ever("");
+
+    REQUIRE_FALSE(condition.nextStateChange(rule, change_time));
+
+    rule.internal()->updateMetaDataCounters(/*applied=*/true);
+    const auto applied = rule.internal()->metadata().lastApplied();
+
+    REQUIRE(condition.nextStateChange(rule, change_time));
+    REQUIRE(change_time > applied + std::chrono::seconds(10));
+    REQUIRE(change_time < applied + std::chrono::seconds(11));
+    REQUIRE_FALSE(condition_ever.nextStateChange(rule, change_time));
+  }
+}
+
+TEST_CASE("Shared condition results", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\" with-interface 03:00:00"));
+
+  for (unsigned int i = 0; i < 16; ++i) {
+    ruleset.appendRule(Rule::fromString("block if { !true false }"));
+  }
+
+  SECTION("negated and plain conditions are evaluated consistently") {
+    const uint32_t id_reject = ruleset.appendRule(Rule::fromString("reject if !false"));
+    ruleset.appendRule(Rule::fromString("allow if true"));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_reject);
+  }
+
+  SECTION("rules with non-memoizable conditions are still evaluated") {
+    const uint32_t id_allow = ruleset.appendRule(Rule::fromString("allow if !rule-applied"));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow);
+  }
+}
+
+namespace {
+  /* A costly condition which counts its evaluations */
+  class CountingCondition : public RuleCondition
+  {
+  public:
+    CountingCondition(bool state, bool side_effects, unsigned int& count)
+      : RuleCondition("counting"),
+        _state(state),
+        _side_effects(side_effects),
+        _count(count)
+    {
+    }
+
+    bool update(const Rule& rule)
+    {
+      (void)rule;
+      ++_count;
+      return _state;
+    }
+
+    bool hasSideEffects() const
+    {
+      return _side_effects;
+    }
+
+    RuleCondition * clone() const
+    {
+      return new CountingCondition(*this);
+    }
+
+  private:
+    const bool _state;
+    const bool _side_effects;
+    unsigned int& _count;
+  };
+}
+
+TEST_CASE("Condition evaluation order", "[RuleSet]") {
+  const Rule device_rule = Rule::fromString("allow id 1234:5678");
+  unsigned int count = 0;
+
+  SECTION("cheap conditions decide before costly ones are evaluated") {
+    Rule rule = Rule::fromString("allow if all-of { true false }");
+    rule.attributeConditions().values().insert(rule.attributeConditions().values().begin(),
+                                               new CountingCondition(true, false, count));
+
+    REQUIRE_FALSE(rule.internal()->meetsConditions(device_rule, /*with_update=*/true));
+    REQUIRE(count == 0);
+  }
+
+  SECTION("one-of stops at the first true condition") {
+    Rule rule = Rule::fromString("allow if one-of { false true }");
+    rule.attributeConditions().values().push_back(new CountingCondition(false, false, count));
+
+    REQUIRE(rule.internal()->meetsConditions(device_rule, /*with_update=*/true));
+    REQUIRE(count == 0);
+  }
+
+  SECTION("costly conditions are evaluated when needed") {
+    Rule rule = Rule::fromString("allow if none-of { false false }");
+    rule.attributeConditions().values().push_back(new CountingCondition(true, false, count));
+
+    REQUIRE_FALSE(rule.internal()->meetsConditions(device_rule, /*with_update=*/true));
+    REQUIRE(count == 1);
+  }
+
+  SECTION("conditions with side effects are always evaluated") {
+    Rule rule = Rule::fromString("allow if all-of { false }");
+    rule.attributeConditions().values().push_back(new CountingCondition(true, true, count));
+
+    REQUIRE_FALSE(rule.internal()->meetsConditions(device_rule, /*with_update=*/true));
+    REQUIRE(count == 1);
+  }
+}
+
+namespace {
+  /* A pure condition which evaluates its sibling as well */
+  class BatchCondition : public RuleCondition
+  {
+  public:
+    BatchCondition(const String& parameter, const RuleCondition& sibling, unsigned int& count)
+      : RuleCondition("batch", parameter),
+        _sibling_key(sibling.key()),
+        _count(count)
+    {
+    }
+
+    bool update(const Rule& rule)
+    {
+      (void)rule;
+      ++_count;
+      return true;
+    }
+
+    void updateMany(const Rule& rule, EvaluationMemo& memo)
+    {
+      memo.emplace(key(), update(rule));
+      memo.emplace(_sibling_key, false);
+    }
+
+    bool isMemoizable() const
+    {
+      return true;
+    }
+
+    RuleCondition * clone() const
+    {
+      return new BatchCondition(*this);
+    }
+
+  private:
+    const uint32_t _sibling_key;
+    unsigned int& _count;
+  };
+}
+
+TEST_CASE("Batch condition evaluation", "[RuleSet]") {
+  const Rule device_rule;
+  unsigned int count = 0;
+  RuleCondition::EvaluationMemo memo;
+  CountingCondition sibling(true, false, count);
+  BatchCondition first("a", sibling, count);
+
+  SECTION("one evaluation stores the results of the sibling conditions") {
+    REQUIRE(first.evaluate(device_rule, &memo));
+    REQUIRE(memo.size() == 2);
+    REQUIRE(memo.at(sibling.key()) == false);
+    REQUIRE(first.evaluate(device_rule, &memo));
+    REQUIRE(count == 1);
+  }
+
+  SECTION("unknown condition modules are refused") {
+    REQUIRE(ConditionModule::find("batch") == nullptr);
+    REQUIRE_THROWS(ConditionModule::load("/nonexistent/usbguard-condition.so"));
+    REQUIRE(ConditionModule::identifiers().empty());
+  }
+}
+
+TEST_CASE("Rule match time statistics", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\" with-interface 03:00:00"));
+  const uint32_t id_allow = ruleset.appendRule(Rule::fromString("allow id 1234:5678"));
+
+  for (unsigned int i = 0; i < 3; ++i) {
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow);
+  }
+
+  const Rule::Statistics statistics = ruleset.getRule(id_allow)->getStatistics();
+  uint64_t passes = 0;
+
+  REQUIRE(statistics.match_time_histogram.size() == Rule::Statistics::MatchTimeBuckets);
+  for (auto count : statistics.match_time_histogram) {
+    passes += count;
+  }
+  REQUIRE(passes == 3);
+  REQUIRE(statistics.last_applied == 0);
+
+  ruleset.getFirstMatchingRule(device_rule)->updateMetaDataCounters(/*applied=*/true);
+  REQUIRE(ruleset.getRule(id_allow)->getStatistics().last_applied > 0);
+}
+
+TEST_CASE("Match traces", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\" with-interface 03:00:00"));
+  const uint32_t id_other = ruleset.appendRule(Rule::fromString("allow id 1234:0001"));
+  const uint32_t id_serial = ruleset.appendRule(Rule::fromString("allow id 1234:5678 serial \"0002\""));
+  const uint32_t id_false = ruleset.appendRule(Rule::fromString("block id 1234:5678 if false"));
+  const uint32_t id_allow = ruleset.appendRule(Rule::fromString("allow id 1234:5678 if true"));
+  ruleset.appendRule(Rule::fromString("reject"));
+
+  SECTION("end at the matching rule") {
+    const auto steps = ruleset.explainMatch(device_rule);
+
+    REQUIRE(steps.size() == 4);
+    REQUIRE(steps[0].rule_id == id_other);
+    REQUIRE(steps[0].rejected_by == "id");
+    REQUIRE(steps[1].rule_id == id_serial);
+    REQUIRE(steps[1].rejected_by == "serial");
+    REQUIRE(steps[2].rule_id == id_false);
+    REQUIRE(steps[2].rejected_by.empty());
+    REQUIRE_FALSE(steps[2].matched);
+    REQUIRE(steps[2].conditions.size() == 1);
+    REQUIRE(steps[2].conditions[0].first == "false");
+    REQUIRE_FALSE(steps[2].conditions[0].second);
+    REQUIRE(steps[3].rule_id == id_allow);
+    REQUIRE(steps[3].target == Rule::Target::Allow);
+    REQUIRE(steps[3].matched);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow);
+  }
+
+  SECTION("don't update the rule counters") {
+    ruleset.explainMatch(device_rule);
+    REQUIRE(ruleset.getRule(id_allow)->getStatistics().evaluated == 0);
+    REQUIRE(ruleset.getRule(id_allow)->internal()->conditionsState() == 0);
+  }
+}
+
+TEST_CASE("Rule groups", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0001\" hash \"abcd\" with-interface 08:06:50"));
+  const uint32_t id_lockdown = ruleset.appendRule(Rule::fromString("block with-interface 08:*:* group \"lockdown\""));
+  const uint32_t id_office = ruleset.appendRule(Rule::fromString("allow hash \"abcd\" group \"office\""));
+  const uint32_t id_other = ruleset.appendRule(Rule::fromString("reject id 1234:5678"));
+
+  REQUIRE(ruleset.getRule(id_office)->getGroup() == "office");
+  REQUIRE(ruleset.isGroupEnabled("lockdown"));
+  REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_lockdown);
+
+  SECTION("disabled groups are skipped") {
+    REQUIRE(ruleset.setGroupEnabled("lockdown", false));
+    REQUIRE_FALSE(ruleset.setGroupEnabled("lockdown", false));
+    REQUIRE_FALSE(ruleset.isGroupEnabled("lockdown"));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_office);
+
+    REQUIRE(ruleset.setGroupEnabled("office", false));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_other);
+    REQUIRE(ruleset.getFirstMatchingInterfaceRules(device_rule)[0]->getRuleID() == id_other);
+
+    REQUIRE(ruleset.setGroupEnabled("lockdown", true));
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_lockdown);
+  }
+
+  SECTION("sealed rule sets skip disabled groups") {
+    ruleset.setSealed(true);
+    ruleset.setGroupEnabled("lockdown", false);
+    REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_office);
+  }
+
+  SECTION("the group is written to the rule string") {
+    REQUIRE(ruleset.getRule(id_office)->toString() == "allow hash \"abcd\" group \"office\"");
+    REQUIRE_THROWS(ruleset.setGroupEnabled("", false));
+  }
+}
+
+TEST_CASE("One-of set rule matches", "[RuleSet]") {
+  RuleSet ruleset(nullptr);
+  auto device_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:5678 serial \"0002\" name \"disk\""));
+  auto other_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:9999 serial \"0004\" name \"disk\""));
+  auto wildcard_rule = makePointer<const Rule>(Rule::fromString("allow id 1234:* serial \"0001\""));
+
+  const uint32_t id_block = ruleset.appendRule(Rule::fromString("block id none-of { 1234:9999 1234:5678 } serial one-of { \"0003\" \"0001\" }"));
+  const uint32_t id_allow = ruleset.appendRule(Rule::fromString("allow id one-of { 1234:9999 1234:* 1234:5678 } serial one-of { \"0003\" \"0002\" \"0001\" }"));
+
+  REQUIRE(ruleset.getFirstMatchingRule(device_rule)->getRuleID() == id_allow);
+  REQUIRE(ruleset.getFirstMatchingRule(other_rule)->getRuleID() == Rule::DefaultID);
+  REQUIRE(ruleset.getFirstMatchingRule(wildcard_rule)->getRuleID() == id_allow);
+  REQUIRE(ruleset.getRule(id_block)->toString() == "block id none-of { 1234:9999 1234:5678 } serial one-of { \"0003\" \"0001\" }");
+}
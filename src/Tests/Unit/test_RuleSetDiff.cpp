@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <RuleSetDiff.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace usbguard;
+
+static Rule symbolRule(unsigned int symbol)
+{
+  char rule_spec[32];
+  snprintf(rule_spec, sizeof rule_spec, "allow id 1234:%04x", symbol);
+  return Rule::fromString(rule_spec);
+}
+
+static size_t lcsLength(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b)
+{
+  std::vector<std::vector<size_t>> table(a.size() + 1, std::vector<size_t>(b.size() + 1, 0));
+
+  for (size_t i = 1; i <= a.size(); ++i) {
+    for (size_t j = 1; j <= b.size(); ++j) {
+      table[i][j] = a[i - 1] == b[j - 1] ? table[i - 1][j - 1] + 1 : std::max(table[i - 1][j], table[i][j - 1]);
+    }
+  }
+  return table[a.size()][b.size()];
+}
+
+/*
+ * Diff the rule set against the target, apply the operations and
+ * check the result and the ids of the kept rules.
+ */
+static void checkDiff(const std::vector<unsigned int>& current, const std::vector<unsigned int>& target)
+{
+  RuleSet ruleset(nullptr);
+  std::vector<Rule> target_rules;
+
+  for (const unsigned int symbol : current) {
+    ruleset.appendRule(symbolRule(symbol));
+  }
+  for (const unsigned int symbol : target) {
+    target_rules.push_back(symbolRule(symbol));
+  }
+
+  const auto current_rules = ruleset.getRules();
+  const RuleSetDiff diff(current_rules, target_rules);
+
+  REQUIRE(diff.keptCount() == lcsLength(current, target));
+  REQUIRE(diff.removedCount() == current.size() - diff.keptCount());
+  REQUIRE(diff.insertedCount() == target.size() - diff.keptCount());
+
+  ruleset.applyBatch(diff.operations());
+  const auto rules = ruleset.getRules();
+  REQUIRE(rules.size() == target.size());
+
+  size_t kept_ids = 0;
+  for (size_t i = 0; i < rules.size(); ++i) {
+    REQUIRE(rules[i]->toString() == target_rules[i].toString());
+    for (auto const& current_rule : current_rules) {
+      if (current_rule->getRuleID() == rules[i]->getRuleID()) {
+        ++kept_ids;
+      }
+    }
+  }
+  REQUIRE(kept_ids == diff.keptCount());
+  return;
+}
+
+TEST_CASE("Rule set diff", "[RuleSetDiff]") {
+  SECTION("equal rule sets have no operations") {
+    RuleSet ruleset(nullptr);
+    ruleset.appendRule(symbolRule(1));
+    ruleset.appendRule(symbolRule(2));
+    const RuleSetDiff diff(ruleset.getRules(), { symbolRule(1), symbolRule(2) });
+    REQUIRE(diff.operations().empty());
+    REQUIRE(diff.keptCount() == 2);
+  }
+
+  SECTION("edits keep the rules around them") {
+    checkDiff({ }, { 1, 2, 3 });
+    checkDiff({ 1, 2, 3 }, { });
+    checkDiff({ 1, 2, 3 }, { 0, 1, 2, 3 });
+    checkDiff({ 1, 2, 3 }, { 1, 4, 5, 2, 3 });
+    checkDiff({ 1, 2, 3, 4 }, { 4, 3, 2, 1 });
+    checkDiff({ 1, 2, 3, 1, 2, 3 }, { 3, 2, 1, 3, 2, 1, 4 });
+  }
+
+  SECTION("the kept rules are a longest common subsequence") {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<unsigned int> symbol(0, 5);
+    std::uniform_int_distribution<size_t> length(0, 24);
+
+    for (int round = 0; round < 200; ++round) {
+      std::vector<unsigned int> current(length(generator));
+      std::vector<unsigned int> target(length(generator));
+      for (auto& value : current) {
+        value = symbol(generator);
+      }
+      for (auto& value : target) {
+        value = symbol(generator);
+      }
+      checkDiff(current, target);
+    }
+  }
+}
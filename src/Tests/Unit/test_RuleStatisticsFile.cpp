@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <RuleStatisticsFile.hpp>
+#include <ctime>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+using namespace usbguard;
+
+static uint32_t appendRule(RuleSet& ruleset, const std::string& rule_spec, uint64_t applied)
+{
+  const uint32_t id = ruleset.appendRule(Rule::fromString(rule_spec));
+  Rule::Statistics statistics;
+  statistics.evaluated = applied * 2;
+  statistics.applied = applied;
+  ruleset.setRuleStatistics(id, statistics);
+  return id;
+}
+
+static off_t fileSize(const std::string& path)
+{
+  struct stat st;
+  REQUIRE(stat(path.c_str(), &st) == 0);
+  return st.st_size;
+}
+
+TEST_CASE("Rule statistics file", "[RuleStatisticsFile]") {
+  char directory_template[] = "/tmp/usbguard-statistics.XXXXXX";
+  const std::string directory = mkdtemp(directory_template);
+  const std::string path = directory + "/rules.stats";
+
+  RuleSet ruleset(nullptr);
+  const uint32_t id_a = appendRule(ruleset, "allow id 1234:0001", 5);
+  appendRule(ruleset, "block id 1234:0002", 7);
+
+  SECTION("the counters follow the rule text") {
+    RuleStatisticsFile(path).checkpoint(ruleset.getRules());
+
+    RuleSet restored(nullptr);
+    const uint32_t id_new = appendRule(restored, "allow id 1234:0003", 0);
+    const uint32_t id_b = appendRule(restored, "block id 1234:0002", 0);
+    const uint32_t id_a2 = appendRule(restored, "allow id 1234:0001", 0);
+
+    RuleStatisticsFile file(path);
+    REQUIRE(file.restore(restored) == 2);
+    REQUIRE(restored.getRule(id_a2)->getStatistics().applied == 5);
+    REQUIRE(restored.getRule(id_a2)->getStatistics().evaluated == 10);
+    REQUIRE(restored.getRule(id_b)->getStatistics().applied == 7);
+    REQUIRE(restored.getRule(id_new)->getStatistics().applied == 0);
+  }
+
+  SECTION("only the changed counters are appended") {
+    RuleStatisticsFile file(path);
+    file.restore(ruleset);
+    file.checkpoint(ruleset.getRules());
+    const off_t size = fileSize(path);
+
+    file.checkpoint(ruleset.getRules());
+    REQUIRE(fileSize(path) == size);
+
+    Rule::Statistics statistics = ruleset.getRule(id_a)->getStatistics();
+    statistics.applied = 6;
+    ruleset.setRuleStatistics(id_a, statistics);
+    file.checkpoint(ruleset.getRules());
+    const off_t record_size = fileSize(path) - size;
+    REQUIRE(record_size > 0);
+
+    RuleSet restored(nullptr);
+    const uint32_t id = appendRule(restored, "allow id 1234:0001", 0);
+    RuleStatisticsFile(path).restore(restored);
+    REQUIRE(restored.getRule(id)->getStatistics().applied == 6);
+
+    /* A torn append leaves the previous record */
+    REQUIRE(truncate(path.c_str(), fileSize(path) - record_size / 2) == 0);
+    RuleStatisticsFile(path).restore(restored);
+    REQUIRE(restored.getRule(id)->getStatistics().applied == 5);
+  }
+
+  SECTION("the writer thread writes the last checkpoint") {
+    RuleStatisticsFile file(path);
+    file.start();
+    file.checkpoint(ruleset.getRules());
+    file.stop();
+
+    RuleSet restored(nullptr);
+    const uint32_t id = appendRule(restored, "block id 1234:0002", 0);
+    REQUIRE(RuleStatisticsFile(path).restore(restored) == 1);
+    REQUIRE(restored.getRule(id)->getStatistics().applied == 7);
+  }
+
+  SECTION("the wall-clock times are kept") {
+    const uint64_t now = time(nullptr);
+    Rule::Statistics statistics = ruleset.getRule(id_a)->getStatistics();
+    statistics.last_applied = now - 3600;
+    ruleset.setRuleStatistics(id_a, statistics);
+    REQUIRE(ruleset.getRule(id_a)->getStatistics().last_applied >= now - 3601);
+    REQUIRE(ruleset.getRule(id_a)->getStatistics().last_applied <= now - 3599);
+    REQUIRE(ruleset.getRule(id_a)->getStatistics().last_evaluated == 0);
+  }
+
+  unlink(path.c_str());
+  rmdir(directory.c_str());
+}
@@ -0,0 +1,68 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <StartupProfile.hpp>
+
+using namespace usbguard;
+
+TEST_CASE("Startup profile", "[StartupProfile]") {
+  const auto now = std::chrono::steady_clock::now();
+
+  StartupProfile::recordPhase("before-start", now, now + std::chrono::milliseconds(1));
+  StartupProfile::start();
+  {
+    StartupProfile::Scope phase("scoped");
+  }
+  StartupProfile::recordPhase("explicit", now, now + std::chrono::microseconds(250));
+  StartupProfile::recordDeviceLoad(2, std::chrono::microseconds(30));
+  StartupProfile::recordDeviceLoad(1, std::chrono::microseconds(10));
+  StartupProfile::recordDeviceDecision(1, std::chrono::microseconds(5));
+
+  SECTION("phases and devices are recorded until finish") {
+    const StartupProfile running = StartupProfile::get();
+    REQUIRE(running.ready_ns == 0);
+    REQUIRE(running.phases.size() == 2);
+    REQUIRE(running.phases[0].name == "scoped");
+    REQUIRE(running.phases[1].name == "explicit");
+    REQUIRE(running.phases[1].start_ns == 0);
+    REQUIRE(running.phases[1].duration_ns == 250000);
+    REQUIRE(running.devices.size() == 2);
+    REQUIRE(running.devices[0].id == 1);
+    REQUIRE(running.devices[0].load_ns == 10000);
+    REQUIRE(running.devices[0].decision_ns == 5000);
+    REQUIRE(running.devices[1].decision_ns == 0);
+
+    REQUIRE(StartupProfile::finish());
+    REQUIRE_FALSE(StartupProfile::finish());
+    StartupProfile::recordPhase("after-finish", now, now);
+    StartupProfile::recordDeviceLoad(3, std::chrono::microseconds(1));
+
+    const StartupProfile finished = StartupProfile::get();
+    REQUIRE(finished.ready_ns > 0);
+    REQUIRE(finished.phases.size() == 2);
+    REQUIRE(finished.devices.size() == 2);
+  }
+
+  SECTION("the summary lists the slowest devices") {
+    const String summary = StartupProfile::get().toString(1);
+    REQUIRE(summary.find("explicit +0us 250us") != String::npos);
+    REQUIRE(summary.find("2 devices; device 2 load 30us") != String::npos);
+    REQUIRE(summary.find("device 1 ") == String::npos);
+  }
+}
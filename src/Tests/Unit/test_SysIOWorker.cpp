@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <LinuxSysIO.hpp>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <vector>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace usbguard;
+
+static std::string readFile(const std::string& path)
+{
+  std::ifstream stream(path);
+  return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("Sysfs I/O worker", "[SysIOWorker]") {
+  char dir_template[] = "/tmp/usbguard-sysio.XXXXXX";
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string dir = dir_template;
+  const std::string authorized = dir + "/authorized";
+  const std::string remove = dir + "/remove";
+
+  std::ofstream(authorized) << "0";
+  std::ofstream(remove) << "0";
+
+  std::mutex mutex;
+  std::vector<std::pair<SysIORequest, int>> completed;
+
+  SysIOWorker worker([&mutex, &completed](const SysIORequest& request, int error) {
+    std::unique_lock<std::mutex> lock(mutex);
+    completed.emplace_back(request, error);
+  });
+
+  SECTION("requests are refused while the worker isn't running") {
+    REQUIRE(worker.submit(SYSIO_REQUEST_WRITE, authorized, 1, 1) == 0);
+    REQUIRE(readFile(authorized) == "0");
+  }
+
+  SECTION("requests complete in order with their status") {
+    worker.start();
+    REQUIRE(worker.running());
+    const uint64_t first = worker.submit(SYSIO_REQUEST_WRITE, authorized, 1, 1);
+    const uint64_t second = worker.submit(SYSIO_REQUEST_WRITE, dir + "/missing/authorized", 1, 2);
+    const uint64_t third = worker.submit(SYSIO_REQUEST_READ, authorized, 0, 3);
+    REQUIRE(first != 0);
+    REQUIRE(second > first);
+    REQUIRE(third > second);
+    worker.wait(third);
+
+    REQUIRE(readFile(authorized) == "1");
+    std::unique_lock<std::mutex> lock(mutex);
+    REQUIRE(completed.size() == 3);
+    REQUIRE(completed[0].first.id == 1);
+    REQUIRE(completed[0].second == 0);
+    REQUIRE(completed[1].first.id == 2);
+    REQUIRE(completed[1].second == ENOENT);
+    REQUIRE(completed[2].first.id == 3);
+    REQUIRE(completed[2].second == 0);
+    REQUIRE(completed[2].first.value == 1);
+  }
+
+  SECTION("all of the submitted requests complete when the worker stops") {
+    worker.start();
+    for (uint32_t id = 1; id <= 100; ++id) {
+      REQUIRE(worker.submit(SYSIO_REQUEST_WRITE, authorized, id % 2, id) != 0);
+    }
+    REQUIRE(worker.submit(SYSIO_REQUEST_WRITE, remove, 1, 101) != 0);
+    worker.stop();
+    REQUIRE_FALSE(worker.running());
+
+    REQUIRE(readFile(authorized) == "0");
+    REQUIRE(readFile(remove) == "1");
+    REQUIRE(completed.size() == 101);
+    for (size_t i = 0; i < completed.size(); ++i) {
+      REQUIRE(completed[i].first.id == i + 1);
+      REQUIRE(completed[i].second == 0);
+    }
+    REQUIRE(worker.submit(SYSIO_REQUEST_WRITE, authorized, 1, 102) == 0);
+  }
+
+  unlink(authorized.c_str());
+  unlink(remove.c_str());
+  rmdir(dir.c_str());
+}
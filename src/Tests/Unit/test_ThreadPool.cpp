@@ -0,0 +1,88 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include "Common/ThreadPool.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace usbguard;
+
+TEST_CASE("Thread pool", "[ThreadPool]") {
+  SECTION("all of the submitted jobs run before the pool stops") {
+    ThreadPool pool(4, 8);
+    std::atomic<size_t> done(0);
+
+    for (size_t i = 0; i < 1000; ++i) {
+      pool.submit([&done]() { ++done; });
+    }
+    pool.stop();
+    REQUIRE(pool.stopRequested());
+    REQUIRE(done == 1000);
+
+    /* Run by the caller after the pool stopped */
+    REQUIRE_FALSE(pool.trySubmit([&done]() { ++done; }));
+    pool.submit([&done]() { ++done; });
+    REQUIRE(done == 1001);
+  }
+
+  SECTION("parallelFor visits every index once") {
+    ThreadPool pool(4);
+    std::vector<std::atomic<unsigned>> visits(10000);
+
+    for (auto& visit : visits) {
+      visit = 0;
+    }
+    pool.parallelFor(visits.size(), [&visits](size_t i) { ++visits[i]; });
+
+    size_t visited_once = 0;
+    for (auto const& visit : visits) {
+      visited_once += (visit == 1 ? 1 : 0);
+    }
+    REQUIRE(visited_once == visits.size());
+  }
+
+  SECTION("parallelFor rethrows the error of the lowest index") {
+    ThreadPool pool(4);
+
+    for (size_t round = 0; round < 20; ++round) {
+      try {
+        pool.parallelFor(1000, [](size_t i) {
+          if (i == 700 || i == 300 || i == 900) {
+            throw std::runtime_error(std::to_string(i));
+          }
+        });
+        FAIL("no exception thrown");
+      }
+      catch(const std::runtime_error& ex) {
+        REQUIRE(std::string(ex.what()) == "300");
+      }
+    }
+  }
+
+  SECTION("parallelFor can be nested in a job") {
+    ThreadPool pool(2, 1);
+    std::atomic<size_t> sum(0);
+
+    pool.parallelFor(8, [&pool, &sum](size_t i) {
+      pool.parallelFor(100, [&sum](size_t j) { sum += j; });
+    });
+    REQUIRE(sum == 8 * 4950);
+  }
+}
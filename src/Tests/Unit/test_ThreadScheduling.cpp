@@ -0,0 +1,67 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include "Common/ThreadScheduling.hpp"
+#include <thread>
+
+using namespace usbguard;
+
+TEST_CASE("Thread scheduling", "[ThreadScheduling]") {
+  ThreadScheduling scheduling;
+
+  SECTION("nothing is set by default") {
+    REQUIRE(scheduling.empty());
+    REQUIRE(scheduling.apply());
+  }
+
+  SECTION("CPU lists") {
+    REQUIRE(scheduling.setCPUs("0"));
+    REQUIRE_FALSE(scheduling.empty());
+    REQUIRE(scheduling.setCPUs("0,2-3"));
+    REQUIRE(scheduling.setCPUs("1-1"));
+    REQUIRE_FALSE(scheduling.setCPUs(""));
+    REQUIRE_FALSE(scheduling.setCPUs("0,"));
+    REQUIRE_FALSE(scheduling.setCPUs("3-1"));
+    REQUIRE_FALSE(scheduling.setCPUs("-1"));
+    REQUIRE_FALSE(scheduling.setCPUs("a"));
+    REQUIRE_FALSE(scheduling.setCPUs("100000"));
+  }
+
+  SECTION("policies") {
+    REQUIRE(scheduling.setPolicy("other"));
+    REQUIRE_FALSE(scheduling.empty());
+    REQUIRE(scheduling.setPolicy("other:-5"));
+    REQUIRE(scheduling.setPolicy("batch:10"));
+    REQUIRE(scheduling.setPolicy("idle"));
+    REQUIRE(scheduling.setPolicy("fifo:10"));
+    REQUIRE(scheduling.setPolicy("rr:99"));
+    REQUIRE_FALSE(scheduling.setPolicy("fifo"));
+    REQUIRE_FALSE(scheduling.setPolicy("fifo:0"));
+    REQUIRE_FALSE(scheduling.setPolicy("rr:100"));
+    REQUIRE_FALSE(scheduling.setPolicy("other:20"));
+    REQUIRE_FALSE(scheduling.setPolicy("idle:1"));
+    REQUIRE_FALSE(scheduling.setPolicy("deadline"));
+    REQUIRE_FALSE(scheduling.setPolicy(""));
+  }
+
+  SECTION("the current thread can be lowered") {
+    std::thread thread([]() { REQUIRE(ThreadScheduling::lowerPriority(1)); });
+    thread.join();
+  }
+}
@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <Common/TimerWheel.hpp>
+
+#include <algorithm>
+
+using namespace usbguard;
+
+TEST_CASE("Timer wheel", "[Utility]") {
+  SECTION("empty wheel") {
+    TimerWheel wheel(100);
+    std::vector<TimerWheel::ID> expired;
+
+    REQUIRE(wheel.empty());
+    REQUIRE(wheel.nextTick() == 100);
+    REQUIRE_NOTHROW(wheel.advance(1000, expired));
+    REQUIRE(expired.empty());
+    REQUIRE(wheel.currentTick() == 1000);
+  }
+
+  SECTION("entries expire exactly at their tick") {
+    TimerWheel wheel(10);
+    std::vector<TimerWheel::ID> expired;
+
+    wheel.schedule(1, 15);
+    wheel.schedule(2, 10 + 64 * 3 + 5);
+    wheel.schedule(3, 10 + 64 * 64 * 7);
+    REQUIRE(wheel.size() == 3);
+
+    wheel.advance(14, expired);
+    REQUIRE(expired.empty());
+    wheel.advance(15, expired);
+    REQUIRE(expired == std::vector<TimerWheel::ID>({ 1 }));
+
+    expired.clear();
+    wheel.advance(10 + 64 * 3 + 4, expired);
+    REQUIRE(expired.empty());
+    wheel.advance(10 + 64 * 3 + 5, expired);
+    REQUIRE(expired == std::vector<TimerWheel::ID>({ 2 }));
+
+    expired.clear();
+    wheel.advance(10 + 64 * 64 * 7 - 1, expired);
+    REQUIRE(expired.empty());
+    wheel.advance(10 + 64 * 64 * 7, expired);
+    REQUIRE(expired == std::vector<TimerWheel::ID>({ 3 }));
+    REQUIRE(wheel.empty());
+  }
+
+  SECTION("a long gap expires everything due at once") {
+    TimerWheel wheel(0);
+    std::vector<TimerWheel::ID> expired;
+
+    for (TimerWheel::ID id = 1; id <= 100; ++id) {
+      wheel.schedule(id, id * 1000);
+    }
+
+    wheel.advance(50000, expired);
+    std::sort(expired.begin(), expired.end());
+    REQUIRE(expired.size() == 50);
+    REQUIRE(expired.front() == 1);
+    REQUIRE(expired.back() == 50);
+    REQUIRE(wheel.size() == 50);
+  }
+
+  SECTION("rescheduling and cancelling") {
+    TimerWheel wheel(0);
+    std::vector<TimerWheel::ID> expired;
+
+    wheel.schedule(1, 100);
+    wheel.schedule(1, 200);
+    wheel.schedule(2, 100);
+    REQUIRE(wheel.size() == 2);
+    REQUIRE(wheel.cancel(2));
+    REQUIRE_FALSE(wheel.cancel(2));
+    REQUIRE_FALSE(wheel.isScheduled(2));
+
+    wheel.advance(199, expired);
+    REQUIRE(expired.empty());
+    wheel.advance(200, expired);
+    REQUIRE(expired == std::vector<TimerWheel::ID>({ 1 }));
+  }
+
+  SECTION("past expiration times expire on the next tick") {
+    TimerWheel wheel(500);
+    std::vector<TimerWheel::ID> expired;
+
+    wheel.schedule(1, 10);
+    REQUIRE(wheel.nextTick() == 501);
+    wheel.advance(501, expired);
+    REQUIRE(expired == std::vector<TimerWheel::ID>({ 1 }));
+  }
+
+  SECTION("expiration times beyond the wheel range") {
+    const TimerWheel::Tick far = TimerWheel::Tick(1) << 30;
+    TimerWheel wheel(0);
+    std::vector<TimerWheel::ID> expired;
+
+    wheel.schedule(1, far);
+    wheel.advance(far - 1, expired);
+    REQUIRE(expired.empty());
+    wheel.advance(far, expired);
+    REQUIRE(expired == std::vector<TimerWheel::ID>({ 1 }));
+  }
+}
@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <USB.hpp>
+
+#include <sstream>
+
+using namespace usbguard;
+
+static const uint8_t descriptor_data[] = {
+  /* Device */
+  0x12, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40, 0x34, 0x12,
+  0x78, 0x56, 0x00, 0x01, 0x01, 0x02, 0x03, 0x01,
+  /* Configuration */
+  0x09, 0x02, 0x19, 0x00, 0x01, 0x01, 0x00, 0x80, 0x32,
+  /* Interface */
+  0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01, 0x00,
+  /* Endpoint */
+  0x07, 0x05, 0x81, 0x03, 0x08, 0x00, 0x0a
+};
+
+static void setHandlers(USBDescriptorParser& parser, std::vector<uint8_t>& types)
+{
+  auto record_type = [&types](USBDescriptorParser*, const USBDescriptor* descriptor) {
+    types.push_back(descriptor->bHeader.bDescriptorType);
+  };
+
+  parser.setHandler(USB_DESCRIPTOR_TYPE_DEVICE, sizeof (USBDeviceDescriptor),
+                    USBParseDeviceDescriptor, record_type);
+  parser.setHandler(USB_DESCRIPTOR_TYPE_CONFIGURATION, sizeof (USBConfigurationDescriptor),
+                    USBParseConfigurationDescriptor, record_type);
+  parser.setHandler(USB_DESCRIPTOR_TYPE_INTERFACE, sizeof (USBInterfaceDescriptor),
+                    USBParseInterfaceDescriptor, record_type);
+  parser.setHandler(USB_DESCRIPTOR_TYPE_ENDPOINT, sizeof (USBEndpointDescriptor),
+                    USBParseEndpointDescriptor, record_type);
+  return;
+}
+
+TEST_CASE("Descriptor parsing from a buffer", "[USBDescriptorParser]") {
+  USBDescriptorParser stream_parser;
+  USBDescriptorParser buffer_parser;
+  std::vector<uint8_t> stream_types;
+  std::vector<uint8_t> buffer_types;
+
+  setHandlers(stream_parser, stream_types);
+  setHandlers(buffer_parser, buffer_types);
+
+  SECTION("matches parsing from a stream") {
+    std::istringstream stream(std::string(reinterpret_cast<const char*>(descriptor_data), sizeof descriptor_data));
+
+    REQUIRE(stream_parser.parse(stream) == sizeof descriptor_data);
+    REQUIRE(buffer_parser.parse(descriptor_data, sizeof descriptor_data) == sizeof descriptor_data);
+    REQUIRE(buffer_types == stream_types);
+    REQUIRE(buffer_types == std::vector<uint8_t>({ 0x01, 0x02, 0x04, 0x05 }));
+    REQUIRE(buffer_parser.getDescriptorCounts().size() == stream_parser.getDescriptorCounts().size());
+  }
+
+  SECTION("rejects truncated data") {
+    REQUIRE_THROWS(buffer_parser.parse(descriptor_data, sizeof descriptor_data - 1));
+    REQUIRE_THROWS(buffer_parser.parse(descriptor_data, 1));
+  }
+
+  SECTION("accepts empty data") {
+    REQUIRE(buffer_parser.parse(descriptor_data, 0) == 0);
+    REQUIRE(buffer_types.empty());
+  }
+}
+
+class TestSpanHandler
+{
+public:
+  void deviceDescriptor(const USBDescriptorView& descriptor)
+  {
+    views.push_back(descriptor.data());
+  }
+
+  void configurationDescriptor(const USBDescriptorView& descriptor)
+  {
+    views.push_back(descriptor.data());
+  }
+
+  void interfaceDescriptor(const USBDescriptorView& descriptor)
+  {
+    interface_class = descriptor.as<USBInterfaceDescriptor>().bInterfaceClass;
+    views.push_back(descriptor.data());
+  }
+
+  void endpointDescriptor(const USBDescriptorView& descriptor)
+  {
+    views.push_back(descriptor.data());
+  }
+
+  std::vector<const uint8_t *> views;
+  uint8_t interface_class = 0;
+};
+
+TEST_CASE("Descriptor parsing in place", "[USBDescriptorParser]") {
+  TestSpanHandler handler;
+
+  SECTION("emits views into the buffer") {
+    REQUIRE(USBParseDescriptorSpan(descriptor_data, sizeof descriptor_data, handler) == sizeof descriptor_data);
+    REQUIRE(handler.views.size() == 4);
+    REQUIRE(handler.views[0] == descriptor_data);
+    REQUIRE(handler.views[1] == descriptor_data + 18);
+    REQUIRE(handler.views[2] == descriptor_data + 27);
+    REQUIRE(handler.views[3] == descriptor_data + 36);
+    REQUIRE(handler.interface_class == 0x03);
+  }
+
+  SECTION("skips unknown descriptor types") {
+    const uint8_t data[] = { 0x04, 0x24, 0x01, 0x02, 0x07, 0x05, 0x81, 0x03, 0x08, 0x00, 0x0a };
+
+    REQUIRE(USBParseDescriptorSpan(data, sizeof data, handler) == sizeof data);
+    REQUIRE(handler.views.size() == 1);
+    REQUIRE(handler.views[0] == data + 4);
+  }
+
+  SECTION("rejects invalid data") {
+    const uint8_t bad_length[] = { 0x08, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01 };
+
+    REQUIRE_THROWS(USBParseDescriptorSpan(bad_length, sizeof bad_length, handler));
+    REQUIRE_THROWS(USBParseDescriptorSpan(descriptor_data, sizeof descriptor_data - 1, handler));
+  }
+}
@@ -0,0 +1,120 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <USBTrafficMonitor.hpp>
+#include <RuleCondition.hpp>
+#include <Rule.hpp>
+#include <cstring>
+#include <memory>
+
+using namespace usbguard;
+
+static USBMonHeader makeEvent(uint8_t type, uint16_t busnum, uint8_t devnum, int64_t ts_sec, uint32_t length)
+{
+  USBMonHeader header;
+  memset(&header, 0, sizeof header);
+  header.type = type;
+  header.xfer_type = 1; /* interrupt */
+  header.epnum = 0x81;
+  header.busnum = busnum;
+  header.devnum = devnum;
+  header.flag_setup = '-';
+  header.ts_sec = ts_sec;
+  header.len_urb = length;
+  return header;
+}
+
+static USBMonHeader makeSetAddress(uint16_t busnum, uint8_t address)
+{
+  USBMonHeader header = makeEvent('S', busnum, 0, 0, 0);
+  header.xfer_type = 2; /* control */
+  header.epnum = 0;
+  header.flag_setup = 0;
+  header.setup[0] = 0x00;
+  header.setup[1] = 0x05;
+  header.setup[2] = address;
+  return header;
+}
+
+TEST_CASE("USB traffic monitor counters", "[USBTrafficMonitor]") {
+  USBTrafficMonitor& monitor = USBTrafficMonitor::instance();
+  monitor.reset();
+
+  SECTION("count completed transfers only") {
+    monitor.processEvent(makeEvent('S', 1, 5, 100, 8));
+    monitor.processEvent(makeEvent('C', 1, 5, 100, 8));
+    monitor.processEvent(makeEvent('C', 1, 5, 100, 4));
+    monitor.processEvent(makeEvent('E', 1, 5, 100, 0));
+
+    const auto counters = monitor.getCounters(1, 5);
+    REQUIRE(counters.transfers == 2);
+    REQUIRE(counters.bytes == 12);
+    REQUIRE(monitor.getStatistics().events == 4);
+    REQUIRE(monitor.getCounters(1, 6).transfers == 0);
+    REQUIRE(monitor.getCounters(2, 5).transfers == 0);
+  }
+
+  SECTION("record the peak rate per second") {
+    for (int i = 0; i < 10; ++i) {
+      monitor.processEvent(makeEvent('C', 3, 2, 200, 8));
+    }
+    for (int i = 0; i < 3; ++i) {
+      monitor.processEvent(makeEvent('C', 3, 2, 201, 8));
+    }
+
+    const auto counters = monitor.getCounters(3, 2);
+    REQUIRE(counters.transfers == 13);
+    REQUIRE(counters.peak_rate == 10);
+    REQUIRE(counters.current_rate == 3);
+  }
+
+  SECTION("are reset when the device number is assigned again") {
+    monitor.processEvent(makeEvent('C', 1, 7, 300, 8));
+    REQUIRE(monitor.getCounters(1, 7).transfers == 1);
+    monitor.processEvent(makeSetAddress(1, 7));
+    REQUIRE(monitor.getCounters(1, 7).transfers == 0);
+    REQUIRE(monitor.getCounters(1, 7).peak_rate == 0);
+  }
+
+  SECTION("ignore out of range device numbers") {
+    monitor.processEvent(makeEvent('C', 1000, 5, 100, 8));
+    monitor.processEvent(makeEvent('C', 1, 200, 100, 8));
+    REQUIRE(monitor.getCounters(1000, 5).transfers == 0);
+    REQUIRE(monitor.getCounters(1, 200).transfers == 0);
+  }
+
+  monitor.reset();
+}
+
+TEST_CASE("USB traffic rate condition", "[USBTrafficMonitor]") {
+  SECTION("requires a transfer rate") {
+    REQUIRE_THROWS(delete RuleCondition::getImplementation("usb-traffic-rate"));
+    REQUIRE_THROWS(delete RuleCondition::getImplementation("usb-traffic-rate(fast)"));
+    REQUIRE_THROWS(delete RuleCondition::getImplementation("usb-traffic-rate(-1)"));
+  }
+
+  SECTION("is false while the monitor isn't running") {
+    std::unique_ptr<RuleCondition> condition(RuleCondition::getImplementation("usb-traffic-rate(0)"));
+    Rule device_rule;
+    device_rule.attributeViaPort().append("1-1");
+    REQUIRE(condition->toString() == "usb-traffic-rate(0)");
+    REQUIRE_FALSE(USBTrafficMonitor::instance().running());
+    REQUIRE_FALSE(condition->evaluate(device_rule));
+  }
+}
@@ -0,0 +1,190 @@
+//
+// Copyright (C) 2016 Red Hat, Inc.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Daniel Kopecek <dkopecek@redhat.com>
+//
+#include <catch.hpp>
+#include <VirtualDeviceManager.hpp>
+#include <DeviceManagerHooks.hpp>
+#include <Device.hpp>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <ftw.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace usbguard;
+
+namespace
+{
+  class TestDeviceManagerHooks : public DeviceManagerHooks
+  {
+  public:
+    void dmHookDeviceInserted(Pointer<Device> device)
+    {
+      (void)device;
+      ++inserted;
+    }
+
+    void dmHookDevicesPresent(const PointerVector<Device>& devices)
+    {
+      present += devices.size();
+    }
+
+    void dmHookDeviceRemoved(Pointer<Device> device)
+    {
+      (void)device;
+      ++removed;
+    }
+
+    void dmHookDevicesRemoved(const PointerVector<Device>& devices)
+    {
+      removed += devices.size();
+    }
+
+    uint32_t dmHookAssignID()
+    {
+      return ++_id;
+    }
+
+    std::atomic<size_t> inserted { 0 };
+    std::atomic<size_t> present { 0 };
+    std::atomic<size_t> removed { 0 };
+
+  private:
+    uint32_t _id = 0;
+  };
+
+  int removeEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+  {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return ::remove(path);
+  }
+
+  void removeTree(const String& path)
+  {
+    nftw(path.c_str(), removeEntry, 16, FTW_DEPTH|FTW_PHYS);
+  }
+
+  bool waitFor(const std::atomic<size_t>& counter, size_t value)
+  {
+    for (int i = 0; i < 500 && counter < value; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return counter == value;
+  }
+
+  uint32_t deviceID(VirtualDeviceManager& manager, const String& name)
+  {
+    return manager.getIDFromName(name);
+  }
+}
+
+TEST_CASE("Virtual device names", "[VirtualDeviceManager]") {
+  REQUIRE(VirtualDeviceManager::parentName("usb1").empty());
+  REQUIRE(VirtualDeviceManager::parentName("1-2") == "usb1");
+  REQUIRE(VirtualDeviceManager::parentName("12-2.3") == "12-2");
+  REQUIRE(VirtualDeviceManager::parentName("2-1.4.3") == "2-1.4");
+  REQUIRE_THROWS(VirtualDeviceManager::parentName("foo"));
+
+  StringVector names = { "2-1.1", "1-1", "usb2", "2-1", "usb1" };
+  VirtualDeviceManager::sortParentsFirst(names);
+  REQUIRE(names == StringVector({ "usb1", "usb2", "1-1", "2-1", "2-1.1" }));
+}
+
+TEST_CASE("Virtual sysfs tree", "[VirtualDeviceManager]") {
+  char dir_template[] = "/tmp/usbguard-sysfs.XXXXXX";
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const String root(dir_template);
+
+  VirtualDeviceManager::Layout layout;
+  layout.buses = 2;
+  layout.hub_ports = 2;
+  layout.devices = 5;
+
+  const StringVector names = VirtualDeviceManager::generate(root, layout);
+  REQUIRE(names == StringVector({ "usb1", "1-1", "1-2", "usb2", "2-1", "2-1.1", "2-1.2", "2-2", "2-2.1" }));
+
+  TestDeviceManagerHooks hooks;
+  VirtualDeviceManager manager(hooks);
+  manager.setSysfsRoot(root);
+
+  SECTION("enumerate the present devices") {
+    manager.scan();
+    REQUIRE(hooks.present == names.size());
+    REQUIRE(manager.getDeviceList().size() == names.size());
+
+    auto root_hub = manager.getDevice(deviceID(manager, "usb2"));
+    auto hub = manager.getDevice(deviceID(manager, "2-1"));
+    auto device = manager.getDevice(deviceID(manager, "2-1.2"));
+
+    REQUIRE(root_hub->isController());
+    REQUIRE_FALSE(hub->isController());
+    REQUIRE(root_hub->getParentID() == Rule::RootID);
+    REQUIRE(hub->getParentID() == root_hub->getID());
+    REQUIRE(device->getParentID() == hub->getID());
+    REQUIRE(device->getDeviceID().getVendorID() == "1209");
+    REQUIRE(device->getDeviceID().getProductID() == "0001");
+    REQUIRE(device->getInterfaceTypes() == std::vector<USBInterfaceType>({ USBInterfaceType(0x08, 0x06, 0x50) }));
+    REQUIRE(device->getSerial() == "00000003");
+    REQUIRE(device->getTarget() == Rule::Target::Block);
+    REQUIRE(manager.getDeviceSubtree(root_hub->getID()).size() == 6);
+  }
+
+  SECTION("apply targets to the tree") {
+    manager.scan();
+    const uint32_t id = deviceID(manager, "1-2");
+
+    manager.allowDevice(id);
+    std::ifstream authorized(root + "/devices/1-2/authorized");
+    String value;
+    authorized >> value;
+    REQUIRE(value == "1");
+    REQUIRE(manager.getDevice(id)->getTarget() == Rule::Target::Allow);
+  }
+
+  SECTION("process the device events") {
+    for (auto const& name : names) {
+      REQUIRE(unlink((root + "/bus/usb/devices/" + name).c_str()) == 0);
+    }
+
+    manager.start();
+    REQUIRE(waitFor(hooks.present, 0));
+
+    for (auto const& name : { "usb2", "2-1", "2-1.1", "2-1.2" }) {
+      manager.injectEvent("add", name);
+    }
+    REQUIRE(waitFor(hooks.inserted, 4));
+    REQUIRE(manager.getDeviceList().size() == 4);
+
+    /* The rejected device is removed */
+    manager.rejectDevice(deviceID(manager, "2-1.1"));
+    REQUIRE(waitFor(hooks.removed, 1));
+
+    /* Unplugging the hub removes the devices behind it */
+    manager.injectEvent("remove", "2-1");
+    REQUIRE(waitFor(hooks.removed, 3));
+    REQUIRE(manager.getDeviceList().size() == 1);
+
+    manager.stop();
+  }
+
+  removeTree(root);
+}